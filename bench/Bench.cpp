@@ -0,0 +1,633 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include <dawn-gfx/FrameReplay.h>
+#include <dawn-gfx/Renderer.h>
+#include <dawn-gfx/Shader.h>
+#include <dawn-gfx/Trace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace dw::gfx;
+
+// Allocation counting. Every allocation made through the global operator new is counted, so that
+// workloads can report how many allocations a frame makes on the submit and render threads.
+namespace {
+std::atomic<u64> allocation_count{0};
+
+void* countedAllocate(std::size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size > 0 ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc{};
+}
+}  // namespace
+
+void* operator new(std::size_t size) {
+    return countedAllocate(size);
+}
+
+void* operator new[](std::size_t size) {
+    return countedAllocate(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+// JSON results are written to stdout, so only warnings and errors are logged (to stderr).
+class StderrLogger : public Logger {
+public:
+    void log(LogLevel level, const std::string& str) const override {
+        if (level == LogLevel::Warning || level == LogLevel::Error) {
+            std::cerr << str << std::endl;
+        }
+    }
+};
+
+const char* rendererTypeToString(RendererType renderer) {
+    switch (renderer) {
+        case RendererType::Vulkan:
+            return "Vulkan";
+        case RendererType::OpenGL:
+            return "OpenGL";
+        case RendererType::Null:
+            return "Null";
+        default:
+            return "<unknown>";
+    }
+}
+
+ShaderStageInfo compileShader(ShaderStage stage, const std::string& source) {
+    auto spv_result = compileGLSL(stage, source);
+    if (!spv_result) {
+        throw std::runtime_error("Failed to compile benchmark shader: " +
+                                 spv_result.error().compile_error);
+    }
+    return std::move(*spv_result);
+}
+
+// A vertex shader which adds up 'uniform_count' vec4 uniforms named u0, u1, ...
+std::string uniformVertexShader(uint uniform_count) {
+    std::string uniforms;
+    std::string sum = "vec4(0.0)";
+    for (uint i = 0; i < uniform_count; ++i) {
+        uniforms += fmt::format("    vec4 u{};\n", i);
+        sum += fmt::format(" + u{}", i);
+    }
+    std::string source =
+        "#version 450 core\n"
+        "layout(location = 0) in vec2 in_position;\n"
+        "layout(location = 1) in vec2 in_texcoord;\n"
+        "layout(location = 0) out vec2 out_texcoord;\n";
+    if (uniform_count > 0) {
+        source += "layout(binding = 0) uniform PerDraw {\n" + uniforms + "};\n";
+    }
+    source +=
+        "void main() {\n"
+        "    out_texcoord = in_texcoord;\n"
+        "    gl_Position = vec4(in_position, 0.0, 1.0) + (" +
+        sum +
+        ") * 0.0001;\n"
+        "}\n";
+    return source;
+}
+
+const char* kColourFragmentShader =
+    "#version 450 core\n"
+    "layout(location = 0) in vec2 in_texcoord;\n"
+    "layout(location = 0) out vec4 out_colour;\n"
+    "void main() {\n"
+    "    out_colour = vec4(in_texcoord, 0.0, 1.0);\n"
+    "}\n";
+
+const char* kTexturedFragmentShader =
+    "#version 450 core\n"
+    "layout(location = 0) in vec2 in_texcoord;\n"
+    "layout(location = 0) out vec4 out_colour;\n"
+    "layout(binding = 1) uniform sampler2D diffuse_texture;\n"
+    "void main() {\n"
+    "    out_colour = texture(diffuse_texture, in_texcoord);\n"
+    "}\n";
+
+VertexDecl quadVertexDecl() {
+    VertexDecl decl;
+    decl.begin()
+        .add(VertexDecl::Attribute::Position, 2, VertexDecl::AttributeType::Float)
+        .add(VertexDecl::Attribute::TexCoord0, 2, VertexDecl::AttributeType::Float)
+        .end();
+    return decl;
+}
+
+struct QuadVertex {
+    float x, y, u, v;
+};
+
+// A small quad at a position determined by an index, so that draws don't overlap exactly.
+void writeQuad(QuadVertex* vertices, u16* indices, uint index, u16 base_vertex) {
+    float x = static_cast<float>(index % 64) / 32.0f - 1.0f;
+    float y = static_cast<float>((index / 64) % 64) / 32.0f - 1.0f;
+    float size = 1.0f / 32.0f;
+    vertices[0] = {x, y, 0.0f, 0.0f};
+    vertices[1] = {x + size, y, 1.0f, 0.0f};
+    vertices[2] = {x + size, y + size, 1.0f, 1.0f};
+    vertices[3] = {x, y + size, 0.0f, 1.0f};
+    const u16 quad_indices[] = {0, 1, 2, 2, 3, 0};
+    for (uint i = 0; i < 6; ++i) {
+        indices[i] = static_cast<u16>(base_vertex + quad_indices[i]);
+    }
+}
+
+class Workload {
+public:
+    virtual ~Workload() = default;
+    virtual std::string name() const = 0;
+    virtual void start(Renderer& r) = 0;
+    virtual void submit(Renderer& r, uint frame) = 0;
+    virtual void stop(Renderer& r) = 0;
+};
+
+// Resources shared by the workloads: a static quad and a program with a given number of uniforms.
+class QuadWorkload : public Workload {
+public:
+    explicit QuadWorkload(uint uniform_count, bool textured = false)
+        : uniform_count_(uniform_count), textured_(textured) {
+    }
+
+    void start(Renderer& r) override {
+        auto vs = compileShader(ShaderStage::Vertex, uniformVertexShader(uniform_count_));
+        auto fs = compileShader(ShaderStage::Fragment,
+                                textured_ ? kTexturedFragmentShader : kColourFragmentShader);
+        program_ = r.createProgram({vs, fs});
+        for (uint i = 0; i < uniform_count_; ++i) {
+            uniforms_.emplace_back(r.createUniform(fmt::format("u{}", i)));
+        }
+
+        QuadVertex vertices[4];
+        u16 indices[6];
+        writeQuad(vertices, indices, 0, 0);
+        vb_ = r.createVertexBuffer(Memory(vertices, sizeof(vertices)), quadVertexDecl());
+        ib_ = r.createIndexBuffer(Memory(indices, sizeof(indices)), IndexBufferType::U16);
+    }
+
+    void stop(Renderer& r) override {
+        r.deleteIndexBuffer(ib_);
+        r.deleteVertexBuffer(vb_);
+        r.deleteProgram(program_);
+    }
+
+protected:
+    void setUniforms(Renderer& r, uint draw) {
+        for (uint i = 0; i < uniforms_.size(); ++i) {
+            r.setUniform(uniforms_[i], Vec4{static_cast<float>(draw), static_cast<float>(i),
+                                            0.0f, 1.0f});
+        }
+    }
+
+    uint uniform_count_;
+    bool textured_;
+    ProgramHandle program_;
+    std::vector<UniformHandle> uniforms_;
+    VertexBufferHandle vb_;
+    IndexBufferHandle ib_;
+};
+
+// N draws of a static quad, each setting M uniforms.
+class DrawsWorkload : public QuadWorkload {
+public:
+    DrawsWorkload(uint draw_count, uint uniform_count)
+        : QuadWorkload(uniform_count), draw_count_(draw_count) {
+    }
+
+    std::string name() const override {
+        return fmt::format("draws_{}x{}_uniforms", draw_count_, uniform_count_);
+    }
+
+    void submit(Renderer& r, uint) override {
+        r.setRenderQueueClear({0.0f, 0.0f, 0.0f});
+        for (uint i = 0; i < draw_count_; ++i) {
+            setUniforms(r, i);
+            r.setVertexBuffer(vb_);
+            r.setIndexBuffer(ib_);
+            r.submit(program_, 6);
+        }
+    }
+
+private:
+    uint draw_count_;
+};
+
+// An immediate mode UI: every frame, each widget writes its quads to transient buffers and draws
+// them with its own scissor rectangle.
+class TransientUiWorkload : public QuadWorkload {
+public:
+    TransientUiWorkload(uint widget_count, uint quads_per_widget)
+        : QuadWorkload(1), widget_count_(widget_count), quads_per_widget_(quads_per_widget) {
+    }
+
+    std::string name() const override {
+        return fmt::format("transient_ui_{}x{}_quads", widget_count_, quads_per_widget_);
+    }
+
+    void submit(Renderer& r, uint) override {
+        VertexDecl decl = quadVertexDecl();
+        r.setRenderQueueClear({0.0f, 0.0f, 0.0f});
+        for (uint widget = 0; widget < widget_count_; ++widget) {
+            auto tvb = r.allocTransientVertexBuffer(quads_per_widget_ * 4, decl);
+            auto tib = r.allocTransientIndexBuffer(quads_per_widget_ * 6);
+            if (!tvb || !tib) {
+                continue;
+            }
+            auto* vertices = reinterpret_cast<QuadVertex*>(r.getTransientVertexBufferData(*tvb));
+            auto* indices = reinterpret_cast<u16*>(r.getTransientIndexBufferData(*tib));
+            for (uint quad = 0; quad < quads_per_widget_; ++quad) {
+                writeQuad(vertices + quad * 4, indices + quad * 6,
+                          widget * quads_per_widget_ + quad, static_cast<u16>(quad * 4));
+            }
+            setUniforms(r, widget);
+            r.setScissor(static_cast<u16>(widget % 32 * 16),
+                         static_cast<u16>(widget / 32 % 32 * 16), 256, 256);
+            r.setVertexBuffer(*tvb);
+            r.setIndexBuffer(*tib);
+            r.submit(program_, quads_per_widget_ * 6);
+        }
+    }
+
+private:
+    uint widget_count_;
+    uint quads_per_widget_;
+};
+
+// Many render queues into a handful of frame buffers, each with a few draws.
+class RenderQueuesWorkload : public QuadWorkload {
+public:
+    RenderQueuesWorkload(uint queue_count, uint draws_per_queue)
+        : QuadWorkload(2), queue_count_(queue_count), draws_per_queue_(draws_per_queue) {
+    }
+
+    std::string name() const override {
+        return fmt::format("render_queues_{}x{}_draws", queue_count_, draws_per_queue_);
+    }
+
+    void start(Renderer& r) override {
+        QuadWorkload::start(r);
+        for (uint i = 0; i < kFrameBufferCount; ++i) {
+            frame_buffers_.emplace_back(r.createFrameBuffer(256, 256, TextureFormat::RGBA8));
+        }
+    }
+
+    void submit(Renderer& r, uint) override {
+        for (uint queue = 0; queue < queue_count_; ++queue) {
+            // Group queues by frame buffer, so that consecutive queues can share a render pass.
+            uint frame_buffer = queue * kFrameBufferCount / queue_count_;
+            uint render_queue = r.startRenderQueue(frame_buffers_[frame_buffer]);
+            if (queue == 0 || frame_buffer != (queue - 1) * kFrameBufferCount / queue_count_) {
+                r.setRenderQueueClear(render_queue, {0.0f, 0.0f, 0.0f});
+            }
+            for (uint i = 0; i < draws_per_queue_; ++i) {
+                setUniforms(r, queue * draws_per_queue_ + i);
+                r.setVertexBuffer(vb_);
+                r.setIndexBuffer(ib_);
+                r.submit(render_queue, program_, 6);
+            }
+        }
+    }
+
+    void stop(Renderer& r) override {
+        for (auto frame_buffer : frame_buffers_) {
+            r.deleteFrameBuffer(frame_buffer);
+        }
+        frame_buffers_.clear();
+        QuadWorkload::stop(r);
+    }
+
+private:
+    static constexpr uint kFrameBufferCount = 4;
+    uint queue_count_;
+    uint draws_per_queue_;
+    std::vector<FrameBufferHandle> frame_buffers_;
+};
+
+// Creates, draws with and deletes a set of small textures every frame.
+class TextureChurnWorkload : public QuadWorkload {
+public:
+    TextureChurnWorkload(uint textures_per_frame, u16 texture_size)
+        : QuadWorkload(0, true),
+          textures_per_frame_(textures_per_frame),
+          texture_size_(texture_size) {
+    }
+
+    std::string name() const override {
+        return fmt::format("texture_churn_{}x{}px", textures_per_frame_, texture_size_);
+    }
+
+    void submit(Renderer& r, uint frame) override {
+        r.setRenderQueueClear({0.0f, 0.0f, 0.0f});
+        std::vector<TextureHandle> textures;
+        textures.reserve(textures_per_frame_);
+        usize texture_bytes = usize(texture_size_) * texture_size_ * 4;
+        for (uint i = 0; i < textures_per_frame_; ++i) {
+            Memory data(texture_bytes);
+            std::memset(data.data(), static_cast<int>((frame + i) & 0xff), texture_bytes);
+            TextureHandle texture = r.createTexture2D(texture_size_, texture_size_,
+                                                      TextureFormat::RGBA8, std::move(data));
+            textures.emplace_back(texture);
+            r.setTexture(1, texture);
+            r.setVertexBuffer(vb_);
+            r.setIndexBuffer(ib_);
+            r.submit(program_, 6);
+        }
+        for (auto texture : textures) {
+            r.deleteTexture(texture);
+        }
+    }
+
+private:
+    uint textures_per_frame_;
+    u16 texture_size_;
+};
+
+struct Summary {
+    double mean = 0.0;
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double max = 0.0;
+};
+
+template <typename T> Summary summarise(std::vector<T> samples) {
+    Summary summary;
+    if (samples.empty()) {
+        return summary;
+    }
+    std::sort(samples.begin(), samples.end());
+    double total = 0.0;
+    for (const auto& sample : samples) {
+        total += static_cast<double>(sample);
+    }
+    summary.mean = total / static_cast<double>(samples.size());
+    summary.p50 = static_cast<double>(samples[samples.size() / 2]);
+    summary.p95 =
+        static_cast<double>(samples[std::min(samples.size() - 1, samples.size() * 95 / 100)]);
+    summary.max = static_cast<double>(samples.back());
+    return summary;
+}
+
+std::string toJson(const Summary& summary) {
+    return fmt::format(R"({{"mean":{:.4f},"p50":{:.4f},"p95":{:.4f},"max":{:.4f}}})", summary.mean,
+                       summary.p50, summary.p95, summary.max);
+}
+
+std::string toJson(const FrameStats::CacheStats& stats) {
+    return fmt::format(R"({{"hits":{},"misses":{}}})", stats.hits, stats.misses);
+}
+
+std::string toJson(const FrameStats& stats) {
+    return fmt::format(
+        R"({{"render_queues":{},"render_items":{},"draw_calls":{},"primitives":{},)"
+        R"("program_binds":{},"pipeline_binds":{},"descriptor_set_binds":{},"texture_binds":{},)"
+        R"("sampler_binds":{},"uniform_bytes":{},"transient_vb_used":{},)"
+        R"("transient_vb_capacity":{},"transient_ib_used":{},"transient_ib_capacity":{},)"
+        R"("pre_frame_commands":{},"post_frame_commands":{},"pipeline_cache":{},)"
+        R"("descriptor_set_cache":{},"vertex_decl_cache":{},"sampler_cache":{},)"
+        R"("uniform_location_cache":{}}})",
+        stats.render_queues, stats.render_items, stats.draw_calls, stats.primitives,
+        stats.program_binds, stats.pipeline_binds, stats.descriptor_set_binds, stats.texture_binds,
+        stats.sampler_binds, stats.uniform_bytes, stats.transient_vb_used,
+        stats.transient_vb_capacity, stats.transient_ib_used, stats.transient_ib_capacity,
+        stats.pre_frame_commands, stats.post_frame_commands, toJson(stats.pipeline_cache),
+        toJson(stats.descriptor_set_cache), toJson(stats.vertex_decl_cache),
+        toJson(stats.sampler_cache), toJson(stats.uniform_location_cache));
+}
+
+struct Options {
+    RendererType renderer = RendererType::Null;
+    uint frames = 300;
+    uint warmup_frames = 30;
+    std::string filter;
+    std::string replay;
+    std::string trace;
+};
+
+// Runs a workload on a new renderer, and writes its results to stdout as a single line of JSON.
+// Submit time is the time taken to record the frame, and render time is the time spent in
+// Renderer::frame(), which processes the frame on this thread as the render thread is disabled.
+bool runWorkload(Workload& workload, const Options& options, Logger& logger) {
+    Renderer r{logger};
+    r.setWindowHidden(true);
+    auto init_result =
+        r.init(options.renderer, 1280, 720, "dawn-gfx-bench", InputCallbacks{}, false);
+    if (!init_result) {
+        std::cerr << "Failed to initialise renderer: " << init_result.error() << std::endl;
+        return false;
+    }
+    workload.start(r);
+
+    using Clock = std::chrono::steady_clock;
+    auto to_ms = [](Clock::duration duration) {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    };
+    std::vector<double> submit_ms, render_ms;
+    std::vector<u64> allocations;
+    submit_ms.reserve(options.frames);
+    render_ms.reserve(options.frames);
+    allocations.reserve(options.frames);
+    for (uint frame = 0; frame < options.warmup_frames + options.frames; ++frame) {
+        u64 allocations_before = allocation_count.load(std::memory_order_relaxed);
+        auto submit_start = Clock::now();
+        workload.submit(r, frame);
+        auto render_start = Clock::now();
+        if (!r.frame()) {
+            std::cerr << "Rendering stopped during " << workload.name() << "." << std::endl;
+            return false;
+        }
+        auto render_end = Clock::now();
+        if (frame >= options.warmup_frames) {
+            submit_ms.emplace_back(to_ms(render_start - submit_start));
+            render_ms.emplace_back(to_ms(render_end - render_start));
+            allocations.emplace_back(allocation_count.load(std::memory_order_relaxed) -
+                                     allocations_before);
+        }
+    }
+    FrameStats stats = r.frameStats();
+    GpuTimings gpu_timings = r.gpuTimings();
+    workload.stop(r);
+    r.frame();
+
+    std::cout << fmt::format(
+                     R"({{"workload":"{}","renderer":"{}","frames":{},"submit_ms":{},)"
+                     R"("render_ms":{},"allocations_per_frame":{},"gpu_frame_ms":{},"stats":{}}})",
+                     workload.name(), rendererTypeToString(options.renderer), options.frames,
+                     toJson(summarise(submit_ms)), toJson(summarise(render_ms)),
+                     toJson(summarise(allocations)),
+                     gpu_timings.valid ? fmt::format("{:.4f}", gpu_timings.frame_milliseconds)
+                                       : "null",
+                     toJson(stats))
+              << std::endl;
+    return true;
+}
+
+std::string jsonString(const std::string& str) {
+    std::string escaped = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped + "\"";
+}
+
+// Replays a frame capture written by Renderer::captureNextFrame, and writes its results to stdout
+// as a single line of JSON. Render time is the time spent in FrameReplay::frame().
+bool runReplay(const Options& options, Logger& logger) {
+    FrameReplay replay{logger};
+    auto open_result = replay.open(options.replay, options.renderer);
+    if (!open_result) {
+        std::cerr << "Failed to open capture: " << open_result.error() << std::endl;
+        return false;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    std::vector<double> render_ms;
+    std::vector<u64> allocations;
+    render_ms.reserve(options.frames);
+    allocations.reserve(options.frames);
+    for (uint frame = 0; frame < options.warmup_frames + options.frames; ++frame) {
+        u64 allocations_before = allocation_count.load(std::memory_order_relaxed);
+        auto render_start = Clock::now();
+        if (!replay.frame()) {
+            std::cerr << "Rendering stopped during replay." << std::endl;
+            return false;
+        }
+        auto render_end = Clock::now();
+        if (frame >= options.warmup_frames) {
+            render_ms.emplace_back(
+                std::chrono::duration<double, std::milli>(render_end - render_start).count());
+            allocations.emplace_back(allocation_count.load(std::memory_order_relaxed) -
+                                     allocations_before);
+        }
+    }
+    GpuTimings gpu_timings = replay.gpuTimings();
+
+    std::cout << fmt::format(
+                     R"({{"capture":{},"renderer":"{}","captured_renderer":"{}","frames":{},)"
+                     R"("render_ms":{},"allocations_per_frame":{},"gpu_frame_ms":{},"stats":{}}})",
+                     jsonString(options.replay), rendererTypeToString(options.renderer),
+                     rendererTypeToString(replay.capturedRendererType()), options.frames,
+                     toJson(summarise(render_ms)), toJson(summarise(allocations)),
+                     gpu_timings.valid ? fmt::format("{:.4f}", gpu_timings.frame_milliseconds)
+                                       : "null",
+                     toJson(replay.frameStats()))
+              << std::endl;
+    return true;
+}
+
+void printUsage() {
+    std::cerr << "Usage: dawn-gfx-bench [--renderer null|gl|vulkan] [--frames N] [--warmup N] "
+                 "[--filter SUBSTRING] [--replay CAPTURE] [--trace TRACE_JSON]"
+              << std::endl;
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--renderer") {
+            if (value == "null") {
+                options.renderer = RendererType::Null;
+            } else if (value == "gl") {
+                options.renderer = RendererType::OpenGL;
+            } else if (value == "vulkan") {
+                options.renderer = RendererType::Vulkan;
+            } else {
+                return false;
+            }
+        } else if (arg == "--frames") {
+            options.frames = static_cast<uint>(std::max(1, std::atoi(value.c_str())));
+        } else if (arg == "--warmup") {
+            options.warmup_frames = static_cast<uint>(std::max(0, std::atoi(value.c_str())));
+        } else if (arg == "--filter") {
+            options.filter = value;
+        } else if (arg == "--replay") {
+            options.replay = value;
+        } else if (arg == "--trace") {
+            options.trace = value;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<Workload>> workloads;
+    workloads.emplace_back(std::make_unique<DrawsWorkload>(1000, 1));
+    workloads.emplace_back(std::make_unique<DrawsWorkload>(1000, 8));
+    workloads.emplace_back(std::make_unique<DrawsWorkload>(10000, 4));
+    workloads.emplace_back(std::make_unique<TransientUiWorkload>(500, 16));
+    workloads.emplace_back(std::make_unique<RenderQueuesWorkload>(64, 16));
+    workloads.emplace_back(std::make_unique<TextureChurnWorkload>(32, 64));
+
+    // Recording a trace allocates, which is included in the allocation counts.
+    if (!options.trace.empty()) {
+        Trace::start();
+    }
+
+    StderrLogger logger;
+    bool success = true;
+    if (!options.replay.empty()) {
+        success = runReplay(options, logger);
+    } else {
+        for (auto& workload : workloads) {
+            if (!options.filter.empty() &&
+                workload->name().find(options.filter) == std::string::npos) {
+                continue;
+            }
+            success &= runWorkload(*workload, options, logger);
+        }
+    }
+
+    if (!options.trace.empty()) {
+        Trace::stop();
+        auto trace_result = Trace::writeChromeTrace(options.trace);
+        if (!trace_result) {
+            std::cerr << "Failed to write trace: " << trace_result.error() << std::endl;
+            success = false;
+        }
+    }
+    return success ? 0 : 1;
+}
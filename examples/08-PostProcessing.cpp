@@ -3,6 +3,7 @@
  * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
  */
 #include "Common.h"
+#include <dawn-gfx/RenderGraph.h>
 
 class PostProcessing : public Example {
 public:
@@ -10,7 +11,7 @@ public:
     ProgramHandle box_program_;
 
     ProgramHandle post_process_;
-    FrameBufferHandle fb_handle_;
+    std::unique_ptr<RenderGraph> render_graph_;
 
     void start() override {
         // Load shaders.
@@ -22,8 +23,8 @@ public:
         // Create box.
         box_ = MeshBuilder{r}.normals(true).texcoords(true).createBox(10.0f);
 
-        // Set up frame buffer.
-        fb_handle_ = r.createFrameBuffer(width(), height(), TextureFormat::RGBA8);
+        // The scene texture is created by the render graph each frame.
+        render_graph_ = std::make_unique<RenderGraph>(r);
 
         // Load post process shader.
         auto pp_vs =
@@ -34,10 +35,6 @@ public:
     }
 
     void render(float dt) override {
-        // Set up render queue to frame buffer.
-        r.startRenderQueue(fb_handle_);
-        r.setRenderQueueClear({0.0f, 0.0f, 0.2f});
-
         // Calculate matrices.
         static float angle = 0.0f;
         angle += M_PI / 4.0f * dt;  // 45 degrees per second.
@@ -45,25 +42,43 @@ public:
                      Mat4::RotateX(M_PI / 8.0f) * Mat4::RotateY(angle);
         static Mat4 view = Mat4::identity;
         static Mat4 proj = util::createProjMatrix(r, 0.1f, 1000.0f, 60.0f, aspect());
-        r.setUniform("model_matrix", model);
-        r.setUniform("mvp_matrix", proj * view * model);
-        r.setUniform("light_direction", Vec3{1.0f, 1.0f, 1.0f}.Normalized());
-
-        // Set vertex buffer and submit.
-        r.setVertexBuffer(box_.vb);
-        r.setIndexBuffer(box_.ib);
-        r.submit(box_program_, box_.index_count);
 
-        // Set up render queue to draw fsq to backbuffer.
-        r.startRenderQueue();
-        r.setRenderQueueClear({0.0f, 0.2f, 0.0f});
+        // Render the box into a transient texture, then draw it to the backbuffer with the post
+        // process shader.
+        RenderGraphTextureHandle scene;
+        render_graph_->addPass(
+            "Scene",
+            [&](RenderGraph::PassBuilder& builder) {
+                scene = builder.create(width(), height(), TextureFormat::RGBA8);
+                builder.write(scene);
+                builder.setClear({0.0f, 0.0f, 0.2f});
+            },
+            [=](Renderer& r, const RenderGraph::PassResources&) {
+                r.setUniform("model_matrix", model);
+                r.setUniform("mvp_matrix", proj * view * model);
+                r.setUniform("light_direction", Vec3{1.0f, 1.0f, 1.0f}.Normalized());
 
-        // Draw fb.
-        r.setTexture(1, r.getFrameBufferTexture(fb_handle_, 0));
-        r.submitFullscreenQuad(post_process_);
+                // Set vertex buffer and submit.
+                r.setVertexBuffer(box_.vb);
+                r.setIndexBuffer(box_.ib);
+                r.submit(box_program_, box_.index_count);
+            });
+        render_graph_->addPass(
+            "PostProcess",
+            [&](RenderGraph::PassBuilder& builder) {
+                builder.read(scene);
+                builder.writeBackbuffer();
+                builder.setClear({0.0f, 0.2f, 0.0f});
+            },
+            [=](Renderer& r, const RenderGraph::PassResources& resources) {
+                r.setTexture(1, resources.texture(scene));
+                r.submitFullscreenQuad(post_process_);
+            });
+        render_graph_->execute();
     }
 
     void stop() override {
+        render_graph_.reset();
         r.deleteProgram(post_process_);
         r.deleteProgram(box_program_);
     }
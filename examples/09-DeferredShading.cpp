@@ -3,22 +3,25 @@
  * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
  */
 #include "Common.h"
+#include <dawn-gfx/LightClusters.h>
 
 //#define DEBUG_GBUFFER
 
+// Calculates the distance at which a point light no longer has a visible effect.
+float pointLightRadius(const Colour& colour, float linear_term, float quadratic_term) {
+    float light_max = std::fmaxf(std::fmaxf(colour.r(), colour.g()), colour.b());
+    float min_light_level = 256.0f / 4.0f;
+    float discriminant =
+        linear_term * linear_term - 4.0f * quadratic_term * (1.0f - min_light_level * light_max);
+    return (-linear_term + std::sqrt(discriminant)) / (2.0f * quadratic_term);
+}
+
 class PointLight {
 public:
     PointLight(Renderer& r, Colour colour, float linear_term, float quadratic_term,
                const Vec2& screen_size)
         : r(r) {
-        // Calculate radius.
-        float light_max = std::fmaxf(std::fmaxf(colour.r(), colour.g()), colour.b());
-        float min_light_level = 256.0f / 4.0f;
-        light_sphere_radius_ =
-            (-linear_term +
-             std::sqrt(linear_term * linear_term -
-                       4.0f * quadratic_term * (1.0f - min_light_level * light_max))) /
-            (2.0f * quadratic_term);
+        light_sphere_radius_ = pointLightRadius(colour, linear_term, quadratic_term);
 
         setPosition(Vec3::zero);
 
@@ -96,9 +99,28 @@ public:
         std::unique_ptr<PointLight> light;
         float angle_offset = 0.0f;
         Vec3 origin;
+        Vec3 position;
+        Colour colour;
+        float radius = 0.0f;
     };
     std::vector<PointLightInfo> point_lights;
 
+    // Clustered shading. If storage buffers are supported, all point lights are shaded in a single
+    // fullscreen pass, instead of drawing a light volume for each light.
+    struct ClusteredLight {
+        Vec4 position_radius;
+        Vec4 colour;
+    };
+    bool clustered_ = false;
+    std::unique_ptr<LightClusters> light_clusters_;
+    ProgramHandle clustered_light_pass_;
+    StorageBufferHandle light_buffer_;
+    StorageBufferHandle cluster_buffer_;
+    StorageBufferHandle light_index_buffer_;
+    usize light_index_capacity_ = 0;
+    std::vector<float> light_x_, light_y_, light_z_, light_radius_;
+    std::vector<ClusteredLight> clustered_lights_;
+
     struct SphereInfo {
         Vec3 position;
     };
@@ -107,6 +129,7 @@ public:
     std::mt19937 random_engine_{1};  // start with the same seed each time, for determinism.
 
     static constexpr auto kLightCount = 30;
+    static constexpr auto kClusteredLightCount = 1024;
     static constexpr auto kSphereCount = 50;
     static constexpr auto kGroundSize = 30.0f;
 
@@ -160,6 +183,30 @@ public:
         r.setUniform("ambient_light", Vec3{0.1f, 0.1f, 0.1f});
         r.submit(post_process_);
 
+        // Clustered shading uses many more lights, with a much smaller area of effect.
+        clustered_ = r.isComputeSupported();
+        int light_count = clustered_ ? kClusteredLightCount : kLightCount;
+        float linear_term = clustered_ ? 0.7f : 0.18f;
+        float quadratic_term = clustered_ ? 1.8f : 0.11f;
+        if (clustered_) {
+            auto clustered_fs = util::loadShader(
+                r, ShaderStage::Fragment,
+                util::media("shaders/deferred_shading/light_pass_clustered.frag"));
+            clustered_light_pass_ = r.createProgram({pp_vs, clustered_fs});
+            r.setUniform("linear_term", linear_term);
+            r.setUniform("quadratic_term", quadratic_term);
+            r.submit(clustered_light_pass_);
+
+            light_clusters_ = std::make_unique<LightClusters>();
+            light_buffer_ = r.createStorageBuffer(
+                Memory(light_count * sizeof(ClusteredLight)), BufferUsage::Dynamic);
+            cluster_buffer_ = r.createStorageBuffer(
+                Memory(light_clusters_->clusters().size() * sizeof(u32)), BufferUsage::Dynamic);
+            light_index_capacity_ = light_clusters_->clusterCount();
+            light_index_buffer_ = r.createStorageBuffer(
+                Memory(light_index_capacity_ * sizeof(u32)), BufferUsage::Dynamic);
+        }
+
         // Lights.
         std::array<float, 2> intervals = {0.5f, 1.0f};
         std::array<float, 2> weights = {0.0f, 1.0f};
@@ -169,14 +216,17 @@ public:
         std::uniform_real_distribution<float> angle_offset_distribution(-math::pi, math::pi);
         std::uniform_real_distribution<float> position_axis_distribution(-kGroundSize, kGroundSize);
         std::uniform_real_distribution<float> position_height_distribution(3.0f, 5.0f);
-        for (int i = 0; i < kLightCount; ++i) {
+        for (int i = 0; i < light_count; ++i) {
             PointLightInfo light;
-            light.light = std::make_unique<PointLight>(
-                r,
-                Colour{colour_channel_distribution(random_engine_),
-                       colour_channel_distribution(random_engine_),
-                       colour_channel_distribution(random_engine_)},
-                0.18f, 0.11f, Vec2{static_cast<float>(width()), static_cast<float>(height())});
+            light.colour = Colour{colour_channel_distribution(random_engine_),
+                                  colour_channel_distribution(random_engine_),
+                                  colour_channel_distribution(random_engine_)};
+            light.radius = pointLightRadius(light.colour, linear_term, quadratic_term);
+            if (!clustered_) {
+                light.light = std::make_unique<PointLight>(
+                    r, light.colour, linear_term, quadratic_term,
+                    Vec2{static_cast<float>(width()), static_cast<float>(height())});
+            }
             light.angle_offset = angle_offset_distribution(random_engine_);
             light.origin.x = position_axis_distribution(random_engine_);
             light.origin.y = position_height_distribution(random_engine_);
@@ -240,21 +290,86 @@ public:
         static float angle = 0.0f;
         angle += dt;
         for (auto& light_info : point_lights) {
-            light_info.light->setPosition(
+            light_info.position =
                 Vec3(light_info.origin.x + sin(angle + light_info.angle_offset) * 5.0f -
                          cos(angle - light_info.angle_offset) * 4.0f,
                      light_info.origin.y,
                      light_info.origin.z - sin(angle + light_info.angle_offset * 0.5f) * 5.5f +
-                         cos(angle + light_info.angle_offset * 0.8f) * 6.0f));
-            r.setTexture(1, r.getFrameBufferTexture(gbuffer_, 0));
-            r.setTexture(2, r.getFrameBufferTexture(gbuffer_, 1));
-            r.setTexture(3, r.getFrameBufferTexture(gbuffer_, 2));
-            light_info.light->draw(view, proj);
+                         cos(angle + light_info.angle_offset * 0.8f) * 6.0f);
+            if (!clustered_) {
+                light_info.light->setPosition(light_info.position);
+                r.setTexture(1, r.getFrameBufferTexture(gbuffer_, 0));
+                r.setTexture(2, r.getFrameBufferTexture(gbuffer_, 1));
+                r.setTexture(3, r.getFrameBufferTexture(gbuffer_, 2));
+                light_info.light->draw(view, proj);
+            }
+        }
+        if (clustered_) {
+            drawClusteredLights(view);
         }
 #endif
     }
 
+    void drawClusteredLights(const Mat4& view) {
+        // Bin the lights into clusters.
+        usize light_count = point_lights.size();
+        light_x_.resize(light_count);
+        light_y_.resize(light_count);
+        light_z_.resize(light_count);
+        light_radius_.resize(light_count);
+        clustered_lights_.resize(light_count);
+        for (usize i = 0; i < light_count; ++i) {
+            const auto& light_info = point_lights[i];
+            light_x_[i] = light_info.position.x;
+            light_y_[i] = light_info.position.y;
+            light_z_[i] = light_info.position.z;
+            light_radius_[i] = light_info.radius;
+            clustered_lights_[i] = {Vec4{light_info.position, light_info.radius},
+                                    Vec4{light_info.colour.rgb(), 0.0f}};
+        }
+        light_clusters_->build(
+            view, 60.0f * M_DEGTORAD, aspect(), 0.1f, 150.0f,
+            {light_x_.data(), light_y_.data(), light_z_.data(), light_radius_.data(), light_count});
+
+        // Upload the clusters, growing the light index buffer if needed.
+        const auto& light_indices = light_clusters_->lightIndices();
+        if (light_indices.size() > light_index_capacity_) {
+            r.deleteStorageBuffer(light_index_buffer_);
+            light_index_capacity_ = std::max(light_indices.size(), light_index_capacity_ * 2);
+            light_index_buffer_ = r.createStorageBuffer(
+                Memory(light_index_capacity_ * sizeof(u32)), BufferUsage::Dynamic);
+        }
+        r.updateStorageBuffer(light_buffer_, Memory(clustered_lights_), 0);
+        r.updateStorageBuffer(cluster_buffer_, Memory(light_clusters_->clusters()), 0);
+        if (!light_indices.empty()) {
+            r.updateStorageBuffer(light_index_buffer_, Memory(light_indices), 0);
+        }
+
+        // Shade every light in a single pass, added on top of the ambient light.
+        r.setStateDisable(RenderState::Depth);
+        r.setStateEnable(RenderState::Blending);
+        r.setStateBlendEquation(BlendEquation::Add, BlendFunc::One, BlendFunc::One);
+        r.setTexture(1, r.getFrameBufferTexture(gbuffer_, 0));
+        r.setTexture(2, r.getFrameBufferTexture(gbuffer_, 1));
+        r.setTexture(3, r.getFrameBufferTexture(gbuffer_, 2));
+        r.setStorageBuffer(4, light_buffer_);
+        r.setStorageBuffer(5, cluster_buffer_);
+        r.setStorageBuffer(6, light_index_buffer_);
+        r.setUniform("view_matrix", view);
+        r.setUniform("cluster_params", light_clusters_->shaderParams());
+        r.setUniform("cluster_counts", Vec3{static_cast<float>(light_clusters_->tilesX()),
+                                            static_cast<float>(light_clusters_->tilesY()),
+                                            static_cast<float>(light_clusters_->slices())});
+        r.submitFullscreenQuad(clustered_light_pass_);
+    }
+
     void stop() override {
+        if (clustered_) {
+            r.deleteStorageBuffer(light_index_buffer_);
+            r.deleteStorageBuffer(cluster_buffer_);
+            r.deleteStorageBuffer(light_buffer_);
+            r.deleteProgram(clustered_light_pass_);
+        }
         r.deleteProgram(post_process_);
         r.deleteTexture(texture_);
         r.deleteProgram(ground_program_);
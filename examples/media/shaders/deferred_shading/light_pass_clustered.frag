@@ -0,0 +1,81 @@
+#version 450 core
+
+layout(location = 0) in VertexData {
+    vec2 texcoord;
+} i;
+
+layout(location = 0) out vec4 out_colour;
+
+/*
+GBUFFER LAYOUT:
+gb0: |diffuse.rgb|X|
+gb1: |position.xyz|X|
+gb2: |normal.xyz|X|
+*/
+layout(binding = 1) uniform sampler2D gb0_texture;
+layout(binding = 2) uniform sampler2D gb1_texture;
+layout(binding = 3) uniform sampler2D gb2_texture;
+
+struct PointLight {
+    vec4 position_radius;
+    vec4 colour;
+};
+
+layout(std430, binding = 4) readonly buffer Lights {
+    PointLight lights[];
+};
+
+// (offset, count) of each cluster's range of light_indices.
+layout(std430, binding = 5) readonly buffer Clusters {
+    uvec2 clusters[];
+};
+
+layout(std430, binding = 6) readonly buffer LightIndices {
+    uint light_indices[];
+};
+
+layout(binding = 7) uniform PerSubmit {
+    mat4 view_matrix;
+    vec4 cluster_params;
+    vec3 cluster_counts;
+    float linear_term;
+    float quadratic_term;
+};
+
+void main() {
+    vec3 diffuse_colour = texture(gb0_texture, i.texcoord).rgb;
+    vec3 pixel_position = texture(gb1_texture, i.texcoord).rgb;
+    vec3 pixel_normal = normalize(texture(gb2_texture, i.texcoord).rgb);
+
+    // Nothing was drawn to this pixel.
+    if (diffuse_colour == vec3(0.0, 0.0, 0.0)) {
+        out_colour = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+
+    // Find the cluster which contains this pixel.
+    vec3 view_position = (view_matrix * vec4(pixel_position, 1.0)).xyz;
+    float depth = -view_position.z;
+    vec2 tile = floor((view_position.xy / depth * cluster_params.xy + 1.0) * 0.5 * cluster_counts.xy);
+    float slice = floor(log(depth) * cluster_params.z + cluster_params.w);
+    uvec3 cluster = uvec3(clamp(vec3(tile, slice), vec3(0.0), cluster_counts - 1.0));
+    uvec3 counts = uvec3(cluster_counts);
+    uvec2 range = clusters[(cluster.z * counts.y + cluster.y) * counts.x + cluster.x];
+
+    vec3 lighting = vec3(0.0);
+    for (uint l = range.x; l < range.x + range.y; ++l) {
+        PointLight light = lights[light_indices[l]];
+        vec3 light_position = light.position_radius.xyz;
+
+        // Diffuse.
+        vec3 light_dir = normalize(light_position - pixel_position);
+        vec3 diffuse = max(dot(pixel_normal, light_dir), 0.0) * diffuse_colour * light.colour.rgb;
+        // Attenuation.
+        float distance = length(light_position - pixel_position);
+        float attenuation = 1.0 / (1.0 + linear_term * distance + quadratic_term * distance * distance);
+        diffuse *= attenuation;
+        lighting += diffuse;
+    }
+
+    out_colour = vec4(lighting, 1.0);
+}
@@ -29,6 +29,10 @@ private:
     // Renderer resources.
     VertexDecl vertex_decl_;
     ProgramHandle shader_program_;
+    UniformBufferHandle per_frame_buffer_;
+
+    inline void submitDraws(TransientVertexBufferHandle tvb, TransientIndexBufferHandle tib,
+                            const ImDrawCmd& cmd, uint count, uint index_offset, int base_vertex);
 };
 
 // Implementation.
@@ -43,6 +47,9 @@ ImGuiBackend::ImGuiBackend(Renderer& r, ImGuiIO& io) : r_(r), io_(io) {
     io.DisplayFramebufferScale.y = r_.windowScale().y;
     io.IniFilename = nullptr;
 
+    // Draw commands are submitted with a base vertex, so large meshes don't need 32-bit indices.
+    io.BackendFlags |= ImGuiBackendFlags_RendererHasVtxOffset;
+
     // Load font texture atlas.
     unsigned char* pixels;
     int width, height;
@@ -133,9 +140,13 @@ ImGuiBackend::ImGuiBackend(Renderer& r, ImGuiIO& io) : r_(r), io_(io) {
                                          Memory(std::move(compiled_vs_result->spirv))},
                                         {ShaderStage::Fragment, compiled_fs_result->entry_point,
                                          Memory(std::move(compiled_fs_result->spirv))}});
+
+    // The projection matrix is uploaded once per frame, instead of with every draw.
+    per_frame_buffer_ = r_.createUniformBuffer(Memory(sizeof(Mat4)), BufferUsage::Dynamic);
 }
 
 ImGuiBackend::~ImGuiBackend() {
+    r_.deleteUniformBuffer(per_frame_buffer_);
     r_.deleteProgram(shader_program_);
 }
 
@@ -143,7 +154,7 @@ void ImGuiBackend::newFrame() {
 }
 
 void ImGuiBackend::render(ImDrawData* draw_data) {
-    if (!draw_data) {
+    if (!draw_data || draw_data->TotalVtxCount == 0) {
         return;
     }
 
@@ -152,68 +163,105 @@ void ImGuiBackend::render(ImDrawData* draw_data) {
         return;
     }
 
-    // Setup projection matrix.
+    // Setup projection matrix. Uniform buffers are column-major, like the matrices passed to
+    // setUniform once the renderer has transposed them.
     Mat4 proj_matrix = Mat4::OpenGLOrthoProjRH(-1.0f, 1.0f, io_.DisplaySize.x, io_.DisplaySize.y) *
                        Mat4::Translate(-io_.DisplaySize.x * 0.5f, io_.DisplaySize.y * 0.5f, 0.0f) *
                        Mat4::Scale(1.0f, -1.0f, 1.0f);
-    r_.setUniform("proj_matrix", proj_matrix);
+    proj_matrix.Transpose();
+    r_.updateUniformBuffer(per_frame_buffer_, Memory(&proj_matrix, sizeof(Mat4)), 0);
+
+    // Copy every command list into a single vertex and index buffer. Each command list's indices
+    // start from 0, which is corrected by submitting its commands with a base vertex.
+    auto tvb = r_.allocTransientVertexBuffer(draw_data->TotalVtxCount, vertex_decl_);
+    if (!tvb) {
+        return;
+    }
+    auto tib = r_.allocTransientIndexBuffer(
+        draw_data->TotalIdxCount,
+        sizeof(ImDrawIdx) == 2 ? IndexBufferType::U16 : IndexBufferType::U32);
+    if (!tib) {
+        return;
+    }
+    auto* vtx_dest = reinterpret_cast<ImDrawVert*>(r_.getTransientVertexBufferData(*tvb));
+    auto* idx_dest = reinterpret_cast<ImDrawIdx*>(r_.getTransientIndexBufferData(*tib));
+    for (int n = 0; n < draw_data->CmdListsCount; ++n) {
+        const ImDrawList* cmd_list = draw_data->CmdLists[n];
+        memcpy(vtx_dest, cmd_list->VtxBuffer.Data, cmd_list->VtxBuffer.Size * sizeof(ImDrawVert));
+        memcpy(idx_dest, cmd_list->IdxBuffer.Data, cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx));
+        vtx_dest += cmd_list->VtxBuffer.Size;
+        idx_dest += cmd_list->IdxBuffer.Size;
+    }
 
     // Create a new render queue specific for the UI elements.
     r_.startRenderQueue();
 
-    // Process command lists.
+    // Process command lists. Consecutive commands which use the same texture and clip rect, and
+    // follow on from each other in the index buffer, are merged into a single draw.
+    uint list_vtx_offset = 0;
+    uint list_idx_offset = 0;
     for (int n = 0; n < draw_data->CmdListsCount; ++n) {
-        auto cmd_list = draw_data->CmdLists[n];
-
-        // Update GPU buffers.
-        auto& vtx_buffer = cmd_list->VtxBuffer;
-        auto& idx_buffer = cmd_list->IdxBuffer;
-        auto tvb = r_.allocTransientVertexBuffer(vtx_buffer.Size, vertex_decl_);
-        if (!tvb) {
-            return;
-        }
-        auto tib = r_.allocTransientIndexBuffer(idx_buffer.Size);
-        if (!tib) {
-            return;
-        }
-        memcpy(r_.getTransientVertexBufferData(*tvb), vtx_buffer.Data,
-               vtx_buffer.Size * sizeof(ImDrawVert));
-        memcpy(r_.getTransientIndexBufferData(*tib), idx_buffer.Data,
-               idx_buffer.Size * sizeof(ImDrawIdx));
-
-        // Execute draw commands.
-        uint offset = 0;
+        const ImDrawList* cmd_list = draw_data->CmdLists[n];
+        const ImDrawCmd* batch = nullptr;
+        uint batch_count = 0;
+        uint batch_offset = 0;
+        int batch_base_vertex = 0;
         for (int cmd_i = 0; cmd_i < cmd_list->CmdBuffer.Size; ++cmd_i) {
             const ImDrawCmd* cmd = &cmd_list->CmdBuffer[cmd_i];
+            uint offset = list_idx_offset + cmd->IdxOffset;
+            int base_vertex = static_cast<int>(list_vtx_offset + cmd->VtxOffset);
+            if (batch && !cmd->UserCallback && cmd->TextureId == batch->TextureId &&
+                memcmp(&cmd->ClipRect, &batch->ClipRect, sizeof(ImVec4)) == 0 &&
+                base_vertex == batch_base_vertex && offset == batch_offset + batch_count) {
+                batch_count += cmd->ElemCount;
+                continue;
+            }
+            if (batch) {
+                submitDraws(*tvb, *tib, *batch, batch_count, batch_offset, batch_base_vertex);
+                batch = nullptr;
+            }
             if (cmd->UserCallback) {
                 cmd->UserCallback(cmd_list, cmd);
             } else {
-                // Set render state.
-                r_.setStateEnable(RenderState::Blending);
-                r_.setStateBlendEquation(BlendEquation::Add, BlendFunc::SrcAlpha,
-                                         BlendFunc::OneMinusSrcAlpha);
-                r_.setStateDisable(RenderState::CullFace);
-                r_.setStateDisable(RenderState::Depth);
-                r_.setScissor(static_cast<u16>(cmd->ClipRect.x * io_.DisplayFramebufferScale.x),
-                              static_cast<u16>(cmd->ClipRect.y * io_.DisplayFramebufferScale.y),
-                              static_cast<u16>((cmd->ClipRect.z - cmd->ClipRect.x) *
-                                               io_.DisplayFramebufferScale.x),
-                              static_cast<u16>((cmd->ClipRect.w - cmd->ClipRect.y) *
-                                               io_.DisplayFramebufferScale.y));
-
-                // Set resources.
-                r_.setTexture(1, TextureHandle{static_cast<TextureHandle::base_type>(
-                                     reinterpret_cast<dga::uintptr>(cmd->TextureId))});
-                r_.setVertexBuffer(*tvb);
-                r_.setIndexBuffer(*tib);
-
-                // Draw.
-                r_.submit(shader_program_, cmd->ElemCount, offset);
+                batch = cmd;
+                batch_count = cmd->ElemCount;
+                batch_offset = offset;
+                batch_base_vertex = base_vertex;
             }
-            offset += cmd->ElemCount;
         }
+        if (batch) {
+            submitDraws(*tvb, *tib, *batch, batch_count, batch_offset, batch_base_vertex);
+        }
+        list_vtx_offset += cmd_list->VtxBuffer.Size;
+        list_idx_offset += cmd_list->IdxBuffer.Size;
     }
 }
 
+void ImGuiBackend::submitDraws(TransientVertexBufferHandle tvb, TransientIndexBufferHandle tib,
+                               const ImDrawCmd& cmd, uint count, uint index_offset,
+                               int base_vertex) {
+    // Set render state.
+    r_.setStateEnable(RenderState::Blending);
+    r_.setStateBlendEquation(BlendEquation::Add, BlendFunc::SrcAlpha,
+                             BlendFunc::OneMinusSrcAlpha);
+    r_.setStateDisable(RenderState::CullFace);
+    r_.setStateDisable(RenderState::Depth);
+    r_.setScissor(
+        static_cast<u16>(cmd.ClipRect.x * io_.DisplayFramebufferScale.x),
+        static_cast<u16>(cmd.ClipRect.y * io_.DisplayFramebufferScale.y),
+        static_cast<u16>((cmd.ClipRect.z - cmd.ClipRect.x) * io_.DisplayFramebufferScale.x),
+        static_cast<u16>((cmd.ClipRect.w - cmd.ClipRect.y) * io_.DisplayFramebufferScale.y));
+
+    // Set resources.
+    r_.setUniformBuffer(0, per_frame_buffer_);
+    r_.setTexture(1, TextureHandle{static_cast<TextureHandle::base_type>(
+                         reinterpret_cast<dga::uintptr>(cmd.TextureId))});
+    r_.setVertexBuffer(tvb);
+    r_.setIndexBuffer(tib);
+
+    // Draw.
+    r_.submit(shader_program_, count, index_offset, 1, base_vertex);
+}
+
 }  // namespace gfx
 }  // namespace dw
@@ -0,0 +1,61 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Base.h"
+#include "Renderer.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dw {
+namespace gfx {
+class RenderContext;
+struct FrameCaptureData;
+
+// Replays a frame captured with Renderer::captureNextFrame() on its own render context, without
+// the application which submitted it. The captured frame is rendered as-is (it was sorted before
+// it was captured), so replaying it repeatedly measures the backend in isolation.
+class DW_API FrameReplay {
+public:
+    explicit FrameReplay(Logger& logger);
+    ~FrameReplay();
+
+    // Non-copyable.
+    FrameReplay(const FrameReplay&) = delete;
+    FrameReplay& operator=(const FrameReplay&) = delete;
+
+    /// Loads a capture file, creates a window of the captured size, then creates the resources
+    /// which existed before the captured frame. The renderer type doesn't need to match the one
+    /// the frame was captured with.
+    Result<void, std::string> open(const std::string& path, RendererType type,
+                                   bool window_hidden = true);
+
+    /// Renders the captured frame. Resources that the frame creates are deleted again afterwards,
+    /// and resources that it deletes are kept, so the frame can be replayed any number of times.
+    /// Returns false if rendering failed or the window was closed.
+    bool frame();
+
+    /// Returns the statistics of the most recently replayed frame. See FrameStats.
+    FrameStats frameStats() const;
+
+    /// Returns the GPU timings of the most recently measured frame. See GpuTimings.
+    GpuTimings gpuTimings() const;
+
+    /// Returns the renderer type the frame was captured with.
+    RendererType capturedRendererType() const;
+
+private:
+    Logger& logger_;
+    std::unique_ptr<FrameCaptureData> capture_;
+    std::unique_ptr<RenderContext> render_context_;
+    // The setup commands are processed during the first replayed frame.
+    bool setup_pending_;
+    // Commands processed after each replayed frame.
+    std::vector<RenderCommand> commands_post_;
+};
+}  // namespace gfx
+}  // namespace dw
@@ -0,0 +1,72 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Base.h"
+#include "MathDefs.h"
+#include <memory>
+#include <vector>
+
+namespace dw {
+namespace gfx {
+class WorkerPool;
+
+/// Bounding spheres stored as a structure of arrays. Each array has 'count' elements.
+struct BoundingSpheres {
+    const float* centre_x;
+    const float* centre_y;
+    const float* centre_z;
+    const float* radius;
+    usize count;
+};
+
+/// Axis aligned bounding boxes stored as a structure of arrays. Each array has 'count' elements.
+struct BoundingBoxes {
+    const float* min_x;
+    const float* min_y;
+    const float* min_z;
+    const float* max_x;
+    const float* max_y;
+    const float* max_z;
+    usize count;
+};
+
+/// Tests batches of bounding volumes against a view frustum, and returns the indices of the ones
+/// which are visible. Volumes are tested several at a time using SSE, AVX or NEON, depending on
+/// which instruction sets the library is compiled for, and large batches are split across worker
+/// threads.
+///
+/// The frustum is extracted from a view-projection matrix which maps to clip space with depth in
+/// [-1, 1]. Projection matrices with depth in [0, 1] can also be used, with the near plane tested
+/// slightly conservatively.
+class DW_API FrustumCuller {
+public:
+    /// Creates a culler which splits large batches across 'thread_count' worker threads. 0 uses
+    /// one worker thread per hardware thread, and 1 culls every batch on the calling thread.
+    explicit FrustumCuller(usize thread_count = 0);
+    ~FrustumCuller();
+
+    // Non-copyable.
+    FrustumCuller(const FrustumCuller&) = delete;
+    FrustumCuller& operator=(const FrustumCuller&) = delete;
+
+    /// Replaces the contents of 'visible' with the indices of the spheres which intersect the
+    /// frustum, in increasing order. Returns the number of visible spheres.
+    usize cull(const Mat4& view_proj, const BoundingSpheres& spheres, std::vector<u32>& visible);
+
+    /// Replaces the contents of 'visible' with the indices of the boxes which intersect the
+    /// frustum, in increasing order. Returns the number of visible boxes. Boxes near the corners
+    /// of the frustum may be reported as visible when they're not.
+    usize cull(const Mat4& view_proj, const BoundingBoxes& boxes, std::vector<u32>& visible);
+
+private:
+    std::unique_ptr<WorkerPool> worker_pool_;
+    std::vector<std::vector<u32>> job_visible_;
+
+    template <typename Volumes, typename Kernel>
+    usize cullParallel(const Volumes& volumes, std::vector<u32>& visible, Kernel kernel);
+};
+}  // namespace gfx
+}  // namespace dw
@@ -0,0 +1,93 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Base.h"
+#include "FrustumCuller.h"
+#include "MathDefs.h"
+#include <memory>
+#include <vector>
+
+namespace dw {
+namespace gfx {
+class WorkerPool;
+
+/// Bins point lights into a grid of clusters which subdivides the view frustum, so that a single
+/// fullscreen pass can shade each pixel with only the lights which can reach it. The frustum is
+/// split into tiles on screen, and into slices in depth which get exponentially thicker away from
+/// the camera. Large sets of lights are binned across worker threads.
+///
+/// The result is a list of (offset, count) pairs, one for each cluster, which index into a list of
+/// light indices. Both are laid out to be uploaded directly into storage buffers. A shader finds
+/// the cluster of a view space position 'p' (looking down -Z) with the values from shaderParams():
+///
+///     tile_x = floor((p.x / -p.z * params.x + 1) * 0.5 * tiles_x)
+///     tile_y = floor((p.y / -p.z * params.y + 1) * 0.5 * tiles_y)
+///     slice = floor(log(-p.z) * params.z + params.w)
+///     cluster = (slice * tiles_y + tile_y) * tiles_x + tile_x
+///
+/// with each component clamped to the grid. This is independent of the viewport, so it works the
+/// same whether or not the viewport is flipped.
+class DW_API LightClusters {
+public:
+    /// Creates a grid of 'tiles_x' by 'tiles_y' tiles and 'slices' depth slices. Lights are binned
+    /// across 'thread_count' worker threads. 0 uses one worker thread per hardware thread, and 1
+    /// bins every light on the calling thread.
+    LightClusters(uint tiles_x = 16, uint tiles_y = 9, uint slices = 24, usize thread_count = 0);
+    ~LightClusters();
+
+    // Non-copyable.
+    LightClusters(const LightClusters&) = delete;
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    /// Bins a set of point lights, each given as a world space bounding sphere of its area of
+    /// effect. The frustum is described by a world to view space matrix, the vertical field of view
+    /// in radians, the aspect ratio (width / height), and the depth range covered by the slices.
+    /// Lights outside of the frustum aren't included in any cluster.
+    void build(const Mat4& view_matrix, float vertical_fov, float aspect_ratio, float z_near,
+               float z_far, const BoundingSpheres& lights);
+
+    /// (offset, count) pairs of each cluster into lightIndices().
+    const std::vector<u32>& clusters() const;
+
+    /// Indices of the lights passed to build(), grouped by cluster.
+    const std::vector<u32>& lightIndices() const;
+
+    /// Values used by a shader to find the cluster of a view space position (see above).
+    Vec4 shaderParams() const;
+
+    /// Returns the index of the cluster which contains a view space position.
+    uint clusterIndex(const Vec3& view_position) const;
+
+    uint tilesX() const;
+    uint tilesY() const;
+    uint slices() const;
+    uint clusterCount() const;
+
+private:
+    struct LightBounds;
+    struct Slice;
+
+    uint tiles_x_;
+    uint tiles_y_;
+    uint slices_;
+    std::unique_ptr<WorkerPool> worker_pool_;
+
+    float ndc_scale_x_;
+    float ndc_scale_y_;
+    float slice_scale_;
+    float slice_bias_;
+    std::vector<float> slice_depths_;
+
+    std::vector<LightBounds> bounds_;
+    std::vector<Slice> slice_data_;
+    std::vector<u32> clusters_;
+    std::vector<u32> light_indices_;
+
+    void binSlice(uint slice);
+    uint sliceIndex(float depth) const;
+};
+}  // namespace gfx
+}  // namespace dw
@@ -18,6 +18,9 @@ public:
     MeshBuilder& normals(bool normals);
     MeshBuilder& texcoords(bool texcoords);
     MeshBuilder& tangents(bool tangents);
+    // Number of levels of detail to generate, including the full detail mesh. See
+    // TriangleBuffer::lods.
+    MeshBuilder& lods(uint count);
 
     Mesh createPlane(float width, float height);
     Mesh createBox(float half_size);
@@ -28,6 +31,7 @@ private:
     bool with_normals_;
     bool with_texcoords_;
     bool with_tangents_;
+    uint lod_count_;
 };
 }
 }  // namespace dw
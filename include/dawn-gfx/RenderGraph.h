@@ -0,0 +1,177 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Renderer.h"
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+DEFINE_HANDLE_TYPE(RenderGraphTextureHandle);
+
+namespace dw {
+namespace gfx {
+/// Builds a frame out of passes which declare the textures they read and write, instead of
+/// managing render queues and frame buffers directly. When the graph is executed:
+///
+/// - Passes which don't contribute to the backbuffer (or to an imported texture) are culled.
+/// - Transient textures are only allocated for the range of passes that use them. Transient
+///   textures with the same size and format whose lifetimes don't overlap share the same
+///   texture, so a frame only needs as many textures as are alive at once.
+/// - Each remaining pass is submitted as a render queue targeting the textures it writes, in the
+///   order the passes were added, and labelled with the pass's name.
+///
+/// Attachments which aren't needed are discarded with load and store ops, such as the previous
+/// contents of a transient texture before its first pass, and depth buffers which no later pass
+/// uses. Textures and frame buffers are kept between frames, so a graph which has the same shape
+/// every frame doesn't create any resources after the first frame. The backends transition each
+/// texture only when it's next used as an attachment or sampled, so the declared reads and writes
+/// are also what determine the barriers between passes.
+class DW_API RenderGraph {
+public:
+    /// Declares what a pass reads and writes. Only valid inside the setup function of a pass.
+    class DW_API PassBuilder {
+    public:
+        /// Declares a transient texture, which exists from the first pass which uses it to the
+        /// last. Its contents are undefined before the first pass writes to it.
+        RenderGraphTextureHandle create(u16 width, u16 height, TextureFormat format);
+
+        /// Declares that this pass samples a texture.
+        void read(RenderGraphTextureHandle texture);
+
+        /// Declares that this pass renders to a texture. Textures are bound as colour attachments
+        /// in the order they are written, and must all be the same size.
+        void write(RenderGraphTextureHandle texture);
+
+        /// Declares that this pass renders to the backbuffer instead of to textures. Passes which
+        /// render to the backbuffer are never culled.
+        void writeBackbuffer();
+
+        /// Clears the attachments of this pass before it starts rendering.
+        void setClear(const Colour& colour, bool clear_colour = true, bool clear_depth = true);
+
+    private:
+        RenderGraph& graph_;
+        usize pass_index_;
+
+        PassBuilder(RenderGraph& graph, usize pass_index);
+        friend class RenderGraph;
+    };
+
+    /// Maps the textures declared by a pass to the textures allocated for them. Only valid inside
+    /// the execute function of a pass.
+    class DW_API PassResources {
+    public:
+        TextureHandle texture(RenderGraphTextureHandle texture) const;
+
+    private:
+        const RenderGraph& graph_;
+
+        explicit PassResources(const RenderGraph& graph);
+        friend class RenderGraph;
+    };
+
+    using SetupFunction = std::function<void(PassBuilder&)>;
+    // Called with the pass's render queue as the last created render queue, so that items can be
+    // submitted to it directly.
+    using ExecuteFunction = std::function<void(Renderer&, const PassResources&)>;
+
+    struct Stats {
+        uint passes = 0;
+        uint culled_passes = 0;
+        uint transient_textures = 0;
+        // Textures allocated for the transient textures, and their total size in bytes.
+        uint allocated_textures = 0;
+        usize allocated_bytes = 0;
+    };
+
+    explicit RenderGraph(Renderer& r);
+    ~RenderGraph();
+
+    // Non-copyable.
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    /// Makes a texture owned by the application available to passes, such as a texture which is
+    /// kept between frames. Passes which write to imported textures are never culled.
+    RenderGraphTextureHandle importTexture(TextureHandle texture);
+
+    /// Adds a pass. 'setup' is called immediately to declare the pass's reads and writes, and
+    /// 'execute' is called by execute() if the pass isn't culled.
+    void addPass(const std::string& name, SetupFunction setup, ExecuteFunction execute);
+
+    /// Culls unused passes, allocates textures, then executes the remaining passes. The graph is
+    /// empty afterwards, ready for the next frame.
+    void execute();
+
+    /// Returns statistics of the most recently executed graph.
+    Stats stats() const;
+
+private:
+    struct TextureDesc {
+        u16 width;
+        u16 height;
+        TextureFormat format;
+
+        bool operator==(const TextureDesc& other) const {
+            return width == other.width && height == other.height && format == other.format;
+        }
+    };
+    struct TextureDescHash {
+        usize operator()(const TextureDesc& desc) const;
+    };
+
+    struct VirtualTexture {
+        TextureDesc desc;
+        std::optional<TextureHandle> imported;
+        TextureHandle allocated;
+        usize first_pass;
+        usize last_pass;
+    };
+
+    struct Pass {
+        std::string name;
+        ExecuteFunction execute;
+        std::vector<RenderGraphTextureHandle> reads;
+        std::vector<RenderGraphTextureHandle> writes;
+        bool writes_backbuffer = false;
+        std::optional<RenderQueue::ClearParameters> clear;
+        bool culled = false;
+    };
+
+    // A texture kept between frames, which is reused for transient textures with the same
+    // description. Textures which haven't been used for a few frames are deleted.
+    struct PooledTexture {
+        TextureHandle handle;
+        uint unused_frames = 0;
+        bool in_use = false;
+    };
+
+    // A frame buffer kept between frames for passes which write the same textures.
+    struct CachedFrameBuffer {
+        std::vector<TextureHandle> textures;
+        FrameBufferHandle handle;
+        uint unused_frames = 0;
+    };
+
+    Renderer& r_;
+    std::vector<Pass> passes_;
+    std::vector<VirtualTexture> textures_;
+    std::unordered_map<TextureDesc, std::vector<PooledTexture>, TextureDescHash> texture_pool_;
+    std::vector<CachedFrameBuffer> frame_buffer_cache_;
+    Stats stats_;
+
+    const VirtualTexture& virtualTexture(RenderGraphTextureHandle texture) const;
+    void cullPasses();
+    void allocateTextures();
+    // Chooses load and store ops which discard the attachments of a pass that aren't needed.
+    RenderQueue::AttachmentOps attachmentOps(usize pass_index) const;
+    TextureHandle acquireTexture(const TextureDesc& desc);
+    FrameBufferHandle frameBuffer(const std::vector<TextureHandle>& textures);
+    void trimPool();
+};
+}  // namespace gfx
+}  // namespace dw
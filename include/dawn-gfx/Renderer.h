@@ -5,7 +5,11 @@
 #pragma once
 
 #include "Base.h"
+#include "detail/FrameArena.h"
+#include "detail/FrameQueue.h"
+#include "detail/MpscQueue.h"
 #include "detail/Handle.h"
+#include "detail/HandleMap.h"
 #include "detail/Memory.h"
 #include "MathDefs.h"
 #include "Colour.h"
@@ -13,7 +17,6 @@
 #include "VertexDecl.h"
 #include "Input.h"
 
-#include <dga/barrier.h>
 #include <dga/hash_combine.h>
 #include <vector>
 #include <variant>
@@ -23,10 +26,18 @@
 #include <atomic>
 #include <thread>
 #include <optional>
+#include <mutex>
+#include <shared_mutex>
+#include <memory>
 
 #define DW_MAX_TEXTURE_SAMPLERS 8
-#define DW_MAX_TRANSIENT_VERTEX_BUFFER_SIZE (1 << 20)
-#define DW_MAX_TRANSIENT_INDEX_BUFFER_SIZE (1 << 20)
+// Size of the bindless texture table. See Renderer::bindlessTextureIndex.
+#define DW_MAX_BINDLESS_TEXTURES 4096
+#define DW_DEFAULT_TRANSIENT_VERTEX_BUFFER_SIZE (1 << 20)
+#define DW_DEFAULT_TRANSIENT_INDEX_BUFFER_SIZE (1 << 20)
+// Transient storage grows past these sizes. The old names are kept for existing code.
+#define DW_MAX_TRANSIENT_VERTEX_BUFFER_SIZE DW_DEFAULT_TRANSIENT_VERTEX_BUFFER_SIZE
+#define DW_MAX_TRANSIENT_INDEX_BUFFER_SIZE DW_DEFAULT_TRANSIENT_INDEX_BUFFER_SIZE
 
 // Handles.
 #define DEFINE_HANDLE_TYPE(_Name)                                                                 \
@@ -57,11 +68,15 @@ DEFINE_HANDLE_TYPE(VertexBufferHandle);
 DEFINE_HANDLE_TYPE(TransientVertexBufferHandle);
 DEFINE_HANDLE_TYPE(IndexBufferHandle);
 DEFINE_HANDLE_TYPE(TransientIndexBufferHandle);
+DEFINE_HANDLE_TYPE(IndirectBufferHandle);
+DEFINE_HANDLE_TYPE(StorageBufferHandle);
 DEFINE_HANDLE_TYPE(ShaderHandle);
 DEFINE_HANDLE_TYPE(ProgramHandle);
+DEFINE_HANDLE_TYPE(UniformHandle);
 DEFINE_HANDLE_TYPE(UniformBufferHandle);
 DEFINE_HANDLE_TYPE(TextureHandle);
 DEFINE_HANDLE_TYPE(FrameBufferHandle);
+DEFINE_HANDLE_TYPE(OcclusionQueryHandle);
 
 namespace dw {
 namespace gfx {
@@ -69,8 +84,18 @@ namespace gfx {
 // Renderer type.
 enum class RendererType { Null, OpenGL, Vulkan };
 
+// How frames are presented to the window.
+// - Immediate: Frames are shown as soon as they're finished, and may tear. Lowest latency.
+// - Mailbox: Frames are shown at the next vertical blank, replacing any frame which is already
+//   waiting, without blocking. Low latency without tearing.
+// - Fifo: Frames are queued and shown one per vertical blank, blocking when the queue is full.
+//   Always supported.
+// - FifoRelaxed: Like Fifo, but a frame which misses a vertical blank is shown immediately and may
+//   tear, rather than waiting for the next one.
+enum class PresentMode { Immediate, Mailbox, Fifo, FifoRelaxed };
+
 // Shader type.
-enum class ShaderStage { Vertex, Geometry, Fragment };
+enum class ShaderStage { Vertex, Geometry, Fragment, Compute };
 
 // Buffer usage.
 enum class BufferUsage {
@@ -82,6 +107,16 @@ enum class BufferUsage {
 // Index buffer type.
 enum class IndexBufferType { U16, U32 };
 
+// Arguments of a single indexed draw stored in an indirect buffer. This matches the layout used by
+// both GL and Vulkan. base_instance must be 0, as instanced vertex data isn't offset by it on GL.
+struct DrawIndexedIndirectCommand {
+    u32 index_count;
+    u32 instance_count;
+    u32 first_index;
+    i32 base_vertex;
+    u32 base_instance;
+};
+
 // Texture format.
 /*
  * RGBA16S
@@ -138,6 +173,19 @@ enum class TextureFormat {
     RGBA32I,
     RGBA32U,
     RGBA32F,
+    // Block-compressed colour formats.
+    BC1,      // RGB(A), 4x4 blocks of 8 bytes (DXT1).
+    BC2,      // RGBA, 4x4 blocks of 16 bytes (DXT3).
+    BC3,      // RGBA, 4x4 blocks of 16 bytes (DXT5).
+    BC4,      // R, 4x4 blocks of 8 bytes.
+    BC5,      // RG, 4x4 blocks of 16 bytes.
+    BC6H,     // RGB unsigned half float, 4x4 blocks of 16 bytes.
+    BC7,      // RGBA, 4x4 blocks of 16 bytes.
+    ETC2,     // RGB, 4x4 blocks of 8 bytes.
+    ETC2A,    // RGBA, 4x4 blocks of 16 bytes.
+    ASTC4x4,  // RGBA, 4x4 blocks of 16 bytes.
+    ASTC6x6,  // RGBA, 6x6 blocks of 16 bytes.
+    ASTC8x8,  // RGBA, 8x8 blocks of 16 bytes.
     // Depth formats.
     D16,
     D24,
@@ -233,6 +281,37 @@ enum class BlendFunc {
 };
 enum class BlendEquation { Add, Subtract, ReverseSubtract, Min, Max };
 
+// Fixed function render state. Backends which use pipeline state objects (Vulkan) bake this into
+// their pipelines.
+struct PipelineState {
+    bool depth_enabled = true;
+    bool cull_face_enabled = true;
+    CullFrontFace cull_front_face = CullFrontFace::CCW;
+    PolygonMode polygon_mode = PolygonMode::Fill;
+    bool blend_enabled = false;
+    BlendEquation blend_equation_rgb = BlendEquation::Add;
+    BlendFunc blend_src_rgb = BlendFunc::One;
+    BlendFunc blend_dest_rgb = BlendFunc::Zero;
+    BlendEquation blend_equation_a = BlendEquation::Add;
+    BlendFunc blend_src_a = BlendFunc::One;
+    BlendFunc blend_dest_a = BlendFunc::Zero;
+    bool colour_write = true;  // TODO: make component-wise
+    bool depth_write = true;
+    // TODO: Stencil write.
+
+    bool operator==(const PipelineState& other) const {
+        return depth_enabled == other.depth_enabled &&
+               cull_face_enabled == other.cull_face_enabled &&
+               cull_front_face == other.cull_front_face && polygon_mode == other.polygon_mode &&
+               blend_enabled == other.blend_enabled &&
+               blend_equation_rgb == other.blend_equation_rgb &&
+               blend_src_rgb == other.blend_src_rgb && blend_dest_rgb == other.blend_dest_rgb &&
+               blend_equation_a == other.blend_equation_a && blend_src_a == other.blend_src_a &&
+               blend_dest_a == other.blend_dest_a && colour_write == other.colour_write &&
+               depth_write == other.depth_write;
+    }
+};
+
 // Shader stage info.
 struct ShaderStageInfo {
     ShaderStage stage;
@@ -278,23 +357,99 @@ struct DeleteIndexBuffer {
     IndexBufferHandle handle;
 };
 
+struct CreateIndirectBuffer {
+    IndirectBufferHandle handle;
+    Memory data;
+    uint size;
+    BufferUsage usage;
+};
+
+struct UpdateIndirectBuffer {
+    IndirectBufferHandle handle;
+    Memory data;
+    uint offset;
+};
+
+struct DeleteIndirectBuffer {
+    IndirectBufferHandle handle;
+};
+
+struct CreateStorageBuffer {
+    StorageBufferHandle handle;
+    Memory data;
+    uint size;
+    BufferUsage usage;
+};
+
+struct UpdateStorageBuffer {
+    StorageBufferHandle handle;
+    Memory data;
+    uint offset;
+};
+
+struct DeleteStorageBuffer {
+    StorageBufferHandle handle;
+};
+
+struct CreateUniformBuffer {
+    UniformBufferHandle handle;
+    Memory data;
+    uint size;
+    BufferUsage usage;
+};
+
+struct UpdateUniformBuffer {
+    UniformBufferHandle handle;
+    Memory data;
+    uint offset;
+};
+
+struct DeleteUniformBuffer {
+    UniformBufferHandle handle;
+};
+
 struct CreateProgram {
     ProgramHandle handle;
     std::vector<ShaderStageInfo> stages;
+    bool async = false;
 };
 
 struct DeleteProgram {
     ProgramHandle handle;
 };
 
+struct CreateUniform {
+    UniformHandle handle;
+    std::string name;
+};
+
 struct CreateTexture2D {
     TextureHandle handle;
     u16 width;
     u16 height;
     TextureFormat format;
-    Memory data;
+    // Data for each mip level, starting with the base level. Empty if the texture is uninitialised.
+    std::vector<Memory> mip_levels;
     bool generate_mipmaps;
     bool framebuffer_usage;
+    // True if the texture can be bound as a storage image.
+    bool storage_usage = false;
+    // Number of layers of a 2D array texture, or 0 if the texture isn't an array. Each mip level
+    // of an array texture contains the data of every layer in turn.
+    u16 array_layers = 0;
+    // True if the texture is added to the bindless texture table (if supported).
+    bool bindless = false;
+};
+
+struct UpdateTexture2D {
+    TextureHandle handle;
+    uint mip_level;
+    u16 x;
+    u16 y;
+    u16 width;
+    u16 height;
+    // Tightly packed texel data for the region, textureLevelSize(format, width, height) bytes.
+    Memory data;
 };
 
 struct DeleteTexture {
@@ -312,6 +467,22 @@ struct CreateFrameBuffer {
 struct DeleteFrameBuffer {
     FrameBufferHandle handle;
 };
+
+struct CreateOcclusionQuery {
+    OcclusionQueryHandle handle;
+};
+
+struct DeleteOcclusionQuery {
+    OcclusionQueryHandle handle;
+};
+
+struct PrewarmPipeline {
+    ProgramHandle program;
+    VertexDecl decl;
+    VertexDecl instance_decl;
+    std::optional<FrameBufferHandle> frame_buffer;
+    PipelineState pipeline_state;
+};
 }  // namespace cmd
 
 // clang-format off
@@ -322,18 +493,49 @@ using RenderCommand =
             cmd::CreateIndexBuffer,
             cmd::UpdateIndexBuffer,
             cmd::DeleteIndexBuffer,
+            cmd::CreateIndirectBuffer,
+            cmd::UpdateIndirectBuffer,
+            cmd::DeleteIndirectBuffer,
+            cmd::CreateStorageBuffer,
+            cmd::UpdateStorageBuffer,
+            cmd::DeleteStorageBuffer,
+            cmd::CreateUniformBuffer,
+            cmd::UpdateUniformBuffer,
+            cmd::DeleteUniformBuffer,
             cmd::CreateProgram,
             cmd::DeleteProgram,
+            cmd::CreateUniform,
             cmd::CreateTexture2D,
+            cmd::UpdateTexture2D,
             cmd::DeleteTexture,
             cmd::CreateFrameBuffer,
-            cmd::DeleteFrameBuffer>;
+            cmd::DeleteFrameBuffer,
+            cmd::CreateOcclusionQuery,
+            cmd::DeleteOcclusionQuery,
+            cmd::PrewarmPipeline>;
 // clang-format on
 
 using UniformData = std::variant<int, float, Vec2, Vec3, Vec4, Mat3, Mat4>;
 
-// Current render state.
-struct RenderItem {
+// Offsets into a uniform buffer passed to setUniformBuffer must be a multiple of this. This is the
+// largest minUniformBufferOffsetAlignment required by current devices.
+constexpr uint kUniformBufferOffsetAlignment = 256;
+
+// The maximum number of frames which can be in flight at once. See Renderer::setFrameCount.
+constexpr uint kMaxFrameCount = 4;
+
+// Current render state. Render items belonging to a frame allocate their uniform and resource
+// bindings from the frame's arena.
+struct RenderItem : PipelineState {
+    RenderItem() = default;
+    explicit RenderItem(FrameArena* arena)
+        : uniforms(FrameAllocator<UniformBinding>{arena}),
+          uniform_buffers(FrameAllocator<UniformBufferBinding>{arena}),
+          textures(FrameAllocator<TextureBinding>{arena}),
+          storage_buffers(FrameAllocator<StorageBufferBinding>{arena}),
+          storage_images(FrameAllocator<StorageImageBinding>{arena}) {
+    }
+
     struct SamplerInfo {
         u32 sampler_flags;
         float max_anisotropy;
@@ -343,6 +545,24 @@ struct RenderItem {
         }
     };
 
+    struct UniformBinding {
+        UniformHandle handle;
+        UniformData data;
+    };
+
+    // A range of a uniform buffer which provides the contents of a uniform block, instead of
+    // uniform values.
+    struct UniformBufferBinding {
+        uint binding_location;
+        UniformBufferHandle handle;
+        uint offset;
+
+        bool operator==(const UniformBufferBinding& other) const {
+            return binding_location == other.binding_location && handle == other.handle &&
+                   offset == other.offset;
+        }
+    };
+
     struct TextureBinding {
         uint binding_location;
         TextureHandle handle;
@@ -354,6 +574,28 @@ struct RenderItem {
         }
     };
 
+    // Indirect buffers can also be bound as storage buffers, so that compute shaders can write
+    // draw arguments.
+    struct StorageBufferBinding {
+        uint binding_location;
+        std::variant<StorageBufferHandle, IndirectBufferHandle> handle;
+
+        bool operator==(const StorageBufferBinding& other) const {
+            return binding_location == other.binding_location && handle == other.handle;
+        }
+    };
+
+    struct StorageImageBinding {
+        uint binding_location;
+        TextureHandle handle;
+        uint mip_level;
+
+        bool operator==(const StorageImageBinding& other) const {
+            return binding_location == other.binding_location && handle == other.handle &&
+                   mip_level == other.mip_level;
+        }
+    };
+
     // Vertices and indices.
     std::optional<VertexBufferHandle> vb;
     uint vb_offset = 0;  // Offset in bytes.
@@ -361,11 +603,39 @@ struct RenderItem {
     std::optional<IndexBufferHandle> ib;  // Offset in bytes.
     uint ib_offset = 0;
     uint primitive_count = 0;
+    int base_vertex = 0;  // Added to each index. Only used with an index buffer.
+
+    // Per-instance vertex data.
+    std::optional<VertexBufferHandle> instance_vb;
+    uint instance_vb_offset = 0;  // Offset in bytes.
+    VertexDecl instance_decl_override;
+    uint instance_count = 1;
+
+    // Indirect draw arguments. If set, the item draws 'draw_count' DrawIndexedIndirectCommands
+    // read from the indirect buffer instead of using primitive_count and instance_count.
+    std::optional<IndirectBufferHandle> indirect_buffer;
+    uint indirect_offset = 0;  // Offset in bytes.
+    uint draw_count = 0;
+
+    // Occlusion queries. The samples drawn by the item which pass the depth test are counted into
+    // 'occlusion_query', and the item is skipped if an earlier result of 'draw_condition' found
+    // no samples. See Renderer::setOcclusionQuery and Renderer::setDrawCondition.
+    std::optional<OcclusionQueryHandle> occlusion_query;
+    std::optional<OcclusionQueryHandle> draw_condition;
 
     // Shader program and parameters.
     std::optional<ProgramHandle> program;
-    std::unordered_map<std::string, UniformData> uniforms;
-    std::vector<TextureBinding> textures;
+    FrameVector<UniformBinding> uniforms;
+    FrameVector<UniformBufferBinding> uniform_buffers;
+    FrameVector<TextureBinding> textures;
+    FrameVector<StorageBufferBinding> storage_buffers;
+    // Storage images are only bound for dispatches.
+    FrameVector<StorageImageBinding> storage_images;
+
+    // Compute work group counts. Only used by items in RenderQueue::compute_items.
+    uint group_count_x = 0;
+    uint group_count_y = 0;
+    uint group_count_z = 0;
 
     // Scissor.
     bool scissor_enabled = false;
@@ -374,33 +644,187 @@ struct RenderItem {
     u16 scissor_width = 0;
     u16 scissor_height = 0;
 
-    // Render state.
-    bool depth_enabled = true;
-    bool cull_face_enabled = true;
-    CullFrontFace cull_front_face = CullFrontFace::CCW;
-    PolygonMode polygon_mode = PolygonMode::Fill;
-    bool blend_enabled = false;
-    BlendEquation blend_equation_rgb = BlendEquation::Add;
-    BlendFunc blend_src_rgb = BlendFunc::One;
-    BlendFunc blend_dest_rgb = BlendFunc::Zero;
-    BlendEquation blend_equation_a = BlendEquation::Add;
-    BlendFunc blend_src_a = BlendFunc::One;
-    BlendFunc blend_dest_a = BlendFunc::Zero;
-    bool colour_write = true;  // TODO: make component-wise
-    bool depth_write = true;
-    // TODO: Stencil write.
+    // Sorting.
+    float sort_depth = 0.0f;  // View space depth, used by depth sorted render queues.
+    u64 sort_key = 0;         // Packed program, render state, texture and buffer key.
 };
 
 // Render queue.
 struct RenderQueue {
+    RenderQueue() = default;
+    explicit RenderQueue(FrameArena* arena)
+        : render_items(FrameAllocator<RenderItem>{arena}),
+          compute_items(FrameAllocator<RenderItem>{arena}),
+          timing_scopes(FrameAllocator<TimingScope>{arena}) {
+    }
+
     struct ClearParameters {
         Colour colour;
         bool clear_colour;
         bool clear_depth;
     };
+    // What happens to the existing contents of an attachment when a queue starts rendering.
+    enum class LoadOp {
+        Load,     // Keep the existing contents.
+        Clear,    // Clear to the clear parameters (or to 0 colour and 1 depth without them).
+        DontCare  // The existing contents are undefined, for attachments that are fully drawn over.
+    };
+    // What happens to the contents of an attachment when a queue finishes rendering.
+    enum class StoreOp {
+        Store,    // Write the contents to memory, so that later queues can load or sample them.
+        DontCare  // The contents are undefined afterwards, such as for a depth buffer which is
+                  // only used within the queue.
+    };
+    // Load and store ops of the colour attachments and the depth attachment of a frame buffer.
+    // Discarding attachments saves memory bandwidth, particularly on tile based GPUs which
+    // otherwise copy each attachment into and out of tile memory.
+    struct AttachmentOps {
+        LoadOp colour_load = LoadOp::Load;
+        StoreOp colour_store = StoreOp::Store;
+        LoadOp depth_load = LoadOp::Load;
+        StoreOp depth_store = StoreOp::Store;
+    };
+    enum class SortMode {
+        Sequential,   // Submission order.
+        State,        // Minimise program, render state, texture and buffer changes.
+        FrontToBack,  // Ascending sort depth, then state.
+        BackToFront   // Descending sort depth, then state.
+    };
+    // A labelled range of render items which is timed on the GPU.
+    struct TimingScope {
+        std::string name;
+        uint begin;  // Index of the first render item.
+        uint end;    // Index after the last render item.
+        uint depth;  // Nesting depth within the render queue.
+    };
     std::optional<ClearParameters> clear_parameters;
+    // Without explicit attachment ops, attachments are cleared as requested by the clear
+    // parameters and loaded otherwise, and are always stored.
+    std::optional<AttachmentOps> attachment_ops;
     std::optional<FrameBufferHandle> frame_buffer;
-    std::vector<RenderItem> render_items;
+    SortMode sort_mode = SortMode::Sequential;
+    // Shown by graphics debuggers (such as RenderDoc) around the queue's commands, if not empty.
+    std::string label;
+    FrameVector<RenderItem> render_items;
+    // Compute dispatches. These run in submission order before the render items of this queue,
+    // with barriers before and after them, so their results are visible to later draws and
+    // dispatches (including indirect draw arguments). Consecutive queues that render to the same
+    // frame buffer share a render pass on Vulkan, so their dispatches all run before the first of
+    // these queues starts drawing.
+    FrameVector<RenderItem> compute_items;
+    // GPU timing scopes. Only used by Sequential queues, as sorting would reorder the items.
+    FrameVector<TimingScope> timing_scopes;
+
+    // Returns the attachment ops of this queue, taking the clear parameters into account.
+    AttachmentOps resolvedAttachmentOps() const {
+        if (attachment_ops) {
+            return *attachment_ops;
+        }
+        AttachmentOps ops;
+        if (clear_parameters && clear_parameters->clear_colour) {
+            ops.colour_load = LoadOp::Clear;
+        }
+        if (clear_parameters && clear_parameters->clear_depth) {
+            ops.depth_load = LoadOp::Clear;
+        }
+        return ops;
+    }
+};
+
+// GPU timings of a rendered frame, measured with timestamp queries. Timestamps are read back a few
+// frames after they are written so that reading them never stalls, so these lag behind the frame
+// being submitted.
+struct GpuTimings {
+    struct Scope {
+        std::string name;
+        uint render_queue;
+        uint depth;
+        double milliseconds;
+    };
+    // False if timestamp queries are not supported, or no frame has been measured yet.
+    bool valid = false;
+    // Time between the start and end of the frame's command stream, including uploads and
+    // dispatches.
+    double frame_milliseconds = 0.0;
+    // Time spent on the render items of each render queue, indexed by render queue. This doesn't
+    // include dispatches, which may be moved ahead of the queue (see RenderQueue::compute_items).
+    std::vector<double> render_queue_milliseconds;
+    std::vector<Scope> scopes;
+};
+
+// Statistics of a rendered frame, counted by the frontend and the backend while processing it.
+// Counters which don't apply to a backend are left at 0.
+struct FrameStats {
+    struct CacheStats {
+        u32 hits = 0;
+        u32 misses = 0;
+    };
+
+    // Work submitted by the frame.
+    u32 render_queues = 0;
+    u32 render_items = 0;
+    u32 compute_items = 0;
+    u32 pre_frame_commands = 0;
+    u32 post_frame_commands = 0;
+
+    // Work issued by the backend. Primitives drawn by indirect draws are not known on the CPU, so
+    // aren't counted.
+    u32 draw_calls = 0;
+    u32 dispatches = 0;
+    u64 primitives = 0;
+
+    // State changes. Program, texture and sampler binds are counted by GL, and pipeline and
+    // descriptor set binds by Vulkan.
+    u32 program_binds = 0;
+    u32 pipeline_binds = 0;
+    u32 descriptor_set_binds = 0;
+    u32 texture_binds = 0;
+    u32 sampler_binds = 0;
+    u64 uniform_bytes = 0;
+
+    // Transient vertex and index buffer bytes allocated this frame, and the capacity of their
+    // pages. 16 and 32 bit index buffers are counted together.
+    u32 transient_vb_used = 0;
+    u32 transient_vb_capacity = 0;
+    u32 transient_ib_used = 0;
+    u32 transient_ib_capacity = 0;
+
+    // Backend object caches. Vulkan reports the pipeline, descriptor set, vertex decl and sampler
+    // caches, and GL reports the sampler cache, uniform location lookups and its vertex array
+    // cache (as vertex_decl_cache).
+    CacheStats pipeline_cache;
+    CacheStats descriptor_set_cache;
+    CacheStats vertex_decl_cache;
+    CacheStats sampler_cache;
+    CacheStats uniform_location_cache;
+};
+
+// GPU memory used by resources, tracked by the backend as they are created and deleted. Vulkan
+// reports the size of each resource's memory allocation, and GL estimates it from the resource's
+// size and format. Buffers which are updated while frames are in flight have a copy for each
+// frame, which is included. Memory used by the renderer itself (such as the swap chain, transient
+// buffers and staging buffers) isn't tracked. The Null renderer doesn't report any memory.
+struct GpuMemoryStats {
+    u64 vertex_buffers = 0;
+    u64 index_buffers = 0;
+    u64 uniform_buffers = 0;
+    u64 storage_buffers = 0;  // Including indirect buffers.
+    u64 textures = 0;
+    // Textures which can be rendered to, and the depth buffers of frame buffers.
+    u64 render_targets = 0;
+
+    // Device local memory which this process can use without paging, and the amount it currently
+    // uses (including memory which isn't tracked above). Reported by VK_EXT_memory_budget on
+    // Vulkan, or GL_NVX_gpu_memory_info on GL, as the dedicated video memory and the amount of it
+    // in use by every process. False if neither is available.
+    bool budget_valid = false;
+    u64 budget = 0;
+    u64 usage = 0;
+
+    u64 total() const {
+        return vertex_buffers + index_buffers + uniform_buffers + storage_buffers + textures +
+               render_targets;
+    }
 };
 
 // Frame.
@@ -409,28 +833,51 @@ struct Frame {
     Frame();
     void clear();
 
+    // Per-frame allocations, reset in clear(). Declared first so that it outlives everything which
+    // allocates from it.
+    FrameArena arena;
+
     RenderItem pending_item;
     std::vector<RenderQueue> render_queues;
 
     std::vector<RenderCommand> commands_pre;
     std::vector<RenderCommand> commands_post;
 
-    // Transient vertex/index buffer storage.
-    struct {
-        std::array<byte, DW_MAX_TRANSIENT_VERTEX_BUFFER_SIZE> data;
-        uint size;
+    // If set, the frame is written to a capture file at this path when it's rendered. See
+    // Renderer::captureNextFrame.
+    std::optional<std::string> capture_path;
+
+    // Transient vertex/index buffer storage. Allocations are made from a list of pages which are
+    // kept between frames, so the storage can grow without invalidating pointers that have already
+    // been handed out. Each page maps to a fixed range of the backend buffer.
+    struct TransientBufferStorage {
+        struct Page {
+            std::unique_ptr<byte[]> data;
+            uint capacity = 0;
+            // Offset of this page in the backend buffer.
+            uint offset = 0;
+            uint size = 0;
+        };
+        std::vector<Page> pages;
+        usize current_page = 0;
+        // Minimum size of the backend buffer required to hold all allocations made this frame.
+        uint size = 0;
+
+        // Allocates 'size' bytes, adding a new page of at least 'page_size' bytes if needed.
+        byte* allocate(uint allocation_size, uint page_size, uint& offset);
+        void reset();
+    };
+    struct : TransientBufferStorage {
         std::optional<VertexBufferHandle> handle;
     } transient_vb_storage;
-
-    struct {
-        std::array<byte, DW_MAX_TRANSIENT_INDEX_BUFFER_SIZE> data;
-        uint size;
+    struct : TransientBufferStorage {
         std::optional<IndexBufferHandle> handle;
-    } transient_ib_storage;
+    } transient_ib_storage, transient_ib32_storage;
 
     // Transient vertex/index buffer data.
     struct TransientVertexBufferData {
         byte* data;
+        uint offset;
         uint size;
         VertexDecl decl;
     };
@@ -439,7 +886,9 @@ struct Frame {
     HandleGenerator<TransientVertexBufferHandle> transient_vertex_buffer_handle_generator_;
     struct TransientIndexBufferData {
         byte* data;
+        uint offset;
         uint size;
+        IndexBufferType type;
     };
     std::unordered_map<TransientIndexBufferHandle, TransientIndexBufferData>
         transient_index_buffers_;
@@ -452,13 +901,107 @@ struct Frame {
 #endif
 };
 
+// Records render items on a worker thread. Encoders are obtained from Renderer::beginEncoder and
+// returned with Renderer::endEncoder, and their items are merged into the render queues of the
+// current frame in Renderer::frame(). Resources used by an encoder must be created before it
+// begins recording.
+class DW_API Encoder {
+public:
+    void setVertexBuffer(VertexBufferHandle handle);
+    void setInstanceBuffer(VertexBufferHandle handle, uint offset = 0);
+    void setIndexBuffer(IndexBufferHandle handle);
+
+    void setUniform(UniformHandle uniform, UniformData data);
+    void setUniformBuffer(uint binding_location, UniformBufferHandle handle, uint offset = 0);
+    bool setTexture(uint binding_location, TextureHandle handle,
+                    u32 sampler_flags = SamplerFlag::Default, float max_anisotropy = 0.0f);
+    void setStorageBuffer(uint binding_location, StorageBufferHandle handle);
+    void setStorageBuffer(uint binding_location, IndirectBufferHandle handle);
+    void setStorageImage(uint binding_location, TextureHandle handle, uint mip_level = 0);
+
+    void setStateEnable(RenderState state);
+    void setStateDisable(RenderState state);
+    void setStateCullFrontFace(CullFrontFace front_face);
+    void setStatePolygonMode(PolygonMode polygon_mode);
+    void setStateBlendEquation(BlendEquation equation, BlendFunc src, BlendFunc dest);
+    void setColourWrite(bool write_enabled);
+    void setDepthWrite(bool write_enabled);
+    void setScissor(u16 x, u16 y, u16 width, u16 height);
+    void setSortDepth(float depth);
+    void setOcclusionQuery(OcclusionQueryHandle handle);
+    void setDrawCondition(OcclusionQueryHandle handle);
+
+    // Update uniform and draw state, then draw. The render queue must have been created on the
+    // submit thread this frame. See Renderer::submit for base_vertex.
+    void submit(uint render_queue, ProgramHandle program, uint vertex_count, uint offset = 0,
+                uint instance_count = 1, int base_vertex = 0);
+
+    // Update uniform and draw state, then draw using arguments read from an indirect buffer.
+    void submitIndirect(uint render_queue, ProgramHandle program, IndirectBufferHandle handle,
+                        uint draw_count, uint offset = 0);
+
+    // Update uniform and resource state, then dispatch a compute program.
+    void dispatch(uint render_queue, ProgramHandle program, uint group_count_x,
+                  uint group_count_y = 1, uint group_count_z = 1);
+
+private:
+    friend class Renderer;
+
+    explicit Encoder(Renderer& renderer);
+
+    Renderer& renderer_;
+    RenderItem pending_item_;
+    std::vector<std::pair<uint, RenderItem>> items_;
+    std::vector<std::pair<uint, RenderItem>> compute_items_;
+};
+
 // Low level renderer.
 class RenderContext;
+class ResourceJournal;
+// Functions which create, update or delete resources (buffers, textures, frame buffers, programs
+// and uniforms) can be called from any thread, such as asset loading threads. They take effect at
+// the start of the next frame submitted after they return. Everything else must be called from
+// the thread which calls frame(), or through an Encoder.
 class DW_API Renderer {
 public:
     explicit Renderer(Logger& logger);
     ~Renderer();
 
+    /// Sets the directory used to persist caches (such as compiled pipelines) between runs. Must
+    /// be called before init(). Caches are not persisted if no directory is set.
+    void setCacheDirectory(const std::string& directory);
+
+    /// Creates the window hidden, so that a GL or Vulkan renderer can run without being shown
+    /// (for example, in benchmarks). Must be called before init().
+    void setWindowHidden(bool hidden);
+
+    /// Keeps track of the commands which created every live resource, so that frames can be
+    /// captured with captureNextFrame(). This holds a reference to the data of each resource
+    /// until it's deleted. Must be called before init().
+    void setFrameCaptureEnabled(bool enabled);
+
+    /// Sets the number of frames which can be in flight when using a render thread, including
+    /// the frame being submitted. Defaults to 2. With more frames, the submit thread can run
+    /// further ahead of the render thread, so that a slow frame on one thread doesn't stall the
+    /// other, at the cost of latency. The submit thread only waits in frame() if every other frame
+    /// is still queued or being rendered. Must be between 2 and kMaxFrameCount, and must be called
+    /// before init().
+    void setFrameCount(uint count);
+
+    /// Sets how frames are presented. Defaults to Mailbox. Modes which the device doesn't support
+    /// fall back to Mailbox, then Fifo. OpenGL has no mailbox mode, so it uses Immediate instead.
+    /// 'swap_interval' is the number of vertical blanks that each frame is shown for with Fifo
+    /// and FifoRelaxed, which is only supported by OpenGL (Vulkan always uses 1). Can be called at
+    /// any time, and takes effect from the next rendered frame.
+    void setPresentMode(PresentMode mode, uint swap_interval = 1);
+
+    /// Sets the number of frames which the GPU can be working on at once, including the frame
+    /// being rendered. Defaults to 2. Fewer frames reduce the latency between submitting a frame
+    /// and it being shown, at the cost of the CPU waiting for the GPU more often. This is
+    /// separate to setFrameCount, which limits how far the submit thread can run ahead of the
+    /// render thread. Must be between 1 and kMaxFrameCount, and must be called before init().
+    void setMaxFramesInFlight(uint count);
+
     /// Initialise.
     Result<void, std::string> init(RendererType type, u16 width, u16 height,
                                    const std::string& title, InputCallbacks input_callbacks,
@@ -479,6 +1022,11 @@ public:
     void updateVertexBuffer(VertexBufferHandle handle, Memory data, uint offset);
     void deleteVertexBuffer(VertexBufferHandle handle);
 
+    /// Sets a per-instance vertex stream for the next instanced draw. Instance attributes are
+    /// assigned shader locations immediately after the per-vertex attributes.
+    void setInstanceBuffer(VertexBufferHandle handle, uint offset = 0);
+    void setInstanceBuffer(TransientVertexBufferHandle handle);
+
     /// Create index buffer.
     IndexBufferHandle createIndexBuffer(Memory data, IndexBufferType type,
                                         BufferUsage usage = BufferUsage::Static);
@@ -486,22 +1034,80 @@ public:
     void updateIndexBuffer(IndexBufferHandle handle, Memory data, uint offset);
     void deleteIndexBuffer(IndexBufferHandle handle);
 
-    /// Transient vertex buffer.
+    /// Create indirect buffer. The buffer contains an array of DrawIndexedIndirectCommand, and is
+    /// used with submitIndirect. It can be updated from the CPU or written by the GPU.
+    IndirectBufferHandle createIndirectBuffer(Memory data,
+                                              BufferUsage usage = BufferUsage::Static);
+    void updateIndirectBuffer(IndirectBufferHandle handle, Memory data, uint offset);
+    void deleteIndirectBuffer(IndirectBufferHandle handle);
+
+    /// Create storage buffer. Storage buffers can be read and written by compute programs, and read
+    /// by vertex and fragment programs.
+    StorageBufferHandle createStorageBuffer(Memory data, BufferUsage usage = BufferUsage::Static);
+    void updateStorageBuffer(StorageBufferHandle handle, Memory data, uint offset);
+    void deleteStorageBuffer(StorageBufferHandle handle);
+
+    /// Binds a storage buffer to a binding location defined in the current shader program.
+    void setStorageBuffer(uint binding_location, StorageBufferHandle handle);
+    /// Binds an indirect buffer as a storage buffer, so that a compute program can write draw
+    /// arguments which are consumed by submitIndirect.
+    void setStorageBuffer(uint binding_location, IndirectBufferHandle handle);
+
+    /// Create uniform buffer. A uniform buffer holds the contents of one or more uniform blocks
+    /// laid out with std140 rules, such as per-camera or per-material constants, so that they are
+    /// uploaded once instead of for every draw.
+    UniformBufferHandle createUniformBuffer(Memory data, BufferUsage usage = BufferUsage::Static);
+    void updateUniformBuffer(UniformBufferHandle handle, Memory data, uint offset);
+    void deleteUniformBuffer(UniformBufferHandle handle);
+
+    /// Sources the uniform block at a binding location defined in the current shader program from
+    /// a uniform buffer, starting at 'offset' bytes (a multiple of kUniformBufferOffsetAlignment).
+    /// Uniforms set with setUniform which belong to that block are ignored.
+    void setUniformBuffer(uint binding_location, UniformBufferHandle handle, uint offset = 0);
+
+    /// Transient vertex buffer. The data is written into CPU memory owned by the frame being
+    /// submitted, which is copied into the backend's stream buffer once when the frame is
+    /// rendered, as the render thread may still be drawing the previous frame from GPU memory.
+    /// Storage grows as needed, so this only returns std::nullopt if the frame has run out of
+    /// transient buffer handles.
     std::optional<TransientVertexBufferHandle> allocTransientVertexBuffer(uint vertex_count,
                                                                           const VertexDecl& decl);
     byte* getTransientVertexBufferData(TransientVertexBufferHandle handle);
     void setVertexBuffer(TransientVertexBufferHandle handle);
 
     /// Transient index buffer.
-    std::optional<TransientIndexBufferHandle> allocTransientIndexBuffer(uint index_count);
+    std::optional<TransientIndexBufferHandle> allocTransientIndexBuffer(
+        uint index_count, IndexBufferType type = IndexBufferType::U16);
     byte* getTransientIndexBufferData(TransientIndexBufferHandle handle);
     void setIndexBuffer(TransientIndexBufferHandle handle);
 
+    /// Sets the page size of transient vertex/index buffer storage. Transient storage grows by a
+    /// page whenever a frame's allocations exceed its current capacity.
+    void setTransientBufferPageSize(uint vertex_buffer_page_size, uint index_buffer_page_size);
+
     /// Create program.
     ProgramHandle createProgram(std::vector<ShaderStageInfo> stages);
+    /// Create program in the background. Shader module creation, reflection and cross-compilation
+    /// happen on worker threads, so large programs don't stall a frame. Draws using the program
+    /// are skipped until it is ready.
+    ProgramHandle createProgramAsync(std::vector<ShaderStageInfo> stages);
+    /// Returns true once a program has been created by the render thread and can be drawn with.
+    bool isProgramReady(ProgramHandle program) const;
     void deleteProgram(ProgramHandle program);
 
+    /// Interns a uniform name. Calling this multiple times with the same name returns the same
+    /// handle, which can be used to set uniforms without hashing the name on every draw.
+    UniformHandle createUniform(const std::string& uniform_name);
+
     /// Uniforms.
+    void setUniform(UniformHandle uniform, int value);
+    void setUniform(UniformHandle uniform, float value);
+    void setUniform(UniformHandle uniform, const Vec2& value);
+    void setUniform(UniformHandle uniform, const Vec3& value);
+    void setUniform(UniformHandle uniform, const Vec4& value);
+    void setUniform(UniformHandle uniform, const Mat3& value);
+    void setUniform(UniformHandle uniform, const Mat4& value);
+    void setUniform(UniformHandle uniform, UniformData data);
     void setUniform(const std::string& uniform_name, int value);
     void setUniform(const std::string& uniform_name, float value);
     void setUniform(const std::string& uniform_name, const Vec2& value);
@@ -513,15 +1119,57 @@ public:
 
     // Create texture.
     TextureHandle createTexture2D(u16 width, u16 height, TextureFormat format, Memory data,
-                                  bool generate_mipmaps = true, bool framebuffer_usage = false);
+                                  bool generate_mipmaps = true, bool framebuffer_usage = false,
+                                  bool storage_usage = false);
+    /// Creates a texture from a precomputed mip chain, starting with the base level. Each level
+    /// must contain exactly textureLevelSize(format, width >> level, height >> level) bytes, or
+    /// an invalid handle is returned.
+    TextureHandle createTexture2D(u16 width, u16 height, TextureFormat format,
+                                  std::vector<Memory> mip_levels);
+    /// Replaces a region of a mip level of a texture, such as a video frame or a glyph cache page.
+    /// 'data' must contain exactly textureLevelSize(format, width, height) bytes. Regions of
+    /// compressed textures must be aligned to blocks, except where they reach the level's edge.
+    /// The upload is staged by the backend, so it doesn't wait for the GPU to finish using the
+    /// texture in earlier frames.
+    void updateTexture2D(TextureHandle handle, Memory data, u16 x, u16 y, u16 width, u16 height,
+                         uint mip_level = 0);
+    /// Creates a 2D array texture, made up of 'layers' images of the same size and format. 'data'
+    /// contains the base level of each layer in turn, or is empty if the texture is uninitialised.
+    /// Array textures are sampled with a sampler2DArray, and can't be updated, rendered to or
+    /// bound as storage images. Returns an invalid handle if 'data' has the wrong size.
+    TextureHandle createTexture2DArray(u16 width, u16 height, u16 layers, TextureFormat format,
+                                       Memory data, bool generate_mipmaps = true);
+    /// Returns true if textures of this format can be created and sampled. Only valid after init.
+    bool isTextureFormatSupported(TextureFormat format) const;
+    /// Returns true if programs can sample textures from the bindless texture table. Only valid
+    /// after init.
+    bool isBindlessTexturingSupported() const;
+    /// Returns the index of a texture in the bindless texture table, which lets draws select
+    /// textures with an index instead of binding them, so that draws with different textures can
+    /// be merged. Programs opt in by declaring the table (of up to DW_MAX_BINDLESS_TEXTURES
+    /// textures) at set 1, binding 0:
+    ///
+    ///     layout(set = 1, binding = 0) uniform sampler2D textures[4096];
+    ///
+    /// Every 2D texture other than frame buffer and storage textures is in the table, sampled with
+    /// SamplerFlag::Default, and keeps its index until it's deleted. On Vulkan the index may vary
+    /// within a draw if it's wrapped in nonuniformEXT. On OpenGL it must be dynamically uniform,
+    /// such as a uniform or a value read from a storage buffer with the draw ID. Returns
+    /// std::nullopt if the texture isn't in the table, or bindless texturing isn't supported.
+    std::optional<u32> bindlessTextureIndex(TextureHandle handle) const;
     // get texture information.
     void deleteTexture(TextureHandle handle);
     // Binds a texture to a binding location defined in the current shader program.
     bool setTexture(uint binding_location, TextureHandle handle,
                     u32 sampler_flags = SamplerFlag::Default, float max_anisotropy = 0.0f);
+    /// Binds a mip level of a texture as a storage image for the next dispatch. The texture must
+    /// have been created with storage_usage.
+    void setStorageImage(uint binding_location, TextureHandle handle, uint mip_level = 0);
 
     // Framebuffer.
     FrameBufferHandle createFrameBuffer(u16 width, u16 height, TextureFormat format);
+    /// Creates a frame buffer which renders to 'textures', which must be 2D textures of the same
+    /// size. Returns an invalid handle if they aren't.
     FrameBufferHandle createFrameBuffer(std::vector<TextureHandle> textures);
     TextureHandle getFrameBufferTexture(FrameBufferHandle handle, uint index);
     void deleteFrameBuffer(FrameBufferHandle handle);
@@ -545,6 +1193,62 @@ public:
     void setRenderQueueClear(uint render_queue, const Colour& colour, bool clear_colour = true,
                              bool clear_depth = true);
 
+    /// Sets what happens to the contents of the attachments of the last created render queue
+    /// before and after it renders. This overrides the load ops implied by setRenderQueueClear,
+    /// although the clear colour is still used by LoadOp::Clear. Consecutive render queues which
+    /// output to the same frame buffer may be merged into one render pass, in which case the load
+    /// ops of the first and the store ops of the last are used.
+    void setRenderQueueAttachmentOps(const RenderQueue::AttachmentOps& ops);
+
+    /// Sets what happens to the contents of the attachments of a render queue before and after it
+    /// renders.
+    void setRenderQueueAttachmentOps(uint render_queue, const RenderQueue::AttachmentOps& ops);
+
+    /// Sets the order in which the items of the last created render queue are processed.
+    /// Note that uniforms persist between draws using the same program, so items in a sorted
+    /// queue should set all of the uniforms they depend on.
+    void setRenderQueueSortMode(RenderQueue::SortMode sort_mode);
+
+    /// Sets the order in which the items of a render queue are processed.
+    void setRenderQueueSortMode(uint render_queue, RenderQueue::SortMode sort_mode);
+
+    /// Labels the last created render queue. Backends emit the label as a debug group around the
+    /// queue's commands, so that it shows up in graphics debuggers such as RenderDoc and Nsight.
+    void setRenderQueueLabel(std::string label);
+
+    /// Labels a render queue.
+    void setRenderQueueLabel(uint render_queue, std::string label);
+
+    /// Starts a labelled GPU timing scope in the last created render queue. The scope covers the
+    /// items submitted to the queue until the matching endGpuScope. Scopes can be nested, and are
+    /// only measured in Sequential render queues.
+    void beginGpuScope(std::string name);
+
+    /// Starts a labelled GPU timing scope in a render queue.
+    void beginGpuScope(uint render_queue, std::string name);
+
+    /// Ends the innermost GPU timing scope of the last created render queue.
+    void endGpuScope();
+
+    /// Ends the innermost GPU timing scope of a render queue.
+    void endGpuScope(uint render_queue);
+
+    /// Returns the GPU timings of the most recently measured frame. See GpuTimings.
+    GpuTimings gpuTimings() const;
+
+    /// Returns the statistics of the most recently rendered frame. See FrameStats.
+    FrameStats frameStats() const;
+
+    /// Returns the GPU memory used by each category of resource, and the memory budget if the
+    /// backend can query it. See GpuMemoryStats. Resources are counted once the render thread has
+    /// processed their create command.
+    GpuMemoryStats gpuMemoryStats() const;
+
+    /// Writes the next frame submitted by frame() to a capture file, along with the resources it
+    /// uses, once it has been rendered. Captures can be replayed offline with FrameReplay.
+    /// Requires setFrameCaptureEnabled(true).
+    void captureNextFrame(const std::string& path);
+
     /// Update state.
     void setStateEnable(RenderState state);
     void setStateDisable(RenderState state);
@@ -559,6 +1263,37 @@ public:
     /// Scissor.
     void setScissor(u16 x, u16 y, u16 width, u16 height);
 
+    /// Sets the view space depth of the next submitted item. Only used by render queues which are
+    /// sorted front-to-back or back-to-front.
+    void setSortDepth(float depth);
+
+    /// Creates an occlusion query, which counts the samples of a draw that pass the depth test.
+    /// A query is usually written by a cheap proxy draw (such as a bounding box with colour and
+    /// depth writes disabled), and used as the draw condition of the object that it stands in for.
+    OcclusionQueryHandle createOcclusionQuery();
+    void deleteOcclusionQuery(OcclusionQueryHandle handle);
+
+    /// Counts the samples of the next submitted draw into an occlusion query. Each query can be
+    /// written by at most one draw per frame.
+    void setOcclusionQuery(OcclusionQueryHandle handle);
+
+    /// Skips the next submitted draw if a previous result of an occlusion query found no samples.
+    /// Where conditional rendering is supported, the GPU skips the draw without the result being
+    /// read back: Vulkan uses the result from the previous frame, and OpenGL uses the latest
+    /// result which is available without waiting. Otherwise, the result last read back by the CPU
+    /// is used (see occlusionQueryResult). Draws are never skipped by a query which has no result
+    /// yet, such as one which was created this frame.
+    void setDrawCondition(OcclusionQueryHandle handle);
+
+    /// Returns the latest result of an occlusion query which has been read back, or std::nullopt
+    /// if there isn't one yet. Results are read back asynchronously so that the renderer never
+    /// waits for the GPU, and lag the frame being submitted by at least a frame. Backends which
+    /// can't count samples exactly return a non-zero value if any samples passed.
+    std::optional<u64> occlusionQueryResult(OcclusionQueryHandle handle) const;
+
+    /// Returns true if draw conditions are evaluated by the GPU. Only valid after init.
+    bool isConditionalRenderingSupported() const;
+
     /// Update uniform and draw state, but submit no geometry. Submits to the last created render
     /// queue.
     void submit(ProgramHandle program);
@@ -574,6 +1309,49 @@ public:
     /// Offset is in vertices/indices depending on whether an index buffer is being used.
     void submit(uint render_queue, ProgramHandle program, uint vertex_count, uint offset = 0);
 
+    /// Update uniform and draw state, then draw multiple instances. Submits to the last created
+    /// render queue. 'base_vertex' is added to each index before it's used to fetch a vertex,
+    /// which allows several meshes to share one index buffer and vertex buffer without rebasing
+    /// their indices. It's ignored if no index buffer is bound.
+    void submit(ProgramHandle program, uint vertex_count, uint offset, uint instance_count,
+                int base_vertex = 0);
+
+    /// Update uniform and draw state, then draw multiple instances.
+    void submit(uint render_queue, ProgramHandle program, uint vertex_count, uint offset,
+                uint instance_count, int base_vertex = 0);
+
+    /// Update uniform and draw state, then issue 'draw_count' indexed draws with arguments read
+    /// from an indirect buffer, starting 'offset' bytes into the buffer. An index buffer must be
+    /// bound. Where supported, this is a single multi-draw call. Submits to the last created render
+    /// queue.
+    void submitIndirect(ProgramHandle program, IndirectBufferHandle handle, uint draw_count,
+                        uint offset = 0);
+
+    /// Update uniform and draw state, then issue 'draw_count' indexed draws with arguments read
+    /// from an indirect buffer.
+    void submitIndirect(uint render_queue, ProgramHandle program, IndirectBufferHandle handle,
+                        uint draw_count, uint offset = 0);
+
+    /// Update uniform and resource state, then dispatch a compute program. Submits to the last
+    /// created render queue.
+    void dispatch(ProgramHandle program, uint group_count_x, uint group_count_y = 1,
+                  uint group_count_z = 1);
+
+    /// Update uniform and resource state, then dispatch a compute program. The dispatch runs
+    /// before the render items of the render queue (see RenderQueue::compute_items).
+    void dispatch(uint render_queue, ProgramHandle program, uint group_count_x,
+                  uint group_count_y = 1, uint group_count_z = 1);
+
+    /// Returns true if compute programs and storage buffers are supported. Only valid after init.
+    bool isComputeSupported() const;
+
+    /// Creates the pipeline which would be used to draw with the current render state, program and
+    /// vertex layout into a render queue, without drawing anything. This can be used during loading
+    /// to avoid hitches the first time something is drawn. Resets the current render state in the
+    /// same way as submit.
+    void prewarmPipeline(uint render_queue, ProgramHandle program, const VertexDecl& decl,
+                         const VertexDecl& instance_decl = VertexDecl{});
+
     /// Update uniform and draw state, then draws a full screen quad. Submits to the last created
     /// render queue.
     void submitFullscreenQuad(ProgramHandle program);
@@ -581,6 +1359,12 @@ public:
     /// Update uniform and draw state, then draws a full screen quad.
     void submitFullscreenQuad(uint render_queue, ProgramHandle program);
 
+    /// Returns an encoder which can be used to record render items on another thread.
+    Encoder* beginEncoder();
+
+    /// Returns an encoder to the renderer. Its items will be submitted in the next call to frame().
+    void endEncoder(Encoder* encoder);
+
     /// Render a single frame.
     bool frame();
 
@@ -601,6 +1385,9 @@ private:
 
     u16 width_, height_;
     std::string window_title_;
+    std::string cache_directory_;
+    bool window_hidden_;
+    bool frame_capture_enabled_;
 
     bool use_render_thread_;
     bool is_first_frame_;
@@ -609,56 +1396,111 @@ private:
     // Handles.
     HandleGenerator<VertexBufferHandle> vertex_buffer_handle_;
     HandleGenerator<IndexBufferHandle> index_buffer_handle_;
+    HandleGenerator<IndirectBufferHandle> indirect_buffer_handle_;
+    HandleGenerator<StorageBufferHandle> storage_buffer_handle_;
+    HandleGenerator<UniformBufferHandle> uniform_buffer_handle_;
     HandleGenerator<ShaderHandle> shader_handle_;
     HandleGenerator<ProgramHandle> program_handle_;
+    HandleGenerator<UniformHandle> uniform_handle_;
     HandleGenerator<TextureHandle> texture_handle_;
     HandleGenerator<FrameBufferHandle> frame_buffer_handle_;
+    HandleGenerator<OcclusionQueryHandle> occlusion_query_handle_;
+
+    // Resource info. Guarded by resource_mutex_, as resources can be created on any thread.
+    mutable std::shared_mutex resource_mutex_;
 
     // Vertex/index buffers.
     struct VertexBufferInfo {
         VertexDecl decl;
         BufferUsage usage;
     };
-    std::unordered_map<VertexBufferHandle, VertexBufferInfo> vertex_buffer_info_;
-    std::unordered_map<IndexBufferHandle, IndexBufferType> index_buffer_types_;
+    HandleMap<VertexBufferHandle, VertexBufferInfo> vertex_buffer_info_;
+    HandleMap<IndexBufferHandle, IndexBufferType> index_buffer_types_;
+    HandleMap<IndirectBufferHandle, uint> indirect_buffer_sizes_;
+    HandleMap<StorageBufferHandle, uint> storage_buffer_sizes_;
+    HandleMap<UniformBufferHandle, uint> uniform_buffer_sizes_;
     VertexBufferHandle transient_vb;
-    uint transient_vb_max_size;
+    uint transient_vb_page_size;
     IndexBufferHandle transient_ib;
-    uint transient_ib_max_size;
+    IndexBufferHandle transient_ib32;
+    uint transient_ib_page_size;
+
+    // Uniforms.
+    std::unordered_map<std::string, UniformHandle> uniform_handles_;
 
     // Textures.
     struct TextureData {
         u16 width;
         u16 height;
         TextureFormat format;
+        bool storage_usage;
+        // 0 if the texture isn't an array.
+        u16 array_layers;
+        bool bindless;
+        // Number of mip levels, including the base level.
+        u32 mip_levels;
     };
-    std::unordered_map<TextureHandle, TextureData> texture_data_;
+    HandleMap<TextureHandle, TextureData> texture_data_;
 
     // Framebuffers.
-    std::unordered_map<FrameBufferHandle, std::vector<TextureHandle>> frame_buffer_textures_;
+    HandleMap<FrameBufferHandle, std::vector<TextureHandle>> frame_buffer_textures_;
 
     // Fullscreen quad.
     VertexBufferHandle fullscreen_quad_vb_;
 
-    // Shared.
-    std::atomic<bool> shared_rt_should_exit_;
-    bool shared_rt_finished_;
-    dga::Barrier shared_frame_barrier_;
-    std::mutex swap_mutex_;
-    std::condition_variable swap_cv_;
-    bool swapped_frames_;
+    // GPU timing scopes which have not been ended yet, as (render queue, scope index) pairs.
+    std::vector<std::pair<uint, usize>> open_gpu_scopes_;
 
-    Frame frames_[2];
+    // Shared. Frames are handed to the render thread through submitted_frames_, and handed back
+    // through free_frames_ once they've been rendered.
+    std::atomic<bool> shared_rt_should_exit_;
+    std::atomic<bool> shared_rt_finished_;
+    FrameQueue submitted_frames_;
+    FrameQueue free_frames_;
+
+    uint frame_count_;
+    PresentMode present_mode_;
+    uint swap_interval_;
+    uint max_frames_in_flight_;
+    std::vector<std::unique_ptr<Frame>> frames_;
     Frame* submit_;
-    Frame* render_;
 
-    // Add a command to the submit thread.
+    // Encoders.
+    std::mutex encoder_mutex_;
+    std::vector<std::unique_ptr<Encoder>> encoders_;
+    std::vector<Encoder*> free_encoders_;
+    std::vector<Encoder*> finished_encoders_;
+    friend class Encoder;
+
+    // Fills in the draw parameters of a render item before it's added to a render queue.
+    void finishRenderItem(RenderItem& item, ProgramHandle program, uint vertex_count, uint offset,
+                          uint instance_count, int base_vertex = 0) const;
+    // Fills in the draw parameters of an indirect render item. Returns false if it can't be drawn.
+    bool finishIndirectRenderItem(RenderItem& item, ProgramHandle program,
+                                  IndirectBufferHandle handle, uint draw_count, uint offset) const;
+    // Fills in the group counts of a compute item. Returns false if it can't be dispatched.
+    bool finishComputeItem(RenderItem& item, ProgramHandle program, uint group_count_x,
+                           uint group_count_y, uint group_count_z) const;
+    void mergeEncoders();
+    // Ends any open GPU timing scopes, and drops the scopes of sorted render queues.
+    void finishGpuScopes();
+    // Drops the occlusion queries of items which write a query that an earlier item in the frame
+    // has already written.
+    void finishOcclusionQueries();
+
+    // Add a command to the next frame. Commands can be submitted from any thread, and are moved
+    // into the frame when it's handed to the render thread.
+    MpscQueue<RenderCommand> pending_commands_pre_;
+    MpscQueue<RenderCommand> pending_commands_post_;
     void submitPreFrameCommand(RenderCommand command);
     void submitPostFrameCommand(RenderCommand command);
 
     // Renderer.
     std::unique_ptr<RenderContext> shared_render_context_;
 
+    // Live resources, used to capture frames. Only accessed on the render thread.
+    std::unique_ptr<ResourceJournal> resource_journal_;
+
     // Render thread proc.
     void renderThread();
     bool renderFrame(Frame* frame);
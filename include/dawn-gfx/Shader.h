@@ -5,6 +5,7 @@
 #pragma once
 
 #include "Renderer.h"
+#include "ShaderCache.h"
 
 namespace dw {
 namespace gfx {
@@ -13,9 +14,23 @@ struct ShaderCompileError {
     std::string debug_log;
 };
 
-// Compiles an in-memory GLSL shader into SPIR-V.
+// Compiles an in-memory GLSL shader into SPIR-V. If a cache is provided, previously compiled
+// SPIR-V is returned from the cache without invoking the compiler, and newly compiled SPIR-V is
+// added to it.
 Result<ShaderStageInfo, ShaderCompileError> compileGLSL(
     ShaderStage stage, const std::string& glsl_source,
-    const std::vector<std::string>& compile_definitions = {});
+    const std::vector<std::string>& compile_definitions = {}, ShaderCache* cache = nullptr);
+
+struct GLSLCompileJob {
+    ShaderStage stage;
+    std::string glsl_source;
+    std::vector<std::string> compile_definitions;
+};
+
+// Compiles many GLSL shaders into SPIR-V in parallel, returning a result for each job in the same
+// order as the jobs. The worker threads are shared by every call, and concurrent calls run one
+// after another.
+std::vector<Result<ShaderStageInfo, ShaderCompileError>> compileGLSLBatch(
+    const std::vector<GLSLCompileJob>& jobs, ShaderCache* cache = nullptr);
 }  // namespace gfx
 }  // namespace dw
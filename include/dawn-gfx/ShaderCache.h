@@ -0,0 +1,66 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Base.h"
+#include "detail/Memory.h"
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace dw {
+namespace gfx {
+// A content addressed cache of compiled SPIR-V, which can be persisted to a single pack file.
+// Cached shaders are keyed on everything which affects the output of compileGLSL (the stage,
+// source, compile definitions and compiler version). Loaded pack files are memory mapped where
+// supported, so SPIR-V returned from a loaded cache refers directly to the file contents.
+class DW_API ShaderCache {
+public:
+    struct Entry {
+        // The content which the key was hashed from. Lookups compare it, so that two shaders
+        // whose keys collide can't return each other's SPIR-V.
+        std::string key_data;
+        std::string entry_point;
+        Memory spirv;
+    };
+
+    ShaderCache();
+    ~ShaderCache();
+
+    // Non-copyable.
+    ShaderCache(const ShaderCache&) = delete;
+    ShaderCache& operator=(const ShaderCache&) = delete;
+
+    /// Loads entries from a pack file written by save(), adding them to this cache. Returns false
+    /// if the file doesn't exist or isn't a valid pack file.
+    bool load(const std::string& path);
+
+    /// Writes all entries to a pack file. Returns false if the file couldn't be written. The
+    /// pack is written to a temporary file which then replaces 'path', so it's safe to save to
+    /// the file that the cache was loaded from.
+    bool save(const std::string& path) const;
+
+    /// Looks up a compiled shader by key, returning it only if its key data matches.
+    std::optional<Entry> find(u64 key, const std::string& key_data) const;
+
+    /// Adds a compiled shader to the cache.
+    void insert(u64 key, Entry entry);
+
+    /// Number of cached shaders.
+    usize size() const;
+
+    /// Returns true if entries were inserted since the cache was last saved.
+    bool dirty() const;
+
+private:
+    std::unordered_map<u64, Entry> entries_;
+    mutable bool dirty_;
+    mutable std::mutex mutex_;
+};
+}  // namespace gfx
+}  // namespace dw
@@ -0,0 +1,52 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Renderer.h"
+
+namespace dw {
+namespace gfx {
+// Memory layout of a texture format. Texel data is stored in blocks, which are 1x1 for
+// uncompressed formats.
+struct TextureFormatInfo {
+    u8 block_width;
+    u8 block_height;
+    u8 block_size;
+    bool compressed;
+};
+
+DW_API TextureFormatInfo textureFormatInfo(TextureFormat format);
+
+// Size in bytes of a single tightly packed mip level. Dimensions are clamped to 1.
+DW_API usize textureLevelSize(TextureFormat format, u32 width, u32 height);
+
+// Number of mip levels in a full mip chain of a texture.
+DW_API u32 textureMipCount(u32 width, u32 height);
+
+// Size in bytes of 'level_count' tightly packed mip levels of a texture, starting at 'first_level'.
+DW_API usize textureLevelsSize(TextureFormat format, u32 width, u32 height, u32 first_level,
+                               u32 level_count);
+
+// A texture loaded from a container file. Mip level data refers directly to the loaded file, which
+// is kept alive until the last level is released.
+struct LoadedTexture {
+    u16 width;
+    u16 height;
+    TextureFormat format;
+    // True if the texel data is sRGB encoded.
+    bool srgb;
+    std::vector<Memory> mip_levels;
+};
+
+// Loads a 2D texture from a KTX2 or DDS file, detected from the file contents. The file is memory
+// mapped where supported. Supercompressed KTX2 files, cube maps, arrays and 3D textures are not
+// supported.
+DW_API Result<LoadedTexture, std::string> loadTexture(const std::string& path);
+
+// Parses a 2D texture from a KTX2 or DDS file which has already been loaded into memory. Mip
+// levels refer to (and keep alive) the memory block.
+DW_API Result<LoadedTexture, std::string> loadTexture(Memory file_data);
+}  // namespace gfx
+}  // namespace dw
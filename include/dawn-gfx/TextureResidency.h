@@ -0,0 +1,132 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Renderer.h"
+#include "Texture.h"
+#include <vector>
+
+DEFINE_HANDLE_TYPE(StreamedTextureHandle);
+
+namespace dw {
+namespace gfx {
+/// Streams the mip levels of textures in and out of GPU memory, so that textures only use as much
+/// memory as the detail they're drawn with needs, and the textures together fit within a budget.
+/// The mip chain of each texture is kept in CPU memory, and each frame:
+///
+/// - Every texture which is drawn requests the detail it needs with requestDetail(). Textures
+///   which haven't been requested for a while are reduced to their smallest level.
+/// - The levels needed by each request are chosen, starting from the level whose texels are
+///   closest to (but not larger than) a screen pixel.
+/// - If the chosen levels don't fit in the budget, the largest level is dropped from the texture
+///   whose texels are smallest on screen, until they do.
+/// - Textures which have too many levels resident are streamed out first, then textures which
+///   need more levels are streamed in, up to a number of bytes per frame. Textures whose resident
+///   texels are largest on screen are streamed in first.
+///
+/// A texture is streamed in or out by creating a new texture from the resident part of its mip
+/// chain, and deleting the previous one, so texture() (and the texture's bindless index) changes
+/// when it's streamed. The previous texture isn't deleted until the frame has been rendered, so
+/// frames can still sample it. Memory is counted in bytes of tightly packed texel data, which is
+/// the same as the textures count towards Renderer::gpuMemoryStats() on GL.
+class DW_API TextureResidency {
+public:
+    struct Stats {
+        uint textures = 0;
+        // Bytes of resident levels, and the bytes that would be resident if every texture had the
+        // levels it requested.
+        usize resident_bytes = 0;
+        usize requested_bytes = 0;
+        // Textures streamed in and out by the last update, and the bytes they uploaded.
+        uint streamed_in = 0;
+        uint streamed_out = 0;
+        usize uploaded_bytes = 0;
+    };
+
+    /// Creates a residency manager which keeps the resident levels of its textures within
+    /// 'budget_bytes'.
+    TextureResidency(Renderer& r, usize budget_bytes);
+    ~TextureResidency();
+
+    // Non-copyable.
+    TextureResidency(const TextureResidency&) = delete;
+    TextureResidency& operator=(const TextureResidency&) = delete;
+
+    /// Sets the memory budget of resident levels. The smallest level of every texture is always
+    /// resident, even if that exceeds the budget.
+    void setBudget(usize budget_bytes);
+
+    /// Limits the bytes uploaded to stream in levels each frame, to avoid spikes when many
+    /// textures come into view at once. At least one texture is streamed in each frame, however
+    /// large it is. 0 disables the limit.
+    void setMaxUploadBytesPerFrame(usize bytes);
+
+    /// Adds a texture with a precomputed mip chain, starting with the base level. Each level must
+    /// contain exactly textureLevelSize(format, width >> level, height >> level) bytes. Only the
+    /// smallest level is resident until the texture is requested.
+    StreamedTextureHandle add(u16 width, u16 height, TextureFormat format,
+                              std::vector<Memory> mip_levels);
+
+    /// Adds a texture loaded with loadTexture().
+    StreamedTextureHandle add(const LoadedTexture& texture);
+
+    /// Removes a texture, and deletes its resident levels.
+    void remove(StreamedTextureHandle handle);
+
+    /// Requests that a texture is resident with enough detail to be drawn this frame, covering
+    /// 'screen_size' pixels along its longest side. The largest request since the last update is
+    /// used.
+    void requestDetail(StreamedTextureHandle handle, float screen_size);
+
+    /// Returns the texture containing the resident levels, which can be bound with setTexture()
+    /// until the next update.
+    TextureHandle texture(StreamedTextureHandle handle) const;
+
+    /// Returns the level of the original mip chain which is the base level of texture().
+    uint residentLevel(StreamedTextureHandle handle) const;
+
+    /// Chooses the resident levels of each texture from this frame's requests, then streams
+    /// textures in and out. Called once per frame, before the frame is submitted.
+    void update();
+
+    /// Returns statistics of the most recent update.
+    Stats stats() const;
+
+private:
+    struct StreamedTexture {
+        u32 generation = 0;
+        bool live = false;
+        u16 width = 0;
+        u16 height = 0;
+        TextureFormat format = TextureFormat::RGBA8;
+        std::vector<Memory> mip_levels;
+        TextureHandle texture;
+        // First level of the mip chain which is resident, and which should be resident.
+        uint resident_level = 0;
+        uint target_level = 0;
+        // Largest requested screen size since the last update, and the screen size used by the
+        // last update, which is kept until the request expires.
+        float requested_size = 0.0f;
+        float screen_size = 0.0f;
+        uint frames_since_request = 0;
+    };
+
+    Renderer& r_;
+    usize budget_bytes_;
+    usize max_upload_bytes_per_frame_;
+    std::vector<StreamedTexture> textures_;
+    std::vector<u32> free_indices_;
+    Stats stats_;
+
+    StreamedTexture* find(StreamedTextureHandle handle);
+    const StreamedTexture* find(StreamedTextureHandle handle) const;
+    // Chooses the target level of each texture, then drops levels until they fit in the budget.
+    void chooseTargetLevels();
+    // Recreates a texture with the levels from 'level' onwards. Returns the bytes uploaded.
+    usize makeResident(StreamedTexture& texture, uint level);
+    static usize levelsSize(const StreamedTexture& texture, uint first_level);
+};
+}  // namespace gfx
+}  // namespace dw
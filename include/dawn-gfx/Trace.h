@@ -0,0 +1,68 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Base.h"
+#include <string>
+
+#ifdef DW_TRACY
+#include <tracy/Tracy.hpp>
+#endif
+
+namespace dw {
+namespace gfx {
+/// Records scoped CPU events on every thread, so that stalls on the submit, render and worker
+/// threads can be lined up with each other, and with GPU captures. Scopes are added with
+/// DW_TRACE_SCOPE, and cost a single atomic load while nothing is being recorded.
+///
+/// When the library is built with DW_TRACY, scopes are forwarded to Tracy instead, and Trace only
+/// names threads.
+class DW_API Trace {
+public:
+    /// Starts recording events, discarding any events recorded before. Events are held in memory
+    /// until the next call to start().
+    static void start();
+
+    /// Stops recording events.
+    static void stop();
+
+    /// Returns true between start() and stop().
+    static bool isRecording();
+
+    /// Writes the recorded events in the Chrome trace event format, which can be opened with
+    /// chrome://tracing or the Perfetto UI.
+    static Result<void, std::string> writeChromeTrace(const std::string& path);
+
+    /// Names the calling thread in exported traces.
+    static void setThreadName(const std::string& name);
+};
+
+/// Records an event covering its lifetime. 'name' must be a string literal, as only the pointer is
+/// stored.
+class DW_API TraceScope {
+public:
+    explicit TraceScope(const char* name);
+    ~TraceScope();
+
+    // Non-copyable.
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name_;
+    u64 begin_;  // 0 if the scope started while nothing was being recorded.
+};
+}  // namespace gfx
+}  // namespace dw
+
+#define DW_TRACE_CONCAT_INNER(a, b) a##b
+#define DW_TRACE_CONCAT(a, b) DW_TRACE_CONCAT_INNER(a, b)
+
+#ifdef DW_TRACY
+#define DW_TRACE_SCOPE(name) ZoneScopedN(name)
+#else
+#define DW_TRACE_SCOPE(name) \
+    ::dw::gfx::TraceScope DW_TRACE_CONCAT(dw_trace_scope_, __LINE__) { name }
+#endif
@@ -11,13 +11,34 @@
 
 namespace dw {
 namespace gfx {
+// A range of a mesh's index buffer which draws the mesh at one level of detail.
+struct MeshLod {
+    uint index_offset;
+    uint index_count;
+    // Roughly the largest distance between this LOD and the full detail mesh, in model space.
+    float error;
+};
+
 struct Mesh {
     VertexBufferHandle vb;
     IndexBufferHandle ib;
     uint vertex_count;
+    // Number of indices in the full detail mesh, which is the start of the index buffer.
     uint index_count;
+    // Every level of detail in the index buffer, starting with the full detail mesh and getting
+    // coarser. To draw a LOD, submit its index range: r.submit(program, lod.index_count,
+    // lod.index_offset).
+    std::vector<MeshLod> lods;
 };
 
+// Returns the coarsest LOD of a mesh whose error is at most 'max_pixel_error' pixels when drawn at
+// a scale of 'pixels_per_unit'.
+uint selectLod(const Mesh& mesh, float pixels_per_unit, float max_pixel_error = 1.0f);
+
+// Returns the number of pixels covered by one unit in model space at a given distance from a
+// camera with a perspective projection. 'vertical_fov' is in radians.
+float pixelsPerUnit(float distance, float vertical_fov, float viewport_height);
+
 Vec3 calculateTangent(const Vec3& p1, const Vec3& p2, const Vec3& p3, const Vec2& tc1, const Vec2& tc2, const Vec2& tc3);
 
 class DW_API TriangleBuffer {
@@ -29,10 +50,26 @@ public:
     void estimateVertexCount(uint count);
     void estimateIndexCount(uint count);
 
+    // Enable or disable optimising the mesh in end(). Enabled by default.
+    void optimize(bool enabled);
+
+    // Enable or disable storing normals, tangents and texture coordinates in quantized formats,
+    // which roughly halves the size of each vertex. Disabled by default.
+    void quantize(bool enabled);
+
+    // Set the number of levels of detail to generate, including the full detail mesh. Each LOD
+    // aims to have 'reduction' times the number of triangles of the previous one, and fewer LODs
+    // are generated if the mesh can't be simplified any further. Defaults to 1.
+    void lods(uint count, float reduction = 0.5f);
+
     // Begin creating new geometry.
     void begin();
 
-    // Compile the vertex and index arrays into GPU buffers.
+    // Compile the vertex and index arrays into GPU buffers, with each LOD appended to the index
+    // buffer. If optimisation is enabled, duplicate vertices are merged, triangles are reordered
+    // to make better use of the post-transform vertex cache and to reduce overdraw, vertices are
+    // reordered in the order they're used, and 16-bit indices are used if there are few enough
+    // vertices.
     Mesh end(Renderer& r);
 
     // Add a vertex.
@@ -54,11 +91,19 @@ private:
         Vec2 tex_coord = {0.0f, 0.0f};
         Vec3 tangent = {0.0f, 0.0f, 0.0f};
     };
+    bool optimize_;
+    bool quantize_;
+    uint lod_count_;
+    float lod_reduction_;
     bool contains_normals_;
     bool contains_texcoords_;
     bool contains_tangents_;
     std::vector<Vertex> vertices_;
     std::vector<u32> indices_;
+
+    // Build the vertex buffer contents, and the vertex declaration which describes them.
+    Memory packVertices(VertexDecl& decl);
+    Memory packQuantizedVertices(VertexDecl& decl);
 };
 }  // namespace dw
 }
@@ -18,7 +18,10 @@ class DW_API VertexDecl {
 public:
     enum class Attribute { Position, Normal, Colour, TexCoord0, Tangent };
 
-    enum class AttributeType { Float, Uint8 };
+    // Int10_10_10_2 and Uint10_10_10_2 pack 4 components into 32 bits, with x in the lowest bits,
+    // so they must be added with a count of 4. 3 component Half, Int16 and Uint16 attributes aren't
+    // supported by most Vulkan drivers, so prefer 2 or 4 components.
+    enum class AttributeType { Float, Uint8, Half, Int16, Uint16, Int10_10_10_2, Uint10_10_10_2 };
 
     VertexDecl();
     ~VertexDecl() = default;
@@ -41,6 +44,12 @@ public:
     static void decodeAttributes(u16 encoded_attribute, Attribute& attribute, usize& count,
                                  AttributeType& type, bool& normalised);
     static u16 attributeTypeSize(AttributeType type);
+    static u16 attributeSize(AttributeType type, usize count);
+
+    // Helpers for writing quantized attributes. packHalf rounds to the nearest half float, and
+    // packInt10_10_10_2 packs 4 components in [-1, 1] for a normalised Int10_10_10_2 attribute.
+    static u16 packHalf(float value);
+    static u32 packInt10_10_10_2(float x, float y, float z, float w);
 
     // Attribute: 7
     // Count: 3
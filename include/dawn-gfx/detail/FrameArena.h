@@ -0,0 +1,98 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "../Base.h"
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace dw {
+namespace gfx {
+// A linear allocator for data which lives for a single frame. Memory is allocated from a list of
+// blocks which are kept between frames, deallocation is a no-op, and everything is released at
+// once with reset(). Not thread safe.
+class DW_API FrameArena {
+public:
+    static constexpr usize kDefaultBlockSize = 256 * 1024;
+
+    explicit FrameArena(usize block_size = kDefaultBlockSize);
+    ~FrameArena() = default;
+
+    // Non-copyable.
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    void* allocate(usize size, usize alignment);
+    void reset();
+
+    // Number of bytes allocated since the last reset, and the total capacity of all blocks.
+    usize used() const;
+    usize capacity() const;
+
+private:
+    struct Block {
+        std::unique_ptr<byte[]> data;
+        usize size;
+        usize used;
+    };
+    std::vector<Block> blocks_;
+    usize current_block_;
+    usize block_size_;
+};
+
+// An STL allocator which allocates from a FrameArena. A default constructed allocator has no arena
+// and allocates from the heap instead.
+template <typename T> class FrameAllocator {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    FrameAllocator() noexcept : arena_(nullptr) {
+    }
+
+    explicit FrameAllocator(FrameArena* arena) noexcept : arena_(arena) {
+    }
+
+    template <typename U>
+    FrameAllocator(const FrameAllocator<U>& other) noexcept : arena_(other.arena()) {
+    }
+
+    T* allocate(usize n) {
+        if (arena_) {
+            return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, usize) noexcept {
+        if (!arena_) {
+            ::operator delete(p);
+        }
+    }
+
+    FrameArena* arena() const noexcept {
+        return arena_;
+    }
+
+    template <typename U> bool operator==(const FrameAllocator<U>& other) const noexcept {
+        return arena_ == other.arena();
+    }
+
+    template <typename U> bool operator!=(const FrameAllocator<U>& other) const noexcept {
+        return arena_ != other.arena();
+    }
+
+private:
+    FrameArena* arena_;
+};
+
+template <typename T> using FrameVector = std::vector<T, FrameAllocator<T>>;
+}  // namespace gfx
+}  // namespace dw
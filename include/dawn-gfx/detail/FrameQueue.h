@@ -0,0 +1,56 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "../Base.h"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace dw {
+namespace gfx {
+struct Frame;
+
+// A fixed capacity queue of frames, used to hand frames between the submit and render threads.
+// Must only be pushed to by one thread and popped from by another. Pushing and popping are
+// lock-free. A consumer which finds the queue empty sleeps until a frame is pushed, and the mutex
+// is only taken by the producer when a consumer is sleeping.
+class DW_API FrameQueue {
+public:
+    static constexpr usize kCapacity = 8;
+
+    FrameQueue();
+    ~FrameQueue() = default;
+
+    // Non-copyable.
+    FrameQueue(const FrameQueue&) = delete;
+    FrameQueue& operator=(const FrameQueue&) = delete;
+
+    // Adds a frame to the queue. The queue must not be full.
+    void push(Frame* frame);
+
+    // Removes the oldest frame from the queue, or returns nullptr if the queue is empty.
+    Frame* tryPop();
+
+    // Removes the oldest frame from the queue, waiting for one to be pushed if the queue is empty.
+    // Returns nullptr if the queue is empty and has been closed.
+    Frame* pop();
+
+    // Wakes up a consumer waiting in pop(), and causes pop() to stop waiting from then on.
+    void close();
+
+private:
+    std::array<Frame*, kCapacity> frames_;
+    std::atomic<usize> head_;
+    std::atomic<usize> tail_;
+
+    std::atomic<bool> consumer_waiting_;
+    bool closed_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+}  // namespace gfx
+}  // namespace dw
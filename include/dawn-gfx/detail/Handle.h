@@ -5,20 +5,42 @@
 #pragma once
 
 #include "../Base.h"
+#include <atomic>
+#include <cassert>
 #include <functional>
+#include <mutex>
+#include <vector>
 
 namespace dw {
 namespace gfx {
-// Type safe handles.
+// Type safe handles. A handle is made up of an index, which is reused once the handle is
+// released, and a generation, which is incremented each time the index is reused. The index is
+// stored in the low bits, so the first use of each index has the same value as the index.
 template <typename HandleType> class BaseHandle {
 public:
     using base_type = u32;
 
+    static constexpr base_type kIndexBits = 20;
+    static constexpr base_type kIndexMask = (base_type(1) << kIndexBits) - 1;
+    static constexpr base_type kGenerationMask = ~base_type(0) >> kIndexBits;
+
     BaseHandle() : value_(-1) {}
 
     explicit BaseHandle(base_type value) : value_(value) {
     }
 
+    static HandleType make(base_type index, base_type generation) {
+        return HandleType{((generation & kGenerationMask) << kIndexBits) | (index & kIndexMask)};
+    }
+
+    base_type index() const {
+        return value_ & kIndexMask;
+    }
+
+    base_type generation() const {
+        return value_ >> kIndexBits;
+    }
+
     explicit operator base_type() const {
         return value_;
     }
@@ -59,22 +81,73 @@ private:
     base_type value_;
 };
 
-// Handle generator.
+// Handle generator. All functions can be called from any thread. Unless handles have been
+// released, next() only increments an atomic counter.
 template <typename Handle> class HandleGenerator {
 public:
-    HandleGenerator() : next_{1} {
+    using base_type = typename Handle::base_type;
+
+    HandleGenerator() : next_index_{1}, free_count_{0} {
     }
 
     void reset() {
-        next_ = Handle(1);
+        std::lock_guard<std::mutex> lock{mutex_};
+        next_index_.store(1, std::memory_order_relaxed);
+        free_.clear();
+        recycling_.clear();
+        released_.clear();
+        free_count_.store(0, std::memory_order_relaxed);
     }
 
+    // Returns Handle{} if every index is in use.
     Handle next() {
-        return next_++;
+        if (free_count_.load(std::memory_order_acquire) > 0) {
+            std::lock_guard<std::mutex> lock{mutex_};
+            if (!free_.empty()) {
+                Handle handle = free_.back();
+                free_.pop_back();
+                free_count_.store(free_.size(), std::memory_order_relaxed);
+                return handle;
+            }
+        }
+        // The last index is reserved for Handle{}, so the counter stops there instead of
+        // wrapping around into indices which are still in use.
+        base_type index = next_index_.load(std::memory_order_relaxed);
+        do {
+            if (index >= Handle::kIndexMask) {
+                return Handle{};
+            }
+        } while (!next_index_.compare_exchange_weak(index, index + 1, std::memory_order_relaxed));
+        return Handle{index};
+    }
+
+    // Marks a handle as deleted. Its index is reused with a new generation after the second call
+    // to recycle() which follows.
+    void release(Handle handle) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        released_.emplace_back(Handle::make(handle.index(), handle.generation() + 1));
+    }
+
+    // Called once per frame, once its commands have been collected. Indices are reused one frame
+    // after they're released, as the command which deletes a handle might be collected by the
+    // frame after the one which was current when it was released. This ensures that the delete
+    // command is processed before any command which creates a resource with the reused index.
+    void recycle() {
+        std::lock_guard<std::mutex> lock{mutex_};
+        free_.insert(free_.end(), recycling_.begin(), recycling_.end());
+        recycling_.swap(released_);
+        released_.clear();
+        free_count_.store(free_.size(), std::memory_order_release);
     }
 
 private:
-    Handle next_;
+    std::atomic<base_type> next_index_;
+    std::atomic<usize> free_count_;
+    std::mutex mutex_;
+    // Released handles, with their generation already incremented.
+    std::vector<Handle> free_;
+    std::vector<Handle> recycling_;
+    std::vector<Handle> released_;
 };
 }  // namespace gfx
 }  // namespace dw
@@ -0,0 +1,234 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "../Base.h"
+#include <array>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace dw {
+namespace gfx {
+// A table of values indexed by handle, with a similar interface to std::unordered_map. Values are
+// stored in a slot for each handle index, so a lookup is a bounds check and a comparison of the
+// handle stored in the slot, which fails if the handle is from an older generation (for example,
+// a handle which has been deleted and had its index reused). Slots are allocated in fixed size
+// chunks, so references to values remain valid until they are erased.
+template <typename Handle, typename T> class HandleMap {
+public:
+    using key_type = Handle;
+    using mapped_type = T;
+    using value_type = std::pair<const Handle, T>;
+
+private:
+    static constexpr usize kChunkSize = 64;
+    using Slot = std::optional<value_type>;
+    using Chunk = std::array<Slot, kChunkSize>;
+
+    template <bool Const> class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = HandleMap::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+        using reference = std::conditional_t<Const, const value_type&, value_type&>;
+        using MapType = std::conditional_t<Const, const HandleMap, HandleMap>;
+
+        Iterator(MapType* map, usize index) : map_(map), index_(index) {
+            skipEmptySlots();
+        }
+
+        // Allows an iterator to be converted to a const iterator.
+        operator Iterator<true>() const {
+            return Iterator<true>{map_, index_};
+        }
+
+        reference operator*() const {
+            return *map_->slot(index_);
+        }
+
+        pointer operator->() const {
+            return &*map_->slot(index_);
+        }
+
+        Iterator& operator++() {
+            ++index_;
+            skipEmptySlots();
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator tmp{*this};
+            ++*this;
+            return tmp;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return index_ == other.index_;
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return index_ != other.index_;
+        }
+
+    private:
+        MapType* map_;
+        usize index_;
+
+        void skipEmptySlots() {
+            while (index_ < map_->capacity() && !map_->slot(index_)) {
+                ++index_;
+            }
+        }
+
+        friend class HandleMap;
+    };
+
+public:
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    HandleMap() : size_(0) {
+    }
+
+    iterator begin() {
+        return iterator{this, 0};
+    }
+
+    iterator end() {
+        return iterator{this, capacity()};
+    }
+
+    const_iterator begin() const {
+        return const_iterator{this, 0};
+    }
+
+    const_iterator end() const {
+        return const_iterator{this, capacity()};
+    }
+
+    usize size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    iterator find(Handle handle) {
+        return iterator{this, findIndex(handle)};
+    }
+
+    const_iterator find(Handle handle) const {
+        return const_iterator{this, findIndex(handle)};
+    }
+
+    usize count(Handle handle) const {
+        return findIndex(handle) != capacity() ? 1 : 0;
+    }
+
+    T& at(Handle handle) {
+        usize index = findIndex(handle);
+        if (index == capacity()) {
+            throw std::out_of_range("HandleMap::at");
+        }
+        return slot(index)->second;
+    }
+
+    const T& at(Handle handle) const {
+        usize index = findIndex(handle);
+        if (index == capacity()) {
+            throw std::out_of_range("HandleMap::at");
+        }
+        return slot(index)->second;
+    }
+
+    T& operator[](Handle handle) {
+        return emplace(handle).first->second;
+    }
+
+    // Adds a value if the handle doesn't already have one. A value which belongs to an older
+    // generation of the handle's index is replaced.
+    template <typename... Args> std::pair<iterator, bool> emplace(Handle handle, Args&&... args) {
+        usize index = handle.index();
+        while (index >= capacity()) {
+            chunks_.emplace_back(std::make_unique<Chunk>());
+        }
+        Slot& s = slot(index);
+        if (s) {
+            if (s->first == handle) {
+                return {iterator{this, index}, false};
+            }
+            s.reset();
+            --size_;
+        }
+        s.emplace(std::piecewise_construct, std::forward_as_tuple(handle),
+                  std::forward_as_tuple(std::forward<Args>(args)...));
+        ++size_;
+        return {iterator{this, index}, true};
+    }
+
+    std::pair<iterator, bool> insert(value_type&& value) {
+        return emplace(value.first, std::move(value.second));
+    }
+
+    std::pair<iterator, bool> insert(const value_type& value) {
+        return emplace(value.first, value.second);
+    }
+
+    usize erase(Handle handle) {
+        usize index = findIndex(handle);
+        if (index == capacity()) {
+            return 0;
+        }
+        slot(index).reset();
+        --size_;
+        return 1;
+    }
+
+    iterator erase(const_iterator it) {
+        slot(it.index_).reset();
+        --size_;
+        return iterator{this, it.index_ + 1};
+    }
+
+    void clear() {
+        chunks_.clear();
+        size_ = 0;
+    }
+
+private:
+    std::vector<std::unique_ptr<Chunk>> chunks_;
+    usize size_;
+
+    usize capacity() const {
+        return chunks_.size() * kChunkSize;
+    }
+
+    Slot& slot(usize index) {
+        return (*chunks_[index / kChunkSize])[index % kChunkSize];
+    }
+
+    const Slot& slot(usize index) const {
+        return (*chunks_[index / kChunkSize])[index % kChunkSize];
+    }
+
+    // Returns capacity() if the handle has no value.
+    usize findIndex(Handle handle) const {
+        usize index = handle.index();
+        if (index >= capacity()) {
+            return capacity();
+        }
+        const Slot& s = slot(index);
+        return s && s->first == handle ? index : capacity();
+    }
+};
+}  // namespace gfx
+}  // namespace dw
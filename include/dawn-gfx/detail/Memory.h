@@ -5,18 +5,90 @@
 #pragma once
 
 #include "../Base.h"
+#include <array>
 #include <cstddef>
+#include <functional>
 #include <vector>
 #include <memory>
+#include <mutex>
 #include <cstring>
 
 namespace dw {
 namespace gfx {
 using MemoryDeleter = void (*)(byte*);
 
+// Allocates the data of memory blocks. Memory blocks are usually allocated on the thread which
+// creates a resource and freed on the render thread, so implementations must be thread safe.
+class DW_API MemoryAllocator {
+public:
+    virtual ~MemoryAllocator() = default;
+
+    virtual byte* allocate(usize size) = 0;
+    virtual void deallocate(byte* data, usize size) = 0;
+};
+
+// Allocates from the heap with new[].
+class DW_API HeapMemoryAllocator : public MemoryAllocator {
+public:
+    byte* allocate(usize size) override;
+    void deallocate(byte* data, usize size) override;
+};
+
+// Pools small allocations in power of two size classes, so that frequently created small buffers
+// (such as uniform buffer updates) reuse freed blocks. Larger allocations are passed to a parent
+// allocator. Each size class keeps up to kMaxPooledBytes of free blocks.
+class DW_API PooledMemoryAllocator : public MemoryAllocator {
+public:
+    static constexpr usize kMinBlockSize = 64;
+    static constexpr usize kMaxBlockSize = 64 * 1024;
+    static constexpr usize kMaxPooledBytes = 1024 * 1024;
+
+    // If 'parent' is null, blocks are allocated from the heap. The parent must outlive this
+    // allocator.
+    explicit PooledMemoryAllocator(MemoryAllocator* parent = nullptr);
+    ~PooledMemoryAllocator() override;
+
+    // Non-copyable.
+    PooledMemoryAllocator(const PooledMemoryAllocator&) = delete;
+    PooledMemoryAllocator& operator=(const PooledMemoryAllocator&) = delete;
+
+    byte* allocate(usize size) override;
+    void deallocate(byte* data, usize size) override;
+
+private:
+    static constexpr usize kSizeClassCount = 11;  // 64 bytes to 64 KiB.
+    struct SizeClass {
+        std::mutex mutex;
+        std::vector<byte*> free_blocks;
+    };
+
+    HeapMemoryAllocator heap_;
+    MemoryAllocator* parent_;
+    std::array<SizeClass, kSizeClassCount> size_classes_;
+
+    // Returns kSizeClassCount if the size is too large to be pooled.
+    static usize sizeClassIndex(usize size);
+};
+
 // A blob of memory.
 class DW_API Memory {
 public:
+    /// Sets the allocator used by Memory(usize) and the copying constructors. If null, the default
+    /// allocator is used, which pools small blocks with a PooledMemoryAllocator. Blocks are freed
+    /// by the allocator which allocated them, so the allocator must outlive every block it
+    /// allocates.
+    static void setAllocator(MemoryAllocator* allocator);
+
+    /// Returns the allocator used by new memory blocks.
+    static MemoryAllocator& allocator();
+
+    /// Creates a memory block which refers to existing data without copying it. The data must
+    /// stay alive and unchanged until 'on_release' is called, which happens when the last copy of
+    /// the block is destroyed. Blocks passed to the renderer are destroyed on the render thread
+    /// once the command which uses them has been processed (or once the resource is deleted, if
+    /// frame capture is enabled). Size in bytes.
+    static Memory view(const void* data, usize size, std::function<void()> on_release = {});
+
     /// Constructs an empty memory block.
     Memory();
 
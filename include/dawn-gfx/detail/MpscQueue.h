@@ -0,0 +1,68 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "../Base.h"
+#include <atomic>
+#include <utility>
+#include <vector>
+
+namespace dw {
+namespace gfx {
+// An unbounded queue which any number of threads can push to without locking, and which one
+// thread drains. Values pushed by a thread are drained in the order that it pushed them.
+template <typename T> class MpscQueue {
+public:
+    MpscQueue() : head_(nullptr) {
+    }
+
+    ~MpscQueue() {
+        Node* node = head_.load(std::memory_order_acquire);
+        while (node) {
+            Node* next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+
+    // Non-copyable.
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(T value) {
+        Node* node = new Node{std::move(value), head_.load(std::memory_order_relaxed)};
+        while (!head_.compare_exchange_weak(node->next, node, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+        }
+    }
+
+    // Moves every value which has been pushed so far to the end of 'out', oldest first.
+    void drain(std::vector<T>& out) {
+        // Nodes are linked newest first, so reverse the list before moving the values out.
+        Node* node = head_.exchange(nullptr, std::memory_order_acquire);
+        Node* oldest = nullptr;
+        while (node) {
+            Node* next = node->next;
+            node->next = oldest;
+            oldest = node;
+            node = next;
+        }
+        while (oldest) {
+            Node* next = oldest->next;
+            out.emplace_back(std::move(oldest->value));
+            delete oldest;
+            oldest = next;
+        }
+    }
+
+private:
+    struct Node {
+        T value;
+        Node* next;
+    };
+    std::atomic<Node*> head_;
+};
+}  // namespace gfx
+}  // namespace dw
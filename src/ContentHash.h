@@ -0,0 +1,45 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Base.h"
+
+#include <string>
+
+namespace dw {
+namespace gfx {
+// Builds a 64-bit FNV-1a hash of some content. Unlike std::hash, the result is stable across runs
+// and platforms, so it can be used to key data which is persisted to disk.
+class ContentHash {
+public:
+    ContentHash() : hash_{14695981039346656037ull} {
+    }
+
+    void add(const void* data, usize size) {
+        const auto* bytes = static_cast<const u8*>(data);
+        for (usize i = 0; i < size; ++i) {
+            hash_ = (hash_ ^ bytes[i]) * 1099511628211ull;
+        }
+    }
+
+    template <typename T> void add(const T& value) {
+        add(&value, sizeof(T));
+    }
+
+    void add(const std::string& value) {
+        // Include the length, so that consecutive strings can't alias each other.
+        add(static_cast<u64>(value.size()));
+        add(value.data(), value.size());
+    }
+
+    u64 hash() const {
+        return hash_;
+    }
+
+private:
+    u64 hash_;
+};
+}  // namespace gfx
+}  // namespace dw
@@ -0,0 +1,57 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "dawn-gfx/detail/FrameArena.h"
+
+#include <algorithm>
+
+namespace dw {
+namespace gfx {
+FrameArena::FrameArena(usize block_size) : current_block_(0), block_size_(block_size) {
+}
+
+void* FrameArena::allocate(usize size, usize alignment) {
+    while (current_block_ < blocks_.size()) {
+        Block& block = blocks_[current_block_];
+        usize address = reinterpret_cast<usize>(block.data.get()) + block.used;
+        usize padding = (alignment - address % alignment) % alignment;
+        if (block.used + padding + size <= block.size) {
+            block.used += padding + size;
+            return block.data.get() + block.used - size;
+        }
+        current_block_++;
+    }
+
+    // Out of space, add a new block. Blocks are allocated with new[], so are suitably aligned for
+    // any fundamental type.
+    usize new_block_size = std::max(block_size_, size);
+    blocks_.push_back(Block{std::make_unique<byte[]>(new_block_size), new_block_size, size});
+    current_block_ = blocks_.size() - 1;
+    return blocks_.back().data.get();
+}
+
+void FrameArena::reset() {
+    for (auto& block : blocks_) {
+        block.used = 0;
+    }
+    current_block_ = 0;
+}
+
+usize FrameArena::used() const {
+    usize total = 0;
+    for (const auto& block : blocks_) {
+        total += block.used;
+    }
+    return total;
+}
+
+usize FrameArena::capacity() const {
+    usize total = 0;
+    for (const auto& block : blocks_) {
+        total += block.size;
+    }
+    return total;
+}
+}  // namespace gfx
+}  // namespace dw
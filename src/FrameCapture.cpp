@@ -0,0 +1,865 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "FrameCapture.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace dw {
+namespace gfx {
+namespace {
+// Capture file layout: a header, followed by the setup commands, followed by the frame. Values are
+// written in declaration order with no padding, except for the contents of Memory blocks which are
+// aligned to kBlobAlignment so that they can be used in place when the file is mapped.
+constexpr u32 kCaptureMagic = 0x43465744;  // "DWFC"
+constexpr u32 kCaptureVersion = 8;
+constexpr usize kBlobAlignment = 16;
+
+enum class ResourceType : u64 {
+    VertexBuffer,
+    IndexBuffer,
+    IndirectBuffer,
+    StorageBuffer,
+    UniformBuffer,
+    Program,
+    Uniform,
+    Texture,
+    FrameBuffer,
+    OcclusionQuery
+};
+
+template <typename Handle>
+ResourceCommandInfo makeInfo(ResourceType type, Handle handle, ResourceCommandInfo::Action action,
+                             uint offset = 0, usize size = 0) {
+    return {(u64(type) << 32) | static_cast<u32>(handle), action, offset, size};
+}
+
+struct ResourceCommandVisitor {
+    using Action = ResourceCommandInfo::Action;
+    using R = std::optional<ResourceCommandInfo>;
+
+    R operator()(const cmd::CreateVertexBuffer& c) const {
+        return makeInfo(ResourceType::VertexBuffer, c.handle, Action::Create);
+    }
+    R operator()(const cmd::UpdateVertexBuffer& c) const {
+        return makeInfo(ResourceType::VertexBuffer, c.handle, Action::Update, c.offset,
+                        c.data.size());
+    }
+    R operator()(const cmd::DeleteVertexBuffer& c) const {
+        return makeInfo(ResourceType::VertexBuffer, c.handle, Action::Delete);
+    }
+    R operator()(const cmd::CreateIndexBuffer& c) const {
+        return makeInfo(ResourceType::IndexBuffer, c.handle, Action::Create);
+    }
+    R operator()(const cmd::UpdateIndexBuffer& c) const {
+        return makeInfo(ResourceType::IndexBuffer, c.handle, Action::Update, c.offset,
+                        c.data.size());
+    }
+    R operator()(const cmd::DeleteIndexBuffer& c) const {
+        return makeInfo(ResourceType::IndexBuffer, c.handle, Action::Delete);
+    }
+    R operator()(const cmd::CreateIndirectBuffer& c) const {
+        return makeInfo(ResourceType::IndirectBuffer, c.handle, Action::Create);
+    }
+    R operator()(const cmd::UpdateIndirectBuffer& c) const {
+        return makeInfo(ResourceType::IndirectBuffer, c.handle, Action::Update, c.offset,
+                        c.data.size());
+    }
+    R operator()(const cmd::DeleteIndirectBuffer& c) const {
+        return makeInfo(ResourceType::IndirectBuffer, c.handle, Action::Delete);
+    }
+    R operator()(const cmd::CreateStorageBuffer& c) const {
+        return makeInfo(ResourceType::StorageBuffer, c.handle, Action::Create);
+    }
+    R operator()(const cmd::UpdateStorageBuffer& c) const {
+        return makeInfo(ResourceType::StorageBuffer, c.handle, Action::Update, c.offset,
+                        c.data.size());
+    }
+    R operator()(const cmd::DeleteStorageBuffer& c) const {
+        return makeInfo(ResourceType::StorageBuffer, c.handle, Action::Delete);
+    }
+    R operator()(const cmd::CreateUniformBuffer& c) const {
+        return makeInfo(ResourceType::UniformBuffer, c.handle, Action::Create);
+    }
+    R operator()(const cmd::UpdateUniformBuffer& c) const {
+        return makeInfo(ResourceType::UniformBuffer, c.handle, Action::Update, c.offset,
+                        c.data.size());
+    }
+    R operator()(const cmd::DeleteUniformBuffer& c) const {
+        return makeInfo(ResourceType::UniformBuffer, c.handle, Action::Delete);
+    }
+    R operator()(const cmd::CreateProgram& c) const {
+        return makeInfo(ResourceType::Program, c.handle, Action::Create);
+    }
+    R operator()(const cmd::DeleteProgram& c) const {
+        return makeInfo(ResourceType::Program, c.handle, Action::Delete);
+    }
+    R operator()(const cmd::CreateUniform& c) const {
+        return makeInfo(ResourceType::Uniform, c.handle, Action::Create);
+    }
+    R operator()(const cmd::CreateTexture2D& c) const {
+        return makeInfo(ResourceType::Texture, c.handle, Action::Create);
+    }
+    R operator()(const cmd::UpdateTexture2D& c) const {
+        auto info = makeInfo(ResourceType::Texture, c.handle, Action::Update);
+        info.texture_region = {c.mip_level, c.x, c.y, c.width, c.height};
+        return info;
+    }
+    R operator()(const cmd::DeleteTexture& c) const {
+        return makeInfo(ResourceType::Texture, c.handle, Action::Delete);
+    }
+    R operator()(const cmd::CreateFrameBuffer& c) const {
+        return makeInfo(ResourceType::FrameBuffer, c.handle, Action::Create);
+    }
+    R operator()(const cmd::DeleteFrameBuffer& c) const {
+        return makeInfo(ResourceType::FrameBuffer, c.handle, Action::Delete);
+    }
+    R operator()(const cmd::CreateOcclusionQuery& c) const {
+        return makeInfo(ResourceType::OcclusionQuery, c.handle, Action::Create);
+    }
+    R operator()(const cmd::DeleteOcclusionQuery& c) const {
+        return makeInfo(ResourceType::OcclusionQuery, c.handle, Action::Delete);
+    }
+    R operator()(const cmd::PrewarmPipeline&) const {
+        return std::nullopt;
+    }
+};
+
+struct DeleteCommandVisitor {
+    using R = std::optional<RenderCommand>;
+
+    R operator()(const cmd::CreateVertexBuffer& c) const {
+        return RenderCommand{cmd::DeleteVertexBuffer{c.handle}};
+    }
+    R operator()(const cmd::CreateIndexBuffer& c) const {
+        return RenderCommand{cmd::DeleteIndexBuffer{c.handle}};
+    }
+    R operator()(const cmd::CreateIndirectBuffer& c) const {
+        return RenderCommand{cmd::DeleteIndirectBuffer{c.handle}};
+    }
+    R operator()(const cmd::CreateStorageBuffer& c) const {
+        return RenderCommand{cmd::DeleteStorageBuffer{c.handle}};
+    }
+    R operator()(const cmd::CreateUniformBuffer& c) const {
+        return RenderCommand{cmd::DeleteUniformBuffer{c.handle}};
+    }
+    R operator()(const cmd::CreateProgram& c) const {
+        return RenderCommand{cmd::DeleteProgram{c.handle}};
+    }
+    R operator()(const cmd::CreateTexture2D& c) const {
+        return RenderCommand{cmd::DeleteTexture{c.handle}};
+    }
+    R operator()(const cmd::CreateFrameBuffer& c) const {
+        return RenderCommand{cmd::DeleteFrameBuffer{c.handle}};
+    }
+    R operator()(const cmd::CreateOcclusionQuery& c) const {
+        return RenderCommand{cmd::DeleteOcclusionQuery{c.handle}};
+    }
+    template <typename T> R operator()(const T&) const {
+        return std::nullopt;
+    }
+};
+
+// Writes values to a byte stream.
+class CaptureWriter {
+public:
+    static constexpr bool kReading = false;
+
+    template <typename T> void value(T& v) {
+        static_assert(std::is_trivially_copyable<T>::value, "Value must be trivially copyable");
+        bytes(&v, sizeof(T));
+    }
+
+    void bytes(const void* data, usize size) {
+        const byte* begin = static_cast<const byte*>(data);
+        data_.insert(data_.end(), begin, begin + size);
+    }
+
+    void memory(Memory& memory) {
+        u64 size = memory.size();
+        value(size);
+        data_.resize((data_.size() + kBlobAlignment - 1) / kBlobAlignment * kBlobAlignment);
+        bytes(memory.data(), memory.size());
+    }
+
+    bool checkCount(usize) const {
+        return true;
+    }
+
+    void fail() {
+    }
+
+    const std::vector<byte>& data() const {
+        return data_;
+    }
+
+private:
+    std::vector<byte> data_;
+};
+
+// Reads values from a mapped capture file. Reading past the end of the file, or reading an invalid
+// value, marks the reader as failed, and zeroes any remaining values.
+class CaptureReader {
+public:
+    static constexpr bool kReading = true;
+
+    explicit CaptureReader(std::shared_ptr<MappedFile> file)
+        : file_(std::move(file)), offset_(0), failed_(false) {
+    }
+
+    template <typename T> void value(T& v) {
+        static_assert(std::is_trivially_copyable<T>::value, "Value must be trivially copyable");
+        bytes(&v, sizeof(T));
+    }
+
+    void bytes(void* data, usize size) {
+        if (!checkCount(size)) {
+            std::memset(data, 0, size);
+            return;
+        }
+        std::memcpy(data, file_->data() + offset_, size);
+        offset_ += size;
+    }
+
+    // The memory block refers to the mapped file, and keeps it alive.
+    void memory(Memory& memory) {
+        u64 size = 0;
+        value(size);
+        offset_ = (offset_ + kBlobAlignment - 1) / kBlobAlignment * kBlobAlignment;
+        if (size == 0 || !checkCount(size)) {
+            memory = Memory{};
+            return;
+        }
+        auto file = file_;
+        memory = Memory(file_->data() + offset_, size, [file](byte*) {});
+        offset_ += size;
+    }
+
+    // Returns false (and fails) if there are fewer than 'count' bytes remaining. Used to reject
+    // element counts which can't possibly be valid before allocating space for them.
+    bool checkCount(usize count) {
+        if (failed_ || offset_ > file_->size() || count > file_->size() - offset_) {
+            failed_ = true;
+            return false;
+        }
+        return true;
+    }
+
+    void fail() {
+        failed_ = true;
+    }
+
+    bool failed() const {
+        return failed_;
+    }
+
+private:
+    std::shared_ptr<MappedFile> file_;
+    usize offset_;
+    bool failed_;
+};
+
+// Transfer functions either write a value to a CaptureWriter, or read it from a CaptureReader.
+// They're declared up front so that the container overloads can find the overloads of their
+// elements.
+template <typename Archive, typename T>
+std::enable_if_t<std::is_trivially_copyable<T>::value> transfer(Archive& ar, T& value);
+template <typename Archive> void transfer(Archive& ar, Vec2& value);
+template <typename Archive> void transfer(Archive& ar, Vec3& value);
+template <typename Archive> void transfer(Archive& ar, Vec4& value);
+template <typename Archive> void transfer(Archive& ar, Mat3& value);
+template <typename Archive> void transfer(Archive& ar, Mat4& value);
+template <typename Archive> void transfer(Archive& ar, std::string& value);
+template <typename Archive> void transfer(Archive& ar, Memory& value);
+template <typename Archive> void transfer(Archive& ar, VertexDecl& value);
+template <typename Archive, typename T> void transfer(Archive& ar, std::optional<T>& value);
+template <typename Archive, typename... Ts> void transfer(Archive& ar, std::variant<Ts...>& value);
+template <typename Archive, typename T, typename Alloc>
+void transfer(Archive& ar, std::vector<T, Alloc>& values);
+template <typename Archive> void transfer(Archive& ar, ShaderStageInfo& value);
+template <typename Archive> void transfer(Archive& ar, cmd::CreateVertexBuffer& c);
+template <typename Archive> void transfer(Archive& ar, cmd::UpdateVertexBuffer& c);
+template <typename Archive> void transfer(Archive& ar, cmd::DeleteVertexBuffer& c);
+template <typename Archive> void transfer(Archive& ar, cmd::CreateIndexBuffer& c);
+template <typename Archive> void transfer(Archive& ar, cmd::UpdateIndexBuffer& c);
+template <typename Archive> void transfer(Archive& ar, cmd::DeleteIndexBuffer& c);
+template <typename Archive> void transfer(Archive& ar, cmd::CreateIndirectBuffer& c);
+template <typename Archive> void transfer(Archive& ar, cmd::UpdateIndirectBuffer& c);
+template <typename Archive> void transfer(Archive& ar, cmd::DeleteIndirectBuffer& c);
+template <typename Archive> void transfer(Archive& ar, cmd::CreateStorageBuffer& c);
+template <typename Archive> void transfer(Archive& ar, cmd::UpdateStorageBuffer& c);
+template <typename Archive> void transfer(Archive& ar, cmd::DeleteStorageBuffer& c);
+template <typename Archive> void transfer(Archive& ar, cmd::CreateUniformBuffer& c);
+template <typename Archive> void transfer(Archive& ar, cmd::UpdateUniformBuffer& c);
+template <typename Archive> void transfer(Archive& ar, cmd::DeleteUniformBuffer& c);
+template <typename Archive> void transfer(Archive& ar, cmd::CreateProgram& c);
+template <typename Archive> void transfer(Archive& ar, cmd::DeleteProgram& c);
+template <typename Archive> void transfer(Archive& ar, cmd::CreateUniform& c);
+template <typename Archive> void transfer(Archive& ar, cmd::CreateTexture2D& c);
+template <typename Archive> void transfer(Archive& ar, cmd::UpdateTexture2D& c);
+template <typename Archive> void transfer(Archive& ar, cmd::DeleteTexture& c);
+template <typename Archive> void transfer(Archive& ar, cmd::CreateFrameBuffer& c);
+template <typename Archive> void transfer(Archive& ar, cmd::DeleteFrameBuffer& c);
+template <typename Archive> void transfer(Archive& ar, cmd::CreateOcclusionQuery& c);
+template <typename Archive> void transfer(Archive& ar, cmd::DeleteOcclusionQuery& c);
+template <typename Archive> void transfer(Archive& ar, cmd::PrewarmPipeline& c);
+template <typename Archive> void transfer(Archive& ar, RenderItem::UniformBinding& binding);
+template <typename Archive> void transfer(Archive& ar, RenderItem::StorageBufferBinding& binding);
+template <typename Archive> void transfer(Archive& ar, RenderItem& item);
+template <typename Archive> void transfer(Archive& ar, RenderQueue::TimingScope& scope);
+template <typename Archive> void transfer(Archive& ar, RenderQueue& queue);
+template <typename Archive> void transfer(Archive& ar, Frame::TransientBufferStorage& storage);
+template <typename Archive> void transfer(Archive& ar, Frame& frame);
+
+template <typename Archive, typename T>
+std::enable_if_t<std::is_trivially_copyable<T>::value> transfer(Archive& ar, T& value) {
+    ar.value(value);
+}
+
+// MathGeoLib types are plain arrays of floats, but aren't necessarily trivially copyable.
+template <typename Archive> void transfer(Archive& ar, Vec2& value) {
+    ar.bytes(&value, sizeof(value));
+}
+
+template <typename Archive> void transfer(Archive& ar, Vec3& value) {
+    ar.bytes(&value, sizeof(value));
+}
+
+template <typename Archive> void transfer(Archive& ar, Vec4& value) {
+    ar.bytes(&value, sizeof(value));
+}
+
+template <typename Archive> void transfer(Archive& ar, Mat3& value) {
+    ar.bytes(&value, sizeof(value));
+}
+
+template <typename Archive> void transfer(Archive& ar, Mat4& value) {
+    ar.bytes(&value, sizeof(value));
+}
+
+template <typename Archive> void transfer(Archive& ar, std::string& value) {
+    u32 size = static_cast<u32>(value.size());
+    ar.value(size);
+    if constexpr (Archive::kReading) {
+        if (!ar.checkCount(size)) {
+            return;
+        }
+        value.resize(size);
+    }
+    ar.bytes(&value[0], size);
+}
+
+template <typename Archive> void transfer(Archive& ar, Memory& value) {
+    ar.memory(value);
+}
+
+// Attribute offsets are stored as pointers (see VertexDecl::add).
+template <typename Archive> void transfer(Archive& ar, VertexDecl& value) {
+    transfer(ar, value.stride_);
+    u32 count = static_cast<u32>(value.attributes_.size());
+    ar.value(count);
+    if constexpr (Archive::kReading) {
+        if (!ar.checkCount(count)) {
+            return;
+        }
+        value.attributes_.resize(count);
+    }
+    for (auto& attribute : value.attributes_) {
+        transfer(ar, attribute.first);
+        u64 offset = reinterpret_cast<uintptr_t>(attribute.second);
+        ar.value(offset);
+        attribute.second = reinterpret_cast<byte*>(static_cast<uintptr_t>(offset));
+    }
+}
+
+template <typename Archive, typename T> void transfer(Archive& ar, std::optional<T>& value) {
+    bool has_value = value.has_value();
+    ar.value(has_value);
+    if constexpr (Archive::kReading) {
+        if (!has_value) {
+            value.reset();
+            return;
+        }
+        value.emplace();
+    }
+    if (value) {
+        transfer(ar, *value);
+    }
+}
+
+template <typename Variant, usize... I>
+void emplaceAlternative(Variant& value, usize index, std::index_sequence<I...>) {
+    ((index == I ? (void)value.template emplace<I>() : (void)0), ...);
+}
+
+template <typename Archive, typename... Ts> void transfer(Archive& ar, std::variant<Ts...>& value) {
+    u32 index = static_cast<u32>(value.index());
+    ar.value(index);
+    if constexpr (Archive::kReading) {
+        if (index >= sizeof...(Ts)) {
+            ar.fail();
+            return;
+        }
+        emplaceAlternative(value, index, std::index_sequence_for<Ts...>{});
+    }
+    std::visit([&ar](auto& alternative) { transfer(ar, alternative); }, value);
+}
+
+// Items and queues belonging to a frame are constructed with the frame's arena.
+template <typename Archive, typename T, typename Alloc>
+void transfer(Archive& ar, std::vector<T, Alloc>& values) {
+    u32 count = static_cast<u32>(values.size());
+    ar.value(count);
+    if constexpr (Archive::kReading) {
+        if (!ar.checkCount(count)) {
+            return;
+        }
+        values.clear();
+        values.reserve(count);
+        for (u32 i = 0; i < count; ++i) {
+            if constexpr (std::is_same<Alloc, FrameAllocator<T>>::value &&
+                          std::is_constructible<T, FrameArena*>::value) {
+                values.emplace_back(values.get_allocator().arena());
+            } else {
+                values.emplace_back();
+            }
+        }
+    }
+    for (auto& value : values) {
+        transfer(ar, value);
+    }
+}
+
+template <typename Archive> void transfer(Archive& ar, ShaderStageInfo& value) {
+    transfer(ar, value.stage);
+    transfer(ar, value.entry_point);
+    transfer(ar, value.spirv);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::CreateVertexBuffer& c) {
+    transfer(ar, c.handle);
+    transfer(ar, c.data);
+    transfer(ar, c.size);
+    transfer(ar, c.decl);
+    transfer(ar, c.usage);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::UpdateVertexBuffer& c) {
+    transfer(ar, c.handle);
+    transfer(ar, c.data);
+    transfer(ar, c.offset);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::DeleteVertexBuffer& c) {
+    transfer(ar, c.handle);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::CreateIndexBuffer& c) {
+    transfer(ar, c.handle);
+    transfer(ar, c.data);
+    transfer(ar, c.size);
+    transfer(ar, c.type);
+    transfer(ar, c.usage);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::UpdateIndexBuffer& c) {
+    transfer(ar, c.handle);
+    transfer(ar, c.data);
+    transfer(ar, c.offset);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::DeleteIndexBuffer& c) {
+    transfer(ar, c.handle);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::CreateIndirectBuffer& c) {
+    transfer(ar, c.handle);
+    transfer(ar, c.data);
+    transfer(ar, c.size);
+    transfer(ar, c.usage);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::UpdateIndirectBuffer& c) {
+    transfer(ar, c.handle);
+    transfer(ar, c.data);
+    transfer(ar, c.offset);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::DeleteIndirectBuffer& c) {
+    transfer(ar, c.handle);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::CreateStorageBuffer& c) {
+    transfer(ar, c.handle);
+    transfer(ar, c.data);
+    transfer(ar, c.size);
+    transfer(ar, c.usage);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::UpdateStorageBuffer& c) {
+    transfer(ar, c.handle);
+    transfer(ar, c.data);
+    transfer(ar, c.offset);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::DeleteStorageBuffer& c) {
+    transfer(ar, c.handle);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::CreateUniformBuffer& c) {
+    transfer(ar, c.handle);
+    transfer(ar, c.data);
+    transfer(ar, c.size);
+    transfer(ar, c.usage);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::UpdateUniformBuffer& c) {
+    transfer(ar, c.handle);
+    transfer(ar, c.data);
+    transfer(ar, c.offset);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::DeleteUniformBuffer& c) {
+    transfer(ar, c.handle);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::CreateProgram& c) {
+    transfer(ar, c.handle);
+    transfer(ar, c.stages);
+    transfer(ar, c.async);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::DeleteProgram& c) {
+    transfer(ar, c.handle);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::CreateUniform& c) {
+    transfer(ar, c.handle);
+    transfer(ar, c.name);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::CreateTexture2D& c) {
+    transfer(ar, c.handle);
+    transfer(ar, c.width);
+    transfer(ar, c.height);
+    transfer(ar, c.format);
+    transfer(ar, c.mip_levels);
+    transfer(ar, c.generate_mipmaps);
+    transfer(ar, c.framebuffer_usage);
+    transfer(ar, c.storage_usage);
+    transfer(ar, c.array_layers);
+    transfer(ar, c.bindless);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::UpdateTexture2D& c) {
+    transfer(ar, c.handle);
+    transfer(ar, c.mip_level);
+    transfer(ar, c.x);
+    transfer(ar, c.y);
+    transfer(ar, c.width);
+    transfer(ar, c.height);
+    transfer(ar, c.data);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::DeleteTexture& c) {
+    transfer(ar, c.handle);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::CreateFrameBuffer& c) {
+    transfer(ar, c.handle);
+    transfer(ar, c.width);
+    transfer(ar, c.height);
+    transfer(ar, c.textures);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::DeleteFrameBuffer& c) {
+    transfer(ar, c.handle);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::CreateOcclusionQuery& c) {
+    transfer(ar, c.handle);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::DeleteOcclusionQuery& c) {
+    transfer(ar, c.handle);
+}
+
+template <typename Archive> void transfer(Archive& ar, cmd::PrewarmPipeline& c) {
+    transfer(ar, c.program);
+    transfer(ar, c.decl);
+    transfer(ar, c.instance_decl);
+    transfer(ar, c.frame_buffer);
+    transfer(ar, c.pipeline_state);
+}
+
+template <typename Archive> void transfer(Archive& ar, RenderItem::UniformBinding& binding) {
+    transfer(ar, binding.handle);
+    transfer(ar, binding.data);
+}
+
+template <typename Archive> void transfer(Archive& ar, RenderItem::StorageBufferBinding& binding) {
+    transfer(ar, binding.binding_location);
+    transfer(ar, binding.handle);
+}
+
+template <typename Archive> void transfer(Archive& ar, RenderItem& item) {
+    transfer(ar, static_cast<PipelineState&>(item));
+    transfer(ar, item.vb);
+    transfer(ar, item.vb_offset);
+    transfer(ar, item.vertex_decl_override);
+    transfer(ar, item.ib);
+    transfer(ar, item.ib_offset);
+    transfer(ar, item.primitive_count);
+    transfer(ar, item.base_vertex);
+    transfer(ar, item.instance_vb);
+    transfer(ar, item.instance_vb_offset);
+    transfer(ar, item.instance_decl_override);
+    transfer(ar, item.instance_count);
+    transfer(ar, item.indirect_buffer);
+    transfer(ar, item.indirect_offset);
+    transfer(ar, item.draw_count);
+    transfer(ar, item.occlusion_query);
+    transfer(ar, item.draw_condition);
+    transfer(ar, item.program);
+    transfer(ar, item.uniforms);
+    transfer(ar, item.uniform_buffers);
+    transfer(ar, item.textures);
+    transfer(ar, item.storage_buffers);
+    transfer(ar, item.storage_images);
+    transfer(ar, item.group_count_x);
+    transfer(ar, item.group_count_y);
+    transfer(ar, item.group_count_z);
+    transfer(ar, item.scissor_enabled);
+    transfer(ar, item.scissor_x);
+    transfer(ar, item.scissor_y);
+    transfer(ar, item.scissor_width);
+    transfer(ar, item.scissor_height);
+    transfer(ar, item.sort_depth);
+    transfer(ar, item.sort_key);
+}
+
+template <typename Archive> void transfer(Archive& ar, RenderQueue::TimingScope& scope) {
+    transfer(ar, scope.name);
+    transfer(ar, scope.begin);
+    transfer(ar, scope.end);
+    transfer(ar, scope.depth);
+}
+
+template <typename Archive> void transfer(Archive& ar, RenderQueue& queue) {
+    bool has_clear = queue.clear_parameters.has_value();
+    transfer(ar, has_clear);
+    if constexpr (Archive::kReading) {
+        if (has_clear) {
+            queue.clear_parameters.emplace();
+        }
+    }
+    if (queue.clear_parameters) {
+        transfer(ar, queue.clear_parameters->colour.rgba());
+        transfer(ar, queue.clear_parameters->clear_colour);
+        transfer(ar, queue.clear_parameters->clear_depth);
+    }
+    bool has_attachment_ops = queue.attachment_ops.has_value();
+    transfer(ar, has_attachment_ops);
+    if constexpr (Archive::kReading) {
+        if (has_attachment_ops) {
+            queue.attachment_ops.emplace();
+        }
+    }
+    if (queue.attachment_ops) {
+        transfer(ar, queue.attachment_ops->colour_load);
+        transfer(ar, queue.attachment_ops->colour_store);
+        transfer(ar, queue.attachment_ops->depth_load);
+        transfer(ar, queue.attachment_ops->depth_store);
+    }
+    transfer(ar, queue.frame_buffer);
+    transfer(ar, queue.sort_mode);
+    transfer(ar, queue.label);
+    transfer(ar, queue.render_items);
+    transfer(ar, queue.compute_items);
+    transfer(ar, queue.timing_scopes);
+}
+
+// Only the allocated part of each page is stored.
+template <typename Archive> void transfer(Archive& ar, Frame::TransientBufferStorage& storage) {
+    u32 page_count = static_cast<u32>(storage.pages.size());
+    ar.value(page_count);
+    if constexpr (Archive::kReading) {
+        if (!ar.checkCount(page_count)) {
+            return;
+        }
+        storage.pages.resize(page_count);
+    }
+    for (auto& page : storage.pages) {
+        transfer(ar, page.capacity);
+        transfer(ar, page.offset);
+        transfer(ar, page.size);
+        if constexpr (Archive::kReading) {
+            if (page.size > page.capacity || !ar.checkCount(page.size)) {
+                ar.fail();
+                return;
+            }
+            page.data.reset(new byte[page.capacity]);
+        }
+        ar.bytes(page.data.get(), page.size);
+    }
+    u64 current_page = storage.current_page;
+    ar.value(current_page);
+    storage.current_page = static_cast<usize>(current_page);
+    transfer(ar, storage.size);
+}
+
+template <typename Archive> void transfer(Archive& ar, Frame& frame) {
+    u32 queue_count = static_cast<u32>(frame.render_queues.size());
+    ar.value(queue_count);
+    if constexpr (Archive::kReading) {
+        if (!ar.checkCount(queue_count)) {
+            return;
+        }
+        frame.render_queues.clear();
+        for (u32 i = 0; i < queue_count; ++i) {
+            frame.render_queues.emplace_back(&frame.arena);
+        }
+    }
+    for (auto& queue : frame.render_queues) {
+        transfer(ar, queue);
+    }
+    transfer(ar, frame.commands_pre);
+    transfer(ar, frame.commands_post);
+    transfer(ar, static_cast<Frame::TransientBufferStorage&>(frame.transient_vb_storage));
+    transfer(ar, frame.transient_vb_storage.handle);
+    transfer(ar, static_cast<Frame::TransientBufferStorage&>(frame.transient_ib_storage));
+    transfer(ar, frame.transient_ib_storage.handle);
+    transfer(ar, static_cast<Frame::TransientBufferStorage&>(frame.transient_ib32_storage));
+    transfer(ar, frame.transient_ib32_storage.handle);
+}
+}  // namespace
+
+std::optional<ResourceCommandInfo> resourceCommandInfo(const RenderCommand& command) {
+    return std::visit(ResourceCommandVisitor{}, command);
+}
+
+std::optional<RenderCommand> deleteCommandFor(const RenderCommand& create_command) {
+    return std::visit(DeleteCommandVisitor{}, create_command);
+}
+
+void ResourceJournal::record(const std::vector<RenderCommand>& commands) {
+    using Action = ResourceCommandInfo::Action;
+    for (const auto& command : commands) {
+        auto info = resourceCommandInfo(command);
+        if (!info) {
+            continue;
+        }
+        auto it = creation_index_.find(info->key);
+        switch (info->action) {
+            case Action::Create:
+                if (it != creation_index_.end()) {
+                    resources_.erase(it->second);
+                }
+                creation_index_[info->key] = next_creation_index_;
+                resources_[next_creation_index_++] = {command};
+                break;
+            case Action::Update: {
+                if (it == creation_index_.end()) {
+                    break;
+                }
+                // Drop earlier updates which are entirely overwritten by this one.
+                auto& resource_commands = resources_.at(it->second);
+                resource_commands.erase(
+                    std::remove_if(resource_commands.begin() + 1, resource_commands.end(),
+                                   [&info](const RenderCommand& earlier) {
+                                       auto earlier_info = *resourceCommandInfo(earlier);
+                                       if (info->texture_region) {
+                                           return earlier_info.texture_region &&
+                                                  info->texture_region->contains(
+                                                      *earlier_info.texture_region);
+                                       }
+                                       return earlier_info.offset >= info->offset &&
+                                              earlier_info.offset + earlier_info.size <=
+                                                  info->offset + info->size;
+                                   }),
+                    resource_commands.end());
+                resource_commands.emplace_back(command);
+                break;
+            }
+            case Action::Delete:
+                if (it != creation_index_.end()) {
+                    resources_.erase(it->second);
+                    creation_index_.erase(it);
+                }
+                break;
+        }
+    }
+}
+
+std::vector<RenderCommand> ResourceJournal::commands() const {
+    std::vector<RenderCommand> commands;
+    for (const auto& resource : resources_) {
+        commands.insert(commands.end(), resource.second.begin(), resource.second.end());
+    }
+    return commands;
+}
+
+Result<void, std::string> writeFrameCapture(const std::string& path, RendererType renderer,
+                                            u16 width, u16 height,
+                                            const std::vector<RenderCommand>& setup_commands,
+                                            const Frame& frame) {
+    // Transfer functions take mutable references, but the writer only reads from them.
+    CaptureWriter writer;
+    u32 magic = kCaptureMagic;
+    u32 version = kCaptureVersion;
+    writer.value(magic);
+    writer.value(version);
+    writer.value(renderer);
+    writer.value(width);
+    writer.value(height);
+    transfer(writer, const_cast<std::vector<RenderCommand>&>(setup_commands));
+    transfer(writer, const_cast<Frame&>(frame));
+
+    std::ofstream file{path, std::ios::binary | std::ios::trunc};
+    if (!file) {
+        return Error(fmt::format("Unable to open {} for writing.", path));
+    }
+    file.write(reinterpret_cast<const char*>(writer.data().data()), writer.data().size());
+    if (!file) {
+        return Error(fmt::format("Unable to write {}.", path));
+    }
+    return {};
+}
+
+Result<void, std::string> readFrameCapture(const std::string& path, FrameCaptureData& capture) {
+    auto file = std::make_shared<MappedFile>(path);
+    if (!file->data()) {
+        return Error(fmt::format("Unable to read capture file {}.", path));
+    }
+    CaptureReader reader{file};
+    u32 magic = 0;
+    u32 version = 0;
+    reader.value(magic);
+    reader.value(version);
+    if (magic != kCaptureMagic) {
+        return Error(fmt::format("{} is not a frame capture.", path));
+    }
+    if (version != kCaptureVersion) {
+        return Error(fmt::format("{} has capture version {}, expected {}.", path, version,
+                                 kCaptureVersion));
+    }
+    reader.value(capture.renderer);
+    reader.value(capture.width);
+    reader.value(capture.height);
+    transfer(reader, capture.setup_commands);
+    transfer(reader, capture.frame);
+    if (reader.failed()) {
+        return Error(fmt::format("{} is truncated or corrupt.", path));
+    }
+    return {};
+}
+}  // namespace gfx
+}  // namespace dw
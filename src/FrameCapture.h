@@ -0,0 +1,92 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Renderer.h"
+
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dw {
+namespace gfx {
+// How a render command affects the resource it refers to. Resources are identified by a key
+// made up of the resource type and handle.
+struct ResourceCommandInfo {
+    enum class Action { Create, Update, Delete };
+
+    u64 key;
+    Action action;
+    // The byte range written by an update.
+    uint offset;
+    usize size;
+    // The region written by a texture update, which is used instead of the byte range.
+    struct TextureRegion {
+        uint mip_level;
+        u16 x;
+        u16 y;
+        u16 width;
+        u16 height;
+
+        bool contains(const TextureRegion& other) const {
+            return mip_level == other.mip_level && x <= other.x && y <= other.y &&
+                   other.x + other.width <= x + width && other.y + other.height <= y + height;
+        }
+    };
+    std::optional<TextureRegion> texture_region = std::nullopt;
+};
+
+// Returns how a command affects a resource, or std::nullopt if it doesn't create, update or delete
+// a resource (for example, PrewarmPipeline).
+std::optional<ResourceCommandInfo> resourceCommandInfo(const RenderCommand& command);
+
+// Returns the command which deletes the resource created by a create command, or std::nullopt if
+// the resource can't be deleted (for example, uniforms).
+std::optional<RenderCommand> deleteCommandFor(const RenderCommand& create_command);
+
+// The live resources of a renderer, stored as the command which created each resource followed by
+// the commands which have updated it since. Updates which are entirely overwritten by a later
+// update are dropped.
+class ResourceJournal {
+public:
+    // Applies the commands of a frame.
+    void record(const std::vector<RenderCommand>& commands);
+
+    // Returns the commands which recreate every live resource, in the order that the resources
+    // were created.
+    std::vector<RenderCommand> commands() const;
+
+private:
+    // Commands of each resource, ordered by creation.
+    std::map<u64, std::vector<RenderCommand>> resources_;
+    std::unordered_map<u64, u64> creation_index_;
+    u64 next_creation_index_ = 0;
+};
+
+// A frame loaded from a capture file. Memory blocks in the commands refer to the mapped file, and
+// keep it alive.
+struct FrameCaptureData {
+    RendererType renderer;
+    u16 width;
+    u16 height;
+    // Commands which recreate the resources which existed before the frame.
+    std::vector<RenderCommand> setup_commands;
+    Frame frame;
+};
+
+// Writes a frame to a capture file, along with the commands which create the resources used by
+// it. Captures are a flat stream of values in native byte order, so they can only be read by the
+// same version of the library on the same platform.
+Result<void, std::string> writeFrameCapture(const std::string& path, RendererType renderer,
+                                            u16 width, u16 height,
+                                            const std::vector<RenderCommand>& setup_commands,
+                                            const Frame& frame);
+
+// Reads a capture file written by writeFrameCapture.
+Result<void, std::string> readFrameCapture(const std::string& path, FrameCaptureData& capture);
+}  // namespace gfx
+}  // namespace dw
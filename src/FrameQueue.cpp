@@ -0,0 +1,62 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "dawn-gfx/detail/FrameQueue.h"
+
+#include <cassert>
+
+namespace dw {
+namespace gfx {
+FrameQueue::FrameQueue()
+    : frames_{}, head_(0), tail_(0), consumer_waiting_(false), closed_(false) {
+}
+
+void FrameQueue::push(Frame* frame) {
+    usize tail = tail_.load(std::memory_order_relaxed);
+    assert(tail - head_.load(std::memory_order_acquire) < kCapacity);
+    frames_[tail % kCapacity] = frame;
+    tail_.store(tail + 1, std::memory_order_seq_cst);
+
+    // The consumer sets the flag before checking the queue again under the mutex, so either it
+    // sees the frame, or the flag is seen here. Taking the mutex ensures that the notification
+    // can't happen between its check and it going to sleep.
+    if (consumer_waiting_.load(std::memory_order_seq_cst)) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        cv_.notify_one();
+    }
+}
+
+Frame* FrameQueue::tryPop() {
+    usize head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_seq_cst)) {
+        return nullptr;
+    }
+    Frame* frame = frames_[head % kCapacity];
+    head_.store(head + 1, std::memory_order_release);
+    return frame;
+}
+
+Frame* FrameQueue::pop() {
+    Frame* frame = tryPop();
+    if (frame) {
+        return frame;
+    }
+
+    std::unique_lock<std::mutex> lock{mutex_};
+    consumer_waiting_.store(true, std::memory_order_seq_cst);
+    cv_.wait(lock, [this, &frame] {
+        frame = tryPop();
+        return frame || closed_;
+    });
+    consumer_waiting_.store(false, std::memory_order_relaxed);
+    return frame;
+}
+
+void FrameQueue::close() {
+    std::lock_guard<std::mutex> lock{mutex_};
+    closed_ = true;
+    cv_.notify_all();
+}
+}  // namespace gfx
+}  // namespace dw
@@ -0,0 +1,132 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "Base.h"
+#include "FrameReplay.h"
+#include "FrameCapture.h"
+
+#include "gl/RenderContextGL.h"
+#include "null/RenderContextNull.h"
+#include "vulkan/RenderContextVK.h"
+
+#include <unordered_set>
+
+namespace dw {
+namespace gfx {
+FrameReplay::FrameReplay(Logger& logger) : logger_(logger), setup_pending_(false) {
+}
+
+FrameReplay::~FrameReplay() {
+    if (render_context_) {
+        render_context_->stopRendering();
+        render_context_.reset();
+    }
+}
+
+Result<void, std::string> FrameReplay::open(const std::string& path, RendererType type,
+                                            bool window_hidden) {
+    capture_ = std::make_unique<FrameCaptureData>();
+    commands_post_.clear();
+    auto read_result = readFrameCapture(path, *capture_);
+    if (!read_result) {
+        return read_result;
+    }
+
+    // Create programs synchronously, so that every replayed frame draws the same items.
+    for (auto* commands : {&capture_->setup_commands, &capture_->frame.commands_pre}) {
+        for (auto& command : *commands) {
+            if (auto* create_program = std::get_if<cmd::CreateProgram>(&command)) {
+                create_program->async = false;
+            }
+        }
+    }
+
+    // After each frame, delete the resources created by the frame so that the next replay can
+    // create them again. Resources which existed before the frame are kept, as later replays
+    // still use them.
+    std::unordered_set<u64> created_by_frame;
+    for (const auto& command : capture_->frame.commands_pre) {
+        auto info = resourceCommandInfo(command);
+        if (info && info->action == ResourceCommandInfo::Action::Create) {
+            created_by_frame.insert(info->key);
+        }
+    }
+    for (const auto& command : capture_->frame.commands_post) {
+        auto info = resourceCommandInfo(command);
+        if (info && info->action == ResourceCommandInfo::Action::Delete &&
+            created_by_frame.erase(info->key) > 0) {
+            commands_post_.emplace_back(command);
+        }
+    }
+    for (auto it = capture_->frame.commands_pre.rbegin(); it != capture_->frame.commands_pre.rend();
+         ++it) {
+        auto info = resourceCommandInfo(*it);
+        if (info && info->action == ResourceCommandInfo::Action::Create &&
+            created_by_frame.erase(info->key) > 0) {
+            if (auto delete_command = deleteCommandFor(*it)) {
+                commands_post_.emplace_back(std::move(*delete_command));
+            }
+        }
+    }
+
+    switch (type) {
+        case RendererType::Null:
+            render_context_ = std::make_unique<RenderContextNull>(logger_);
+            break;
+        case RendererType::OpenGL:
+            render_context_ = std::make_unique<RenderContextGL>(logger_);
+            break;
+        case RendererType::Vulkan:
+            render_context_ = std::make_unique<RenderContextVK>(logger_);
+            break;
+    }
+    render_context_->setWindowHidden(window_hidden);
+    auto window_result = render_context_->createWindow(capture_->width, capture_->height,
+                                                       "Frame Replay", InputCallbacks{});
+    if (!window_result) {
+        render_context_.reset();
+        return window_result;
+    }
+    render_context_->startRendering();
+    setup_pending_ = true;
+    logger_.info("[FrameReplay] Loaded {} with {} setup commands and {} render queues.", path,
+                 capture_->setup_commands.size(), capture_->frame.render_queues.size());
+    return {};
+}
+
+bool FrameReplay::frame() {
+    if (!render_context_) {
+        return false;
+    }
+    render_context_->beginFrameStats();
+    render_context_->prepareFrame();
+    if (setup_pending_) {
+        render_context_->processCommandList(capture_->setup_commands);
+        setup_pending_ = false;
+    }
+    render_context_->processCommandList(capture_->frame.commands_pre);
+    if (!render_context_->frame(&capture_->frame)) {
+        logger_.warn("[FrameReplay] Rendering failed.");
+        return false;
+    }
+    render_context_->processCommandList(commands_post_);
+    render_context_->endFrameStats(&capture_->frame);
+
+    render_context_->processEvents();
+    return !render_context_->isWindowClosed();
+}
+
+FrameStats FrameReplay::frameStats() const {
+    return render_context_ ? render_context_->frameStats() : FrameStats{};
+}
+
+GpuTimings FrameReplay::gpuTimings() const {
+    return render_context_ ? render_context_->gpuTimings() : GpuTimings{};
+}
+
+RendererType FrameReplay::capturedRendererType() const {
+    return capture_ ? capture_->renderer : RendererType::Null;
+}
+}  // namespace gfx
+}  // namespace dw
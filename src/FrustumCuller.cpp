@@ -0,0 +1,372 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "FrustumCuller.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#if defined(__AVX__)
+#define DW_CULL_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DW_CULL_SSE
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DW_CULL_NEON
+#include <arm_neon.h>
+#endif
+
+namespace dw {
+namespace gfx {
+namespace {
+// Batches smaller than this are culled on the calling thread, as waking up the workers would cost
+// more than it saves.
+constexpr usize kParallelThreshold = 32768;
+constexpr usize kJobSize = 16384;
+
+// The six planes of a frustum, with normals facing inwards. A point p is inside a plane if
+// a * p.x + b * p.y + c * p.z + d >= 0.
+struct FrustumPlanes {
+    float a[6];
+    float b[6];
+    float c[6];
+    float d[6];
+};
+
+FrustumPlanes extractPlanes(const Mat4& m) {
+    // Gribb and Hartmann's method: (row 3 +/- row i) . p >= 0 for each clip space axis.
+    FrustumPlanes planes;
+    for (int i = 0; i < 6; ++i) {
+        int row = i / 2;
+        float sign = i % 2 == 0 ? 1.0f : -1.0f;
+        float a = m[3][0] + sign * m[row][0];
+        float b = m[3][1] + sign * m[row][1];
+        float c = m[3][2] + sign * m[row][2];
+        float d = m[3][3] + sign * m[row][3];
+        // Normalise the plane, so that distances can be compared against sphere radii.
+        float length = std::sqrt(a * a + b * b + c * c);
+        float scale = length > 0.0f ? 1.0f / length : 0.0f;
+        planes.a[i] = a * scale;
+        planes.b[i] = b * scale;
+        planes.c[i] = c * scale;
+        planes.d[i] = d * scale;
+    }
+    return planes;
+}
+
+// Each instruction set provides the same set of operations on a fixed number of lanes, so that the
+// kernels below only need to be written once.
+struct ScalarOps {
+    static constexpr usize kWidth = 1;
+    using Float = float;
+    using Mask = bool;
+
+    static Float load(const float* p) {
+        return *p;
+    }
+    static Float splat(float value) {
+        return value;
+    }
+    static Float add(Float a, Float b) {
+        return a + b;
+    }
+    static Float sub(Float a, Float b) {
+        return a - b;
+    }
+    static Float mul(Float a, Float b) {
+        return a * b;
+    }
+    static Mask greater(Float a, Float b) {
+        return a > b;
+    }
+    static Mask both(Mask a, Mask b) {
+        return a && b;
+    }
+    static Mask allTrue() {
+        return true;
+    }
+    static u32 bits(Mask mask) {
+        return mask ? 1 : 0;
+    }
+};
+
+#if defined(DW_CULL_AVX)
+struct SimdOps {
+    static constexpr usize kWidth = 8;
+    using Float = __m256;
+    using Mask = __m256;
+
+    static Float load(const float* p) {
+        return _mm256_loadu_ps(p);
+    }
+    static Float splat(float value) {
+        return _mm256_set1_ps(value);
+    }
+    static Float add(Float a, Float b) {
+        return _mm256_add_ps(a, b);
+    }
+    static Float sub(Float a, Float b) {
+        return _mm256_sub_ps(a, b);
+    }
+    static Float mul(Float a, Float b) {
+        return _mm256_mul_ps(a, b);
+    }
+    static Mask greater(Float a, Float b) {
+        return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+    }
+    static Mask both(Mask a, Mask b) {
+        return _mm256_and_ps(a, b);
+    }
+    static Mask allTrue() {
+        return _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    }
+    static u32 bits(Mask mask) {
+        return static_cast<u32>(_mm256_movemask_ps(mask));
+    }
+};
+#elif defined(DW_CULL_SSE)
+struct SimdOps {
+    static constexpr usize kWidth = 4;
+    using Float = __m128;
+    using Mask = __m128;
+
+    static Float load(const float* p) {
+        return _mm_loadu_ps(p);
+    }
+    static Float splat(float value) {
+        return _mm_set1_ps(value);
+    }
+    static Float add(Float a, Float b) {
+        return _mm_add_ps(a, b);
+    }
+    static Float sub(Float a, Float b) {
+        return _mm_sub_ps(a, b);
+    }
+    static Float mul(Float a, Float b) {
+        return _mm_mul_ps(a, b);
+    }
+    static Mask greater(Float a, Float b) {
+        return _mm_cmpgt_ps(a, b);
+    }
+    static Mask both(Mask a, Mask b) {
+        return _mm_and_ps(a, b);
+    }
+    static Mask allTrue() {
+        return _mm_castsi128_ps(_mm_set1_epi32(-1));
+    }
+    static u32 bits(Mask mask) {
+        return static_cast<u32>(_mm_movemask_ps(mask));
+    }
+};
+#elif defined(DW_CULL_NEON)
+struct SimdOps {
+    static constexpr usize kWidth = 4;
+    using Float = float32x4_t;
+    using Mask = uint32x4_t;
+
+    static Float load(const float* p) {
+        return vld1q_f32(p);
+    }
+    static Float splat(float value) {
+        return vdupq_n_f32(value);
+    }
+    static Float add(Float a, Float b) {
+        return vaddq_f32(a, b);
+    }
+    static Float sub(Float a, Float b) {
+        return vsubq_f32(a, b);
+    }
+    static Float mul(Float a, Float b) {
+        return vmulq_f32(a, b);
+    }
+    static Mask greater(Float a, Float b) {
+        return vcgtq_f32(a, b);
+    }
+    static Mask both(Mask a, Mask b) {
+        return vandq_u32(a, b);
+    }
+    static Mask allTrue() {
+        return vdupq_n_u32(0xFFFFFFFF);
+    }
+    static u32 bits(Mask mask) {
+        // NEON has no movemask, so select a different bit from each lane and combine them.
+        const u32 lane_bits[4] = {1, 2, 4, 8};
+        uint32x4_t selected = vandq_u32(mask, vld1q_u32(lane_bits));
+        uint32x2_t pairs = vorr_u32(vget_low_u32(selected), vget_high_u32(selected));
+        return vget_lane_u32(pairs, 0) | vget_lane_u32(pairs, 1);
+    }
+};
+#else
+using SimdOps = ScalarOps;
+#endif
+
+template <typename Ops> struct SplatPlanes {
+    typename Ops::Float a[6];
+    typename Ops::Float b[6];
+    typename Ops::Float c[6];
+    typename Ops::Float d[6];
+
+    explicit SplatPlanes(const FrustumPlanes& planes) {
+        for (usize i = 0; i < 6; ++i) {
+            a[i] = Ops::splat(planes.a[i]);
+            b[i] = Ops::splat(planes.b[i]);
+            c[i] = Ops::splat(planes.c[i]);
+            d[i] = Ops::splat(planes.d[i]);
+        }
+    }
+
+    typename Ops::Float distance(usize i, typename Ops::Float x, typename Ops::Float y,
+                                 typename Ops::Float z) const {
+        return Ops::add(Ops::add(Ops::mul(a[i], x), Ops::mul(b[i], y)),
+                        Ops::add(Ops::mul(c[i], z), d[i]));
+    }
+};
+
+template <typename Ops> void appendVisible(u32 bits, usize first, std::vector<u32>& visible) {
+    for (usize lane = 0; lane < Ops::kWidth; ++lane) {
+        if (bits & (1u << lane)) {
+            visible.emplace_back(static_cast<u32>(first + lane));
+        }
+    }
+}
+
+// A sphere is visible if its centre is no further than its radius behind any plane.
+template <typename Ops>
+usize cullSpheresRange(const FrustumPlanes& planes, const BoundingSpheres& spheres, usize begin,
+                       usize end, std::vector<u32>& visible) {
+    const SplatPlanes<Ops> splat_planes{planes};
+    const typename Ops::Float zero = Ops::splat(0.0f);
+    usize i = begin;
+    for (; i + Ops::kWidth <= end; i += Ops::kWidth) {
+        auto x = Ops::load(spheres.centre_x + i);
+        auto y = Ops::load(spheres.centre_y + i);
+        auto z = Ops::load(spheres.centre_z + i);
+        auto r = Ops::load(spheres.radius + i);
+        auto inside = Ops::allTrue();
+        for (usize p = 0; p < 6; ++p) {
+            auto distance = Ops::add(splat_planes.distance(p, x, y, z), r);
+            inside = Ops::both(inside, Ops::greater(distance, zero));
+        }
+        appendVisible<Ops>(Ops::bits(inside), i, visible);
+    }
+    return i;
+}
+
+// A box is visible if the corner which is furthest along a plane's normal isn't behind the plane,
+// for every plane. The distance to that corner is the distance to the centre plus the box's
+// extents projected onto the normal.
+template <typename Ops>
+usize cullBoxesRange(const FrustumPlanes& planes, const BoundingBoxes& boxes, usize begin,
+                     usize end, std::vector<u32>& visible) {
+    FrustumPlanes abs_planes;
+    for (usize p = 0; p < 6; ++p) {
+        abs_planes.a[p] = std::abs(planes.a[p]);
+        abs_planes.b[p] = std::abs(planes.b[p]);
+        abs_planes.c[p] = std::abs(planes.c[p]);
+        abs_planes.d[p] = 0.0f;
+    }
+    const SplatPlanes<Ops> splat_planes{planes};
+    const SplatPlanes<Ops> splat_abs_planes{abs_planes};
+    const typename Ops::Float zero = Ops::splat(0.0f);
+    const typename Ops::Float half = Ops::splat(0.5f);
+    usize i = begin;
+    for (; i + Ops::kWidth <= end; i += Ops::kWidth) {
+        auto min_x = Ops::load(boxes.min_x + i);
+        auto min_y = Ops::load(boxes.min_y + i);
+        auto min_z = Ops::load(boxes.min_z + i);
+        auto max_x = Ops::load(boxes.max_x + i);
+        auto max_y = Ops::load(boxes.max_y + i);
+        auto max_z = Ops::load(boxes.max_z + i);
+        auto centre_x = Ops::mul(Ops::add(min_x, max_x), half);
+        auto centre_y = Ops::mul(Ops::add(min_y, max_y), half);
+        auto centre_z = Ops::mul(Ops::add(min_z, max_z), half);
+        auto extent_x = Ops::mul(Ops::sub(max_x, min_x), half);
+        auto extent_y = Ops::mul(Ops::sub(max_y, min_y), half);
+        auto extent_z = Ops::mul(Ops::sub(max_z, min_z), half);
+        auto inside = Ops::allTrue();
+        for (usize p = 0; p < 6; ++p) {
+            auto distance = Ops::add(splat_planes.distance(p, centre_x, centre_y, centre_z),
+                                     splat_abs_planes.distance(p, extent_x, extent_y, extent_z));
+            inside = Ops::both(inside, Ops::greater(distance, zero));
+        }
+        appendVisible<Ops>(Ops::bits(inside), i, visible);
+    }
+    return i;
+}
+
+// Culls a range with the widest available kernel, then the scalar kernel for any leftovers.
+void cullSpheres(const FrustumPlanes& planes, const BoundingSpheres& spheres, usize begin,
+                 usize end, std::vector<u32>& visible) {
+    usize tail = cullSpheresRange<SimdOps>(planes, spheres, begin, end, visible);
+    cullSpheresRange<ScalarOps>(planes, spheres, tail, end, visible);
+}
+
+void cullBoxes(const FrustumPlanes& planes, const BoundingBoxes& boxes, usize begin, usize end,
+               std::vector<u32>& visible) {
+    usize tail = cullBoxesRange<SimdOps>(planes, boxes, begin, end, visible);
+    cullBoxesRange<ScalarOps>(planes, boxes, tail, end, visible);
+}
+}  // namespace
+
+FrustumCuller::FrustumCuller(usize thread_count) {
+    if (thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (thread_count > 1) {
+        worker_pool_ = std::make_unique<WorkerPool>(thread_count);
+    }
+}
+
+FrustumCuller::~FrustumCuller() = default;
+
+usize FrustumCuller::cull(const Mat4& view_proj, const BoundingSpheres& spheres,
+                          std::vector<u32>& visible) {
+    FrustumPlanes planes = extractPlanes(view_proj);
+    return cullParallel(spheres, visible,
+                        [&planes, &spheres](usize begin, usize end, std::vector<u32>& out) {
+                            cullSpheres(planes, spheres, begin, end, out);
+                        });
+}
+
+usize FrustumCuller::cull(const Mat4& view_proj, const BoundingBoxes& boxes,
+                          std::vector<u32>& visible) {
+    FrustumPlanes planes = extractPlanes(view_proj);
+    return cullParallel(boxes, visible,
+                        [&planes, &boxes](usize begin, usize end, std::vector<u32>& out) {
+                            cullBoxes(planes, boxes, begin, end, out);
+                        });
+}
+
+template <typename Volumes, typename Kernel>
+usize FrustumCuller::cullParallel(const Volumes& volumes, std::vector<u32>& visible,
+                                  Kernel kernel) {
+    visible.clear();
+    if (!worker_pool_ || volumes.count < kParallelThreshold) {
+        kernel(0, volumes.count, visible);
+        return visible.size();
+    }
+
+    // Each job writes to its own list, and the lists are joined in order afterwards so that the
+    // result is the same as culling on one thread. The lists are kept between calls to avoid
+    // reallocating them every frame.
+    usize job_count = (volumes.count + kJobSize - 1) / kJobSize;
+    if (job_visible_.size() < job_count) {
+        job_visible_.resize(job_count);
+    }
+    worker_pool_->run(job_count, [this, &volumes, &kernel](usize, usize job_index) {
+        auto& out = job_visible_[job_index];
+        out.clear();
+        usize begin = job_index * kJobSize;
+        kernel(begin, std::min(begin + kJobSize, volumes.count), out);
+    });
+    for (usize job = 0; job < job_count; ++job) {
+        visible.insert(visible.end(), job_visible_[job].begin(), job_visible_[job].end());
+    }
+    return visible.size();
+}
+}  // namespace gfx
+}  // namespace dw
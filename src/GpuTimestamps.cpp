@@ -0,0 +1,104 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "Base.h"
+#include "GpuTimestamps.h"
+
+#include <algorithm>
+
+namespace dw {
+namespace gfx {
+namespace {
+double ticksToMilliseconds(u64 begin, u64 end, double nanoseconds_per_tick) {
+    if (end <= begin) {
+        return 0.0;
+    }
+    return static_cast<double>(end - begin) * nanoseconds_per_tick * 1e-6;
+}
+}  // namespace
+
+void GpuTimestampLayout::build(const Frame* frame, u32 max_queries) {
+    query_count_ = 2;
+    queue_timestamps_.clear();
+    queue_ranges_.clear();
+    scopes_.clear();
+
+    std::vector<uint> positions;
+    for (usize i = 0; i < frame->render_queues.size(); ++i) {
+        const auto& queue = frame->render_queues[i];
+        auto& timestamps = queue_timestamps_.emplace_back();
+        auto& queue_range = queue_ranges_.emplace_back(Range{kNoQuery, kNoQuery});
+        uint item_count = static_cast<uint>(queue.render_items.size());
+        if (item_count == 0) {
+            continue;
+        }
+
+        // Collect the distinct positions which need a timestamp.
+        positions.clear();
+        positions.emplace_back(0);
+        positions.emplace_back(item_count);
+        for (const auto& scope : queue.timing_scopes) {
+            positions.emplace_back(std::min(scope.begin, item_count));
+            positions.emplace_back(std::min(scope.end, item_count));
+        }
+        std::sort(positions.begin(), positions.end());
+        positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+        if (query_count_ + positions.size() > max_queries) {
+            continue;
+        }
+        for (uint position : positions) {
+            timestamps.emplace_back(position, query_count_++);
+        }
+
+        // Resolve the queries at each end of the queue and its scopes.
+        auto query_at = [&timestamps, item_count](uint position) {
+            position = std::min(position, item_count);
+            auto it = std::lower_bound(
+                timestamps.begin(), timestamps.end(), position,
+                [](const std::pair<uint, u32>& entry, uint p) { return entry.first < p; });
+            return it->second;
+        };
+        queue_range = Range{timestamps.front().second, timestamps.back().second};
+        for (const auto& scope : queue.timing_scopes) {
+            scopes_.emplace_back(Scope{scope.name, static_cast<uint>(i), scope.depth,
+                                       Range{query_at(scope.begin), query_at(scope.end)}});
+        }
+    }
+}
+
+u32 GpuTimestampLayout::queryCount() const {
+    return query_count_;
+}
+
+const GpuTimestampLayout::QueueTimestamps& GpuTimestampLayout::queueTimestamps(
+    usize render_queue) const {
+    return queue_timestamps_[render_queue];
+}
+
+GpuTimings GpuTimestampLayout::resolve(const u64* timestamps, double nanoseconds_per_tick) const {
+    auto range_milliseconds = [timestamps, nanoseconds_per_tick](const Range& range) {
+        if (range.begin_query == kNoQuery) {
+            return 0.0;
+        }
+        return ticksToMilliseconds(timestamps[range.begin_query], timestamps[range.end_query],
+                                   nanoseconds_per_tick);
+    };
+
+    GpuTimings timings;
+    timings.valid = true;
+    timings.frame_milliseconds = ticksToMilliseconds(
+        timestamps[kFrameBeginQuery], timestamps[kFrameEndQuery], nanoseconds_per_tick);
+    timings.render_queue_milliseconds.reserve(queue_ranges_.size());
+    for (const auto& range : queue_ranges_) {
+        timings.render_queue_milliseconds.emplace_back(range_milliseconds(range));
+    }
+    timings.scopes.reserve(scopes_.size());
+    for (const auto& scope : scopes_) {
+        timings.scopes.emplace_back(GpuTimings::Scope{scope.name, scope.render_queue, scope.depth,
+                                                      range_milliseconds(scope.range)});
+    }
+    return timings;
+}
+}  // namespace gfx
+}  // namespace dw
@@ -0,0 +1,59 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Renderer.h"
+
+#include <utility>
+#include <vector>
+
+namespace dw {
+namespace gfx {
+// Layout of the timestamp queries written while rendering a frame. Queries 0 and 1 are written at
+// the start and end of the frame. Each non-empty render queue then has a timestamp at every item
+// position which begins or ends the queue or one of its timing scopes. A timestamp at position i
+// is written before render item i, or after the last item if i is the item count.
+class GpuTimestampLayout {
+public:
+    static constexpr u32 kFrameBeginQuery = 0;
+    static constexpr u32 kFrameEndQuery = 1;
+
+    using QueueTimestamps = std::vector<std::pair<uint, u32>>;
+
+    // Assigns queries to the timestamps of a frame. Render queues which don't fit in 'max_queries'
+    // are not timed.
+    void build(const Frame* frame, u32 max_queries);
+
+    // Number of queries used by the frame.
+    u32 queryCount() const;
+
+    // Timestamps of a render queue as (item position, query) pairs, sorted by position.
+    const QueueTimestamps& queueTimestamps(usize render_queue) const;
+
+    // Converts timestamps read back from the queries into timings. 'timestamps' must contain
+    // queryCount() values.
+    GpuTimings resolve(const u64* timestamps, double nanoseconds_per_tick) const;
+
+private:
+    static constexpr u32 kNoQuery = ~0u;
+
+    struct Range {
+        u32 begin_query;
+        u32 end_query;
+    };
+    struct Scope {
+        std::string name;
+        uint render_queue;
+        uint depth;
+        Range range;
+    };
+
+    u32 query_count_ = 2;
+    std::vector<QueueTimestamps> queue_timestamps_;
+    std::vector<Range> queue_ranges_;
+    std::vector<Scope> scopes_;
+};
+}  // namespace gfx
+}  // namespace dw
@@ -0,0 +1,281 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "LightClusters.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <thread>
+#include <utility>
+
+namespace dw {
+namespace gfx {
+namespace {
+// Fewer lights than this are binned on the calling thread, as waking up the workers would cost
+// more than it saves.
+constexpr usize kParallelThreshold = 256;
+constexpr usize kBoundsJobSize = 1024;
+
+uint toTile(float ndc, uint tiles) {
+    float tile = std::floor((ndc + 1.0f) * 0.5f * static_cast<float>(tiles));
+    return static_cast<uint>(std::clamp(tile, 0.0f, static_cast<float>(tiles - 1)));
+}
+
+// Finds the range of NDC coordinates along one axis covered by a sphere with its centre at
+// 'centre' along the axis and 'depth' in front of the camera, by finding the slopes of the two
+// lines from the camera which touch the sphere. Returns false if the sphere is entirely outside
+// of [-1, 1].
+bool projectSphereAxis(float centre, float depth, float radius, float ndc_scale, uint tiles,
+                       uint& first_tile, uint& last_tile) {
+    float a = depth * depth - radius * radius;
+    if (a <= 0.0f) {
+        // The sphere crosses the plane of the camera, so it could cover the whole screen.
+        first_tile = 0;
+        last_tile = tiles - 1;
+        return true;
+    }
+    float b = centre * depth;
+    float d = radius * std::sqrt(centre * centre + a);
+    float min_ndc = (b - d) / a * ndc_scale;
+    float max_ndc = (b + d) / a * ndc_scale;
+    if (max_ndc < -1.0f || min_ndc > 1.0f) {
+        return false;
+    }
+    first_tile = toTile(min_ndc, tiles);
+    last_tile = toTile(max_ndc, tiles);
+    return true;
+}
+}  // namespace
+
+// The range of clusters covered by a light's bounding sphere. Lights which aren't visible have an
+// empty slice range.
+struct LightClusters::LightBounds {
+    Vec3 centre;
+    float radius;
+    uint first_tile_x, last_tile_x;
+    uint first_tile_y, last_tile_y;
+    uint first_slice, last_slice;
+};
+
+// Lights binned into one depth slice. Each slice is binned by a single job.
+struct LightClusters::Slice {
+    std::vector<std::pair<u32, u32>> hits;  // (tile, light) pairs.
+    std::vector<u32> fill;
+    std::vector<u32> light_indices;
+    std::vector<float> tile_min_x, tile_max_x;
+    std::vector<float> tile_min_y, tile_max_y;
+};
+
+LightClusters::LightClusters(uint tiles_x, uint tiles_y, uint slices, usize thread_count)
+    : tiles_x_(tiles_x),
+      tiles_y_(tiles_y),
+      slices_(slices),
+      ndc_scale_x_(1.0f),
+      ndc_scale_y_(1.0f),
+      slice_scale_(0.0f),
+      slice_bias_(0.0f),
+      slice_data_(slices),
+      clusters_(clusterCount() * 2, 0) {
+    assert(tiles_x > 0 && tiles_y > 0 && slices > 0);
+    if (thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (thread_count > 1) {
+        worker_pool_ = std::make_unique<WorkerPool>(thread_count);
+    }
+}
+
+LightClusters::~LightClusters() = default;
+
+void LightClusters::build(const Mat4& view_matrix, float vertical_fov, float aspect_ratio,
+                          float z_near, float z_far, const BoundingSpheres& lights) {
+    assert(z_near > 0.0f && z_far > z_near);
+
+    // Slices are distributed exponentially, so that clusters are roughly cube shaped.
+    float tan_half_fov = std::tan(vertical_fov * 0.5f);
+    ndc_scale_x_ = 1.0f / (tan_half_fov * aspect_ratio);
+    ndc_scale_y_ = 1.0f / tan_half_fov;
+    slice_scale_ = static_cast<float>(slices_) / std::log(z_far / z_near);
+    slice_bias_ = -std::log(z_near) * slice_scale_;
+    slice_depths_.resize(slices_ + 1);
+    for (uint slice = 0; slice <= slices_; ++slice) {
+        slice_depths_[slice] =
+            z_near * std::pow(z_far / z_near, static_cast<float>(slice) / slices_);
+    }
+
+    // Find the clusters covered by each light.
+    bounds_.resize(lights.count);
+    auto bound_lights = [&](usize begin, usize end) {
+        for (usize i = begin; i < end; ++i) {
+            LightBounds& bounds = bounds_[i];
+            bounds.centre = (view_matrix * Vec4{lights.centre_x[i], lights.centre_y[i],
+                                                lights.centre_z[i], 1.0f})
+                                .xyz();
+            bounds.radius = lights.radius[i];
+            bounds.first_slice = 1;
+            bounds.last_slice = 0;
+
+            float depth = -bounds.centre.z;
+            if (depth + bounds.radius < z_near || depth - bounds.radius > z_far) {
+                continue;
+            }
+            if (!projectSphereAxis(bounds.centre.x, depth, bounds.radius, ndc_scale_x_, tiles_x_,
+                                   bounds.first_tile_x, bounds.last_tile_x) ||
+                !projectSphereAxis(bounds.centre.y, depth, bounds.radius, ndc_scale_y_, tiles_y_,
+                                   bounds.first_tile_y, bounds.last_tile_y)) {
+                continue;
+            }
+            bounds.first_slice = sliceIndex(depth - bounds.radius);
+            bounds.last_slice = sliceIndex(depth + bounds.radius);
+        }
+    };
+    bool parallel = worker_pool_ && lights.count >= kParallelThreshold;
+    if (parallel) {
+        usize job_count = (lights.count + kBoundsJobSize - 1) / kBoundsJobSize;
+        worker_pool_->run(job_count, [&](usize, usize job_index) {
+            usize begin = job_index * kBoundsJobSize;
+            bound_lights(begin, std::min(begin + kBoundsJobSize, lights.count));
+        });
+    } else {
+        bound_lights(0, lights.count);
+    }
+
+    // Bin the lights into each slice independently, then join the slices together.
+    if (parallel) {
+        worker_pool_->run(slices_, [this](usize, usize slice) { binSlice(slice); });
+    } else {
+        for (uint slice = 0; slice < slices_; ++slice) {
+            binSlice(slice);
+        }
+    }
+    light_indices_.clear();
+    uint clusters_per_slice = tiles_x_ * tiles_y_;
+    for (uint slice = 0; slice < slices_; ++slice) {
+        auto offset = static_cast<u32>(light_indices_.size());
+        for (uint cluster = slice * clusters_per_slice; cluster < (slice + 1) * clusters_per_slice;
+             ++cluster) {
+            clusters_[cluster * 2] += offset;
+        }
+        const auto& slice_light_indices = slice_data_[slice].light_indices;
+        light_indices_.insert(light_indices_.end(), slice_light_indices.begin(),
+                              slice_light_indices.end());
+    }
+}
+
+const std::vector<u32>& LightClusters::clusters() const {
+    return clusters_;
+}
+
+const std::vector<u32>& LightClusters::lightIndices() const {
+    return light_indices_;
+}
+
+Vec4 LightClusters::shaderParams() const {
+    return Vec4{ndc_scale_x_, ndc_scale_y_, slice_scale_, slice_bias_};
+}
+
+uint LightClusters::clusterIndex(const Vec3& view_position) const {
+    float depth = -view_position.z;
+    uint slice = sliceIndex(depth);
+    float inv_depth = depth > 0.0f ? 1.0f / depth : 0.0f;
+    uint tile_x = toTile(view_position.x * inv_depth * ndc_scale_x_, tiles_x_);
+    uint tile_y = toTile(view_position.y * inv_depth * ndc_scale_y_, tiles_y_);
+    return (slice * tiles_y_ + tile_y) * tiles_x_ + tile_x;
+}
+
+uint LightClusters::tilesX() const {
+    return tiles_x_;
+}
+
+uint LightClusters::tilesY() const {
+    return tiles_y_;
+}
+
+uint LightClusters::slices() const {
+    return slices_;
+}
+
+uint LightClusters::clusterCount() const {
+    return tiles_x_ * tiles_y_ * slices_;
+}
+
+void LightClusters::binSlice(uint slice) {
+    Slice& data = slice_data_[slice];
+
+    // Calculate the view space bounds of each column and row of clusters in this slice. The
+    // sides of a cluster are planes through the camera, so the bounds are at either the near or
+    // far end of the slice.
+    float near_depth = slice_depths_[slice];
+    float far_depth = slice_depths_[slice + 1];
+    auto tile_bounds = [near_depth, far_depth](uint tiles, float ndc_scale,
+                                               std::vector<float>& min, std::vector<float>& max) {
+        min.resize(tiles);
+        max.resize(tiles);
+        for (uint tile = 0; tile < tiles; ++tile) {
+            float min_slope = (-1.0f + 2.0f * tile / tiles) / ndc_scale;
+            float max_slope = (-1.0f + 2.0f * (tile + 1) / tiles) / ndc_scale;
+            min[tile] = std::min(min_slope * near_depth, min_slope * far_depth);
+            max[tile] = std::max(max_slope * near_depth, max_slope * far_depth);
+        }
+    };
+    tile_bounds(tiles_x_, ndc_scale_x_, data.tile_min_x, data.tile_max_x);
+    tile_bounds(tiles_y_, ndc_scale_y_, data.tile_min_y, data.tile_max_y);
+
+    // Test each light which overlaps this slice against the clusters in its projected bounds,
+    // counting the lights in each cluster.
+    u32* slice_clusters = &clusters_[slice * tiles_x_ * tiles_y_ * 2];
+    uint tile_count = tiles_x_ * tiles_y_;
+    for (uint tile = 0; tile < tile_count; ++tile) {
+        slice_clusters[tile * 2 + 1] = 0;
+    }
+    auto squared = [](float x) { return x * x; };
+    data.hits.clear();
+    for (usize light = 0; light < bounds_.size(); ++light) {
+        const LightBounds& bounds = bounds_[light];
+        if (slice < bounds.first_slice || slice > bounds.last_slice) {
+            continue;
+        }
+        const Vec3& c = bounds.centre;
+        float z = std::clamp(c.z, -far_depth, -near_depth);
+        float radius_sq = bounds.radius * bounds.radius - squared(c.z - z);
+        for (uint tile_y = bounds.first_tile_y; tile_y <= bounds.last_tile_y; ++tile_y) {
+            float y = std::clamp(c.y, data.tile_min_y[tile_y], data.tile_max_y[tile_y]);
+            float row_radius_sq = radius_sq - squared(c.y - y);
+            for (uint tile_x = bounds.first_tile_x; tile_x <= bounds.last_tile_x; ++tile_x) {
+                float x = std::clamp(c.x, data.tile_min_x[tile_x], data.tile_max_x[tile_x]);
+                if (squared(c.x - x) <= row_radius_sq) {
+                    uint tile = tile_y * tiles_x_ + tile_x;
+                    data.hits.emplace_back(tile, static_cast<u32>(light));
+                    slice_clusters[tile * 2 + 1]++;
+                }
+            }
+        }
+    }
+
+    // Group the lights by cluster. Offsets are relative to the start of this slice until the
+    // slices are joined.
+    data.fill.resize(tile_count);
+    u32 offset = 0;
+    for (uint tile = 0; tile < tile_count; ++tile) {
+        slice_clusters[tile * 2] = offset;
+        data.fill[tile] = offset;
+        offset += slice_clusters[tile * 2 + 1];
+    }
+    data.light_indices.resize(data.hits.size());
+    for (const auto& hit : data.hits) {
+        data.light_indices[data.fill[hit.first]++] = hit.second;
+    }
+}
+
+uint LightClusters::sliceIndex(float depth) const {
+    if (depth <= 0.0f) {
+        return 0;
+    }
+    float slice = std::floor(std::log(depth) * slice_scale_ + slice_bias_);
+    return static_cast<uint>(std::clamp(slice, 0.0f, static_cast<float>(slices_ - 1)));
+}
+}  // namespace gfx
+}  // namespace dw
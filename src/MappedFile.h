@@ -0,0 +1,83 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Base.h"
+
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <vector>
+#endif
+
+namespace dw {
+namespace gfx {
+// A view of a file's contents. The file is memory mapped copy-on-write where supported, otherwise
+// it's read into memory. Either way, writes to the data are never written back to the file.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) : data_{nullptr}, size_{0} {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat file_stat;
+        if (::fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+            void* mapping = ::mmap(nullptr, static_cast<usize>(file_stat.st_size),
+                                   PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                data_ = static_cast<byte*>(mapping);
+                size_ = static_cast<usize>(file_stat.st_size);
+            }
+        }
+        ::close(fd);
+#else
+        std::ifstream file{path, std::ios::binary | std::ios::ate};
+        if (!file) {
+            return;
+        }
+        buffer_.resize(static_cast<usize>(file.tellg()));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(buffer_.data()), buffer_.size());
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+#endif
+    }
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (data_) {
+            ::munmap(data_, size_);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    byte* data() const {
+        return data_;
+    }
+
+    usize size() const {
+        return size_;
+    }
+
+private:
+    byte* data_;
+    usize size_;
+#ifdef _WIN32
+    std::vector<byte> buffer_;
+#endif
+};
+}  // namespace gfx
+}  // namespace dw
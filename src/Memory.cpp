@@ -4,14 +4,114 @@
  */
 #include "dawn-gfx/detail/Memory.h"
 
+#include <atomic>
+
 namespace dw {
 namespace gfx {
+namespace {
+std::atomic<MemoryAllocator*> memory_allocator{nullptr};
+
+MemoryAllocator& defaultMemoryAllocator() {
+    // Intentionally leaked, as memory blocks held by static objects can be destroyed after any
+    // static allocator would have been.
+    static auto* allocator = new PooledMemoryAllocator();
+    return *allocator;
+}
+}  // namespace
+
+byte* HeapMemoryAllocator::allocate(usize size) {
+    return new byte[size];
+}
+
+void HeapMemoryAllocator::deallocate(byte* data, usize) {
+    delete[] data;
+}
+
+PooledMemoryAllocator::PooledMemoryAllocator(MemoryAllocator* parent)
+    : parent_(parent ? parent : &heap_) {
+}
+
+PooledMemoryAllocator::~PooledMemoryAllocator() {
+    for (usize i = 0; i < kSizeClassCount; ++i) {
+        for (byte* block : size_classes_[i].free_blocks) {
+            parent_->deallocate(block, kMinBlockSize << i);
+        }
+    }
+}
+
+byte* PooledMemoryAllocator::allocate(usize size) {
+    usize index = sizeClassIndex(size);
+    if (index == kSizeClassCount) {
+        return parent_->allocate(size);
+    }
+    auto& size_class = size_classes_[index];
+    {
+        std::lock_guard<std::mutex> lock{size_class.mutex};
+        if (!size_class.free_blocks.empty()) {
+            byte* block = size_class.free_blocks.back();
+            size_class.free_blocks.pop_back();
+            return block;
+        }
+    }
+    return parent_->allocate(kMinBlockSize << index);
+}
+
+void PooledMemoryAllocator::deallocate(byte* data, usize size) {
+    usize index = sizeClassIndex(size);
+    if (index == kSizeClassCount) {
+        parent_->deallocate(data, size);
+        return;
+    }
+    usize block_size = kMinBlockSize << index;
+    auto& size_class = size_classes_[index];
+    {
+        std::lock_guard<std::mutex> lock{size_class.mutex};
+        if ((size_class.free_blocks.size() + 1) * block_size <= kMaxPooledBytes) {
+            size_class.free_blocks.emplace_back(data);
+            return;
+        }
+    }
+    parent_->deallocate(data, block_size);
+}
+
+usize PooledMemoryAllocator::sizeClassIndex(usize size) {
+    if (size > kMaxBlockSize) {
+        return kSizeClassCount;
+    }
+    usize index = 0;
+    while ((kMinBlockSize << index) < size) {
+        ++index;
+    }
+    return index;
+}
+
+void Memory::setAllocator(MemoryAllocator* allocator) {
+    memory_allocator.store(allocator, std::memory_order_release);
+}
+
+MemoryAllocator& Memory::allocator() {
+    MemoryAllocator* allocator = memory_allocator.load(std::memory_order_acquire);
+    return allocator ? *allocator : defaultMemoryAllocator();
+}
+
+Memory Memory::view(const void* data, usize size, std::function<void()> on_release) {
+    // The deleter doesn't free the data, it only tells the owner that it's no longer used.
+    byte* bytes = const_cast<byte*>(static_cast<const byte*>(data));
+    return Memory(bytes, size, [on_release = std::move(on_release)](byte*) {
+        if (on_release) {
+            on_release();
+        }
+    });
+}
+
 Memory::Memory() : data_{nullptr}, size_{0} {
 }
 
 Memory::Memory(usize size) : size_{size} {
     if (size > 0) {
-        data_.reset(new byte[size], std::default_delete<byte[]>());
+        MemoryAllocator* allocator = &Memory::allocator();
+        data_.reset(allocator->allocate(size),
+                    [allocator, size](byte* data) { allocator->deallocate(data, size); });
     }
 }
 
@@ -7,7 +7,7 @@
 namespace dw {
 namespace gfx {
 MeshBuilder::MeshBuilder(Renderer& r)
-    : r_(r), with_normals_(false), with_texcoords_(false), with_tangents_(false) {
+    : r_(r), with_normals_(false), with_texcoords_(false), with_tangents_(false), lod_count_(1) {
 }
 
 MeshBuilder& MeshBuilder::normals(bool normals) {
@@ -25,8 +25,14 @@ MeshBuilder& MeshBuilder::tangents(bool tangents) {
     return *this;
 }
 
+MeshBuilder& MeshBuilder::lods(uint count) {
+    lod_count_ = count;
+    return *this;
+}
+
 Mesh MeshBuilder::createPlane(float width, float height) {
     TriangleBuffer buffer;
+    buffer.lods(lod_count_);
     buffer.begin();
     buffer.estimateVertexCount(4);
     buffer.estimateIndexCount(6);
@@ -121,6 +127,7 @@ Mesh MeshBuilder::createBox(float half_size) {
 
     // Build mesh.
     TriangleBuffer buffer;
+    buffer.lods(lod_count_);
     buffer.begin();
     buffer.estimateVertexCount(36);
     buffer.estimateIndexCount(36);
@@ -145,6 +152,7 @@ Mesh MeshBuilder::createBox(float half_size) {
 
 Mesh MeshBuilder::createSphere(float radius, uint num_rings, uint num_segments) {
     TriangleBuffer buffer;
+    buffer.lods(lod_count_);
 
     buffer.begin();
     buffer.estimateVertexCount((num_rings + 1) * (num_segments + 1));
@@ -0,0 +1,539 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "MeshOptimizer.h"
+#include "ContentHash.h"
+#include "MathDefs.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace dw {
+namespace gfx {
+namespace {
+// Parameters of Forsyth's scoring function. The simulated cache is larger than the caches of most
+// GPUs, which gives a better result across a range of cache sizes.
+constexpr usize kVertexCacheSize = 32;
+constexpr float kCacheDecayPower = 1.5f;
+constexpr float kLastTriangleScore = 0.75f;
+constexpr float kValenceBoostScale = 2.0f;
+constexpr float kValenceBoostPower = 0.5f;
+
+// Size of the FIFO cache simulated to find cluster boundaries when optimising overdraw.
+constexpr u32 kClusterCacheSize = 16;
+
+float vertexScore(int cache_position, u32 remaining_triangles) {
+    if (remaining_triangles == 0) {
+        // The vertex isn't used by any more triangles.
+        return -1.0f;
+    }
+    float score = 0.0f;
+    if (cache_position >= 0) {
+        if (cache_position < 3) {
+            // Vertices used by the previous triangle have a fixed score, so that the order of
+            // the vertices within a triangle doesn't matter.
+            score = kLastTriangleScore;
+        } else {
+            const float scale = 1.0f / static_cast<float>(kVertexCacheSize - 3);
+            score = std::pow(1.0f - static_cast<float>(cache_position - 3) * scale,
+                             kCacheDecayPower);
+        }
+    }
+    // Boost vertices with few triangles left, so that we don't leave lone triangles behind.
+    score += kValenceBoostScale *
+             std::pow(static_cast<float>(remaining_triangles), -kValenceBoostPower);
+    return score;
+}
+
+Vec3 readPosition(const void* positions, usize stride, u32 index) {
+    const auto* data = static_cast<const byte*>(positions) + index * stride;
+    float p[3];
+    std::memcpy(p, data, sizeof(p));
+    return {p[0], p[1], p[2]};
+}
+
+// A symmetric 4x4 matrix which measures the sum of squared distances from a point to a set of
+// planes, weighted by the area of the triangle that each plane came from.
+struct Quadric {
+    double a00 = 0.0, a01 = 0.0, a02 = 0.0, a11 = 0.0, a12 = 0.0, a22 = 0.0;
+    double b0 = 0.0, b1 = 0.0, b2 = 0.0, c = 0.0;
+    double weight = 0.0;
+
+    static Quadric fromPlane(const Vec3& normal, float d, float weight) {
+        double a = normal.x, b = normal.y, c = normal.z;
+        Quadric q;
+        q.a00 = a * a * weight;
+        q.a01 = a * b * weight;
+        q.a02 = a * c * weight;
+        q.a11 = b * b * weight;
+        q.a12 = b * c * weight;
+        q.a22 = c * c * weight;
+        q.b0 = a * d * weight;
+        q.b1 = b * d * weight;
+        q.b2 = c * d * weight;
+        q.c = static_cast<double>(d) * d * weight;
+        q.weight = weight;
+        return q;
+    }
+
+    Quadric& operator+=(const Quadric& other) {
+        a00 += other.a00;
+        a01 += other.a01;
+        a02 += other.a02;
+        a11 += other.a11;
+        a12 += other.a12;
+        a22 += other.a22;
+        b0 += other.b0;
+        b1 += other.b1;
+        b2 += other.b2;
+        c += other.c;
+        weight += other.weight;
+        return *this;
+    }
+
+    // Returns the weighted mean squared distance from 'p' to the planes.
+    double error(const Vec3& p) const {
+        double x = p.x, y = p.y, z = p.z;
+        double e = a00 * x * x + a11 * y * y + a22 * z * z;
+        e += 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z);
+        e += 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+        return weight > 0.0 ? std::max(e, 0.0) / weight : 0.0;
+    }
+};
+
+struct Collapse {
+    u32 from;
+    u32 to;
+    double error;
+};
+}  // namespace
+
+usize remapDuplicateVertices(std::vector<u32>& remap, const void* vertices, usize vertex_count,
+                             usize vertex_size) {
+    const auto* data = static_cast<const byte*>(vertices);
+    remap.assign(vertex_count, ~0u);
+
+    // Open addressing hash table of vertex indices, which is at most half full.
+    usize table_size = 1;
+    while (table_size < vertex_count * 2) {
+        table_size *= 2;
+    }
+    std::vector<u32> table(table_size, ~0u);
+
+    usize unique_count = 0;
+    for (usize i = 0; i < vertex_count; ++i) {
+        const byte* vertex = data + i * vertex_size;
+        ContentHash hash;
+        hash.add(vertex, vertex_size);
+        usize slot = static_cast<usize>(hash.hash()) & (table_size - 1);
+        while (true) {
+            u32 existing = table[slot];
+            if (existing == ~0u) {
+                table[slot] = static_cast<u32>(i);
+                remap[i] = static_cast<u32>(unique_count++);
+                break;
+            }
+            if (std::memcmp(data + existing * vertex_size, vertex, vertex_size) == 0) {
+                remap[i] = remap[existing];
+                break;
+            }
+            slot = (slot + 1) & (table_size - 1);
+        }
+    }
+    return unique_count;
+}
+
+usize remapVerticesForFetch(std::vector<u32>& remap, const std::vector<u32>& indices,
+                            usize vertex_count) {
+    remap.assign(vertex_count, ~0u);
+    u32 next_index = 0;
+    for (u32 index : indices) {
+        if (remap[index] == ~0u) {
+            remap[index] = next_index++;
+        }
+    }
+    return next_index;
+}
+
+void applyIndexRemap(std::vector<u32>& indices, const std::vector<u32>& remap) {
+    for (u32& index : indices) {
+        index = remap[index];
+    }
+}
+
+void optimizeVertexCache(std::vector<u32>& indices, usize vertex_count) {
+    assert(indices.size() % 3 == 0);
+    const usize triangle_count = indices.size() / 3;
+    if (triangle_count == 0) {
+        return;
+    }
+
+    // Build a list of the triangles which use each vertex. The first 'remaining[v]' entries of a
+    // vertex's list are the triangles which haven't been emitted yet.
+    std::vector<u32> adjacency_offsets(vertex_count + 1, 0);
+    for (u32 index : indices) {
+        adjacency_offsets[index + 1]++;
+    }
+    for (usize v = 0; v < vertex_count; ++v) {
+        adjacency_offsets[v + 1] += adjacency_offsets[v];
+    }
+    std::vector<u32> adjacency(indices.size());
+    std::vector<u32> remaining(vertex_count, 0);
+    for (usize i = 0; i < indices.size(); ++i) {
+        u32 v = indices[i];
+        adjacency[adjacency_offsets[v] + remaining[v]++] = static_cast<u32>(i / 3);
+    }
+
+    std::vector<float> vertex_scores(vertex_count);
+    for (usize v = 0; v < vertex_count; ++v) {
+        vertex_scores[v] = vertexScore(-1, remaining[v]);
+    }
+    auto triangleScore = [&](u32 t) {
+        return vertex_scores[indices[t * 3]] + vertex_scores[indices[t * 3 + 1]] +
+               vertex_scores[indices[t * 3 + 2]];
+    };
+    std::vector<float> triangle_scores(triangle_count);
+    std::vector<bool> emitted(triangle_count, false);
+    u32 best_triangle = 0;
+    for (u32 t = 0; t < triangle_count; ++t) {
+        triangle_scores[t] = triangleScore(t);
+        if (triangle_scores[t] > triangle_scores[best_triangle]) {
+            best_triangle = t;
+        }
+    }
+
+    std::vector<u32> result;
+    result.reserve(indices.size());
+    std::vector<u32> cache;
+    std::vector<u32> new_cache;
+    cache.reserve(kVertexCacheSize + 3);
+    new_cache.reserve(kVertexCacheSize + 3);
+    u32 next_unemitted = 0;
+    while (result.size() < indices.size()) {
+        if (best_triangle == ~0u) {
+            // None of the vertices in the cache have triangles left, so start again from the next
+            // triangle which hasn't been emitted.
+            while (emitted[next_unemitted]) {
+                ++next_unemitted;
+            }
+            best_triangle = next_unemitted;
+        }
+
+        // Emit the triangle and remove it from the lists of its vertices.
+        const u32* triangle = &indices[best_triangle * 3];
+        emitted[best_triangle] = true;
+        for (usize i = 0; i < 3; ++i) {
+            u32 v = triangle[i];
+            result.emplace_back(v);
+            u32* begin = &adjacency[adjacency_offsets[v]];
+            u32* end = begin + remaining[v];
+            *std::find(begin, end, best_triangle) = *(end - 1);
+            --remaining[v];
+        }
+
+        // Move the triangle's vertices to the front of the cache.
+        new_cache.assign(triangle, triangle + 3);
+        for (u32 v : cache) {
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+                new_cache.emplace_back(v);
+            }
+        }
+        for (usize i = kVertexCacheSize; i < new_cache.size(); ++i) {
+            u32 v = new_cache[i];
+            vertex_scores[v] = vertexScore(-1, remaining[v]);
+        }
+        for (usize i = kVertexCacheSize; i < new_cache.size(); ++i) {
+            u32 v = new_cache[i];
+            for (u32 j = 0; j < remaining[v]; ++j) {
+                u32 t = adjacency[adjacency_offsets[v] + j];
+                triangle_scores[t] = triangleScore(t);
+            }
+        }
+        new_cache.resize(std::min(new_cache.size(), kVertexCacheSize));
+        std::swap(cache, new_cache);
+
+        // Update the scores of the cached vertices, then pick the best triangle which uses them.
+        for (usize i = 0; i < cache.size(); ++i) {
+            vertex_scores[cache[i]] = vertexScore(static_cast<int>(i), remaining[cache[i]]);
+        }
+        best_triangle = ~0u;
+        float best_score = -1.0f;
+        for (u32 v : cache) {
+            for (u32 j = 0; j < remaining[v]; ++j) {
+                u32 t = adjacency[adjacency_offsets[v] + j];
+                triangle_scores[t] = triangleScore(t);
+                if (triangle_scores[t] > best_score) {
+                    best_score = triangle_scores[t];
+                    best_triangle = t;
+                }
+            }
+        }
+    }
+    indices = std::move(result);
+}
+
+void optimizeOverdraw(std::vector<u32>& indices, const void* positions, usize vertex_count,
+                      usize stride) {
+    assert(indices.size() % 3 == 0);
+    const usize triangle_count = indices.size() / 3;
+    if (triangle_count == 0) {
+        return;
+    }
+
+    // Split the triangles into clusters wherever the cache optimiser had to jump to a triangle
+    // which shares no vertices with the cache, as moving those clusters around doesn't affect the
+    // cache efficiency within them.
+    std::vector<u32> cluster_starts{0};
+    std::vector<u32> cache_timestamps(vertex_count, 0);
+    u32 timestamp = kClusterCacheSize + 1;
+    for (u32 t = 0; t < triangle_count; ++t) {
+        u32 misses = 0;
+        for (usize i = 0; i < 3; ++i) {
+            u32 v = indices[t * 3 + i];
+            if (timestamp - cache_timestamps[v] > kClusterCacheSize) {
+                cache_timestamps[v] = timestamp++;
+                ++misses;
+            }
+        }
+        if (t > 0 && misses == 3) {
+            cluster_starts.emplace_back(t);
+        }
+    }
+    if (cluster_starts.size() == 1) {
+        return;
+    }
+    cluster_starts.emplace_back(static_cast<u32>(triangle_count));
+
+    Vec3 mesh_centroid{0.0f, 0.0f, 0.0f};
+    for (usize v = 0; v < vertex_count; ++v) {
+        mesh_centroid += readPosition(positions, stride, static_cast<u32>(v));
+    }
+    mesh_centroid /= static_cast<float>(std::max<usize>(vertex_count, 1));
+
+    // Sort the clusters so that the ones on the outside of the mesh facing outwards go first, as
+    // they're the most likely to occlude the rest of the mesh.
+    const usize cluster_count = cluster_starts.size() - 1;
+    std::vector<float> cluster_scores(cluster_count);
+    for (usize c = 0; c < cluster_count; ++c) {
+        Vec3 centroid{0.0f, 0.0f, 0.0f};
+        Vec3 normal{0.0f, 0.0f, 0.0f};
+        float area = 0.0f;
+        for (u32 t = cluster_starts[c]; t < cluster_starts[c + 1]; ++t) {
+            Vec3 p0 = readPosition(positions, stride, indices[t * 3]);
+            Vec3 p1 = readPosition(positions, stride, indices[t * 3 + 1]);
+            Vec3 p2 = readPosition(positions, stride, indices[t * 3 + 2]);
+            // The length of the cross product is twice the triangle's area, so this weights each
+            // triangle by its area.
+            Vec3 triangle_normal = (p1 - p0).Cross(p2 - p0);
+            float triangle_area = triangle_normal.Length();
+            centroid += (p0 + p1 + p2) * (triangle_area / 3.0f);
+            normal += triangle_normal;
+            area += triangle_area;
+        }
+        if (area > 0.0f) {
+            centroid /= area;
+        }
+        float normal_length = normal.Length();
+        cluster_scores[c] =
+            normal_length > 0.0f ? (centroid - mesh_centroid).Dot(normal) / normal_length : 0.0f;
+    }
+    std::vector<u32> cluster_order(cluster_count);
+    for (usize c = 0; c < cluster_count; ++c) {
+        cluster_order[c] = static_cast<u32>(c);
+    }
+    std::stable_sort(cluster_order.begin(), cluster_order.end(),
+                     [&](u32 a, u32 b) { return cluster_scores[a] > cluster_scores[b]; });
+
+    std::vector<u32> result;
+    result.reserve(indices.size());
+    for (u32 c : cluster_order) {
+        result.insert(result.end(), indices.begin() + cluster_starts[c] * 3,
+                      indices.begin() + cluster_starts[c + 1] * 3);
+    }
+    indices = std::move(result);
+}
+
+float simplify(std::vector<u32>& destination, const std::vector<u32>& indices,
+               const void* positions, usize vertex_count, usize stride,
+               usize target_index_count) {
+    assert(indices.size() % 3 == 0);
+    destination = indices;
+    if (destination.size() <= target_index_count) {
+        return 0.0f;
+    }
+
+    std::vector<Vec3> vertex_positions(vertex_count);
+    for (usize v = 0; v < vertex_count; ++v) {
+        vertex_positions[v] = readPosition(positions, stride, static_cast<u32>(v));
+    }
+
+    // Accumulate the planes of the triangles around each vertex.
+    std::vector<Quadric> quadrics(vertex_count);
+    for (usize i = 0; i < indices.size(); i += 3) {
+        const Vec3& p0 = vertex_positions[indices[i]];
+        Vec3 normal = (vertex_positions[indices[i + 1]] - p0)
+                          .Cross(vertex_positions[indices[i + 2]] - p0);
+        float area = normal.Length();
+        if (area <= 0.0f) {
+            continue;
+        }
+        normal /= area;
+        Quadric q = Quadric::fromPlane(normal, -normal.Dot(p0), area);
+        for (usize j = 0; j < 3; ++j) {
+            quadrics[indices[i + j]] += q;
+        }
+    }
+
+    // Lock vertices on the border of the mesh, which have an edge that's only used by one
+    // triangle, and vertices which share their position with another vertex, which are on a seam
+    // between different normals or texture coordinates. Moving either would open holes.
+    std::vector<bool> locked(vertex_count, false);
+    {
+        std::unordered_map<u64, u32> edge_counts;
+        for (usize i = 0; i < indices.size(); i += 3) {
+            for (usize j = 0; j < 3; ++j) {
+                u32 a = indices[i + j];
+                u32 b = indices[i + (j + 1) % 3];
+                u64 key = (static_cast<u64>(std::min(a, b)) << 32) | std::max(a, b);
+                edge_counts[key]++;
+            }
+        }
+        for (const auto& edge : edge_counts) {
+            if (edge.second == 1) {
+                locked[edge.first >> 32] = true;
+                locked[edge.first & 0xFFFFFFFF] = true;
+            }
+        }
+        std::vector<u32> remap;
+        remapDuplicateVertices(remap, vertex_positions.data(), vertex_count, sizeof(Vec3));
+        std::vector<u32> position_counts(vertex_count, 0);
+        for (usize v = 0; v < vertex_count; ++v) {
+            position_counts[remap[v]]++;
+        }
+        for (usize v = 0; v < vertex_count; ++v) {
+            if (position_counts[remap[v]] > 1) {
+                locked[v] = true;
+            }
+        }
+    }
+
+    // Returns true if moving 'from' to 'to' would flip or squash any triangle which isn't removed.
+    std::vector<u32> adjacency_offsets;
+    std::vector<u32> adjacency;
+    auto collapseFlipsTriangle = [&](u32 from, u32 to) {
+        for (u32 j = adjacency_offsets[from]; j < adjacency_offsets[from + 1]; ++j) {
+            const u32* triangle = &destination[adjacency[j] * 3];
+            if (triangle[0] == to || triangle[1] == to || triangle[2] == to) {
+                continue;
+            }
+            Vec3 before[3];
+            Vec3 after[3];
+            for (usize k = 0; k < 3; ++k) {
+                before[k] = vertex_positions[triangle[k]];
+                after[k] = triangle[k] == from ? vertex_positions[to] : before[k];
+            }
+            Vec3 normal_before = (before[1] - before[0]).Cross(before[2] - before[0]);
+            Vec3 normal_after = (after[1] - after[0]).Cross(after[2] - after[0]);
+            if (normal_before.Dot(normal_after) <=
+                0.25f * normal_before.Length() * normal_after.Length()) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // Each pass collapses the cheapest edges whose neighbourhoods don't overlap, then rebuilds the
+    // index buffer, until the target is reached or no edges can be collapsed.
+    double max_error = 0.0;
+    std::vector<Collapse> collapses;
+    std::vector<u32> collapse_targets(vertex_count);
+    std::vector<bool> touched(vertex_count);
+    while (destination.size() > target_index_count) {
+        adjacency_offsets.assign(vertex_count + 1, 0);
+        for (u32 index : destination) {
+            adjacency_offsets[index + 1]++;
+        }
+        for (usize v = 0; v < vertex_count; ++v) {
+            adjacency_offsets[v + 1] += adjacency_offsets[v];
+        }
+        adjacency.resize(destination.size());
+        std::vector<u32> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+        for (usize i = 0; i < destination.size(); ++i) {
+            adjacency[fill[destination[i]]++] = static_cast<u32>(i / 3);
+        }
+
+        collapses.clear();
+        for (usize i = 0; i < destination.size(); i += 3) {
+            for (usize j = 0; j < 3; ++j) {
+                u32 a = destination[i + j];
+                u32 b = destination[i + (j + 1) % 3];
+                Quadric q = quadrics[a];
+                q += quadrics[b];
+                if (!locked[a]) {
+                    collapses.push_back({a, b, q.error(vertex_positions[b])});
+                }
+                if (!locked[b]) {
+                    collapses.push_back({b, a, q.error(vertex_positions[a])});
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+        for (usize v = 0; v < vertex_count; ++v) {
+            collapse_targets[v] = static_cast<u32>(v);
+        }
+        touched.assign(vertex_count, false);
+        usize triangles_to_remove = (destination.size() - target_index_count + 2) / 3;
+        usize triangles_removed = 0;
+        usize collapse_count = 0;
+        for (const Collapse& collapse : collapses) {
+            if (triangles_removed >= triangles_to_remove) {
+                break;
+            }
+            u32 from = collapse.from;
+            u32 to = collapse.to;
+            if (touched[from] || touched[to] || collapseFlipsTriangle(from, to)) {
+                continue;
+            }
+            collapse_targets[from] = to;
+            quadrics[to] += quadrics[from];
+            max_error = std::max(max_error, collapse.error);
+            ++collapse_count;
+
+            // Don't collapse anything else in the neighbourhood of this collapse in this pass, as
+            // the flip tests above assume that the neighbouring vertices don't move.
+            for (u32 j = adjacency_offsets[from]; j < adjacency_offsets[from + 1]; ++j) {
+                const u32* triangle = &destination[adjacency[j] * 3];
+                if (triangle[0] == to || triangle[1] == to || triangle[2] == to) {
+                    ++triangles_removed;
+                }
+                touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = true;
+            }
+        }
+        if (collapse_count == 0) {
+            break;
+        }
+
+        // Apply the collapses, and remove triangles which have become degenerate.
+        usize write = 0;
+        for (usize i = 0; i < destination.size(); i += 3) {
+            u32 a = collapse_targets[destination[i]];
+            u32 b = collapse_targets[destination[i + 1]];
+            u32 c = collapse_targets[destination[i + 2]];
+            if (a != b && b != c && a != c) {
+                destination[write++] = a;
+                destination[write++] = b;
+                destination[write++] = c;
+            }
+        }
+        destination.resize(write);
+    }
+    return static_cast<float>(std::sqrt(max_error));
+}
+}  // namespace gfx
+}  // namespace dw
@@ -0,0 +1,62 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Base.h"
+
+#include <utility>
+#include <vector>
+
+namespace dw {
+namespace gfx {
+// Builds a table which maps each vertex to the index of the first vertex with identical contents,
+// renumbered so that the unique vertices are contiguous. Returns the number of unique vertices.
+usize remapDuplicateVertices(std::vector<u32>& remap, const void* vertices, usize vertex_count,
+                             usize vertex_size);
+
+// Builds a table which maps each vertex to its position in the order that it's first referenced by
+// the index buffer, so that vertex fetches are as sequential as possible. Vertices which aren't
+// referenced are mapped to ~0u. Returns the number of referenced vertices.
+usize remapVerticesForFetch(std::vector<u32>& remap, const std::vector<u32>& indices,
+                            usize vertex_count);
+
+// Applies a remap table built by one of the functions above to an array of vertices, dropping
+// vertices which are mapped to ~0u and duplicates.
+template <typename T>
+void applyVertexRemap(std::vector<T>& vertices, const std::vector<u32>& remap, usize new_count) {
+    std::vector<T> result(new_count);
+    for (usize i = 0; i < vertices.size(); ++i) {
+        if (remap[i] != ~0u) {
+            result[remap[i]] = vertices[i];
+        }
+    }
+    vertices = std::move(result);
+}
+
+// Applies a remap table to an index buffer.
+void applyIndexRemap(std::vector<u32>& indices, const std::vector<u32>& remap);
+
+// Reorders the triangles in an index buffer to reduce post-transform vertex cache misses, using
+// Tom Forsyth's linear-speed vertex cache optimisation.
+void optimizeVertexCache(std::vector<u32>& indices, usize vertex_count);
+
+// Reorders clusters of triangles which have already been optimised for the vertex cache, so that
+// clusters facing outwards from the centre of the mesh are drawn first. This reduces overdraw from
+// most view directions without affecting the cache efficiency within each cluster. 'positions'
+// points to the first vertex position, each of which is three floats and 'stride' bytes apart.
+void optimizeOverdraw(std::vector<u32>& indices, const void* positions, usize vertex_count,
+                      usize stride);
+
+// Simplifies a mesh by collapsing edges in order of their quadric error, until the index buffer
+// has at most 'target_index_count' indices or no more edges can be collapsed, and writes the new
+// index buffer to 'destination'. Vertices are only moved onto other existing vertices, so the
+// result can share the original vertex buffer. Vertices on borders or attribute seams are never
+// moved, so the mesh's outline doesn't change. Returns the error of the simplified mesh, which is
+// roughly the largest distance between it and the original surface.
+float simplify(std::vector<u32>& destination, const std::vector<u32>& indices,
+               const void* positions, usize vertex_count, usize stride,
+               usize target_index_count);
+}  // namespace gfx
+}  // namespace dw
@@ -7,6 +7,9 @@
 #include "Renderer.h"
 #include "Input.h"
 #include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace dw {
 namespace gfx {
@@ -18,9 +21,107 @@ public:
 
     virtual RendererType type() const = 0;
 
+    // Directory used to persist caches between runs, or empty if caches should not be persisted.
+    // Set before the window is created.
+    void setCacheDirectory(std::string cache_directory) {
+        cache_directory_ = std::move(cache_directory);
+    }
+
+    // If set, the window is created hidden. Set before the window is created.
+    void setWindowHidden(bool hidden) {
+        window_hidden_ = hidden;
+    }
+
+    // Presentation settings. Can be set from any thread, and are picked up by the backend with
+    // takePresentModeChange().
+    void setPresentMode(PresentMode mode, uint swap_interval) {
+        std::lock_guard<std::mutex> lock{present_mode_mutex_};
+        present_mode_ = mode;
+        swap_interval_ = swap_interval;
+        present_mode_changed_ = true;
+    }
+
+    // Number of frames the GPU can be working on at once. Set before the window is created.
+    void setMaxFramesInFlight(uint count) {
+        max_frames_in_flight_ = count;
+    }
+
+    // Returns true once a program has been created and can be drawn with. Thread safe.
+    virtual bool isProgramReady(ProgramHandle program) const {
+        std::lock_guard<std::mutex> lock{ready_programs_mutex_};
+        return ready_programs_.count(program) > 0;
+    }
+
+    // Returns the statistics of the most recently rendered frame. Thread safe.
+    FrameStats frameStats() const {
+        std::lock_guard<std::mutex> lock{frame_stats_mutex_};
+        return frame_stats_;
+    }
+
+    // Resets the statistics of the frame being rendered. Called on the render thread before a
+    // frame's commands are processed.
+    void beginFrameStats() {
+        stats_ = FrameStats{};
+    }
+
+    // Adds the frontend's counters to the statistics of the frame being rendered, then publishes
+    // them. Called on the render thread after a frame has been processed.
+    void endFrameStats(const Frame* frame) {
+        auto add_transient_usage = [](const Frame::TransientBufferStorage& storage, u32& used,
+                                      u32& capacity) {
+            for (const auto& page : storage.pages) {
+                used += page.size;
+                capacity += page.capacity;
+            }
+        };
+        stats_.render_queues = static_cast<u32>(frame->render_queues.size());
+        for (const auto& queue : frame->render_queues) {
+            stats_.render_items += static_cast<u32>(queue.render_items.size());
+            stats_.compute_items += static_cast<u32>(queue.compute_items.size());
+        }
+        stats_.pre_frame_commands = static_cast<u32>(frame->commands_pre.size());
+        stats_.post_frame_commands = static_cast<u32>(frame->commands_post.size());
+        add_transient_usage(frame->transient_vb_storage, stats_.transient_vb_used,
+                            stats_.transient_vb_capacity);
+        add_transient_usage(frame->transient_ib_storage, stats_.transient_ib_used,
+                            stats_.transient_ib_capacity);
+        add_transient_usage(frame->transient_ib32_storage, stats_.transient_ib_used,
+                            stats_.transient_ib_capacity);
+
+        std::lock_guard<std::mutex> lock{frame_stats_mutex_};
+        frame_stats_ = stats_;
+    }
+
+    // Returns the GPU timings of the most recently measured frame. Thread safe.
+    GpuTimings gpuTimings() const {
+        std::lock_guard<std::mutex> lock{gpu_timings_mutex_};
+        return gpu_timings_;
+    }
+
+    // Returns the latest result of an occlusion query which has been read back. Thread safe.
+    std::optional<u64> occlusionQueryResult(OcclusionQueryHandle query) const {
+        std::lock_guard<std::mutex> lock{occlusion_query_results_mutex_};
+        auto it = occlusion_query_results_.find(query);
+        if (it == occlusion_query_results_.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    // Returns the GPU memory used by resources, and the memory budget. Thread safe.
+    GpuMemoryStats gpuMemoryStats() const {
+        std::lock_guard<std::mutex> lock{memory_stats_mutex_};
+        return memory_stats_;
+    }
+
     // Capabilities / customisations.
     virtual Mat4 adjustProjectionMatrix(Mat4 projection_matrix) const = 0;
     virtual bool hasFlippedViewport() const = 0;
+    // Only valid once the window has been created.
+    virtual bool isTextureFormatSupported(TextureFormat format) const = 0;
+    virtual bool isComputeSupported() const = 0;
+    virtual bool isBindlessTexturingSupported() const = 0;
+    virtual bool isConditionalRenderingSupported() const = 0;
 
     // Window management. Executed on the main thread.
     virtual Result<void, std::string> createWindow(u16 width, u16 height,
@@ -42,6 +143,132 @@ public:
 
 protected:
     Logger& logger_;
+    std::string cache_directory_;
+    bool window_hidden_ = false;
+    uint max_frames_in_flight_ = 2;
+
+    // Statistics of the frame being rendered, which backends add to on the render thread. Worker
+    // threads must only update the cache counters while holding the lock of that cache.
+    FrameStats stats_;
+
+    // Called by backends on the render thread when a program finishes being created, or is
+    // deleted.
+    void setProgramReady(ProgramHandle program, bool ready) {
+        std::lock_guard<std::mutex> lock{ready_programs_mutex_};
+        if (ready) {
+            ready_programs_.insert(program);
+        } else {
+            ready_programs_.erase(program);
+        }
+    }
+
+    // Called by backends on the render thread to get the presentation settings, if they've changed
+    // since the last call.
+    bool takePresentModeChange(PresentMode& mode, uint& swap_interval) {
+        std::lock_guard<std::mutex> lock{present_mode_mutex_};
+        if (!present_mode_changed_) {
+            return false;
+        }
+        mode = present_mode_;
+        swap_interval = swap_interval_;
+        present_mode_changed_ = false;
+        return true;
+    }
+
+    // Called by backends on the render thread when the timestamps of a frame have been read back.
+    void setGpuTimings(GpuTimings timings) {
+        std::lock_guard<std::mutex> lock{gpu_timings_mutex_};
+        gpu_timings_ = std::move(timings);
+    }
+
+    // Called by backends on the render thread when the result of an occlusion query has been read
+    // back, or with std::nullopt when the query is deleted.
+    void setOcclusionQueryResult(OcclusionQueryHandle query, std::optional<u64> samples) {
+        std::lock_guard<std::mutex> lock{occlusion_query_results_mutex_};
+        if (samples) {
+            occlusion_query_results_[query] = *samples;
+        } else {
+            occlusion_query_results_.erase(query);
+        }
+    }
+
+    // Categories of GPU memory, matching the fields of GpuMemoryStats. Render target textures and
+    // frame buffers (which own their depth buffer) are both counted as render targets.
+    enum class MemoryCategory {
+        VertexBuffers,
+        IndexBuffers,
+        UniformBuffers,
+        StorageBuffers,
+        Textures,
+        RenderTargets,
+        FrameBuffers
+    };
+
+    // Called by backends on the render thread when a resource is created or resized, or with 0
+    // bytes when it's destroyed. Resources are identified by their handle within a category.
+    template <typename Handle>
+    void setResourceMemory(MemoryCategory category, Handle resource, u64 bytes) {
+        u64 key = static_cast<u64>(category) << 32 | static_cast<u32>(resource);
+        std::lock_guard<std::mutex> lock{memory_stats_mutex_};
+        u64& total = memoryCategoryTotal(category);
+        auto it = resource_memory_.find(key);
+        if (it != resource_memory_.end()) {
+            total -= it->second;
+            if (bytes == 0) {
+                resource_memory_.erase(it);
+            } else {
+                it->second = bytes;
+            }
+        } else if (bytes > 0) {
+            resource_memory_.emplace(key, bytes);
+        }
+        total += bytes;
+    }
+
+    // Called by backends on the render thread when the memory budget has been queried.
+    void setMemoryBudget(u64 budget, u64 usage) {
+        std::lock_guard<std::mutex> lock{memory_stats_mutex_};
+        memory_stats_.budget_valid = true;
+        memory_stats_.budget = budget;
+        memory_stats_.usage = usage;
+    }
+
+private:
+    u64& memoryCategoryTotal(MemoryCategory category) {
+        switch (category) {
+            case MemoryCategory::VertexBuffers:
+                return memory_stats_.vertex_buffers;
+            case MemoryCategory::IndexBuffers:
+                return memory_stats_.index_buffers;
+            case MemoryCategory::UniformBuffers:
+                return memory_stats_.uniform_buffers;
+            case MemoryCategory::StorageBuffers:
+                return memory_stats_.storage_buffers;
+            case MemoryCategory::Textures:
+                return memory_stats_.textures;
+            case MemoryCategory::RenderTargets:
+            case MemoryCategory::FrameBuffers:
+                break;
+        }
+        return memory_stats_.render_targets;
+    }
+
+    std::unordered_set<ProgramHandle> ready_programs_;
+    mutable std::mutex ready_programs_mutex_;
+    GpuTimings gpu_timings_;
+    mutable std::mutex gpu_timings_mutex_;
+    std::unordered_map<OcclusionQueryHandle, u64> occlusion_query_results_;
+    mutable std::mutex occlusion_query_results_mutex_;
+    FrameStats frame_stats_;
+    mutable std::mutex frame_stats_mutex_;
+    // Size of each tracked resource, keyed by category and handle.
+    std::unordered_map<u64, u64> resource_memory_;
+    GpuMemoryStats memory_stats_;
+    mutable std::mutex memory_stats_mutex_;
+    PresentMode present_mode_ = PresentMode::Mailbox;
+    uint swap_interval_ = 1;
+    bool present_mode_changed_ = false;
+    std::mutex present_mode_mutex_;
 };
 }  // namespace gfx
 }  // namespace dw
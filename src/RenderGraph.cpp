@@ -0,0 +1,314 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "RenderGraph.h"
+#include "Texture.h"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+
+namespace dw {
+namespace gfx {
+namespace {
+// Pooled textures and cached frame buffers which haven't been used for this many frames are
+// deleted. This keeps resources alive across a few frames where a pass is culled or resized.
+constexpr uint kMaxUnusedFrames = 4;
+}  // namespace
+
+usize RenderGraph::TextureDescHash::operator()(const TextureDesc& desc) const {
+    u64 key = static_cast<u64>(desc.width) | static_cast<u64>(desc.height) << 16 |
+              static_cast<u64>(desc.format) << 32;
+    return std::hash<u64>{}(key);
+}
+
+RenderGraph::PassBuilder::PassBuilder(RenderGraph& graph, usize pass_index)
+    : graph_(graph), pass_index_(pass_index) {
+}
+
+RenderGraphTextureHandle RenderGraph::PassBuilder::create(u16 width, u16 height,
+                                                          TextureFormat format) {
+    RenderGraphTextureHandle handle{static_cast<u32>(graph_.textures_.size())};
+    graph_.textures_.push_back({{width, height, format}, std::nullopt, {}, 0, 0});
+    return handle;
+}
+
+void RenderGraph::PassBuilder::read(RenderGraphTextureHandle texture) {
+    assert(static_cast<u32>(texture) < graph_.textures_.size());
+    graph_.passes_[pass_index_].reads.push_back(texture);
+}
+
+void RenderGraph::PassBuilder::write(RenderGraphTextureHandle texture) {
+    assert(static_cast<u32>(texture) < graph_.textures_.size());
+    graph_.passes_[pass_index_].writes.push_back(texture);
+}
+
+void RenderGraph::PassBuilder::writeBackbuffer() {
+    graph_.passes_[pass_index_].writes_backbuffer = true;
+}
+
+void RenderGraph::PassBuilder::setClear(const Colour& colour, bool clear_colour,
+                                        bool clear_depth) {
+    graph_.passes_[pass_index_].clear = RenderQueue::ClearParameters{colour, clear_colour,
+                                                                     clear_depth};
+}
+
+RenderGraph::PassResources::PassResources(const RenderGraph& graph) : graph_(graph) {
+}
+
+TextureHandle RenderGraph::PassResources::texture(RenderGraphTextureHandle texture) const {
+    const auto& virtual_texture = graph_.virtualTexture(texture);
+    return virtual_texture.imported ? *virtual_texture.imported : virtual_texture.allocated;
+}
+
+RenderGraph::RenderGraph(Renderer& r) : r_(r) {
+}
+
+RenderGraph::~RenderGraph() {
+    for (auto& frame_buffer : frame_buffer_cache_) {
+        r_.deleteFrameBuffer(frame_buffer.handle);
+    }
+    for (auto& pool : texture_pool_) {
+        for (auto& texture : pool.second) {
+            r_.deleteTexture(texture.handle);
+        }
+    }
+}
+
+RenderGraphTextureHandle RenderGraph::importTexture(TextureHandle texture) {
+    RenderGraphTextureHandle handle{static_cast<u32>(textures_.size())};
+    textures_.push_back({{0, 0, TextureFormat::RGBA8}, texture, {}, 0, 0});
+    return handle;
+}
+
+void RenderGraph::addPass(const std::string& name, SetupFunction setup, ExecuteFunction execute) {
+    passes_.emplace_back();
+    passes_.back().name = name;
+    passes_.back().execute = std::move(execute);
+    PassBuilder builder{*this, passes_.size() - 1};
+    setup(builder);
+}
+
+void RenderGraph::execute() {
+    cullPasses();
+    allocateTextures();
+
+    // Execute the remaining passes, each into its own render queue.
+    PassResources resources{*this};
+    std::vector<TextureHandle> attachments;
+    for (usize i = 0; i < passes_.size(); ++i) {
+        auto& pass = passes_[i];
+        if (pass.culled) {
+            continue;
+        }
+        // A pass renders to either the backbuffer or the textures it writes.
+        assert(!pass.writes_backbuffer || pass.writes.empty());
+        if (pass.writes_backbuffer || pass.writes.empty()) {
+            r_.startRenderQueue();
+        } else {
+            attachments.clear();
+            for (auto texture : pass.writes) {
+                attachments.push_back(resources.texture(texture));
+            }
+            r_.startRenderQueue(frameBuffer(attachments));
+        }
+        if (pass.clear) {
+            r_.setRenderQueueClear(pass.clear->colour, pass.clear->clear_colour,
+                                   pass.clear->clear_depth);
+        }
+        r_.setRenderQueueAttachmentOps(attachmentOps(i));
+        r_.setRenderQueueLabel(pass.name);
+        pass.execute(r_, resources);
+    }
+
+    trimPool();
+    passes_.clear();
+    textures_.clear();
+}
+
+RenderGraph::Stats RenderGraph::stats() const {
+    return stats_;
+}
+
+const RenderGraph::VirtualTexture& RenderGraph::virtualTexture(
+    RenderGraphTextureHandle texture) const {
+    assert(static_cast<u32>(texture) < textures_.size());
+    return textures_[static_cast<u32>(texture)];
+}
+
+void RenderGraph::cullPasses() {
+    // Walk backwards from the passes which have side effects outside of the graph, keeping each
+    // pass which writes a texture that a kept pass reads.
+    std::vector<bool> needed(textures_.size(), false);
+    stats_.passes = static_cast<uint>(passes_.size());
+    stats_.culled_passes = 0;
+    for (usize i = passes_.size(); i-- > 0;) {
+        auto& pass = passes_[i];
+        bool live = pass.writes_backbuffer;
+        for (auto texture : pass.writes) {
+            live |= needed[static_cast<u32>(texture)] || virtualTexture(texture).imported;
+        }
+        pass.culled = !live;
+        if (pass.culled) {
+            stats_.culled_passes++;
+            continue;
+        }
+        for (auto texture : pass.reads) {
+            needed[static_cast<u32>(texture)] = true;
+        }
+    }
+}
+
+void RenderGraph::allocateTextures() {
+    // Find the range of passes which use each transient texture.
+    constexpr usize kUnused = ~usize(0);
+    for (auto& texture : textures_) {
+        texture.first_pass = kUnused;
+        texture.last_pass = 0;
+    }
+    for (usize i = 0; i < passes_.size(); ++i) {
+        if (passes_[i].culled) {
+            continue;
+        }
+        auto use = [&](RenderGraphTextureHandle handle) {
+            auto& texture = textures_[static_cast<u32>(handle)];
+            texture.first_pass = std::min(texture.first_pass, i);
+            texture.last_pass = std::max(texture.last_pass, i);
+        };
+        std::for_each(passes_[i].reads.begin(), passes_[i].reads.end(), use);
+        std::for_each(passes_[i].writes.begin(), passes_[i].writes.end(), use);
+    }
+
+    // Assign textures from the pool in pass order, returning each texture to the pool after its
+    // last pass so that a later transient texture with the same description can reuse it.
+    for (auto& pool : texture_pool_) {
+        for (auto& texture : pool.second) {
+            texture.in_use = false;
+        }
+    }
+    stats_.transient_textures = 0;
+    for (usize i = 0; i < passes_.size(); ++i) {
+        for (auto& texture : textures_) {
+            if (!texture.imported && texture.first_pass == i) {
+                texture.allocated = acquireTexture(texture.desc);
+                stats_.transient_textures++;
+            }
+        }
+        for (auto& texture : textures_) {
+            if (!texture.imported && texture.first_pass != kUnused && texture.last_pass == i) {
+                for (auto& pooled : texture_pool_.at(texture.desc)) {
+                    if (pooled.handle == texture.allocated) {
+                        pooled.in_use = false;
+                    }
+                }
+            }
+        }
+    }
+}
+
+RenderQueue::AttachmentOps RenderGraph::attachmentOps(usize pass_index) const {
+    const auto& pass = passes_[pass_index];
+    RenderQueue::AttachmentOps ops;
+    if (pass.clear && pass.clear->clear_colour) {
+        ops.colour_load = RenderQueue::LoadOp::Clear;
+    }
+    if (pass.clear && pass.clear->clear_depth) {
+        ops.depth_load = RenderQueue::LoadOp::Clear;
+    }
+
+    // The previous contents of transient textures are undefined before they're first written, so
+    // they don't need to be loaded.
+    bool first_writes = !pass.writes.empty();
+    for (auto texture : pass.writes) {
+        const auto& virtual_texture = virtualTexture(texture);
+        first_writes &= !virtual_texture.imported && virtual_texture.first_pass == pass_index;
+    }
+    if (first_writes && ops.colour_load == RenderQueue::LoadOp::Load) {
+        ops.colour_load = RenderQueue::LoadOp::DontCare;
+    }
+
+    // The depth buffer belongs to the frame buffer of the pass, so it's only needed afterwards if
+    // a later pass renders to the same frame buffer.
+    ops.depth_store = RenderQueue::StoreOp::DontCare;
+    for (usize i = pass_index + 1; i < passes_.size(); ++i) {
+        const auto& later = passes_[i];
+        if (!later.culled && later.writes_backbuffer == pass.writes_backbuffer &&
+            later.writes == pass.writes) {
+            ops.depth_store = RenderQueue::StoreOp::Store;
+            break;
+        }
+    }
+    return ops;
+}
+
+TextureHandle RenderGraph::acquireTexture(const TextureDesc& desc) {
+    auto& pool = texture_pool_[desc];
+    for (auto& texture : pool) {
+        if (!texture.in_use) {
+            texture.in_use = true;
+            texture.unused_frames = 0;
+            return texture.handle;
+        }
+    }
+    PooledTexture texture;
+    texture.handle =
+        r_.createTexture2D(desc.width, desc.height, desc.format, Memory(), false, true);
+    texture.in_use = true;
+    pool.push_back(texture);
+    return texture.handle;
+}
+
+FrameBufferHandle RenderGraph::frameBuffer(const std::vector<TextureHandle>& textures) {
+    for (auto& frame_buffer : frame_buffer_cache_) {
+        if (frame_buffer.textures == textures) {
+            frame_buffer.unused_frames = 0;
+            return frame_buffer.handle;
+        }
+    }
+    CachedFrameBuffer frame_buffer;
+    frame_buffer.textures = textures;
+    frame_buffer.handle = r_.createFrameBuffer(textures);
+    frame_buffer_cache_.push_back(frame_buffer);
+    return frame_buffer.handle;
+}
+
+void RenderGraph::trimPool() {
+    // Frame buffers are deleted first, as they may refer to pooled textures which are about to be
+    // deleted. A frame buffer is unused whenever any of its pooled textures are unused.
+    for (auto& frame_buffer : frame_buffer_cache_) {
+        if (frame_buffer.unused_frames++ >= kMaxUnusedFrames) {
+            r_.deleteFrameBuffer(frame_buffer.handle);
+        }
+    }
+    frame_buffer_cache_.erase(std::remove_if(frame_buffer_cache_.begin(),
+                                             frame_buffer_cache_.end(),
+                                             [](const CachedFrameBuffer& frame_buffer) {
+                                                 return frame_buffer.unused_frames >
+                                                        kMaxUnusedFrames;
+                                             }),
+                              frame_buffer_cache_.end());
+
+    stats_.allocated_textures = 0;
+    stats_.allocated_bytes = 0;
+    for (auto pool = texture_pool_.begin(); pool != texture_pool_.end();) {
+        auto& textures = pool->second;
+        for (auto& texture : textures) {
+            if (texture.unused_frames++ >= kMaxUnusedFrames) {
+                r_.deleteTexture(texture.handle);
+            } else if (texture.unused_frames == 1) {
+                stats_.allocated_textures++;
+                stats_.allocated_bytes +=
+                    textureLevelSize(pool->first.format, pool->first.width, pool->first.height);
+            }
+        }
+        textures.erase(std::remove_if(textures.begin(), textures.end(),
+                                      [](const PooledTexture& texture) {
+                                          return texture.unused_frames > kMaxUnusedFrames;
+                                      }),
+                       textures.end());
+        pool = textures.empty() ? texture_pool_.erase(pool) : std::next(pool);
+    }
+}
+}  // namespace gfx
+}  // namespace dw
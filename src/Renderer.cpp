@@ -4,24 +4,233 @@
  */
 #include "Base.h"
 #include "Renderer.h"
+#include "Texture.h"
+#include "FrameCapture.h"
+#include "Trace.h"
 
 #include "gl/RenderContextGL.h"
 #include "null/RenderContextNull.h"
 #include "vulkan/RenderContextVK.h"
 
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+
 namespace dw {
 namespace gfx {
+namespace {
+// Returns false if a handle generator has run out of handles, which are then invalid.
+template <typename Handle> bool checkHandle(Logger& logger, Handle handle, const char* type) {
+    if (handle == Handle{}) {
+        logger.error("Unable to create {}, as the maximum number of handles are in use.", type);
+        return false;
+    }
+    return true;
+}
+
+// Sort key layout (most significant first):
+// | program (16) | render state (12) | textures (12) | vertex buffer (12) | index buffer (12) |
+u64 makeStateSortKey(const RenderItem& item) {
+    u64 program = item.program ? static_cast<u32>(*item.program) & 0xFFFF : 0;
+
+    // Render state bits, followed by a hash of the blend state.
+    u64 state = 0;
+    state |= u64(item.depth_enabled) << 0;
+    state |= u64(item.depth_write) << 1;
+    state |= u64(item.cull_face_enabled) << 2;
+    state |= u64(item.cull_front_face == CullFrontFace::CW) << 3;
+    state |= u64(item.polygon_mode == PolygonMode::Wireframe) << 4;
+    state |= u64(item.colour_write) << 5;
+    state |= u64(item.blend_enabled) << 6;
+    if (item.blend_enabled) {
+        std::size_t blend_hash = 0;
+        dga::hashCombine(blend_hash, item.blend_equation_rgb, item.blend_src_rgb,
+                         item.blend_dest_rgb, item.blend_equation_a, item.blend_src_a,
+                         item.blend_dest_a);
+        state |= u64(blend_hash & 0x1F) << 7;
+    }
+
+    // Textures are keyed by a hash of all bindings, so items sharing the same set of textures end
+    // up adjacent.
+    u64 textures = 0;
+    if (!item.textures.empty()) {
+        std::size_t texture_hash = 0;
+        for (const auto& binding : item.textures) {
+            dga::hashCombine(texture_hash, binding.binding_location, binding.handle,
+                             binding.sampler_info);
+        }
+        textures = texture_hash & 0xFFF;
+    }
+
+    u64 vb = item.vb ? static_cast<u32>(*item.vb) & 0xFFF : 0;
+    u64 ib = item.ib ? static_cast<u32>(*item.ib) & 0xFFF : 0;
+    return (program << 48) | ((state & 0xFFF) << 36) | (textures << 24) | (vb << 12) | ib;
+}
+
+// Maps a float to an unsigned integer which preserves ordering.
+u32 sortableDepth(float depth) {
+    u32 bits;
+    std::memcpy(&bits, &depth, sizeof(bits));
+    return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+}
+
+void setItemUniform(RenderItem& item, UniformHandle uniform, UniformData data) {
+    // MathGeoLib stores matrices in row-major order, but render contexts expect matrices in
+    // column-major order.
+    if (Mat3* mat3_data = std::get_if<Mat3>(&data)) {
+        mat3_data->Transpose();
+    } else if (Mat4* mat4_data = std::get_if<Mat4>(&data)) {
+        mat4_data->Transpose();
+    }
+
+    // Items only set a handful of uniforms, so a linear search beats a map here.
+    for (auto& binding : item.uniforms) {
+        if (binding.handle == uniform) {
+            binding.data = std::move(data);
+            return;
+        }
+    }
+    item.uniforms.emplace_back(RenderItem::UniformBinding{uniform, std::move(data)});
+}
+
+bool setItemTexture(RenderItem& item, uint binding_location, TextureHandle handle,
+                    u32 sampler_flags, float max_anisotropy) {
+    if (item.textures.size() == DW_MAX_TEXTURE_SAMPLERS) {
+        return false;
+    }
+    item.textures.emplace_back(
+        RenderItem::TextureBinding{binding_location, handle, {sampler_flags, max_anisotropy}});
+    return true;
+}
+
+void setItemUniformBuffer(Logger& logger, RenderItem& item, uint binding_location,
+                          UniformBufferHandle handle, uint offset) {
+    if (offset % kUniformBufferOffsetAlignment != 0) {
+        logger.error("Uniform buffer {} offset {} is not a multiple of {} bytes, ignoring.", handle,
+                     offset, kUniformBufferOffsetAlignment);
+        return;
+    }
+    for (auto& binding : item.uniform_buffers) {
+        if (binding.binding_location == binding_location) {
+            binding.handle = handle;
+            binding.offset = offset;
+            return;
+        }
+    }
+    item.uniform_buffers.emplace_back(
+        RenderItem::UniformBufferBinding{binding_location, handle, offset});
+}
+
+void setItemStorageBuffer(RenderItem& item, uint binding_location,
+                          std::variant<StorageBufferHandle, IndirectBufferHandle> handle) {
+    item.storage_buffers.emplace_back(RenderItem::StorageBufferBinding{binding_location, handle});
+}
+
+void setItemStorageImage(RenderItem& item, uint binding_location, TextureHandle handle,
+                         uint mip_level) {
+    item.storage_images.emplace_back(
+        RenderItem::StorageImageBinding{binding_location, handle, mip_level});
+}
+
+void setItemState(RenderItem& item, RenderState state, bool enabled) {
+    switch (state) {
+        case RenderState::CullFace:
+            item.cull_face_enabled = enabled;
+            break;
+        case RenderState::Depth:
+            item.depth_enabled = enabled;
+            break;
+        case RenderState::Blending:
+            item.blend_enabled = enabled;
+            break;
+    }
+}
+
+void setItemScissor(RenderItem& item, u16 x, u16 y, u16 width, u16 height) {
+    item.scissor_enabled = true;
+    item.scissor_x = x;
+    item.scissor_y = y;
+    item.scissor_width = width;
+    item.scissor_height = height;
+}
+
+void sortRenderQueue(RenderQueue& queue) {
+    if (queue.sort_mode == RenderQueue::SortMode::Sequential || queue.render_items.size() < 2) {
+        return;
+    }
+
+    // Depth sorted queues use the depth as the most significant 32 bits, then preserve the
+    // program and render state from the state key.
+    if (queue.sort_mode != RenderQueue::SortMode::State) {
+        bool back_to_front = queue.sort_mode == RenderQueue::SortMode::BackToFront;
+        for (auto& item : queue.render_items) {
+            u32 depth = sortableDepth(item.sort_depth);
+            if (back_to_front) {
+                depth = ~depth;
+            }
+            item.sort_key = (u64(depth) << 32) | (makeStateSortKey(item) >> 32);
+        }
+    }
+    std::stable_sort(
+        queue.render_items.begin(), queue.render_items.end(),
+        [](const RenderItem& a, const RenderItem& b) { return a.sort_key < b.sort_key; });
+}
+}  // namespace
+
+byte* Frame::TransientBufferStorage::allocate(uint allocation_size, uint page_size,
+                                              uint& offset) {
+    // Move on to the next page with enough space.
+    while (current_page < pages.size() &&
+           pages[current_page].size + allocation_size > pages[current_page].capacity) {
+        current_page++;
+    }
+
+    // Add a new page at the end of the buffer if none are left.
+    if (current_page == pages.size()) {
+        Page page;
+        // Round up the capacity so that pages following this one remain aligned for any index
+        // type.
+        page.capacity = (std::max(page_size, allocation_size) + 15) & ~15u;
+        page.data = std::make_unique<byte[]>(page.capacity);
+        if (!pages.empty()) {
+            page.offset = pages.back().offset + pages.back().capacity;
+        }
+        pages.emplace_back(std::move(page));
+    }
+
+    Page& page = pages[current_page];
+    byte* data = page.data.get() + page.size;
+    offset = page.offset + page.size;
+    page.size += allocation_size;
+    size = std::max(size, page.offset + page.size);
+    return data;
+}
+
+void Frame::TransientBufferStorage::reset() {
+    for (auto& page : pages) {
+        page.size = 0;
+    }
+    current_page = 0;
+    size = 0;
+}
+
 Frame::Frame() {
     clear();
 }
 
 void Frame::clear() {
+    // Destroy everything allocated from the arena before resetting it.
     pending_item = RenderItem();
     render_queues.clear();
+    arena.reset();
+    pending_item = RenderItem(&arena);
+
     commands_pre.clear();
     commands_post.clear();
-    transient_vb_storage.size = 0;
-    transient_ib_storage.size = 0;
+    capture_path.reset();
+    transient_vb_storage.reset();
+    transient_ib_storage.reset();
+    transient_ib32_storage.reset();
     transient_vertex_buffers_.clear();
     transient_vertex_buffer_handle_generator_.reset();
     transient_index_buffers_.clear();
@@ -32,41 +241,206 @@ void Frame::clear() {
 #endif
 
     // Add default render queue.
-    render_queues.emplace_back();
+    render_queues.emplace_back(&arena);
+}
+
+Encoder::Encoder(Renderer& renderer) : renderer_(renderer) {
+}
+
+void Encoder::setVertexBuffer(VertexBufferHandle handle) {
+    pending_item_.vb = handle;
+    pending_item_.vb_offset = 0;
+    pending_item_.vertex_decl_override = VertexDecl{};
+}
+
+void Encoder::setInstanceBuffer(VertexBufferHandle handle, uint offset) {
+    pending_item_.instance_vb = handle;
+    pending_item_.instance_vb_offset = offset;
+    pending_item_.instance_decl_override = VertexDecl{};
+}
+
+void Encoder::setIndexBuffer(IndexBufferHandle handle) {
+    pending_item_.ib = handle;
+    pending_item_.ib_offset = 0;
+}
+
+void Encoder::setUniform(UniformHandle uniform, UniformData data) {
+    setItemUniform(pending_item_, uniform, std::move(data));
+}
+
+void Encoder::setUniformBuffer(uint binding_location, UniformBufferHandle handle, uint offset) {
+    setItemUniformBuffer(renderer_.logger_, pending_item_, binding_location, handle, offset);
+}
+
+bool Encoder::setTexture(uint binding_location, TextureHandle handle, u32 sampler_flags,
+                         float max_anisotropy) {
+    return setItemTexture(pending_item_, binding_location, handle, sampler_flags, max_anisotropy);
+}
+
+void Encoder::setStorageBuffer(uint binding_location, StorageBufferHandle handle) {
+    setItemStorageBuffer(pending_item_, binding_location, handle);
+}
+
+void Encoder::setStorageBuffer(uint binding_location, IndirectBufferHandle handle) {
+    setItemStorageBuffer(pending_item_, binding_location, handle);
+}
+
+void Encoder::setStorageImage(uint binding_location, TextureHandle handle, uint mip_level) {
+    setItemStorageImage(pending_item_, binding_location, handle, mip_level);
+}
+
+void Encoder::setStateEnable(RenderState state) {
+    setItemState(pending_item_, state, true);
+}
+
+void Encoder::setStateDisable(RenderState state) {
+    setItemState(pending_item_, state, false);
+}
+
+void Encoder::setStateCullFrontFace(CullFrontFace front_face) {
+    pending_item_.cull_front_face = front_face;
+}
+
+void Encoder::setStatePolygonMode(PolygonMode polygon_mode) {
+    pending_item_.polygon_mode = polygon_mode;
+}
+
+void Encoder::setStateBlendEquation(BlendEquation equation, BlendFunc src, BlendFunc dest) {
+    pending_item_.blend_equation_rgb = pending_item_.blend_equation_a = equation;
+    pending_item_.blend_src_rgb = pending_item_.blend_src_a = src;
+    pending_item_.blend_dest_rgb = pending_item_.blend_dest_a = dest;
+}
+
+void Encoder::setColourWrite(bool write_enabled) {
+    pending_item_.colour_write = write_enabled;
+}
+
+void Encoder::setDepthWrite(bool write_enabled) {
+    pending_item_.depth_write = write_enabled;
+}
+
+void Encoder::setScissor(u16 x, u16 y, u16 width, u16 height) {
+    setItemScissor(pending_item_, x, y, width, height);
+}
+
+void Encoder::setSortDepth(float depth) {
+    pending_item_.sort_depth = depth;
+}
+
+void Encoder::setOcclusionQuery(OcclusionQueryHandle handle) {
+    pending_item_.occlusion_query = handle;
+}
+
+void Encoder::setDrawCondition(OcclusionQueryHandle handle) {
+    pending_item_.draw_condition = handle;
+}
+
+void Encoder::submit(uint render_queue, ProgramHandle program, uint vertex_count, uint offset,
+                     uint instance_count, int base_vertex) {
+    renderer_.finishRenderItem(pending_item_, program, vertex_count, offset, instance_count,
+                               base_vertex);
+    items_.emplace_back(render_queue, std::move(pending_item_));
+    pending_item_ = RenderItem();
+}
+
+void Encoder::submitIndirect(uint render_queue, ProgramHandle program, IndirectBufferHandle handle,
+                             uint draw_count, uint offset) {
+    if (renderer_.finishIndirectRenderItem(pending_item_, program, handle, draw_count, offset)) {
+        items_.emplace_back(render_queue, std::move(pending_item_));
+    }
+    pending_item_ = RenderItem();
+}
+
+void Encoder::dispatch(uint render_queue, ProgramHandle program, uint group_count_x,
+                       uint group_count_y, uint group_count_z) {
+    if (renderer_.finishComputeItem(pending_item_, program, group_count_x, group_count_y,
+                                    group_count_z)) {
+        compute_items_.emplace_back(render_queue, std::move(pending_item_));
+    }
+    pending_item_ = RenderItem();
 }
 
 Renderer::Renderer(Logger& logger)
     : logger_(logger),
+      window_hidden_(false),
+      frame_capture_enabled_(false),
       use_render_thread_(false),
       is_first_frame_(true),
       shared_rt_should_exit_(false),
       shared_rt_finished_(false),
-      shared_frame_barrier_(2),
-      submit_(&frames_[0]),
-      render_(&frames_[1]),
+      frame_count_(2),
+      present_mode_(PresentMode::Mailbox),
+      swap_interval_(1),
+      max_frames_in_flight_(2),
+      submit_(nullptr),
       transient_vb(-1),
-      transient_ib(-1) {
+      transient_vb_page_size(DW_DEFAULT_TRANSIENT_VERTEX_BUFFER_SIZE),
+      transient_ib(-1),
+      transient_ib32(-1),
+      transient_ib_page_size(DW_DEFAULT_TRANSIENT_INDEX_BUFFER_SIZE) {
+    static_assert(kMaxFrameCount <= FrameQueue::kCapacity);
+    frames_.emplace_back(std::make_unique<Frame>());
+    submit_ = frames_.front().get();
 }
 
 Renderer::~Renderer() {
     // Wait for render thread if multithreaded.
-    if (use_render_thread_) {
-        if (!shared_rt_finished_) {
-            // Flag to the render thread that it should exit.
-            shared_rt_should_exit_ = true;
-
-            // Wait for the render thread to complete its last frame.
-            shared_frame_barrier_.wait();
-
-            // Wait for the render thread to exit completely.
-            render_thread_.join();
-        }
+    if (render_thread_.joinable()) {
+        // Flag to the render thread that it should exit, and wake it up if it's waiting for a
+        // frame. It finishes the frame it's rendering, then drops the frames after it.
+        shared_rt_should_exit_ = true;
+        submitted_frames_.close();
+
+        // Wait for the render thread to exit completely.
+        render_thread_.join();
     }
 
     // Delete renderer.
     shared_render_context_.reset();
 }
 
+void Renderer::setCacheDirectory(const std::string& directory) {
+    cache_directory_ = directory;
+}
+
+void Renderer::setWindowHidden(bool hidden) {
+    window_hidden_ = hidden;
+}
+
+void Renderer::setFrameCaptureEnabled(bool enabled) {
+    frame_capture_enabled_ = enabled;
+}
+
+void Renderer::setFrameCount(uint count) {
+    if (count < 2 || count > kMaxFrameCount) {
+        logger_.warn("Frame count {} is out of range, must be between 2 and {}.", count,
+                     kMaxFrameCount);
+        count = std::clamp(count, 2u, kMaxFrameCount);
+    }
+    frame_count_ = count;
+}
+
+void Renderer::setPresentMode(PresentMode mode, uint swap_interval) {
+    if (swap_interval < 1) {
+        logger_.warn("Swap interval must be at least 1.");
+        swap_interval = 1;
+    }
+    present_mode_ = mode;
+    swap_interval_ = swap_interval;
+    if (shared_render_context_) {
+        shared_render_context_->setPresentMode(mode, swap_interval);
+    }
+}
+
+void Renderer::setMaxFramesInFlight(uint count) {
+    if (count < 1 || count > kMaxFrameCount) {
+        logger_.warn("Max frames in flight {} is out of range, must be between 1 and {}.", count,
+                     kMaxFrameCount);
+        count = std::clamp(count, 1u, kMaxFrameCount);
+    }
+    max_frames_in_flight_ = count;
+}
+
 Result<void, std::string> Renderer::init(RendererType type, u16 width, u16 height,
                                          const std::string& title, InputCallbacks input_callbacks,
                                          bool use_render_thread) {
@@ -82,16 +456,31 @@ Result<void, std::string> Renderer::init(RendererType type, u16 width, u16 heigh
     window_title_ = title;
     use_render_thread_ = use_render_thread;
     is_first_frame_ = true;
+    if (frame_capture_enabled_) {
+        resource_journal_ = std::make_unique<ResourceJournal>();
+    }
 
-    // Initialise transient vb/ib.
-    transient_vb_max_size = DW_MAX_TRANSIENT_VERTEX_BUFFER_SIZE;
+    // Initialise transient vb/ib. These are resized by the render context if a frame's transient
+    // storage outgrows them.
     transient_vb =
-        createVertexBuffer(Memory(transient_vb_max_size), VertexDecl{}, BufferUsage::Stream);
-    transient_ib_max_size = DW_MAX_TRANSIENT_INDEX_BUFFER_SIZE;
-    transient_ib =
-        createIndexBuffer(Memory(transient_vb_max_size), IndexBufferType::U16, BufferUsage::Stream);
-    frames_[0].transient_vb_storage.handle = frames_[1].transient_vb_storage.handle = transient_vb;
-    frames_[0].transient_ib_storage.handle = frames_[1].transient_ib_storage.handle = transient_ib;
+        createVertexBuffer(Memory(transient_vb_page_size), VertexDecl{}, BufferUsage::Stream);
+    transient_ib = createIndexBuffer(Memory(transient_ib_page_size), IndexBufferType::U16,
+                                     BufferUsage::Stream);
+    transient_ib32 = createIndexBuffer(Memory(transient_ib_page_size), IndexBufferType::U32,
+                                       BufferUsage::Stream);
+
+    // Create the frames. Only one is needed without a render thread. The frame being submitted
+    // has already been created, and the rest start off free.
+    uint frame_count = use_render_thread ? frame_count_ : 1;
+    while (frames_.size() < frame_count) {
+        frames_.emplace_back(std::make_unique<Frame>());
+        free_frames_.push(frames_.back().get());
+    }
+    for (auto& frame : frames_) {
+        frame->transient_vb_storage.handle = transient_vb;
+        frame->transient_ib_storage.handle = transient_ib;
+        frame->transient_ib32_storage.handle = transient_ib32;
+    }
 
     // Kick off rendering thread.
     switch (type) {
@@ -108,6 +497,10 @@ Result<void, std::string> Renderer::init(RendererType type, u16 width, u16 heigh
             shared_render_context_ = std::make_unique<RenderContextVK>(logger_);
             break;
     }
+    shared_render_context_->setCacheDirectory(cache_directory_);
+    shared_render_context_->setWindowHidden(window_hidden_);
+    shared_render_context_->setPresentMode(present_mode_, swap_interval_);
+    shared_render_context_->setMaxFramesInFlight(max_frames_in_flight_);
     auto window_result =
         shared_render_context_->createWindow(width_, height_, window_title_, input_callbacks);
     if (!window_result) {
@@ -166,9 +559,15 @@ VertexBufferHandle Renderer::createVertexBuffer(Memory data, const VertexDecl& d
                                                 BufferUsage usage) {
     // TODO: Validate data.
     auto handle = vertex_buffer_handle_.next();
+    if (!checkHandle(logger_, handle, "vertex buffer")) {
+        return handle;
+    }
     uint data_size = data.size();
+    {
+        std::unique_lock<std::shared_mutex> lock{resource_mutex_};
+        vertex_buffer_info_[handle] = VertexBufferInfo{decl, usage};
+    }
     submitPreFrameCommand(cmd::CreateVertexBuffer{handle, std::move(data), data_size, decl, usage});
-    vertex_buffer_info_[handle] = VertexBufferInfo{decl, usage};
     return handle;
 }
 
@@ -178,16 +577,32 @@ void Renderer::setVertexBuffer(VertexBufferHandle handle) {
     submit_->pending_item.vertex_decl_override = VertexDecl{};
 }
 
+void Renderer::setInstanceBuffer(VertexBufferHandle handle, uint offset) {
+    submit_->pending_item.instance_vb = handle;
+    submit_->pending_item.instance_vb_offset = offset;
+    submit_->pending_item.instance_decl_override = VertexDecl{};
+}
+
+void Renderer::setInstanceBuffer(TransientVertexBufferHandle handle) {
+    Frame::TransientVertexBufferData& tvb = submit_->transient_vertex_buffers_.at(handle);
+    submit_->pending_item.instance_vb = transient_vb;
+    submit_->pending_item.instance_vb_offset = tvb.offset;
+    submit_->pending_item.instance_decl_override = tvb.decl;
+}
+
 void Renderer::updateVertexBuffer(VertexBufferHandle handle, Memory data, uint offset) {
-    auto vbd = vertex_buffer_info_.find(handle);
-    if (vbd == vertex_buffer_info_.end()) {
-        logger_.error("Vertex buffer handle {} invalid.", static_cast<u32>(handle));
-        return;
-    }
-    if (vbd->second.usage == BufferUsage::Static) {
-        logger_.error("Attempted to update a static vertex buffer {}, skipping.",
-                      static_cast<u32>(handle));
-        return;
+    {
+        std::shared_lock<std::shared_mutex> lock{resource_mutex_};
+        auto vbd = vertex_buffer_info_.find(handle);
+        if (vbd == vertex_buffer_info_.end()) {
+            logger_.error("Vertex buffer handle {} invalid.", static_cast<u32>(handle));
+            return;
+        }
+        if (vbd->second.usage == BufferUsage::Static) {
+            logger_.error("Attempted to update a static vertex buffer {}, skipping.",
+                          static_cast<u32>(handle));
+            return;
+        }
     }
     submitPreFrameCommand(cmd::UpdateVertexBuffer{handle, std::move(data), offset});
 
@@ -204,14 +619,25 @@ void Renderer::updateVertexBuffer(VertexBufferHandle handle, Memory data, uint o
 
 void Renderer::deleteVertexBuffer(VertexBufferHandle handle) {
     submitPostFrameCommand(cmd::DeleteVertexBuffer{handle});
+    {
+        std::unique_lock<std::shared_mutex> lock{resource_mutex_};
+        vertex_buffer_info_.erase(handle);
+    }
+    vertex_buffer_handle_.release(handle);
 }
 
 IndexBufferHandle Renderer::createIndexBuffer(Memory data, IndexBufferType type,
                                               BufferUsage usage) {
     auto handle = index_buffer_handle_.next();
+    if (!checkHandle(logger_, handle, "index buffer")) {
+        return handle;
+    }
     uint data_size = data.size();
+    {
+        std::unique_lock<std::shared_mutex> lock{resource_mutex_};
+        index_buffer_types_[handle] = type;
+    }
     submitPreFrameCommand(cmd::CreateIndexBuffer{handle, std::move(data), data_size, type, usage});
-    index_buffer_types_[handle] = type;
     return handle;
 }
 
@@ -236,21 +662,150 @@ void Renderer::updateIndexBuffer(IndexBufferHandle handle, Memory data, uint off
 
 void Renderer::deleteIndexBuffer(IndexBufferHandle handle) {
     submitPostFrameCommand(cmd::DeleteIndexBuffer{handle});
+    {
+        std::unique_lock<std::shared_mutex> lock{resource_mutex_};
+        index_buffer_types_.erase(handle);
+    }
+    index_buffer_handle_.release(handle);
+}
+
+IndirectBufferHandle Renderer::createIndirectBuffer(Memory data, BufferUsage usage) {
+    auto handle = indirect_buffer_handle_.next();
+    if (!checkHandle(logger_, handle, "indirect buffer")) {
+        return handle;
+    }
+    uint data_size = data.size();
+    {
+        std::unique_lock<std::shared_mutex> lock{resource_mutex_};
+        indirect_buffer_sizes_[handle] = data_size;
+    }
+    submitPreFrameCommand(cmd::CreateIndirectBuffer{handle, std::move(data), data_size, usage});
+    return handle;
+}
+
+void Renderer::updateIndirectBuffer(IndirectBufferHandle handle, Memory data, uint offset) {
+    {
+        std::shared_lock<std::shared_mutex> lock{resource_mutex_};
+        if (offset + data.size() > indirect_buffer_sizes_.at(handle)) {
+            logger_.error("Update of indirect buffer {} is out of range ({} bytes at offset {}).",
+                          handle, data.size(), offset);
+            return;
+        }
+    }
+    submitPreFrameCommand(cmd::UpdateIndirectBuffer{handle, std::move(data), offset});
+}
+
+void Renderer::deleteIndirectBuffer(IndirectBufferHandle handle) {
+    submitPostFrameCommand(cmd::DeleteIndirectBuffer{handle});
+    {
+        std::unique_lock<std::shared_mutex> lock{resource_mutex_};
+        indirect_buffer_sizes_.erase(handle);
+    }
+    indirect_buffer_handle_.release(handle);
+}
+
+StorageBufferHandle Renderer::createStorageBuffer(Memory data, BufferUsage usage) {
+    auto handle = storage_buffer_handle_.next();
+    if (!checkHandle(logger_, handle, "storage buffer")) {
+        return handle;
+    }
+    uint data_size = data.size();
+    {
+        std::unique_lock<std::shared_mutex> lock{resource_mutex_};
+        storage_buffer_sizes_[handle] = data_size;
+    }
+    submitPreFrameCommand(cmd::CreateStorageBuffer{handle, std::move(data), data_size, usage});
+    return handle;
+}
+
+void Renderer::updateStorageBuffer(StorageBufferHandle handle, Memory data, uint offset) {
+    {
+        std::shared_lock<std::shared_mutex> lock{resource_mutex_};
+        if (offset + data.size() > storage_buffer_sizes_.at(handle)) {
+            logger_.error("Update of storage buffer {} is out of range ({} bytes at offset {}).",
+                          handle, data.size(), offset);
+            return;
+        }
+    }
+    submitPreFrameCommand(cmd::UpdateStorageBuffer{handle, std::move(data), offset});
+}
+
+void Renderer::deleteStorageBuffer(StorageBufferHandle handle) {
+    submitPostFrameCommand(cmd::DeleteStorageBuffer{handle});
+    {
+        std::unique_lock<std::shared_mutex> lock{resource_mutex_};
+        storage_buffer_sizes_.erase(handle);
+    }
+    storage_buffer_handle_.release(handle);
+}
+
+void Renderer::setStorageBuffer(uint binding_location, StorageBufferHandle handle) {
+    setItemStorageBuffer(submit_->pending_item, binding_location, handle);
+}
+
+void Renderer::setStorageBuffer(uint binding_location, IndirectBufferHandle handle) {
+    setItemStorageBuffer(submit_->pending_item, binding_location, handle);
+}
+
+UniformBufferHandle Renderer::createUniformBuffer(Memory data, BufferUsage usage) {
+    auto handle = uniform_buffer_handle_.next();
+    if (!checkHandle(logger_, handle, "uniform buffer")) {
+        return handle;
+    }
+    uint data_size = data.size();
+    {
+        std::unique_lock<std::shared_mutex> lock{resource_mutex_};
+        uniform_buffer_sizes_[handle] = data_size;
+    }
+    submitPreFrameCommand(cmd::CreateUniformBuffer{handle, std::move(data), data_size, usage});
+    return handle;
+}
+
+void Renderer::updateUniformBuffer(UniformBufferHandle handle, Memory data, uint offset) {
+    {
+        std::shared_lock<std::shared_mutex> lock{resource_mutex_};
+        if (offset + data.size() > uniform_buffer_sizes_.at(handle)) {
+            logger_.error("Update of uniform buffer {} is out of range ({} bytes at offset {}).",
+                          handle, data.size(), offset);
+            return;
+        }
+    }
+    submitPreFrameCommand(cmd::UpdateUniformBuffer{handle, std::move(data), offset});
+}
+
+void Renderer::deleteUniformBuffer(UniformBufferHandle handle) {
+    submitPostFrameCommand(cmd::DeleteUniformBuffer{handle});
+    {
+        std::unique_lock<std::shared_mutex> lock{resource_mutex_};
+        uniform_buffer_sizes_.erase(handle);
+    }
+    uniform_buffer_handle_.release(handle);
+}
+
+void Renderer::setUniformBuffer(uint binding_location, UniformBufferHandle handle, uint offset) {
+    {
+        std::shared_lock<std::shared_mutex> lock{resource_mutex_};
+        auto size_it = uniform_buffer_sizes_.find(handle);
+        if (size_it == uniform_buffer_sizes_.end() || offset >= size_it->second) {
+            logger_.error("Uniform buffer {} offset {} is out of range, ignoring.", handle, offset);
+            return;
+        }
+    }
+    setItemUniformBuffer(logger_, submit_->pending_item, binding_location, handle, offset);
 }
 
 std::optional<TransientVertexBufferHandle> Renderer::allocTransientVertexBuffer(
     uint vertex_count, const VertexDecl& decl) {
-    // Check that we have enough space.
     uint size = vertex_count * decl.stride();
-    if (size > transient_vb_max_size - submit_->transient_vb_storage.size) {
-        return std::nullopt;
-    }
+    uint offset;
+    byte* data = submit_->transient_vb_storage.allocate(size, transient_vb_page_size, offset);
 
     // Allocate handle.
     auto handle = submit_->transient_vertex_buffer_handle_generator_.next();
-    byte* data = submit_->transient_vb_storage.data.data() + submit_->transient_vb_storage.size;
-    submit_->transient_vb_storage.size += size;
-    submit_->transient_vertex_buffers_[handle] = {data, size, decl};
+    if (!checkHandle(logger_, handle, "transient vertex buffer")) {
+        return std::nullopt;
+    }
+    submit_->transient_vertex_buffers_[handle] = {data, offset, size, decl};
     return handle;
 }
 
@@ -265,22 +820,30 @@ byte* Renderer::getTransientVertexBufferData(TransientVertexBufferHandle handle)
 void Renderer::setVertexBuffer(TransientVertexBufferHandle handle) {
     Frame::TransientVertexBufferData& tvb = submit_->transient_vertex_buffers_.at(handle);
     submit_->pending_item.vb = transient_vb;
-    submit_->pending_item.vb_offset = uint(tvb.data - submit_->transient_vb_storage.data.data());
+    submit_->pending_item.vb_offset = tvb.offset;
     submit_->pending_item.vertex_decl_override = tvb.decl;
 }
 
-std::optional<TransientIndexBufferHandle> Renderer::allocTransientIndexBuffer(uint index_count) {
-    // Check that we have enough space.
-    uint size = index_count * sizeof(u16);
-    if (size > transient_ib_max_size - submit_->transient_ib_storage.size) {
-        return std::nullopt;
+std::optional<TransientIndexBufferHandle> Renderer::allocTransientIndexBuffer(
+    uint index_count, IndexBufferType type) {
+    // U16 and U32 indices are stored in separate buffers.
+    uint size;
+    uint offset;
+    byte* data;
+    if (type == IndexBufferType::U16) {
+        size = index_count * sizeof(u16);
+        data = submit_->transient_ib_storage.allocate(size, transient_ib_page_size, offset);
+    } else {
+        size = index_count * sizeof(u32);
+        data = submit_->transient_ib32_storage.allocate(size, transient_ib_page_size, offset);
     }
 
     // Allocate handle.
     auto handle = submit_->transient_index_buffer_handle_generator_.next();
-    byte* data = submit_->transient_ib_storage.data.data() + submit_->transient_ib_storage.size;
-    submit_->transient_ib_storage.size += size;
-    submit_->transient_index_buffers_[handle] = {data, size};
+    if (!checkHandle(logger_, handle, "transient index buffer")) {
+        return std::nullopt;
+    }
+    submit_->transient_index_buffers_[handle] = {data, offset, size, type};
     return handle;
 }
 
@@ -294,119 +857,388 @@ byte* Renderer::getTransientIndexBufferData(TransientIndexBufferHandle handle) {
 
 void Renderer::setIndexBuffer(TransientIndexBufferHandle handle) {
     Frame::TransientIndexBufferData& tib = submit_->transient_index_buffers_.at(handle);
-    submit_->pending_item.ib = transient_ib;
-    submit_->pending_item.ib_offset = uint(tib.data - submit_->transient_ib_storage.data.data());
+    submit_->pending_item.ib = tib.type == IndexBufferType::U16 ? transient_ib : transient_ib32;
+    submit_->pending_item.ib_offset = tib.offset;
+}
+
+void Renderer::setTransientBufferPageSize(uint vertex_buffer_page_size,
+                                          uint index_buffer_page_size) {
+    transient_vb_page_size = vertex_buffer_page_size;
+    transient_ib_page_size = index_buffer_page_size;
 }
 
 ProgramHandle Renderer::createProgram(std::vector<ShaderStageInfo> stages) {
     auto handle = program_handle_.next();
+    if (!checkHandle(logger_, handle, "program")) {
+        return handle;
+    }
     submitPreFrameCommand(cmd::CreateProgram{handle, std::move(stages)});
     return handle;
 }
 
+ProgramHandle Renderer::createProgramAsync(std::vector<ShaderStageInfo> stages) {
+    auto handle = program_handle_.next();
+    if (!checkHandle(logger_, handle, "program")) {
+        return handle;
+    }
+    submitPreFrameCommand(cmd::CreateProgram{handle, std::move(stages), true});
+    return handle;
+}
+
+bool Renderer::isProgramReady(ProgramHandle program) const {
+    return shared_render_context_->isProgramReady(program);
+}
+
 void Renderer::deleteProgram(ProgramHandle program) {
     submitPostFrameCommand(cmd::DeleteProgram{program});
+    program_handle_.release(program);
+}
+
+UniformHandle Renderer::createUniform(const std::string& uniform_name) {
+    {
+        std::shared_lock<std::shared_mutex> lock{resource_mutex_};
+        auto it = uniform_handles_.find(uniform_name);
+        if (it != uniform_handles_.end()) {
+            return it->second;
+        }
+    }
+
+    // Check again, as another thread may have created the uniform since. The command is submitted
+    // while holding the lock, so it's queued before any other thread can find the handle.
+    std::unique_lock<std::shared_mutex> lock{resource_mutex_};
+    auto it = uniform_handles_.find(uniform_name);
+    if (it != uniform_handles_.end()) {
+        return it->second;
+    }
+    auto handle = uniform_handle_.next();
+    if (!checkHandle(logger_, handle, "uniform")) {
+        return handle;
+    }
+    uniform_handles_.emplace(uniform_name, handle);
+    submitPreFrameCommand(cmd::CreateUniform{handle, uniform_name});
+    return handle;
+}
+
+void Renderer::setUniform(UniformHandle uniform, int value) {
+    setUniform(uniform, UniformData{value});
+}
+
+void Renderer::setUniform(UniformHandle uniform, float value) {
+    setUniform(uniform, UniformData{value});
+}
+
+void Renderer::setUniform(UniformHandle uniform, const Vec2& value) {
+    setUniform(uniform, UniformData{value});
+}
+
+void Renderer::setUniform(UniformHandle uniform, const Vec3& value) {
+    setUniform(uniform, UniformData{value});
+}
+
+void Renderer::setUniform(UniformHandle uniform, const Vec4& value) {
+    setUniform(uniform, UniformData{value});
+}
+
+void Renderer::setUniform(UniformHandle uniform, const Mat3& value) {
+    setUniform(uniform, UniformData{value});
+}
+
+void Renderer::setUniform(UniformHandle uniform, const Mat4& value) {
+    setUniform(uniform, UniformData{value});
+}
+
+void Renderer::setUniform(UniformHandle uniform, UniformData data) {
+    setItemUniform(submit_->pending_item, uniform, std::move(data));
 }
 
 void Renderer::setUniform(const std::string& uniform_name, int value) {
-    setUniform(uniform_name, UniformData{value});
+    setUniform(createUniform(uniform_name), UniformData{value});
 }
 
 void Renderer::setUniform(const std::string& uniform_name, float value) {
-    setUniform(uniform_name, UniformData{value});
+    setUniform(createUniform(uniform_name), UniformData{value});
 }
 
 void Renderer::setUniform(const std::string& uniform_name, const Vec2& value) {
-    setUniform(uniform_name, UniformData{value});
+    setUniform(createUniform(uniform_name), UniformData{value});
 }
 
 void Renderer::setUniform(const std::string& uniform_name, const Vec3& value) {
-    setUniform(uniform_name, UniformData{value});
+    setUniform(createUniform(uniform_name), UniformData{value});
 }
 
 void Renderer::setUniform(const std::string& uniform_name, const Vec4& value) {
-    setUniform(uniform_name, UniformData{value});
+    setUniform(createUniform(uniform_name), UniformData{value});
 }
 
 void Renderer::setUniform(const std::string& uniform_name, const Mat3& value) {
-    setUniform(uniform_name, UniformData{value});
+    setUniform(createUniform(uniform_name), UniformData{value});
 }
 
 void Renderer::setUniform(const std::string& uniform_name, const Mat4& value) {
-    setUniform(uniform_name, UniformData{value});
+    setUniform(createUniform(uniform_name), UniformData{value});
 }
 
 void Renderer::setUniform(const std::string& uniform_name, UniformData data) {
-    // MathGeoLib stores matrices in row-major order, but render contexts expect matrices in
-    // column-major order.
-    if (Mat3* mat3_data = std::get_if<Mat3>(&data)) {
-        mat3_data->Transpose();
-    } else if (Mat4* mat4_data = std::get_if<Mat4>(&data)) {
-        mat4_data->Transpose();
-    }
-    submit_->pending_item.uniforms[uniform_name] = data;
+    setUniform(createUniform(uniform_name), std::move(data));
 }
 
 TextureHandle Renderer::createTexture2D(u16 width, u16 height, TextureFormat format, Memory data,
-                                        bool generate_mipmaps, bool framebuffer_usage) {
+                                        bool generate_mipmaps, bool framebuffer_usage,
+                                        bool storage_usage) {
+    auto handle = texture_handle_.next();
+    if (!checkHandle(logger_, handle, "texture")) {
+        return handle;
+    }
+    bool bindless =
+        !framebuffer_usage && !storage_usage && handle.index() < DW_MAX_BINDLESS_TEXTURES;
+    // Mipmaps can't be generated for compressed formats.
+    u32 level_count = generate_mipmaps && !textureFormatInfo(format).compressed
+                          ? textureMipCount(width, height)
+                          : 1;
+    {
+        std::unique_lock<std::shared_mutex> lock{resource_mutex_};
+        texture_data_[handle] = {width, height, format, storage_usage, 0, bindless, level_count};
+    }
+    std::vector<Memory> mip_levels;
+    if (data.data()) {
+        mip_levels.emplace_back(std::move(data));
+    }
+    submitPreFrameCommand(cmd::CreateTexture2D{handle, width, height, format,
+                                               std::move(mip_levels), generate_mipmaps,
+                                               framebuffer_usage, storage_usage, 0, bindless});
+    return handle;
+}
+
+TextureHandle Renderer::createTexture2D(u16 width, u16 height, TextureFormat format,
+                                        std::vector<Memory> mip_levels) {
+    for (u32 level = 0; level < mip_levels.size(); ++level) {
+        usize expected_size = textureLevelSize(format, width >> level, height >> level);
+        if (mip_levels[level].size() != expected_size) {
+            logger_.error("Mip level {} of texture has size {}, expected {}.", level,
+                          mip_levels[level].size(), expected_size);
+            return TextureHandle{};
+        }
+    }
+    auto handle = texture_handle_.next();
+    if (!checkHandle(logger_, handle, "texture")) {
+        return handle;
+    }
+    bool bindless = handle.index() < DW_MAX_BINDLESS_TEXTURES;
+    auto level_count = static_cast<u32>(std::max<usize>(mip_levels.size(), 1));
+    {
+        std::unique_lock<std::shared_mutex> lock{resource_mutex_};
+        texture_data_[handle] = {width, height, format, false, 0, bindless, level_count};
+    }
+    submitPreFrameCommand(cmd::CreateTexture2D{handle, width, height, format,
+                                               std::move(mip_levels), false, false, false, 0,
+                                               bindless});
+    return handle;
+}
+
+TextureHandle Renderer::createTexture2DArray(u16 width, u16 height, u16 layers,
+                                             TextureFormat format, Memory data,
+                                             bool generate_mipmaps) {
+    if (layers == 0) {
+        logger_.error("Array textures must have at least one layer.");
+        return TextureHandle{};
+    }
+    usize expected_size = textureLevelSize(format, width, height) * layers;
+    if (data.data() && data.size() != expected_size) {
+        logger_.error("Array texture data has size {}, expected {}.", data.size(), expected_size);
+        return TextureHandle{};
+    }
     auto handle = texture_handle_.next();
-    texture_data_[handle] = {width, height, format};
-    submitPreFrameCommand(cmd::CreateTexture2D{handle, width, height, format, std::move(data),
-                                               generate_mipmaps, framebuffer_usage});
+    if (!checkHandle(logger_, handle, "texture")) {
+        return handle;
+    }
+    u32 level_count = generate_mipmaps && !textureFormatInfo(format).compressed
+                          ? textureMipCount(width, height)
+                          : 1;
+    {
+        std::unique_lock<std::shared_mutex> lock{resource_mutex_};
+        texture_data_[handle] = {width, height, format, false, layers, false, level_count};
+    }
+    std::vector<Memory> mip_levels;
+    if (data.data()) {
+        mip_levels.emplace_back(std::move(data));
+    }
+    submitPreFrameCommand(cmd::CreateTexture2D{handle, width, height, format,
+                                               std::move(mip_levels), generate_mipmaps, false,
+                                               false, layers});
     return handle;
 }
 
+void Renderer::updateTexture2D(TextureHandle handle, Memory data, u16 x, u16 y, u16 width,
+                               u16 height, uint mip_level) {
+    {
+        std::shared_lock<std::shared_mutex> lock{resource_mutex_};
+        auto texture_it = texture_data_.find(handle);
+        if (texture_it == texture_data_.end()) {
+            logger_.error("Texture handle {} invalid.", static_cast<u32>(handle));
+            return;
+        }
+        const auto& texture = texture_it->second;
+        if (texture.array_layers > 0) {
+            logger_.error("Texture {} is an array texture, which can't be updated, skipping.",
+                          static_cast<u32>(handle));
+            return;
+        }
+        if (mip_level >= texture.mip_levels) {
+            logger_.error("Mip level {} of texture {} doesn't exist, skipping.", mip_level,
+                          static_cast<u32>(handle));
+            return;
+        }
+        u32 level_width = std::max(texture.width >> mip_level, 1);
+        u32 level_height = std::max(texture.height >> mip_level, 1);
+        if (u32(x) + width > level_width || u32(y) + height > level_height) {
+            logger_.error(
+                "Region ({}, {}) {}x{} is outside of mip level {} of texture {} ({}x{}), skipping.",
+                x, y, width, height, mip_level, static_cast<u32>(handle), level_width,
+                level_height);
+            return;
+        }
+        auto info = textureFormatInfo(texture.format);
+        bool x_aligned = x % info.block_width == 0 &&
+                         (width % info.block_width == 0 || u32(x) + width == level_width);
+        bool y_aligned = y % info.block_height == 0 &&
+                         (height % info.block_height == 0 || u32(y) + height == level_height);
+        if (!x_aligned || !y_aligned) {
+            logger_.error("Region ({}, {}) {}x{} of texture {} isn't aligned to {}x{} blocks.",
+                          x, y, width, height, static_cast<u32>(handle), info.block_width,
+                          info.block_height);
+            return;
+        }
+        usize expected_size = textureLevelSize(texture.format, width, height);
+        if (data.size() != expected_size) {
+            logger_.error("Update of texture {} has size {}, expected {}.",
+                          static_cast<u32>(handle), data.size(), expected_size);
+            return;
+        }
+    }
+    submitPreFrameCommand(
+        cmd::UpdateTexture2D{handle, mip_level, x, y, width, height, std::move(data)});
+}
+
+bool Renderer::isTextureFormatSupported(TextureFormat format) const {
+    return shared_render_context_->isTextureFormatSupported(format);
+}
+
+bool Renderer::isBindlessTexturingSupported() const {
+    return shared_render_context_->isBindlessTexturingSupported();
+}
+
+std::optional<u32> Renderer::bindlessTextureIndex(TextureHandle handle) const {
+    if (!isBindlessTexturingSupported()) {
+        return std::nullopt;
+    }
+    std::shared_lock<std::shared_mutex> lock{resource_mutex_};
+    auto texture_it = texture_data_.find(handle);
+    if (texture_it == texture_data_.end() || !texture_it->second.bindless) {
+        return std::nullopt;
+    }
+    return handle.index();
+}
+
 bool Renderer::setTexture(uint binding_location, TextureHandle handle, u32 sampler_flags,
                           float max_anisotropy) {
-    if (submit_->pending_item.textures.size() == DW_MAX_TEXTURE_SAMPLERS) {
-        return false;
+    return setItemTexture(submit_->pending_item, binding_location, handle, sampler_flags,
+                          max_anisotropy);
+}
+
+void Renderer::setStorageImage(uint binding_location, TextureHandle handle, uint mip_level) {
+    {
+        std::shared_lock<std::shared_mutex> lock{resource_mutex_};
+        auto texture_it = texture_data_.find(handle);
+        if (texture_it == texture_data_.end() || !texture_it->second.storage_usage) {
+            logger_.error("Texture {} was not created with storage usage, ignoring.", handle);
+            return;
+        }
     }
-    submit_->pending_item.textures.emplace_back(
-        RenderItem::TextureBinding{binding_location, handle, {sampler_flags, max_anisotropy}});
-    return true;
+    setItemStorageImage(submit_->pending_item, binding_location, handle, mip_level);
 }
 
 void Renderer::deleteTexture(TextureHandle handle) {
-    texture_data_.erase(handle);
+    {
+        std::unique_lock<std::shared_mutex> lock{resource_mutex_};
+        texture_data_.erase(handle);
+    }
     submitPostFrameCommand(cmd::DeleteTexture{handle});
+    texture_handle_.release(handle);
 }
 
 FrameBufferHandle Renderer::createFrameBuffer(u16 width, u16 height, TextureFormat format) {
     auto handle = frame_buffer_handle_.next();
+    if (!checkHandle(logger_, handle, "frame buffer")) {
+        return handle;
+    }
     auto texture_handle = createTexture2D(width, height, format, Memory(), false, true);
-    frame_buffer_textures_[handle] = {texture_handle};
+    if (texture_handle == TextureHandle{}) {
+        frame_buffer_handle_.release(handle);
+        return FrameBufferHandle{};
+    }
+    {
+        std::unique_lock<std::shared_mutex> lock{resource_mutex_};
+        frame_buffer_textures_[handle] = {texture_handle};
+    }
     submitPreFrameCommand(cmd::CreateFrameBuffer{handle, width, height, {texture_handle}});
     return handle;
 }
 
 FrameBufferHandle Renderer::createFrameBuffer(std::vector<TextureHandle> textures) {
-    auto handle = frame_buffer_handle_.next();
-    u16 width = texture_data_.at(textures[0]).width, height = texture_data_.at(textures[0]).height;
-    for (size_t i = 1; i < textures.size(); ++i) {
-        auto& data = texture_data_.at(textures[i]);
-        if (data.width != width || data.height != height) {
-            // TODO: error.
-            logger_.error("Frame buffer mismatch at index %d: Expected: %d x %d, Actual: %d x %d",
+    if (textures.empty()) {
+        logger_.error("Frame buffers must have at least one texture.");
+        return FrameBufferHandle{};
+    }
+    std::unique_lock<std::shared_mutex> lock{resource_mutex_};
+    u16 width = 0, height = 0;
+    for (usize i = 0; i < textures.size(); ++i) {
+        auto texture_it = texture_data_.find(textures[i]);
+        if (texture_it == texture_data_.end()) {
+            logger_.error("Texture handle {} invalid.", static_cast<u32>(textures[i]));
+            return FrameBufferHandle{};
+        }
+        const auto& data = texture_it->second;
+        if (data.array_layers > 0) {
+            logger_.error("Array texture {} can't be used as a frame buffer attachment.",
+                          static_cast<u32>(textures[i]));
+            return FrameBufferHandle{};
+        }
+        if (i == 0) {
+            width = data.width;
+            height = data.height;
+        } else if (data.width != width || data.height != height) {
+            logger_.error("Frame buffer mismatch at index {}: Expected: {} x {}, Actual: {} x {}",
                           i, width, height, data.width, data.height);
+            return FrameBufferHandle{};
         }
     }
+    auto handle = frame_buffer_handle_.next();
+    if (!checkHandle(logger_, handle, "frame buffer")) {
+        return handle;
+    }
     frame_buffer_textures_[handle] = textures;
     submitPreFrameCommand(cmd::CreateFrameBuffer{handle, width, height, textures});
     return handle;
 }
 
 TextureHandle Renderer::getFrameBufferTexture(FrameBufferHandle handle, uint index) {
+    std::shared_lock<std::shared_mutex> lock{resource_mutex_};
     auto& textures = frame_buffer_textures_.at(handle);
     return textures[index];
 }
 
 void Renderer::deleteFrameBuffer(FrameBufferHandle handle) {
-    frame_buffer_textures_.erase(handle);
+    {
+        std::unique_lock<std::shared_mutex> lock{resource_mutex_};
+        frame_buffer_textures_.erase(handle);
+    }
     submitPostFrameCommand(cmd::DeleteFrameBuffer{handle});
+    frame_buffer_handle_.release(handle);
 }
 
 uint Renderer::startRenderQueue(std::optional<FrameBufferHandle> frame_buffer) {
-    submit_->render_queues.emplace_back();
+    submit_->render_queues.emplace_back(&submit_->arena);
     submit_->render_queues.back().frame_buffer = frame_buffer;
     return lastCreatedRenderQueue();
 }
@@ -425,32 +1257,93 @@ void Renderer::setRenderQueueClear(uint render_queue, const Colour& colour, bool
         RenderQueue::ClearParameters{colour, clear_colour, clear_depth});
 }
 
-void Renderer::setStateEnable(RenderState state) {
-    switch (state) {
-        case RenderState::CullFace:
-            submit_->pending_item.cull_face_enabled = true;
-            break;
-        case RenderState::Depth:
-            submit_->pending_item.depth_enabled = true;
-            break;
-        case RenderState::Blending:
-            submit_->pending_item.blend_enabled = true;
-            break;
+void Renderer::setRenderQueueAttachmentOps(const RenderQueue::AttachmentOps& ops) {
+    setRenderQueueAttachmentOps(lastCreatedRenderQueue(), ops);
+}
+
+void Renderer::setRenderQueueAttachmentOps(uint render_queue,
+                                           const RenderQueue::AttachmentOps& ops) {
+    submit_->render_queues[render_queue].attachment_ops = ops;
+}
+
+void Renderer::setRenderQueueSortMode(RenderQueue::SortMode sort_mode) {
+    setRenderQueueSortMode(lastCreatedRenderQueue(), sort_mode);
+}
+
+void Renderer::setRenderQueueSortMode(uint render_queue, RenderQueue::SortMode sort_mode) {
+    submit_->render_queues[render_queue].sort_mode = sort_mode;
+}
+
+void Renderer::setRenderQueueLabel(std::string label) {
+    setRenderQueueLabel(lastCreatedRenderQueue(), std::move(label));
+}
+
+void Renderer::setRenderQueueLabel(uint render_queue, std::string label) {
+    submit_->render_queues[render_queue].label = std::move(label);
+}
+
+void Renderer::beginGpuScope(std::string name) {
+    beginGpuScope(lastCreatedRenderQueue(), std::move(name));
+}
+
+void Renderer::beginGpuScope(uint render_queue, std::string name) {
+    auto& queue = submit_->render_queues[render_queue];
+    uint depth = 0;
+    for (const auto& open_scope : open_gpu_scopes_) {
+        if (open_scope.first == render_queue) {
+            depth++;
+        }
     }
+    uint begin = static_cast<uint>(queue.render_items.size());
+    queue.timing_scopes.emplace_back(
+        RenderQueue::TimingScope{std::move(name), begin, begin, depth});
+    open_gpu_scopes_.emplace_back(render_queue, queue.timing_scopes.size() - 1);
 }
 
-void Renderer::setStateDisable(RenderState state) {
-    switch (state) {
-        case RenderState::CullFace:
-            submit_->pending_item.cull_face_enabled = false;
-            break;
-        case RenderState::Depth:
-            submit_->pending_item.depth_enabled = false;
-            break;
-        case RenderState::Blending:
-            submit_->pending_item.blend_enabled = false;
-            break;
+void Renderer::endGpuScope() {
+    endGpuScope(lastCreatedRenderQueue());
+}
+
+void Renderer::endGpuScope(uint render_queue) {
+    auto open_scope = std::find_if(open_gpu_scopes_.rbegin(), open_gpu_scopes_.rend(),
+                                   [render_queue](const std::pair<uint, usize>& scope) {
+                                       return scope.first == render_queue;
+                                   });
+    if (open_scope == open_gpu_scopes_.rend()) {
+        logger_.warn("[GpuScope] No GPU scope is open in render queue {}.", render_queue);
+        return;
+    }
+    auto& queue = submit_->render_queues[render_queue];
+    queue.timing_scopes[open_scope->second].end = static_cast<uint>(queue.render_items.size());
+    open_gpu_scopes_.erase(std::next(open_scope).base());
+}
+
+GpuTimings Renderer::gpuTimings() const {
+    return shared_render_context_->gpuTimings();
+}
+
+FrameStats Renderer::frameStats() const {
+    return shared_render_context_->frameStats();
+}
+
+GpuMemoryStats Renderer::gpuMemoryStats() const {
+    return shared_render_context_->gpuMemoryStats();
+}
+
+void Renderer::captureNextFrame(const std::string& path) {
+    if (!resource_journal_) {
+        logger_.error("[FrameCapture] Frame capture is not enabled, unable to capture {}.", path);
+        return;
     }
+    submit_->capture_path = path;
+}
+
+void Renderer::setStateEnable(RenderState state) {
+    setItemState(submit_->pending_item, state, true);
+}
+
+void Renderer::setStateDisable(RenderState state) {
+    setItemState(submit_->pending_item, state, false);
 }
 
 void Renderer::setStateCullFrontFace(CullFrontFace front_face) {
@@ -485,11 +1378,41 @@ void Renderer::setDepthWrite(bool write_enabled) {
 }
 
 void Renderer::setScissor(u16 x, u16 y, u16 width, u16 height) {
-    submit_->pending_item.scissor_enabled = true;
-    submit_->pending_item.scissor_x = x;
-    submit_->pending_item.scissor_y = y;
-    submit_->pending_item.scissor_width = width;
-    submit_->pending_item.scissor_height = height;
+    setItemScissor(submit_->pending_item, x, y, width, height);
+}
+
+void Renderer::setSortDepth(float depth) {
+    submit_->pending_item.sort_depth = depth;
+}
+
+OcclusionQueryHandle Renderer::createOcclusionQuery() {
+    auto handle = occlusion_query_handle_.next();
+    if (!checkHandle(logger_, handle, "occlusion query")) {
+        return handle;
+    }
+    submitPreFrameCommand(cmd::CreateOcclusionQuery{handle});
+    return handle;
+}
+
+void Renderer::deleteOcclusionQuery(OcclusionQueryHandle handle) {
+    submitPostFrameCommand(cmd::DeleteOcclusionQuery{handle});
+    occlusion_query_handle_.release(handle);
+}
+
+void Renderer::setOcclusionQuery(OcclusionQueryHandle handle) {
+    submit_->pending_item.occlusion_query = handle;
+}
+
+void Renderer::setDrawCondition(OcclusionQueryHandle handle) {
+    submit_->pending_item.draw_condition = handle;
+}
+
+std::optional<u64> Renderer::occlusionQueryResult(OcclusionQueryHandle handle) const {
+    return shared_render_context_->occlusionQueryResult(handle);
+}
+
+bool Renderer::isConditionalRenderingSupported() const {
+    return shared_render_context_->isConditionalRenderingSupported();
 }
 
 void Renderer::submit(ProgramHandle program) {
@@ -505,25 +1428,64 @@ void Renderer::submit(ProgramHandle program, uint vertex_count, uint offset) {
 }
 
 void Renderer::submit(uint render_queue, ProgramHandle program, uint vertex_count, uint offset) {
+    submit(render_queue, program, vertex_count, offset, 1);
+}
+
+void Renderer::submit(ProgramHandle program, uint vertex_count, uint offset, uint instance_count,
+                      int base_vertex) {
+    submit(lastCreatedRenderQueue(), program, vertex_count, offset, instance_count, base_vertex);
+}
+
+void Renderer::submit(uint render_queue, ProgramHandle program, uint vertex_count, uint offset,
+                      uint instance_count, int base_vertex) {
     // Complete item.
     auto& item = submit_->pending_item;
-    item.program = program;
-    item.primitive_count = vertex_count / 3;
-    if (vertex_count > 0) {
-        if (item.ib.has_value()) {
-            IndexBufferType type = index_buffer_types_.at(*item.ib);
-            item.ib_offset += offset * (type == IndexBufferType::U16 ? sizeof(u16) : sizeof(u32));
-        } else if (item.vb.has_value()) {
-            const VertexDecl& decl = vertex_buffer_info_.at(*item.vb).decl;
-            item.vb_offset += offset * decl.stride();
-        } else {
-            logger_.error("Submitted item with no vertex or index buffer bound.");
-        }
-    }
+    finishRenderItem(item, program, vertex_count, offset, instance_count, base_vertex);
 
     // Move the "pending" render item to the specified render queue.
     submit_->render_queues[render_queue].render_items.emplace_back(std::move(item));
-    item = RenderItem();
+    item = RenderItem(&submit_->arena);
+}
+
+void Renderer::submitIndirect(ProgramHandle program, IndirectBufferHandle handle, uint draw_count,
+                              uint offset) {
+    submitIndirect(lastCreatedRenderQueue(), program, handle, draw_count, offset);
+}
+
+void Renderer::submitIndirect(uint render_queue, ProgramHandle program,
+                              IndirectBufferHandle handle, uint draw_count, uint offset) {
+    auto& item = submit_->pending_item;
+    if (finishIndirectRenderItem(item, program, handle, draw_count, offset)) {
+        submit_->render_queues[render_queue].render_items.emplace_back(std::move(item));
+    }
+    item = RenderItem(&submit_->arena);
+}
+
+void Renderer::dispatch(ProgramHandle program, uint group_count_x, uint group_count_y,
+                        uint group_count_z) {
+    dispatch(lastCreatedRenderQueue(), program, group_count_x, group_count_y, group_count_z);
+}
+
+void Renderer::dispatch(uint render_queue, ProgramHandle program, uint group_count_x,
+                        uint group_count_y, uint group_count_z) {
+    auto& item = submit_->pending_item;
+    if (finishComputeItem(item, program, group_count_x, group_count_y, group_count_z)) {
+        submit_->render_queues[render_queue].compute_items.emplace_back(std::move(item));
+    }
+    item = RenderItem(&submit_->arena);
+}
+
+bool Renderer::isComputeSupported() const {
+    return shared_render_context_->isComputeSupported();
+}
+
+void Renderer::prewarmPipeline(uint render_queue, ProgramHandle program, const VertexDecl& decl,
+                               const VertexDecl& instance_decl) {
+    auto& item = submit_->pending_item;
+    submitPreFrameCommand(cmd::PrewarmPipeline{program, decl, instance_decl,
+                                               submit_->render_queues[render_queue].frame_buffer,
+                                               item});
+    item = RenderItem(&submit_->arena);
 }
 
 void Renderer::submitFullscreenQuad(ProgramHandle program) {
@@ -537,7 +1499,44 @@ void Renderer::submitFullscreenQuad(uint render_queue, ProgramHandle program) {
     submit(render_queue, program, 3, 0);
 }
 
+Encoder* Renderer::beginEncoder() {
+    std::lock_guard<std::mutex> lock{encoder_mutex_};
+    if (free_encoders_.empty()) {
+        encoders_.emplace_back(new Encoder(*this));
+        return encoders_.back().get();
+    }
+    Encoder* encoder = free_encoders_.back();
+    free_encoders_.pop_back();
+    return encoder;
+}
+
+void Renderer::endEncoder(Encoder* encoder) {
+    std::lock_guard<std::mutex> lock{encoder_mutex_};
+    finished_encoders_.emplace_back(encoder);
+}
+
 bool Renderer::frame() {
+    DW_TRACE_SCOPE("Renderer::frame");
+
+    // Add items recorded by encoders to the frame being submitted.
+    mergeEncoders();
+    finishGpuScopes();
+    finishOcclusionQueries();
+    pending_commands_pre_.drain(submit_->commands_pre);
+    pending_commands_post_.drain(submit_->commands_post);
+
+    // Allow the handles of deleted resources to be reused once their delete commands have been
+    // collected by a frame.
+    vertex_buffer_handle_.recycle();
+    index_buffer_handle_.recycle();
+    indirect_buffer_handle_.recycle();
+    storage_buffer_handle_.recycle();
+    uniform_buffer_handle_.recycle();
+    program_handle_.recycle();
+    texture_handle_.recycle();
+    frame_buffer_handle_.recycle();
+    occlusion_query_handle_.recycle();
+
     // If we are rendering in multithreaded mode, wait for the render thread.
     if (use_render_thread_) {
         // If the rendering thread is doing nothing, print a warning and give up.
@@ -546,15 +1545,12 @@ bool Renderer::frame() {
             return false;
         }
 
-        // Wait for render thread.
-        shared_frame_barrier_.wait();
-
-        // Wait for frame swap, then reset swapped_frames_. This has no race here, because the
-        // render thread will not modify "swapped_frames_" again until after this thread hits the
-        // barrier.
-        std::unique_lock<std::mutex> lock{swap_mutex_};
-        swap_cv_.wait(lock, [this] { return swapped_frames_; });
-        swapped_frames_ = false;
+        // Hand the frame to the render thread, and continue with a free frame. This only waits
+        // if every other frame is queued or being rendered. If the render thread exits, it hands
+        // back every frame it hasn't rendered, so this can't wait forever.
+        submitted_frames_.push(submit_);
+        DW_TRACE_SCOPE("Renderer::waitForFreeFrame");
+        submit_ = free_frames_.pop();
     } else {
         if (is_first_frame_) {
             is_first_frame_ = false;
@@ -588,56 +1584,219 @@ Vec2i Renderer::backbufferSize() const {
     return shared_render_context_->framebufferSize();
 }
 
+void Renderer::finishRenderItem(RenderItem& item, ProgramHandle program, uint vertex_count,
+                                uint offset, uint instance_count, int base_vertex) const {
+    item.program = program;
+    item.primitive_count = vertex_count / 3;
+    item.instance_count = instance_count;
+    item.base_vertex = item.ib.has_value() ? base_vertex : 0;
+    if (vertex_count > 0) {
+        std::shared_lock<std::shared_mutex> lock{resource_mutex_};
+        if (item.ib.has_value()) {
+            IndexBufferType type = index_buffer_types_.at(*item.ib);
+            item.ib_offset += offset * (type == IndexBufferType::U16 ? sizeof(u16) : sizeof(u32));
+        } else if (item.vb.has_value()) {
+            const VertexDecl& decl = vertex_buffer_info_.at(*item.vb).decl;
+            item.vb_offset += offset * decl.stride();
+        } else {
+            logger_.error("Submitted item with no vertex or index buffer bound.");
+        }
+    }
+    item.sort_key = makeStateSortKey(item);
+}
+
+bool Renderer::finishIndirectRenderItem(RenderItem& item, ProgramHandle program,
+                                        IndirectBufferHandle handle, uint draw_count,
+                                        uint offset) const {
+    if (!item.ib.has_value()) {
+        logger_.error("Submitted indirect item with no index buffer bound.");
+        return false;
+    }
+    {
+        std::shared_lock<std::shared_mutex> lock{resource_mutex_};
+        auto size_it = indirect_buffer_sizes_.find(handle);
+        if (size_it == indirect_buffer_sizes_.end()) {
+            logger_.error("Submitted indirect item with invalid indirect buffer {}.", handle);
+            return false;
+        }
+        if (offset % 4 != 0 ||
+            offset + draw_count * sizeof(DrawIndexedIndirectCommand) > size_it->second) {
+            logger_.error("Indirect draw of {} commands at offset {} is out of range of buffer {}.",
+                          draw_count, offset, handle);
+            return false;
+        }
+    }
+    finishRenderItem(item, program, 0, 0, 1);
+    item.indirect_buffer = handle;
+    item.indirect_offset = offset;
+    item.draw_count = draw_count;
+    return true;
+}
+
+bool Renderer::finishComputeItem(RenderItem& item, ProgramHandle program, uint group_count_x,
+                                 uint group_count_y, uint group_count_z) const {
+    if (group_count_x == 0 || group_count_y == 0 || group_count_z == 0) {
+        return false;
+    }
+    item.program = program;
+    item.group_count_x = group_count_x;
+    item.group_count_y = group_count_y;
+    item.group_count_z = group_count_z;
+    return true;
+}
+
+void Renderer::mergeEncoders() {
+    std::lock_guard<std::mutex> lock{encoder_mutex_};
+    for (Encoder* encoder : finished_encoders_) {
+        for (auto& entry : encoder->items_) {
+            if (entry.first >= submit_->render_queues.size()) {
+                logger_.error("Encoder submitted to invalid render queue {}, skipping.",
+                              entry.first);
+                continue;
+            }
+            submit_->render_queues[entry.first].render_items.emplace_back(
+                std::move(entry.second));
+        }
+        for (auto& entry : encoder->compute_items_) {
+            if (entry.first >= submit_->render_queues.size()) {
+                logger_.error("Encoder dispatched to invalid render queue {}, skipping.",
+                              entry.first);
+                continue;
+            }
+            submit_->render_queues[entry.first].compute_items.emplace_back(
+                std::move(entry.second));
+        }
+        encoder->items_.clear();
+        encoder->compute_items_.clear();
+        encoder->pending_item_ = RenderItem();
+        free_encoders_.emplace_back(encoder);
+    }
+    finished_encoders_.clear();
+}
+
+void Renderer::finishGpuScopes() {
+    for (const auto& open_scope : open_gpu_scopes_) {
+        auto& queue = submit_->render_queues[open_scope.first];
+        auto& scope = queue.timing_scopes[open_scope.second];
+        logger_.warn("[GpuScope] GPU scope '{}' in render queue {} was not ended.", scope.name,
+                     open_scope.first);
+        scope.end = static_cast<uint>(queue.render_items.size());
+    }
+    open_gpu_scopes_.clear();
+    for (usize i = 0; i < submit_->render_queues.size(); ++i) {
+        auto& queue = submit_->render_queues[i];
+        if (queue.sort_mode != RenderQueue::SortMode::Sequential && !queue.timing_scopes.empty()) {
+            logger_.warn("[GpuScope] Render queue {} is sorted, so its GPU scopes are ignored.", i);
+            queue.timing_scopes.clear();
+        }
+    }
+}
+
+void Renderer::finishOcclusionQueries() {
+    std::unordered_set<OcclusionQueryHandle> written_queries;
+    for (usize i = 0; i < submit_->render_queues.size(); ++i) {
+        for (auto& item : submit_->render_queues[i].render_items) {
+            if (item.occlusion_query && !written_queries.insert(*item.occlusion_query).second) {
+                logger_.error("[OcclusionQuery] Occlusion query {} is written more than once in "
+                              "a frame, ignoring render queue {}'s write.",
+                              *item.occlusion_query, i);
+                item.occlusion_query.reset();
+            }
+        }
+    }
+}
+
 void Renderer::submitPreFrameCommand(RenderCommand command) {
-    submit_->commands_pre.emplace_back(std::move(command));
+    pending_commands_pre_.push(std::move(command));
 }
 
 void Renderer::submitPostFrameCommand(RenderCommand command) {
-    submit_->commands_post.emplace_back(std::move(command));
+    pending_commands_post_.push(std::move(command));
 }
 
 void Renderer::renderThread() {
+    Trace::setThreadName("Render");
     shared_render_context_->startRendering();
 
     while (!shared_rt_should_exit_) {
-        // Skip rendering first frame (as this will be a no-op, but causes a crash as transient
-        // buffers are not created yet).
-        if (is_first_frame_) {
-            is_first_frame_ = false;
-        } else {
-            if (!renderFrame(render_)) {
-                shared_rt_should_exit_ = true;
-            }
-        }
-
-        // Wait for submit thread.
-        shared_frame_barrier_.wait();
-
-        // Swap command buffers and unblock submit thread.
+        // Wait for the submit thread to hand over a frame.
+        Frame* frame;
         {
-            std::lock_guard<std::mutex> lock{swap_mutex_};
-            std::swap(submit_, render_);
-            swapped_frames_ = true;
-
-            // If the render loop has been marked for termination, update the "RT finished" marker.
-            if (shared_rt_should_exit_) {
-                shared_rt_finished_ = true;
-            }
+            DW_TRACE_SCOPE("Renderer::waitForSubmittedFrame");
+            frame = submitted_frames_.pop();
+        }
+        if (!frame) {
+            break;
+        }
+        if (!renderFrame(frame)) {
+            shared_rt_should_exit_ = true;
+            frame->clear();
         }
-        swap_cv_.notify_all();
+        free_frames_.push(frame);
+    }
+
+    // Hand back the frames which won't be rendered. The submit thread checks shared_rt_finished_
+    // before handing over another frame, so at most one more frame can be queued after this, and
+    // free_frames_ is never empty by then.
+    shared_rt_finished_ = true;
+    while (Frame* frame = submitted_frames_.tryPop()) {
+        frame->clear();
+        free_frames_.push(frame);
     }
 
     shared_render_context_->stopRendering();
 }
 
 bool Renderer::renderFrame(Frame* frame) {
+    DW_TRACE_SCOPE("Renderer::renderFrame");
+
+    // Sort render items.
+    {
+        DW_TRACE_SCOPE("Renderer::sortRenderQueues");
+        for (auto& queue : frame->render_queues) {
+            sortRenderQueue(queue);
+        }
+    }
+
+    // Capture the frame before its commands are applied to the live resources, so that the capture
+    // starts from the resources which existed before the frame.
+    if (resource_journal_) {
+        if (frame->capture_path) {
+            auto result =
+                writeFrameCapture(*frame->capture_path, rendererType(), width_, height_,
+                                  resource_journal_->commands(), *frame);
+            if (result) {
+                logger_.info("[FrameCapture] Captured frame to {}.", *frame->capture_path);
+            } else {
+                logger_.error("[FrameCapture] Failed to capture frame to {}: {}",
+                              *frame->capture_path, result.error());
+            }
+        }
+        resource_journal_->record(frame->commands_pre);
+        resource_journal_->record(frame->commands_post);
+    }
+
     // Hand off commands to the render context.
-    shared_render_context_->prepareFrame();
-    shared_render_context_->processCommandList(frame->commands_pre);
-    if (!shared_render_context_->frame(frame)) {
-        return false;
+    shared_render_context_->beginFrameStats();
+    {
+        DW_TRACE_SCOPE("RenderContext::prepareFrame");
+        shared_render_context_->prepareFrame();
+    }
+    {
+        DW_TRACE_SCOPE("RenderContext::processCommandList (pre-frame)");
+        shared_render_context_->processCommandList(frame->commands_pre);
+    }
+    {
+        DW_TRACE_SCOPE("RenderContext::frame");
+        if (!shared_render_context_->frame(frame)) {
+            return false;
+        }
+    }
+    {
+        DW_TRACE_SCOPE("RenderContext::processCommandList (post-frame)");
+        shared_render_context_->processCommandList(frame->commands_post);
     }
-    shared_render_context_->processCommandList(frame->commands_post);
+    shared_render_context_->endFrameStats(frame);
 
     // Clear the frame state.
     frame->clear();
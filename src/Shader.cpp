@@ -4,6 +4,13 @@
  */
 #include "Shader.h"
 #include "Glslang.h"
+#include "ContentHash.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <mutex>
+#include <optional>
+#include <thread>
 
 namespace {
 class GlslangInitialiser {
@@ -123,13 +130,54 @@ constexpr TBuiltInResource kDefaultTBuiltInResource = {
         /* .generalVariableIndexing = */ 1,
         /* .generalConstantMatrixVectorIndexing = */ 1,
     }};
+
+// Bump this whenever the compiler options below change, to invalidate cached SPIR-V.
+constexpr dw::gfx::u64 kShaderCacheKeyVersion = 1;
+
+// Serialises everything which affects the output of compileGLSL. The cache key is a hash of this,
+// and cached entries store it to detect key collisions.
+std::string shaderCacheKeyData(dw::gfx::ShaderStage stage, const std::string& glsl_source,
+                               const std::vector<std::string>& compile_definitions) {
+    std::string key_data;
+    auto add = [&key_data](const auto& value) {
+        key_data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    auto add_string = [&key_data, &add](const std::string& value) {
+        // Include the length, so that consecutive strings can't alias each other.
+        add(static_cast<dw::gfx::u64>(value.size()));
+        key_data.append(value);
+    };
+    add(kShaderCacheKeyVersion);
+    add(static_cast<dw::gfx::u32>(glslang::GetSpirvGeneratorVersion()));
+    add(static_cast<dw::gfx::u32>(stage));
+    add_string(glsl_source);
+    add(static_cast<dw::gfx::u64>(compile_definitions.size()));
+    for (const auto& define : compile_definitions) {
+        add_string(define);
+    }
+    return key_data;
+}
 }  // namespace
 
 namespace dw {
 namespace gfx {
 Result<ShaderStageInfo, ShaderCompileError> compileGLSL(
     ShaderStage stage, const std::string& glsl_source,
-    const std::vector<std::string>& compile_definitions) {
+    const std::vector<std::string>& compile_definitions, ShaderCache* cache) {
+    u64 cache_key = 0;
+    std::string cache_key_data;
+    if (cache) {
+        cache_key_data = shaderCacheKeyData(stage, glsl_source, compile_definitions);
+        ContentHash key;
+        key.add(cache_key_data);
+        cache_key = key.hash();
+        auto cached = cache->find(cache_key, cache_key_data);
+        if (cached) {
+            return Result<ShaderStageInfo, ShaderCompileError>(
+                ShaderStageInfo{stage, std::move(cached->entry_point), std::move(cached->spirv)});
+        }
+    }
+
     EShLanguage esh_stage;
     switch (stage) {
         case ShaderStage::Vertex:
@@ -141,6 +189,9 @@ Result<ShaderStageInfo, ShaderCompileError> compileGLSL(
         case ShaderStage::Fragment:
             esh_stage = EShLangFragment;
             break;
+        case ShaderStage::Compute:
+            esh_stage = EShLangCompute;
+            break;
         default:
             return Error(
                 ShaderCompileError{fmt::format("Unexpected shader stage {}", esh_stage), ""});
@@ -197,8 +248,39 @@ Result<ShaderStageInfo, ShaderCompileError> compileGLSL(
     spv_version.spv = 0x10000;
     intermediate.setSpv(spv_version);
     glslang::GlslangToSpv(*program.getIntermediate(esh_stage), spirv_out);
+    Memory spirv{std::move(spirv_out)};
+    if (cache) {
+        cache->insert(cache_key, ShaderCache::Entry{std::move(cache_key_data),
+                                                    intermediate.getEntryPointName(), spirv});
+    }
     return Result<ShaderStageInfo, ShaderCompileError>(
-        ShaderStageInfo{stage, intermediate.getEntryPointName(), Memory(std::move(spirv_out))});
+        ShaderStageInfo{stage, intermediate.getEntryPointName(), std::move(spirv)});
+}
+
+std::vector<Result<ShaderStageInfo, ShaderCompileError>> compileGLSLBatch(
+    const std::vector<GLSLCompileJob>& jobs, ShaderCache* cache) {
+    // glslang keeps its state per thread (after process initialisation), so each job can be
+    // compiled independently.
+    std::vector<std::optional<Result<ShaderStageInfo, ShaderCompileError>>> results(jobs.size());
+    if (!jobs.empty()) {
+        // The pool is created on first use and shared by every batch, so that its threads aren't
+        // started and joined each call. run() can only be called by one thread at a time.
+        static WorkerPool worker_pool{std::max(1u, std::thread::hardware_concurrency())};
+        static std::mutex worker_pool_mutex;
+        std::lock_guard<std::mutex> lock{worker_pool_mutex};
+        worker_pool.run(jobs.size(), [&jobs, &results, cache](usize, usize job_index) {
+            const auto& job = jobs[job_index];
+            results[job_index].emplace(
+                compileGLSL(job.stage, job.glsl_source, job.compile_definitions, cache));
+        });
+    }
+
+    std::vector<Result<ShaderStageInfo, ShaderCompileError>> output;
+    output.reserve(results.size());
+    for (auto& result : results) {
+        output.emplace_back(std::move(*result));
+    }
+    return output;
 }
 }  // namespace gfx
 }  // namespace dw
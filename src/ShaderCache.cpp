@@ -0,0 +1,185 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "ShaderCache.h"
+#include "MappedFile.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace dw {
+namespace gfx {
+namespace {
+// Pack file layout: a header, followed by a table of entries, followed by the key data, entry
+// point names and SPIR-V blobs (aligned to 4 bytes) that the entries refer to. Offsets are
+// relative to the start of the file.
+constexpr u32 kPackMagic = 0x43535744;  // "DWSC"
+constexpr u32 kPackVersion = 2;
+
+struct PackHeader {
+    u32 magic;
+    u32 version;
+    u32 entry_count;
+    u32 reserved;
+};
+
+struct PackEntry {
+    u64 key;
+    u32 key_data_offset;
+    u32 key_data_size;
+    u32 entry_point_offset;
+    u32 entry_point_size;
+    u32 spirv_offset;
+    u32 spirv_size;
+};
+
+u32 alignUp(u32 value, u32 alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+}  // namespace
+
+ShaderCache::ShaderCache() : dirty_{false} {
+}
+
+ShaderCache::~ShaderCache() = default;
+
+bool ShaderCache::load(const std::string& path) {
+    auto file = std::make_shared<MappedFile>(path);
+    if (file->size() < sizeof(PackHeader)) {
+        return false;
+    }
+
+    PackHeader header;
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (header.magic != kPackMagic || header.version != kPackVersion ||
+        file->size() < sizeof(PackHeader) + header.entry_count * sizeof(PackEntry)) {
+        return false;
+    }
+
+    // Parse into a separate map so that a truncated or corrupt file leaves the cache untouched.
+    std::unordered_map<u64, Entry> loaded_entries;
+    for (u32 i = 0; i < header.entry_count; ++i) {
+        PackEntry pack_entry;
+        std::memcpy(&pack_entry, file->data() + sizeof(PackHeader) + i * sizeof(PackEntry),
+                    sizeof(pack_entry));
+        if (static_cast<usize>(pack_entry.key_data_offset) + pack_entry.key_data_size >
+                file->size() ||
+            static_cast<usize>(pack_entry.entry_point_offset) + pack_entry.entry_point_size >
+                file->size() ||
+            static_cast<usize>(pack_entry.spirv_offset) + pack_entry.spirv_size > file->size()) {
+            return false;
+        }
+
+        // The SPIR-V memory refers to the mapped file, and keeps it alive.
+        Entry entry;
+        entry.key_data.assign(
+            reinterpret_cast<const char*>(file->data() + pack_entry.key_data_offset),
+            pack_entry.key_data_size);
+        entry.entry_point.assign(
+            reinterpret_cast<const char*>(file->data() + pack_entry.entry_point_offset),
+            pack_entry.entry_point_size);
+        entry.spirv =
+            Memory(file->data() + pack_entry.spirv_offset, pack_entry.spirv_size, [file](byte*) {});
+        loaded_entries[pack_entry.key] = std::move(entry);
+    }
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (entries_.empty()) {
+        entries_.swap(loaded_entries);
+    } else {
+        for (auto& loaded_entry : loaded_entries) {
+            entries_[loaded_entry.first] = std::move(loaded_entry.second);
+        }
+    }
+    return true;
+}
+
+bool ShaderCache::save(const std::string& path) const {
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    // Lay out the data section after the entry table.
+    std::vector<PackEntry> pack_entries;
+    pack_entries.reserve(entries_.size());
+    u32 offset = static_cast<u32>(sizeof(PackHeader) + entries_.size() * sizeof(PackEntry));
+    for (const auto& entry : entries_) {
+        PackEntry pack_entry;
+        pack_entry.key = entry.first;
+        pack_entry.key_data_offset = offset;
+        pack_entry.key_data_size = static_cast<u32>(entry.second.key_data.size());
+        offset += pack_entry.key_data_size;
+        pack_entry.entry_point_offset = offset;
+        pack_entry.entry_point_size = static_cast<u32>(entry.second.entry_point.size());
+        offset = alignUp(offset + pack_entry.entry_point_size, 4);
+        pack_entry.spirv_offset = offset;
+        pack_entry.spirv_size = static_cast<u32>(entry.second.spirv.size());
+        offset += pack_entry.spirv_size;
+        pack_entries.push_back(pack_entry);
+    }
+
+    // Loaded entries may refer to a mapping of the file at 'path', so it can't be truncated while
+    // they're written. Write a new file and rename it over the old one instead.
+    std::string temp_path = path + ".tmp";
+    std::ofstream file{temp_path, std::ios::binary | std::ios::trunc};
+    if (!file) {
+        return false;
+    }
+    PackHeader header{kPackMagic, kPackVersion, static_cast<u32>(pack_entries.size()), 0};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(pack_entries.data()),
+               pack_entries.size() * sizeof(PackEntry));
+    const char padding[4] = {};
+    for (const auto& pack_entry : pack_entries) {
+        const Entry& entry = entries_.at(pack_entry.key);
+        file.write(entry.key_data.data(), pack_entry.key_data_size);
+        file.write(entry.entry_point.data(), pack_entry.entry_point_size);
+        file.write(padding, pack_entry.spirv_offset -
+                                (pack_entry.entry_point_offset + pack_entry.entry_point_size));
+        file.write(reinterpret_cast<const char*>(entry.spirv.data()), pack_entry.spirv_size);
+    }
+    file.close();
+    if (!file) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    // rename() doesn't replace existing files on Windows. Loaded files are read into memory there
+    // rather than mapped, so the old file can be removed first.
+    std::remove(path.c_str());
+#endif
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    dirty_ = false;
+    return true;
+}
+
+std::optional<ShaderCache::Entry> ShaderCache::find(u64 key, const std::string& key_data) const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    auto it = entries_.find(key);
+    if (it == entries_.end() || it->second.key_data != key_data) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+void ShaderCache::insert(u64 key, Entry entry) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    entries_[key] = std::move(entry);
+    dirty_ = true;
+}
+
+usize ShaderCache::size() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return entries_.size();
+}
+
+bool ShaderCache::dirty() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return dirty_;
+}
+}  // namespace gfx
+}  // namespace dw
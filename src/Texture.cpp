@@ -0,0 +1,457 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "Texture.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
+
+namespace dw {
+namespace gfx {
+namespace {
+// clang-format off
+const std::array<TextureFormatInfo, usize(TextureFormat::Count)> kTextureFormatInfo = {{
+    {1, 1, 1,  false}, // A8
+    {1, 1, 1,  false}, // R8
+    {1, 1, 1,  false}, // R8I
+    {1, 1, 1,  false}, // R8U
+    {1, 1, 1,  false}, // R8S
+    {1, 1, 2,  false}, // R16
+    {1, 1, 2,  false}, // R16I
+    {1, 1, 2,  false}, // R16U
+    {1, 1, 2,  false}, // R16F
+    {1, 1, 2,  false}, // R16S
+    {1, 1, 4,  false}, // R32I
+    {1, 1, 4,  false}, // R32U
+    {1, 1, 4,  false}, // R32F
+    {1, 1, 2,  false}, // RG8
+    {1, 1, 2,  false}, // RG8I
+    {1, 1, 2,  false}, // RG8U
+    {1, 1, 2,  false}, // RG8S
+    {1, 1, 4,  false}, // RG16
+    {1, 1, 4,  false}, // RG16I
+    {1, 1, 4,  false}, // RG16U
+    {1, 1, 4,  false}, // RG16F
+    {1, 1, 4,  false}, // RG16S
+    {1, 1, 8,  false}, // RG32I
+    {1, 1, 8,  false}, // RG32U
+    {1, 1, 8,  false}, // RG32F
+    {1, 1, 3,  false}, // RGB8
+    {1, 1, 3,  false}, // RGB8I
+    {1, 1, 3,  false}, // RGB8U
+    {1, 1, 3,  false}, // RGB8S
+    {1, 1, 4,  false}, // BGRA8
+    {1, 1, 4,  false}, // RGBA8
+    {1, 1, 4,  false}, // RGBA8I
+    {1, 1, 4,  false}, // RGBA8U
+    {1, 1, 4,  false}, // RGBA8S
+    {1, 1, 8,  false}, // RGBA16
+    {1, 1, 8,  false}, // RGBA16I
+    {1, 1, 8,  false}, // RGBA16U
+    {1, 1, 8,  false}, // RGBA16F
+    {1, 1, 8,  false}, // RGBA16S
+    {1, 1, 16, false}, // RGBA32I
+    {1, 1, 16, false}, // RGBA32U
+    {1, 1, 16, false}, // RGBA32F
+    {4, 4, 8,  true }, // BC1
+    {4, 4, 16, true }, // BC2
+    {4, 4, 16, true }, // BC3
+    {4, 4, 8,  true }, // BC4
+    {4, 4, 16, true }, // BC5
+    {4, 4, 16, true }, // BC6H
+    {4, 4, 16, true }, // BC7
+    {4, 4, 8,  true }, // ETC2
+    {4, 4, 16, true }, // ETC2A
+    {4, 4, 16, true }, // ASTC4x4
+    {6, 6, 16, true }, // ASTC6x6
+    {8, 8, 16, true }, // ASTC8x8
+    {1, 1, 2,  false}, // D16
+    {1, 1, 4,  false}, // D24
+    {1, 1, 4,  false}, // D24S8
+    {1, 1, 4,  false}, // D32
+    {1, 1, 4,  false}, // D16F
+    {1, 1, 4,  false}, // D24F
+    {1, 1, 4,  false}, // D32F
+    {1, 1, 1,  false}, // D0S8
+}};
+// clang-format on
+static_assert(static_cast<int>(TextureFormat::Count) ==
+                  sizeof(kTextureFormatInfo) / sizeof(kTextureFormatInfo[0]),
+              "Texture format info mismatch.");
+
+struct FormatMapping {
+    u32 file_format;
+    TextureFormat format;
+    bool srgb;
+};
+
+// VkFormat values used by KTX2 files.
+// clang-format off
+const FormatMapping kKtx2FormatMap[] = {
+    {9,   TextureFormat::R8,      false}, // VK_FORMAT_R8_UNORM
+    {15,  TextureFormat::R8,      true }, // VK_FORMAT_R8_SRGB
+    {16,  TextureFormat::RG8,     false}, // VK_FORMAT_R8G8_UNORM
+    {37,  TextureFormat::RGBA8,   false}, // VK_FORMAT_R8G8B8A8_UNORM
+    {43,  TextureFormat::RGBA8,   true }, // VK_FORMAT_R8G8B8A8_SRGB
+    {44,  TextureFormat::BGRA8,   false}, // VK_FORMAT_B8G8R8A8_UNORM
+    {50,  TextureFormat::BGRA8,   true }, // VK_FORMAT_B8G8R8A8_SRGB
+    {76,  TextureFormat::R16F,    false}, // VK_FORMAT_R16_SFLOAT
+    {83,  TextureFormat::RG16F,   false}, // VK_FORMAT_R16G16_SFLOAT
+    {97,  TextureFormat::RGBA16F, false}, // VK_FORMAT_R16G16B16A16_SFLOAT
+    {100, TextureFormat::R32F,    false}, // VK_FORMAT_R32_SFLOAT
+    {103, TextureFormat::RG32F,   false}, // VK_FORMAT_R32G32_SFLOAT
+    {109, TextureFormat::RGBA32F, false}, // VK_FORMAT_R32G32B32A32_SFLOAT
+    {131, TextureFormat::BC1,     false}, // VK_FORMAT_BC1_RGB_UNORM_BLOCK
+    {132, TextureFormat::BC1,     true }, // VK_FORMAT_BC1_RGB_SRGB_BLOCK
+    {133, TextureFormat::BC1,     false}, // VK_FORMAT_BC1_RGBA_UNORM_BLOCK
+    {134, TextureFormat::BC1,     true }, // VK_FORMAT_BC1_RGBA_SRGB_BLOCK
+    {135, TextureFormat::BC2,     false}, // VK_FORMAT_BC2_UNORM_BLOCK
+    {136, TextureFormat::BC2,     true }, // VK_FORMAT_BC2_SRGB_BLOCK
+    {137, TextureFormat::BC3,     false}, // VK_FORMAT_BC3_UNORM_BLOCK
+    {138, TextureFormat::BC3,     true }, // VK_FORMAT_BC3_SRGB_BLOCK
+    {139, TextureFormat::BC4,     false}, // VK_FORMAT_BC4_UNORM_BLOCK
+    {141, TextureFormat::BC5,     false}, // VK_FORMAT_BC5_UNORM_BLOCK
+    {143, TextureFormat::BC6H,    false}, // VK_FORMAT_BC6H_UFLOAT_BLOCK
+    {145, TextureFormat::BC7,     false}, // VK_FORMAT_BC7_UNORM_BLOCK
+    {146, TextureFormat::BC7,     true }, // VK_FORMAT_BC7_SRGB_BLOCK
+    {147, TextureFormat::ETC2,    false}, // VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK
+    {148, TextureFormat::ETC2,    true }, // VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK
+    {151, TextureFormat::ETC2A,   false}, // VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK
+    {152, TextureFormat::ETC2A,   true }, // VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK
+    {157, TextureFormat::ASTC4x4, false}, // VK_FORMAT_ASTC_4x4_UNORM_BLOCK
+    {158, TextureFormat::ASTC4x4, true }, // VK_FORMAT_ASTC_4x4_SRGB_BLOCK
+    {165, TextureFormat::ASTC6x6, false}, // VK_FORMAT_ASTC_6x6_UNORM_BLOCK
+    {166, TextureFormat::ASTC6x6, true }, // VK_FORMAT_ASTC_6x6_SRGB_BLOCK
+    {171, TextureFormat::ASTC8x8, false}, // VK_FORMAT_ASTC_8x8_UNORM_BLOCK
+    {172, TextureFormat::ASTC8x8, true }, // VK_FORMAT_ASTC_8x8_SRGB_BLOCK
+};
+
+// DXGI_FORMAT values used by DDS files with a DX10 header.
+const FormatMapping kDxgiFormatMap[] = {
+    {2,  TextureFormat::RGBA32F, false}, // DXGI_FORMAT_R32G32B32A32_FLOAT
+    {10, TextureFormat::RGBA16F, false}, // DXGI_FORMAT_R16G16B16A16_FLOAT
+    {28, TextureFormat::RGBA8,   false}, // DXGI_FORMAT_R8G8B8A8_UNORM
+    {29, TextureFormat::RGBA8,   true }, // DXGI_FORMAT_R8G8B8A8_UNORM_SRGB
+    {71, TextureFormat::BC1,     false}, // DXGI_FORMAT_BC1_UNORM
+    {72, TextureFormat::BC1,     true }, // DXGI_FORMAT_BC1_UNORM_SRGB
+    {74, TextureFormat::BC2,     false}, // DXGI_FORMAT_BC2_UNORM
+    {75, TextureFormat::BC2,     true }, // DXGI_FORMAT_BC2_UNORM_SRGB
+    {77, TextureFormat::BC3,     false}, // DXGI_FORMAT_BC3_UNORM
+    {78, TextureFormat::BC3,     true }, // DXGI_FORMAT_BC3_UNORM_SRGB
+    {80, TextureFormat::BC4,     false}, // DXGI_FORMAT_BC4_UNORM
+    {83, TextureFormat::BC5,     false}, // DXGI_FORMAT_BC5_UNORM
+    {87, TextureFormat::BGRA8,   false}, // DXGI_FORMAT_B8G8R8A8_UNORM
+    {91, TextureFormat::BGRA8,   true }, // DXGI_FORMAT_B8G8R8A8_UNORM_SRGB
+    {95, TextureFormat::BC6H,    false}, // DXGI_FORMAT_BC6H_UF16
+    {98, TextureFormat::BC7,     false}, // DXGI_FORMAT_BC7_UNORM
+    {99, TextureFormat::BC7,     true }, // DXGI_FORMAT_BC7_UNORM_SRGB
+};
+// clang-format on
+
+template <usize N>
+const FormatMapping* findFormat(const FormatMapping (&map)[N], u32 file_format) {
+    auto it = std::find_if(map, map + N,
+                           [file_format](const auto& m) { return m.file_format == file_format; });
+    return it != map + N ? it : nullptr;
+}
+
+constexpr u32 makeFourCC(char a, char b, char c, char d) {
+    return u32(u8(a)) | (u32(u8(b)) << 8) | (u32(u8(c)) << 16) | (u32(u8(d)) << 24);
+}
+
+const u8 kKtx2Identifier[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32,
+                                0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+
+struct Ktx2Header {
+    u8 identifier[12];
+    u32 vk_format;
+    u32 type_size;
+    u32 pixel_width;
+    u32 pixel_height;
+    u32 pixel_depth;
+    u32 layer_count;
+    u32 face_count;
+    u32 level_count;
+    u32 supercompression_scheme;
+    u32 dfd_byte_offset;
+    u32 dfd_byte_length;
+    u32 kvd_byte_offset;
+    u32 kvd_byte_length;
+    u64 sgd_byte_offset;
+    u64 sgd_byte_length;
+};
+static_assert(sizeof(Ktx2Header) == 80, "Unexpected KTX2 header size.");
+
+struct Ktx2Level {
+    u64 byte_offset;
+    u64 byte_length;
+    u64 uncompressed_byte_length;
+};
+
+struct DdsPixelFormat {
+    u32 size;
+    u32 flags;
+    u32 four_cc;
+    u32 rgb_bit_count;
+    u32 r_bit_mask;
+    u32 g_bit_mask;
+    u32 b_bit_mask;
+    u32 a_bit_mask;
+};
+
+struct DdsHeader {
+    u32 magic;
+    u32 size;
+    u32 flags;
+    u32 height;
+    u32 width;
+    u32 pitch_or_linear_size;
+    u32 depth;
+    u32 mip_map_count;
+    u32 reserved1[11];
+    DdsPixelFormat pixel_format;
+    u32 caps;
+    u32 caps2;
+    u32 caps3;
+    u32 caps4;
+    u32 reserved2;
+};
+static_assert(sizeof(DdsHeader) == 128, "Unexpected DDS header size.");
+
+struct DdsHeaderDx10 {
+    u32 dxgi_format;
+    u32 resource_dimension;
+    u32 misc_flag;
+    u32 array_size;
+    u32 misc_flags2;
+};
+
+constexpr u32 kDdsMagic = makeFourCC('D', 'D', 'S', ' ');
+constexpr u32 kDdsPixelFormatFourCC = 0x4;
+constexpr u32 kDdsPixelFormatRGB = 0x40;
+constexpr u32 kDdsCaps2CubeMap = 0x200;
+constexpr u32 kDdsCaps2Volume = 0x200000;
+constexpr u32 kDxgiResourceDimensionTexture2D = 3;
+
+// Location of each mip level within a file.
+struct ParsedTexture {
+    u32 width;
+    u32 height;
+    TextureFormat format;
+    bool srgb;
+    std::vector<std::pair<usize, usize>> levels;
+};
+
+Result<ParsedTexture, std::string> finishParse(ParsedTexture parsed, usize file_size) {
+    if (parsed.width == 0 || parsed.height == 0 || parsed.width > 0xFFFF ||
+        parsed.height > 0xFFFF) {
+        return Error(fmt::format("Unsupported texture size {}x{}.", parsed.width, parsed.height));
+    }
+    if (parsed.levels.size() > textureMipCount(parsed.width, parsed.height)) {
+        return Error(fmt::format("Texture has too many mip levels ({}).", parsed.levels.size()));
+    }
+    for (u32 i = 0; i < parsed.levels.size(); ++i) {
+        const auto& level = parsed.levels[i];
+        usize expected_size =
+            textureLevelSize(parsed.format, parsed.width >> i, parsed.height >> i);
+        if (level.second != expected_size) {
+            return Error(fmt::format("Mip level {} has size {}, expected {}.", i, level.second,
+                                     expected_size));
+        }
+        if (level.first > file_size || level.second > file_size - level.first) {
+            return Error(fmt::format("Mip level {} is out of bounds.", i));
+        }
+    }
+    return Result<ParsedTexture, std::string>(std::move(parsed));
+}
+
+Result<ParsedTexture, std::string> parseKtx2(const byte* data, usize size) {
+    Ktx2Header header;
+    if (size < sizeof(header)) {
+        return Error(std::string{"KTX2 file is truncated."});
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (header.supercompression_scheme != 0) {
+        return Error(fmt::format("KTX2 supercompression scheme {} is not supported.",
+                                 header.supercompression_scheme));
+    }
+    if (header.pixel_depth > 1 || header.layer_count > 1 || header.face_count != 1) {
+        return Error(std::string{"Only 2D KTX2 textures are supported."});
+    }
+    const FormatMapping* mapping = findFormat(kKtx2FormatMap, header.vk_format);
+    if (!mapping) {
+        return Error(fmt::format("KTX2 format {} is not supported.", header.vk_format));
+    }
+
+    // A level count of 0 means that mips should be generated at load time.
+    u32 level_count = std::max(header.level_count, 1u);
+    if (sizeof(header) + level_count * sizeof(Ktx2Level) > size) {
+        return Error(std::string{"KTX2 file is truncated."});
+    }
+    ParsedTexture parsed{header.pixel_width, header.pixel_height, mapping->format, mapping->srgb,
+                         {}};
+    for (u32 i = 0; i < level_count; ++i) {
+        Ktx2Level level;
+        std::memcpy(&level, data + sizeof(header) + i * sizeof(Ktx2Level), sizeof(level));
+        parsed.levels.emplace_back(static_cast<usize>(level.byte_offset),
+                                   static_cast<usize>(level.byte_length));
+    }
+    return finishParse(std::move(parsed), size);
+}
+
+Result<ParsedTexture, std::string> parseDds(const byte* data, usize size) {
+    DdsHeader header;
+    if (size < sizeof(header)) {
+        return Error(std::string{"DDS file is truncated."});
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if ((header.caps2 & (kDdsCaps2CubeMap | kDdsCaps2Volume)) != 0) {
+        return Error(std::string{"Only 2D DDS textures are supported."});
+    }
+
+    ParsedTexture parsed{header.width, header.height, TextureFormat::RGBA8, false, {}};
+    usize data_offset = sizeof(header);
+    const DdsPixelFormat& pf = header.pixel_format;
+    if ((pf.flags & kDdsPixelFormatFourCC) && pf.four_cc == makeFourCC('D', 'X', '1', '0')) {
+        DdsHeaderDx10 dx10_header;
+        if (size < sizeof(header) + sizeof(dx10_header)) {
+            return Error(std::string{"DDS file is truncated."});
+        }
+        std::memcpy(&dx10_header, data + sizeof(header), sizeof(dx10_header));
+        data_offset += sizeof(dx10_header);
+        if (dx10_header.resource_dimension != kDxgiResourceDimensionTexture2D ||
+            dx10_header.array_size > 1) {
+            return Error(std::string{"Only 2D DDS textures are supported."});
+        }
+        const FormatMapping* mapping = findFormat(kDxgiFormatMap, dx10_header.dxgi_format);
+        if (!mapping) {
+            return Error(fmt::format("DXGI format {} is not supported.", dx10_header.dxgi_format));
+        }
+        parsed.format = mapping->format;
+        parsed.srgb = mapping->srgb;
+    } else if (pf.flags & kDdsPixelFormatFourCC) {
+        switch (pf.four_cc) {
+            case makeFourCC('D', 'X', 'T', '1'):
+                parsed.format = TextureFormat::BC1;
+                break;
+            case makeFourCC('D', 'X', 'T', '3'):
+                parsed.format = TextureFormat::BC2;
+                break;
+            case makeFourCC('D', 'X', 'T', '5'):
+                parsed.format = TextureFormat::BC3;
+                break;
+            case makeFourCC('A', 'T', 'I', '1'):
+            case makeFourCC('B', 'C', '4', 'U'):
+                parsed.format = TextureFormat::BC4;
+                break;
+            case makeFourCC('A', 'T', 'I', '2'):
+            case makeFourCC('B', 'C', '5', 'U'):
+                parsed.format = TextureFormat::BC5;
+                break;
+            default:
+                return Error(fmt::format("DDS FourCC {:#x} is not supported.", pf.four_cc));
+        }
+    } else if ((pf.flags & kDdsPixelFormatRGB) && pf.rgb_bit_count == 32 &&
+               pf.r_bit_mask == 0x000000FF) {
+        parsed.format = TextureFormat::RGBA8;
+    } else if ((pf.flags & kDdsPixelFormatRGB) && pf.rgb_bit_count == 32 &&
+               pf.r_bit_mask == 0x00FF0000) {
+        parsed.format = TextureFormat::BGRA8;
+    } else {
+        return Error(std::string{"DDS pixel format is not supported."});
+    }
+
+    // Mip levels are stored contiguously after the headers.
+    u32 level_count = std::min(std::max(header.mip_map_count, 1u),
+                               textureMipCount(parsed.width, parsed.height));
+    for (u32 i = 0; i < level_count; ++i) {
+        usize level_size = textureLevelSize(parsed.format, parsed.width >> i, parsed.height >> i);
+        parsed.levels.emplace_back(data_offset, level_size);
+        data_offset += level_size;
+    }
+    return finishParse(std::move(parsed), size);
+}
+
+Result<ParsedTexture, std::string> parseTexture(const byte* data, usize size) {
+    if (size >= sizeof(kKtx2Identifier) &&
+        std::memcmp(data, kKtx2Identifier, sizeof(kKtx2Identifier)) == 0) {
+        return parseKtx2(data, size);
+    }
+    u32 magic = 0;
+    if (size >= sizeof(magic)) {
+        std::memcpy(&magic, data, sizeof(magic));
+    }
+    if (magic == kDdsMagic) {
+        return parseDds(data, size);
+    }
+    return Error(std::string{"Unrecognised texture file format."});
+}
+
+// Builds a texture from a parsed file. Each mip level is a view into the file data, which is kept
+// alive by the holder captured in each level's deleter.
+template <typename Holder>
+LoadedTexture makeLoadedTexture(const ParsedTexture& parsed, byte* data, Holder holder) {
+    LoadedTexture texture{static_cast<u16>(parsed.width), static_cast<u16>(parsed.height),
+                          parsed.format, parsed.srgb, {}};
+    texture.mip_levels.reserve(parsed.levels.size());
+    for (const auto& level : parsed.levels) {
+        texture.mip_levels.emplace_back(data + level.first, level.second, [holder](byte*) {});
+    }
+    return texture;
+}
+}  // namespace
+
+TextureFormatInfo textureFormatInfo(TextureFormat format) {
+    return kTextureFormatInfo[static_cast<usize>(format)];
+}
+
+usize textureLevelSize(TextureFormat format, u32 width, u32 height) {
+    const TextureFormatInfo& info = kTextureFormatInfo[static_cast<usize>(format)];
+    usize blocks_x = (std::max(width, 1u) + info.block_width - 1) / info.block_width;
+    usize blocks_y = (std::max(height, 1u) + info.block_height - 1) / info.block_height;
+    return blocks_x * blocks_y * info.block_size;
+}
+
+u32 textureMipCount(u32 width, u32 height) {
+    u32 count = 1;
+    for (u32 size = std::max(width, height); size > 1; size >>= 1) {
+        ++count;
+    }
+    return count;
+}
+
+usize textureLevelsSize(TextureFormat format, u32 width, u32 height, u32 first_level,
+                        u32 level_count) {
+    usize size = 0;
+    for (u32 level = first_level; level < first_level + level_count; ++level) {
+        size += textureLevelSize(format, width >> level, height >> level);
+    }
+    return size;
+}
+
+Result<LoadedTexture, std::string> loadTexture(const std::string& path) {
+    auto file = std::make_shared<MappedFile>(path);
+    if (!file->data()) {
+        return Error(fmt::format("Unable to read texture file {}.", path));
+    }
+    auto parsed = parseTexture(file->data(), file->size());
+    if (!parsed) {
+        return Error(fmt::format("{}: {}", path, parsed.error()));
+    }
+    return Result<LoadedTexture, std::string>(makeLoadedTexture(*parsed, file->data(), file));
+}
+
+Result<LoadedTexture, std::string> loadTexture(Memory file_data) {
+    auto parsed = parseTexture(file_data.data(), file_data.size());
+    if (!parsed) {
+        return Error(parsed.error());
+    }
+    return Result<LoadedTexture, std::string>(
+        makeLoadedTexture(*parsed, file_data.data(), file_data));
+}
+}  // namespace gfx
+}  // namespace dw
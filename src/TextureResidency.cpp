@@ -0,0 +1,249 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "TextureResidency.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <queue>
+#include <utility>
+
+namespace dw {
+namespace gfx {
+namespace {
+// Textures which haven't been requested for this many updates are reduced to their smallest
+// level. This keeps textures which are briefly hidden (or culled) from streaming out and in again.
+constexpr uint kRequestExpiryFrames = 30;
+}  // namespace
+
+TextureResidency::TextureResidency(Renderer& r, usize budget_bytes)
+    : r_(r), budget_bytes_(budget_bytes), max_upload_bytes_per_frame_(0) {
+}
+
+TextureResidency::~TextureResidency() {
+    for (auto& texture : textures_) {
+        if (texture.live) {
+            r_.deleteTexture(texture.texture);
+        }
+    }
+}
+
+void TextureResidency::setBudget(usize budget_bytes) {
+    budget_bytes_ = budget_bytes;
+}
+
+void TextureResidency::setMaxUploadBytesPerFrame(usize bytes) {
+    max_upload_bytes_per_frame_ = bytes;
+}
+
+StreamedTextureHandle TextureResidency::add(u16 width, u16 height, TextureFormat format,
+                                            std::vector<Memory> mip_levels) {
+    assert(!mip_levels.empty());
+    u32 index;
+    if (!free_indices_.empty()) {
+        index = free_indices_.back();
+        free_indices_.pop_back();
+    } else {
+        index = static_cast<u32>(textures_.size());
+        textures_.emplace_back();
+    }
+    auto& texture = textures_[index];
+    texture.live = true;
+    texture.width = width;
+    texture.height = height;
+    texture.format = format;
+    texture.mip_levels = std::move(mip_levels);
+    texture.target_level = static_cast<uint>(texture.mip_levels.size() - 1);
+    makeResident(texture, texture.target_level);
+    return StreamedTextureHandle::make(index, texture.generation);
+}
+
+StreamedTextureHandle TextureResidency::add(const LoadedTexture& texture) {
+    return add(texture.width, texture.height, texture.format, texture.mip_levels);
+}
+
+void TextureResidency::remove(StreamedTextureHandle handle) {
+    auto* texture = find(handle);
+    if (!texture) {
+        return;
+    }
+    r_.deleteTexture(texture->texture);
+    u32 generation = (texture->generation + 1) & StreamedTextureHandle::kGenerationMask;
+    *texture = StreamedTexture{};
+    texture->generation = generation;
+    free_indices_.push_back(handle.index());
+}
+
+void TextureResidency::requestDetail(StreamedTextureHandle handle, float screen_size) {
+    auto* texture = find(handle);
+    if (texture) {
+        texture->requested_size = std::max(texture->requested_size, screen_size);
+    }
+}
+
+TextureHandle TextureResidency::texture(StreamedTextureHandle handle) const {
+    const auto* texture = find(handle);
+    return texture ? texture->texture : TextureHandle{};
+}
+
+uint TextureResidency::residentLevel(StreamedTextureHandle handle) const {
+    const auto* texture = find(handle);
+    return texture ? texture->resident_level : 0;
+}
+
+void TextureResidency::update() {
+    chooseTargetLevels();
+    stats_.streamed_in = 0;
+    stats_.streamed_out = 0;
+    stats_.uploaded_bytes = 0;
+
+    // Stream out first, so that the memory they free is available to the textures streamed in.
+    std::vector<u32> stream_in;
+    for (u32 i = 0; i < textures_.size(); ++i) {
+        auto& texture = textures_[i];
+        if (!texture.live) {
+            continue;
+        }
+        if (texture.target_level > texture.resident_level) {
+            stats_.uploaded_bytes += makeResident(texture, texture.target_level);
+            stats_.streamed_out++;
+        } else if (texture.target_level < texture.resident_level) {
+            stream_in.push_back(i);
+        }
+    }
+
+    // Stream in the textures whose resident texels are largest on screen first.
+    auto texel_screen_size = [this](u32 index) {
+        const auto& texture = textures_[index];
+        auto size = std::max(texture.width, texture.height) >> texture.resident_level;
+        return texture.screen_size / static_cast<float>(std::max(size, 1));
+    };
+    std::sort(stream_in.begin(), stream_in.end(), [&texel_screen_size](u32 a, u32 b) {
+        return texel_screen_size(a) > texel_screen_size(b);
+    });
+    usize stream_in_bytes = 0;
+    for (u32 index : stream_in) {
+        auto& texture = textures_[index];
+        usize size = levelsSize(texture, texture.target_level);
+        if (max_upload_bytes_per_frame_ > 0 && stats_.streamed_in > 0 &&
+            stream_in_bytes + size > max_upload_bytes_per_frame_) {
+            continue;
+        }
+        stream_in_bytes += makeResident(texture, texture.target_level);
+        stats_.streamed_in++;
+    }
+    stats_.uploaded_bytes += stream_in_bytes;
+
+    stats_.textures = 0;
+    stats_.resident_bytes = 0;
+    for (const auto& texture : textures_) {
+        if (texture.live) {
+            stats_.textures++;
+            stats_.resident_bytes += levelsSize(texture, texture.resident_level);
+        }
+    }
+}
+
+TextureResidency::Stats TextureResidency::stats() const {
+    return stats_;
+}
+
+TextureResidency::StreamedTexture* TextureResidency::find(StreamedTextureHandle handle) {
+    return const_cast<StreamedTexture*>(
+        static_cast<const TextureResidency*>(this)->find(handle));
+}
+
+const TextureResidency::StreamedTexture* TextureResidency::find(
+    StreamedTextureHandle handle) const {
+    if (handle.index() >= textures_.size()) {
+        return nullptr;
+    }
+    const auto& texture = textures_[handle.index()];
+    return texture.live && texture.generation == handle.generation() ? &texture : nullptr;
+}
+
+void TextureResidency::chooseTargetLevels() {
+    // Choose the level whose texels are closest to, but not larger than, a screen pixel.
+    usize total_bytes = 0;
+    for (auto& texture : textures_) {
+        if (!texture.live) {
+            continue;
+        }
+        if (texture.requested_size > 0.0f) {
+            texture.screen_size = texture.requested_size;
+            texture.frames_since_request = 0;
+        } else if (++texture.frames_since_request > kRequestExpiryFrames) {
+            texture.screen_size = 0.0f;
+        }
+        texture.requested_size = 0.0f;
+
+        auto last_level = static_cast<uint>(texture.mip_levels.size() - 1);
+        texture.target_level = last_level;
+        if (texture.screen_size > 0.0f) {
+            float texels_per_pixel =
+                static_cast<float>(std::max(texture.width, texture.height)) / texture.screen_size;
+            auto level = texels_per_pixel > 1.0f
+                             ? static_cast<uint>(std::floor(std::log2(texels_per_pixel)))
+                             : 0u;
+            texture.target_level = std::min(level, last_level);
+        }
+        total_bytes += levelsSize(texture, texture.target_level);
+    }
+    stats_.requested_bytes = total_bytes;
+    if (total_bytes <= budget_bytes_) {
+        return;
+    }
+
+    // Drop the largest level of the texture whose texels are smallest on screen (relative to its
+    // target level) until the levels fit, as that loses the least detail.
+    using Candidate = std::pair<float, u32>;
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidates;
+    auto texel_screen_size = [](const StreamedTexture& texture) {
+        auto size = std::max(texture.width, texture.height) >> texture.target_level;
+        return texture.screen_size / static_cast<float>(std::max(size, 1));
+    };
+    for (u32 i = 0; i < textures_.size(); ++i) {
+        const auto& texture = textures_[i];
+        if (texture.live && texture.target_level + 1 < texture.mip_levels.size()) {
+            candidates.emplace(texel_screen_size(texture), i);
+        }
+    }
+    while (total_bytes > budget_bytes_ && !candidates.empty()) {
+        auto& texture = textures_[candidates.top().second];
+        candidates.pop();
+        // Subtract exactly what levelsSize() counted for the dropped level, so that the total
+        // can't drift from (or wrap below) the sizes it was summed from.
+        total_bytes -= levelsSize(texture, texture.target_level) -
+                       levelsSize(texture, texture.target_level + 1);
+        texture.target_level++;
+        if (texture.target_level + 1 < texture.mip_levels.size()) {
+            candidates.emplace(texel_screen_size(texture),
+                               static_cast<u32>(&texture - textures_.data()));
+        }
+    }
+}
+
+usize TextureResidency::makeResident(StreamedTexture& texture, uint level) {
+    // The previous texture is deleted once the current frame has been rendered, so it can still
+    // be sampled by items which have already been submitted.
+    auto width = static_cast<u16>(std::max(texture.width >> level, 1));
+    auto height = static_cast<u16>(std::max(texture.height >> level, 1));
+    std::vector<Memory> levels{texture.mip_levels.begin() + level, texture.mip_levels.end()};
+    TextureHandle previous = texture.texture;
+    bool had_texture = texture.texture != TextureHandle{};
+    texture.texture = r_.createTexture2D(width, height, texture.format, std::move(levels));
+    texture.resident_level = level;
+    if (had_texture) {
+        r_.deleteTexture(previous);
+    }
+    return levelsSize(texture, level);
+}
+
+usize TextureResidency::levelsSize(const StreamedTexture& texture, uint first_level) {
+    return textureLevelsSize(texture.format, texture.width, texture.height, first_level,
+                             static_cast<u32>(texture.mip_levels.size()) - first_level);
+}
+}  // namespace gfx
+}  // namespace dw
@@ -0,0 +1,168 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "Trace.h"
+
+#include <fmt/format.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace dw {
+namespace gfx {
+namespace {
+struct TraceEvent {
+    const char* name;
+    u64 begin;  // Steady clock nanoseconds.
+    u64 end;
+};
+
+// Events recorded by a single thread. Only the owning thread appends events, so the lock is only
+// contended while a trace is being started or exported.
+struct ThreadEvents {
+    std::mutex mutex;
+    u32 thread_id;
+    std::string thread_name;
+    std::vector<TraceEvent> events;
+};
+
+struct TraceState {
+    std::atomic<bool> recording{false};
+    std::atomic<u64> start_time{0};
+    // Every thread which has recorded an event or been named. Threads are kept after they exit, so
+    // that their events can still be exported.
+    std::mutex threads_mutex;
+    std::vector<std::shared_ptr<ThreadEvents>> threads;
+};
+
+TraceState& traceState() {
+    static TraceState state;
+    return state;
+}
+
+ThreadEvents& threadEvents() {
+    thread_local std::shared_ptr<ThreadEvents> thread_events;
+    if (!thread_events) {
+        auto& state = traceState();
+        std::lock_guard<std::mutex> lock{state.threads_mutex};
+        thread_events = std::make_shared<ThreadEvents>();
+        thread_events->thread_id = static_cast<u32>(state.threads.size());
+        state.threads.emplace_back(thread_events);
+    }
+    return *thread_events;
+}
+
+u64 now() {
+    return static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now().time_since_epoch())
+                                .count());
+}
+
+std::string escapeJson(const std::string& str) {
+    std::string escaped;
+    escaped.reserve(str.size());
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            escaped += fmt::format("\\u{:04x}", static_cast<int>(c));
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+}  // namespace
+
+void Trace::start() {
+    auto& state = traceState();
+    std::lock_guard<std::mutex> lock{state.threads_mutex};
+    for (auto& thread : state.threads) {
+        std::lock_guard<std::mutex> thread_lock{thread->mutex};
+        thread->events.clear();
+    }
+    state.start_time = now();
+    state.recording = true;
+}
+
+void Trace::stop() {
+    traceState().recording = false;
+}
+
+bool Trace::isRecording() {
+    return traceState().recording;
+}
+
+Result<void, std::string> Trace::writeChromeTrace(const std::string& path) {
+    std::ofstream file{path, std::ios::trunc};
+    if (!file) {
+        return Error(fmt::format("Unable to open {} for writing.", path));
+    }
+
+    // Timestamps are written in microseconds from the start of the trace. Events which began
+    // before the trace started are dropped, as they were recorded by an earlier trace.
+    auto& state = traceState();
+    u64 start_time = state.start_time;
+    std::lock_guard<std::mutex> lock{state.threads_mutex};
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    auto separator = [&first]() {
+        const char* separator = first ? "\n" : ",\n";
+        first = false;
+        return separator;
+    };
+    for (auto& thread : state.threads) {
+        std::lock_guard<std::mutex> thread_lock{thread->mutex};
+        if (!thread->thread_name.empty()) {
+            file << separator()
+                 << fmt::format("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},"
+                                "\"args\":{{\"name\":\"{}\"}}}}",
+                                thread->thread_id, escapeJson(thread->thread_name));
+        }
+        for (const auto& event : thread->events) {
+            if (event.begin < start_time) {
+                continue;
+            }
+            file << separator()
+                 << fmt::format("{{\"name\":\"{}\",\"cat\":\"dawn-gfx\",\"ph\":\"X\",\"ts\":{:.3f},"
+                                "\"dur\":{:.3f},\"pid\":1,\"tid\":{}}}",
+                                escapeJson(event.name), (event.begin - start_time) / 1000.0,
+                                (event.end - event.begin) / 1000.0, thread->thread_id);
+        }
+    }
+    file << "\n]}\n";
+    if (!file) {
+        return Error(fmt::format("Unable to write {}.", path));
+    }
+    return {};
+}
+
+void Trace::setThreadName(const std::string& name) {
+#ifdef DW_TRACY
+    tracy::SetThreadName(name.c_str());
+#endif
+    auto& thread_events = threadEvents();
+    std::lock_guard<std::mutex> lock{thread_events.mutex};
+    thread_events.thread_name = name;
+}
+
+TraceScope::TraceScope(const char* name)
+    : name_(name), begin_(traceState().recording.load(std::memory_order_relaxed) ? now() : 0) {
+}
+
+TraceScope::~TraceScope() {
+    if (begin_ == 0) {
+        return;
+    }
+    u64 end = now();
+    auto& thread_events = threadEvents();
+    std::lock_guard<std::mutex> lock{thread_events.mutex};
+    thread_events.events.push_back({name_, begin_, end});
+}
+}  // namespace gfx
+}  // namespace dw
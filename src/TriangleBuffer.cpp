@@ -3,6 +3,12 @@
  * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
  */
 #include "TriangleBuffer.h"
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
 
 namespace dw {
 namespace gfx {
@@ -22,7 +28,43 @@ Vec3 calculateTangent(const Vec3& p1, const Vec3& p2, const Vec3& p3, const Vec2
     return tangent;
 }
 
-TriangleBuffer::TriangleBuffer() : contains_normals_(false), contains_texcoords_(false) {
+uint selectLod(const Mesh& mesh, float pixels_per_unit, float max_pixel_error) {
+    uint lod = 0;
+    while (lod + 1 < mesh.lods.size() &&
+           mesh.lods[lod + 1].error * pixels_per_unit <= max_pixel_error) {
+        ++lod;
+    }
+    return lod;
+}
+
+float pixelsPerUnit(float distance, float vertical_fov, float viewport_height) {
+    return viewport_height /
+           (2.0f * std::tan(vertical_fov * 0.5f) * std::max(distance, M_LARGE_EPSILON));
+}
+
+TriangleBuffer::TriangleBuffer()
+    : optimize_(true),
+      quantize_(false),
+      lod_count_(1),
+      lod_reduction_(0.5f),
+      contains_normals_(false),
+      contains_texcoords_(false),
+      contains_tangents_(false) {
+}
+
+void TriangleBuffer::optimize(bool enabled) {
+    optimize_ = enabled;
+}
+
+void TriangleBuffer::quantize(bool enabled) {
+    quantize_ = enabled;
+}
+
+void TriangleBuffer::lods(uint count, float reduction) {
+    assert(count >= 1);
+    assert(reduction > 0.0f && reduction < 1.0f);
+    lod_count_ = count;
+    lod_reduction_ = reduction;
 }
 
 void TriangleBuffer::estimateVertexCount(uint count) {
@@ -42,9 +84,88 @@ void TriangleBuffer::begin() {
 }
 
 Mesh TriangleBuffer::end(Renderer& r) {
+    const Vec3* positions = vertices_.empty() ? nullptr : &vertices_.data()->position;
+    if (optimize_ && !vertices_.empty()) {
+        // Merge identical vertices. Attributes which weren't specified are all zero, so comparing
+        // whole vertices is the same as comparing only the attributes which are used.
+        std::vector<u32> remap;
+        usize unique_count = remapDuplicateVertices(remap, vertices_.data(), vertices_.size(),
+                                                    sizeof(Vertex));
+        applyIndexRemap(indices_, remap);
+        applyVertexRemap(vertices_, remap, unique_count);
+        positions = &vertices_.data()->position;
+    }
+
+    // Generate each LOD by simplifying the full detail mesh, stopping early once simplifying
+    // stops making much difference.
+    std::vector<std::vector<u32>> lod_indices;
+    std::vector<float> lod_errors{0.0f};
+    lod_indices.emplace_back(std::move(indices_));
+    for (uint lod = 1; lod < lod_count_ && positions; ++lod) {
+        auto target = static_cast<usize>(static_cast<float>(lod_indices[0].size()) *
+                                         std::pow(lod_reduction_, static_cast<float>(lod)));
+        std::vector<u32> simplified;
+        float error = simplify(simplified, lod_indices[0], positions, vertices_.size(),
+                               sizeof(Vertex), target / 3 * 3);
+        if (simplified.empty() || simplified.size() * 10 > lod_indices.back().size() * 9) {
+            break;
+        }
+        lod_indices.emplace_back(std::move(simplified));
+        lod_errors.emplace_back(error);
+    }
+
+    if (optimize_ && positions) {
+        for (auto& indices : lod_indices) {
+            optimizeVertexCache(indices, vertices_.size());
+            optimizeOverdraw(indices, positions, vertices_.size(), sizeof(Vertex));
+        }
+    }
+
+    // Every LOD shares the vertex buffer, and has its own range of the index buffer.
+    std::vector<MeshLod> lods;
+    indices_.clear();
+    for (usize lod = 0; lod < lod_indices.size(); ++lod) {
+        lods.push_back({static_cast<uint>(indices_.size()),
+                        static_cast<uint>(lod_indices[lod].size()), lod_errors[lod]});
+        indices_.insert(indices_.end(), lod_indices[lod].begin(), lod_indices[lod].end());
+    }
+
+    if (optimize_ && positions) {
+        // Lay out the vertices in the order that the optimised index buffer uses them, which also
+        // drops any vertices which aren't referenced.
+        std::vector<u32> remap;
+        usize used_count = remapVerticesForFetch(remap, indices_, vertices_.size());
+        applyIndexRemap(indices_, remap);
+        applyVertexRemap(vertices_, remap, used_count);
+    }
+
     // Set up vertex data.
-    Memory data;
     VertexDecl decl;
+    Memory data = quantize_ ? packQuantizedVertices(decl) : packVertices(decl);
+
+    // Set up index data, using 16-bit indices if every vertex can be addressed by one.
+    Memory index_data;
+    IndexBufferType index_type = IndexBufferType::U32;
+    if (optimize_ && vertices_.size() <= std::numeric_limits<u16>::max() + usize{1}) {
+        index_data = Memory(indices_.size() * sizeof(u16));
+        auto* packed_indices = reinterpret_cast<u16*>(index_data.data());
+        for (usize i = 0; i < indices_.size(); ++i) {
+            packed_indices[i] = static_cast<u16>(indices_[i]);
+        }
+        index_type = IndexBufferType::U16;
+    } else {
+        index_data = Memory(indices_);
+    }
+
+    // Upload to GPU.
+    Mesh result{r.createVertexBuffer(std::move(data), decl),
+                r.createIndexBuffer(std::move(index_data), index_type),
+                static_cast<uint>(vertices_.size()), lods[0].index_count, std::move(lods)};
+    return result;
+}
+
+Memory TriangleBuffer::packVertices(VertexDecl& decl) {
+    Memory data;
     decl.begin();
     decl.add(VertexDecl::Attribute::Position, 3, VertexDecl::AttributeType::Float);
     if (contains_normals_) {
@@ -91,12 +212,51 @@ Mesh TriangleBuffer::end(Renderer& r) {
             assert(offset == stride);
         }
     }
+    return data;
+}
 
-    // Upload to GPU.
-    Mesh result{r.createVertexBuffer(std::move(data), decl),
-                r.createIndexBuffer(Memory(indices_), IndexBufferType::U32),
-                static_cast<uint>(vertices_.size()), static_cast<uint>(indices_.size())};
-    return result;
+Memory TriangleBuffer::packQuantizedVertices(VertexDecl& decl) {
+    // Normals and tangents are unit vectors, so they fit in 10 bits per component. Texture
+    // coordinates are stored as half floats, so they can tile outside of [0, 1].
+    decl.begin();
+    decl.add(VertexDecl::Attribute::Position, 3, VertexDecl::AttributeType::Float);
+    if (contains_normals_) {
+        decl.add(VertexDecl::Attribute::Normal, 4, VertexDecl::AttributeType::Int10_10_10_2, true);
+    }
+    if (contains_texcoords_) {
+        decl.add(VertexDecl::Attribute::TexCoord0, 2, VertexDecl::AttributeType::Half);
+    }
+    if (contains_tangents_) {
+        decl.add(VertexDecl::Attribute::Tangent, 4, VertexDecl::AttributeType::Int10_10_10_2,
+                 true);
+    }
+    decl.end();
+
+    Memory data(vertices_.size() * decl.stride());
+    for (size_t i = 0; i < vertices_.size(); ++i) {
+        const Vertex& source_vertex = vertices_[i];
+        byte* vertex_start = &data[i * decl.stride()];
+        byte* vertex = vertex_start;
+        auto write = [&vertex](const auto& value) {
+            std::memcpy(vertex, &value, sizeof(value));
+            vertex += sizeof(value);
+        };
+        write(source_vertex.position);
+        if (contains_normals_) {
+            const Vec3& n = source_vertex.normal;
+            write(VertexDecl::packInt10_10_10_2(n.x, n.y, n.z, 0.0f));
+        }
+        if (contains_texcoords_) {
+            write(VertexDecl::packHalf(source_vertex.tex_coord.x));
+            write(VertexDecl::packHalf(source_vertex.tex_coord.y));
+        }
+        if (contains_tangents_) {
+            const Vec3& t = source_vertex.tangent;
+            write(VertexDecl::packInt10_10_10_2(t.x, t.y, t.z, 0.0f));
+        }
+        assert(vertex - vertex_start == decl.stride());
+    }
+    return data;
 }
 
 void TriangleBuffer::position(const Vec3& p) {
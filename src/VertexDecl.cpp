@@ -3,7 +3,10 @@
  * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
  */
 #include "VertexDecl.h"
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstring>
 
 namespace dw {
 namespace gfx {
@@ -19,7 +22,7 @@ VertexDecl& VertexDecl::add(VertexDecl::Attribute attribute, usize count,
     attributes_.emplace_back(
         std::make_pair(encodeAttributes(attribute, count, type, normalised),
                        reinterpret_cast<byte*>(static_cast<std::uintptr_t>(stride_))));
-    stride_ += static_cast<u16>(count) * attributeTypeSize(type);
+    stride_ += attributeSize(type, count);
     return *this;
 }
 
@@ -64,12 +67,80 @@ u16 VertexDecl::attributeTypeSize(AttributeType type) {
             return sizeof(u8);
         case AttributeType::Float:
             return sizeof(float);
+        case AttributeType::Half:
+        case AttributeType::Int16:
+        case AttributeType::Uint16:
+            return sizeof(u16);
+        case AttributeType::Int10_10_10_2:
+        case AttributeType::Uint10_10_10_2:
+            // Not a per-component size, as all components share the same 32 bits.
+            return sizeof(u32);
         default:
             assert(false);
             return 0;
     }
 }
 
+u16 VertexDecl::attributeSize(AttributeType type, usize count) {
+    if (type == AttributeType::Int10_10_10_2 || type == AttributeType::Uint10_10_10_2) {
+        assert(count == 4);
+        return sizeof(u32);
+    }
+    return static_cast<u16>(count) * attributeTypeSize(type);
+}
+
+u16 VertexDecl::packHalf(float value) {
+    u32 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    u32 sign = (bits >> 16) & 0x8000;
+    u32 exponent = (bits >> 23) & 0xFF;
+    u32 mantissa = bits & 0x7FFFFF;
+
+    // Infinity and NaN.
+    if (exponent == 0xFF) {
+        return static_cast<u16>(sign | 0x7C00 | (mantissa != 0 ? 0x200 : 0));
+    }
+
+    int half_exponent = static_cast<int>(exponent) - 127 + 15;
+    if (half_exponent >= 0x1F) {
+        // Too large, so round to infinity.
+        return static_cast<u16>(sign | 0x7C00);
+    }
+    if (half_exponent <= 0) {
+        // Too small to be a normal half float, so convert to a subnormal or zero.
+        if (half_exponent < -10) {
+            return static_cast<u16>(sign);
+        }
+        mantissa |= 0x800000;
+        u32 shift = static_cast<u32>(14 - half_exponent);
+        u32 half = mantissa >> shift;
+        u32 remainder = mantissa & ((1u << shift) - 1);
+        u32 halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1))) {
+            ++half;
+        }
+        return static_cast<u16>(sign | half);
+    }
+
+    // Round to nearest even. If the mantissa overflows, it carries into the exponent, which gives
+    // the correct result.
+    u32 half = (static_cast<u32>(half_exponent) << 10) | (mantissa >> 13);
+    u32 remainder = mantissa & 0x1FFF;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+        ++half;
+    }
+    return static_cast<u16>(sign | half);
+}
+
+u32 VertexDecl::packInt10_10_10_2(float x, float y, float z, float w) {
+    auto pack = [](float value, float scale, u32 mask) {
+        auto quantized = static_cast<int>(std::round(std::clamp(value, -1.0f, 1.0f) * scale));
+        return static_cast<u32>(quantized) & mask;
+    };
+    return pack(x, 511.0f, 0x3FF) | (pack(y, 511.0f, 0x3FF) << 10) |
+           (pack(z, 511.0f, 0x3FF) << 20) | (pack(w, 1.0f, 0x3) << 30);
+}
+
 bool VertexDecl::operator==(const VertexDecl& other) const {
     return stride_ == other.stride_ && attributes_ == other.attributes_;
 }
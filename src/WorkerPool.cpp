@@ -0,0 +1,95 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "Base.h"
+#include "WorkerPool.h"
+#include "Trace.h"
+
+#include <string>
+
+namespace dw {
+namespace gfx {
+WorkerPool::WorkerPool(usize thread_count)
+    : job_count_(0), next_job_(0), completed_jobs_(0), exit_(false) {
+    threads_.reserve(thread_count);
+    for (usize i = 0; i < thread_count; ++i) {
+        threads_.emplace_back([this, i]() { workerThread(i); });
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        exit_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+usize WorkerPool::size() const {
+    return threads_.size();
+}
+
+void WorkerPool::run(usize job_count, Job job) {
+    if (job_count == 0) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock{mutex_};
+    job_ = std::move(job);
+    job_count_ = job_count;
+    next_job_ = 0;
+    completed_jobs_ = 0;
+    work_cv_.notify_all();
+
+    // Wait for the workers to finish, then reset the job so no worker picks it up again.
+    done_cv_.wait(lock, [this] { return completed_jobs_ == job_count_; });
+    job_ = nullptr;
+    job_count_ = 0;
+    next_job_ = 0;
+}
+
+void WorkerPool::submit(Task task) {
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        tasks_.emplace_back(std::move(task));
+    }
+    work_cv_.notify_one();
+}
+
+void WorkerPool::workerThread(usize thread_index) {
+    Trace::setThreadName("Worker " + std::to_string(thread_index));
+    std::unique_lock<std::mutex> lock{mutex_};
+    while (true) {
+        work_cv_.wait(lock,
+                      [this] { return exit_ || next_job_ < job_count_ || !tasks_.empty(); });
+        if (exit_) {
+            return;
+        }
+
+        // Take jobs until there are none left.
+        while (next_job_ < job_count_) {
+            usize job_index = next_job_++;
+            lock.unlock();
+            job_(thread_index, job_index);
+            lock.lock();
+            if (++completed_jobs_ == job_count_) {
+                done_cv_.notify_all();
+            }
+        }
+
+        // Then pick up a single task, checking for jobs again once it's done.
+        if (!tasks_.empty()) {
+            Task task = std::move(tasks_.front());
+            tasks_.pop_front();
+            lock.unlock();
+            task(thread_index);
+            lock.lock();
+        }
+    }
+}
+}  // namespace gfx
+}  // namespace dw
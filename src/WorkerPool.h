@@ -0,0 +1,61 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Base.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dw {
+namespace gfx {
+// A fixed size pool of worker threads used by render contexts to split up work within a frame, or
+// to run background tasks.
+class WorkerPool {
+public:
+    using Job = std::function<void(usize thread_index, usize job_index)>;
+    using Task = std::function<void(usize thread_index)>;
+
+    explicit WorkerPool(usize thread_count);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool(WorkerPool&&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    WorkerPool& operator=(WorkerPool&&) = delete;
+
+    // Number of worker threads. Thread indices passed to jobs are in the range [0, size()).
+    usize size() const;
+
+    // Runs job(thread_index, job_index) for each job index in [0, job_count) on the worker
+    // threads, and blocks until all jobs have completed.
+    void run(usize job_count, Job job);
+
+    // Queues a task to run on one of the worker threads, and returns immediately. Jobs passed to
+    // run() take priority over tasks. Tasks which haven't started when the pool is destroyed are
+    // discarded.
+    void submit(Task task);
+
+private:
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+
+    Job job_;
+    usize job_count_;
+    usize next_job_;
+    usize completed_jobs_;
+    std::deque<Task> tasks_;
+    bool exit_;
+
+    void workerThread(usize thread_index);
+};
+}  // namespace gfx
+}  // namespace dw
@@ -3,7 +3,10 @@
  * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
  */
 #include "Base.h"
+#include "ContentHash.h"
 #include "SPIRV.h"
+#include "Texture.h"
+#include "Trace.h"
 #include "gl/RenderContextGL.h"
 #include "Input.h"
 
@@ -12,7 +15,14 @@
 #include <locale>
 #include <exception>
 #include <codecvt>
+#include <cstring>
 #include <map>
+#include <algorithm>
+#include <limits>
+#include <fstream>
+#include <thread>
+#include <type_traits>
+#include <unordered_set>
 
 /**
  * RenderContextGL. A render context implementation which targets GL
@@ -109,6 +119,49 @@ GLenum mapBufferUsage(BufferUsage usage) {
     }
 }
 
+// Block-compressed texture formats. These are defined by extensions (or later GL versions) which
+// are not included in the GL loader.
+constexpr GLenum kCompressedRGBAS3TCDXT1 = 0x83F1;
+constexpr GLenum kCompressedRGBAS3TCDXT3 = 0x83F2;
+constexpr GLenum kCompressedRGBAS3TCDXT5 = 0x83F3;
+constexpr GLenum kCompressedSRGBAlphaS3TCDXT1 = 0x8C4D;
+constexpr GLenum kCompressedSRGBAlphaS3TCDXT3 = 0x8C4E;
+constexpr GLenum kCompressedSRGBAlphaS3TCDXT5 = 0x8C4F;
+constexpr GLenum kCompressedRGBABPTCUnorm = 0x8E8C;
+constexpr GLenum kCompressedSRGBAlphaBPTCUnorm = 0x8E8D;
+constexpr GLenum kCompressedRGBBPTCUnsignedFloat = 0x8E8F;
+constexpr GLenum kCompressedRGB8ETC2 = 0x9274;
+constexpr GLenum kCompressedSRGB8ETC2 = 0x9275;
+constexpr GLenum kCompressedRGBA8ETC2EAC = 0x9278;
+constexpr GLenum kCompressedSRGB8Alpha8ETC2EAC = 0x9279;
+constexpr GLenum kCompressedRGBAASTC4x4 = 0x93B0;
+constexpr GLenum kCompressedRGBAASTC6x6 = 0x93B4;
+constexpr GLenum kCompressedRGBAASTC8x8 = 0x93B7;
+constexpr GLenum kCompressedSRGB8Alpha8ASTC4x4 = 0x93D0;
+constexpr GLenum kCompressedSRGB8Alpha8ASTC6x6 = 0x93D4;
+constexpr GLenum kCompressedSRGB8Alpha8ASTC8x8 = 0x93D7;
+
+// Compute shaders and storage buffers (GL 4.3), which are also not included in the GL loader.
+constexpr GLenum kComputeShader = 0x91B9;
+constexpr GLenum kShaderStorageBuffer = 0x90D2;
+constexpr GLbitfield kAllBarrierBits = 0xFFFFFFFF;
+
+// GL_NVX_gpu_memory_info queries, which are reported in kilobytes.
+constexpr GLenum kGpuMemoryInfoDedicatedVidmem = 0x9047;
+constexpr GLenum kGpuMemoryInfoCurrentAvailableVidmem = 0x9049;
+constexpr uint kMemoryInfoInterval = 30;
+
+// The bindless texture table (set 1, binding 0) is renamed to this during cross-compilation, so
+// that it can be found in the linked program.
+constexpr const char* kBindlessTexturesUniform = "dw_bindless_textures";
+
+// GLES 3.0 can only report whether any samples passed.
+#if DW_GL_VERSION != DW_GLES_300
+constexpr GLenum kOcclusionQueryTarget = GL_SAMPLES_PASSED;
+#else
+constexpr GLenum kOcclusionQueryTarget = GL_ANY_SAMPLES_PASSED;
+#endif
+
 struct TextureFormatGL {
     GLenum internal_format;
     GLenum internal_format_srgb;
@@ -160,6 +213,18 @@ const std::array<TextureFormatGL, usize(TextureFormat::Count)> kTextureFormatMap
     {GL_RGBA32I,            GL_ZERO,         GL_RGBA,             GL_INT,               false}, // RGBA32I
     {GL_RGBA32UI,           GL_ZERO,         GL_RGBA,             GL_UNSIGNED_INT,      false}, // RGBA32U
     {GL_RGBA32F,            GL_ZERO,         GL_RGBA,             GL_FLOAT,             false}, // RGBA32F
+    {kCompressedRGBAS3TCDXT1, kCompressedSRGBAlphaS3TCDXT1, GL_ZERO, GL_ZERO, false}, // BC1
+    {kCompressedRGBAS3TCDXT3, kCompressedSRGBAlphaS3TCDXT3, GL_ZERO, GL_ZERO, false}, // BC2
+    {kCompressedRGBAS3TCDXT5, kCompressedSRGBAlphaS3TCDXT5, GL_ZERO, GL_ZERO, false}, // BC3
+    {GL_COMPRESSED_RED_RGTC1, GL_ZERO, GL_ZERO, GL_ZERO, false}, // BC4
+    {GL_COMPRESSED_RG_RGTC2, GL_ZERO, GL_ZERO, GL_ZERO, false}, // BC5
+    {kCompressedRGBBPTCUnsignedFloat, GL_ZERO, GL_ZERO, GL_ZERO, false}, // BC6H
+    {kCompressedRGBABPTCUnorm, kCompressedSRGBAlphaBPTCUnorm, GL_ZERO, GL_ZERO, false}, // BC7
+    {kCompressedRGB8ETC2, kCompressedSRGB8ETC2, GL_ZERO, GL_ZERO, false}, // ETC2
+    {kCompressedRGBA8ETC2EAC, kCompressedSRGB8Alpha8ETC2EAC, GL_ZERO, GL_ZERO, false}, // ETC2A
+    {kCompressedRGBAASTC4x4, kCompressedSRGB8Alpha8ASTC4x4, GL_ZERO, GL_ZERO, false}, // ASTC4x4
+    {kCompressedRGBAASTC6x6, kCompressedSRGB8Alpha8ASTC6x6, GL_ZERO, GL_ZERO, false}, // ASTC6x6
+    {kCompressedRGBAASTC8x8, kCompressedSRGB8Alpha8ASTC8x8, GL_ZERO, GL_ZERO, false}, // ASTC8x8
     {GL_DEPTH_COMPONENT16,  GL_ZERO,         GL_DEPTH_COMPONENT,  GL_UNSIGNED_SHORT,    false}, // D16
     {GL_DEPTH_COMPONENT24,  GL_ZERO,         GL_DEPTH_COMPONENT,  GL_UNSIGNED_INT,      false}, // D24
     {GL_DEPTH24_STENCIL8,   GL_ZERO,         GL_DEPTH_STENCIL,    GL_UNSIGNED_INT_24_8, false}, // D24S8
@@ -195,7 +260,27 @@ const std::unordered_map<BlendFunc, GLenum> kBlendFuncMap = {
     {BlendFunc::SrcAlphaSaturate, GL_SRC_ALPHA_SATURATE},
 };
 const std::unordered_map<ShaderStage, GLenum> kShaderStageMap = {
-    {ShaderStage::Vertex, GL_VERTEX_SHADER}, {ShaderStage::Geometry, GL_GEOMETRY_SHADER}, {ShaderStage::Fragment, GL_FRAGMENT_SHADER}};
+    {ShaderStage::Vertex, GL_VERTEX_SHADER},
+    {ShaderStage::Geometry, GL_GEOMETRY_SHADER},
+    {ShaderStage::Fragment, GL_FRAGMENT_SHADER},
+    {ShaderStage::Compute, kComputeShader}};
+const std::unordered_map<VertexDecl::AttributeType, GLenum> kAttributeTypeMap = {
+    {VertexDecl::AttributeType::Float, GL_FLOAT},
+    {VertexDecl::AttributeType::Uint8, GL_UNSIGNED_BYTE},
+    {VertexDecl::AttributeType::Half, GL_HALF_FLOAT},
+    {VertexDecl::AttributeType::Int16, GL_SHORT},
+    {VertexDecl::AttributeType::Uint16, GL_UNSIGNED_SHORT},
+    {VertexDecl::AttributeType::Int10_10_10_2, GL_INT_2_10_10_10_REV},
+    {VertexDecl::AttributeType::Uint10_10_10_2, GL_UNSIGNED_INT_2_10_10_10_REV}};
+
+// Program binary cache file header. Bump the version whenever the cross-compilation options in
+// CreateProgram change, to invalidate cached programs.
+constexpr u32 kProgramCacheMagic = 0x42505744;  // "DWPB"
+constexpr u32 kProgramCacheVersion = 3;
+
+// Size of the buffer which uniform blocks that aren't sourced from a uniform buffer are streamed
+// into.
+constexpr usize kUniformScratchBufferSize = 1024 * 1024;
 
 // GLFW key map.
 const std::unordered_map<int, Key::Enum> kGlfwKeyMap = {
@@ -317,47 +402,18 @@ static_assert(static_cast<int>(TextureFormat::Count) ==
               "Texture format mapping mismatch.");
 
 // Uniform binder.
-class UniformBinder {
-public:
-    UniformBinder() : uniform_location_{0} {
-    }
-
-    void operator()(const int& value) {
-        GL_CHECK(glUniform1i(uniform_location_, value));
-    }
-
-    void operator()(const float& value) {
-        GL_CHECK(glUniform1f(uniform_location_, value));
-    }
-
-    void operator()(const Vec2& value) {
-        GL_CHECK(glUniform2f(uniform_location_, value.x, value.y));
-    }
-
-    void operator()(const Vec3& value) {
-        GL_CHECK(glUniform3f(uniform_location_, value.x, value.y, value.z));
-    }
-
-    void operator()(const Vec4& value) {
-        GL_CHECK(glUniform4f(uniform_location_, value.x, value.y, value.z, value.w));
-    }
-
-    void operator()(const Mat3& value) {
-        GL_CHECK(glUniformMatrix3fv(uniform_location_, 1, GL_FALSE, value.ptr()));
-    }
-
-    void operator()(const Mat4& value) {
-        GL_CHECK(glUniformMatrix4fv(uniform_location_, 1, GL_FALSE, value.ptr()));
-    }
-
-    void updateUniform(GLint location, const UniformData& data) {
-        uniform_location_ = location;
-        visit(*this, data);
-    }
+const RenderItem::UniformBufferBinding* findUniformBufferBinding(const RenderItem& item,
+                                                                u32 binding_location) {
+    auto it = std::find_if(item.uniform_buffers.begin(), item.uniform_buffers.end(),
+                           [binding_location](const RenderItem::UniformBufferBinding& binding) {
+                               return binding.binding_location == binding_location;
+                           });
+    return it != item.uniform_buffers.end() ? &*it : nullptr;
+}
 
-private:
-    GLint uniform_location_;
-};
+usize alignUniformOffset(usize offset, usize alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
 }  // namespace
 
 int last_error_code = 0;
@@ -367,11 +423,13 @@ void SamplerCacheGL::setMaxSupportedAnisotropy(float max_anisotropy) {
     max_supported_anisotropy_ = max_anisotropy;
 }
 
-GLuint SamplerCacheGL::findOrCreate(RenderItem::SamplerInfo info) {
+GLuint SamplerCacheGL::findOrCreate(RenderItem::SamplerInfo info, FrameStats::CacheStats& stats) {
     auto it = cache_.find(info);
     if (it != cache_.end()) {
+        stats.hits++;
         return it->second;
     }
+    stats.misses++;
 
     GLuint sampler_object;
     GL_CHECK(glGenSamplers(1, &sampler_object));
@@ -428,7 +486,47 @@ void SamplerCacheGL::clear() {
 }
 
 RenderContextGL::RenderContextGL(Logger& logger)
-    : RenderContext(logger), max_supported_anisotropy_(0.0f) {
+    : RenderContext(logger),
+      max_supported_anisotropy_(0.0f),
+      program_binary_supported_(false),
+      texture_format_supported_{},
+      multi_draw_elements_indirect_(nullptr),
+      indirect_index_buffer_(0),
+      indirect_index_buffer_size_(0),
+      compute_supported_(false),
+      dispatch_compute_(nullptr),
+      memory_barrier_(nullptr),
+      bind_image_texture_(nullptr),
+      vertex_attrib_binding_supported_(false),
+      vertex_attrib_format_(nullptr),
+      vertex_attrib_binding_(nullptr),
+      bind_vertex_buffer_(nullptr),
+      vertex_binding_divisor_(nullptr),
+      bind_textures_(nullptr),
+      bind_samplers_(nullptr),
+      invalidate_framebuffer_(nullptr),
+      bindless_texturing_supported_(false),
+      get_texture_sampler_handle_(nullptr),
+      make_texture_handle_resident_(nullptr),
+      make_texture_handle_non_resident_(nullptr),
+      uniform_handle_ui64v_(nullptr),
+      bindless_texture_table_version_(1),
+      draw_base_vertex_supported_(false),
+      gpu_timing_supported_(false),
+      gpu_timing_frame_index_(0),
+      swap_control_tear_supported_(false),
+      vao_(0),
+      bound_vao_(0),
+      vertex_array_frame_(0),
+      uniform_scratch_buffer_(0),
+      uniform_scratch_offset_(0),
+      uniform_scratch_generation_(0),
+      uniform_buffer_offset_alignment_(1),
+      next_texture_upload_buffer_(0),
+      active_texture_unit_(0),
+      conditional_rendering_supported_(false),
+      memory_info_supported_(false),
+      frames_until_memory_info_(0) {
 }
 
 RenderContextGL::~RenderContextGL() {
@@ -450,6 +548,22 @@ bool RenderContextGL::hasFlippedViewport() const {
     return false;
 }
 
+bool RenderContextGL::isTextureFormatSupported(TextureFormat format) const {
+    return texture_format_supported_[static_cast<usize>(format)];
+}
+
+bool RenderContextGL::isComputeSupported() const {
+    return compute_supported_;
+}
+
+bool RenderContextGL::isBindlessTexturingSupported() const {
+    return bindless_texturing_supported_;
+}
+
+bool RenderContextGL::isConditionalRenderingSupported() const {
+    return conditional_rendering_supported_;
+}
+
 Result<void, std::string> RenderContextGL::createWindow(u16 width, u16 height,
                                                         const std::string& title,
                                                         InputCallbacks input_callbacks) {
@@ -492,6 +606,7 @@ Result<void, std::string> RenderContextGL::createWindow(u16 width, u16 height,
 #endif
     // TODO: Support resizing.
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_VISIBLE, window_hidden_ ? GLFW_FALSE : GLFW_TRUE);
 
     // Select monitor.
     GLFWmonitor* monitor = glfwGetPrimaryMonitor();
@@ -518,7 +633,13 @@ Result<void, std::string> RenderContextGL::createWindow(u16 width, u16 height,
     backbuffer_height_ = static_cast<u16>(fb_size.y);
     glfwMakeContextCurrent(window_);
 #ifndef DGA_EMSCRIPTEN
-    glfwSwapInterval(0);
+    swap_control_tear_supported_ = glfwExtensionSupported("WGL_EXT_swap_control_tear") ||
+                                   glfwExtensionSupported("GLX_EXT_swap_control_tear");
+    PresentMode present_mode;
+    uint swap_interval;
+    if (takePresentModeChange(present_mode, swap_interval)) {
+        applyPresentMode(present_mode, swap_interval);
+    }
 #endif
     glfwSetWindowUserPointer(window_, static_cast<void*>(this));
 
@@ -614,6 +735,173 @@ Result<void, std::string> RenderContextGL::createWindow(u16 width, u16 height,
     GL_CHECK(glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &max_supported_anisotropy_));
     sampler_cache_.setMaxSupportedAnisotropy(max_supported_anisotropy_);
 
+    GLint program_binary_format_count = 0;
+    GL_CHECK(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &program_binary_format_count));
+    program_binary_supported_ = program_binary_format_count > 0;
+    program_binary_formats_.resize(static_cast<usize>(std::max(program_binary_format_count, 0)));
+    if (!program_binary_formats_.empty()) {
+        GL_CHECK(glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, program_binary_formats_.data()));
+    }
+    driver_id_ = fmt::format("{}|{}|{}", reinterpret_cast<const char*>(glGetString(GL_VENDOR)),
+                             reinterpret_cast<const char*>(glGetString(GL_RENDERER)),
+                             reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+
+    // Determine which texture formats are supported. Uncompressed formats are core, but most
+    // block-compressed formats depend on extensions.
+    std::unordered_set<std::string> extensions;
+    GLint extension_count = 0;
+    GL_CHECK(glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count));
+    for (GLint i = 0; i < extension_count; ++i) {
+        extensions.emplace(
+            reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i))));
+    }
+    auto has_extension = [&extensions](const char* name) { return extensions.count(name) > 0; };
+    bool s3tc_supported = has_extension("GL_EXT_texture_compression_s3tc") ||
+                          has_extension("GL_WEBGL_compressed_texture_s3tc");
+    bool bptc_supported = has_extension("GL_ARB_texture_compression_bptc") ||
+                          has_extension("GL_EXT_texture_compression_bptc");
+#if DW_GL_VERSION == DW_GLES_300
+    bool rgtc_supported = has_extension("GL_EXT_texture_compression_rgtc");
+    bool etc2_supported = true;
+#else
+    bool rgtc_supported = true;
+    bool etc2_supported = has_extension("GL_ARB_ES3_compatibility");
+#endif
+    bool astc_supported = has_extension("GL_KHR_texture_compression_astc_ldr");
+    for (usize i = 0; i < texture_format_supported_.size(); ++i) {
+        switch (static_cast<TextureFormat>(i)) {
+            case TextureFormat::BC1:
+            case TextureFormat::BC2:
+            case TextureFormat::BC3:
+                texture_format_supported_[i] = s3tc_supported;
+                break;
+            case TextureFormat::BC4:
+            case TextureFormat::BC5:
+                texture_format_supported_[i] = rgtc_supported;
+                break;
+            case TextureFormat::BC6H:
+            case TextureFormat::BC7:
+                texture_format_supported_[i] = bptc_supported;
+                break;
+            case TextureFormat::ETC2:
+            case TextureFormat::ETC2A:
+                texture_format_supported_[i] = etc2_supported;
+                break;
+            case TextureFormat::ASTC4x4:
+            case TextureFormat::ASTC6x6:
+            case TextureFormat::ASTC8x8:
+                texture_format_supported_[i] = astc_supported;
+                break;
+            default:
+                texture_format_supported_[i] = true;
+                break;
+        }
+    }
+
+    // Multi-draw indirect.
+#if DW_GL_VERSION != DW_GLES_300
+    if (has_extension("GL_ARB_multi_draw_indirect")) {
+        multi_draw_elements_indirect_ = reinterpret_cast<MultiDrawElementsIndirectProc>(
+            glfwGetProcAddress("glMultiDrawElementsIndirect"));
+    }
+#endif
+
+    // Compute shaders and storage buffers/images.
+#if DW_GL_VERSION != DW_GLES_300
+    GLint major_version = 0, minor_version = 0;
+    GL_CHECK(glGetIntegerv(GL_MAJOR_VERSION, &major_version));
+    GL_CHECK(glGetIntegerv(GL_MINOR_VERSION, &minor_version));
+    if ((major_version == 4 && minor_version >= 3) || major_version > 4 ||
+        (has_extension("GL_ARB_compute_shader") &&
+         has_extension("GL_ARB_shader_storage_buffer_object") &&
+         has_extension("GL_ARB_shader_image_load_store"))) {
+        dispatch_compute_ =
+            reinterpret_cast<DispatchComputeProc>(glfwGetProcAddress("glDispatchCompute"));
+        memory_barrier_ =
+            reinterpret_cast<MemoryBarrierProc>(glfwGetProcAddress("glMemoryBarrier"));
+        bind_image_texture_ =
+            reinterpret_cast<BindImageTextureProc>(glfwGetProcAddress("glBindImageTexture"));
+        compute_supported_ = dispatch_compute_ && memory_barrier_ && bind_image_texture_;
+    }
+
+    // Separate vertex formats and buffer bindings.
+    if ((major_version == 4 && minor_version >= 3) || major_version > 4 ||
+        has_extension("GL_ARB_vertex_attrib_binding")) {
+        vertex_attrib_format_ =
+            reinterpret_cast<VertexAttribFormatProc>(glfwGetProcAddress("glVertexAttribFormat"));
+        vertex_attrib_binding_ = reinterpret_cast<VertexAttribBindingProc>(
+            glfwGetProcAddress("glVertexAttribBinding"));
+        bind_vertex_buffer_ =
+            reinterpret_cast<BindVertexBufferProc>(glfwGetProcAddress("glBindVertexBuffer"));
+        vertex_binding_divisor_ = reinterpret_cast<VertexBindingDivisorProc>(
+            glfwGetProcAddress("glVertexBindingDivisor"));
+        vertex_attrib_binding_supported_ = vertex_attrib_format_ && vertex_attrib_binding_ &&
+                                           bind_vertex_buffer_ && vertex_binding_divisor_;
+    }
+
+    // Multi-bind.
+    if ((major_version == 4 && minor_version >= 4) || major_version > 4 ||
+        has_extension("GL_ARB_multi_bind")) {
+        bind_textures_ =
+            reinterpret_cast<BindTexturesProc>(glfwGetProcAddress("glBindTextures"));
+        bind_samplers_ =
+            reinterpret_cast<BindSamplersProc>(glfwGetProcAddress("glBindSamplers"));
+        if (!bind_textures_ || !bind_samplers_) {
+            bind_textures_ = nullptr;
+            bind_samplers_ = nullptr;
+        }
+    }
+
+    // Framebuffer invalidation.
+    if ((major_version == 4 && minor_version >= 3) || major_version > 4 ||
+        has_extension("GL_ARB_invalidate_subdata")) {
+        invalidate_framebuffer_ = reinterpret_cast<InvalidateFramebufferProc>(
+            glfwGetProcAddress("glInvalidateFramebuffer"));
+    }
+
+    // Bindless textures.
+    if (has_extension("GL_ARB_bindless_texture")) {
+        get_texture_sampler_handle_ = reinterpret_cast<GetTextureSamplerHandleProc>(
+            glfwGetProcAddress("glGetTextureSamplerHandleARB"));
+        make_texture_handle_resident_ = reinterpret_cast<MakeTextureHandleResidentProc>(
+            glfwGetProcAddress("glMakeTextureHandleResidentARB"));
+        make_texture_handle_non_resident_ = reinterpret_cast<MakeTextureHandleResidentProc>(
+            glfwGetProcAddress("glMakeTextureHandleNonResidentARB"));
+        uniform_handle_ui64v_ = reinterpret_cast<UniformHandleui64vProc>(
+            glfwGetProcAddress("glUniformHandleui64vARB"));
+        bindless_texturing_supported_ = get_texture_sampler_handle_ &&
+                                        make_texture_handle_resident_ &&
+                                        make_texture_handle_non_resident_ && uniform_handle_ui64v_;
+    }
+#else
+    invalidate_framebuffer_ = reinterpret_cast<InvalidateFramebufferProc>(
+        glfwGetProcAddress("glInvalidateFramebuffer"));
+#endif
+
+    // Texture units.
+    GLint texture_unit_count = 0;
+    GL_CHECK(glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &texture_unit_count));
+    bound_textures_.assign(static_cast<usize>(texture_unit_count), 0);
+    bound_samplers_.assign(static_cast<usize>(texture_unit_count), 0);
+
+    // Uniform buffer binding points.
+    GLint uniform_buffer_binding_count = 0;
+    GLint uniform_buffer_offset_alignment = 0;
+    GL_CHECK(glGetIntegerv(GL_MAX_UNIFORM_BUFFER_BINDINGS, &uniform_buffer_binding_count));
+    GL_CHECK(glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniform_buffer_offset_alignment));
+    bound_uniform_buffer_ranges_.assign(static_cast<usize>(uniform_buffer_binding_count),
+                                        UniformBufferRange{0, 0, 0});
+    uniform_buffer_offset_alignment_ =
+        static_cast<usize>(std::max(uniform_buffer_offset_alignment, 1));
+
+    // Timestamp queries are core in GL 3.3, but need GL_EXT_disjoint_timer_query on GLES.
+#if DW_GL_VERSION != DW_GLES_300
+    gpu_timing_supported_ = true;
+    draw_base_vertex_supported_ = true;
+    conditional_rendering_supported_ = true;
+    memory_info_supported_ = has_extension("GL_NVX_gpu_memory_info");
+#endif
+
     // Print GL information.
     logger_.info("OpenGL: {} - GLSL: {}", glGetString(GL_VERSION),
                  glGetString(GL_SHADING_LANGUAGE_VERSION));
@@ -625,6 +913,24 @@ Result<void, std::string> RenderContextGL::createWindow(u16 width, u16 height,
                  static_cast<bool>(GLAD_GL_EXT_texture_filter_anisotropic));
     logger_.info("Capabilities:");
     logger_.info("- Max supported anisotropy: {}", max_supported_anisotropy_);
+    logger_.info("- Program binary formats: {}", program_binary_format_count);
+    logger_.info("- Compressed textures: BC1-3: {} - BC4-5: {} - BC6H/BC7: {} - ETC2: {} - "
+                 "ASTC: {}",
+                 s3tc_supported, rgtc_supported, bptc_supported, etc2_supported, astc_supported);
+    logger_.info("- Multi-draw indirect: {}", multi_draw_elements_indirect_ != nullptr);
+    logger_.info("- Compute: {}", compute_supported_);
+    logger_.info("- Vertex attrib binding: {}", vertex_attrib_binding_supported_);
+    logger_.info("- Texture units: {} - Multi-bind: {}", texture_unit_count,
+                 bind_textures_ != nullptr);
+    logger_.info("- GPU timing: {}", gpu_timing_supported_);
+    logger_.info("- Draw base vertex: {}", draw_base_vertex_supported_);
+    logger_.info("- Conditional rendering: {}", conditional_rendering_supported_);
+    logger_.info("- Memory budget: {}", memory_info_supported_);
+
+    // Start worker threads used to cross-compile async programs, leaving half of the cores for
+    // the main and render threads.
+    program_worker_pool_ =
+        std::make_unique<WorkerPool>(std::max(1u, std::thread::hardware_concurrency() / 2));
 
     // Hand off context to render thread.
     glfwMakeContextCurrent(nullptr);
@@ -671,14 +977,100 @@ void RenderContextGL::startRendering() {
 
     GL_CHECK(glGenVertexArrays(1, &vao_));
     GL_CHECK(glBindVertexArray(vao_));
+    bound_vao_ = vao_;
 }
 
 void RenderContextGL::stopRendering() {
+    // Abandon any async programs which are still in flight.
+    program_worker_pool_.reset();
+    for (const auto& entry : pending_programs_) {
+        GL_CHECK(glDeleteProgram(entry.second.program_data.program));
+    }
+    pending_programs_.clear();
+    cross_compiled_programs_.clear();
+
     GL_CHECK(glBindVertexArray(0));
     GL_CHECK(glDeleteVertexArrays(1, &vao_));
+    for (const auto& entry : vertex_array_cache_) {
+        GL_CHECK(glDeleteVertexArrays(1, &entry.second.vao));
+    }
+    vertex_array_cache_.clear();
+    bound_vao_ = 0;
+
+    for (auto& timing_frame : gpu_timing_frames_) {
+        if (!timing_frame.queries.empty()) {
+            GL_CHECK(glDeleteQueries(timing_frame.queries.size(), timing_frame.queries.data()));
+        }
+        timing_frame = GpuTimingFrame{};
+    }
+
+    for (GLsync fence : frame_fences_) {
+        GL_CHECK(glDeleteSync(fence));
+    }
+    frame_fences_.clear();
+
+    for (const auto& entry : occlusion_query_map_) {
+        GL_CHECK(glDeleteQueries(kOcclusionQueryObjectCount, entry.second.queries.data()));
+    }
+    occlusion_query_map_.clear();
+
+    for (auto& upload_buffer : texture_upload_buffers_) {
+        if (upload_buffer.buffer != 0) {
+            GL_CHECK(glDeleteBuffers(1, &upload_buffer.buffer));
+        }
+        upload_buffer = TextureUploadBuffer{};
+    }
+    if (indirect_index_buffer_ != 0) {
+        GL_CHECK(glDeleteBuffers(1, &indirect_index_buffer_));
+        indirect_index_buffer_ = 0;
+        indirect_index_buffer_size_ = 0;
+    }
+    if (uniform_scratch_buffer_ != 0) {
+        GL_CHECK(glDeleteBuffers(1, &uniform_scratch_buffer_));
+        uniform_scratch_buffer_ = 0;
+    }
 }
 
 void RenderContextGL::prepareFrame() {
+    finishAsyncPrograms();
+    evictVertexArrays();
+
+#ifndef DGA_EMSCRIPTEN
+    PresentMode present_mode;
+    uint swap_interval;
+    if (takePresentModeChange(present_mode, swap_interval)) {
+        applyPresentMode(present_mode, swap_interval);
+    }
+
+    // Wait until the GPU has finished enough frames for this one to be in flight.
+    while (frame_fences_.size() >= max_frames_in_flight_) {
+        glClientWaitSync(frame_fences_.front(), GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+        GL_CHECK(glDeleteSync(frame_fences_.front()));
+        frame_fences_.pop_front();
+    }
+#endif
+}
+
+void RenderContextGL::applyPresentMode(PresentMode mode, uint swap_interval) {
+    // GL only controls how many vertical blanks to wait for, so there's no equivalent of mailbox.
+    // A negative interval allows late swaps to tear, if the driver supports it.
+    int interval = static_cast<int>(swap_interval);
+    switch (mode) {
+        case PresentMode::Immediate:
+        case PresentMode::Mailbox:
+            interval = 0;
+            break;
+        case PresentMode::Fifo:
+            break;
+        case PresentMode::FifoRelaxed:
+            if (swap_control_tear_supported_) {
+                interval = -interval;
+            } else {
+                logger_.warn("[Present] Relaxed FIFO is not supported, using FIFO instead.");
+            }
+            break;
+    }
+    glfwSwapInterval(interval);
 }
 
 void RenderContextGL::processCommandList(std::vector<RenderCommand>& command_list) {
@@ -690,22 +1082,49 @@ void RenderContextGL::processCommandList(std::vector<RenderCommand>& command_lis
 
 bool RenderContextGL::frame(const Frame* frame) {
     assert(window_);
+    beginGpuTiming(frame);
+    readOcclusionQueryResults();
+    queryMemoryInfo();
 
     // Upload transient vertex/element buffer data.
     auto& tvb = frame->transient_vb_storage;
     if (tvb.handle && tvb.size > 0) {
-        GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_map_.at(*tvb.handle).vertex_buffer));
-        GL_CHECK(glBufferSubData(GL_ARRAY_BUFFER, 0, tvb.size, tvb.data.data()));
+        auto& vb_data = vertex_buffer_map_.at(*tvb.handle);
+        uploadTransientBuffer(GL_ARRAY_BUFFER, vb_data.vertex_buffer, vb_data.size, vb_data.usage,
+                              tvb);
     }
-    auto& tib = frame->transient_ib_storage;
-    if (tib.handle && tib.size > 0) {
-        GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
-                              index_buffer_map_.at(*tib.handle).element_buffer));
-        GL_CHECK(glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, tib.size, tib.data.data()));
+    for (auto* tib : {&frame->transient_ib_storage, &frame->transient_ib32_storage}) {
+        if (tib->handle && tib->size > 0) {
+            auto& ib_data = index_buffer_map_.at(*tib->handle);
+            uploadTransientBuffer(GL_ELEMENT_ARRAY_BUFFER, ib_data.element_buffer, ib_data.size,
+                                  ib_data.usage, *tib);
+        }
     }
 
     // Process render queues.
-    for (auto& q : frame->render_queues) {
+    static const GpuTimestampLayout::QueueTimestamps kNoTimestamps;
+    const auto& timing_frame = gpu_timing_frames_[gpu_timing_frame_index_];
+    for (usize queue_index = 0; queue_index < frame->render_queues.size(); ++queue_index) {
+        DW_TRACE_SCOPE("RenderContextGL::renderQueue");
+        const auto& q = frame->render_queues[queue_index];
+        const auto& timestamps = gpu_timing_supported_
+                                     ? timing_frame.layout.queueTimestamps(queue_index)
+                                     : kNoTimestamps;
+        auto next_timestamp = timestamps.begin();
+
+        // Label the queue's commands (including its dispatches) in graphics debuggers.
+#if DW_GL_VERSION != DW_GLES_300
+        bool labelled = GLAD_GL_KHR_debug && !q.label.empty();
+        if (labelled) {
+            GL_CHECK(glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, q.label.c_str()));
+        }
+#endif
+
+        // Run compute items first, so that draws in this queue can use their results.
+        if (!q.compute_items.empty()) {
+            dispatchComputeItems(q);
+        }
+
         // Set up framebuffer.
         u16 fb_width, fb_height;
         if (q.frame_buffer) {
@@ -723,26 +1142,58 @@ bool RenderContextGL::frame(const Frame* frame) {
         (void)fb_width;
         (void)fb_height;
 
-        // Clear frame buffer.
-        if (q.clear_parameters) {
-            auto colour = q.clear_parameters->colour;
+        // Clear or discard the existing contents of the frame buffer.
+        auto ops = q.resolvedAttachmentOps();
+        GLbitfield clear_mask = 0;
+        if (ops.colour_load == RenderQueue::LoadOp::Clear) {
+            clear_mask |= GL_COLOR_BUFFER_BIT;
+        }
+        if (ops.depth_load == RenderQueue::LoadOp::Clear) {
+            clear_mask |= GL_DEPTH_BUFFER_BIT;
+        }
+        if (clear_mask != 0) {
+            auto colour =
+                q.clear_parameters ? q.clear_parameters->colour : Colour{0.0f, 0.0f, 0.0f, 0.0f};
             GL_CHECK(glClearColor(colour.r(), colour.g(), colour.b(), colour.a()));
-            GLbitfield clear_mask = 0;
-            if (q.clear_parameters->clear_colour) {
-                clear_mask |= GL_COLOR_BUFFER_BIT;
-            }
-            if (q.clear_parameters->clear_depth) {
-                clear_mask |= GL_DEPTH_BUFFER_BIT;
-            }
             GL_CHECK(glClear(clear_mask));
         }
+        invalidateFrameBuffer(q, ops.colour_load == RenderQueue::LoadOp::DontCare,
+                              ops.depth_load == RenderQueue::LoadOp::DontCare);
 
         // Render items.
-        u32 previous_max_texture_unit = 0;
+        const RenderItem* previous = nullptr;
         for (uint i = 0; i < q.render_items.size(); ++i) {
-            auto* previous = i > 0 ? &q.render_items[i - 1] : nullptr;
             auto* current = &q.render_items[i];
 
+            // Write the GPU timestamps which come before this item.
+            for (; next_timestamp != timestamps.end() && next_timestamp->first == i;
+                 ++next_timestamp) {
+                GL_CHECK(
+                    glQueryCounter(timing_frame.queries[next_timestamp->second], GL_TIMESTAMP));
+            }
+
+            // Skip items whose program is still being created.
+            auto program_it = program_map_.find(*current->program);
+            if (program_it == program_map_.end()) {
+                continue;
+            }
+
+            // Find the query object which the draw condition is evaluated with. Without
+            // conditional rendering, the item is skipped if the query's last result found nothing.
+            GLuint condition_query = 0;
+            if (current->draw_condition) {
+                auto query_it = occlusion_query_map_.find(*current->draw_condition);
+                if (query_it != occlusion_query_map_.end()) {
+                    if (!conditional_rendering_supported_) {
+                        const auto& last_result = query_it->second.last_result;
+                        if (last_result && *last_result == 0) {
+                            continue;
+                        }
+                    }
+                    condition_query = query_it->second.last_written;
+                }
+            }
+
             // Update render state.
             if (!previous || previous->cull_face_enabled != current->cull_face_enabled) {
                 if (current->cull_face_enabled) {
@@ -790,110 +1241,21 @@ bool RenderContextGL::frame(const Frame* frame) {
             }
 
             // Bind Program.
-            ProgramData& program_data = program_map_.at(*current->program);
+            ProgramData& program_data = program_it->second;
             if (!previous || previous->program != current->program) {
                 GL_CHECK(glUseProgram(program_data.program));
+                stats_.program_binds++;
             }
 
-            // Bind uniforms.
-            UniformBinder binder;
-            for (auto& entry : current->uniforms) {
-                auto uniform_name = entry.first;
-                auto location = program_data.uniform_location_map.find(uniform_name);
-                GLint uniform_location;
-                if (location != program_data.uniform_location_map.end()) {
-                    uniform_location = (*location).second;
-                } else {
-                    // A uniform inside a (converted) uniform block may have been remapped to a
-                    // location inside a struct uniform caled _<id>. When looking up the uniform
-                    // location, take this into account.
-                    auto uniform_remap_id = program_data.uniform_remap_ids.find(uniform_name);
-                    std::string remapped_uniform_name =
-                        uniform_remap_id == program_data.uniform_remap_ids.end()
-                            ? uniform_name
-                            : fmt::format("_{}.{}", uniform_remap_id->second, uniform_name);
-
-                    // Look up the uniform location.
-                    GL_CHECK(uniform_location = glGetUniformLocation(
-                                 program_data.program, remapped_uniform_name.c_str()));
-                    program_data.uniform_location_map.emplace(uniform_name, uniform_location);
-                    if (uniform_location == -1) {
-                        logger_.warn("[Frame] Unknown or optimised out uniform '{}', skipping.",
-                                     uniform_name);
-                    }
-                }
-                if (uniform_location == -1) {
-                    continue;
-                }
-                binder.updateUniform(uniform_location, entry.second);
-            }
-
-            // Bind textures.
-            for (uint j = 0; j < current->textures.size(); ++j) {
-                const auto& texture = current->textures[j];
-
-                GL_CHECK(glActiveTexture(GL_TEXTURE0 + j));
-
-                auto texture_unit_it =
-                    program_data.binding_location_to_texture_unit.find(texture.binding_location);
-                if (texture_unit_it == program_data.binding_location_to_texture_unit.end()) {
-                    logger_.warn("Binding location {} does not correspond to a texture.",
-                                 texture.binding_location);
-                    GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
-                    GL_CHECK(glBindSampler(j, 0));
-                    continue;
-                }
-
-                const auto& texture_data = texture_map_.at(texture.handle);
-                GL_CHECK(glBindTexture(GL_TEXTURE_2D, texture_data.texture));
-                if (texture.sampler_info.sampler_flags != 0) {
-                    auto sampler_info = texture.sampler_info;
-                    if (!texture_data.has_mip_maps) {
-                        sampler_info.sampler_flags &= ~SamplerFlag::maskMipFilter;
-                    }
-                    GLuint sampler = sampler_cache_.findOrCreate(sampler_info);
-                    GL_CHECK(glBindSampler(j, sampler));
-                } else {
-                    GL_CHECK(glBindSampler(j, 0));
-                }
-            }
-            // Unbind any previously bound texture units.
-            for (int j = current->textures.size(); j < previous_max_texture_unit; ++j) {
-                GL_CHECK(glActiveTexture(GL_TEXTURE0 + j));
-                GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
-                GL_CHECK(glBindSampler(j, 0));
-            }
-
-            // Bind vertex data.
-            if (!previous || previous->vb != current->vb) {
-                if (current->vb) {
-                    GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER,
-                                          vertex_buffer_map_.at(*current->vb).vertex_buffer));
-                }
-            }
-
-            // Bind attributes.
-            for (uint attrib = 0; attrib < current_vertex_decl.attributes_.size(); ++attrib) {
-                GL_CHECK(glDisableVertexAttribArray(attrib));
-            }
-            if (current->vb) {
-                current_vertex_decl = current->vertex_decl_override.empty()
-                                          ? vertex_buffer_map_.at(*current->vb).decl
-                                          : current->vertex_decl_override;
-                setupVertexArrayAttributes(current_vertex_decl, current->vb_offset);
-            } else {
-                current_vertex_decl = VertexDecl{};
-            }
+            // Bind uniforms and resources.
+            bindUniforms(program_data, *current);
+            bindUniformBuffers(program_data, *current);
+            bindTextures(program_data, *current);
+            bindBindlessTextures(program_data);
+            bindStorageBuffers(*current);
 
-            // Bind element data.
-            if (!previous || previous->ib != current->ib) {
-                if (current->ib) {
-                    GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
-                                          index_buffer_map_.at(*current->ib).element_buffer));
-                } else {
-                    GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
-                }
-            }
+            // Bind vertex and element data.
+            bindVertexArray(*current, frame);
 
             // Set viewport masks. These will need to be unset after processing the command to avoid
             // clobbering the next glClear call.
@@ -910,18 +1272,69 @@ bool RenderContextGL::frame(const Frame* frame) {
                                    current->scissor_width, current->scissor_height));
             }
 
+            // Begin the draw condition and occlusion query. If the oldest query object hasn't been
+            // read back yet, its result is dropped.
+#if DW_GL_VERSION != DW_GLES_300
+            if (condition_query != 0 && conditional_rendering_supported_) {
+                GL_CHECK(glBeginConditionalRender(condition_query, GL_QUERY_NO_WAIT));
+            }
+#endif
+            OcclusionQueryData* occlusion_query = nullptr;
+            if (current->occlusion_query) {
+                auto query_it = occlusion_query_map_.find(*current->occlusion_query);
+                if (query_it != occlusion_query_map_.end()) {
+                    occlusion_query = &query_it->second;
+                    usize index = occlusion_query->next;
+                    occlusion_query->next = (index + 1) % kOcclusionQueryObjectCount;
+                    occlusion_query->pending[index] = true;
+                    occlusion_query->last_written = occlusion_query->queries[index];
+                    GL_CHECK(glBeginQuery(kOcclusionQueryTarget, occlusion_query->last_written));
+                }
+            }
+
             // Submit.
-            if (current->primitive_count > 0) {
+            if (current->indirect_buffer) {
+                submitIndirect(*current);
+            } else if (current->primitive_count > 0 && current->instance_count > 0) {
+                stats_.draw_calls++;
+                stats_.primitives += u64(current->primitive_count) * current->instance_count;
                 if (current->ib) {
                     GLenum element_type = index_buffer_map_.at(*current->ib).type;
-                    GL_CHECK(glDrawElements(
-                        GL_TRIANGLES, current->primitive_count * 3, element_type,
-                        reinterpret_cast<void*>(static_cast<std::intptr_t>(current->ib_offset))));
+                    void* ib_offset =
+                        reinterpret_cast<void*>(static_cast<std::intptr_t>(current->ib_offset));
+                    GLsizei count = current->primitive_count * 3;
+                    if (current->base_vertex != 0 && draw_base_vertex_supported_) {
+#if DW_GL_VERSION != DW_GLES_300
+                        GL_CHECK(glDrawElementsInstancedBaseVertex(
+                            GL_TRIANGLES, count, element_type, ib_offset, current->instance_count,
+                            current->base_vertex));
+#endif
+                    } else if (current->instance_count > 1) {
+                        GL_CHECK(glDrawElementsInstanced(GL_TRIANGLES, count, element_type,
+                                                         ib_offset, current->instance_count));
+                    } else {
+                        GL_CHECK(glDrawElements(GL_TRIANGLES, count, element_type, ib_offset));
+                    }
                 } else {
-                    GL_CHECK(glDrawArrays(GL_TRIANGLES, 0, current->primitive_count * 3));
+                    if (current->instance_count > 1) {
+                        GL_CHECK(glDrawArraysInstanced(GL_TRIANGLES, 0,
+                                                       current->primitive_count * 3,
+                                                       current->instance_count));
+                    } else {
+                        GL_CHECK(glDrawArrays(GL_TRIANGLES, 0, current->primitive_count * 3));
+                    }
                 }
             }
 
+            if (occlusion_query) {
+                GL_CHECK(glEndQuery(kOcclusionQueryTarget));
+            }
+#if DW_GL_VERSION != DW_GLES_300
+            if (condition_query != 0 && conditional_rendering_supported_) {
+                GL_CHECK(glEndConditionalRender());
+            }
+#endif
+
             // Restore viewport masks.
             if (!current->colour_write) {
                 GL_CHECK(glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE));
@@ -932,18 +1345,39 @@ bool RenderContextGL::frame(const Frame* frame) {
             if (current->scissor_enabled) {
                 GL_CHECK(glDisable(GL_SCISSOR_TEST));
             }
+            previous = current;
+        }
+        for (; next_timestamp != timestamps.end(); ++next_timestamp) {
+            GL_CHECK(glQueryCounter(timing_frame.queries[next_timestamp->second], GL_TIMESTAMP));
         }
 
-        // Unbind all previously bound texture units.
-        for (int j = 0; j < previous_max_texture_unit; ++j) {
-            GL_CHECK(glActiveTexture(GL_TEXTURE0 + j));
-            GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
-            GL_CHECK(glBindSampler(j, 0));
+        // Discard attachments which aren't needed after this queue.
+        invalidateFrameBuffer(q, ops.colour_store == RenderQueue::StoreOp::DontCare,
+                              ops.depth_store == RenderQueue::StoreOp::DontCare);
+
+#if DW_GL_VERSION != DW_GLES_300
+        if (labelled) {
+            GL_CHECK(glPopDebugGroup());
         }
+#endif
+    }
+
+    // Commands bind buffers, which must not be recorded in a cached VAO.
+    if (bound_vao_ != vao_) {
+        GL_CHECK(glBindVertexArray(vao_));
+        bound_vao_ = vao_;
     }
 
+    endGpuTiming();
+
     // Swap buffers.
-    glfwSwapBuffers(window_);
+    {
+        DW_TRACE_SCOPE("RenderContextGL::swapBuffers");
+        glfwSwapBuffers(window_);
+    }
+#ifndef DGA_EMSCRIPTEN
+    frame_fences_.push_back(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+#endif
 
     // Continue rendering.
     return true;
@@ -960,7 +1394,10 @@ void RenderContextGL::operator()(const cmd::CreateVertexBuffer& c) {
     } else {
         GL_CHECK(glBufferData(GL_ARRAY_BUFFER, c.size, nullptr, usage));
     }
-    vertex_buffer_map_.insert({c.handle, VertexBufferData{vbo, c.decl, usage, c.size}});
+    vertex_buffer_map_.insert(
+        {c.handle, VertexBufferData{vbo, c.decl, vertexDeclId(c.decl), usage, c.size}});
+    setResourceMemory(MemoryCategory::VertexBuffers, c.handle,
+                      std::max<usize>(c.size, c.data.size()));
 }
 
 void RenderContextGL::operator()(const cmd::UpdateVertexBuffer& c) {
@@ -969,6 +1406,7 @@ void RenderContextGL::operator()(const cmd::UpdateVertexBuffer& c) {
     if (c.data.size() > vb_data.size) {
         GL_CHECK(glBufferData(GL_ARRAY_BUFFER, c.data.size(), c.data.data(), vb_data.usage));
         vb_data.size = c.data.size();
+        setResourceMemory(MemoryCategory::VertexBuffers, c.handle, vb_data.size);
     } else {
         GL_CHECK(glBufferSubData(GL_ARRAY_BUFFER, c.offset, c.data.size(), c.data.data()));
     }
@@ -976,8 +1414,10 @@ void RenderContextGL::operator()(const cmd::UpdateVertexBuffer& c) {
 
 void RenderContextGL::operator()(const cmd::DeleteVertexBuffer& c) {
     auto it = vertex_buffer_map_.find(c.handle);
+    forgetVertexArrayBuffer(it->second.vertex_buffer);
     GL_CHECK(glDeleteBuffers(1, &it->second.vertex_buffer));
     vertex_buffer_map_.erase(it);
+    setResourceMemory(MemoryCategory::VertexBuffers, c.handle, 0);
 }
 
 void RenderContextGL::operator()(const cmd::CreateIndexBuffer& c) {
@@ -997,6 +1437,8 @@ void RenderContextGL::operator()(const cmd::CreateIndexBuffer& c) {
                          static_cast<GLenum>(c.type == IndexBufferType::U16 ? GL_UNSIGNED_SHORT
                                                                             : GL_UNSIGNED_INT),
                          usage, c.size}});
+    setResourceMemory(MemoryCategory::IndexBuffers, c.handle,
+                      std::max<usize>(c.size, c.data.size()));
 }
 
 void RenderContextGL::operator()(const cmd::UpdateIndexBuffer& c) {
@@ -1006,6 +1448,7 @@ void RenderContextGL::operator()(const cmd::UpdateIndexBuffer& c) {
         GL_CHECK(
             glBufferData(GL_ELEMENT_ARRAY_BUFFER, c.data.size(), c.data.data(), ib_data.usage));
         ib_data.size = c.data.size();
+        setResourceMemory(MemoryCategory::IndexBuffers, c.handle, ib_data.size);
     } else {
         GL_CHECK(glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, c.offset, c.data.size(), c.data.data()));
     }
@@ -1013,173 +1456,325 @@ void RenderContextGL::operator()(const cmd::UpdateIndexBuffer& c) {
 
 void RenderContextGL::operator()(const cmd::DeleteIndexBuffer& c) {
     auto it = index_buffer_map_.find(c.handle);
+    forgetVertexArrayBuffer(it->second.element_buffer);
     GL_CHECK(glDeleteBuffers(1, &it->second.element_buffer));
     index_buffer_map_.erase(it);
+    setResourceMemory(MemoryCategory::IndexBuffers, c.handle, 0);
 }
 
-void RenderContextGL::operator()(const cmd::CreateProgram& c) {
-    ProgramData program_data;
-    GL_CHECK(program_data.program = glCreateProgram());
+void RenderContextGL::operator()(const cmd::CreateIndirectBuffer& c) {
+    GLenum usage = mapBufferUsage(c.usage);
+    GLuint buffer;
+    GL_CHECK(glGenBuffers(1, &buffer));
+    GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer));
+    GL_CHECK(glBufferData(GL_DRAW_INDIRECT_BUFFER, c.size, c.data.data(), usage));
+    indirect_buffer_map_.insert({c.handle, BufferData{buffer, usage, c.size}});
+    setResourceMemory(MemoryCategory::StorageBuffers, c.handle, c.size);
+}
 
-    // Transpile each provided shader stage to GLSL.
-    std::vector<GLuint> created_shaders;
-    created_shaders.reserve(c.stages.size());
-    for (const auto& stage : c.stages) {
-        GLuint shader = 0;
-        GL_CHECK(shader = glCreateShader(kShaderStageMap.at(stage.stage)));
-
-        // Convert SPIR-V into GLSL.
-        spirv_cross::CompilerGLSL glsl{reinterpret_cast<const u32*>(stage.spirv.data()),
-                                       stage.spirv.size() / sizeof(u32)};
-        spirv_cross::ShaderResources resources = glsl.get_shader_resources();
-
-        // Remap texture binding locations.
-        u32 next_texture_binding_location = 0;
-        std::map<u32, const spirv_cross::Resource*> sampled_images_by_binding;
-        for (const auto& resource : resources.sampled_images) {
-            sampled_images_by_binding[glsl.get_decoration(resource.id, spv::DecorationBinding)] =
-                &resource;
-        }
-        for (const auto& entry : sampled_images_by_binding) {
-            const auto& resource = *entry.second;
-            u32 set = glsl.get_decoration(resource.id, spv::DecorationDescriptorSet);
-            u32 binding = glsl.get_decoration(resource.id, spv::DecorationBinding);
-            u32 new_binding = next_texture_binding_location++;
-            logger_.debug(
-                "Remapping sampled image with location(set={}, binding={}) to location(binding={})",
-                set, binding, new_binding);
-            glsl.unset_decoration(resource.id, spv::DecorationDescriptorSet);
-            glsl.set_decoration(resource.id, spv::DecorationBinding, new_binding);
-            assert(program_data.binding_location_to_texture_unit.count(binding) == 0);
-            program_data.binding_location_to_texture_unit[binding] = new_binding;
-        }
+void RenderContextGL::operator()(const cmd::UpdateIndirectBuffer& c) {
+    auto& buffer_data = indirect_buffer_map_.at(c.handle);
+    GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer_data.buffer));
+    GL_CHECK(glBufferSubData(GL_DRAW_INDIRECT_BUFFER, c.offset, c.data.size(), c.data.data()));
+}
 
-        // If we use the 'emit_uniform_buffer_as_plain_uniforms' option on an empty uniform block,
-        // variables are going to be prefixed with _<id>, where <id> is the resource ID in SPIR-V.
-        // In those cases, we need to store that information so it can be looked up during frame().
-        for (const auto& resource : resources.uniform_buffers) {
-            if (!glsl.get_name(resource.id).empty()) {
-                continue;
-            }
+void RenderContextGL::operator()(const cmd::DeleteIndirectBuffer& c) {
+    auto it = indirect_buffer_map_.find(c.handle);
+    GL_CHECK(glDeleteBuffers(1, &it->second.buffer));
+    indirect_buffer_map_.erase(it);
+    setResourceMemory(MemoryCategory::StorageBuffers, c.handle, 0);
+}
 
-            const spirv_cross::SPIRType& type = glsl.get_type(resource.base_type_id);
-            usize member_count = type.member_types.size();
-            for (usize i = 0; i < member_count; ++i) {
-                auto member_name = glsl.get_member_name(type.self, i);
-                assert(program_data.uniform_remap_ids.count(member_name) == 0);
-                program_data.uniform_remap_ids[member_name] = resource.id;
-            }
-        }
+void RenderContextGL::operator()(const cmd::CreateStorageBuffer& c) {
+    if (!compute_supported_) {
+        logger_.error("[CreateStorageBuffer] Storage buffers are not supported by this device.");
+    }
+    GLenum usage = mapBufferUsage(c.usage);
+    GLuint buffer;
+    GL_CHECK(glGenBuffers(1, &buffer));
+    GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, buffer));
+    GL_CHECK(glBufferData(GL_ARRAY_BUFFER, c.size, c.data.data(), usage));
+    storage_buffer_map_.insert({c.handle, BufferData{buffer, usage, c.size}});
+    setResourceMemory(MemoryCategory::StorageBuffers, c.handle, c.size);
+}
 
-        // Compile to GLSL, ready to give to GL driver.
-        spirv_cross::CompilerGLSL::Options options;
-        options.emit_push_constant_as_uniform_buffer = true;
-        options.emit_uniform_buffer_as_plain_uniforms = true;
-#if DW_GL_VERSION == DW_GL_410
-        options.version = 410;
-        options.es = false;
-#elif DW_GL_VERSION == DW_GLES_300
-        options.version = 300;
-        options.es = true;
-#else
-#error "Unsupported DW_GL_VERSION"
-#endif
-        glsl.set_common_options(options);
-        std::string source = glsl.compile();
+void RenderContextGL::operator()(const cmd::UpdateStorageBuffer& c) {
+    auto& buffer_data = storage_buffer_map_.at(c.handle);
+    GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, buffer_data.buffer));
+    GL_CHECK(glBufferSubData(GL_ARRAY_BUFFER, c.offset, c.data.size(), c.data.data()));
+}
 
-        // Postprocess the GLSL to remove a GL 4.2 extension, which doesn't exist on macOS.
-#if DGA_PLATFORM == DGA_MACOS
-        source = dga::strReplaceAll(source, "#extension GL_ARB_shading_language_420pack : require",
-                                    "#extension GL_ARB_shading_language_420pack : disable");
-#endif
+void RenderContextGL::operator()(const cmd::DeleteStorageBuffer& c) {
+    auto it = storage_buffer_map_.find(c.handle);
+    GL_CHECK(glDeleteBuffers(1, &it->second.buffer));
+    storage_buffer_map_.erase(it);
+    setResourceMemory(MemoryCategory::StorageBuffers, c.handle, 0);
+}
 
-        // Compile the shader.
-        // logger_.debug("Decompiled GLSL from SPIR-V: {}", source);
-        const char* sources_cstr = source.c_str();
-        GL_CHECK(glShaderSource(shader, 1, &sources_cstr, nullptr));
-        GL_CHECK(glCompileShader(shader));
+void RenderContextGL::operator()(const cmd::CreateUniformBuffer& c) {
+    GLenum usage = mapBufferUsage(c.usage);
+    GLuint buffer;
+    GL_CHECK(glGenBuffers(1, &buffer));
+    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, buffer));
+    GL_CHECK(glBufferData(GL_UNIFORM_BUFFER, c.size, nullptr, usage));
+    if (c.data.size() > 0) {
+        GL_CHECK(glBufferSubData(GL_UNIFORM_BUFFER, 0, std::min<usize>(c.data.size(), c.size),
+                                 c.data.data()));
+    }
+    uniform_buffer_map_.insert({c.handle, BufferData{buffer, usage, c.size}});
+    setResourceMemory(MemoryCategory::UniformBuffers, c.handle, c.size);
+}
 
-        // Check compilation result.
-        GLint result;
-        GL_CHECK(glGetShaderiv(shader, GL_COMPILE_STATUS, &result));
-        if (result == GL_FALSE) {
-            int info_log_length;
-            GL_CHECK(glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &info_log_length));
-            std::string error_message(info_log_length, '\0');
-            GL_CHECK(glGetShaderInfoLog(shader, info_log_length, nullptr, error_message.data()));
-            logger_.error("[CreateProgram] Shader compile error: {}", error_message);
-            return;
-        }
+void RenderContextGL::operator()(const cmd::UpdateUniformBuffer& c) {
+    auto& buffer_data = uniform_buffer_map_.at(c.handle);
+    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, buffer_data.buffer));
+    GL_CHECK(glBufferSubData(GL_UNIFORM_BUFFER, c.offset, c.data.size(), c.data.data()));
+}
 
-        // Attach shader to program.
-        GL_CHECK(glAttachShader(program_data.program, shader));
-        created_shaders.push_back(shader);
+void RenderContextGL::operator()(const cmd::DeleteUniformBuffer& c) {
+    auto it = uniform_buffer_map_.find(c.handle);
+    // GL unbinds a deleted buffer from every binding point, and may reuse its name.
+    for (auto& range : bound_uniform_buffer_ranges_) {
+        if (range.buffer == it->second.buffer) {
+            range = UniformBufferRange{0, 0, 0};
+        }
     }
+    GL_CHECK(glDeleteBuffers(1, &it->second.buffer));
+    uniform_buffer_map_.erase(it);
+    setResourceMemory(MemoryCategory::UniformBuffers, c.handle, 0);
+}
 
-    // Link program.
-    GL_CHECK(glLinkProgram(program_data.program));
+void RenderContextGL::operator()(const cmd::CreateProgram& c) {
+    ProgramData program_data;
+    GL_CHECK(program_data.program = glCreateProgram());
 
-    // Check the result of the link process.
-    GLint result = GL_FALSE;
-    glGetProgramiv(program_data.program, GL_LINK_STATUS, &result);
-    if (result == GL_FALSE) {
-        int info_log_length;
-        GL_CHECK(glGetProgramiv(program_data.program, GL_INFO_LOG_LENGTH, &info_log_length));
-        std::string error_message(info_log_length, '\0');
-        GL_CHECK(glGetProgramInfoLog(program_data.program, info_log_length, nullptr,
-                                     error_message.data()));
-        logger_.error("[CreateProgram] Shader link error: {}", error_message);
+    // Try to restore a program binary saved by a previous run, which skips cross-compilation and
+    // compilation entirely.
+    u64 cache_key = 0;
+    if (programBinaryCacheEnabled()) {
+        cache_key = programCacheKey(c);
+        if (loadCachedProgram(cache_key, program_data)) {
+            program_map_.emplace(c.handle, std::move(program_data));
+            setProgramReady(c.handle, true);
+            return;
+        }
+        GL_CHECK(glProgramParameteri(program_data.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                                     GL_TRUE));
     }
 
-    // Destroy leftover shaders.
-    for (auto shader : created_shaders) {
-        GL_CHECK(glDeleteShader(shader));
+    // Async programs are cross-compiled on the worker pool, then compiled and linked by
+    // finishAsyncPrograms() once they're done, as GL calls need to happen on the render thread.
+    if (c.async && program_worker_pool_) {
+        pending_programs_.emplace(c.handle, PendingProgram{std::move(program_data), cache_key});
+        program_worker_pool_->submit([this, handle = c.handle, stages = c.stages](usize) {
+            auto program = crossCompileProgram(stages);
+            std::lock_guard<std::mutex> lock{cross_compiled_programs_mutex_};
+            cross_compiled_programs_.emplace_back(handle, std::move(program));
+        });
+        return;
     }
 
-    program_map_.emplace(c.handle, std::move(program_data));
+    linkProgram(c.handle, std::move(program_data), cache_key, crossCompileProgram(c.stages));
 }
 
 void RenderContextGL::operator()(const cmd::DeleteProgram& c) {
+    setProgramReady(c.handle, false);
     auto it = program_map_.find(c.handle);
+    auto pending_it = pending_programs_.find(c.handle);
     if (it != program_map_.end()) {
         GL_CHECK(glDeleteProgram(it->second.program));
         program_map_.erase(it);
+    } else if (pending_it != pending_programs_.end()) {
+        // The program is still being cross-compiled. Its result is discarded once it's done.
+        GL_CHECK(glDeleteProgram(pending_it->second.program_data.program));
+        pending_programs_.erase(pending_it);
     } else {
         logger_.error("[DeleteProgram] Unable to find program with handle {}", u32(c.handle));
     }
 }
 
+void RenderContextGL::operator()(const cmd::CreateUniform& c) {
+    u32 index = static_cast<u32>(c.handle);
+    if (index >= uniform_names_.size()) {
+        uniform_names_.resize(index + 1);
+    }
+    uniform_names_[index] = c.name;
+}
+
 void RenderContextGL::operator()(const cmd::CreateTexture2D& c) {
+    if (!texture_format_supported_[static_cast<usize>(c.format)]) {
+        logger_.error("[CreateTexture2D] Texture format {} is not supported by this device.",
+                      static_cast<u32>(c.format));
+        return;
+    }
+    // GL reads the whole of each level which has data, so a short level would be read past.
+    for (usize level = 0; level < c.mip_levels.size(); ++level) {
+        usize expected_size = textureLevelSize(c.format, std::max(c.width >> level, 1),
+                                               std::max(c.height >> level, 1)) *
+                              std::max<u32>(c.array_layers, 1);
+        if (c.mip_levels[level].data() && c.mip_levels[level].size() < expected_size) {
+            logger_.error("[CreateTexture2D] Mip level {} of texture {} has size {}, expected {}.",
+                          level, static_cast<u32>(c.handle), c.mip_levels[level].size(),
+                          expected_size);
+            return;
+        }
+    }
+
+    GLenum target = c.array_layers > 0 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
     GLuint texture;
     GL_CHECK(glGenTextures(1, &texture));
-    GL_CHECK(glBindTexture(GL_TEXTURE_2D, texture));
+    GL_CHECK(glBindTexture(target, texture));
+    bound_textures_[active_texture_unit_] = texture;
 
     // Give image data to OpenGL.
     TextureFormatGL format = kTextureFormatMap[static_cast<int>(c.format)];
+    TextureFormatInfo format_info = textureFormatInfo(c.format);
     logger_.debug(
         "[CreateTexture2D] format {} - internal fmt: {:#x} - internal fmt srgb: {:#x} - fmt: {:#x} "
         "- type: {:#x}",
         static_cast<u32>(c.format), format.internal_format, format.internal_format_srgb,
         format.format, format.type);
-    GL_CHECK(glTexImage2D(GL_TEXTURE_2D, 0, format.internal_format, c.width, c.height, 0,
-                          format.format, format.type, c.data.data()));
 
-    // Generate mipmaps.
-    if (c.generate_mipmaps) {
-        GL_CHECK(glGenerateMipmap(GL_TEXTURE_2D));
+    // Level data is tightly packed.
+    GL_CHECK(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+    usize level_count = std::max<usize>(c.mip_levels.size(), 1);
+    for (usize level = 0; level < level_count; ++level) {
+        auto width = static_cast<GLsizei>(std::max(c.width >> level, 1));
+        auto height = static_cast<GLsizei>(std::max(c.height >> level, 1));
+        const byte* data = level < c.mip_levels.size() ? c.mip_levels[level].data() : nullptr;
+        auto gl_level = static_cast<GLint>(level);
+        if (c.array_layers > 0) {
+            auto layers = static_cast<GLsizei>(c.array_layers);
+            if (format_info.compressed) {
+                auto size = static_cast<GLsizei>(textureLevelSize(c.format, width, height) *
+                                                 c.array_layers);
+                GL_CHECK(glCompressedTexImage3D(target, gl_level, format.internal_format, width,
+                                                height, layers, 0, size, data));
+            } else {
+                GL_CHECK(glTexImage3D(target, gl_level, format.internal_format, width, height,
+                                      layers, 0, format.format, format.type, data));
+            }
+        } else if (format_info.compressed) {
+            auto size = static_cast<GLsizei>(textureLevelSize(c.format, width, height));
+            GL_CHECK(glCompressedTexImage2D(target, gl_level, format.internal_format, width,
+                                            height, 0, size, data));
+        } else {
+            GL_CHECK(glTexImage2D(target, gl_level, format.internal_format, width, height, 0,
+                                  format.format, format.type, data));
+        }
+    }
+
+    // Use the provided mip chain, or generate mipmaps. The driver can't generate mipmaps for
+    // compressed formats.
+    bool has_mip_maps = false;
+    if (c.mip_levels.size() > 1) {
+        GL_CHECK(glTexParameteri(target, GL_TEXTURE_MAX_LEVEL,
+                                 static_cast<GLint>(c.mip_levels.size() - 1)));
+        has_mip_maps = true;
+    } else if (c.generate_mipmaps && !format_info.compressed) {
+        GL_CHECK(glGenerateMipmap(target));
+        has_mip_maps = true;
+    } else {
+        GL_CHECK(glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 0));
+    }
+
+    // Add the texture to the bindless texture table. Resident textures can't be modified, other
+    // than their contents.
+    GLuint64 bindless_handle = 0;
+    if (c.bindless && bindless_texturing_supported_) {
+        RenderItem::SamplerInfo sampler_info{SamplerFlag::Default, 0.0f};
+        if (!has_mip_maps) {
+            sampler_info.sampler_flags &= ~SamplerFlag::maskMipFilter;
+        }
+        GLuint sampler = sampler_cache_.findOrCreate(sampler_info, stats_.sampler_cache);
+        GL_CHECK(bindless_handle = get_texture_sampler_handle_(texture, sampler));
+        GL_CHECK(make_texture_handle_resident_(bindless_handle));
+        u32 index = c.handle.index();
+        if (index >= bindless_texture_handles_.size()) {
+            bindless_texture_handles_.resize(index + 1, 0);
+        }
+        bindless_texture_handles_[index] = bindless_handle;
+        bindless_texture_table_version_++;
     }
 
     // Add texture.
-    texture_map_.emplace(c.handle, TextureData{texture, c.generate_mipmaps});
+    bool generated_mip_maps = has_mip_maps && c.mip_levels.size() <= 1;
+    texture_map_.emplace(c.handle, TextureData{texture, target, has_mip_maps,
+                                               format.internal_format, c.format,
+                                               generated_mip_maps, bindless_handle});
+    u32 mip_count = generated_mip_maps ? textureMipCount(c.width, c.height)
+                                       : static_cast<u32>(level_count);
+    setResourceMemory(c.framebuffer_usage ? MemoryCategory::RenderTargets
+                                          : MemoryCategory::Textures,
+                      c.handle,
+                      textureLevelsSize(c.format, c.width, c.height, 0, mip_count) *
+                          std::max<u32>(c.array_layers, 1));
 }
 
-void RenderContextGL::operator()(const cmd::DeleteTexture& c) {
+void RenderContextGL::operator()(const cmd::UpdateTexture2D& c) {
     auto it = texture_map_.find(c.handle);
-    GL_CHECK(glDeleteTextures(1, &it->second.texture));
-    texture_map_.erase(it);
-}
+    if (it == texture_map_.end()) {
+        logger_.error("[UpdateTexture2D] Texture {} doesn't exist.", static_cast<u32>(c.handle));
+        return;
+    }
+    const auto& texture_data = it->second;
+
+    // Stage the data in the next upload buffer. Respecifying its storage orphans the previous
+    // contents, so the driver doesn't need to wait for an earlier upload from it to finish.
+    auto& upload_buffer = texture_upload_buffers_[next_texture_upload_buffer_];
+    next_texture_upload_buffer_ = (next_texture_upload_buffer_ + 1) % kTextureUploadBufferCount;
+    if (upload_buffer.buffer == 0) {
+        GL_CHECK(glGenBuffers(1, &upload_buffer.buffer));
+    }
+    GL_CHECK(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload_buffer.buffer));
+    if (c.data.size() > upload_buffer.size) {
+        upload_buffer.size = std::max<size_t>(c.data.size(), upload_buffer.size * 2);
+    }
+    GL_CHECK(glBufferData(GL_PIXEL_UNPACK_BUFFER, upload_buffer.size, nullptr, GL_STREAM_DRAW));
+    GL_CHECK(glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, c.data.size(), c.data.data()));
+
+    // With a pixel unpack buffer bound, the data pointer is an offset into the buffer.
+    GL_CHECK(glBindTexture(GL_TEXTURE_2D, texture_data.texture));
+    bound_textures_[active_texture_unit_] = texture_data.texture;
+    GL_CHECK(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+    auto level = static_cast<GLint>(c.mip_level);
+    if (textureFormatInfo(texture_data.format).compressed) {
+        GL_CHECK(glCompressedTexSubImage2D(GL_TEXTURE_2D, level, c.x, c.y, c.width, c.height,
+                                           texture_data.internal_format,
+                                           static_cast<GLsizei>(c.data.size()), nullptr));
+    } else {
+        TextureFormatGL format = kTextureFormatMap[static_cast<int>(texture_data.format)];
+        GL_CHECK(glTexSubImage2D(GL_TEXTURE_2D, level, c.x, c.y, c.width, c.height, format.format,
+                                 format.type, nullptr));
+    }
+    GL_CHECK(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
 
-void RenderContextGL::operator()(const cmd::CreateFrameBuffer& c) {
+    if (c.mip_level == 0 && texture_data.generated_mip_maps) {
+        GL_CHECK(glGenerateMipmap(GL_TEXTURE_2D));
+    }
+}
+
+void RenderContextGL::operator()(const cmd::DeleteTexture& c) {
+    auto it = texture_map_.find(c.handle);
+    if (it == texture_map_.end()) {
+        logger_.error("[DeleteTexture] Texture {} doesn't exist.", static_cast<u32>(c.handle));
+        return;
+    }
+    // Remove the texture from the bindless texture table.
+    if (it->second.bindless_handle != 0) {
+        GL_CHECK(make_texture_handle_non_resident_(it->second.bindless_handle));
+        bindless_texture_handles_[c.handle.index()] = 0;
+        bindless_texture_table_version_++;
+    }
+    // Deleting a texture unbinds it from every texture unit.
+    std::replace(bound_textures_.begin(), bound_textures_.end(), it->second.texture, GLuint{0});
+    GL_CHECK(glDeleteTextures(1, &it->second.texture));
+    texture_map_.erase(it);
+    setResourceMemory(MemoryCategory::Textures, c.handle, 0);
+    setResourceMemory(MemoryCategory::RenderTargets, c.handle, 0);
+}
+
+void RenderContextGL::operator()(const cmd::CreateFrameBuffer& c) {
     FrameBufferData fb_data;
     fb_data.textures = c.textures;
     fb_data.width = c.width;
@@ -1219,17 +1814,75 @@ void RenderContextGL::operator()(const cmd::CreateFrameBuffer& c) {
 
     // Add to map.
     frame_buffer_map_.emplace(c.handle, fb_data);
+    setResourceMemory(MemoryCategory::FrameBuffers, c.handle, u64(c.width) * c.height * 4);
+}
+
+void RenderContextGL::operator()(const cmd::DeleteFrameBuffer& c) {
+    auto it = frame_buffer_map_.find(c.handle);
+    if (it == frame_buffer_map_.end()) {
+        return;
+    }
+    GL_CHECK(glDeleteFramebuffers(1, &it->second.frame_buffer));
+    GL_CHECK(glDeleteRenderbuffers(1, &it->second.depth_render_buffer));
+    frame_buffer_map_.erase(it);
+    setResourceMemory(MemoryCategory::FrameBuffers, c.handle, 0);
+}
+
+void RenderContextGL::operator()(const cmd::CreateOcclusionQuery& c) {
+    OcclusionQueryData query_data;
+    GL_CHECK(glGenQueries(kOcclusionQueryObjectCount, query_data.queries.data()));
+    query_data.pending.fill(false);
+    query_data.next = 0;
+    query_data.last_written = 0;
+    occlusion_query_map_.emplace(c.handle, query_data);
 }
 
-void RenderContextGL::operator()(const cmd::DeleteFrameBuffer&) {
-    // TODO: unimplemented.
+void RenderContextGL::operator()(const cmd::DeleteOcclusionQuery& c) {
+    auto query_it = occlusion_query_map_.find(c.handle);
+    if (query_it == occlusion_query_map_.end()) {
+        return;
+    }
+    GL_CHECK(glDeleteQueries(kOcclusionQueryObjectCount, query_it->second.queries.data()));
+    occlusion_query_map_.erase(query_it);
+    setOcclusionQueryResult(c.handle, std::nullopt);
+}
+
+void RenderContextGL::operator()(const cmd::PrewarmPipeline&) {
+    // OpenGL has no pipeline objects. Programs are already linked when they are created.
+}
+
+void RenderContextGL::invalidateFrameBuffer(const RenderQueue& q, bool colour, bool depth) {
+    if (!invalidate_framebuffer_ || (!colour && !depth)) {
+        return;
+    }
+    std::vector<GLenum> attachments;
+    if (q.frame_buffer) {
+        if (colour) {
+            auto colour_attachment_count = frame_buffer_map_.at(*q.frame_buffer).textures.size();
+            for (usize i = 0; i < colour_attachment_count; ++i) {
+                attachments.emplace_back(static_cast<GLenum>(GL_COLOR_ATTACHMENT0 + i));
+            }
+        }
+        if (depth) {
+            attachments.emplace_back(GL_DEPTH_STENCIL_ATTACHMENT);
+        }
+    } else {
+        // The default framebuffer uses different names for its attachments.
+        if (colour) {
+            attachments.emplace_back(GL_COLOR);
+        }
+        if (depth) {
+            attachments.emplace_back(GL_DEPTH);
+            attachments.emplace_back(GL_STENCIL);
+        }
+    }
+    GL_CHECK(invalidate_framebuffer_(GL_FRAMEBUFFER, static_cast<GLsizei>(attachments.size()),
+                                     attachments.data()));
 }
 
-void RenderContextGL::setupVertexArrayAttributes(const VertexDecl& decl, uint vb_offset) {
-    static std::unordered_map<VertexDecl::AttributeType, GLenum> attribute_type_map = {
-        {VertexDecl::AttributeType::Float, GL_FLOAT},
-        {VertexDecl::AttributeType::Uint8, GL_UNSIGNED_BYTE}};
-    u16 attrib_counter = 0;
+uint RenderContextGL::setupVertexArrayAttributes(const VertexDecl& decl, uint vb_offset,
+                                                 uint first_location, uint divisor) {
+    uint attrib_counter = first_location;
     for (auto& attrib : decl.attributes_) {
         // Decode attribute.
         VertexDecl::Attribute attribute;
@@ -1239,8 +1892,8 @@ void RenderContextGL::setupVertexArrayAttributes(const VertexDecl& decl, uint vb
         VertexDecl::decodeAttributes(attrib.first, attribute, count, type, normalised);
 
         // Convert type.
-        auto gl_type = attribute_type_map.find(type);
-        if (gl_type == attribute_type_map.end()) {
+        auto gl_type = kAttributeTypeMap.find(type);
+        if (gl_type == kAttributeTypeMap.end()) {
             logger_.warn("[SetupVertexArrayAttributes] Unknown attribute type: {}", (uint)type);
             continue;
         }
@@ -1255,8 +1908,1238 @@ void RenderContextGL::setupVertexArrayAttributes(const VertexDecl& decl, uint vb
         GL_CHECK(glVertexAttribPointer(attrib_counter, count, gl_type->second,
                                        static_cast<GLboolean>(normalised ? GL_TRUE : GL_FALSE),
                                        decl.stride_, attrib.second + vb_offset));
+        if (divisor != 0) {
+            GL_CHECK(glVertexAttribDivisor(attrib_counter, divisor));
+        }
+        attrib_counter++;
+    }
+    return attrib_counter;
+}
+
+uint RenderContextGL::setupVertexArrayFormat(const VertexDecl& decl, uint first_location,
+                                             uint binding) {
+    uint attrib_counter = first_location;
+    for (auto& attrib : decl.attributes_) {
+        VertexDecl::Attribute attribute;
+        usize count;
+        VertexDecl::AttributeType type;
+        bool normalised;
+        VertexDecl::decodeAttributes(attrib.first, attribute, count, type, normalised);
+
+        auto gl_type = kAttributeTypeMap.find(type);
+        if (gl_type == kAttributeTypeMap.end()) {
+            logger_.warn("[SetupVertexArrayFormat] Unknown attribute type: {}", (uint)type);
+            continue;
+        }
+
+        GL_CHECK(glEnableVertexAttribArray(attrib_counter));
+        auto relative_offset = static_cast<GLuint>(reinterpret_cast<uintptr_t>(attrib.second));
+        GL_CHECK(vertex_attrib_format_(attrib_counter, count, gl_type->second,
+                                       static_cast<GLboolean>(normalised ? GL_TRUE : GL_FALSE),
+                                       relative_offset));
+        GL_CHECK(vertex_attrib_binding_(attrib_counter, binding));
         attrib_counter++;
     }
+    return attrib_counter;
+}
+
+u32 RenderContextGL::vertexDeclId(const VertexDecl& decl) {
+    auto it = vertex_decl_ids_.find(decl);
+    if (it == vertex_decl_ids_.end()) {
+        it = vertex_decl_ids_.emplace(decl, static_cast<u32>(vertex_decl_ids_.size() + 1)).first;
+    }
+    return it->second;
+}
+
+bool RenderContextGL::VertexArrayKey::operator==(const VertexArrayKey& other) const {
+    return decl_id == other.decl_id && instance_decl_id == other.instance_decl_id &&
+           vertex_buffer == other.vertex_buffer && vb_offset == other.vb_offset &&
+           instance_buffer == other.instance_buffer &&
+           instance_vb_offset == other.instance_vb_offset &&
+           element_buffer == other.element_buffer;
+}
+
+usize RenderContextGL::VertexArrayKeyHash::operator()(const VertexArrayKey& key) const {
+    usize hash = 0;
+    dga::hashCombine(hash, key.decl_id, key.instance_decl_id, key.vertex_buffer, key.vb_offset,
+                     key.instance_buffer, key.instance_vb_offset, key.element_buffer);
+    return hash;
+}
+
+void RenderContextGL::bindVertexArray(const RenderItem& item, const Frame* frame) {
+    // Transient vertex data is at a different offset in every draw, so caching a VAO per offset
+    // would only fill up the cache.
+    const auto& transient_vb = frame->transient_vb_storage.handle;
+    bool uses_transient_vb =
+        transient_vb && (item.vb == transient_vb || item.instance_vb == transient_vb);
+    if (!item.vb || (uses_transient_vb && !vertex_attrib_binding_supported_)) {
+        bindDefaultVertexArray(item);
+        return;
+    }
+
+    const auto& vb_data = vertex_buffer_map_.at(*item.vb);
+    const VertexDecl& decl =
+        item.vertex_decl_override.empty() ? vb_data.decl : item.vertex_decl_override;
+    const VertexBufferData* instance_vb_data =
+        item.instance_vb ? &vertex_buffer_map_.at(*item.instance_vb) : nullptr;
+    const VertexDecl* instance_decl = nullptr;
+    if (instance_vb_data) {
+        instance_decl = item.instance_decl_override.empty() ? &instance_vb_data->decl
+                                                            : &item.instance_decl_override;
+    }
+    GLuint instance_buffer = instance_vb_data ? instance_vb_data->vertex_buffer : 0;
+    GLuint element_buffer = item.ib ? index_buffer_map_.at(*item.ib).element_buffer : 0;
+    uint vb_offset = vertexBufferOffset(item, decl);
+
+    VertexArrayKey key;
+    key.decl_id = item.vertex_decl_override.empty() ? vb_data.decl_id : vertexDeclId(decl);
+    if (instance_decl) {
+        key.instance_decl_id = item.instance_decl_override.empty() ? instance_vb_data->decl_id
+                                                                   : vertexDeclId(*instance_decl);
+    }
+    if (!vertex_attrib_binding_supported_) {
+        key.vertex_buffer = vb_data.vertex_buffer;
+        key.vb_offset = vb_offset;
+        key.instance_buffer = instance_buffer;
+        key.instance_vb_offset = item.instance_vb_offset;
+        key.element_buffer = element_buffer;
+    }
+
+    auto it = vertex_array_cache_.find(key);
+    if (it == vertex_array_cache_.end()) {
+        stats_.vertex_decl_cache.misses++;
+        GLuint vao;
+        GL_CHECK(glGenVertexArrays(1, &vao));
+        GL_CHECK(glBindVertexArray(vao));
+        if (vertex_attrib_binding_supported_) {
+            uint next_location = setupVertexArrayFormat(decl, 0, 0);
+            if (instance_decl) {
+                setupVertexArrayFormat(*instance_decl, next_location, 1);
+                GL_CHECK(vertex_binding_divisor_(1, 1));
+            }
+        } else {
+            // The buffers are part of the key, so are set up once.
+            GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, vb_data.vertex_buffer));
+            uint next_location = setupVertexArrayAttributes(decl, vb_offset, 0, 0);
+            if (instance_decl) {
+                GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, instance_buffer));
+                setupVertexArrayAttributes(*instance_decl, item.instance_vb_offset, next_location,
+                                           1);
+            }
+            GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer));
+        }
+        it = vertex_array_cache_.emplace(key, VertexArrayData{vao, 0, 0, 0, 0, 0, 0}).first;
+    } else {
+        stats_.vertex_decl_cache.hits++;
+        if (bound_vao_ != it->second.vao) {
+            GL_CHECK(glBindVertexArray(it->second.vao));
+        }
+    }
+    auto& vao_data = it->second;
+    bound_vao_ = vao_data.vao;
+    vao_data.last_used_frame = vertex_array_frame_;
+
+    // Update the buffer bindings of the VAO if they've changed since it was last used.
+    if (vertex_attrib_binding_supported_) {
+        if (vao_data.vertex_buffer != vb_data.vertex_buffer || vao_data.vb_offset != vb_offset) {
+            GL_CHECK(bind_vertex_buffer_(0, vb_data.vertex_buffer, vb_offset, decl.stride_));
+            vao_data.vertex_buffer = vb_data.vertex_buffer;
+            vao_data.vb_offset = vb_offset;
+        }
+        if (instance_decl && (vao_data.instance_buffer != instance_buffer ||
+                              vao_data.instance_vb_offset != item.instance_vb_offset)) {
+            GL_CHECK(bind_vertex_buffer_(1, instance_buffer, item.instance_vb_offset,
+                                         instance_decl->stride_));
+            vao_data.instance_buffer = instance_buffer;
+            vao_data.instance_vb_offset = item.instance_vb_offset;
+        }
+        if (vao_data.element_buffer != element_buffer) {
+            GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer));
+            vao_data.element_buffer = element_buffer;
+        }
+    }
+}
+
+void RenderContextGL::bindDefaultVertexArray(const RenderItem& item) {
+    if (bound_vao_ != vao_) {
+        GL_CHECK(glBindVertexArray(vao_));
+        bound_vao_ = vao_;
+    }
+
+    // Disable the attributes set up by the last item which used vao_.
+    uint vertex_attrib_count = current_vertex_decl.attributes_.size();
+    uint attrib_count = vertex_attrib_count + current_instance_decl.attributes_.size();
+    for (uint attrib = 0; attrib < attrib_count; ++attrib) {
+        GL_CHECK(glDisableVertexAttribArray(attrib));
+    }
+    for (uint attrib = vertex_attrib_count; attrib < attrib_count; ++attrib) {
+        GL_CHECK(glVertexAttribDivisor(attrib, 0));
+    }
+    current_instance_decl = VertexDecl{};
+    if (item.vb) {
+        const auto& vb_data = vertex_buffer_map_.at(*item.vb);
+        current_vertex_decl =
+            item.vertex_decl_override.empty() ? vb_data.decl : item.vertex_decl_override;
+        GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, vb_data.vertex_buffer));
+        uint next_location = setupVertexArrayAttributes(
+            current_vertex_decl, vertexBufferOffset(item, current_vertex_decl), 0, 0);
+
+        // Per-instance attributes follow the per-vertex attributes.
+        if (item.instance_vb) {
+            const auto& instance_vb_data = vertex_buffer_map_.at(*item.instance_vb);
+            current_instance_decl = item.instance_decl_override.empty()
+                                        ? instance_vb_data.decl
+                                        : item.instance_decl_override;
+            GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, instance_vb_data.vertex_buffer));
+            setupVertexArrayAttributes(current_instance_decl, item.instance_vb_offset,
+                                       next_location, 1);
+        }
+    } else {
+        current_vertex_decl = VertexDecl{};
+    }
+    GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
+                          item.ib ? index_buffer_map_.at(*item.ib).element_buffer : 0));
+}
+
+uint RenderContextGL::vertexBufferOffset(const RenderItem& item, const VertexDecl& decl) const {
+    if (draw_base_vertex_supported_) {
+        return item.vb_offset;
+    }
+    return static_cast<uint>(static_cast<int>(item.vb_offset) + item.base_vertex * decl.stride_);
+}
+
+void RenderContextGL::forgetVertexArrayBuffer(GLuint buffer) {
+    // GL only detaches a deleted buffer from the bound VAO, and may reuse its name for a new
+    // buffer, so cached VAOs must not refer to it by name afterwards.
+    for (auto it = vertex_array_cache_.begin(); it != vertex_array_cache_.end();) {
+        const auto& key = it->first;
+        auto& vao_data = it->second;
+        if (key.vertex_buffer == buffer || key.instance_buffer == buffer ||
+            key.element_buffer == buffer) {
+            GL_CHECK(glDeleteVertexArrays(1, &vao_data.vao));
+            it = vertex_array_cache_.erase(it);
+            continue;
+        }
+        // Clearing the tracked binding causes it to be rebound when the VAO is next used.
+        if (vao_data.vertex_buffer == buffer) {
+            vao_data.vertex_buffer = 0;
+        }
+        if (vao_data.instance_buffer == buffer) {
+            vao_data.instance_buffer = 0;
+        }
+        if (vao_data.element_buffer == buffer) {
+            vao_data.element_buffer = 0;
+        }
+        ++it;
+    }
+}
+
+void RenderContextGL::evictVertexArrays() {
+    // Only scan the cache occasionally, as most VAOs are used every frame.
+    vertex_array_frame_++;
+    if (vertex_array_frame_ % kVertexArrayMaxUnusedFrames != 0) {
+        return;
+    }
+    for (auto it = vertex_array_cache_.begin(); it != vertex_array_cache_.end();) {
+        if (vertex_array_frame_ - it->second.last_used_frame > kVertexArrayMaxUnusedFrames) {
+            GL_CHECK(glDeleteVertexArrays(1, &it->second.vao));
+            it = vertex_array_cache_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+RenderContextGL::UniformMemberRef RenderContextGL::findUniformMember(ProgramData& program_data,
+                                                                    UniformHandle uniform) {
+    u32 index = static_cast<u32>(uniform);
+    if (index >= program_data.uniform_members.size()) {
+        program_data.uniform_members.resize(index + 1);
+    }
+    UniformMemberRef& member_ref = program_data.uniform_members[index];
+    if (member_ref.block != -2) {
+        stats_.uniform_location_cache.hits++;
+        return member_ref;
+    }
+    stats_.uniform_location_cache.misses++;
+
+    // A uniform inside a uniform block without an instance name is recorded as a member of a
+    // block called _<id>. When looking up the uniform, take this into account.
+    const std::string& uniform_name = uniform_names_.at(index);
+    auto uniform_remap_id = program_data.uniform_remap_ids.find(uniform_name);
+    std::string remapped_uniform_name =
+        uniform_remap_id == program_data.uniform_remap_ids.end()
+            ? uniform_name
+            : fmt::format("_{}.{}", uniform_remap_id->second, uniform_name);
+
+    // Find the uniform block member.
+    member_ref.block = -1;
+    for (usize i = 0; i < program_data.uniform_blocks.size(); ++i) {
+        const auto& members = program_data.uniform_blocks[i].members;
+        auto member_it = std::find_if(
+            members.begin(), members.end(),
+            [&](const UniformBlockMember& member) { return member.name == remapped_uniform_name; });
+        if (member_it != members.end()) {
+            member_ref.block = static_cast<int>(i);
+            member_ref.member = static_cast<int>(member_it - members.begin());
+            return member_ref;
+        }
+    }
+    logger_.warn("[Frame] Unknown uniform '{}', skipping.", uniform_name);
+    return member_ref;
+}
+
+void RenderContextGL::bindUniforms(ProgramData& program_data, const RenderItem& item) {
+    for (auto& binding : item.uniforms) {
+        UniformMemberRef member_ref = findUniformMember(program_data, binding.handle);
+        if (member_ref.block < 0) {
+            continue;
+        }
+
+        // Uniforms of a block which is sourced from a uniform buffer are ignored.
+        auto& block = program_data.uniform_blocks[member_ref.block];
+        if (findUniformBufferBinding(item, block.binding_location)) {
+            continue;
+        }
+        writeUniformBlockMember(block, block.members[member_ref.member], binding.data);
+    }
+}
+
+void RenderContextGL::bindUniformBuffers(ProgramData& program_data, const RenderItem& item) {
+    // Make room for the blocks which need streaming first, as orphaning the scratch buffer
+    // invalidates the ranges of blocks which have already been bound.
+    auto needs_streaming = [this, &item](const UniformBlock& block) {
+        return !findUniformBufferBinding(item, block.binding_location) &&
+               (block.dirty || block.scratch_generation != uniform_scratch_generation_);
+    };
+    usize stream_size = 0;
+    for (const auto& block : program_data.uniform_blocks) {
+        if (needs_streaming(block)) {
+            stream_size += alignUniformOffset(block.size, uniform_buffer_offset_alignment_);
+        }
+    }
+    if (uniform_scratch_buffer_ == 0 ||
+        (stream_size > 0 && uniform_scratch_offset_ + stream_size > kUniformScratchBufferSize)) {
+        orphanUniformScratchBuffer();
+    }
+
+    for (auto& block : program_data.uniform_blocks) {
+        const auto* binding = findUniformBufferBinding(item, block.binding_location);
+        if (binding) {
+            const auto& buffer_data = uniform_buffer_map_.at(binding->handle);
+            if (binding->offset + block.size > buffer_data.size) {
+                logger_.error(
+                    "[Frame] Uniform block at binding {} ({} bytes) doesn't fit in uniform buffer "
+                    "{} at offset {}, skipping.",
+                    block.binding_location, block.size, binding->handle, binding->offset);
+                continue;
+            }
+            if (binding->offset % uniform_buffer_offset_alignment_ != 0) {
+                logger_.error(
+                    "[Frame] Uniform buffer {} offset {} isn't a multiple of the device's uniform "
+                    "buffer offset alignment ({}), skipping.",
+                    binding->handle, binding->offset, uniform_buffer_offset_alignment_);
+                continue;
+            }
+            bindUniformBufferRange(block.binding_location, buffer_data.buffer, binding->offset,
+                                   block.size);
+            continue;
+        }
+
+        // Otherwise, the block is sourced from the scratch buffer.
+        if (needs_streaming(block)) {
+            block.scratch_offset = streamUniformBlock(block);
+            block.scratch_generation = uniform_scratch_generation_;
+            block.dirty = false;
+            stats_.uniform_bytes += block.size;
+        }
+        bindUniformBufferRange(block.binding_location, uniform_scratch_buffer_,
+                               block.scratch_offset, block.size);
+    }
+}
+
+void RenderContextGL::writeUniformBlockMember(UniformBlock& block, const UniformBlockMember& member,
+                                              const UniformData& data) {
+    // Uniform values are written to the first element of the member. Matrices are column major,
+    // and each column is padded to the member's matrix stride in std140.
+    struct Columns {
+        const byte* values;
+        u32 count;
+        u32 size;
+    };
+    Columns columns = std::visit(
+        [](const auto& value) {
+            using T = std::decay_t<decltype(value)>;
+            if constexpr (std::is_same_v<T, Mat3>) {
+                return Columns{reinterpret_cast<const byte*>(value.ptr()), 3, 3 * 4};
+            } else if constexpr (std::is_same_v<T, Mat4>) {
+                return Columns{reinterpret_cast<const byte*>(value.ptr()), 4, 4 * 4};
+            } else {
+                return Columns{reinterpret_cast<const byte*>(&value), 1, sizeof(T)};
+            }
+        },
+        data);
+    const u32 count = std::min(columns.count, std::max(member.columns, 1u));
+    const u32 size = std::min(columns.size, member.vec_size * 4);
+    for (u32 column = 0; column < count; ++column) {
+        std::memcpy(block.data.data() + member.offset + column * member.matrix_stride,
+                    columns.values + column * columns.size, size);
+    }
+    block.dirty = true;
+}
+
+usize RenderContextGL::streamUniformBlock(const UniformBlock& block) {
+    usize offset = uniform_scratch_offset_;
+    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, uniform_scratch_buffer_));
+    GL_CHECK(glBufferSubData(GL_UNIFORM_BUFFER, offset, block.size, block.data.data()));
+    uniform_scratch_offset_ =
+        alignUniformOffset(offset + block.size, uniform_buffer_offset_alignment_);
+    return offset;
+}
+
+void RenderContextGL::orphanUniformScratchBuffer() {
+    if (uniform_scratch_buffer_ == 0) {
+        GL_CHECK(glGenBuffers(1, &uniform_scratch_buffer_));
+    }
+    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, uniform_scratch_buffer_));
+    GL_CHECK(glBufferData(GL_UNIFORM_BUFFER, kUniformScratchBufferSize, nullptr, GL_STREAM_DRAW));
+    uniform_scratch_offset_ = 0;
+    uniform_scratch_generation_++;
+}
+
+void RenderContextGL::bindUniformBufferRange(u32 binding, GLuint buffer, usize offset,
+                                             usize size) {
+    if (binding >= bound_uniform_buffer_ranges_.size()) {
+        return;
+    }
+    auto& range = bound_uniform_buffer_ranges_[binding];
+    if (range.buffer == buffer && range.offset == offset && range.size == size) {
+        return;
+    }
+    GL_CHECK(glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer,
+                               static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(size)));
+    range = UniformBufferRange{buffer, offset, size};
+}
+
+void RenderContextGL::assignUniformBlockBindings(ProgramData& program_data) {
+    for (auto& block : program_data.uniform_blocks) {
+        block.data.assign(block.size, 0);
+        block.dirty = true;
+        block.scratch_offset = 0;
+        block.scratch_generation = 0;
+
+        GLuint block_index = GL_INVALID_INDEX;
+        GL_CHECK(block_index = glGetUniformBlockIndex(program_data.program, block.name.c_str()));
+        if (block_index == GL_INVALID_INDEX) {
+            // Optimised out.
+            continue;
+        }
+        if (block.binding_location >= bound_uniform_buffer_ranges_.size()) {
+            logger_.error(
+                "[CreateProgram] Uniform block '{}' at binding {} exceeds the device's {} uniform "
+                "buffer bindings.",
+                block.name, block.binding_location, bound_uniform_buffer_ranges_.size());
+            continue;
+        }
+        GL_CHECK(glUniformBlockBinding(program_data.program, block_index, block.binding_location));
+    }
+}
+
+void RenderContextGL::bindTextures(ProgramData& program_data, const RenderItem& item) {
+    // The range of texture units changed by this item, which are bound in one call if multi-bind
+    // is supported.
+    u32 first_texture_unit = std::numeric_limits<u32>::max(), last_texture_unit = 0;
+    u32 first_sampler_unit = std::numeric_limits<u32>::max(), last_sampler_unit = 0;
+    for (const auto& texture : item.textures) {
+        auto texture_unit_it =
+            program_data.binding_location_to_texture_unit.find(texture.binding_location);
+        if (texture_unit_it == program_data.binding_location_to_texture_unit.end()) {
+            logger_.warn("Binding location {} does not correspond to a texture.",
+                         texture.binding_location);
+            continue;
+        }
+        u32 unit = texture_unit_it->second;
+        if (unit >= bound_textures_.size()) {
+            logger_.warn("Texture unit {} exceeds the number of texture units ({}).", unit,
+                         bound_textures_.size());
+            continue;
+        }
+
+        const auto& texture_data = texture_map_.at(texture.handle);
+        GLuint sampler = 0;
+        if (texture.sampler_info.sampler_flags != 0) {
+            auto sampler_info = texture.sampler_info;
+            if (!texture_data.has_mip_maps) {
+                sampler_info.sampler_flags &= ~SamplerFlag::maskMipFilter;
+            }
+            sampler = sampler_cache_.findOrCreate(sampler_info, stats_.sampler_cache);
+        }
+        if (setBoundTexture(unit, texture_data.target, texture_data.texture)) {
+            first_texture_unit = std::min(first_texture_unit, unit);
+            last_texture_unit = std::max(last_texture_unit, unit);
+        }
+        if (setBoundSampler(unit, sampler)) {
+            first_sampler_unit = std::min(first_sampler_unit, unit);
+            last_sampler_unit = std::max(last_sampler_unit, unit);
+        }
+    }
+
+    // Units in the range which weren't changed are rebound to what they already had bound.
+    if (bind_textures_ && first_texture_unit <= last_texture_unit) {
+        GL_CHECK(bind_textures_(first_texture_unit, last_texture_unit - first_texture_unit + 1,
+                                &bound_textures_[first_texture_unit]));
+    }
+    if (bind_samplers_ && first_sampler_unit <= last_sampler_unit) {
+        GL_CHECK(bind_samplers_(first_sampler_unit, last_sampler_unit - first_sampler_unit + 1,
+                                &bound_samplers_[first_sampler_unit]));
+    }
+}
+
+void RenderContextGL::bindBindlessTextures(ProgramData& program_data) {
+    if (!bindless_texturing_supported_ || program_data.bindless_textures_location == -1) {
+        return;
+    }
+    if (program_data.bindless_textures_location == -2) {
+        GL_CHECK(program_data.bindless_textures_location =
+                     glGetUniformLocation(program_data.program, kBindlessTexturesUniform));
+        if (program_data.bindless_textures_location == -1) {
+            return;
+        }
+    }
+    if (program_data.bindless_textures_version == bindless_texture_table_version_) {
+        return;
+    }
+    // Handles beyond the size of the table uniform are ignored.
+    auto count = std::min<usize>(bindless_texture_handles_.size(), DW_MAX_BINDLESS_TEXTURES);
+    GL_CHECK(uniform_handle_ui64v_(program_data.bindless_textures_location,
+                                   static_cast<GLsizei>(count), bindless_texture_handles_.data()));
+    program_data.bindless_textures_version = bindless_texture_table_version_;
+}
+
+bool RenderContextGL::setBoundTexture(u32 unit, GLenum target, GLuint texture) {
+    if (bound_textures_[unit] == texture) {
+        return false;
+    }
+    bound_textures_[unit] = texture;
+    stats_.texture_binds++;
+    if (!bind_textures_) {
+        if (active_texture_unit_ != unit) {
+            GL_CHECK(glActiveTexture(GL_TEXTURE0 + unit));
+            active_texture_unit_ = unit;
+        }
+        GL_CHECK(glBindTexture(target, texture));
+    }
+    return true;
+}
+
+bool RenderContextGL::setBoundSampler(u32 unit, GLuint sampler) {
+    if (bound_samplers_[unit] == sampler) {
+        return false;
+    }
+    bound_samplers_[unit] = sampler;
+    stats_.sampler_binds++;
+    if (!bind_samplers_) {
+        GL_CHECK(glBindSampler(unit, sampler));
+    }
+    return true;
+}
+
+void RenderContextGL::bindStorageBuffers(const RenderItem& item) {
+    if (item.storage_buffers.empty()) {
+        return;
+    }
+    if (!compute_supported_) {
+        logger_.error("[Frame] Storage buffers are not supported by this device, skipping.");
+        return;
+    }
+    for (const auto& binding : item.storage_buffers) {
+        GLuint buffer = std::visit(
+            [this](auto handle) -> GLuint {
+                if constexpr (std::is_same_v<decltype(handle), StorageBufferHandle>) {
+                    return storage_buffer_map_.at(handle).buffer;
+                } else {
+                    return indirect_buffer_map_.at(handle).buffer;
+                }
+            },
+            binding.handle);
+        GL_CHECK(glBindBufferBase(kShaderStorageBuffer, binding.binding_location, buffer));
+    }
+}
+
+void RenderContextGL::dispatchComputeItems(const RenderQueue& queue) {
+    if (!compute_supported_) {
+        logger_.error("[Frame] Compute is not supported by this device, skipping {} dispatches.",
+                      queue.compute_items.size());
+        return;
+    }
+
+    // Make writes from previous draws and dispatches visible to the dispatches.
+    GL_CHECK(memory_barrier_(kAllBarrierBits));
+    for (const auto& item : queue.compute_items) {
+        // Skip items whose program is still being created.
+        auto program_it = program_map_.find(*item.program);
+        if (program_it == program_map_.end()) {
+            continue;
+        }
+        ProgramData& program_data = program_it->second;
+        GL_CHECK(glUseProgram(program_data.program));
+        stats_.program_binds++;
+        bindUniforms(program_data, item);
+        bindUniformBuffers(program_data, item);
+        bindTextures(program_data, item);
+        bindBindlessTextures(program_data);
+        bindStorageBuffers(item);
+        for (const auto& binding : item.storage_images) {
+            const auto& texture_data = texture_map_.at(binding.handle);
+            GL_CHECK(bind_image_texture_(binding.binding_location, texture_data.texture,
+                                         static_cast<GLint>(binding.mip_level), GL_FALSE, 0,
+                                         GL_READ_WRITE, texture_data.internal_format));
+        }
+        GL_CHECK(dispatch_compute_(item.group_count_x, item.group_count_y, item.group_count_z));
+        stats_.dispatches++;
+    }
+
+    // Make the results visible to everything that follows, including vertex fetch and indirect
+    // draw arguments.
+    GL_CHECK(memory_barrier_(kAllBarrierBits));
+}
+
+RenderContextGL::CrossCompiledProgram RenderContextGL::crossCompileProgram(
+    const std::vector<ShaderStageInfo>& stages) const {
+    DW_TRACE_SCOPE("RenderContextGL::crossCompileProgram");
+    CrossCompiledProgram program;
+    program.sources.reserve(stages.size());
+    // SPIRV-Cross reports errors by throwing, which must not escape a worker thread.
+    try {
+        for (const auto& stage : stages) {
+            program.sources.emplace_back(stage.stage, crossCompileStage(stage, program));
+        }
+    } catch (const std::exception& e) {
+        program.error = e.what();
+    }
+    return program;
+}
+
+std::string RenderContextGL::crossCompileStage(const ShaderStageInfo& stage,
+                                               CrossCompiledProgram& program) const {
+    // Convert SPIR-V into GLSL.
+    spirv_cross::CompilerGLSL glsl{reinterpret_cast<const u32*>(stage.spirv.data()),
+                                   stage.spirv.size() / sizeof(u32)};
+    spirv_cross::ShaderResources resources = glsl.get_shader_resources();
+
+    // Remap texture binding locations. The bindless texture table has no texture unit, as it's
+    // set with texture handles instead.
+    u32 next_texture_binding_location = 0;
+    std::map<u32, const spirv_cross::Resource*> sampled_images_by_binding;
+    bool uses_bindless_textures = false;
+    for (const auto& resource : resources.sampled_images) {
+        if (glsl.get_decoration(resource.id, spv::DecorationDescriptorSet) == 1) {
+            if (!bindless_texturing_supported_) {
+                throw std::runtime_error("Bindless textures are not supported by this device.");
+            }
+            glsl.unset_decoration(resource.id, spv::DecorationDescriptorSet);
+            glsl.unset_decoration(resource.id, spv::DecorationBinding);
+            glsl.set_name(resource.id, kBindlessTexturesUniform);
+            uses_bindless_textures = true;
+            continue;
+        }
+        sampled_images_by_binding[glsl.get_decoration(resource.id, spv::DecorationBinding)] =
+            &resource;
+    }
+    for (const auto& entry : sampled_images_by_binding) {
+        const auto& resource = *entry.second;
+        u32 set = glsl.get_decoration(resource.id, spv::DecorationDescriptorSet);
+        u32 binding = glsl.get_decoration(resource.id, spv::DecorationBinding);
+        u32 new_binding = next_texture_binding_location++;
+        logger_.debug(
+            "Remapping sampled image with location(set={}, binding={}) to location(binding={})",
+            set, binding, new_binding);
+        glsl.unset_decoration(resource.id, spv::DecorationDescriptorSet);
+        glsl.set_decoration(resource.id, spv::DecorationBinding, new_binding);
+        assert(program.binding_location_to_texture_unit.count(binding) == 0);
+        program.binding_location_to_texture_unit[binding] = new_binding;
+    }
+
+    // Members of a uniform block without an instance name are recorded with the prefix _<id>,
+    // where <id> is the resource ID in SPIR-V. In those cases, we need to store that information
+    // so it can be looked up during frame().
+    for (const auto& resource : resources.uniform_buffers) {
+        if (!glsl.get_name(resource.id).empty()) {
+            continue;
+        }
+
+        const spirv_cross::SPIRType& type = glsl.get_type(resource.base_type_id);
+        usize member_count = type.member_types.size();
+        for (usize i = 0; i < member_count; ++i) {
+            auto member_name = glsl.get_member_name(type.self, i);
+            assert(program.uniform_remap_ids.count(member_name) == 0);
+            program.uniform_remap_ids[member_name] = resource.id;
+        }
+    }
+
+    // Compile to GLSL, ready to give to GL driver.
+    spirv_cross::CompilerGLSL::Options options;
+    options.emit_push_constant_as_uniform_buffer = true;
+#if DW_GL_VERSION == DW_GL_410
+    // Compute shaders and storage buffers/images need GLSL 430. Stages of different versions can
+    // be linked together on desktop GL.
+    if (stage.stage == ShaderStage::Compute || !resources.storage_buffers.empty() ||
+        !resources.storage_images.empty()) {
+        if (!compute_supported_) {
+            throw std::runtime_error(
+                "Compute shaders and storage buffers are not supported by this device.");
+        }
+        options.version = 430;
+    } else {
+        options.version = 410;
+    }
+    options.es = false;
+#elif DW_GL_VERSION == DW_GLES_300
+    options.version = 300;
+    options.es = true;
+#else
+#error "Unsupported DW_GL_VERSION"
+#endif
+    glsl.set_common_options(options);
+    std::string source = glsl.compile();
+
+    // Record the name and std140 layout of each uniform block, so that it can be assigned to its
+    // binding point after linking, and uniforms can be written to its members. This happens after
+    // compiling, as SPIRV-Cross may rename blocks while emitting them. A block which was already
+    // recorded by a previous stage shares its layout, but may name its members differently.
+    for (const auto& resource : resources.uniform_buffers) {
+        const spirv_cross::SPIRType& type = glsl.get_type(resource.base_type_id);
+        const std::string& instance_name = glsl.get_name(resource.id);
+        std::string prefix = instance_name.empty()
+                                 ? fmt::format("_{}", static_cast<u32>(resource.id))
+                                 : instance_name;
+        u32 binding_location = glsl.get_decoration(resource.id, spv::DecorationBinding);
+        auto block_it = std::find_if(
+            program.uniform_blocks.begin(), program.uniform_blocks.end(),
+            [binding_location](const UniformBlock& b) {
+                return b.binding_location == binding_location;
+            });
+        if (block_it == program.uniform_blocks.end()) {
+            UniformBlock new_block;
+            new_block.name = glsl.get_remapped_declared_block_name(resource.id);
+            new_block.binding_location = binding_location;
+            new_block.size = 0;
+            block_it = program.uniform_blocks.insert(block_it, std::move(new_block));
+        }
+        UniformBlock& block = *block_it;
+        block.size = std::max(block.size, static_cast<u32>(glsl.get_declared_struct_size(type)));
+        for (u32 i = 0; i < type.member_types.size(); ++i) {
+            const spirv_cross::SPIRType& member_type = glsl.get_type(type.member_types[i]);
+            UniformBlockMember member;
+            member.name = fmt::format("{}.{}", prefix, glsl.get_member_name(type.self, i));
+            switch (member_type.basetype) {
+                case spirv_cross::SPIRType::Int:
+                case spirv_cross::SPIRType::Boolean:
+                    member.type = UniformBlockMember::Type::Int;
+                    break;
+                case spirv_cross::SPIRType::UInt:
+                    member.type = UniformBlockMember::Type::UInt;
+                    break;
+                case spirv_cross::SPIRType::Float:
+                    member.type = UniformBlockMember::Type::Float;
+                    break;
+                default:
+                    logger_.warn(
+                        "[CreateProgram] Uniform block member '{}' has an unsupported type, and "
+                        "can't be set.",
+                        member.name);
+                    continue;
+            }
+            if (member_type.array.size() > 1 ||
+                (member_type.columns > 1 && member_type.columns != member_type.vecsize)) {
+                logger_.warn(
+                    "[CreateProgram] Uniform block member '{}' has an unsupported type, and "
+                    "can't be set.",
+                    member.name);
+                continue;
+            }
+            member.vec_size = member_type.vecsize;
+            member.columns = member_type.columns;
+            member.array_size = member_type.array.empty() ? 1 : member_type.array[0];
+            member.offset = glsl.type_struct_member_offset(type, i);
+            member.array_stride =
+                member_type.array.empty() ? 0 : glsl.type_struct_member_array_stride(type, i);
+            member.matrix_stride =
+                member_type.columns > 1 ? glsl.type_struct_member_matrix_stride(type, i) : 0;
+            if (std::none_of(block.members.begin(), block.members.end(),
+                             [&member](const UniformBlockMember& m) {
+                                 return m.name == member.name;
+                             })) {
+                block.members.emplace_back(std::move(member));
+            }
+        }
+    }
+
+    // Postprocess the GLSL to remove a GL 4.2 extension, which doesn't exist on macOS.
+#if DGA_PLATFORM == DGA_MACOS
+    source = dga::strReplaceAll(source, "#extension GL_ARB_shading_language_420pack : require",
+                                "#extension GL_ARB_shading_language_420pack : disable");
+#endif
+
+    // Declare the bindless texture table as a bindless sampler array, which SPIRV-Cross can't emit.
+    if (uses_bindless_textures) {
+        source.insert(source.find('\n') + 1, "#extension GL_ARB_bindless_texture : require\n");
+        auto declaration = fmt::format("uniform sampler2D {}[", kBindlessTexturesUniform);
+        source = dga::strReplaceAll(source, declaration, "layout(bindless_sampler) " + declaration);
+    }
+
+    return source;
+}
+
+void RenderContextGL::linkProgram(ProgramHandle handle, ProgramData program_data, u64 cache_key,
+                                  const CrossCompiledProgram& cross_compiled) {
+    DW_TRACE_SCOPE("RenderContextGL::linkProgram");
+    if (!cross_compiled.error.empty()) {
+        logger_.error("[CreateProgram] SPIR-V cross-compile error: {}", cross_compiled.error);
+        GL_CHECK(glDeleteProgram(program_data.program));
+        return;
+    }
+    program_data.uniform_remap_ids = cross_compiled.uniform_remap_ids;
+    program_data.binding_location_to_texture_unit =
+        cross_compiled.binding_location_to_texture_unit;
+    program_data.uniform_blocks = cross_compiled.uniform_blocks;
+
+    std::vector<GLuint> created_shaders;
+    created_shaders.reserve(cross_compiled.sources.size());
+    for (const auto& stage_source : cross_compiled.sources) {
+        GLuint shader = 0;
+        GL_CHECK(shader = glCreateShader(kShaderStageMap.at(stage_source.first)));
+        const std::string& source = stage_source.second;
+
+        // Compile the shader.
+        // logger_.debug("Decompiled GLSL from SPIR-V: {}", source);
+        const char* sources_cstr = source.c_str();
+        GL_CHECK(glShaderSource(shader, 1, &sources_cstr, nullptr));
+        GL_CHECK(glCompileShader(shader));
+
+        // Check compilation result.
+        GLint result;
+        GL_CHECK(glGetShaderiv(shader, GL_COMPILE_STATUS, &result));
+        if (result == GL_FALSE) {
+            int info_log_length;
+            GL_CHECK(glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &info_log_length));
+            std::string error_message(info_log_length, '\0');
+            GL_CHECK(glGetShaderInfoLog(shader, info_log_length, nullptr, error_message.data()));
+            logger_.error("[CreateProgram] Shader compile error: {}", error_message);
+            created_shaders.push_back(shader);
+            destroyFailedProgram(created_shaders, program_data.program);
+            return;
+        }
+
+        // Attach shader to program.
+        GL_CHECK(glAttachShader(program_data.program, shader));
+        created_shaders.push_back(shader);
+    }
+
+    // Link program.
+    GL_CHECK(glLinkProgram(program_data.program));
+
+    // Check the result of the link process.
+    GLint result = GL_FALSE;
+    glGetProgramiv(program_data.program, GL_LINK_STATUS, &result);
+    if (result == GL_FALSE) {
+        int info_log_length;
+        GL_CHECK(glGetProgramiv(program_data.program, GL_INFO_LOG_LENGTH, &info_log_length));
+        std::string error_message(info_log_length, '\0');
+        GL_CHECK(glGetProgramInfoLog(program_data.program, info_log_length, nullptr,
+                                     error_message.data()));
+        logger_.error("[CreateProgram] Shader link error: {}", error_message);
+        destroyFailedProgram(created_shaders, program_data.program);
+        return;
+    }
+    assignUniformBlockBindings(program_data);
+    if (programBinaryCacheEnabled()) {
+        saveCachedProgram(cache_key, program_data);
+    }
+
+    // Destroy leftover shaders.
+    for (auto shader : created_shaders) {
+        GL_CHECK(glDeleteShader(shader));
+    }
+
+    program_map_.emplace(handle, std::move(program_data));
+    setProgramReady(handle, true);
+}
+
+void RenderContextGL::destroyFailedProgram(const std::vector<GLuint>& shaders, GLuint program) {
+    for (auto shader : shaders) {
+        GL_CHECK(glDeleteShader(shader));
+    }
+    GL_CHECK(glDeleteProgram(program));
+}
+
+void RenderContextGL::finishAsyncPrograms() {
+    std::vector<std::pair<ProgramHandle, CrossCompiledProgram>> cross_compiled_programs;
+    {
+        std::lock_guard<std::mutex> lock{cross_compiled_programs_mutex_};
+        cross_compiled_programs.swap(cross_compiled_programs_);
+    }
+    for (const auto& entry : cross_compiled_programs) {
+        auto pending_it = pending_programs_.find(entry.first);
+        if (pending_it == pending_programs_.end()) {
+            // Deleted before it finished.
+            continue;
+        }
+        PendingProgram pending = std::move(pending_it->second);
+        pending_programs_.erase(pending_it);
+        linkProgram(entry.first, std::move(pending.program_data), pending.cache_key, entry.second);
+    }
+}
+
+bool RenderContextGL::programBinaryCacheEnabled() const {
+    return program_binary_supported_ && !cache_directory_.empty();
+}
+
+u64 RenderContextGL::programCacheKey(const cmd::CreateProgram& c) const {
+    ContentHash key;
+    key.add(kProgramCacheVersion);
+    key.add(driver_id_);
+    for (const auto& stage : c.stages) {
+        key.add(static_cast<u32>(stage.stage));
+        key.add(stage.entry_point);
+        key.add(static_cast<u64>(stage.spirv.size()));
+        key.add(stage.spirv.data(), stage.spirv.size());
+    }
+    return key.hash();
+}
+
+bool RenderContextGL::loadCachedProgram(u64 key, ProgramData& program_data) {
+    std::ifstream file{fmt::format("{}/gl_program_{:016x}.bin", cache_directory_, key),
+                       std::ios::binary | std::ios::ate};
+    if (!file) {
+        return false;
+    }
+    const auto file_size = static_cast<usize>(file.tellg());
+    file.seekg(0);
+    auto read_u32 = [&file]() {
+        u32 value = 0;
+        file.read(reinterpret_cast<char*>(&value), sizeof(value));
+        return value;
+    };
+    // Returns false (and fails the stream) if there are fewer than 'count' bytes remaining. Used to
+    // reject sizes and element counts which can't possibly be valid before allocating for them.
+    auto check_count = [&file, file_size](usize count) {
+        auto offset = file ? static_cast<usize>(file.tellg()) : file_size;
+        if (!file || offset > file_size || count > file_size - offset) {
+            file.setstate(std::ios::failbit);
+            return false;
+        }
+        return true;
+    };
+    auto read_string = [&](std::string& str) {
+        u32 size = read_u32();
+        if (check_count(size)) {
+            str.resize(size);
+            file.read(str.data(), str.size());
+        }
+    };
+
+    // Read the header and the metadata that would otherwise be generated during cross-compilation.
+    if (read_u32() != kProgramCacheMagic || read_u32() != kProgramCacheVersion) {
+        return false;
+    }
+    GLenum binary_format = read_u32();
+    u32 binary_size = read_u32();
+    u32 uniform_remap_count = read_u32();
+    u32 texture_unit_count = read_u32();
+    u32 uniform_block_count = read_u32();
+    if (std::find(program_binary_formats_.begin(), program_binary_formats_.end(),
+                  static_cast<GLint>(binary_format)) == program_binary_formats_.end()) {
+        logger_.warn("[CreateProgram] Ignoring program binary {:016x} with unsupported format {}.",
+                     key, binary_format);
+        return false;
+    }
+    // The binary is stored after the metadata, so it must fit in what's left of the file.
+    check_count(binary_size);
+    std::unordered_map<std::string, u32> uniform_remap_ids;
+    for (u32 i = 0; i < uniform_remap_count && file; ++i) {
+        std::string name;
+        read_string(name);
+        uniform_remap_ids[name] = read_u32();
+    }
+    std::unordered_map<u32, u32> binding_location_to_texture_unit;
+    for (u32 i = 0; i < texture_unit_count && file; ++i) {
+        u32 binding_location = read_u32();
+        binding_location_to_texture_unit[binding_location] = read_u32();
+    }
+    std::vector<UniformBlock> uniform_blocks;
+    if (check_count(uniform_block_count)) {
+        uniform_blocks.resize(uniform_block_count);
+    }
+    for (auto& block : uniform_blocks) {
+        read_string(block.name);
+        block.binding_location = read_u32();
+        block.size = read_u32();
+        u32 member_count = read_u32();
+        if (!check_count(member_count)) {
+            break;
+        }
+        block.members.resize(member_count);
+        for (auto& member : block.members) {
+            read_string(member.name);
+            member.type = static_cast<UniformBlockMember::Type>(read_u32());
+            member.vec_size = read_u32();
+            member.columns = read_u32();
+            member.array_size = read_u32();
+            member.offset = read_u32();
+            member.array_stride = read_u32();
+            member.matrix_stride = read_u32();
+        }
+        if (!file) {
+            break;
+        }
+    }
+    std::vector<char> binary;
+    if (check_count(binary_size)) {
+        binary.resize(binary_size);
+        file.read(binary.data(), binary.size());
+    }
+    if (!file) {
+        logger_.warn("[CreateProgram] Ignoring truncated program binary {:016x}.", key);
+        return false;
+    }
+
+    // The driver may reject the binary (for example, after a driver update), in which case the
+    // program is compiled from scratch.
+    GL_CHECK(glProgramBinary(program_data.program, binary_format, binary.data(),
+                             static_cast<GLsizei>(binary.size())));
+    GLint result = GL_FALSE;
+    GL_CHECK(glGetProgramiv(program_data.program, GL_LINK_STATUS, &result));
+    if (result == GL_FALSE) {
+        logger_.debug("[CreateProgram] Driver rejected cached program binary {:016x}.", key);
+        return false;
+    }
+    program_data.uniform_remap_ids = std::move(uniform_remap_ids);
+    program_data.binding_location_to_texture_unit = std::move(binding_location_to_texture_unit);
+    program_data.uniform_blocks = std::move(uniform_blocks);
+    assignUniformBlockBindings(program_data);
+    return true;
+}
+
+void RenderContextGL::saveCachedProgram(u64 key, const ProgramData& program_data) {
+    GLint binary_size = 0;
+    GL_CHECK(glGetProgramiv(program_data.program, GL_PROGRAM_BINARY_LENGTH, &binary_size));
+    if (binary_size <= 0) {
+        return;
+    }
+    std::vector<char> binary(static_cast<usize>(binary_size));
+    GLenum binary_format = 0;
+    GL_CHECK(glGetProgramBinary(program_data.program, binary_size, nullptr, &binary_format,
+                                binary.data()));
+
+    std::ofstream file{fmt::format("{}/gl_program_{:016x}.bin", cache_directory_, key),
+                       std::ios::binary | std::ios::trunc};
+    if (!file) {
+        logger_.warn("[CreateProgram] Unable to write program binary to {}.", cache_directory_);
+        return;
+    }
+    auto write_u32 = [&file](u32 value) {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    write_u32(kProgramCacheMagic);
+    write_u32(kProgramCacheVersion);
+    write_u32(binary_format);
+    write_u32(static_cast<u32>(binary.size()));
+    write_u32(static_cast<u32>(program_data.uniform_remap_ids.size()));
+    write_u32(static_cast<u32>(program_data.binding_location_to_texture_unit.size()));
+    write_u32(static_cast<u32>(program_data.uniform_blocks.size()));
+    for (const auto& entry : program_data.uniform_remap_ids) {
+        write_u32(static_cast<u32>(entry.first.size()));
+        file.write(entry.first.data(), entry.first.size());
+        write_u32(entry.second);
+    }
+    for (const auto& entry : program_data.binding_location_to_texture_unit) {
+        write_u32(entry.first);
+        write_u32(entry.second);
+    }
+    for (const auto& block : program_data.uniform_blocks) {
+        write_u32(static_cast<u32>(block.name.size()));
+        file.write(block.name.data(), block.name.size());
+        write_u32(block.binding_location);
+        write_u32(block.size);
+        write_u32(static_cast<u32>(block.members.size()));
+        for (const auto& member : block.members) {
+            write_u32(static_cast<u32>(member.name.size()));
+            file.write(member.name.data(), member.name.size());
+            write_u32(static_cast<u32>(member.type));
+            write_u32(member.vec_size);
+            write_u32(member.columns);
+            write_u32(member.array_size);
+            write_u32(member.offset);
+            write_u32(member.array_stride);
+            write_u32(member.matrix_stride);
+        }
+    }
+    file.write(binary.data(), binary.size());
+}
+
+void RenderContextGL::uploadTransientBuffer(GLenum target, GLuint buffer, size_t& buffer_size,
+                                            GLenum usage,
+                                            const Frame::TransientBufferStorage& storage) {
+    GL_CHECK(glBindBuffer(target, buffer));
+
+    // Grow the buffer if the storage no longer fits. Otherwise, orphan the previous contents so
+    // the driver doesn't need to wait for draws in flight to finish.
+    if (storage.size > buffer_size) {
+        buffer_size = std::max<size_t>(storage.size, buffer_size * 2);
+    }
+    GL_CHECK(glBufferData(target, buffer_size, nullptr, usage));
+    for (usize i = 0; i <= storage.current_page && i < storage.pages.size(); ++i) {
+        const auto& page = storage.pages[i];
+        if (page.size > 0) {
+            GL_CHECK(glBufferSubData(target, page.offset, page.size, page.data.get()));
+        }
+    }
+}
+
+void RenderContextGL::submitIndirect(const RenderItem& item) {
+#if DW_GL_VERSION == DW_GLES_300
+    // WebGL 2 has no indirect draws.
+    logger_.error("Indirect draws are not supported by WebGL 2, skipping.");
+#else
+    const auto& buffer_data = indirect_buffer_map_.at(*item.indirect_buffer);
+    const auto& ib_data = index_buffer_map_.at(*item.ib);
+    GLenum element_type = ib_data.type;
+    if (item.ib_offset > 0) {
+        // Copy the indices from ib_offset onwards to the start of the scratch index buffer, so
+        // that first_index is relative to ib_offset like on Vulkan. The buffer is orphaned first,
+        // so the copy doesn't wait for earlier draws from it.
+        auto size = static_cast<GLsizeiptr>(ib_data.size - item.ib_offset);
+        if (indirect_index_buffer_ == 0) {
+            GL_CHECK(glGenBuffers(1, &indirect_index_buffer_));
+        }
+        if (static_cast<size_t>(size) > indirect_index_buffer_size_) {
+            indirect_index_buffer_size_ =
+                std::max<size_t>(static_cast<size_t>(size), indirect_index_buffer_size_ * 2);
+        }
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, indirect_index_buffer_));
+        GL_CHECK(glBufferData(GL_COPY_WRITE_BUFFER, indirect_index_buffer_size_, nullptr,
+                              GL_STREAM_COPY));
+        GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, ib_data.element_buffer));
+        GL_CHECK(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, item.ib_offset, 0,
+                                     size));
+        GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indirect_index_buffer_));
+    }
+    GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer_data.buffer));
+    if (multi_draw_elements_indirect_) {
+        GL_CHECK(multi_draw_elements_indirect_(
+            GL_TRIANGLES, element_type,
+            reinterpret_cast<void*>(static_cast<std::intptr_t>(item.indirect_offset)),
+            static_cast<GLsizei>(item.draw_count), sizeof(DrawIndexedIndirectCommand)));
+        stats_.draw_calls++;
+    } else {
+        for (uint i = 0; i < item.draw_count; ++i) {
+            std::intptr_t offset = item.indirect_offset + i * sizeof(DrawIndexedIndirectCommand);
+            GL_CHECK(glDrawElementsIndirect(GL_TRIANGLES, element_type,
+                                            reinterpret_cast<void*>(offset)));
+        }
+        stats_.draw_calls += item.draw_count;
+    }
+    if (item.ib_offset > 0) {
+        // Restore the vertex array's element buffer.
+        GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ib_data.element_buffer));
+    }
+#endif
+}
+
+void RenderContextGL::readOcclusionQueryResults() {
+    // Check the pending query objects of each query from oldest to newest, so that the newest
+    // available result is kept. Results which aren't available yet are checked again next frame,
+    // unless a newer result is already available.
+    for (auto& entry : occlusion_query_map_) {
+        auto& query = entry.second;
+        bool has_new_result = false;
+        for (usize i = 0; i < kOcclusionQueryObjectCount; ++i) {
+            usize index = (query.next + i) % kOcclusionQueryObjectCount;
+            if (!query.pending[index]) {
+                continue;
+            }
+            GLuint available = 0;
+            GL_CHECK(glGetQueryObjectuiv(query.queries[index], GL_QUERY_RESULT_AVAILABLE,
+                                         &available));
+            if (available) {
+                GLuint samples = 0;
+                GL_CHECK(glGetQueryObjectuiv(query.queries[index], GL_QUERY_RESULT, &samples));
+                for (usize older = 0; older <= i; ++older) {
+                    query.pending[(query.next + older) % kOcclusionQueryObjectCount] = false;
+                }
+                query.last_result = samples;
+                has_new_result = true;
+            }
+        }
+        if (has_new_result) {
+            setOcclusionQueryResult(entry.first, query.last_result);
+        }
+    }
+}
+
+void RenderContextGL::queryMemoryInfo() {
+    if (!memory_info_supported_ || frames_until_memory_info_-- > 0) {
+        return;
+    }
+    frames_until_memory_info_ = kMemoryInfoInterval;
+    GLint dedicated = 0;
+    GLint available = 0;
+    GL_CHECK(glGetIntegerv(kGpuMemoryInfoDedicatedVidmem, &dedicated));
+    GL_CHECK(glGetIntegerv(kGpuMemoryInfoCurrentAvailableVidmem, &available));
+    u64 budget = static_cast<u64>(dedicated) * 1024;
+    u64 usage = budget - std::min(budget, static_cast<u64>(available) * 1024);
+    setMemoryBudget(budget, usage);
+}
+
+void RenderContextGL::beginGpuTiming(const Frame* frame) {
+    if (!gpu_timing_supported_) {
+        return;
+    }
+    auto& timing_frame = gpu_timing_frames_[gpu_timing_frame_index_];
+
+    // Read back the timestamps written the last time this set of queries was used. The frame end
+    // timestamp is written last, so once it's available the rest are too. If it isn't ready yet,
+    // then that frame's timings are dropped rather than waiting for them.
+    if (timing_frame.pending) {
+        GLint available = 0;
+        GL_CHECK(glGetQueryObjectiv(timing_frame.queries[GpuTimestampLayout::kFrameEndQuery],
+                                    GL_QUERY_RESULT_AVAILABLE, &available));
+        if (available) {
+            std::vector<u64> timestamps(timing_frame.layout.queryCount());
+            for (usize i = 0; i < timestamps.size(); ++i) {
+                GLuint64 timestamp = 0;
+                GL_CHECK(glGetQueryObjectui64v(timing_frame.queries[i], GL_QUERY_RESULT,
+                                               &timestamp));
+                timestamps[i] = timestamp;
+            }
+            setGpuTimings(timing_frame.layout.resolve(timestamps.data(), 1.0));
+        }
+        timing_frame.pending = false;
+    }
+
+    // Lay out the queries of this frame, creating more query objects if needed.
+    timing_frame.layout.build(frame, kMaxGpuTimestampQueries);
+    usize query_count = timing_frame.layout.queryCount();
+    if (timing_frame.queries.size() < query_count) {
+        usize previous_size = timing_frame.queries.size();
+        timing_frame.queries.resize(query_count);
+        GL_CHECK(glGenQueries(query_count - previous_size,
+                              timing_frame.queries.data() + previous_size));
+    }
+    GL_CHECK(glQueryCounter(timing_frame.queries[GpuTimestampLayout::kFrameBeginQuery],
+                            GL_TIMESTAMP));
+}
+
+void RenderContextGL::endGpuTiming() {
+    if (!gpu_timing_supported_) {
+        return;
+    }
+    auto& timing_frame = gpu_timing_frames_[gpu_timing_frame_index_];
+    GL_CHECK(
+        glQueryCounter(timing_frame.queries[GpuTimestampLayout::kFrameEndQuery], GL_TIMESTAMP));
+    timing_frame.pending = true;
+    gpu_timing_frame_index_ = (gpu_timing_frame_index_ + 1) % kGpuTimingFrameCount;
 }
 }  // namespace gfx
 }  // namespace dw
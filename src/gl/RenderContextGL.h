@@ -6,11 +6,17 @@
 
 #include "Renderer.h"
 #include "RenderContext.h"
+#include "GpuTimestamps.h"
 #include "Logger.h"
+#include "WorkerPool.h"
 
 #include <glad/gl.h>
 #include <GLFW/glfw3.h>
 
+#include <array>
+#include <deque>
+#include <mutex>
+
 namespace dw {
 namespace gfx {
 class SamplerCacheGL {
@@ -18,7 +24,7 @@ public:
     void setMaxSupportedAnisotropy(float max_supported_anisotropy);
 
     // Find a sampler object given a set of sampler flags. If the object does not exist, create it.
-    GLuint findOrCreate(RenderItem::SamplerInfo info);
+    GLuint findOrCreate(RenderItem::SamplerInfo info, FrameStats::CacheStats& stats);
 
     // Clear the cache.
     void clear();
@@ -40,6 +46,10 @@ public:
     // Capabilities / customisations.
     Mat4 adjustProjectionMatrix(Mat4 projection_matrix) const override;
     bool hasFlippedViewport() const override;
+    bool isTextureFormatSupported(TextureFormat format) const override;
+    bool isComputeSupported() const override;
+    bool isBindlessTexturingSupported() const override;
+    bool isConditionalRenderingSupported() const override;
 
     // Window management. Executed on the main thread.
     Result<void, std::string> createWindow(u16 width, u16 height, const std::string& title,
@@ -65,18 +75,129 @@ public:
     void operator()(const cmd::CreateIndexBuffer& c);
     void operator()(const cmd::UpdateIndexBuffer& c);
     void operator()(const cmd::DeleteIndexBuffer& c);
+    void operator()(const cmd::CreateIndirectBuffer& c);
+    void operator()(const cmd::UpdateIndirectBuffer& c);
+    void operator()(const cmd::DeleteIndirectBuffer& c);
+    void operator()(const cmd::CreateStorageBuffer& c);
+    void operator()(const cmd::UpdateStorageBuffer& c);
+    void operator()(const cmd::DeleteStorageBuffer& c);
+    void operator()(const cmd::CreateUniformBuffer& c);
+    void operator()(const cmd::UpdateUniformBuffer& c);
+    void operator()(const cmd::DeleteUniformBuffer& c);
     void operator()(const cmd::CreateProgram& c);
     void operator()(const cmd::DeleteProgram& c);
+    void operator()(const cmd::CreateUniform& c);
     void operator()(const cmd::CreateTexture2D& c);
+    void operator()(const cmd::UpdateTexture2D& c);
     void operator()(const cmd::DeleteTexture& c);
     void operator()(const cmd::CreateFrameBuffer& c);
     void operator()(const cmd::DeleteFrameBuffer& c);
+    void operator()(const cmd::CreateOcclusionQuery& c);
+    void operator()(const cmd::DeleteOcclusionQuery& c);
+    void operator()(const cmd::PrewarmPipeline& c);
     template <typename T> void operator()(const T& c) {
         static_assert(!std::is_same<T, T>::value, "Unimplemented RenderCommand");
     }
 
 private:
     float max_supported_anisotropy_;
+    bool program_binary_supported_;
+    // Program binary formats accepted by glProgramBinary. Cached binaries in any other format are
+    // ignored.
+    std::vector<GLint> program_binary_formats_;
+    // Identifies the GL driver, so that cached program binaries are only reused by the driver which
+    // created them.
+    std::string driver_id_;
+    std::array<bool, usize(TextureFormat::Count)> texture_format_supported_;
+    // glMultiDrawElementsIndirect is GL 4.3 (or GL_ARB_multi_draw_indirect), so it's loaded
+    // separately. If unavailable, each draw is issued with glDrawElementsIndirect.
+    using MultiDrawElementsIndirectProc = void(GLAD_API_PTR*)(GLenum mode, GLenum type,
+                                                              const void* indirect,
+                                                              GLsizei draw_count, GLsizei stride);
+    MultiDrawElementsIndirectProc multi_draw_elements_indirect_;
+    // Indirect commands can't offset into the index buffer, so indices which an indirect draw
+    // reads from part way through an index buffer (such as transient indices) are copied to the
+    // start of this buffer first.
+    GLuint indirect_index_buffer_;
+    size_t indirect_index_buffer_size_;
+    // Compute shaders and storage buffers/images need GL 4.3 (or the equivalent extensions).
+    // Programs which use them are cross-compiled to GLSL 430.
+    bool compute_supported_;
+    using DispatchComputeProc = void(GLAD_API_PTR*)(GLuint num_groups_x, GLuint num_groups_y,
+                                                    GLuint num_groups_z);
+    using MemoryBarrierProc = void(GLAD_API_PTR*)(GLbitfield barriers);
+    using BindImageTextureProc = void(GLAD_API_PTR*)(GLuint unit, GLuint texture, GLint level,
+                                                     GLboolean layered, GLint layer,
+                                                     GLenum access, GLenum format);
+    DispatchComputeProc dispatch_compute_;
+    MemoryBarrierProc memory_barrier_;
+    BindImageTextureProc bind_image_texture_;
+    // Separate vertex formats and buffer bindings need GL 4.3 (or GL_ARB_vertex_attrib_binding).
+    // With them, a VAO is cached per vertex format, and only its buffer bindings change between
+    // draws. Otherwise, a VAO is cached per combination of buffers, offsets and formats.
+    bool vertex_attrib_binding_supported_;
+    using VertexAttribFormatProc = void(GLAD_API_PTR*)(GLuint attrib_index, GLint size,
+                                                       GLenum type, GLboolean normalized,
+                                                       GLuint relative_offset);
+    using VertexAttribBindingProc = void(GLAD_API_PTR*)(GLuint attrib_index,
+                                                        GLuint binding_index);
+    using BindVertexBufferProc = void(GLAD_API_PTR*)(GLuint binding_index, GLuint buffer,
+                                                     GLintptr offset, GLsizei stride);
+    using VertexBindingDivisorProc = void(GLAD_API_PTR*)(GLuint binding_index, GLuint divisor);
+    VertexAttribFormatProc vertex_attrib_format_;
+    VertexAttribBindingProc vertex_attrib_binding_;
+    BindVertexBufferProc bind_vertex_buffer_;
+    VertexBindingDivisorProc vertex_binding_divisor_;
+    // glBindTextures and glBindSamplers are GL 4.4 (or GL_ARB_multi_bind). If available, the
+    // texture units changed by a draw are bound with one call each.
+    using BindTexturesProc = void(GLAD_API_PTR*)(GLuint first, GLsizei count,
+                                                 const GLuint* textures);
+    using BindSamplersProc = void(GLAD_API_PTR*)(GLuint first, GLsizei count,
+                                                 const GLuint* samplers);
+    BindTexturesProc bind_textures_;
+    BindSamplersProc bind_samplers_;
+    // glInvalidateFramebuffer is GLES 3.0 and GL 4.3 (or GL_ARB_invalidate_subdata). It's used to
+    // discard attachments with a DontCare load or store op, which otherwise does nothing.
+    using InvalidateFramebufferProc = void(GLAD_API_PTR*)(GLenum target, GLsizei num_attachments,
+                                                          const GLenum* attachments);
+    InvalidateFramebufferProc invalidate_framebuffer_;
+    // Bindless textures need GL_ARB_bindless_texture, which isn't available on GLES. Each texture
+    // in the bindless texture table has a resident handle, and the handles are uploaded to the
+    // table uniform of a program whenever the table has changed since the program last used it.
+    bool bindless_texturing_supported_;
+    using GetTextureSamplerHandleProc = GLuint64(GLAD_API_PTR*)(GLuint texture, GLuint sampler);
+    using MakeTextureHandleResidentProc = void(GLAD_API_PTR*)(GLuint64 handle);
+    using UniformHandleui64vProc = void(GLAD_API_PTR*)(GLint location, GLsizei count,
+                                                       const GLuint64* value);
+    GetTextureSamplerHandleProc get_texture_sampler_handle_;
+    MakeTextureHandleResidentProc make_texture_handle_resident_;
+    MakeTextureHandleResidentProc make_texture_handle_non_resident_;
+    UniformHandleui64vProc uniform_handle_ui64v_;
+    // Indexed by texture handle index, with 0 for slots which aren't in use.
+    std::vector<GLuint64> bindless_texture_handles_;
+    // Incremented whenever the table changes.
+    u64 bindless_texture_table_version_;
+    // glDrawElementsBaseVertex is GL 3.2, but isn't available on GLES 3.0. Without it, the base
+    // vertex is applied by offsetting the vertex buffer binding instead.
+    bool draw_base_vertex_supported_;
+
+    // GPU timestamp queries. Each frame in flight uses its own set of queries, which are read back
+    // when the set is reused (if the results are available by then).
+    static constexpr usize kGpuTimingFrameCount = 3;
+    static constexpr u32 kMaxGpuTimestampQueries = 1024;
+    struct GpuTimingFrame {
+        std::vector<GLuint> queries;
+        GpuTimestampLayout layout;
+        bool pending = false;
+    };
+    bool gpu_timing_supported_;
+    std::array<GpuTimingFrame, kGpuTimingFrameCount> gpu_timing_frames_;
+    usize gpu_timing_frame_index_;
+
+    // Presentation. A fence is inserted after each frame, so that the CPU can wait until there
+    // are fewer than max_frames_in_flight_ frames still being rendered.
+    bool swap_control_tear_supported_;
+    std::deque<GLsync> frame_fences_;
 
     // Window.
     GLFWwindow* window_;
@@ -91,13 +212,51 @@ private:
     std::function<void(const Vec2i& position)> on_mouse_move_;
     std::function<void(const Vec2& offset)> on_mouse_scroll_;
 
+    // Vertex array objects. vao_ isn't cached, and is bound while processing commands so that
+    // buffer binds don't modify a cached VAO. Items without a vertex buffer (or which use transient
+    // vertex data, if cached VAOs are per offset) set up their attributes on vao_ every draw.
     GLuint vao_;
+    GLuint bound_vao_;
     VertexDecl current_vertex_decl;
+    VertexDecl current_instance_decl;
+    // Cached VAOs which haven't been used for this many frames are deleted.
+    static constexpr u64 kVertexArrayMaxUnusedFrames = 120;
+    // Vertex decls are identified by an ID in the VAO cache, so looking up a VAO doesn't copy the
+    // decl. 0 means no decl. Buffers and offsets are only part of the key when
+    // vertex_attrib_binding_supported_ is false.
+    struct VertexArrayKey {
+        u32 decl_id = 0;
+        u32 instance_decl_id = 0;
+        GLuint vertex_buffer = 0;
+        uint vb_offset = 0;
+        GLuint instance_buffer = 0;
+        uint instance_vb_offset = 0;
+        GLuint element_buffer = 0;
+
+        bool operator==(const VertexArrayKey& other) const;
+    };
+    struct VertexArrayKeyHash {
+        usize operator()(const VertexArrayKey& key) const;
+    };
+    struct VertexArrayData {
+        GLuint vao;
+        // The buffers bound to the VAO. Only used when vertex_attrib_binding_supported_ is true.
+        GLuint vertex_buffer;
+        uint vb_offset;
+        GLuint instance_buffer;
+        uint instance_vb_offset;
+        GLuint element_buffer;
+        u64 last_used_frame;
+    };
+    std::unordered_map<VertexDecl, u32> vertex_decl_ids_;
+    std::unordered_map<VertexArrayKey, VertexArrayData, VertexArrayKeyHash> vertex_array_cache_;
+    u64 vertex_array_frame_;
 
     // Vertex and index buffers.
     struct VertexBufferData {
         GLuint vertex_buffer;
         VertexDecl decl;
+        u32 decl_id;
         GLenum usage;
         size_t size;
     };
@@ -107,26 +266,141 @@ private:
         GLenum usage;
         size_t size;
     };
-    std::unordered_map<VertexBufferHandle, VertexBufferData> vertex_buffer_map_;
-    std::unordered_map<IndexBufferHandle, IndexBufferData> index_buffer_map_;
+    HandleMap<VertexBufferHandle, VertexBufferData> vertex_buffer_map_;
+    HandleMap<IndexBufferHandle, IndexBufferData> index_buffer_map_;
+
+    // Indirect and storage buffers.
+    struct BufferData {
+        GLuint buffer;
+        GLenum usage;
+        size_t size;
+    };
+    HandleMap<IndirectBufferHandle, BufferData> indirect_buffer_map_;
+    HandleMap<StorageBufferHandle, BufferData> storage_buffer_map_;
+
+    // Uniform buffers, which are bound to the uniform blocks of programs with glBindBufferRange.
+    HandleMap<UniformBufferHandle, BufferData> uniform_buffer_map_;
+    // Uniform blocks which aren't sourced from a uniform buffer are filled from the item's
+    // uniforms, and streamed into this buffer whenever they change. It's orphaned when full, which
+    // invalidates every range streamed so far, so the generation is incremented.
+    GLuint uniform_scratch_buffer_;
+    usize uniform_scratch_offset_;
+    u64 uniform_scratch_generation_;
+    usize uniform_buffer_offset_alignment_;
+    // The range bound to each uniform buffer binding point, so that redundant binds are skipped.
+    struct UniformBufferRange {
+        GLuint buffer;
+        usize offset;
+        usize size;
+    };
+    std::vector<UniformBufferRange> bound_uniform_buffer_ranges_;
 
     // Shaders programs.
+    // A member of a uniform block, laid out with std140 rules.
+    struct UniformBlockMember {
+        enum class Type : u8 { Int, UInt, Float };
+
+        std::string name;
+        Type type;
+        u32 vec_size;
+        u32 columns;
+        u32 array_size;
+        u32 offset;
+        u32 array_stride;
+        u32 matrix_stride;
+    };
+    struct UniformBlock {
+        // Name of the block in the GLSL, and the binding point it's assigned after linking, which
+        // is the same as its binding location.
+        std::string name;
+        u32 binding_location;
+        u32 size;
+        std::vector<UniformBlockMember> members;
+        // Contents of the block when it isn't sourced from a uniform buffer, which are written by
+        // the item's uniforms, and the scratch buffer range that they were last streamed to.
+        std::vector<byte> data;
+        bool dirty;
+        usize scratch_offset;
+        u64 scratch_generation;
+    };
+    // The block and member that a uniform refers to. The block is -2 if unresolved, and -1 if the
+    // program doesn't have the uniform.
+    struct UniformMemberRef {
+        int block = -2;
+        int member = -1;
+    };
     struct ProgramData {
         GLuint program;
         std::unordered_map<std::string, u32> uniform_remap_ids;
         std::unordered_map<u32, u32> binding_location_to_texture_unit;
-        // This is a cache of uniform locations that is built up during rendering.
-        std::unordered_map<std::string, GLint> uniform_location_map;
+        // Blocks of every stage. A block which is used by several stages is listed once.
+        std::vector<UniformBlock> uniform_blocks;
+        // This is a cache of the uniform block member of each uniform indexed by uniform handle,
+        // which is built up during rendering.
+        std::vector<UniformMemberRef> uniform_members;
+        // Location of the bindless texture table uniform, resolved when the program is first used
+        // (-2 if unresolved, -1 if the program doesn't use it), and the table version last
+        // uploaded to it.
+        GLint bindless_textures_location = -2;
+        u64 bindless_textures_version = 0;
+    };
+    HandleMap<ProgramHandle, ProgramData> program_map_;
+
+    // The result of cross-compiling each stage of a program from SPIR-V to GLSL. This doesn't
+    // touch GL, so it can happen on a worker thread.
+    struct CrossCompiledProgram {
+        std::vector<std::pair<ShaderStage, std::string>> sources;
+        std::unordered_map<std::string, u32> uniform_remap_ids;
+        std::unordered_map<u32, u32> binding_location_to_texture_unit;
+        std::vector<UniformBlock> uniform_blocks;
+        std::string error;
     };
-    std::unordered_map<ProgramHandle, ProgramData> program_map_;
+
+    // Async programs. These are cross-compiled on the worker pool, then compiled and linked on the
+    // render thread at the start of the next frame after cross-compilation finishes.
+    struct PendingProgram {
+        ProgramData program_data;
+        u64 cache_key;
+    };
+    std::unique_ptr<WorkerPool> program_worker_pool_;
+    std::unordered_map<ProgramHandle, PendingProgram> pending_programs_;
+    std::vector<std::pair<ProgramHandle, CrossCompiledProgram>> cross_compiled_programs_;
+    std::mutex cross_compiled_programs_mutex_;
+
+    // Uniform names indexed by uniform handle.
+    std::vector<std::string> uniform_names_;
 
     // Textures.
     struct TextureData {
         GLuint texture;
+        // GL_TEXTURE_2D, or GL_TEXTURE_2D_ARRAY for array textures.
+        GLenum target;
         bool has_mip_maps;
+        GLenum internal_format;
+        TextureFormat format;
+        // True if the mip chain is generated from the base level, so must be regenerated whenever
+        // the base level is updated.
+        bool generated_mip_maps;
+        // The texture's entry in the bindless texture table, or 0 if it isn't in the table.
+        GLuint64 bindless_handle;
+    };
+    HandleMap<TextureHandle, TextureData> texture_map_;
+    // Pixel unpack buffers which stage texture updates, so that glTexSubImage2D returns without
+    // waiting for the upload. Updates use the buffers in turn, and orphan their previous contents,
+    // so an update never waits for the GPU to finish reading an earlier one.
+    static constexpr usize kTextureUploadBufferCount = 4;
+    struct TextureUploadBuffer {
+        GLuint buffer = 0;
+        size_t size = 0;
     };
-    std::unordered_map<TextureHandle, TextureData> texture_map_;
+    std::array<TextureUploadBuffer, kTextureUploadBufferCount> texture_upload_buffers_;
+    usize next_texture_upload_buffer_;
     SamplerCacheGL sampler_cache_;
+    // The textures and samplers bound to each texture unit, so that only changed bindings are
+    // issued. Units which a draw doesn't use are left bound.
+    std::vector<GLuint> bound_textures_;
+    std::vector<GLuint> bound_samplers_;
+    u32 active_texture_unit_;
 
     // Frame buffers.
     struct FrameBufferData {
@@ -136,10 +410,103 @@ private:
         u16 height;
         std::vector<TextureHandle> textures;
     };
-    std::unordered_map<FrameBufferHandle, FrameBufferData> frame_buffer_map_;
+    HandleMap<FrameBufferHandle, FrameBufferData> frame_buffer_map_;
+
+    // Occlusion queries. Each query cycles through a few query objects, so that it can be written
+    // again while earlier results are still on their way back. glBeginConditionalRender is GL 3.0,
+    // but isn't available on GLES 3.0, where draw conditions use the last result read back instead.
+    static constexpr usize kOcclusionQueryObjectCount = 3;
+    struct OcclusionQueryData {
+        std::array<GLuint, kOcclusionQueryObjectCount> queries;
+        // True for query objects which have been written, but not read back.
+        std::array<bool, kOcclusionQueryObjectCount> pending;
+        // The query object which is written next, which is also the oldest.
+        usize next;
+        // The most recently written query object, or 0 if the query has never been written.
+        GLuint last_written;
+        std::optional<u64> last_result;
+    };
+    bool conditional_rendering_supported_;
+    HandleMap<OcclusionQueryHandle, OcclusionQueryData> occlusion_query_map_;
+
+    // Video memory budget, from GL_NVX_gpu_memory_info. Reading it may synchronise with the
+    // driver, so it's only queried every few frames.
+    bool memory_info_supported_;
+    uint frames_until_memory_info_;
 
     // Helper functions.
-    void setupVertexArrayAttributes(const VertexDecl& decl, uint vb_offset);
+    // Discards the contents of the colour and/or depth attachments of the frame buffer of a render
+    // queue, which must be bound.
+    void invalidateFrameBuffer(const RenderQueue& q, bool colour, bool depth);
+    // Sets up the attributes in a vertex declaration starting at a given attribute location.
+    // Returns the location after the last attribute.
+    uint setupVertexArrayAttributes(const VertexDecl& decl, uint vb_offset, uint first_location,
+                                    uint divisor);
+    // Sets up the attribute formats in a vertex declaration starting at a given attribute
+    // location, sourced from a vertex buffer binding. Returns the location after the last
+    // attribute.
+    uint setupVertexArrayFormat(const VertexDecl& decl, uint first_location, uint binding);
+    u32 vertexDeclId(const VertexDecl& decl);
+    // Binds the vertex and element buffers of a render item, using a cached VAO if possible.
+    void bindVertexArray(const RenderItem& item, const Frame* frame);
+    void bindDefaultVertexArray(const RenderItem& item);
+    // Returns the byte offset to bind a render item's vertex buffer at, which includes its base
+    // vertex if draws can't apply it.
+    uint vertexBufferOffset(const RenderItem& item, const VertexDecl& decl) const;
+    // Removes a buffer which is about to be deleted from the cached VAOs.
+    void forgetVertexArrayBuffer(GLuint buffer);
+    void evictVertexArrays();
+    UniformMemberRef findUniformMember(ProgramData& program_data, UniformHandle uniform);
+    // Binds the uniforms and textures of a render item to the currently bound program.
+    void bindUniforms(ProgramData& program_data, const RenderItem& item);
+    void bindUniformBuffers(ProgramData& program_data, const RenderItem& item);
+    void writeUniformBlockMember(UniformBlock& block, const UniformBlockMember& member,
+                                 const UniformData& data);
+    // Streams a block's contents into the scratch buffer, and returns the offset they're at.
+    usize streamUniformBlock(const UniformBlock& block);
+    void orphanUniformScratchBuffer();
+    void bindUniformBufferRange(u32 binding, GLuint buffer, usize offset, usize size);
+    // Assigns each uniform block of a linked program to its binding point.
+    void assignUniformBlockBindings(ProgramData& program_data);
+    void bindTextures(ProgramData& program_data, const RenderItem& item);
+    // Returns false if the texture unit was already bound.
+    bool setBoundTexture(u32 unit, GLenum target, GLuint texture);
+    bool setBoundSampler(u32 unit, GLuint sampler);
+    void bindStorageBuffers(const RenderItem& item);
+    // Runs the compute items of a render queue, followed by a barrier.
+    void dispatchComputeItems(const RenderQueue& queue);
+    CrossCompiledProgram crossCompileProgram(const std::vector<ShaderStageInfo>& stages) const;
+    std::string crossCompileStage(const ShaderStageInfo& stage,
+                                  CrossCompiledProgram& program) const;
+    // Compiles and links a cross-compiled program, then adds it to the program map.
+    void linkProgram(ProgramHandle handle, ProgramData program_data, u64 cache_key,
+                     const CrossCompiledProgram& cross_compiled);
+    // Deletes the shaders and program object of a program which failed to compile or link.
+    void destroyFailedProgram(const std::vector<GLuint>& shaders, GLuint program);
+    void finishAsyncPrograms();
+    void applyPresentMode(PresentMode mode, uint swap_interval);
+    // Program binary cache. Cached programs are stored in the cache directory, one file per
+    // program.
+    bool programBinaryCacheEnabled() const;
+    u64 programCacheKey(const cmd::CreateProgram& c) const;
+    bool loadCachedProgram(u64 key, ProgramData& program_data);
+    void saveCachedProgram(u64 key, const ProgramData& program_data);
+    // Issues the indirect draws of a render item. The item's index buffer must already be bound.
+    void submitIndirect(const RenderItem& item);
+    // Uploads the bindless texture table to a program if it has changed since the program last
+    // used it.
+    void bindBindlessTextures(ProgramData& program_data);
+    // Uploads transient storage to a buffer, growing the buffer if required.
+    void uploadTransientBuffer(GLenum target, GLuint buffer, size_t& buffer_size, GLenum usage,
+                               const Frame::TransientBufferStorage& storage);
+    // Reads back the results of occlusion queries which have become available.
+    void readOcclusionQueryResults();
+    // Queries the video memory budget and usage every few frames, if supported.
+    void queryMemoryInfo();
+    // Reads back the timestamps of an earlier frame if they are available, then sets up and writes
+    // the first timestamp of this frame.
+    void beginGpuTiming(const Frame* frame);
+    void endGpuTiming();
 };
 }  // namespace gfx
 }  // namespace dw
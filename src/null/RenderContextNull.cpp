@@ -17,6 +17,22 @@ bool RenderContextNull::hasFlippedViewport() const {
     return false;
 }
 
+bool RenderContextNull::isTextureFormatSupported(TextureFormat) const {
+    return true;
+}
+
+bool RenderContextNull::isComputeSupported() const {
+    return true;
+}
+
+bool RenderContextNull::isBindlessTexturingSupported() const {
+    return true;
+}
+
+bool RenderContextNull::isConditionalRenderingSupported() const {
+    return true;
+}
+
 Result<void, std::string> RenderContextNull::createWindow(u16, u16, const std::string&,
                                                           InputCallbacks) {
     return {};
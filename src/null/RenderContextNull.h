@@ -21,6 +21,15 @@ public:
     // Capabilities / customisations.
     Mat4 adjustProjectionMatrix(Mat4 projection_matrix) const override;
     bool hasFlippedViewport() const override;
+    bool isTextureFormatSupported(TextureFormat format) const override;
+    bool isComputeSupported() const override;
+    bool isBindlessTexturingSupported() const override;
+    bool isConditionalRenderingSupported() const override;
+
+    // The null renderer creates nothing, so programs are always ready.
+    bool isProgramReady(ProgramHandle) const override {
+        return true;
+    }
 
     // Window management. Executed on the main thread.
     Result<void, std::string> createWindow(u16 width, u16 height,
@@ -0,0 +1,282 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "vulkan/MemoryAllocatorVK.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+namespace dw {
+namespace gfx {
+namespace {
+// Preferred size of each memory block. Heaps smaller than kMinBlocksPerHeap * kPreferredBlockSize
+// (such as the small host visible device local heap on some GPUs) use smaller blocks.
+constexpr vk::DeviceSize kPreferredBlockSize = 64 * 1024 * 1024;
+constexpr vk::DeviceSize kMinBlocksPerHeap = 8;
+
+vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+}  // namespace
+
+float MemoryAllocatorVK::Stats::fragmentation() const {
+    if (free_bytes == 0) {
+        return 0.0f;
+    }
+    return 1.0f - static_cast<float>(largest_free_range) / static_cast<float>(free_bytes);
+}
+
+MemoryAllocatorVK::Stats& MemoryAllocatorVK::Stats::operator+=(const Stats& other) {
+    block_count += other.block_count;
+    allocation_count += other.allocation_count;
+    dedicated_allocation_count += other.dedicated_allocation_count;
+    allocated_bytes += other.allocated_bytes;
+    used_bytes += other.used_bytes;
+    free_bytes += other.free_bytes;
+    largest_free_range = std::max(largest_free_range, other.largest_free_range);
+    free_range_count += other.free_range_count;
+    return *this;
+}
+
+MemoryAllocatorVK::MemoryAllocatorVK(vk::PhysicalDevice physical_device, vk::Device device)
+    : device_(device), memory_properties_(physical_device.getMemoryProperties()) {
+    heaps_.resize(memory_properties_.memoryTypeCount * 2);
+    for (u32 i = 0; i < memory_properties_.memoryTypeCount; ++i) {
+        const auto& memory_type = memory_properties_.memoryTypes[i];
+        vk::DeviceSize heap_size = memory_properties_.memoryHeaps[memory_type.heapIndex].size;
+        for (usize resource_type = 0; resource_type < 2; ++resource_type) {
+            Heap& heap = heaps_[i * 2 + resource_type];
+            heap.memory_type = i;
+            heap.block_size = std::min(kPreferredBlockSize, heap_size / kMinBlocksPerHeap);
+            heap.host_visible = static_cast<bool>(memory_type.propertyFlags &
+                                                  vk::MemoryPropertyFlagBits::eHostVisible);
+        }
+    }
+}
+
+MemoryAllocatorVK::~MemoryAllocatorVK() {
+    // Any remaining allocations are leaked resources, but the blocks they live in are freed here
+    // regardless.
+    for (const auto& heap : heaps_) {
+        for (const auto& block : heap.blocks) {
+            if (block.memory) {
+                device_.free(block.memory);
+            }
+        }
+    }
+}
+
+MemoryAllocationVK MemoryAllocatorVK::allocate(const vk::MemoryRequirements& requirements,
+                                               vk::MemoryPropertyFlags properties,
+                                               ResourceType resource_type) {
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    u32 memory_type = findMemoryType(requirements.memoryTypeBits, properties);
+    usize heap_index = memory_type * 2 + static_cast<usize>(resource_type);
+    Heap& heap = heaps_[heap_index];
+
+    MemoryAllocationVK allocation;
+    allocation.size = requirements.size;
+    allocation.heap_index = heap_index;
+
+    // Large resources get their own allocation, as they would waste most of a block otherwise.
+    if (requirements.size > heap.block_size / 2) {
+        vk::MemoryAllocateInfo alloc_info;
+        alloc_info.allocationSize = requirements.size;
+        alloc_info.memoryTypeIndex = memory_type;
+        allocation.memory = device_.allocateMemory(alloc_info);
+        allocation.mapped_data = mapMemory(heap, allocation.memory);
+        allocation.block_index = kDedicatedBlock;
+        heap.dedicated_allocation_count++;
+        heap.dedicated_bytes += requirements.size;
+        return allocation;
+    }
+
+    // Find a block with enough space, otherwise create a new one (reusing a previously released
+    // block slot if possible).
+    usize block_index = 0;
+    for (; block_index < heap.blocks.size(); ++block_index) {
+        Block& block = heap.blocks[block_index];
+        if (block.memory && allocateFromBlock(block, requirements.size, requirements.alignment,
+                                              allocation.offset)) {
+            break;
+        }
+    }
+    if (block_index == heap.blocks.size()) {
+        block_index = 0;
+        while (block_index < heap.blocks.size() && heap.blocks[block_index].memory) {
+            ++block_index;
+        }
+        if (block_index == heap.blocks.size()) {
+            heap.blocks.emplace_back();
+        }
+
+        vk::MemoryAllocateInfo alloc_info;
+        alloc_info.allocationSize = heap.block_size;
+        alloc_info.memoryTypeIndex = memory_type;
+        Block& block = heap.blocks[block_index];
+        block.memory = device_.allocateMemory(alloc_info);
+        block.size = heap.block_size;
+        block.mapped_data = mapMemory(heap, block.memory);
+        block.free_ranges = {{0, block.size}};
+        allocateFromBlock(block, requirements.size, requirements.alignment, allocation.offset);
+    }
+
+    Block& block = heap.blocks[block_index];
+    block.used_bytes += requirements.size;
+    block.allocation_count++;
+    allocation.memory = block.memory;
+    allocation.block_index = block_index;
+    if (block.mapped_data) {
+        allocation.mapped_data = block.mapped_data + allocation.offset;
+    }
+    return allocation;
+}
+
+void MemoryAllocatorVK::free(MemoryAllocationVK& allocation) {
+    if (!allocation) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    Heap& heap = heaps_[allocation.heap_index];
+    if (allocation.block_index == kDedicatedBlock) {
+        device_.free(allocation.memory);
+        heap.dedicated_allocation_count--;
+        heap.dedicated_bytes -= allocation.size;
+        allocation = MemoryAllocationVK{};
+        return;
+    }
+
+    // Return the range to the block, merging it with adjacent free ranges.
+    Block& block = heap.blocks[allocation.block_index];
+    vk::DeviceSize offset = allocation.offset;
+    vk::DeviceSize size = allocation.size;
+    auto next = block.free_ranges.lower_bound(offset);
+    if (next != block.free_ranges.end() && offset + size == next->first) {
+        size += next->second;
+        next = block.free_ranges.erase(next);
+    }
+    if (next != block.free_ranges.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset) {
+            offset = previous->first;
+            size += previous->second;
+            block.free_ranges.erase(previous);
+        }
+    }
+    block.free_ranges.emplace(offset, size);
+    block.used_bytes -= allocation.size;
+    block.allocation_count--;
+
+    // Release empty blocks, but keep one around to avoid reallocating when a heap is
+    // repeatedly emptied and refilled (such as during level loads).
+    if (block.allocation_count == 0) {
+        usize other_empty_blocks = 0;
+        for (const auto& other_block : heap.blocks) {
+            if (&other_block != &block && other_block.memory && other_block.allocation_count == 0) {
+                other_empty_blocks++;
+            }
+        }
+        if (other_empty_blocks > 0) {
+            device_.free(block.memory);
+            block = Block{};
+        }
+    }
+    allocation = MemoryAllocationVK{};
+}
+
+MemoryAllocatorVK::Stats MemoryAllocatorVK::stats() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    Stats total;
+    for (const auto& heap : heaps_) {
+        total += heapStats(heap);
+    }
+    return total;
+}
+
+MemoryAllocatorVK::Stats MemoryAllocatorVK::memoryTypeStats(u32 memory_type) const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    Stats total;
+    total += heapStats(heaps_[memory_type * 2]);
+    total += heapStats(heaps_[memory_type * 2 + 1]);
+    return total;
+}
+
+u32 MemoryAllocatorVK::findMemoryType(u32 type_filter, vk::MemoryPropertyFlags properties) const {
+    for (u32 i = 0; i < memory_properties_.memoryTypeCount; i++) {
+        if ((type_filter & (1u << i)) &&
+            (memory_properties_.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+
+    throw std::runtime_error("failed to find a suitable memory type.");
+}
+
+bool MemoryAllocatorVK::allocateFromBlock(Block& block, vk::DeviceSize size,
+                                          vk::DeviceSize alignment, vk::DeviceSize& offset) {
+    // Pick the smallest free range that fits (best fit), to keep large ranges available.
+    auto best_range = block.free_ranges.end();
+    vk::DeviceSize best_offset = 0;
+    for (auto it = block.free_ranges.begin(); it != block.free_ranges.end(); ++it) {
+        vk::DeviceSize aligned_offset = alignUp(it->first, alignment);
+        if (aligned_offset + size > it->first + it->second) {
+            continue;
+        }
+        if (best_range == block.free_ranges.end() || it->second < best_range->second) {
+            best_range = it;
+            best_offset = aligned_offset;
+        }
+    }
+    if (best_range == block.free_ranges.end()) {
+        return false;
+    }
+
+    // Split the range, returning any padding before and after the allocation to the free list.
+    vk::DeviceSize range_offset = best_range->first;
+    vk::DeviceSize range_end = best_range->first + best_range->second;
+    block.free_ranges.erase(best_range);
+    if (best_offset > range_offset) {
+        block.free_ranges.emplace(range_offset, best_offset - range_offset);
+    }
+    if (best_offset + size < range_end) {
+        block.free_ranges.emplace(best_offset + size, range_end - (best_offset + size));
+    }
+    offset = best_offset;
+    return true;
+}
+
+byte* MemoryAllocatorVK::mapMemory(const Heap& heap, vk::DeviceMemory memory) {
+    if (!heap.host_visible) {
+        return nullptr;
+    }
+    return reinterpret_cast<byte*>(device_.mapMemory(memory, 0, VK_WHOLE_SIZE));
+}
+
+MemoryAllocatorVK::Stats MemoryAllocatorVK::heapStats(const Heap& heap) const {
+    Stats stats;
+    stats.dedicated_allocation_count = heap.dedicated_allocation_count;
+    stats.allocation_count = heap.dedicated_allocation_count;
+    stats.allocated_bytes = heap.dedicated_bytes;
+    stats.used_bytes = heap.dedicated_bytes;
+    for (const auto& block : heap.blocks) {
+        if (!block.memory) {
+            continue;
+        }
+        stats.block_count++;
+        stats.allocation_count += block.allocation_count;
+        stats.allocated_bytes += block.size;
+        stats.used_bytes += block.used_bytes;
+        for (const auto& range : block.free_ranges) {
+            stats.free_bytes += range.second;
+            stats.largest_free_range = std::max(stats.largest_free_range, range.second);
+            stats.free_range_count++;
+        }
+    }
+    return stats;
+}
+}  // namespace gfx
+}  // namespace dw
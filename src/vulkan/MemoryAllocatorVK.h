@@ -0,0 +1,118 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Base.h"
+
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include <vulkan/vulkan.hpp>
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace dw {
+namespace gfx {
+// A range of device memory, sub-allocated from a larger block owned by MemoryAllocatorVK.
+struct MemoryAllocationVK {
+    vk::DeviceMemory memory;
+    vk::DeviceSize offset = 0;
+    vk::DeviceSize size = 0;
+    // Host pointer to the start of this allocation if the memory is host visible (blocks are
+    // persistently mapped), otherwise nullptr.
+    byte* mapped_data = nullptr;
+
+    explicit operator bool() const {
+        return static_cast<bool>(memory);
+    }
+
+private:
+    friend class MemoryAllocatorVK;
+    usize heap_index = 0;
+    usize block_index = 0;
+};
+
+// Sub-allocates buffers and images from large blocks of device memory, to keep the number of
+// vkAllocateMemory calls (which are slow, and limited by maxMemoryAllocationCount) to a minimum.
+// Each memory type has two heaps of blocks, one for linear resources (buffers) and one for
+// optimal tiling resources (images), so bufferImageGranularity never needs to be considered.
+class MemoryAllocatorVK {
+public:
+    enum class ResourceType { Linear, Optimal };
+
+    struct Stats {
+        usize block_count = 0;
+        usize allocation_count = 0;
+        usize dedicated_allocation_count = 0;
+        // Total device memory allocated from the driver (including dedicated allocations).
+        vk::DeviceSize allocated_bytes = 0;
+        // Memory in use by allocations (including dedicated allocations).
+        vk::DeviceSize used_bytes = 0;
+        // Free memory inside blocks.
+        vk::DeviceSize free_bytes = 0;
+        vk::DeviceSize largest_free_range = 0;
+        usize free_range_count = 0;
+
+        // Returns a value between 0 (all free memory is in a single range) and 1 (free memory is
+        // split into many small ranges).
+        float fragmentation() const;
+
+        Stats& operator+=(const Stats& other);
+    };
+
+    MemoryAllocatorVK(vk::PhysicalDevice physical_device, vk::Device device);
+    ~MemoryAllocatorVK();
+
+    MemoryAllocatorVK(const MemoryAllocatorVK&) = delete;
+    MemoryAllocatorVK(MemoryAllocatorVK&&) = delete;
+    MemoryAllocatorVK& operator=(const MemoryAllocatorVK&) = delete;
+    MemoryAllocatorVK& operator=(MemoryAllocatorVK&&) = delete;
+
+    MemoryAllocationVK allocate(const vk::MemoryRequirements& requirements,
+                                vk::MemoryPropertyFlags properties, ResourceType resource_type);
+    void free(MemoryAllocationVK& allocation);
+
+    // Usage statistics, either across all memory types or for a single memory type.
+    Stats stats() const;
+    Stats memoryTypeStats(u32 memory_type) const;
+
+    u32 findMemoryType(u32 type_filter, vk::MemoryPropertyFlags properties) const;
+
+private:
+    static constexpr usize kDedicatedBlock = ~usize(0);
+
+    struct Block {
+        vk::DeviceMemory memory;
+        vk::DeviceSize size = 0;
+        byte* mapped_data = nullptr;
+        // Free ranges in this block, as offset -> size.
+        std::map<vk::DeviceSize, vk::DeviceSize> free_ranges;
+        vk::DeviceSize used_bytes = 0;
+        usize allocation_count = 0;
+    };
+
+    struct Heap {
+        u32 memory_type = 0;
+        vk::DeviceSize block_size = 0;
+        bool host_visible = false;
+        std::vector<Block> blocks;
+        usize dedicated_allocation_count = 0;
+        vk::DeviceSize dedicated_bytes = 0;
+    };
+
+    vk::Device device_;
+    vk::PhysicalDeviceMemoryProperties memory_properties_;
+
+    // Indexed by memory type * 2 + resource type.
+    std::vector<Heap> heaps_;
+    mutable std::mutex mutex_;
+
+    bool allocateFromBlock(Block& block, vk::DeviceSize size, vk::DeviceSize alignment,
+                           vk::DeviceSize& offset);
+    byte* mapMemory(const Heap& heap, vk::DeviceMemory memory);
+    Stats heapStats(const Heap& heap) const;
+};
+}  // namespace gfx
+}  // namespace dw
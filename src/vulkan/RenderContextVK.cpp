@@ -3,10 +3,15 @@
  * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
  */
 #include "vulkan/RenderContextVK.h"
+#include "Texture.h"
+#include "Trace.h"
 #include <cstring>
 #include <set>
 #include <cstdint>
 #include <map>
+#include <thread>
+#include <algorithm>
+#include <fstream>
 
 #include <spirv_cross.hpp>
 #include <dawn-gfx/Renderer.h>
@@ -64,6 +69,18 @@ const std::array<TextureFormatVK, usize(TextureFormat::Count)> kTextureFormatMap
     {vk::Format::eR32G32B32A32Sint,   vk::Format::eUndefined   }, // RGBA32I
     {vk::Format::eR32G32B32A32Uint,   vk::Format::eUndefined   }, // RGBA32U
     {vk::Format::eR32G32B32A32Sfloat, vk::Format::eUndefined   }, // RGBA32F
+    {vk::Format::eBc1RgbaUnormBlock,  vk::Format::eBc1RgbaSrgbBlock}, // BC1
+    {vk::Format::eBc2UnormBlock,      vk::Format::eBc2SrgbBlock}, // BC2
+    {vk::Format::eBc3UnormBlock,      vk::Format::eBc3SrgbBlock}, // BC3
+    {vk::Format::eBc4UnormBlock,      vk::Format::eUndefined   }, // BC4
+    {vk::Format::eBc5UnormBlock,      vk::Format::eUndefined   }, // BC5
+    {vk::Format::eBc6HUfloatBlock,    vk::Format::eUndefined   }, // BC6H
+    {vk::Format::eBc7UnormBlock,      vk::Format::eBc7SrgbBlock}, // BC7
+    {vk::Format::eEtc2R8G8B8UnormBlock, vk::Format::eEtc2R8G8B8SrgbBlock}, // ETC2
+    {vk::Format::eEtc2R8G8B8A8UnormBlock, vk::Format::eEtc2R8G8B8A8SrgbBlock}, // ETC2A
+    {vk::Format::eAstc4x4UnormBlock,  vk::Format::eAstc4x4SrgbBlock}, // ASTC4x4
+    {vk::Format::eAstc6x6UnormBlock,  vk::Format::eAstc6x6SrgbBlock}, // ASTC6x6
+    {vk::Format::eAstc8x8UnormBlock,  vk::Format::eAstc8x8SrgbBlock}, // ASTC8x8
     {vk::Format::eD16Unorm,           vk::Format::eUndefined   }, // D16
     {vk::Format::eD24UnormS8Uint,     vk::Format::eUndefined   }, // D24
     {vk::Format::eD24UnormS8Uint,     vk::Format::eUndefined   }, // D24S8
@@ -102,7 +119,14 @@ const std::unordered_map<BlendFunc, vk::BlendFactor> kBlendFuncMap = {
 
 const std::array<const char*, 1> kValidationLayers = {"VK_LAYER_KHRONOS_validation"};
 const std::array<const char*, 1> kRequiredDeviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
-constexpr auto kMaxFramesInFlight = 2;
+// Render queues with at least this many items are split into chunks of roughly this size and
+// recorded in parallel.
+constexpr usize kParallelRecordingMinItems = 256;
+constexpr usize kMaxParallelRecordingThreads = 8;
+// Name of the pipeline cache file, relative to the cache directory.
+constexpr const char* kPipelineCacheFilename = "vulkan_pipeline_cache.bin";
+// Size of the staging ring used for texture uploads. Larger uploads use a dedicated buffer.
+constexpr vk::DeviceSize kUploadStagingRingSize = 32 * 1024 * 1024;
 
 VKAPI_ATTR VkBool32 VKAPI_CALL
 debugMessageCallback(VkDebugUtilsMessageSeverityFlagBitsEXT message_severity,
@@ -120,6 +144,9 @@ debugMessageCallback(VkDebugUtilsMessageSeverityFlagBitsEXT message_severity,
 struct QueueFamilyIndices {
     std::optional<u32> graphics_family;
     std::optional<u32> present_family;
+    // A queue family which supports transfers but not graphics (usually a DMA engine), if the
+    // device has one.
+    std::optional<u32> transfer_family;
 
     static QueueFamilyIndices fromPhysicalDevice(vk::PhysicalDevice device,
                                                  vk::SurfaceKHR surface) {
@@ -142,6 +169,17 @@ struct QueueFamilyIndices {
             i++;
         }
 
+        for (u32 j = 0; j < queue_families.size(); ++j) {
+            vk::QueueFlags flags = queue_families[j].queueFlags;
+            if (!(flags & vk::QueueFlagBits::eTransfer) || (flags & vk::QueueFlagBits::eGraphics)) {
+                continue;
+            }
+            // Prefer a transfer-only family over an async compute family.
+            if (!indices.transfer_family || !(flags & vk::QueueFlagBits::eCompute)) {
+                indices.transfer_family = j;
+            }
+        }
+
         return indices;
     }
 
@@ -173,15 +211,39 @@ struct SwapChainSupportDetails {
         return formats[0];
     }
 
-    vk::PresentModeKHR choosePresentMode() const {
-        // TODO: Configure this.
-        for (const auto& available_present_mode : present_modes) {
-            if (available_present_mode == vk::PresentModeKHR::eMailbox) {
-                return available_present_mode;
-            }
+    vk::PresentModeKHR choosePresentMode(PresentMode preferred, Logger& logger) const {
+        auto is_available = [this](vk::PresentModeKHR mode) {
+            return std::find(present_modes.begin(), present_modes.end(), mode) !=
+                   present_modes.end();
+        };
+        auto mode = vk::PresentModeKHR::eFifo;
+        switch (preferred) {
+            case PresentMode::Immediate:
+                mode = vk::PresentModeKHR::eImmediate;
+                break;
+            case PresentMode::Mailbox:
+                mode = vk::PresentModeKHR::eMailbox;
+                break;
+            case PresentMode::Fifo:
+                mode = vk::PresentModeKHR::eFifo;
+                break;
+            case PresentMode::FifoRelaxed:
+                mode = vk::PresentModeKHR::eFifoRelaxed;
+                break;
         }
-
-        return vk::PresentModeKHR::eFifo;
+        if (is_available(mode)) {
+            return mode;
+        }
+        // FIFO is the only mode which is guaranteed to be available. Only a request for immediate
+        // presentation falls back to mailbox, which is also uncapped. The other modes are
+        // synchronised to vertical blank (or at least don't tear), so they fall back to FIFO.
+        auto chosen = mode == vk::PresentModeKHR::eImmediate &&
+                              is_available(vk::PresentModeKHR::eMailbox)
+                          ? vk::PresentModeKHR::eMailbox
+                          : vk::PresentModeKHR::eFifo;
+        logger.warn("[Swapchain] Present mode {} is not supported, using {} instead.",
+                    vk::to_string(mode), vk::to_string(chosen));
+        return chosen;
     }
 
     vk::Extent2D chooseSwapExtent(Vec2i window_size) const {
@@ -217,9 +279,128 @@ vk::ShaderStageFlagBits convertShaderStage(ShaderStage stage) {
         {ShaderStage::Vertex, vk::ShaderStageFlagBits::eVertex},
         {ShaderStage::Geometry, vk::ShaderStageFlagBits::eGeometry},
         {ShaderStage::Fragment, vk::ShaderStageFlagBits::eFragment},
+        {ShaderStage::Compute, vk::ShaderStageFlagBits::eCompute},
     };
     return shader_stage_map.at(stage);
 }
+
+vk::AttachmentLoadOp convertLoadOp(RenderQueue::LoadOp op) {
+    switch (op) {
+        case RenderQueue::LoadOp::Load:
+            return vk::AttachmentLoadOp::eLoad;
+        case RenderQueue::LoadOp::Clear:
+            return vk::AttachmentLoadOp::eClear;
+        default:
+            return vk::AttachmentLoadOp::eDontCare;
+    }
+}
+
+vk::AttachmentStoreOp convertStoreOp(RenderQueue::StoreOp op) {
+    return op == RenderQueue::StoreOp::Store ? vk::AttachmentStoreOp::eStore
+                                             : vk::AttachmentStoreOp::eDontCare;
+}
+
+// Covers a render target, flipped vertically so that Y points up as it does on GL.
+vk::Viewport targetViewport(vk::Extent2D extent) {
+    vk::Viewport viewport;
+    viewport.width = static_cast<float>(extent.width);
+    viewport.height = -static_cast<float>(extent.height);
+    viewport.x = 0.0f;
+    viewport.y = static_cast<float>(extent.height);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    return viewport;
+}
+
+u32 attachmentOpsKey(const RenderQueue::AttachmentOps& ops) {
+    return static_cast<u32>(ops.colour_load) | static_cast<u32>(ops.colour_store) << 8 |
+           static_cast<u32>(ops.depth_load) << 16 | static_cast<u32>(ops.depth_store) << 24;
+}
+
+// The ops of the render pass each frame buffer (and the backbuffer) is created with, which clear
+// every attachment and discard depth.
+const RenderQueue::AttachmentOps kDefaultAttachmentOps = {
+    RenderQueue::LoadOp::Clear, RenderQueue::StoreOp::Store, RenderQueue::LoadOp::Clear,
+    RenderQueue::StoreOp::DontCare};
+
+// Creates a render pass with a single subpass which renders to a set of colour attachments and a
+// depth attachment. Render passes which only differ in their load and store ops are compatible, so
+// they can be used with the same framebuffers and pipelines. Loaded attachments are expected to be
+// in their final layout, which is where an earlier render pass leaves them.
+vk::RenderPass createRenderPass(vk::Device device, const std::vector<vk::Format>& colour_formats,
+                                vk::ImageLayout colour_final_layout, vk::Format depth_format,
+                                const RenderQueue::AttachmentOps& ops) {
+    // Colour attachments.
+    std::vector<vk::AttachmentDescription> attachment_descriptions;
+    std::vector<vk::AttachmentReference> colour_attachment_refs;
+    for (vk::Format format : colour_formats) {
+        vk::AttachmentDescription colour_attachment;
+        colour_attachment.format = format;
+        colour_attachment.samples = vk::SampleCountFlagBits::e1;
+        colour_attachment.loadOp = convertLoadOp(ops.colour_load);
+        colour_attachment.storeOp = convertStoreOp(ops.colour_store);
+        colour_attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+        colour_attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+        colour_attachment.initialLayout = ops.colour_load == RenderQueue::LoadOp::Load
+                                              ? colour_final_layout
+                                              : vk::ImageLayout::eUndefined;
+        colour_attachment.finalLayout = colour_final_layout;
+        attachment_descriptions.emplace_back(colour_attachment);
+
+        vk::AttachmentReference colour_attachment_ref;
+        colour_attachment_ref.attachment = attachment_descriptions.size() - 1;
+        colour_attachment_ref.layout = vk::ImageLayout::eColorAttachmentOptimal;
+        colour_attachment_refs.emplace_back(colour_attachment_ref);
+    }
+
+    // Depth attachment.
+    vk::AttachmentDescription depth_attachment;
+    depth_attachment.format = depth_format;
+    depth_attachment.samples = vk::SampleCountFlagBits::e1;
+    depth_attachment.loadOp = convertLoadOp(ops.depth_load);
+    depth_attachment.storeOp = convertStoreOp(ops.depth_store);
+    depth_attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+    depth_attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+    depth_attachment.initialLayout = ops.depth_load == RenderQueue::LoadOp::Load
+                                         ? vk::ImageLayout::eDepthStencilAttachmentOptimal
+                                         : vk::ImageLayout::eUndefined;
+    depth_attachment.finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+    attachment_descriptions.emplace_back(depth_attachment);
+
+    vk::AttachmentReference depth_attachment_ref;
+    depth_attachment_ref.attachment = attachment_descriptions.size() - 1;
+    depth_attachment_ref.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+
+    // Subpass.
+    vk::SubpassDescription subpass;
+    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+    subpass.colorAttachmentCount = colour_attachment_refs.size();
+    subpass.pColorAttachments = colour_attachment_refs.data();
+    subpass.pDepthStencilAttachment = &depth_attachment_ref;
+
+    // Loading depth needs the previous render pass's depth writes to be finished.
+    vk::SubpassDependency dependency;
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput |
+                              vk::PipelineStageFlagBits::eLateFragmentTests;
+    dependency.srcAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+    dependency.dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput |
+                              vk::PipelineStageFlagBits::eEarlyFragmentTests;
+    dependency.dstAccessMask = vk::AccessFlagBits::eColorAttachmentRead |
+                               vk::AccessFlagBits::eColorAttachmentWrite |
+                               vk::AccessFlagBits::eDepthStencilAttachmentRead |
+                               vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+
+    vk::RenderPassCreateInfo render_pass_info;
+    render_pass_info.attachmentCount = attachment_descriptions.size();
+    render_pass_info.pAttachments = attachment_descriptions.data();
+    render_pass_info.subpassCount = 1;
+    render_pass_info.pSubpasses = &subpass;
+    render_pass_info.dependencyCount = 1;
+    render_pass_info.pDependencies = &dependency;
+    return device.createRenderPass(render_pass_info);
+}
 }  // namespace
 
 DeviceVK::DeviceVK(vk::PhysicalDevice physical_device, vk::Device device,
@@ -229,9 +410,11 @@ DeviceVK::DeviceVK(vk::PhysicalDevice physical_device, vk::Device device,
       command_pool_(command_pool),
       graphics_queue_(graphics_queue) {
     properties_ = physical_device_.getProperties();
+    allocator_ = std::make_unique<MemoryAllocatorVK>(physical_device_, device_);
 }
 
 DeviceVK::~DeviceVK() {
+    allocator_.reset();
     device_.destroy(command_pool_);
     device_.destroy();
 }
@@ -248,21 +431,17 @@ vk::CommandPool DeviceVK::getCommandPool() const {
     return command_pool_;
 }
 
-u32 DeviceVK::findMemoryType(u32 type_filter, vk::MemoryPropertyFlags properties) {
-    auto mem_properties = physical_device_.getMemoryProperties();
-    for (u32 i = 0; i < mem_properties.memoryTypeCount; i++) {
-        if ((type_filter & (1u << i)) &&
-            (mem_properties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
-        }
-    }
+MemoryAllocatorVK& DeviceVK::allocator() {
+    return *allocator_;
+}
 
-    throw std::runtime_error("failed to find a suitable memory type.");
+u32 DeviceVK::findMemoryType(u32 type_filter, vk::MemoryPropertyFlags properties) {
+    return allocator_->findMemoryType(type_filter, properties);
 }
 
 vk::DeviceSize DeviceVK::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage,
                                       vk::MemoryPropertyFlags properties, vk::Buffer& buffer,
-                                      vk::DeviceMemory& buffer_memory) {
+                                      MemoryAllocationVK& buffer_memory) {
     vk::BufferCreateInfo bufferInfo;
     bufferInfo.size = size;
     bufferInfo.usage = usage;
@@ -270,16 +449,19 @@ vk::DeviceSize DeviceVK::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags
     buffer = device_.createBuffer(bufferInfo);
 
     vk::MemoryRequirements mem_requirements = device_.getBufferMemoryRequirements(buffer);
-    vk::MemoryAllocateInfo alloc_info;
-    alloc_info.allocationSize = mem_requirements.size;
-    alloc_info.memoryTypeIndex = findMemoryType(mem_requirements.memoryTypeBits, properties);
-    buffer_memory = device_.allocateMemory(alloc_info);
+    buffer_memory = allocator_->allocate(mem_requirements, properties,
+                                         MemoryAllocatorVK::ResourceType::Linear);
 
-    device_.bindBufferMemory(buffer, buffer_memory, 0);
+    device_.bindBufferMemory(buffer, buffer_memory.memory, buffer_memory.offset);
 
     return mem_requirements.size;
 }
 
+void DeviceVK::destroyBuffer(vk::Buffer buffer, MemoryAllocationVK& buffer_memory) {
+    device_.destroy(buffer);
+    allocator_->free(buffer_memory);
+}
+
 void DeviceVK::copyBuffer(vk::Buffer src_buffer, vk::Buffer dst_buffer, vk::DeviceSize size) {
     vk::CommandBuffer command_buffer = beginSingleUseCommands();
 
@@ -355,14 +537,15 @@ void DeviceVK::transitionImageLayout(vk::Image image, vk::Format format, vk::Ima
 
 void DeviceVK::createImage(u32 width, u32 height, vk::Format format, vk::ImageTiling tiling,
                            vk::ImageUsageFlags usage, vk::MemoryPropertyFlags properties,
-                           vk::Image& image, vk::DeviceMemory& image_memory) {
+                           vk::Image& image, MemoryAllocationVK& image_memory, u32 mip_levels,
+                           u32 array_layers) {
     vk::ImageCreateInfo image_info;
     image_info.imageType = vk::ImageType::e2D;
     image_info.extent.width = width;
     image_info.extent.height = height;
     image_info.extent.depth = 1;
-    image_info.mipLevels = 1;
-    image_info.arrayLayers = 1;
+    image_info.mipLevels = mip_levels;
+    image_info.arrayLayers = array_layers;
     image_info.format = format;
     image_info.tiling = tiling;
     image_info.initialLayout = vk::ImageLayout::eUndefined;
@@ -372,19 +555,26 @@ void DeviceVK::createImage(u32 width, u32 height, vk::Format format, vk::ImageTi
     image = device_.createImage(image_info);
 
     vk::MemoryRequirements mem_requirements = device_.getImageMemoryRequirements(image);
-    vk::MemoryAllocateInfo alloc_info;
-    alloc_info.allocationSize = mem_requirements.size;
-    alloc_info.memoryTypeIndex = findMemoryType(mem_requirements.memoryTypeBits, properties);
-    image_memory = device_.allocateMemory(alloc_info);
+    image_memory =
+        allocator_->allocate(mem_requirements, properties,
+                             tiling == vk::ImageTiling::eLinear
+                                 ? MemoryAllocatorVK::ResourceType::Linear
+                                 : MemoryAllocatorVK::ResourceType::Optimal);
+
+    device_.bindImageMemory(image, image_memory.memory, image_memory.offset);
+}
 
-    device_.bindImageMemory(image, image_memory, 0);
+void DeviceVK::destroyImage(vk::Image image, MemoryAllocationVK& image_memory) {
+    device_.destroy(image);
+    allocator_->free(image_memory);
 }
 
 vk::ImageView DeviceVK::createImageView(vk::Image image, vk::Format format,
-                                        vk::ImageAspectFlags aspect_flags) {
+                                        vk::ImageAspectFlags aspect_flags, u32 mip_levels,
+                                        vk::ImageViewType view_type, u32 array_layers) {
     vk::ImageViewCreateInfo image_view_info;
     image_view_info.image = image;
-    image_view_info.viewType = vk::ImageViewType::e2D;
+    image_view_info.viewType = view_type;
     image_view_info.format = format;
     image_view_info.components.r = vk::ComponentSwizzle::eIdentity;
     image_view_info.components.g = vk::ComponentSwizzle::eIdentity;
@@ -392,9 +582,9 @@ vk::ImageView DeviceVK::createImageView(vk::Image image, vk::Format format,
     image_view_info.components.a = vk::ComponentSwizzle::eIdentity;
     image_view_info.subresourceRange.aspectMask = aspect_flags;
     image_view_info.subresourceRange.baseMipLevel = 0;
-    image_view_info.subresourceRange.levelCount = 1;
+    image_view_info.subresourceRange.levelCount = mip_levels;
     image_view_info.subresourceRange.baseArrayLayer = 0;
-    image_view_info.subresourceRange.layerCount = 1;
+    image_view_info.subresourceRange.layerCount = array_layers;
     return device_.createImageView(image_view_info);
 }
 
@@ -433,89 +623,148 @@ const vk::PhysicalDeviceProperties& DeviceVK::properties() {
 
 BufferVK::BufferVK(DeviceVK* device, const byte* data, vk::DeviceSize size, BufferUsage usage,
                    vk::BufferUsageFlags buffer_type, usize swap_chain_size)
-    : device(device), size(size), usage(usage) {
+    : device(device), size(size), usage(usage), copy_count_(1), copy_stride_(size) {
     if (usage == BufferUsage::Static) {
         // Static memory uses a staging buffer to upload static vertex data to device local memory.
         vk::Buffer staging_buffer;
-        vk::DeviceMemory staging_buffer_memory;
+        MemoryAllocationVK staging_buffer_memory;
         device->createBuffer(
             size, vk::BufferUsageFlagBits::eTransferSrc,
             vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
             staging_buffer, staging_buffer_memory);
-
-        void* mapped_data = device->getDevice().mapMemory(staging_buffer_memory, 0, size);
-        memcpy(mapped_data, data, static_cast<std::size_t>(size));
-        device->getDevice().unmapMemory(staging_buffer_memory);
+        if (data) {
+            memcpy(staging_buffer_memory.mapped_data, data, static_cast<std::size_t>(size));
+        }
 
         // Copy staging data into buffers.
-        buffer.resize(1);
-        buffer_memory.resize(1);
         device->createBuffer(size, vk::BufferUsageFlagBits::eTransferDst | buffer_type,
-                             vk::MemoryPropertyFlagBits::eDeviceLocal, buffer[0], buffer_memory[0]);
-        device->copyBuffer(staging_buffer, buffer[0], size);
+                             vk::MemoryPropertyFlagBits::eDeviceLocal, buffer_, buffer_memory_);
+        device->copyBuffer(staging_buffer, buffer_, size);
 
-        device->getDevice().destroy(staging_buffer);
-        device->getDevice().free(staging_buffer_memory);
-    } else if (usage == BufferUsage::Stream) {
-        // Streaming buffers are stored as host coherent buffers.
-        buffer.resize(swap_chain_size);
-        buffer_memory.resize(swap_chain_size);
-        for (usize i = 0; i < swap_chain_size; ++i) {
-            device->createBuffer(size, buffer_type,
-                                 vk::MemoryPropertyFlagBits::eHostVisible |
-                                     vk::MemoryPropertyFlagBits::eHostCoherent,
-                                 buffer[i], buffer_memory[i]);
+        device->destroyBuffer(staging_buffer, staging_buffer_memory);
+    } else {
+        // Stream and dynamic buffers are stored as a single persistently mapped host coherent
+        // buffer, containing one copy of the data per swap chain image. This means that the copy
+        // used by the current frame can be written to without waiting for the GPU.
+        copy_count_ = swap_chain_size;
+        copy_stride_ = (size + kCopyAlignment - 1) / kCopyAlignment * kCopyAlignment;
+        device->createBuffer(copy_stride_ * copy_count_, buffer_type,
+                             vk::MemoryPropertyFlagBits::eHostVisible |
+                                 vk::MemoryPropertyFlagBits::eHostCoherent,
+                             buffer_, buffer_memory_);
+        if (data) {
+            for (usize i = 0; i < copy_count_; ++i) {
+                memcpy(buffer_memory_.mapped_data + i * copy_stride_, data, usize(size));
+            }
+        }
 
-            void* mapped_data = device->getDevice().mapMemory(buffer_memory[i], 0, size);
-            memcpy(mapped_data, data, usize(size));
-            device->getDevice().unmapMemory(buffer_memory[i]);
+        // Dynamic buffers keep a copy of their contents, so partial updates can be applied to
+        // the other copies in later frames.
+        if (usage == BufferUsage::Dynamic) {
+            shadow_data_.resize(usize(size));
+            if (data) {
+                memcpy(shadow_data_.data(), data, usize(size));
+            }
+            dirty_ranges_.resize(copy_count_);
         }
     }
 }
 
 BufferVK::~BufferVK() {
-    assert(buffer.size() == buffer_memory.size());
-    for (usize i = 0; i < buffer.size(); ++i) {
-        device->getDevice().free(buffer_memory[i]);
-        device->getDevice().destroy(buffer[i]);
-    }
+    device->destroyBuffer(buffer_, buffer_memory_);
 }
 
 BufferVK::BufferVK(BufferVK&& other) noexcept
-    : device(other.device), size(other.size), usage(other.usage) {
-    std::swap(buffer, other.buffer);
-    std::swap(buffer_memory, other.buffer_memory);
+    : device(other.device),
+      size(other.size),
+      usage(other.usage),
+      copy_count_(other.copy_count_),
+      copy_stride_(other.copy_stride_) {
+    std::swap(buffer_, other.buffer_);
+    std::swap(buffer_memory_, other.buffer_memory_);
+    std::swap(shadow_data_, other.shadow_data_);
+    std::swap(dirty_ranges_, other.dirty_ranges_);
 }
 
 BufferVK& BufferVK::operator=(BufferVK&& other) noexcept {
     device = other.device;
     size = other.size;
-    std::swap(buffer, other.buffer);
-    std::swap(buffer_memory, other.buffer_memory);
     usage = other.usage;
+    copy_count_ = other.copy_count_;
+    copy_stride_ = other.copy_stride_;
+    std::swap(buffer_, other.buffer_);
+    std::swap(buffer_memory_, other.buffer_memory_);
+    std::swap(shadow_data_, other.shadow_data_);
+    std::swap(dirty_ranges_, other.dirty_ranges_);
     return *this;
 }
 
-vk::Buffer BufferVK::get(u32 frame_index) const {
-    return buffer[getIndex(frame_index)];
+vk::Buffer BufferVK::get() const {
+    return buffer_;
+}
+
+vk::DeviceSize BufferVK::getOffset(u32 frame_index) const {
+    return getIndex(frame_index) * copy_stride_;
+}
+
+vk::DeviceSize BufferVK::allocatedSize() const {
+    return buffer_memory_.size;
 }
 
 bool BufferVK::update(u32 frame_index, const byte* data, vk::DeviceSize data_size,
                       vk::DeviceSize offset) {
+    if (offset + data_size > size) {
+        return false;
+    }
+
     switch (usage) {
         case BufferUsage::Static:
             return false;
 
-        case BufferUsage::Dynamic:
-            // TODO: Not implemented.
+        case BufferUsage::Dynamic: {
+            // Write to this frames copy immediately, and mark the range as dirty in the copies
+            // used by other frames in flight.
+            memcpy(shadow_data_.data() + usize(offset), data, usize(data_size));
+            u32 index = getIndex(frame_index);
+            for (u32 i = 0; i < copy_count_; ++i) {
+                if (i == index) {
+                    continue;
+                }
+                auto& range = dirty_ranges_[i];
+                if (range.begin == range.end) {
+                    range = {offset, offset + data_size};
+                } else {
+                    range.begin = std::min(range.begin, offset);
+                    range.end = std::max(range.end, offset + data_size);
+                }
+            }
+            memcpy(buffer_memory_.mapped_data + getOffset(frame_index) + offset, data,
+                   usize(data_size));
+            return true;
+        }
+
+        case BufferUsage::Stream:
+            memcpy(buffer_memory_.mapped_data + getOffset(frame_index) + offset, data,
+                   usize(data_size));
             return true;
+    }
+    return false;
+}
+
+bool BufferVK::flush(u32 frame_index) {
+    if (usage != BufferUsage::Dynamic) {
+        return false;
+    }
 
-        case BufferUsage::Stream: {
-            const auto& current_buffer_memory = buffer_memory[getIndex(frame_index)];
-            void* mapped_data = device->getDevice().mapMemory(current_buffer_memory, usize(offset),
-                                                              usize(data_size));
-            memcpy(mapped_data, data + usize(offset), usize(data_size));
-            device->getDevice().unmapMemory(current_buffer_memory);
+    u32 index = getIndex(frame_index);
+    auto& range = dirty_ranges_[index];
+    if (range.begin != range.end) {
+        memcpy(buffer_memory_.mapped_data + getOffset(frame_index) + range.begin,
+               shadow_data_.data() + usize(range.begin), usize(range.end - range.begin));
+        range = {};
+    }
+    for (const auto& other_range : dirty_ranges_) {
+        if (other_range.begin != other_range.end) {
             return true;
         }
     }
@@ -523,39 +772,60 @@ bool BufferVK::update(u32 frame_index, const byte* data, vk::DeviceSize data_siz
 }
 
 u32 BufferVK::getIndex(u32 frame_index) const {
-    if (buffer.size() == 1) {
+    if (copy_count_ == 1) {
         return 0;
     } else {
-        assert(frame_index < buffer.size());
+        assert(frame_index < copy_count_);
         return frame_index;
     }
 }
 
-VertexDeclVK::VertexDeclVK(const VertexDecl& decl) {
-    binding_description.binding = 0;
-    binding_description.stride = decl.stride();
-    binding_description.inputRate = vk::VertexInputRate::eVertex;
-
-    // Create vertex attribute description from VertexDecl.
-    attribute_descriptions.reserve(decl.attributes_.size());
-    for (usize i = 0; i < decl.attributes_.size(); ++i) {
-        const auto& attrib = decl.attributes_[i];
-
-        // Decode attribute.
-        VertexDecl::Attribute attribute;
-        usize count;
-        VertexDecl::AttributeType type;
-        bool normalised;
-        VertexDecl::decodeAttributes(attrib.first, attribute, count, type, normalised);
+VertexDeclVK::VertexDeclVK(const Info& info, vk::PhysicalDevice physical_device) {
+    struct Binding {
+        const VertexDecl& decl;
+        vk::VertexInputRate input_rate;
+    };
+    std::vector<Binding> bindings = {{info.decl, vk::VertexInputRate::eVertex}};
+    if (!info.instance_decl.empty()) {
+        bindings.push_back({info.instance_decl, vk::VertexInputRate::eInstance});
+    }
 
-        // Setup attribute description
-        vk::VertexInputAttributeDescription attribute_description;
-        attribute_description.binding = 0;
-        attribute_description.location = i;
-        attribute_description.format = getVertexAttributeFormat(type, count, normalised);
-        attribute_description.offset =
-            static_cast<u32>(reinterpret_cast<std::uintptr_t>(attrib.second));
-        attribute_descriptions.push_back(attribute_description);
+    u32 location = 0;
+    for (u32 binding = 0; binding < bindings.size(); ++binding) {
+        const VertexDecl& decl = bindings[binding].decl;
+
+        vk::VertexInputBindingDescription binding_description;
+        binding_description.binding = binding;
+        binding_description.stride = decl.stride();
+        binding_description.inputRate = bindings[binding].input_rate;
+        binding_descriptions.push_back(binding_description);
+
+        // Create vertex attribute description from VertexDecl.
+        for (const auto& attrib : decl.attributes_) {
+            // Decode attribute.
+            VertexDecl::Attribute attribute;
+            usize count;
+            VertexDecl::AttributeType type;
+            bool normalised;
+            VertexDecl::decodeAttributes(attrib.first, attribute, count, type, normalised);
+
+            // Setup attribute description
+            vk::VertexInputAttributeDescription attribute_description;
+            attribute_description.binding = binding;
+            attribute_description.location = location++;
+            attribute_description.format = getVertexAttributeFormat(type, count, normalised);
+            attribute_description.offset =
+                static_cast<u32>(reinterpret_cast<std::uintptr_t>(attrib.second));
+            attribute_descriptions.push_back(attribute_description);
+
+            // Packed and 3 component 16-bit formats are optional for vertex buffers.
+            if (unsupported_format == vk::Format::eUndefined &&
+                !(physical_device.getFormatProperties(attribute_description.format)
+                      .bufferFeatures &
+                  vk::FormatFeatureFlagBits::eVertexBuffer)) {
+                unsupported_format = attribute_description.format;
+            }
+        }
     }
 }
 
@@ -590,6 +860,62 @@ vk::Format VertexDeclVK::getVertexAttributeFormat(VertexDecl::AttributeType type
                     break;
             }
             break;
+        case VertexDecl::AttributeType::Half:
+            switch (count) {
+                case 1:
+                    return vk::Format::eR16Sfloat;
+                case 2:
+                    return vk::Format::eR16G16Sfloat;
+                case 3:
+                    return vk::Format::eR16G16B16Sfloat;
+                case 4:
+                    return vk::Format::eR16G16B16A16Sfloat;
+                default:
+                    break;
+            }
+            break;
+        case VertexDecl::AttributeType::Int16:
+            switch (count) {
+                case 1:
+                    return normalised ? vk::Format::eR16Snorm : vk::Format::eR16Sint;
+                case 2:
+                    return normalised ? vk::Format::eR16G16Snorm : vk::Format::eR16G16Sint;
+                case 3:
+                    return normalised ? vk::Format::eR16G16B16Snorm : vk::Format::eR16G16B16Sint;
+                case 4:
+                    return normalised ? vk::Format::eR16G16B16A16Snorm
+                                      : vk::Format::eR16G16B16A16Sint;
+                default:
+                    break;
+            }
+            break;
+        case VertexDecl::AttributeType::Uint16:
+            switch (count) {
+                case 1:
+                    return normalised ? vk::Format::eR16Unorm : vk::Format::eR16Uint;
+                case 2:
+                    return normalised ? vk::Format::eR16G16Unorm : vk::Format::eR16G16Uint;
+                case 3:
+                    return normalised ? vk::Format::eR16G16B16Unorm : vk::Format::eR16G16B16Uint;
+                case 4:
+                    return normalised ? vk::Format::eR16G16B16A16Unorm
+                                      : vk::Format::eR16G16B16A16Uint;
+                default:
+                    break;
+            }
+            break;
+        case VertexDecl::AttributeType::Int10_10_10_2:
+            if (count == 4) {
+                return normalised ? vk::Format::eA2B10G10R10SnormPack32
+                                  : vk::Format::eA2B10G10R10SintPack32;
+            }
+            break;
+        case VertexDecl::AttributeType::Uint10_10_10_2:
+            if (count == 4) {
+                return normalised ? vk::Format::eA2B10G10R10UnormPack32
+                                  : vk::Format::eA2B10G10R10UintPack32;
+            }
+            break;
         default:
             break;
     }
@@ -605,14 +931,11 @@ UniformScratchBuffer::UniformScratchBuffer(
         size, vk::BufferUsageFlagBits::eUniformBuffer,
         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
         buffer_, buffer_memory_);
-    data_ =
-        reinterpret_cast<byte*>(device_->getDevice().mapMemory(buffer_memory_, 0, maximum_size_));
+    data_ = buffer_memory_.mapped_data;
 }
 
 UniformScratchBuffer::~UniformScratchBuffer() {
-    device_->getDevice().unmapMemory(buffer_memory_);
-    device_->getDevice().destroy(buffer_);
-    device_->getDevice().free(buffer_memory_);
+    device_->destroyBuffer(buffer_, buffer_memory_);
 }
 
 UniformScratchBuffer::Allocation UniformScratchBuffer::alloc(usize size) {
@@ -634,8 +957,16 @@ vk::Buffer UniformScratchBuffer::getBuffer() const {
 }
 
 void TextureVK::setImageBarrier(vk::CommandBuffer command_buffer, vk::ImageLayout new_layout) {
+    vk::ImageMemoryBarrier imb;
+    if (makeImageBarrier(new_layout, imb)) {
+        command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands,
+                                       vk::PipelineStageFlagBits::eAllCommands, {}, {}, {}, imb);
+    }
+}
+
+bool TextureVK::makeImageBarrier(vk::ImageLayout new_layout, vk::ImageMemoryBarrier& imb) {
     if (new_layout == image_layout) {
-        return;
+        return false;
     }
 
     vk::AccessFlags src_access_mask = {};
@@ -645,6 +976,7 @@ void TextureVK::setImageBarrier(vk::CommandBuffer command_buffer, vk::ImageLayou
         case vk::ImageLayout::eUndefined:
             break;
         case vk::ImageLayout::eGeneral:
+            src_access_mask |= vk::AccessFlagBits::eShaderWrite;
             break;
         case vk::ImageLayout::eColorAttachmentOptimal:
             src_access_mask |= vk::AccessFlagBits::eColorAttachmentWrite;
@@ -661,6 +993,7 @@ void TextureVK::setImageBarrier(vk::CommandBuffer command_buffer, vk::ImageLayou
             src_access_mask |= vk::AccessFlagBits::eTransferRead;
             break;
         case vk::ImageLayout::eTransferDstOptimal:
+            src_access_mask |= vk::AccessFlagBits::eTransferWrite;
             break;
         case vk::ImageLayout::ePreinitialized:
             src_access_mask |= vk::AccessFlagBits::eHostWrite | vk::AccessFlagBits::eTransferWrite;
@@ -694,7 +1027,7 @@ void TextureVK::setImageBarrier(vk::CommandBuffer command_buffer, vk::ImageLayou
             dst_access_mask |= vk::AccessFlagBits::eShaderRead;
             break;
         case vk::ImageLayout::eTransferDstOptimal:
-            dst_access_mask |= vk::AccessFlagBits::eTransferRead;
+            dst_access_mask |= vk::AccessFlagBits::eTransferWrite;
             break;
         case vk::ImageLayout::ePreinitialized:
             break;
@@ -705,7 +1038,6 @@ void TextureVK::setImageBarrier(vk::CommandBuffer command_buffer, vk::ImageLayou
             break;
     }
 
-    vk::ImageMemoryBarrier imb;
     imb.srcAccessMask = src_access_mask;
     imb.dstAccessMask = dst_access_mask;
     imb.oldLayout = image_layout;
@@ -715,13 +1047,12 @@ void TextureVK::setImageBarrier(vk::CommandBuffer command_buffer, vk::ImageLayou
     imb.image = image;
     imb.subresourceRange.aspectMask = aspect_mask;
     imb.subresourceRange.baseMipLevel = 0;
-    imb.subresourceRange.levelCount = 1;
+    imb.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
     imb.subresourceRange.baseArrayLayer = 0;
-    imb.subresourceRange.layerCount = 1;
-    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands,
-                                   vk::PipelineStageFlagBits::eAllCommands, {}, {}, {}, imb);
+    imb.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
 
     image_layout = new_layout;
+    return true;
 }
 
 FramebufferVK::FramebufferVK(DeviceVK* device, u16 width, u16 height,
@@ -734,75 +1065,21 @@ FramebufferVK::FramebufferVK(DeviceVK* device, u16 width, u16 height,
                         vk::MemoryPropertyFlagBits::eDeviceLocal, depth.image, depth.image_memory);
     depth.image_view =
         device->createImageView(depth.image, depth_image_format, vk::ImageAspectFlagBits::eDepth);
+    depth.image_format = depth_image_format;
+    depth.image_layout = vk::ImageLayout::eUndefined;
+    depth.aspect_mask = vk::ImageAspectFlagBits::eDepth;
 
     // Create render pass.
     std::vector<vk::ImageView> image_views;
-
-    // Setup colour attachments.
-    std::vector<vk::AttachmentDescription> attachment_descriptions;
-    std::vector<vk::AttachmentReference> colour_attachment_refs;
+    std::vector<vk::Format> colour_formats;
     for (TextureVK* attachment : images) {
-        vk::AttachmentDescription colour_attachment;
-        colour_attachment.format = attachment->image_format;
-        colour_attachment.samples = vk::SampleCountFlagBits::e1;
-        colour_attachment.loadOp = vk::AttachmentLoadOp::eClear;
-        colour_attachment.storeOp = vk::AttachmentStoreOp::eStore;
-        colour_attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
-        colour_attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-        colour_attachment.initialLayout = vk::ImageLayout::eUndefined;
-        colour_attachment.finalLayout = vk::ImageLayout::eColorAttachmentOptimal;
-        attachment_descriptions.emplace_back(colour_attachment);
-
-        vk::AttachmentReference colour_attachment_ref;
-        colour_attachment_ref.attachment = attachment_descriptions.size() - 1;
-        colour_attachment_ref.layout = vk::ImageLayout::eColorAttachmentOptimal;
-        colour_attachment_refs.emplace_back(colour_attachment_ref);
-
         image_views.emplace_back(attachment->image_view);
+        colour_formats.emplace_back(attachment->image_format);
     }
-
-    // Depth attachment.
-    vk::AttachmentDescription depth_attachment;
-    depth_attachment.format = depth_image_format;
-    depth_attachment.samples = vk::SampleCountFlagBits::e1;
-    depth_attachment.loadOp = vk::AttachmentLoadOp::eClear;
-    depth_attachment.storeOp = vk::AttachmentStoreOp::eDontCare;
-    depth_attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
-    depth_attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-    depth_attachment.initialLayout = vk::ImageLayout::eUndefined;
-    depth_attachment.finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
-    attachment_descriptions.emplace_back(depth_attachment);
-
-    vk::AttachmentReference depth_attachment_ref;
-    depth_attachment_ref.attachment = attachment_descriptions.size() - 1;
-    depth_attachment_ref.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
-
     image_views.emplace_back(depth.image_view);
-
-    // Subpass.
-    vk::SubpassDescription subpass;
-    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
-    subpass.colorAttachmentCount = colour_attachment_refs.size();
-    subpass.pColorAttachments = colour_attachment_refs.data();
-    subpass.pDepthStencilAttachment = &depth_attachment_ref;
-
-    vk::SubpassDependency dependency;
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-    dependency.srcAccessMask = {};
-    dependency.dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-    dependency.dstAccessMask =
-        vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
-
-    vk::RenderPassCreateInfo render_pass_info;
-    render_pass_info.attachmentCount = attachment_descriptions.size();
-    render_pass_info.pAttachments = attachment_descriptions.data();
-    render_pass_info.subpassCount = 1;
-    render_pass_info.pSubpasses = &subpass;
-    render_pass_info.dependencyCount = 1;
-    render_pass_info.pDependencies = &dependency;
-    render_pass = device->getDevice().createRenderPass(render_pass_info);
+    render_pass = createRenderPass(device->getDevice(), colour_formats,
+                                   vk::ImageLayout::eColorAttachmentOptimal, depth_image_format,
+                                   kDefaultAttachmentOps);
 
     // Create framebuffer.
     vk::FramebufferCreateInfo framebuffer_info;
@@ -815,7 +1092,27 @@ FramebufferVK::FramebufferVK(DeviceVK* device, u16 width, u16 height,
     framebuffer = device->getDevice().createFramebuffer(framebuffer_info);
 }
 
-RenderContextVK::RenderContextVK(Logger& logger) : RenderContext{logger}, current_frame_(0) {
+RenderContextVK::RenderContextVK(Logger& logger)
+    : RenderContext{logger},
+      multi_draw_indirect_supported_(false),
+      compute_supported_(false),
+      debug_labels_supported_(false),
+      memory_budget_supported_(false),
+      gpu_timing_supported_(false),
+      timestamp_period_(1.0),
+      conditional_rendering_supported_(false),
+      occlusion_query_precise_(false),
+      occlusion_query_slot_count_(0),
+      requested_present_mode_(PresentMode::Mailbox),
+      swap_chain_out_of_date_(false),
+      framebuffer_width_(0),
+      framebuffer_height_(0),
+      swap_chain_image_acquired_(false),
+      per_image_resource_count_(0),
+      current_frame_(0),
+      descriptor_pool_index_(0),
+      bindless_texturing_supported_(false),
+      frame_counter_(0) {
 }
 
 RenderContextVK::~RenderContextVK() {
@@ -830,6 +1127,22 @@ bool RenderContextVK::hasFlippedViewport() const {
     return true;
 }
 
+bool RenderContextVK::isTextureFormatSupported(TextureFormat format) const {
+    return texture_format_supported_[static_cast<usize>(format)];
+}
+
+bool RenderContextVK::isComputeSupported() const {
+    return compute_supported_;
+}
+
+bool RenderContextVK::isBindlessTexturingSupported() const {
+    return bindless_texturing_supported_;
+}
+
+bool RenderContextVK::isConditionalRenderingSupported() const {
+    return conditional_rendering_supported_;
+}
+
 Result<void, std::string> RenderContextVK::createWindow(u16 width, u16 height,
                                                         const std::string& title,
                                                         InputCallbacks input_callbacks) {
@@ -844,10 +1157,26 @@ Result<void, std::string> RenderContextVK::createWindow(u16 width, u16 height,
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     // TODO: Support resizing.
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_VISIBLE, window_hidden_ ? GLFW_FALSE : GLFW_TRUE);
     window_ = glfwCreateWindow(static_cast<int>(width * window_scale_.x),
                                static_cast<int>(height * window_scale_.y), title.c_str(), nullptr,
                                nullptr);
 
+    // Track the size of the surface, so the swapchain can be recreated at the right size from the
+    // render thread.
+    Vec2i fb_size = framebufferSize();
+    framebuffer_width_ = static_cast<u32>(fb_size.x);
+    framebuffer_height_ = static_cast<u32>(fb_size.y);
+    glfwSetWindowUserPointer(window_, static_cast<void*>(this));
+    glfwSetFramebufferSizeCallback(window_, [](GLFWwindow* window, int width, int height) {
+        auto& ctx = *static_cast<RenderContextVK*>(glfwGetWindowUserPointer(window));
+        ctx.framebuffer_width_ = static_cast<u32>(width);
+        ctx.framebuffer_height_ = static_cast<u32>(height);
+        ctx.swap_chain_out_of_date_ = true;
+    });
+    uint swap_interval;
+    takePresentModeChange(requested_present_mode_, swap_interval);
+
 #ifdef NDEBUG
     createInstance(false);
 #else
@@ -855,20 +1184,47 @@ Result<void, std::string> RenderContextVK::createWindow(u16 width, u16 height,
 #endif
 
     createDevice();
+    createPipelineCache();
+
+    // Determine which texture formats can be sampled.
+    for (usize i = 0; i < texture_format_supported_.size(); ++i) {
+        vk::Format format = kTextureFormatMap[i].format;
+        texture_format_supported_[i] =
+            format != vk::Format::eUndefined &&
+            (device_->getPhysicalDevice().getFormatProperties(format).optimalTilingFeatures &
+             vk::FormatFeatureFlagBits::eSampledImage);
+    }
     createSwapChain();
+    per_image_resource_count_ = static_cast<u32>(swap_chain_images_.size());
     createRenderPass();
     createFramebuffers();
     createCommandBuffers();
     createDescriptorPool();
     createSyncObjects();
+    createTimestampQueryPool();
+    createOcclusionQueryPool();
+
+    // Start worker threads used for recording command buffers in parallel, leaving a core for the
+    // render thread.
+    usize worker_count =
+        std::min<usize>(std::thread::hardware_concurrency(), kMaxParallelRecordingThreads);
+    if (worker_count > 1) {
+        worker_pool_ = std::make_unique<WorkerPool>(worker_count - 1);
+    }
+    createSecondaryCommandPools();
 
-    uniform_scratch_buffers_.reserve(swap_chain_image_views_.size());
-    for (usize i = 0; i < swap_chain_image_views_.size(); ++i) {
+    // Start worker threads used to create async programs.
+    program_worker_pool_ =
+        std::make_unique<WorkerPool>(std::max(1u, std::thread::hardware_concurrency() / 2));
+
+    uniform_scratch_buffers_.reserve(per_image_resource_count_);
+    for (usize i = 0; i < per_image_resource_count_; ++i) {
         // We estimate that there will be a maximum of 65535 draw calls, with an average of 128
         // bytes of uniforms each.
         uniform_scratch_buffers_.emplace_back(
             std::make_unique<UniformScratchBuffer>(device_.get(), 65535 * 128));
     }
+    createBindlessTextureTable();
 
     return {};
 }
@@ -914,13 +1270,47 @@ void RenderContextVK::stopRendering() {
 }
 
 void RenderContextVK::prepareFrame() {
+    finishAsyncPrograms();
+
+    // Recreate the swapchain if the surface has changed. The swap interval is a GL only setting.
+    uint swap_interval;
+    if (takePresentModeChange(requested_present_mode_, swap_interval)) {
+        swap_chain_out_of_date_ = true;
+    }
+    if (swap_chain_out_of_date_) {
+        recreateSwapChain();
+    }
+
     // Wait for in-flight fence.
-    vk_device_.waitForFences(in_flight_fences_[current_frame_], VK_TRUE, UINT64_MAX);
+    {
+        DW_TRACE_SCOPE("RenderContextVK::waitForFrameFence");
+        vk_device_.waitForFences(in_flight_fences_[current_frame_], VK_TRUE, UINT64_MAX);
+    }
 
-    // Acquire next image.
-    vk_device_.acquireNextImageKHR(swap_chain_, UINT64_MAX,
-                                   image_available_semaphores_[current_frame_], vk::Fence{},
-                                   &next_frame_index_);
+    // Acquire next image. If the swapchain is out of date, recreate it and try again. If that
+    // fails too (for example, if the window is minimised), the frame is dropped.
+    if (!swap_chain_) {
+        swap_chain_image_acquired_ = false;
+        return;
+    }
+    auto acquire = [this]() {
+        return vk_device_.acquireNextImageKHR(swap_chain_, UINT64_MAX,
+                                              image_available_semaphores_[current_frame_],
+                                              vk::Fence{}, &next_frame_index_);
+    };
+    vk::Result result = acquire();
+    if (result == vk::Result::eErrorOutOfDateKHR && recreateSwapChain()) {
+        result = acquire();
+    }
+    swap_chain_image_acquired_ =
+        result == vk::Result::eSuccess || result == vk::Result::eSuboptimalKHR;
+    if (!swap_chain_image_acquired_) {
+        swap_chain_out_of_date_ = true;
+        return;
+    }
+    if (result == vk::Result::eSuboptimalKHR) {
+        swap_chain_out_of_date_ = true;
+    }
 
     // Check if a previous frame is using this image (i.e. there is a fence to wait on).
     if (images_in_flight_[next_frame_index_]) {
@@ -929,6 +1319,11 @@ void RenderContextVK::prepareFrame() {
 
     // Mark this image as now being in use by this frame.
     images_in_flight_[next_frame_index_] = in_flight_fences_[current_frame_];
+
+    frame_counter_++;
+    evictDescriptorSets();
+    destroyRetiredResources();
+    queryMemoryBudget();
 }
 
 void RenderContextVK::processCommandList(std::vector<RenderCommand>& command_list) {
@@ -939,38 +1334,67 @@ void RenderContextVK::processCommandList(std::vector<RenderCommand>& command_lis
 }
 
 bool RenderContextVK::frame(const Frame* frame) {
+    // Nothing can be rendered if there's no swapchain image to present. Dynamic buffer updates
+    // stay pending until the next frame which is rendered.
+    if (!swap_chain_image_acquired_) {
+        return true;
+    }
+
+    // Apply updates made to dynamic buffers in previous frames to this frame's copy.
+    for (auto it = pending_dynamic_buffers_.begin(); it != pending_dynamic_buffers_.end();) {
+        if ((*it)->flush(next_frame_index_)) {
+            ++it;
+        } else {
+            it = pending_dynamic_buffers_.erase(it);
+        }
+    }
+
     // Update transient vertex and index buffers.
     auto& tvb = frame->transient_vb_storage;
     if (tvb.handle && tvb.size > 0) {
-        auto& tvb_data = vertex_buffer_map_.at(*frame->transient_vb_storage.handle);
-        tvb_data.buffer.update(next_frame_index_, frame->transient_vb_storage.data.data(),
-                               frame->transient_vb_storage.size, 0);
+        auto& tvb_data = vertex_buffer_map_.at(*tvb.handle);
+        uploadTransientBuffer(tvb_data.buffer, vk::BufferUsageFlagBits::eVertexBuffer, tvb);
     }
-    auto& tib = frame->transient_ib_storage;
-    if (tib.handle && tib.size > 0) {
-        auto& tib_data = index_buffer_map_.at(*frame->transient_ib_storage.handle);
-        tib_data.buffer.update(next_frame_index_, frame->transient_ib_storage.data.data(),
-                               frame->transient_ib_storage.size, 0);
+    for (auto* tib : {&frame->transient_ib_storage, &frame->transient_ib32_storage}) {
+        if (tib->handle && tib->size > 0) {
+            auto& tib_data = index_buffer_map_.at(*tib->handle);
+            uploadTransientBuffer(tib_data.buffer, vk::BufferUsageFlagBits::eIndexBuffer, *tib);
+        }
     }
 
     uniform_scratch_buffers_[next_frame_index_]->reset();
+    writeBindlessTextures();
+    for (auto& pool : secondary_command_pools_[next_frame_index_]) {
+        vk_device_.resetCommandPool(pool.pool, vk::CommandPoolResetFlags{});
+        pool.used = 0;
+    }
 
     auto command_buffer = command_buffers_[next_frame_index_];
     vk::CommandBufferBeginInfo begin_info;
     begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
     command_buffer.begin(begin_info);
 
+    // Take ownership of any textures uploaded on the transfer queue.
+    upload_queue_->recordAcquireBarriers(command_buffer);
+    recordTextureUpdates(command_buffer);
+    beginGpuTiming(command_buffer, frame);
+    beginOcclusionQueries(command_buffer, frame);
+
     // Write render queues to command buffer.
     const FramebufferVK* previous_frame_buffer = nullptr;
     bool in_render_pass = false;
-    for (const auto& q : frame->render_queues) {
+    bool backbuffer_rendered = false;
+    for (usize queue_index = 0; queue_index < frame->render_queues.size(); ++queue_index) {
+        DW_TRACE_SCOPE("RenderContextVK::recordRenderQueue");
+        const auto& q = frame->render_queues[queue_index];
+
         // Get framebuffer.
-        const FramebufferVK* current_frame_buffer = nullptr;
+        FramebufferVK* current_frame_buffer = nullptr;
         vk::Framebuffer target_framebuffer;
         vk::RenderPass target_render_pass;
         vk::Extent2D target_extent;
         if (q.frame_buffer) {
-            const auto& fb = framebuffer_map_.at(*q.frame_buffer);
+            auto& fb = framebuffer_map_.at(*q.frame_buffer);
             target_framebuffer = fb.framebuffer;
             target_render_pass = fb.render_pass;
             target_extent = fb.extent;
@@ -990,153 +1414,146 @@ bool RenderContextVK::frame(const Frame* frame) {
                 in_render_pass = false;
             }
 
-            // Transition framebuffer state.
-            if (previous_frame_buffer && current_frame_buffer != previous_frame_buffer) {
-                for (TextureVK* image : previous_frame_buffer->images) {
-                    image->setImageBarrier(command_buffer, vk::ImageLayout::eShaderReadOnlyOptimal);
-                }
-                // TODO: Depth.
+            // Dispatches can't be recorded inside a render pass, so run the dispatches of every
+            // queue which shares this render pass before it begins.
+            usize group_end = queue_index + 1;
+            while (group_end < frame->render_queues.size() &&
+                   frame->render_queues[group_end].frame_buffer == q.frame_buffer) {
+                ++group_end;
             }
+
+            // Transition only the images which this render pass and its dispatches use, instead
+            // of every attachment of the previous frame buffer. Depth attachments are never
+            // sampled, so they're only ever in the depth attachment layout (or undefined before
+            // their first pass), which the render pass transitions them from itself.
+            transitionQueueImages(command_buffer, frame->render_queues, queue_index, group_end,
+                                  current_frame_buffer);
+            recordComputeItems(command_buffer, frame->render_queues, queue_index, group_end);
+
+            // Dispatches may have used the colour attachments as storage images since.
             if (current_frame_buffer) {
                 for (TextureVK* image : current_frame_buffer->images) {
                     image->setImageBarrier(command_buffer,
                                            vk::ImageLayout::eColorAttachmentOptimal);
                 }
-                // TODO: Depth.
             }
 
-            // Begin render pass.
+            // The render pass loads with the ops of the first queue, and stores with the ops of
+            // the last. Attachments which have never been written are cleared instead of loaded.
+            auto ops = q.resolvedAttachmentOps();
+            auto last_ops = frame->render_queues[group_end - 1].resolvedAttachmentOps();
+            ops.colour_store = last_ops.colour_store;
+            ops.depth_store = last_ops.depth_store;
+            vk::ImageLayout& depth_layout =
+                current_frame_buffer ? current_frame_buffer->depth.image_layout
+                                     : depth_image_layout_;
+            if (ops.colour_load == RenderQueue::LoadOp::Load && !current_frame_buffer &&
+                !backbuffer_rendered) {
+                ops.colour_load = RenderQueue::LoadOp::Clear;
+            }
+            if (ops.depth_load == RenderQueue::LoadOp::Load &&
+                depth_layout == vk::ImageLayout::eUndefined) {
+                ops.depth_load = RenderQueue::LoadOp::Clear;
+            }
+            depth_layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+            if (!current_frame_buffer) {
+                backbuffer_rendered = true;
+            }
+
             vk::RenderPassBeginInfo render_pass_info;
-            render_pass_info.renderPass = target_render_pass;
+            render_pass_info.renderPass = findOrCreateRenderPass(current_frame_buffer, ops);
             render_pass_info.framebuffer = target_framebuffer;
             render_pass_info.renderArea.offset = vk::Offset2D{0, 0};
             render_pass_info.renderArea.extent = target_extent;
 
-            // Set clear parameters.
+            // Set clear parameters. These are only needed if an attachment is cleared.
             std::vector<vk::ClearValue> clear_values;
-            int colour_attachment_count = 1;
-            if (current_frame_buffer) {
-                colour_attachment_count = current_frame_buffer->images.size();
-            }
-            vk::ClearColorValue clear_colour;
-            if (q.clear_parameters.has_value()) {
-                const auto& colour = q.clear_parameters.value().colour;
-                clear_colour = {
-                    std::array<float, 4>{colour.r(), colour.g(), colour.b(), colour.a()}};
-            } else {
-                clear_colour = {std::array<float, 4>{0.0f, 0.0f, 0.0f, 0.0f}};
-            }
-            for (int i = 0; i < colour_attachment_count; ++i) {
-                clear_values.emplace_back(clear_colour);
+            if (ops.colour_load == RenderQueue::LoadOp::Clear ||
+                ops.depth_load == RenderQueue::LoadOp::Clear) {
+                usize colour_attachment_count = 1;
+                if (current_frame_buffer) {
+                    colour_attachment_count = current_frame_buffer->images.size();
+                }
+                vk::ClearColorValue clear_colour;
+                if (q.clear_parameters.has_value()) {
+                    const auto& colour = q.clear_parameters.value().colour;
+                    clear_colour = {
+                        std::array<float, 4>{colour.r(), colour.g(), colour.b(), colour.a()}};
+                } else {
+                    clear_colour = {std::array<float, 4>{0.0f, 0.0f, 0.0f, 0.0f}};
+                }
+                for (usize i = 0; i < colour_attachment_count; ++i) {
+                    clear_values.emplace_back(clear_colour);
+                }
+                clear_values.emplace_back(vk::ClearDepthStencilValue{1.0f, 0});
             }
-            clear_values.emplace_back(vk::ClearDepthStencilValue{1.0f, 0});
             render_pass_info.clearValueCount = clear_values.size();
             render_pass_info.pClearValues = clear_values.data();
 
             // Begin render pass.
-            command_buffer.beginRenderPass(render_pass_info, vk::SubpassContents::eInline);
+            command_buffer.beginRenderPass(render_pass_info,
+                                           vk::SubpassContents::eSecondaryCommandBuffers);
             in_render_pass = true;
         }
         previous_frame_buffer = current_frame_buffer;
 
-        for (auto& ri : q.render_items) {
-            auto& program = program_map_.at(*ri.program);
+        // Upload uniforms. This is done serially, as uniform values persist between items which
+        // use the same program.
+        prepareUniforms(q.render_items);
 
-            // Apply uniforms.
-            for (auto& entry : ri.uniforms) {
-                auto uniform = program.uniform_locations.find(entry.first);
-                if (uniform == program.uniform_locations.end()) {
-                    logger_.warn("Unknown uniform '{}' in program {}", entry.first, *ri.program);
-                    continue;
-                }
-                uniform->second.data = std::move(entry.second);
+        // Record render items into secondary command buffers. Large queues are split into chunks
+        // which are recorded in parallel on the worker pool.
+        usize item_count = q.render_items.size();
+        if (item_count == 0) {
+            continue;
+        }
+        usize chunk_count = 1;
+        if (worker_pool_ && item_count >= kParallelRecordingMinItems) {
+            chunk_count = std::min(worker_pool_->size(),
+                                   (item_count + kParallelRecordingMinItems - 1) /
+                                       kParallelRecordingMinItems);
+        }
+        static const GpuTimestampLayout::QueueTimestamps kNoTimestamps;
+        const auto& timestamps = gpu_timing_supported_
+                                     ? gpu_timing_frames_[next_frame_index_].layout.queueTimestamps(
+                                           queue_index)
+                                     : kNoTimestamps;
+        std::vector<vk::CommandBuffer> secondary_command_buffers(chunk_count);
+        std::vector<FrameStats> chunk_stats(chunk_count);
+        auto record_chunk = [&](usize thread_index, usize chunk) {
+            DW_TRACE_SCOPE("RenderContextVK::recordRenderItems");
+            usize begin = item_count * chunk / chunk_count;
+            usize end = item_count * (chunk + 1) / chunk_count;
+            vk::CommandBuffer secondary_command_buffer =
+                beginSecondaryCommandBuffer(thread_index, target_render_pass, target_framebuffer);
+            // A label in a secondary command buffer must end in the same command buffer, so each
+            // chunk is labelled separately.
+            bool labelled = debug_labels_supported_ && !q.label.empty();
+            if (labelled) {
+                vk::DebugUtilsLabelEXT label;
+                label.pLabelName = q.label.c_str();
+                secondary_command_buffer.beginDebugUtilsLabelEXT(label);
             }
-
-            // If there are no vertices to render, we are done.
-            if (!ri.vb) {
-                continue;
-            }
-
-            // Upload uniforms to uniform buffer.
-            std::map<usize, UniformScratchBuffer::Allocation> ubo_data;
-            for (const auto& ubo : program.uniform_buffers) {
-                const u32 alignment = device_->properties().limits.minUniformBufferOffsetAlignment;
-                const u32 vsize = strideAlign(ubo.size, alignment);
-                ubo_data[ubo.binding] = uniform_scratch_buffers_[next_frame_index_]->alloc(vsize);
-            }
-            for (const auto& uniform_entry : program.uniform_locations) {
-                const auto& uniform = uniform_entry.second;
-                if (!uniform.binding_location.has_value()) {
-                    logger_.warn("Push constants not implemented yet.");
-                    continue;
-                }
-
-                // Write to memory.
-                if (uniform.data) {
-                    auto variant_bytes = std::visit(VariantToBytesHelper{}, *uniform.data);
-                    byte* data_dst = ubo_data.at(*uniform.binding_location).ptr + uniform.offset;
-                    std::memcpy(data_dst, variant_bytes.data, variant_bytes.size);
-                    /*
-                    logger_.info("Writing {} (size {}) to offset {} in UBO {}", uniform_pair.first,
-                                 variant_bytes.size, uniform_location.offset,
-                                 *uniform_location.ubo_location);
-                    */
-                }
-#ifndef NDEBUG
-                if (!uniform.data) {
-                    logger_.warn("Uniform {} is uninitialised.", uniform_entry.first);
-                }
-#endif
-            }
-
-            const auto& vb = vertex_buffer_map_.at(*ri.vb);
-
-            // Get (or create) vertex decl.
-            const auto& current_vertex_decl =
-                ri.vertex_decl_override.empty() ? vb.decl : ri.vertex_decl_override;
-            auto decl_it = vertex_decl_cache_.find(current_vertex_decl);
-            if (decl_it == vertex_decl_cache_.end()) {
-                decl_it = vertex_decl_cache_
-                              .emplace(current_vertex_decl, VertexDeclVK{current_vertex_decl})
-                              .first;
-            }
-
-            // Bind (and create) graphics pipeline.
-            auto graphics_pipeline = findOrCreateGraphicsPipeline(
-                PipelineVK::Info{&ri, &vb, &decl_it->second, &program, current_frame_buffer});
-            command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
-                                        graphics_pipeline.pipeline);
-            if (ri.scissor_enabled) {
-                command_buffer.setScissor(
-                    0, vk::Rect2D{vk::Offset2D{ri.scissor_x, ri.scissor_y},
-                                  vk::Extent2D{ri.scissor_width, ri.scissor_height}});
-            } else {
-                command_buffer.setScissor(0, vk::Rect2D{vk::Offset2D{0, 0}, swap_chain_extent_});
-            }
-
-            // Calculate dynamic offsets for the UBOs.
-            std::vector<u32> dynamic_offsets;
-            for (const auto& ubo_entry : ubo_data) {
-                dynamic_offsets.emplace_back(ubo_entry.second.offset_from_base);
-            }
-
-            // Bind descriptor set.
-            auto descriptor_set =
-                findOrCreateDescriptorSet(DescriptorSetVK::Info{&program, std::move(ri.textures)});
-            command_buffer.bindDescriptorSets(
-                vk::PipelineBindPoint::eGraphics, graphics_pipeline.layout, 0,
-                descriptor_set.descriptor_sets[next_frame_index_], dynamic_offsets);
-
-            // Bind vertex/index buffers and draw.
-            command_buffer.bindVertexBuffers(0, vb.buffer.get(next_frame_index_), ri.vb_offset);
-            if (ri.ib) {
-                const auto& ib = index_buffer_map_.at(*ri.ib);
-                command_buffer.bindIndexBuffer(ib.buffer.get(next_frame_index_), ri.ib_offset,
-                                               ib.type);
-                command_buffer.drawIndexed(ri.primitive_count * 3, 1, 0, 0, 0);
-            } else {
-                command_buffer.draw(ri.primitive_count * 3, 1, 0, 0);
+            recordRenderItems(secondary_command_buffer, q, begin, end, current_frame_buffer,
+                              timestamps, chunk_stats[chunk]);
+            if (labelled) {
+                secondary_command_buffer.endDebugUtilsLabelEXT();
             }
+            secondary_command_buffer.end();
+            secondary_command_buffers[chunk] = secondary_command_buffer;
+        };
+        if (chunk_count > 1) {
+            worker_pool_->run(chunk_count, record_chunk);
+        } else {
+            // The render thread uses the last command pool.
+            record_chunk(secondary_command_pools_[next_frame_index_].size() - 1, 0);
+        }
+        command_buffer.executeCommands(secondary_command_buffers);
+        for (const auto& stats : chunk_stats) {
+            stats_.draw_calls += stats.draw_calls;
+            stats_.primitives += stats.primitives;
+            stats_.pipeline_binds += stats.pipeline_binds;
+            stats_.descriptor_set_binds += stats.descriptor_set_binds;
         }
     }
     if (in_render_pass) {
@@ -1144,15 +1561,22 @@ bool RenderContextVK::frame(const Frame* frame) {
         in_render_pass = false;
     }
 
+    endGpuTiming(command_buffer);
     command_buffer.end();
 
-    // Submit command buffer.
+    // Submit pending uploads, then the command buffer. The frame waits for uploads to complete
+    // before any shaders run.
+    std::vector<vk::Semaphore> wait_semaphores = {image_available_semaphores_[current_frame_]};
+    std::vector<vk::PipelineStageFlags> wait_stages = {
+        vk::PipelineStageFlagBits::eColorAttachmentOutput};
+    for (vk::Semaphore semaphore : upload_queue_->submit()) {
+        wait_semaphores.push_back(semaphore);
+        wait_stages.push_back(UploadQueueVK::waitStages());
+    }
     vk::SubmitInfo submit_info;
-    vk::Semaphore wait_semaphores[] = {image_available_semaphores_[current_frame_]};
-    vk::PipelineStageFlags wait_stages[] = {vk::PipelineStageFlagBits::eColorAttachmentOutput};
-    submit_info.waitSemaphoreCount = 1;
-    submit_info.pWaitSemaphores = wait_semaphores;
-    submit_info.pWaitDstStageMask = wait_stages;
+    submit_info.waitSemaphoreCount = static_cast<u32>(wait_semaphores.size());
+    submit_info.pWaitSemaphores = wait_semaphores.data();
+    submit_info.pWaitDstStageMask = wait_stages.data();
     submit_info.commandBufferCount = 1;
     submit_info.pCommandBuffers = &command_buffers_[next_frame_index_];
     vk::Semaphore signal_semaphores[] = {render_finished_semaphores_[current_frame_]};
@@ -1168,21 +1592,830 @@ bool RenderContextVK::frame(const Frame* frame) {
     presentInfo.swapchainCount = 1;
     presentInfo.pSwapchains = &swap_chain_;
     presentInfo.pImageIndices = &next_frame_index_;
-    present_queue_.presentKHR(presentInfo);
+    vk::Result result;
+    {
+        DW_TRACE_SCOPE("RenderContextVK::present");
+        result = present_queue_.presentKHR(&presentInfo);
+    }
+    if (result == vk::Result::eErrorOutOfDateKHR || result == vk::Result::eSuboptimalKHR) {
+        swap_chain_out_of_date_ = true;
+    }
 
-    current_frame_ = (current_frame_ + 1) % kMaxFramesInFlight;
+    current_frame_ = (current_frame_ + 1) % in_flight_fences_.size();
     return true;
 }
 
-void RenderContextVK::operator()(const cmd::CreateVertexBuffer& c) {
-    if (c.usage == BufferUsage::Dynamic) {
-        throw std::invalid_argument(
-            "Dynamic vertex buffers are unimplemented in the Vulkan backend.");
+void RenderContextVK::uploadTransientBuffer(BufferVK& buffer, vk::BufferUsageFlags buffer_type,
+                                            const Frame::TransientBufferStorage& storage) {
+    if (storage.size > buffer.size) {
+        // The previous buffer may still be in use by frames in flight, so it's destroyed once
+        // they've finished. The buffer grows geometrically, so this should only happen a few times.
+        BufferVK grown_buffer{device_.get(),
+                              nullptr,
+                              std::max<vk::DeviceSize>(storage.size, buffer.size * 2),
+                              BufferUsage::Stream,
+                              buffer_type,
+                              per_image_resource_count_};
+        retiredResources().buffers.emplace_back(std::move(buffer));
+        buffer = std::move(grown_buffer);
+    }
+    for (usize i = 0; i <= storage.current_page && i < storage.pages.size(); ++i) {
+        const auto& page = storage.pages[i];
+        if (page.size > 0) {
+            buffer.update(next_frame_index_, page.data.get(), page.size, page.offset);
+        }
     }
+}
 
+void RenderContextVK::createBindlessTextureTable() {
+    if (!bindless_texturing_supported_) {
+        return;
+    }
+    vk::DescriptorSetLayoutBinding binding;
+    binding.binding = 0;
+    binding.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    binding.descriptorCount = DW_MAX_BINDLESS_TEXTURES;
+    binding.stageFlags = vk::ShaderStageFlagBits::eAll;
+    // Only the entries which are accessed need to be valid.
+    vk::DescriptorBindingFlagsEXT binding_flags = vk::DescriptorBindingFlagBitsEXT::ePartiallyBound;
+    vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT binding_flags_info;
+    binding_flags_info.bindingCount = 1;
+    binding_flags_info.pBindingFlags = &binding_flags;
+    vk::DescriptorSetLayoutCreateInfo layout_info;
+    layout_info.pNext = &binding_flags_info;
+    layout_info.bindingCount = 1;
+    layout_info.pBindings = &binding;
+    bindless_descriptor_set_layout_ = vk_device_.createDescriptorSetLayout(layout_info);
+
+    auto set_count = per_image_resource_count_;
+    vk::DescriptorPoolSize pool_size{vk::DescriptorType::eCombinedImageSampler,
+                                     DW_MAX_BINDLESS_TEXTURES * set_count};
+    vk::DescriptorPoolCreateInfo pool_info;
+    pool_info.maxSets = set_count;
+    pool_info.poolSizeCount = 1;
+    pool_info.pPoolSizes = &pool_size;
+    bindless_descriptor_pool_ = vk_device_.createDescriptorPool(pool_info);
+
+    std::vector<vk::DescriptorSetLayout> layouts(set_count, bindless_descriptor_set_layout_);
+    vk::DescriptorSetAllocateInfo alloc_info;
+    alloc_info.descriptorPool = bindless_descriptor_pool_;
+    alloc_info.descriptorSetCount = set_count;
+    alloc_info.pSetLayouts = layouts.data();
+    bindless_descriptor_sets_ = vk_device_.allocateDescriptorSets(alloc_info);
+    bindless_pending_writes_.resize(set_count);
+    bindless_slots_.resize(DW_MAX_BINDLESS_TEXTURES);
+
+    // Create the transparent black texture which replaces deleted textures in the table.
+    auto& fallback = bindless_fallback_texture_;
+    fallback.image_format = vk::Format::eR8G8B8A8Unorm;
+    fallback.aspect_mask = vk::ImageAspectFlagBits::eColor;
+    device_->createImage(1, 1, fallback.image_format, vk::ImageTiling::eOptimal,
+                         vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+                         vk::MemoryPropertyFlagBits::eDeviceLocal, fallback.image,
+                         fallback.image_memory);
+    const byte fallback_texel[4] = {0, 0, 0, 0};
+    upload_queue_->uploadImage(fallback.image,
+                               {UploadQueueVK::ImageLevel{1, 1, fallback_texel, 4}});
+    fallback.image_layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    fallback.image_view = device_->createImageView(fallback.image, fallback.image_format,
+                                                   vk::ImageAspectFlagBits::eColor);
+}
+
+vk::DescriptorSet RenderContextVK::bindlessDescriptorSet() const {
+    return bindless_texturing_supported_ ? bindless_descriptor_sets_[next_frame_index_]
+                                         : vk::DescriptorSet{};
+}
+
+void RenderContextVK::writeBindlessTextures() {
+    if (!bindless_texturing_supported_ || bindless_pending_writes_[next_frame_index_].empty()) {
+        return;
+    }
+    // The frame which last used this descriptor set has finished, so it can be written directly.
+    auto& pending_writes = bindless_pending_writes_[next_frame_index_];
+    std::vector<vk::DescriptorImageInfo> image_infos;
+    std::vector<vk::WriteDescriptorSet> writes;
+    image_infos.reserve(pending_writes.size());
+    writes.reserve(pending_writes.size());
+    vk::Sampler sampler = findOrCreateSampler(RenderItem::SamplerInfo{SamplerFlag::Default, 0.0f});
+    for (u32 index : pending_writes) {
+        auto texture_it = texture_map_.find(bindless_slots_[index]);
+        const TextureVK& texture =
+            texture_it != texture_map_.end() ? texture_it->second : bindless_fallback_texture_;
+        image_infos.emplace_back(sampler, texture.image_view,
+                                 vk::ImageLayout::eShaderReadOnlyOptimal);
+        vk::WriteDescriptorSet write;
+        write.dstSet = bindless_descriptor_sets_[next_frame_index_];
+        write.dstBinding = 0;
+        write.dstArrayElement = index;
+        write.descriptorCount = 1;
+        write.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+        write.pImageInfo = &image_infos.back();
+        writes.emplace_back(write);
+    }
+    vk_device_.updateDescriptorSets(writes, {});
+    pending_writes.clear();
+}
+
+void RenderContextVK::recordTextureUpdates(vk::CommandBuffer command_buffer) {
+    if (pending_texture_updates_.empty()) {
+        return;
+    }
+
+    // Lay out the updates in this frame's staging buffer. Each offset must be a multiple of both 4
+    // and the texel block size of the texture.
+    std::vector<vk::DeviceSize> offsets;
+    offsets.reserve(pending_texture_updates_.size());
+    vk::DeviceSize staging_size = 0;
+    for (const auto& update : pending_texture_updates_) {
+        const auto& texture = texture_map_.at(update.handle);
+        vk::DeviceSize alignment = textureFormatInfo(texture.format).block_size * 4;
+        staging_size = (staging_size + alignment - 1) / alignment * alignment;
+        offsets.emplace_back(staging_size);
+        staging_size += update.data.size();
+    }
+    if (texture_staging_buffers_.size() < per_image_resource_count_) {
+        texture_staging_buffers_.resize(per_image_resource_count_);
+    }
+    auto& staging = texture_staging_buffers_[next_frame_index_];
+    if (staging_size > staging.size) {
+        // The frame which last used this staging buffer has finished, as its swap chain image has
+        // been acquired again.
+        if (staging.buffer) {
+            device_->destroyBuffer(staging.buffer, staging.memory);
+        }
+        staging.size = std::max(staging_size, staging.size * 2);
+        device_->createBuffer(
+            staging.size, vk::BufferUsageFlagBits::eTransferSrc,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+            staging.buffer, staging.memory);
+    }
+
+    // Transition each updated texture once, copy every region, then make the textures readable by
+    // shaders again.
+    std::vector<TextureVK*> textures;
+    std::vector<vk::ImageMemoryBarrier> barriers;
+    for (const auto& update : pending_texture_updates_) {
+        auto* texture = &texture_map_.at(update.handle);
+        if (std::find(textures.begin(), textures.end(), texture) == textures.end()) {
+            textures.emplace_back(texture);
+        }
+    }
+    for (auto* texture : textures) {
+        vk::ImageMemoryBarrier barrier;
+        if (texture->makeImageBarrier(vk::ImageLayout::eTransferDstOptimal, barrier)) {
+            barriers.emplace_back(barrier);
+        }
+    }
+    if (!barriers.empty()) {
+        command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands,
+                                       vk::PipelineStageFlagBits::eTransfer, {}, {}, {}, barriers);
+    }
+    for (usize i = 0; i < pending_texture_updates_.size(); ++i) {
+        const auto& update = pending_texture_updates_[i];
+        memcpy(staging.memory.mapped_data + offsets[i], update.data.data(), update.data.size());
+
+        vk::BufferImageCopy region;
+        region.bufferOffset = offsets[i];
+        region.imageSubresource =
+            vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, update.mip_level, 0, 1};
+        region.imageOffset = vk::Offset3D{update.x, update.y, 0};
+        region.imageExtent = vk::Extent3D{update.width, update.height, 1};
+        command_buffer.copyBufferToImage(staging.buffer, texture_map_.at(update.handle).image,
+                                         vk::ImageLayout::eTransferDstOptimal, region);
+    }
+    barriers.clear();
+    for (auto* texture : textures) {
+        vk::ImageMemoryBarrier barrier;
+        if (texture->makeImageBarrier(vk::ImageLayout::eShaderReadOnlyOptimal, barrier)) {
+            barriers.emplace_back(barrier);
+        }
+    }
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                   vk::PipelineStageFlagBits::eAllCommands, {}, {}, {}, barriers);
+    pending_texture_updates_.clear();
+}
+
+void RenderContextVK::prepareUniforms(const FrameVector<RenderItem>& items) {
+    item_dynamic_offsets_.clear();
+    item_dynamic_offsets_start_.clear();
+    item_push_constants_.clear();
+    item_push_constants_start_.clear();
+    for (const auto& ri : items) {
+        item_dynamic_offsets_start_.emplace_back(item_dynamic_offsets_.size());
+        item_push_constants_start_.emplace_back(item_push_constants_.size());
+        auto program_it = program_map_.find(*ri.program);
+        if (program_it == program_map_.end()) {
+            // Skipped by recordRenderItems, as the program is still being created.
+            continue;
+        }
+        auto& program = program_it->second;
+
+        // Apply uniforms.
+        for (auto& binding : ri.uniforms) {
+            int uniform_index = findUniformIndex(program, binding.handle);
+            if (uniform_index == ProgramVK::kUnknown) {
+                continue;
+            }
+            program.uniforms[uniform_index].data = binding.data;
+        }
+
+        // If there are no vertices to render or work groups to dispatch, we are done.
+        if (!ri.vb && ri.group_count_x == 0) {
+            continue;
+        }
+
+        // Upload uniforms to uniform buffer.
+        // Blocks which are sourced from a uniform buffer use the offset of the bound range instead,
+        // and have no scratch memory to write to.
+        std::map<usize, UniformScratchBuffer::Allocation> ubo_data;
+        for (const auto& ubo : program.uniform_buffers) {
+            if (const auto* buffer_binding = findUniformBufferBinding(ubo, ri)) {
+                ubo_data[ubo.binding] =
+                    UniformScratchBuffer::Allocation{nullptr, buffer_binding->offset};
+                continue;
+            }
+            for (const auto& buffer_binding : ri.uniform_buffers) {
+                if (buffer_binding.binding_location == ubo.binding) {
+                    logger_.error(
+                        "Uniform block at binding {} ({} bytes) doesn't fit in uniform buffer {} "
+                        "at offset {}, using uniforms instead.",
+                        ubo.binding, ubo.size, buffer_binding.handle, buffer_binding.offset);
+                }
+            }
+            const u32 alignment = device_->properties().limits.minUniformBufferOffsetAlignment;
+            const u32 vsize = strideAlign(ubo.size, alignment);
+            ubo_data[ubo.binding] = uniform_scratch_buffers_[next_frame_index_]->alloc(vsize);
+            stats_.uniform_bytes += vsize;
+        }
+        // Push constants are recorded directly into the command buffer.
+        byte* push_constants = nullptr;
+        if (program.push_constant_size > 0) {
+            usize push_constants_offset = item_push_constants_.size();
+            item_push_constants_.resize(push_constants_offset + program.push_constant_size);
+            push_constants = item_push_constants_.data() + push_constants_offset;
+            stats_.uniform_bytes += program.push_constant_size;
+        }
+        for (const auto& uniform : program.uniforms) {
+            // Write to memory.
+            byte* block_ptr = uniform.binding_location.has_value()
+                                  ? ubo_data.at(*uniform.binding_location).ptr
+                                  : push_constants;
+            if (!block_ptr) {
+                continue;
+            }
+            if (uniform.data) {
+                auto variant_bytes = std::visit(VariantToBytesHelper{}, *uniform.data);
+                byte* data_dst = block_ptr + uniform.offset;
+                std::memcpy(data_dst, variant_bytes.data, variant_bytes.size);
+            }
+#ifndef NDEBUG
+            if (!uniform.data) {
+                logger_.warn("Uniform {} is uninitialised.", uniform.name);
+            }
+#endif
+        }
+
+        // Calculate dynamic offsets for the UBOs.
+        for (const auto& ubo_entry : ubo_data) {
+            item_dynamic_offsets_.emplace_back(ubo_entry.second.offset_from_base);
+        }
+    }
+    item_dynamic_offsets_start_.emplace_back(item_dynamic_offsets_.size());
+    item_push_constants_start_.emplace_back(item_push_constants_.size());
+}
+
+const RenderItem::UniformBufferBinding* RenderContextVK::findUniformBufferBinding(
+    const ProgramVK::UniformBuffer& ubo, const RenderItem& item) const {
+    for (const auto& binding : item.uniform_buffers) {
+        if (binding.binding_location == ubo.binding) {
+            const auto& buffer = uniform_buffer_map_.at(binding.handle);
+            return binding.offset + ubo.size <= buffer.size ? &binding : nullptr;
+        }
+    }
+    return nullptr;
+}
+
+std::vector<RenderItem::UniformBufferBinding> RenderContextVK::descriptorUniformBuffers(
+    const ProgramVK& program, const RenderItem& item) const {
+    std::vector<RenderItem::UniformBufferBinding> uniform_buffers;
+    if (item.uniform_buffers.empty()) {
+        return uniform_buffers;
+    }
+    for (const auto& ubo : program.uniform_buffers) {
+        if (const auto* binding = findUniformBufferBinding(ubo, item)) {
+            uniform_buffers.emplace_back(
+                RenderItem::UniformBufferBinding{binding->binding_location, binding->handle, 0});
+        }
+    }
+    return uniform_buffers;
+}
+
+void RenderContextVK::recordRenderItems(vk::CommandBuffer command_buffer, const RenderQueue& queue,
+                                        usize begin, usize end, const FramebufferVK* framebuffer,
+                                        const GpuTimestampLayout::QueueTimestamps& timestamps,
+                                        FrameStats& stats) {
+    auto next_timestamp = std::lower_bound(
+        timestamps.begin(), timestamps.end(), begin,
+        [](const std::pair<uint, u32>& entry, usize position) { return entry.first < position; });
+    auto write_timestamps_until = [&](usize position) {
+        for (; next_timestamp != timestamps.end() && next_timestamp->first <= position;
+             ++next_timestamp) {
+            command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe,
+                                          timestamp_query_pool_,
+                                          timestampQuery(next_timestamp->second));
+        }
+    };
+
+    // Secondary command buffers don't inherit dynamic state, so the viewport is set by each one.
+    vk::Extent2D target_extent = framebuffer ? framebuffer->extent : swap_chain_extent_;
+    command_buffer.setViewport(0, targetViewport(target_extent));
+
+    for (usize i = begin; i < end; ++i) {
+        write_timestamps_until(i);
+        const auto& ri = queue.render_items[i];
+        if (!isRenderItemDrawn(ri)) {
+            continue;
+        }
+        const auto& program = program_map_.at(*ri.program);
+        const auto& vb = vertex_buffer_map_.at(*ri.vb);
+        const VertexBufferVK* instance_vb = nullptr;
+        if (ri.instance_vb) {
+            instance_vb = &vertex_buffer_map_.at(*ri.instance_vb);
+        }
+
+        // Get (or create) vertex decl.
+        VertexDeclVK::Info decl_info;
+        decl_info.decl = ri.vertex_decl_override.empty() ? vb.decl : ri.vertex_decl_override;
+        if (instance_vb) {
+            decl_info.instance_decl = ri.instance_decl_override.empty()
+                                          ? instance_vb->decl
+                                          : ri.instance_decl_override;
+        }
+        const VertexDeclVK* decl = findOrCreateVertexDecl(decl_info);
+        if (decl->unsupported_format != vk::Format::eUndefined) {
+            continue;
+        }
+
+        // Bind (and create) graphics pipeline.
+        auto graphics_pipeline =
+            findOrCreateGraphicsPipeline(PipelineVK::Info{ri, decl, &program, framebuffer});
+        command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, graphics_pipeline.pipeline);
+        stats.pipeline_binds++;
+        if (ri.scissor_enabled) {
+            command_buffer.setScissor(
+                0, vk::Rect2D{vk::Offset2D{ri.scissor_x, ri.scissor_y},
+                              vk::Extent2D{ri.scissor_width, ri.scissor_height}});
+        } else {
+            command_buffer.setScissor(0, vk::Rect2D{vk::Offset2D{0, 0}, target_extent});
+        }
+
+        // Bind descriptor set.
+        auto descriptor_set = findOrCreateDescriptorSet(
+            DescriptorSetVK::Info{program.descriptor_set_shape,
+                                  &program,
+                                  {ri.textures.begin(), ri.textures.end()},
+                                  {ri.storage_buffers.begin(), ri.storage_buffers.end()},
+                                  {},
+                                  descriptorUniformBuffers(program, ri)});
+        usize dynamic_offsets_start = item_dynamic_offsets_start_[i];
+        usize dynamic_offsets_count = item_dynamic_offsets_start_[i + 1] - dynamic_offsets_start;
+        std::array<vk::DescriptorSet, 2> descriptor_sets = {
+            descriptor_set.descriptor_sets[next_frame_index_], bindlessDescriptorSet()};
+        command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
+                                          graphics_pipeline.layout, 0,
+                                          program.uses_bindless_textures ? 2 : 1,
+                                          descriptor_sets.data(),
+                                          static_cast<u32>(dynamic_offsets_count),
+                                          item_dynamic_offsets_.data() + dynamic_offsets_start);
+        stats.descriptor_set_binds++;
+        usize push_constants_start = item_push_constants_start_[i];
+        usize push_constants_size = item_push_constants_start_[i + 1] - push_constants_start;
+        if (push_constants_size > 0) {
+            command_buffer.pushConstants(graphics_pipeline.layout, program.push_constant_stages, 0,
+                                         static_cast<u32>(push_constants_size),
+                                         item_push_constants_.data() + push_constants_start);
+        }
+
+        // Begin the draw condition and occlusion query.
+        const auto* condition =
+            conditional_rendering_supported_ ? findOcclusionQuery(ri.draw_condition) : nullptr;
+        if (condition) {
+            vk::ConditionalRenderingBeginInfoEXT condition_info;
+            condition_info.buffer = occlusion_query_frames_[next_frame_index_].predicate_buffer;
+            condition_info.offset = condition->slot * sizeof(u32);
+            command_buffer.beginConditionalRenderingEXT(condition_info);
+        }
+        const auto* occlusion_query = findOcclusionQuery(ri.occlusion_query);
+        if (occlusion_query) {
+            command_buffer.beginQuery(occlusion_query_pool_, occlusionQuery(occlusion_query->slot),
+                                      occlusion_query_precise_ ? vk::QueryControlFlagBits::ePrecise
+                                                               : vk::QueryControlFlags{});
+        }
+
+        // Bind vertex/index buffers and draw.
+        command_buffer.bindVertexBuffers(
+            0, vb.buffer.get(), vb.buffer.getOffset(next_frame_index_) + ri.vb_offset);
+        if (instance_vb) {
+            command_buffer.bindVertexBuffers(
+                1, instance_vb->buffer.get(),
+                instance_vb->buffer.getOffset(next_frame_index_) + ri.instance_vb_offset);
+        }
+        if (ri.ib) {
+            const auto& ib = index_buffer_map_.at(*ri.ib);
+            command_buffer.bindIndexBuffer(
+                ib.buffer.get(), ib.buffer.getOffset(next_frame_index_) + ri.ib_offset, ib.type);
+            if (ri.indirect_buffer) {
+                const auto& indirect_buffer = indirect_buffer_map_.at(*ri.indirect_buffer);
+                vk::DeviceSize offset =
+                    indirect_buffer.getOffset(next_frame_index_) + ri.indirect_offset;
+                constexpr u32 stride = sizeof(DrawIndexedIndirectCommand);
+                if (multi_draw_indirect_supported_) {
+                    command_buffer.drawIndexedIndirect(indirect_buffer.get(), offset,
+                                                       ri.draw_count, stride);
+                    stats.draw_calls++;
+                } else {
+                    for (u32 draw = 0; draw < ri.draw_count; ++draw) {
+                        command_buffer.drawIndexedIndirect(indirect_buffer.get(),
+                                                           offset + draw * stride, 1, stride);
+                    }
+                    stats.draw_calls += ri.draw_count;
+                }
+            } else {
+                command_buffer.drawIndexed(ri.primitive_count * 3, ri.instance_count, 0,
+                                           ri.base_vertex, 0);
+                stats.draw_calls++;
+                stats.primitives += u64(ri.primitive_count) * ri.instance_count;
+            }
+        } else {
+            command_buffer.draw(ri.primitive_count * 3, ri.instance_count, 0, 0);
+            stats.draw_calls++;
+            stats.primitives += u64(ri.primitive_count) * ri.instance_count;
+        }
+        if (occlusion_query) {
+            command_buffer.endQuery(occlusion_query_pool_, occlusionQuery(occlusion_query->slot));
+        }
+        if (condition) {
+            command_buffer.endConditionalRenderingEXT();
+        }
+    }
+
+    // The last chunk of a queue also writes the timestamps which come after its last item.
+    if (end == queue.render_items.size()) {
+        write_timestamps_until(end);
+    }
+}
+
+void RenderContextVK::beginGpuTiming(vk::CommandBuffer command_buffer, const Frame* frame) {
+    if (!gpu_timing_supported_) {
+        return;
+    }
+    auto& timing_frame = gpu_timing_frames_[next_frame_index_];
+
+    // The fence of the last frame which used this swap chain image was waited on in
+    // prepareFrame(), so its timestamps have normally been written. If they aren't available, drop
+    // them rather than waiting.
+    if (timing_frame.pending) {
+        std::vector<u64> timestamps(timing_frame.layout.queryCount());
+        vk::Result result = vk_device_.getQueryPoolResults(
+            timestamp_query_pool_, timestampQuery(0), static_cast<u32>(timestamps.size()),
+            timestamps.size() * sizeof(u64), timestamps.data(), sizeof(u64),
+            vk::QueryResultFlagBits::e64);
+        if (result == vk::Result::eSuccess) {
+            setGpuTimings(timing_frame.layout.resolve(timestamps.data(), timestamp_period_));
+        }
+        timing_frame.pending = false;
+    }
+
+    timing_frame.layout.build(frame, kMaxGpuTimestampQueries);
+    command_buffer.resetQueryPool(timestamp_query_pool_, timestampQuery(0),
+                                  timing_frame.layout.queryCount());
+    command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, timestamp_query_pool_,
+                                  timestampQuery(GpuTimestampLayout::kFrameBeginQuery));
+}
+
+void RenderContextVK::endGpuTiming(vk::CommandBuffer command_buffer) {
+    if (!gpu_timing_supported_) {
+        return;
+    }
+    command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, timestamp_query_pool_,
+                                  timestampQuery(GpuTimestampLayout::kFrameEndQuery));
+    gpu_timing_frames_[next_frame_index_].pending = true;
+}
+
+u32 RenderContextVK::timestampQuery(u32 query) const {
+    return next_frame_index_ * kMaxGpuTimestampQueries + query;
+}
+
+void RenderContextVK::beginOcclusionQueries(vk::CommandBuffer command_buffer, const Frame* frame) {
+    if (!occlusion_query_pool_) {
+        return;
+    }
+    auto& query_frame = occlusion_query_frames_[next_frame_index_];
+
+    // The fence of the last frame which used this swap chain image was waited on in
+    // prepareFrame(), so its results are normally available. Results which aren't are dropped
+    // rather than waited for.
+    if (!query_frame.written.empty()) {
+        std::vector<u64> results(query_frame.reset_count * 2);
+        (void)vk_device_.getQueryPoolResults(
+            occlusion_query_pool_, occlusionQuery(0), query_frame.reset_count,
+            results.size() * sizeof(u64), results.data(), 2 * sizeof(u64),
+            vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWithAvailability);
+        for (const auto& written : query_frame.written) {
+            auto query_it = occlusion_query_map_.find(written.first);
+            if (query_it == occlusion_query_map_.end() || query_it->second.slot != written.second ||
+                results[written.second * 2 + 1] == 0) {
+                continue;
+            }
+            query_it->second.last_result = results[written.second * 2];
+            setOcclusionQueryResult(written.first, query_it->second.last_result);
+        }
+    }
+
+    // Reset this frame's queries, and find the queries which it writes. Only items which are
+    // drawn write their query, so every query in the list will have a result.
+    query_frame.written.clear();
+    query_frame.reset_count = occlusion_query_slot_count_;
+    if (query_frame.reset_count > 0) {
+        command_buffer.resetQueryPool(occlusion_query_pool_, occlusionQuery(0),
+                                      query_frame.reset_count);
+    }
+    auto* predicates = reinterpret_cast<u32*>(query_frame.predicate_memory.mapped_data);
+    for (const auto& queue : frame->render_queues) {
+        for (const auto& item : queue.render_items) {
+            if (const auto* query = findOcclusionQuery(item.occlusion_query)) {
+                if (isRenderItemDrawn(item)) {
+                    query_frame.written.emplace_back(*item.occlusion_query, query->slot);
+                }
+            }
+            // Draw conditions are visible unless the previous frame's result is copied over them
+            // below. The frame which last read this predicate buffer has finished.
+            if (const auto* condition = findOcclusionQuery(item.draw_condition)) {
+                if (predicates) {
+                    predicates[condition->slot] = 1;
+                }
+            }
+        }
+    }
+    std::sort(query_frame.written.begin(), query_frame.written.end(),
+              [](const std::pair<OcclusionQueryHandle, u32>& a,
+                 const std::pair<OcclusionQueryHandle, u32>& b) { return a.second < b.second; });
+
+    // Copy the results of the previous frame into the predicate buffer, merging consecutive
+    // slots into a single copy. Those queries were submitted earlier on the same queue, so waiting
+    // for them doesn't stall on anything later than the previous frame. Slots of deleted queries
+    // are skipped, as they may have been reused by a new query.
+    if (conditional_rendering_supported_ && previous_occlusion_query_frame_ &&
+        *previous_occlusion_query_frame_ != next_frame_index_) {
+        const auto& previous = occlusion_query_frames_[*previous_occlusion_query_frame_];
+        u32 previous_base = *previous_occlusion_query_frame_ * kMaxOcclusionQueries;
+        std::vector<u32> slots;
+        slots.reserve(previous.written.size());
+        for (const auto& written : previous.written) {
+            const auto* query = findOcclusionQuery(written.first);
+            if (query && query->slot == written.second) {
+                slots.emplace_back(written.second);
+            }
+        }
+        for (usize begin = 0; begin < slots.size();) {
+            usize end = begin + 1;
+            while (end < slots.size() && slots[end] == slots[end - 1] + 1) {
+                ++end;
+            }
+            command_buffer.copyQueryPoolResults(
+                occlusion_query_pool_, previous_base + slots[begin], static_cast<u32>(end - begin),
+                query_frame.predicate_buffer, slots[begin] * sizeof(u32), sizeof(u32),
+                vk::QueryResultFlagBits::eWait);
+            begin = end;
+        }
+        if (!slots.empty()) {
+            vk::MemoryBarrier barrier{vk::AccessFlagBits::eTransferWrite,
+                                      vk::AccessFlagBits::eConditionalRenderingReadEXT};
+            command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                           vk::PipelineStageFlagBits::eConditionalRenderingEXT, {},
+                                           barrier, {}, {});
+        }
+    }
+    previous_occlusion_query_frame_ = next_frame_index_;
+}
+
+u32 RenderContextVK::occlusionQuery(u32 slot) const {
+    return next_frame_index_ * kMaxOcclusionQueries + slot;
+}
+
+const RenderContextVK::OcclusionQueryVK* RenderContextVK::findOcclusionQuery(
+    std::optional<OcclusionQueryHandle> query) const {
+    if (!query) {
+        return nullptr;
+    }
+    auto query_it = occlusion_query_map_.find(*query);
+    return query_it != occlusion_query_map_.end() ? &query_it->second : nullptr;
+}
+
+bool RenderContextVK::isRenderItemDrawn(const RenderItem& item) const {
+    if (!item.vb || program_map_.find(*item.program) == program_map_.end()) {
+        return false;
+    }
+    // Without conditional rendering, items are skipped if their draw condition's last result found
+    // no samples.
+    if (!conditional_rendering_supported_) {
+        const auto* condition = findOcclusionQuery(item.draw_condition);
+        if (condition && condition->last_result && *condition->last_result == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void RenderContextVK::recordComputeItems(vk::CommandBuffer command_buffer,
+                                         const std::vector<RenderQueue>& queues, usize begin,
+                                         usize end) {
+    bool has_compute_items = false;
+    for (usize i = begin; i < end; ++i) {
+        has_compute_items |= !queues[i].compute_items.empty();
+    }
+    if (!has_compute_items) {
+        return;
+    }
+    if (!compute_supported_) {
+        logger_.error("[Dispatch] Compute is not supported by the graphics queue.");
+        return;
+    }
+
+    // Make previous writes visible to the dispatches, and move storage images into the general
+    // layout.
+    vk::MemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite |
+                            vk::AccessFlagBits::eColorAttachmentWrite |
+                            vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands,
+                                   vk::PipelineStageFlagBits::eComputeShader, {}, barrier, {}, {});
+    std::vector<TextureVK*> storage_images;
+    for (usize i = begin; i < end; ++i) {
+        for (const auto& item : queues[i].compute_items) {
+            for (const auto& binding : item.storage_images) {
+                auto texture_it = texture_map_.find(binding.handle);
+                if (texture_it != texture_map_.end() &&
+                    texture_it->second.image_layout != vk::ImageLayout::eGeneral) {
+                    texture_it->second.setImageBarrier(command_buffer, vk::ImageLayout::eGeneral);
+                    storage_images.emplace_back(&texture_it->second);
+                }
+            }
+        }
+    }
+
+    for (usize i = begin; i < end; ++i) {
+        const auto& items = queues[i].compute_items;
+        prepareUniforms(items);
+        for (usize j = 0; j < items.size(); ++j) {
+            const auto& item = items[j];
+            auto program_it = program_map_.find(*item.program);
+            if (program_it == program_map_.end()) {
+                continue;
+            }
+            const auto& program = program_it->second;
+            if (program.stages.count(vk::ShaderStageFlagBits::eCompute) == 0) {
+                logger_.error("[Dispatch] Program {} has no compute stage.", *item.program);
+                continue;
+            }
+
+            auto compute_pipeline = findOrCreateComputePipeline(&program);
+            command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                        compute_pipeline.pipeline);
+            stats_.pipeline_binds++;
+            auto descriptor_set = findOrCreateDescriptorSet(
+                DescriptorSetVK::Info{program.descriptor_set_shape,
+                                      &program,
+                                      {item.textures.begin(), item.textures.end()},
+                                      {item.storage_buffers.begin(), item.storage_buffers.end()},
+                                      {item.storage_images.begin(), item.storage_images.end()},
+                                      descriptorUniformBuffers(program, item)});
+            usize dynamic_offsets_start = item_dynamic_offsets_start_[j];
+            usize dynamic_offsets_count =
+                item_dynamic_offsets_start_[j + 1] - dynamic_offsets_start;
+            std::array<vk::DescriptorSet, 2> descriptor_sets = {
+                descriptor_set.descriptor_sets[next_frame_index_], bindlessDescriptorSet()};
+            command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                                              compute_pipeline.layout, 0,
+                                              program.uses_bindless_textures ? 2 : 1,
+                                              descriptor_sets.data(),
+                                              static_cast<u32>(dynamic_offsets_count),
+                                              item_dynamic_offsets_.data() + dynamic_offsets_start);
+            stats_.descriptor_set_binds++;
+            usize push_constants_start = item_push_constants_start_[j];
+            usize push_constants_size = item_push_constants_start_[j + 1] - push_constants_start;
+            if (push_constants_size > 0) {
+                command_buffer.pushConstants(
+                    compute_pipeline.layout, program.push_constant_stages, 0,
+                    static_cast<u32>(push_constants_size),
+                    item_push_constants_.data() + push_constants_start);
+            }
+            command_buffer.dispatch(item.group_count_x, item.group_count_y, item.group_count_z);
+            stats_.dispatches++;
+        }
+    }
+
+    // Make the results of the dispatches visible to the draws (and dispatches) which follow.
+    barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    barrier.dstAccessMask =
+        vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eVertexAttributeRead |
+        vk::AccessFlagBits::eIndexRead | vk::AccessFlagBits::eUniformRead |
+        vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+    command_buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexInput |
+            vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader |
+            vk::PipelineStageFlagBits::eComputeShader,
+        {}, barrier, {}, {});
+    for (TextureVK* image : storage_images) {
+        image->setImageBarrier(command_buffer, vk::ImageLayout::eShaderReadOnlyOptimal);
+    }
+}
+
+void RenderContextVK::transitionQueueImages(vk::CommandBuffer command_buffer,
+                                            const std::vector<RenderQueue>& queues, usize begin,
+                                            usize end, const FramebufferVK* frame_buffer) {
+    std::vector<vk::ImageMemoryBarrier> barriers;
+    auto is_attachment = [frame_buffer](const TextureVK* texture) {
+        return frame_buffer && std::find(frame_buffer->images.begin(), frame_buffer->images.end(),
+                                         texture) != frame_buffer->images.end();
+    };
+    auto transition_sampled = [&](const FrameVector<RenderItem>& items) {
+        for (const auto& item : items) {
+            for (const auto& binding : item.textures) {
+                auto texture_it = texture_map_.find(binding.handle);
+                if (texture_it == texture_map_.end() || is_attachment(&texture_it->second)) {
+                    continue;
+                }
+                vk::ImageMemoryBarrier barrier;
+                if (texture_it->second.makeImageBarrier(vk::ImageLayout::eShaderReadOnlyOptimal,
+                                                        barrier)) {
+                    barriers.emplace_back(barrier);
+                }
+            }
+        }
+    };
+    for (usize i = begin; i < end; ++i) {
+        transition_sampled(queues[i].compute_items);
+        transition_sampled(queues[i].render_items);
+    }
+    if (frame_buffer) {
+        for (TextureVK* image : frame_buffer->images) {
+            vk::ImageMemoryBarrier barrier;
+            if (image->makeImageBarrier(vk::ImageLayout::eColorAttachmentOptimal, barrier)) {
+                barriers.emplace_back(barrier);
+            }
+        }
+    }
+    if (barriers.empty()) {
+        return;
+    }
+
+    // Wait for earlier passes to finish writing (or reading) the images before they're sampled
+    // (or rendered to).
+    command_buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eColorAttachmentOutput |
+            vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader |
+            vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader |
+            vk::PipelineStageFlagBits::eComputeShader |
+            vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        {}, {}, {}, barriers);
+}
+
+vk::CommandBuffer RenderContextVK::beginSecondaryCommandBuffer(usize thread_index,
+                                                               vk::RenderPass render_pass,
+                                                               vk::Framebuffer framebuffer) {
+    // Command pools are externally synchronised, so each recording thread has its own.
+    auto& pool = secondary_command_pools_[next_frame_index_][thread_index];
+    if (pool.used == pool.command_buffers.size()) {
+        vk::CommandBufferAllocateInfo allocate_info;
+        allocate_info.commandPool = pool.pool;
+        allocate_info.level = vk::CommandBufferLevel::eSecondary;
+        allocate_info.commandBufferCount = 1;
+        pool.command_buffers.emplace_back(vk_device_.allocateCommandBuffers(allocate_info)[0]);
+    }
+    vk::CommandBuffer command_buffer = pool.command_buffers[pool.used++];
+
+    vk::CommandBufferInheritanceInfo inheritance_info;
+    inheritance_info.renderPass = render_pass;
+    inheritance_info.subpass = 0;
+    inheritance_info.framebuffer = framebuffer;
+
+    vk::CommandBufferBeginInfo begin_info;
+    begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit |
+                       vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+    begin_info.pInheritanceInfo = &inheritance_info;
+    command_buffer.begin(begin_info);
+    return command_buffer;
+}
+
+void RenderContextVK::operator()(const cmd::CreateVertexBuffer& c) {
     VertexBufferVK vb{c.decl,
                       BufferVK{device_.get(), c.data.data(), c.data.size(), c.usage,
-                               vk::BufferUsageFlagBits::eVertexBuffer, swap_chain_images_.size()}};
+                               vk::BufferUsageFlagBits::eVertexBuffer, per_image_resource_count_}};
+    setResourceMemory(MemoryCategory::VertexBuffers, c.handle, vb.buffer.allocatedSize());
     vertex_buffer_map_.emplace(c.handle, std::move(vb));
 }
 
@@ -1191,12 +2424,17 @@ void RenderContextVK::operator()(const cmd::UpdateVertexBuffer& c) {
     auto& vb = vertex_buffer_map_.at(c.handle);
     if (!vb.buffer.update(next_frame_index_, c.data.data(), c.data.size(), c.offset)) {
         logger_.warn("Unable to update vertex buffer {}", c.handle);
+    } else if (vb.buffer.usage == BufferUsage::Dynamic) {
+        pending_dynamic_buffers_.insert(&vb.buffer);
     }
 }
 
 void RenderContextVK::operator()(const cmd::DeleteVertexBuffer& c) {
     assert(vertex_buffer_map_.count(c.handle) > 0);
-    vertex_buffer_map_.erase(vertex_buffer_map_.find(c.handle));
+    auto it = vertex_buffer_map_.find(c.handle);
+    pending_dynamic_buffers_.erase(&it->second.buffer);
+    vertex_buffer_map_.erase(it);
+    setResourceMemory(MemoryCategory::VertexBuffers, c.handle, 0);
 }
 
 void RenderContextVK::operator()(const cmd::CreateIndexBuffer& c) {
@@ -1204,7 +2442,8 @@ void RenderContextVK::operator()(const cmd::CreateIndexBuffer& c) {
         c.type == IndexBufferType::U16 ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
     IndexBufferVK ib{type,
                      BufferVK{device_.get(), c.data.data(), c.data.size(), c.usage,
-                              vk::BufferUsageFlagBits::eIndexBuffer, swap_chain_images_.size()}};
+                              vk::BufferUsageFlagBits::eIndexBuffer, per_image_resource_count_}};
+    setResourceMemory(MemoryCategory::IndexBuffers, c.handle, ib.buffer.allocatedSize());
     index_buffer_map_.emplace(c.handle, std::move(ib));
 }
 
@@ -1213,18 +2452,136 @@ void RenderContextVK::operator()(const cmd::UpdateIndexBuffer& c) {
     auto& ib = index_buffer_map_.at(c.handle);
     if (!ib.buffer.update(next_frame_index_, c.data.data(), c.data.size(), c.offset)) {
         logger_.warn("Unable to update index buffer {}", c.handle);
+    } else if (ib.buffer.usage == BufferUsage::Dynamic) {
+        pending_dynamic_buffers_.insert(&ib.buffer);
     }
 }
 
 void RenderContextVK::operator()(const cmd::DeleteIndexBuffer& c) {
     assert(index_buffer_map_.count(c.handle) > 0);
-    index_buffer_map_.erase(index_buffer_map_.find(c.handle));
+    auto it = index_buffer_map_.find(c.handle);
+    pending_dynamic_buffers_.erase(&it->second.buffer);
+    index_buffer_map_.erase(it);
+    setResourceMemory(MemoryCategory::IndexBuffers, c.handle, 0);
+}
+
+void RenderContextVK::operator()(const cmd::CreateIndirectBuffer& c) {
+    BufferVK buffer{device_.get(), c.data.data(), c.size, c.usage,
+                    vk::BufferUsageFlagBits::eIndirectBuffer |
+                        vk::BufferUsageFlagBits::eStorageBuffer,
+                    per_image_resource_count_};
+    setResourceMemory(MemoryCategory::StorageBuffers, c.handle, buffer.allocatedSize());
+    indirect_buffer_map_.emplace(c.handle, std::move(buffer));
+}
+
+void RenderContextVK::operator()(const cmd::UpdateIndirectBuffer& c) {
+    assert(indirect_buffer_map_.count(c.handle) > 0);
+    auto& buffer = indirect_buffer_map_.at(c.handle);
+    if (!buffer.update(next_frame_index_, c.data.data(), c.data.size(), c.offset)) {
+        logger_.warn("Unable to update indirect buffer {}", c.handle);
+    } else if (buffer.usage == BufferUsage::Dynamic) {
+        pending_dynamic_buffers_.insert(&buffer);
+    }
+}
+
+void RenderContextVK::operator()(const cmd::DeleteIndirectBuffer& c) {
+    assert(indirect_buffer_map_.count(c.handle) > 0);
+    auto it = indirect_buffer_map_.find(c.handle);
+    pending_dynamic_buffers_.erase(&it->second);
+    indirect_buffer_map_.erase(it);
+    setResourceMemory(MemoryCategory::StorageBuffers, c.handle, 0);
+}
+
+void RenderContextVK::operator()(const cmd::CreateStorageBuffer& c) {
+    BufferVK buffer{device_.get(), c.data.data(), c.size, c.usage,
+                    vk::BufferUsageFlagBits::eStorageBuffer, per_image_resource_count_};
+    setResourceMemory(MemoryCategory::StorageBuffers, c.handle, buffer.allocatedSize());
+    storage_buffer_map_.emplace(c.handle, std::move(buffer));
+}
+
+void RenderContextVK::operator()(const cmd::UpdateStorageBuffer& c) {
+    assert(storage_buffer_map_.count(c.handle) > 0);
+    auto& buffer = storage_buffer_map_.at(c.handle);
+    if (!buffer.update(next_frame_index_, c.data.data(), c.data.size(), c.offset)) {
+        logger_.warn("Unable to update storage buffer {}", c.handle);
+    } else if (buffer.usage == BufferUsage::Dynamic) {
+        pending_dynamic_buffers_.insert(&buffer);
+    }
+}
+
+void RenderContextVK::operator()(const cmd::DeleteStorageBuffer& c) {
+    assert(storage_buffer_map_.count(c.handle) > 0);
+    auto it = storage_buffer_map_.find(c.handle);
+    pending_dynamic_buffers_.erase(&it->second);
+    storage_buffer_map_.erase(it);
+    setResourceMemory(MemoryCategory::StorageBuffers, c.handle, 0);
+}
+
+void RenderContextVK::operator()(const cmd::CreateUniformBuffer& c) {
+    BufferVK buffer{device_.get(), c.data.data(), c.size, c.usage,
+                    vk::BufferUsageFlagBits::eUniformBuffer, per_image_resource_count_};
+    setResourceMemory(MemoryCategory::UniformBuffers, c.handle, buffer.allocatedSize());
+    uniform_buffer_map_.emplace(c.handle, std::move(buffer));
+}
+
+void RenderContextVK::operator()(const cmd::UpdateUniformBuffer& c) {
+    assert(uniform_buffer_map_.count(c.handle) > 0);
+    auto& buffer = uniform_buffer_map_.at(c.handle);
+    if (!buffer.update(next_frame_index_, c.data.data(), c.data.size(), c.offset)) {
+        logger_.warn("Unable to update uniform buffer {}", c.handle);
+    } else if (buffer.usage == BufferUsage::Dynamic) {
+        pending_dynamic_buffers_.insert(&buffer);
+    }
+}
+
+void RenderContextVK::operator()(const cmd::DeleteUniformBuffer& c) {
+    assert(uniform_buffer_map_.count(c.handle) > 0);
+    auto it = uniform_buffer_map_.find(c.handle);
+    pending_dynamic_buffers_.erase(&it->second);
+    uniform_buffer_map_.erase(it);
+    setResourceMemory(MemoryCategory::UniformBuffers, c.handle, 0);
 }
 
 void RenderContextVK::operator()(const cmd::CreateProgram& c) {
+    // Async programs are created on the worker pool, and added to the program map by
+    // finishAsyncPrograms() once they're done.
+    if (c.async && program_worker_pool_) {
+        pending_programs_.insert(c.handle);
+        program_worker_pool_->submit([this, handle = c.handle, stages = c.stages](usize) {
+            try {
+                auto program = createProgram(stages);
+                std::lock_guard<std::mutex> lock{created_programs_mutex_};
+                created_programs_.emplace_back(handle, std::move(program));
+            } catch (const std::exception& e) {
+                logger_.error("[CreateProgram] Failed to create program {}: {}",
+                              static_cast<u32>(handle), e.what());
+            }
+        });
+        return;
+    }
+
+    program_map_.emplace(c.handle, createProgram(c.stages));
+    setProgramReady(c.handle, true);
+}
+
+void RenderContextVK::operator()(const cmd::DeleteProgram& c) {
+    setProgramReady(c.handle, false);
+    auto it = program_map_.find(c.handle);
+    if (it != program_map_.end()) {
+        retirePipelines(&it->second, nullptr);
+        destroyProgram(it->second);
+        program_map_.erase(it);
+    } else {
+        // The program may still be in flight, in which case it's destroyed once it's done.
+        pending_programs_.erase(c.handle);
+    }
+}
+
+ProgramVK RenderContextVK::createProgram(const std::vector<ShaderStageInfo>& stages) {
+    DW_TRACE_SCOPE("RenderContextVK::createProgram");
     ProgramVK program;
 
-    for (const auto& stage : c.stages) {
+    for (const auto& stage : stages) {
         ShaderVK shader;
         shader.stage = stage.stage;
         shader.entry_point = std::make_unique<char[]>(stage.entry_point.size() + 1);
@@ -1241,7 +2598,7 @@ void RenderContextVK::operator()(const cmd::CreateProgram& c) {
         spirv_cross::Compiler comp(reinterpret_cast<const u32*>(stage.spirv.data()),
                                    stage.spirv.size() / sizeof(u32));
         spirv_cross::ShaderResources res = comp.get_shader_resources();
-        for (const auto& resource : res.uniform_buffers) {
+        auto reflect_struct_layout = [&comp](const spirv_cross::Resource& resource) {
             const spirv_cross::SPIRType& type = comp.get_type(resource.base_type_id);
 
             ShaderVK::StructLayout struct_layout;
@@ -1255,9 +2612,16 @@ void RenderContextVK::operator()(const cmd::CreateProgram& c) {
                     comp.get_member_name(type.self, i), comp.type_struct_member_offset(type, i),
                     comp.get_declared_struct_member_size(type, i)});
             }
+            return struct_layout;
+        };
+        for (const auto& resource : res.uniform_buffers) {
             shader.uniform_buffer_bindings.emplace(
                 comp.get_decoration(resource.id, spv::Decoration::DecorationBinding),
-                std::move(struct_layout));
+                reflect_struct_layout(resource));
+        }
+        // A stage has at most one push constant block.
+        if (!res.push_constant_buffers.empty()) {
+            shader.push_constants = reflect_struct_layout(res.push_constant_buffers.front());
         }
 
         // Find bindings.
@@ -1267,6 +2631,15 @@ void RenderContextVK::operator()(const cmd::CreateProgram& c) {
                 vk::DescriptorType::eUniformBufferDynamic);
         }
         for (const auto& resource : res.sampled_images) {
+            // Set 1 is the bindless texture table, which is shared by every program.
+            if (comp.get_decoration(resource.id, spv::Decoration::DecorationDescriptorSet) == 1) {
+                if (!bindless_texturing_supported_) {
+                    logger_.error(
+                        "[CreateProgram] Bindless textures are not supported by this device.");
+                }
+                program.uses_bindless_textures = true;
+                continue;
+            }
             shader.descriptor_type_bindings.emplace(
                 comp.get_decoration(resource.id, spv::Decoration::DecorationBinding),
                 vk::DescriptorType::eCombinedImageSampler);
@@ -1281,6 +2654,16 @@ void RenderContextVK::operator()(const cmd::CreateProgram& c) {
                 comp.get_decoration(resource.id, spv::Decoration::DecorationBinding),
                 vk::DescriptorType::eSampler);
         }
+        for (const auto& resource : res.storage_buffers) {
+            shader.descriptor_type_bindings.emplace(
+                comp.get_decoration(resource.id, spv::Decoration::DecorationBinding),
+                vk::DescriptorType::eStorageBuffer);
+        }
+        for (const auto& resource : res.storage_images) {
+            shader.descriptor_type_bindings.emplace(
+                comp.get_decoration(resource.id, spv::Decoration::DecorationBinding),
+                vk::DescriptorType::eStorageImage);
+        }
 
         vk::PipelineShaderStageCreateInfo stage_info;
         stage_info.stage = convertShaderStage(shader.stage);
@@ -1352,83 +2735,250 @@ void RenderContextVK::operator()(const cmd::CreateProgram& c) {
             // field.size, field.offset);
             std::string qualified_name =
                 (binding.second.name.empty() ? "" : binding.second.name + ".") + field.name;
-            program.uniform_locations.emplace(
-                std::move(qualified_name),
-                ProgramVK::Uniform{binding.first, field.offset, field.size, {}});
+            program.uniform_indices.emplace(qualified_name, program.uniforms.size());
+            program.uniforms.emplace_back(ProgramVK::Uniform{
+                std::move(qualified_name), binding.first, field.offset, field.size, {}});
         }
     }
 
-    program_map_.emplace(c.handle, std::move(program));
+    // Intern the shape of the descriptor set, made up of the layout bindings and the size of each
+    // uniform buffer (which is the range of its descriptor).
+    std::vector<u32> shape;
+    shape.reserve(program.layout_bindings.size() * 4);
+    for (const auto& binding : program.layout_bindings) {
+        auto uniform_buffer_it =
+            std::find_if(program.uniform_buffers.begin(), program.uniform_buffers.end(),
+                         [&binding](const ProgramVK::UniformBuffer& ubo) {
+                             return ubo.binding == binding.binding;
+                         });
+        shape.insert(shape.end(),
+                     {binding.binding, static_cast<u32>(binding.descriptorType),
+                      static_cast<u32>(binding.stageFlags),
+                      uniform_buffer_it != program.uniform_buffers.end()
+                          ? static_cast<u32>(uniform_buffer_it->size)
+                          : 0u});
+    }
+    {
+        std::lock_guard<std::mutex> lock{descriptor_set_shapes_mutex_};
+        program.descriptor_set_shape =
+            descriptor_set_shapes_
+                .emplace(std::move(shape), static_cast<u32>(descriptor_set_shapes_.size()))
+                .first->second;
+    }
+
+    // Merge the push constant blocks of each stage into a single range. Uniforms which are
+    // declared by several stages are only added once.
+    for (const auto& stage : program.stages) {
+        const auto& push_constants = stage.second.push_constants;
+        if (!push_constants) {
+            continue;
+        }
+        program.push_constant_size =
+            std::max(program.push_constant_size, static_cast<u32>(push_constants->size));
+        program.push_constant_stages |= stage.first;
+        for (const auto& field : push_constants->fields) {
+            std::string qualified_name =
+                (push_constants->name.empty() ? "" : push_constants->name + ".") + field.name;
+            if (program.uniform_indices.count(qualified_name) > 0) {
+                continue;
+            }
+            program.uniform_indices.emplace(qualified_name, program.uniforms.size());
+            program.uniforms.emplace_back(ProgramVK::Uniform{std::move(qualified_name),
+                                                             std::nullopt, field.offset,
+                                                             field.size, {}});
+        }
+    }
+    if (program.push_constant_size > device_->properties().limits.maxPushConstantsSize) {
+        logger_.error("Push constants ({} bytes) exceed the device limit of {} bytes.",
+                      program.push_constant_size,
+                      device_->properties().limits.maxPushConstantsSize);
+    }
+
+    return program;
+}
+
+void RenderContextVK::destroyProgram(ProgramVK& program) {
+    vk_device_.destroy(program.descriptor_set_layout);
+    for (const auto& stage : program.stages) {
+        vk_device_.destroy(stage.second.module);
+    }
+}
+
+void RenderContextVK::finishAsyncPrograms() {
+    std::vector<std::pair<ProgramHandle, ProgramVK>> created_programs;
+    {
+        std::lock_guard<std::mutex> lock{created_programs_mutex_};
+        created_programs.swap(created_programs_);
+    }
+    for (auto& entry : created_programs) {
+        if (pending_programs_.erase(entry.first) == 0) {
+            // Deleted before it finished.
+            destroyProgram(entry.second);
+            continue;
+        }
+        program_map_.emplace(entry.first, std::move(entry.second));
+        setProgramReady(entry.first, true);
+    }
 }
 
-void RenderContextVK::operator()(const cmd::DeleteProgram& c) {
-    auto& program = program_map_.at(c.handle);
-    vk_device_.destroy(program.descriptor_set_layout);
-    for (const auto& stage : program.stages) {
-        vk_device_.destroy(stage.second.module);
+void RenderContextVK::operator()(const cmd::CreateUniform& c) {
+    u32 index = static_cast<u32>(c.handle);
+    if (index >= uniform_names_.size()) {
+        uniform_names_.resize(index + 1);
     }
-    program_map_.erase(c.handle);
+    uniform_names_[index] = c.name;
 }
 
 void RenderContextVK::operator()(const cmd::CreateTexture2D& c) {
-    TextureVK texture;
+    if (!texture_format_supported_[usize(c.format)]) {
+        logger_.error("[CreateTexture2D] Texture format {} is not supported by this device.",
+                      static_cast<u32>(c.format));
+        return;
+    }
+    auto mip_levels = static_cast<u32>(std::max<usize>(c.mip_levels.size(), 1));
+    u32 array_layers = std::max<u32>(c.array_layers, 1);
+    for (u32 i = 0; i < c.mip_levels.size(); ++i) {
+        usize expected_size = textureLevelSize(c.format, std::max(c.width >> i, 1),
+                                               std::max(c.height >> i, 1)) *
+                              array_layers;
+        if (c.mip_levels[i].data() && c.mip_levels[i].size() < expected_size) {
+            logger_.error("[CreateTexture2D] Mip level {} of texture {} has size {}, expected {}.",
+                          i, static_cast<u32>(c.handle), c.mip_levels[i].size(), expected_size);
+            return;
+        }
+    }
 
+    TextureVK texture;
+    texture.format = c.format;
     texture.image_format = kTextureFormatMap.at(usize(c.format)).format;
-
-    vk::DeviceSize buffer_size = c.width * c.height * 4;
-    assert(c.data.size() <= buffer_size);
+    texture.mip_levels = mip_levels;
 
     texture.aspect_mask = vk::ImageAspectFlagBits::eColor;
 
+    vk::ImageUsageFlags storage_usage;
+    if (c.storage_usage) {
+        storage_usage = vk::ImageUsageFlagBits::eStorage;
+        if (!(device_->getPhysicalDevice().getFormatProperties(texture.image_format)
+                  .optimalTilingFeatures &
+              vk::FormatFeatureFlagBits::eStorageImage)) {
+            logger_.error("[CreateTexture2D] Texture format {} can't be used for storage images.",
+                          static_cast<u32>(c.format));
+            return;
+        }
+    }
+
     if (c.framebuffer_usage) {
-        device_->createImage(
-            static_cast<u32>(c.width), static_cast<u32>(c.height), texture.image_format,
-            vk::ImageTiling::eOptimal,
-            vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled,
-            vk::MemoryPropertyFlagBits::eDeviceLocal, texture.image, texture.image_memory);
+        device_->createImage(static_cast<u32>(c.width), static_cast<u32>(c.height),
+                             texture.image_format, vk::ImageTiling::eOptimal,
+                             vk::ImageUsageFlagBits::eColorAttachment |
+                                 vk::ImageUsageFlagBits::eTransferDst |
+                                 vk::ImageUsageFlagBits::eSampled | storage_usage,
+                             vk::MemoryPropertyFlagBits::eDeviceLocal, texture.image,
+                             texture.image_memory);
         texture.image_layout = vk::ImageLayout::eUndefined;
     } else {
-        // Create image by copying to a staging buffer.
-        vk::Buffer staging_buffer;
-        vk::DeviceMemory staging_buffer_memory;
-        device_->createBuffer(
-            buffer_size, vk::BufferUsageFlagBits::eTransferSrc,
-            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-            staging_buffer, staging_buffer_memory);
-
-        void* data = vk_device_.mapMemory(staging_buffer_memory, 0, buffer_size);
-        memcpy(data, c.data.data(), static_cast<std::size_t>(c.data.size()));
-        vk_device_.unmapMemory(staging_buffer_memory);
-
         // Create image.
-        device_->createImage(
-            static_cast<u32>(c.width), static_cast<u32>(c.height), texture.image_format,
-            vk::ImageTiling::eOptimal,
-            vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
-            vk::MemoryPropertyFlagBits::eDeviceLocal, texture.image, texture.image_memory);
-
-        device_->transitionImageLayout(texture.image, texture.image_format,
-                                       vk::ImageLayout::eUndefined,
-                                       vk::ImageLayout::eTransferDstOptimal);
-        device_->copyBufferToImage(staging_buffer, texture.image, static_cast<u32>(c.width),
-                                   static_cast<u32>(c.height));
-        device_->transitionImageLayout(texture.image, texture.image_format,
-                                       vk::ImageLayout::eTransferDstOptimal,
-                                       vk::ImageLayout::eShaderReadOnlyOptimal);
+        device_->createImage(static_cast<u32>(c.width), static_cast<u32>(c.height),
+                             texture.image_format, vk::ImageTiling::eOptimal,
+                             vk::ImageUsageFlagBits::eTransferDst |
+                                 vk::ImageUsageFlagBits::eSampled | storage_usage,
+                             vk::MemoryPropertyFlagBits::eDeviceLocal, texture.image,
+                             texture.image_memory, mip_levels, array_layers);
+
+        // Queue the upload. This is submitted with the next frame, which waits for it to complete
+        // before sampling the texture. Levels without data are filled with zeroes.
+        std::vector<UploadQueueVK::ImageLevel> levels;
+        std::vector<std::vector<byte>> padded_levels;
+        padded_levels.reserve(mip_levels);
+        for (u32 i = 0; i < mip_levels; ++i) {
+            u32 width = std::max(static_cast<u32>(c.width) >> i, 1u);
+            u32 height = std::max(static_cast<u32>(c.height) >> i, 1u);
+            usize size = textureLevelSize(c.format, width, height) * array_layers;
+            const byte* data = i < c.mip_levels.size() ? c.mip_levels[i].data() : nullptr;
+            if (!data) {
+                padded_levels.emplace_back(size, 0);
+                data = padded_levels.back().data();
+            }
+            levels.push_back(UploadQueueVK::ImageLevel{width, height, data, size});
+        }
+        upload_queue_->uploadImage(texture.image, levels, array_layers);
         texture.image_layout = vk::ImageLayout::eShaderReadOnlyOptimal;
-
-        vk_device_.destroy(staging_buffer);
-        vk_device_.free(staging_buffer_memory);
     }
 
     // Create image view.
-    texture.image_view = device_->createImageView(texture.image, texture.image_format,
-                                                  vk::ImageAspectFlagBits::eColor);
+    texture.image_view = device_->createImageView(
+        texture.image, texture.image_format, vk::ImageAspectFlagBits::eColor, mip_levels,
+        c.array_layers > 0 ? vk::ImageViewType::e2DArray : vk::ImageViewType::e2D, array_layers);
+    if (c.storage_usage) {
+        for (u32 level = 0; level < mip_levels; ++level) {
+            vk::ImageViewCreateInfo view_info;
+            view_info.image = texture.image;
+            view_info.viewType = vk::ImageViewType::e2D;
+            view_info.format = texture.image_format;
+            view_info.subresourceRange =
+                vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, level, 1, 0, 1};
+            texture.storage_image_views.push_back(vk_device_.createImageView(view_info));
+        }
+    }
 
+    setResourceMemory(
+        c.framebuffer_usage ? MemoryCategory::RenderTargets : MemoryCategory::Textures, c.handle,
+        texture.image_memory.size);
     texture_map_.emplace(c.handle, std::move(texture));
+
+    // Write the texture into each frame's bindless texture table before that frame next renders.
+    if (c.bindless && bindless_texturing_supported_) {
+        bindless_slots_[c.handle.index()] = c.handle;
+        for (auto& pending_writes : bindless_pending_writes_) {
+            pending_writes.insert(c.handle.index());
+        }
+    }
+}
+
+void RenderContextVK::operator()(const cmd::UpdateTexture2D& c) {
+    auto it = texture_map_.find(c.handle);
+    if (it == texture_map_.end()) {
+        logger_.error("[UpdateTexture2D] Texture {} doesn't exist.", static_cast<u32>(c.handle));
+        return;
+    }
+    // Mipmaps aren't generated on Vulkan, so textures only have the levels they were created with.
+    if (c.mip_level >= it->second.mip_levels) {
+        logger_.error("[UpdateTexture2D] Mip level {} of texture {} doesn't exist.", c.mip_level,
+                      static_cast<u32>(c.handle));
+        return;
+    }
+    // Frames in flight may still be sampling the texture, so the copy is recorded into the next
+    // frame's command buffer rather than submitted on the transfer queue.
+    pending_texture_updates_.emplace_back(c);
 }
 
 void RenderContextVK::operator()(const cmd::DeleteTexture& c) {
+    auto it = texture_map_.find(c.handle);
+    if (it == texture_map_.end()) {
+        logger_.error("[DeleteTexture] Texture {} doesn't exist.", static_cast<u32>(c.handle));
+        return;
+    }
+    // Frames in flight may still sample the texture, so it's destroyed once they've finished.
+    // Updates which haven't been recorded yet (because a frame was dropped) are discarded.
+    pending_texture_updates_.erase(
+        std::remove_if(pending_texture_updates_.begin(), pending_texture_updates_.end(),
+                       [&c](const cmd::UpdateTexture2D& update) {
+                           return update.handle == c.handle;
+                       }),
+        pending_texture_updates_.end());
+    retiredResources().textures.emplace_back(std::move(it->second));
+    texture_map_.erase(it);
+    setResourceMemory(MemoryCategory::Textures, c.handle, 0);
+
+    // Replace the texture in each frame's bindless texture table.
+    u32 index = c.handle.index();
+    if (index < bindless_slots_.size() && bindless_slots_[index] == c.handle) {
+        bindless_slots_[index] = TextureHandle{};
+        for (auto& pending_writes : bindless_pending_writes_) {
+            pending_writes.insert(index);
+        }
+    }
+    setResourceMemory(MemoryCategory::RenderTargets, c.handle, 0);
 }
 
 void RenderContextVK::operator()(const cmd::CreateFrameBuffer& c) {
@@ -1438,10 +2988,70 @@ void RenderContextVK::operator()(const cmd::CreateFrameBuffer& c) {
         textures.push_back(&texture_map_.at(texture_handle));
     }
     FramebufferVK framebuffer{device_.get(), c.width, c.height, std::move(textures)};
+    setResourceMemory(MemoryCategory::FrameBuffers, c.handle, framebuffer.depth.image_memory.size);
     framebuffer_map_.emplace(c.handle, std::move(framebuffer));
 }
 
 void RenderContextVK::operator()(const cmd::DeleteFrameBuffer& c) {
+    auto it = framebuffer_map_.find(c.handle);
+    if (it == framebuffer_map_.end()) {
+        logger_.error("[DeleteFrameBuffer] Frame buffer {} doesn't exist.",
+                      static_cast<u32>(c.handle));
+        return;
+    }
+    // Frames in flight may still render to the frame buffer, so it's destroyed (along with the
+    // pipelines created for its render pass) once they've finished.
+    retirePipelines(nullptr, &it->second);
+    retiredResources().framebuffers.emplace_back(std::move(it->second));
+    framebuffer_map_.erase(it);
+    setResourceMemory(MemoryCategory::FrameBuffers, c.handle, 0);
+}
+
+void RenderContextVK::operator()(const cmd::CreateOcclusionQuery& c) {
+    u32 slot;
+    if (!free_occlusion_query_slots_.empty()) {
+        slot = free_occlusion_query_slots_.back();
+        free_occlusion_query_slots_.pop_back();
+    } else if (occlusion_query_slot_count_ < kMaxOcclusionQueries) {
+        slot = occlusion_query_slot_count_++;
+    } else {
+        logger_.error("[CreateOcclusionQuery] Too many occlusion queries (maximum {}), query {} "
+                      "will be ignored.",
+                      kMaxOcclusionQueries, c.handle);
+        return;
+    }
+    occlusion_query_map_.emplace(c.handle, OcclusionQueryVK{slot, std::nullopt});
+}
+
+void RenderContextVK::operator()(const cmd::DeleteOcclusionQuery& c) {
+    auto query_it = occlusion_query_map_.find(c.handle);
+    if (query_it == occlusion_query_map_.end()) {
+        return;
+    }
+    // The slot's queries in earlier frames are only read back for the query which wrote them, so
+    // the slot can be reused straight away.
+    free_occlusion_query_slots_.emplace_back(query_it->second.slot);
+    occlusion_query_map_.erase(query_it);
+    setOcclusionQueryResult(c.handle, std::nullopt);
+}
+
+void RenderContextVK::operator()(const cmd::PrewarmPipeline& c) {
+    auto program_it = program_map_.find(c.program);
+    if (program_it == program_map_.end()) {
+        logger_.warn("[PrewarmPipeline] Program {} is not ready, skipping.",
+                     static_cast<u32>(c.program));
+        return;
+    }
+    const FramebufferVK* framebuffer = nullptr;
+    if (c.frame_buffer) {
+        framebuffer = &framebuffer_map_.at(*c.frame_buffer);
+    }
+    const VertexDeclVK* decl = findOrCreateVertexDecl(VertexDeclVK::Info{c.decl, c.instance_decl});
+    if (decl->unsupported_format != vk::Format::eUndefined) {
+        return;
+    }
+    findOrCreateGraphicsPipeline(
+        PipelineVK::Info{c.pipeline_state, decl, &program_it->second, framebuffer});
 }
 
 bool RenderContextVK::checkValidationLayerSupport() {
@@ -1461,15 +3071,15 @@ bool RenderContextVK::checkValidationLayerSupport() {
     return true;
 }
 
-std::vector<const char*> RenderContextVK::getRequiredExtensions(bool enable_validation_layers) {
+std::vector<const char*> RenderContextVK::getRequiredExtensions(bool enable_debug_utils) {
     // Get required GLFW extensions.
     u32 glfwExtensionCount = 0;
     const char** glfwExtensions;
     glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
     std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
 
-    // Add the debug utils extension if validation layers are enabled.
-    if (enable_validation_layers) {
+    // Add the debug utils extension if validation layers or debug labels are enabled.
+    if (enable_debug_utils) {
         extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
     }
 
@@ -1492,6 +3102,9 @@ void RenderContextVK::createInstance(bool enable_validation_layers) {
     extension_list << "Vulkan extensions supported:";
     for (const auto& extension : all_extensions) {
         extension_list << " " << extension.extensionName;
+        if (std::string{extension.extensionName} == VK_EXT_DEBUG_UTILS_EXTENSION_NAME) {
+            debug_labels_supported_ = true;
+        }
     }
     logger_.info(extension_list.str());
     std::ostringstream layer_list;
@@ -1512,7 +3125,11 @@ void RenderContextVK::createInstance(bool enable_validation_layers) {
     create_info.pApplicationInfo = &app_info;
 
     // Enable required extensions.
-    auto extensions = getRequiredExtensions(enable_validation_layers);
+    // Debug utils is enabled whenever it's available, so that graphics debuggers such as RenderDoc
+    // show debug labels. The validation layers also provide it.
+    debug_labels_supported_ = debug_labels_supported_ || enable_validation_layers;
+    logger_.info("Debug labels: {}", debug_labels_supported_);
+    auto extensions = getRequiredExtensions(debug_labels_supported_);
     create_info.enabledExtensionCount = static_cast<u32>(extensions.size());
     create_info.ppEnabledExtensionNames = extensions.data();
 
@@ -1601,11 +3218,22 @@ void RenderContextVK::createDevice() {
     auto indices = QueueFamilyIndices::fromPhysicalDevice(physical_device, surface_);
     graphics_queue_family_index_ = indices.graphics_family.value();
     present_queue_family_index_ = indices.present_family.value();
+    transfer_queue_family_index_ = indices.transfer_family;
+    compute_supported_ = static_cast<bool>(
+        physical_device.getQueueFamilyProperties()[graphics_queue_family_index_].queueFlags &
+        vk::QueueFlagBits::eCompute);
+    gpu_timing_supported_ =
+        physical_device.getQueueFamilyProperties()[graphics_queue_family_index_]
+            .timestampValidBits > 0;
+    timestamp_period_ = physical_device.getProperties().limits.timestampPeriod;
 
     // Create a logical device.
     std::vector<vk::DeviceQueueCreateInfo> queue_create_infos;
     std::set<u32> unique_queues_families = {graphics_queue_family_index_,
                                             present_queue_family_index_};
+    if (transfer_queue_family_index_) {
+        unique_queues_families.insert(*transfer_queue_family_index_);
+    }
     float queue_priority = 1.0f;
     for (u32 queue_family : unique_queues_families) {
         vk::DeviceQueueCreateInfo queue_create_info;
@@ -1616,14 +3244,87 @@ void RenderContextVK::createDevice() {
     }
 
     vk::PhysicalDeviceFeatures device_features;
+    multi_draw_indirect_supported_ = physical_device.getFeatures().multiDrawIndirect;
+    device_features.multiDrawIndirect = multi_draw_indirect_supported_;
+    logger_.info("Multi-draw indirect: {}", multi_draw_indirect_supported_);
+    occlusion_query_precise_ = physical_device.getFeatures().occlusionQueryPrecise;
+    device_features.occlusionQueryPrecise = occlusion_query_precise_;
+
+    // The bindless texture table needs non-uniform indexing of partially bound sampler arrays,
+    // and enough per stage samplers to hold the whole table.
+    std::vector<const char*> device_extensions(kRequiredDeviceExtensions.begin(),
+                                               kRequiredDeviceExtensions.end());
+    vk::PhysicalDeviceDescriptorIndexingFeaturesEXT descriptor_indexing_features;
+    bool has_descriptor_indexing = false;
+    bool has_conditional_rendering = false;
+    bool has_memory_budget = false;
+    for (const auto& extension : physical_device.enumerateDeviceExtensionProperties()) {
+        std::string extension_name{extension.extensionName};
+        if (extension_name == VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) {
+            has_descriptor_indexing = true;
+        } else if (extension_name == VK_EXT_CONDITIONAL_RENDERING_EXTENSION_NAME) {
+            has_conditional_rendering = true;
+        } else if (extension_name == VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) {
+            has_memory_budget = true;
+        }
+    }
+    if (has_descriptor_indexing) {
+        vk::PhysicalDeviceFeatures2 features;
+        features.pNext = &descriptor_indexing_features;
+        physical_device.getFeatures2(&features);
+        const auto& limits = physical_device.getProperties().limits;
+        bindless_texturing_supported_ =
+            descriptor_indexing_features.shaderSampledImageArrayNonUniformIndexing &&
+            descriptor_indexing_features.descriptorBindingPartiallyBound &&
+            limits.maxPerStageDescriptorSamplers >= DW_MAX_BINDLESS_TEXTURES + 16 &&
+            limits.maxPerStageDescriptorSampledImages >= DW_MAX_BINDLESS_TEXTURES + 16;
+    }
+    vk::PhysicalDeviceDescriptorIndexingFeaturesEXT enabled_descriptor_indexing_features;
+    if (bindless_texturing_supported_) {
+        device_extensions.emplace_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        enabled_descriptor_indexing_features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        enabled_descriptor_indexing_features.descriptorBindingPartiallyBound = VK_TRUE;
+    }
+    logger_.info("Bindless textures: {}", bindless_texturing_supported_);
+
+    // Draw conditions are evaluated by the GPU with VK_EXT_conditional_rendering.
+    vk::PhysicalDeviceConditionalRenderingFeaturesEXT conditional_rendering_features;
+    if (has_conditional_rendering) {
+        vk::PhysicalDeviceFeatures2 features;
+        features.pNext = &conditional_rendering_features;
+        physical_device.getFeatures2(&features);
+        conditional_rendering_supported_ = conditional_rendering_features.conditionalRendering;
+    }
+    vk::PhysicalDeviceConditionalRenderingFeaturesEXT enabled_conditional_rendering_features;
+    if (conditional_rendering_supported_) {
+        device_extensions.emplace_back(VK_EXT_CONDITIONAL_RENDERING_EXTENSION_NAME);
+        enabled_conditional_rendering_features.conditionalRendering = VK_TRUE;
+    }
+    logger_.info("Conditional rendering: {} - Precise occlusion queries: {}",
+                 conditional_rendering_supported_, occlusion_query_precise_);
+
+    // The memory budget only needs the extension to be enabled, and is read with
+    // getMemoryProperties2.
+    memory_budget_supported_ = has_memory_budget;
+    if (memory_budget_supported_) {
+        device_extensions.emplace_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+    logger_.info("Memory budget: {}", memory_budget_supported_);
 
     vk::DeviceCreateInfo create_info;
     create_info.pQueueCreateInfos = queue_create_infos.data();
     create_info.queueCreateInfoCount = static_cast<u32>(queue_create_infos.size());
     create_info.pEnabledFeatures = &device_features;
-    // No device specific extensions.
-    create_info.enabledExtensionCount = static_cast<u32>(kRequiredDeviceExtensions.size());
-    create_info.ppEnabledExtensionNames = kRequiredDeviceExtensions.data();
+    if (conditional_rendering_supported_) {
+        enabled_conditional_rendering_features.pNext = create_info.pNext;
+        create_info.pNext = &enabled_conditional_rendering_features;
+    }
+    if (bindless_texturing_supported_) {
+        enabled_descriptor_indexing_features.pNext = create_info.pNext;
+        create_info.pNext = &enabled_descriptor_indexing_features;
+    }
+    create_info.enabledExtensionCount = static_cast<u32>(device_extensions.size());
+    create_info.ppEnabledExtensionNames = device_extensions.data();
     // Technically unneeded, but worth doing anyway for old vulkan implementations.
     if (debug_messenger_) {
         create_info.enabledLayerCount = static_cast<u32>(kValidationLayers.size());
@@ -1636,6 +3337,10 @@ void RenderContextVK::createDevice() {
     // Get queue handles.
     graphics_queue_ = vk_device_.getQueue(indices.graphics_family.value(), 0);
     present_queue_ = vk_device_.getQueue(indices.present_family.value(), 0);
+    if (transfer_queue_family_index_) {
+        transfer_queue_ = vk_device_.getQueue(*transfer_queue_family_index_, 0);
+        logger_.info("Using queue family {} for texture uploads.", *transfer_queue_family_index_);
+    }
 
     // Create command pool.
     vk::CommandPoolCreateInfo pool_info;
@@ -1646,16 +3351,26 @@ void RenderContextVK::createDevice() {
     // Create device wrapper.
     device_ =
         std::make_unique<DeviceVK>(physical_device, vk_device_, command_pool, graphics_queue_);
+
+    // Create upload queue.
+    upload_queue_ = std::make_unique<UploadQueueVK>(
+        vk_device_, device_->allocator(), graphics_queue_family_index_, graphics_queue_,
+        transfer_queue_family_index_, transfer_queue_, kUploadStagingRingSize);
 }
 
-void RenderContextVK::createSwapChain() {
+void RenderContextVK::createSwapChain(vk::SwapchainKHR old_swap_chain, u32 image_count) {
     SwapChainSupportDetails swap_chain_support =
         SwapChainSupportDetails::querySupport(device_->getPhysicalDevice(), surface_);
     vk::SurfaceFormatKHR surface_format = swap_chain_support.chooseSurfaceFormat();
-    vk::PresentModeKHR present_mode = swap_chain_support.choosePresentMode();
-    vk::Extent2D extent = swap_chain_support.chooseSwapExtent(windowSize());
+    vk::PresentModeKHR present_mode =
+        swap_chain_support.choosePresentMode(requested_present_mode_, logger_);
+    vk::Extent2D extent = swap_chain_support.chooseSwapExtent(
+        Vec2i{static_cast<int>(framebuffer_width_), static_cast<int>(framebuffer_height_)});
 
-    u32 image_count = swap_chain_support.capabilities.minImageCount + 1;
+    if (image_count == 0) {
+        image_count = swap_chain_support.capabilities.minImageCount + 1;
+    }
+    image_count = std::max(image_count, swap_chain_support.capabilities.minImageCount);
     if (swap_chain_support.capabilities.maxImageCount > 0 &&
         image_count > swap_chain_support.capabilities.maxImageCount) {
         image_count = swap_chain_support.capabilities.maxImageCount;
@@ -1685,7 +3400,7 @@ void RenderContextVK::createSwapChain() {
     create_info.compositeAlpha = vk::CompositeAlphaFlagBitsKHR::eOpaque;
     create_info.presentMode = present_mode;
     create_info.clipped = VK_TRUE;
-    create_info.oldSwapchain = vk::SwapchainKHR{};
+    create_info.oldSwapchain = old_swap_chain;
 
     swap_chain_ = vk_device_.createSwapchainKHR(create_info);
     swap_chain_images_ = vk_device_.getSwapchainImagesKHR(swap_chain_);
@@ -1707,62 +3422,96 @@ void RenderContextVK::createSwapChain() {
                          depth_image_memory_);
     depth_image_view_ =
         device_->createImageView(depth_image_, depth_format_, vk::ImageAspectFlagBits::eDepth);
+    depth_image_layout_ = vk::ImageLayout::eUndefined;
+    logger_.info("[Swapchain] {}x{}, {} images, present mode {}.", swap_chain_extent_.width,
+                 swap_chain_extent_.height, swap_chain_images_.size(),
+                 vk::to_string(present_mode));
 }
 
-void RenderContextVK::createRenderPass() {
-    // Colour attachment.
-    vk::AttachmentDescription colour_attachment;
-    colour_attachment.format = swap_chain_image_format_;
-    colour_attachment.samples = vk::SampleCountFlagBits::e1;
-    colour_attachment.loadOp = vk::AttachmentLoadOp::eClear;
-    colour_attachment.storeOp = vk::AttachmentStoreOp::eStore;
-    colour_attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
-    colour_attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-    colour_attachment.initialLayout = vk::ImageLayout::eUndefined;
-    colour_attachment.finalLayout = vk::ImageLayout::ePresentSrcKHR;
-    vk::AttachmentReference colour_attachment_ref;
-    colour_attachment_ref.attachment = 0;
-    colour_attachment_ref.layout = vk::ImageLayout::eColorAttachmentOptimal;
+bool RenderContextVK::recreateSwapChain() {
+    // A minimised window has no surface to present to, so wait until it's restored.
+    if (framebuffer_width_ == 0 || framebuffer_height_ == 0) {
+        return false;
+    }
 
-    // Depth attachment.
-    vk::AttachmentDescription depth_attachment;
-    depth_attachment.format = depth_format_;
-    depth_attachment.samples = vk::SampleCountFlagBits::e1;
-    depth_attachment.loadOp = vk::AttachmentLoadOp::eClear;
-    depth_attachment.storeOp = vk::AttachmentStoreOp::eDontCare;
-    depth_attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
-    depth_attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-    depth_attachment.initialLayout = vk::ImageLayout::eUndefined;
-    depth_attachment.finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
-    vk::AttachmentReference depth_attachment_ref;
-    depth_attachment_ref.attachment = 1;
-    depth_attachment_ref.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+    // The render pass, and everything which is per swapchain image (such as command buffers and
+    // dynamic buffer copies) are kept, so only the images and framebuffers are recreated. The new
+    // swapchain asks for the same number of images, as there are no per image resources for any
+    // more. If the driver returns more images anyway, the swapchain can't be used, so it's
+    // destroyed and frames are dropped until a later attempt succeeds.
+    vk_device_.waitIdle();
+    destroySwapChainImages();
+    vk::SwapchainKHR old_swap_chain = swap_chain_;
+    createSwapChain(old_swap_chain, per_image_resource_count_);
+    vk_device_.destroy(old_swap_chain);
+    if (swap_chain_images_.size() > per_image_resource_count_) {
+        logger_.error("[Swapchain] Recreated swapchain has {} images, but only {} are supported.",
+                      swap_chain_images_.size(), per_image_resource_count_);
+        destroySwapChainImages();
+        vk_device_.destroy(swap_chain_);
+        swap_chain_ = vk::SwapchainKHR{};
+        return false;
+    }
+    createFramebuffers();
+    images_in_flight_.assign(swap_chain_images_.size(), vk::Fence{});
+    swap_chain_out_of_date_ = false;
+    return true;
+}
 
-    // Subpass.
-    vk::SubpassDescription subpass;
-    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &colour_attachment_ref;
-    subpass.pDepthStencilAttachment = &depth_attachment_ref;
+void RenderContextVK::destroySwapChainImages() {
+    for (const auto& framebuffer : swap_chain_framebuffers_) {
+        vk_device_.destroy(framebuffer);
+    }
+    swap_chain_framebuffers_.clear();
 
-    vk::SubpassDependency dependency;
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-    dependency.srcAccessMask = {};
-    dependency.dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-    dependency.dstAccessMask =
-        vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
+    // Called again after a failed recreation, when the depth image has already been destroyed.
+    if (depth_image_) {
+        vk_device_.destroy(depth_image_view_);
+        device_->destroyImage(depth_image_, depth_image_memory_);
+        depth_image_view_ = vk::ImageView{};
+        depth_image_ = vk::Image{};
+    }
 
-    std::array<vk::AttachmentDescription, 2> attachments = {colour_attachment, depth_attachment};
-    vk::RenderPassCreateInfo render_pass_info;
-    render_pass_info.attachmentCount = attachments.size();
-    render_pass_info.pAttachments = attachments.data();
-    render_pass_info.subpassCount = 1;
-    render_pass_info.pSubpasses = &subpass;
-    render_pass_info.dependencyCount = 1;
-    render_pass_info.pDependencies = &dependency;
-    swapchain_render_pass_ = vk_device_.createRenderPass(render_pass_info);
+    for (const auto& image_view : swap_chain_image_views_) {
+        vk_device_.destroy(image_view);
+    }
+    swap_chain_image_views_.clear();
+    swap_chain_images_.clear();
+}
+
+void RenderContextVK::createRenderPass() {
+    swapchain_render_pass_ =
+        createRenderPass(vk_device_, {swap_chain_image_format_}, vk::ImageLayout::ePresentSrcKHR,
+                         depth_format_, kDefaultAttachmentOps);
+}
+
+vk::RenderPass RenderContextVK::findOrCreateRenderPass(FramebufferVK* frame_buffer,
+                                                       const RenderQueue::AttachmentOps& ops) {
+    u32 key = attachmentOpsKey(ops);
+    if (key == attachmentOpsKey(kDefaultAttachmentOps)) {
+        return frame_buffer ? frame_buffer->render_pass : swapchain_render_pass_;
+    }
+    auto& variants =
+        frame_buffer ? frame_buffer->render_pass_variants : swapchain_render_pass_variants_;
+    auto it = variants.find(key);
+    if (it != variants.end()) {
+        return it->second;
+    }
+    vk::RenderPass render_pass;
+    if (frame_buffer) {
+        std::vector<vk::Format> colour_formats;
+        for (TextureVK* image : frame_buffer->images) {
+            colour_formats.emplace_back(image->image_format);
+        }
+        render_pass = createRenderPass(vk_device_, colour_formats,
+                                       vk::ImageLayout::eColorAttachmentOptimal,
+                                       frame_buffer->depth.image_format, ops);
+    } else {
+        render_pass = createRenderPass(vk_device_, {swap_chain_image_format_},
+                                       vk::ImageLayout::ePresentSrcKHR, depth_format_, ops);
+    }
+    variants.emplace(key, render_pass);
+    return render_pass;
 }
 
 void RenderContextVK::createFramebuffers() {
@@ -1785,10 +3534,25 @@ void RenderContextVK::createCommandBuffers() {
     vk::CommandBufferAllocateInfo allocate_info;
     allocate_info.commandPool = device_->getCommandPool();
     allocate_info.level = vk::CommandBufferLevel::ePrimary;
-    allocate_info.commandBufferCount = static_cast<u32>(swap_chain_framebuffers_.size());
+    allocate_info.commandBufferCount = per_image_resource_count_;
     command_buffers_ = vk_device_.allocateCommandBuffers(allocate_info);
 }
 
+void RenderContextVK::createSecondaryCommandPools() {
+    // One pool per recording thread (each worker thread, plus the render thread) per swap chain
+    // image.
+    usize thread_count = (worker_pool_ ? worker_pool_->size() : 0) + 1;
+    secondary_command_pools_.resize(per_image_resource_count_);
+    for (auto& pools : secondary_command_pools_) {
+        pools.resize(thread_count);
+        for (auto& pool : pools) {
+            vk::CommandPoolCreateInfo pool_info;
+            pool_info.queueFamilyIndex = graphics_queue_family_index_;
+            pool.pool = vk_device_.createCommandPool(pool_info);
+        }
+    }
+}
+
 void RenderContextVK::createDescriptorPool() {
     vk::DescriptorPoolSize dps[] = {
         {vk::DescriptorType::eCombinedImageSampler, (10 * DW_MAX_TEXTURE_SAMPLERS) << 10},
@@ -1800,18 +3564,167 @@ void RenderContextVK::createDescriptorPool() {
     };
 
     vk::DescriptorPoolCreateInfo poolInfo;
+    poolInfo.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
     poolInfo.poolSizeCount = sizeof(dps) / sizeof(dps[0]);
     poolInfo.pPoolSizes = dps;
     poolInfo.maxSets = 10 << 10;
 
-    descriptor_pool_ = vk_device_.createDescriptorPool(poolInfo);
+    descriptor_pools_.emplace_back(vk_device_.createDescriptorPool(poolInfo));
+}
+
+RenderContextVK::RetiredResourcesVK& RenderContextVK::retiredResources() {
+    if (retired_resources_.empty() || retired_resources_.back().frame != frame_counter_) {
+        retired_resources_.emplace_back();
+        retired_resources_.back().frame = frame_counter_;
+    }
+    return retired_resources_.back();
+}
+
+void RenderContextVK::destroyRetiredResources(bool all) {
+    // frame_counter_ is incremented after waiting for the oldest frame in flight, so a resource
+    // deleted while frame N was being prepared is unused once frame N + frames in flight is.
+    auto frames_in_flight = static_cast<u64>(in_flight_fences_.size());
+    while (!retired_resources_.empty() &&
+           (all || retired_resources_.front().frame + frames_in_flight <= frame_counter_)) {
+        auto& retired = retired_resources_.front();
+        for (auto& pipeline : retired.pipelines) {
+            vk_device_.destroy(pipeline.layout);
+            vk_device_.destroy(pipeline.pipeline);
+        }
+        for (auto& framebuffer : retired.framebuffers) {
+            destroyFramebuffer(framebuffer);
+        }
+        for (auto& texture : retired.textures) {
+            destroyTexture(texture);
+        }
+        retired_resources_.pop_front();
+    }
+}
+
+void RenderContextVK::queryMemoryBudget() {
+    if (!memory_budget_supported_) {
+        return;
+    }
+    vk::PhysicalDeviceMemoryBudgetPropertiesEXT budget_properties;
+    vk::PhysicalDeviceMemoryProperties2 properties;
+    properties.pNext = &budget_properties;
+    device_->getPhysicalDevice().getMemoryProperties2(&properties);
+    const auto& memory_properties = properties.memoryProperties;
+    u64 budget = 0;
+    u64 usage = 0;
+    for (u32 i = 0; i < memory_properties.memoryHeapCount; ++i) {
+        if (memory_properties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal) {
+            budget += budget_properties.heapBudget[i];
+            usage += budget_properties.heapUsage[i];
+        }
+    }
+    setMemoryBudget(budget, usage);
+}
+
+void RenderContextVK::destroyTexture(TextureVK& texture) {
+    vk_device_.destroy(texture.image_view);
+    for (vk::ImageView view : texture.storage_image_views) {
+        vk_device_.destroy(view);
+    }
+    device_->destroyImage(texture.image, texture.image_memory);
+}
+
+void RenderContextVK::destroyFramebuffer(FramebufferVK& framebuffer) {
+    vk_device_.destroy(framebuffer.render_pass);
+    for (auto& variant : framebuffer.render_pass_variants) {
+        vk_device_.destroy(variant.second);
+    }
+    vk_device_.destroy(framebuffer.framebuffer);
+    destroyTexture(framebuffer.depth);
+}
+
+void RenderContextVK::retirePipelines(const ProgramVK* program, const FramebufferVK* framebuffer) {
+    std::lock_guard<std::mutex> lock{pipeline_cache_mutex_};
+    auto& retired = retiredResources();
+    for (auto it = graphics_pipeline_cache_.begin(); it != graphics_pipeline_cache_.end();) {
+        if ((program && it->first.program == program) ||
+            (framebuffer && it->first.framebuffer == framebuffer)) {
+            retired.pipelines.emplace_back(it->second);
+            it = graphics_pipeline_cache_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    auto compute_it = compute_pipeline_cache_.find(program);
+    if (program && compute_it != compute_pipeline_cache_.end()) {
+        retired.pipelines.emplace_back(compute_it->second);
+        compute_pipeline_cache_.erase(compute_it);
+    }
+}
+
+void RenderContextVK::evictDescriptorSets() {
+    std::lock_guard<std::mutex> lock{descriptor_set_cache_mutex_};
+    while (!descriptor_set_lru_.empty()) {
+        auto cached_it = descriptor_set_cache_.find(*descriptor_set_lru_.back());
+        if (cached_it->second.last_used_frame + kDescriptorSetMaxUnusedFrames >= frame_counter_) {
+            break;
+        }
+        cached_it->second.descriptor_set.destroy(vk_device_);
+        descriptor_set_lru_.pop_back();
+        descriptor_set_cache_.erase(cached_it);
+    }
+}
+
+void RenderContextVK::createPipelineCache() {
+    // Seed the pipeline cache with the data saved by a previous run, if it was created by the same
+    // driver and device. Drivers are expected to validate the data themselves, but some don't.
+    std::vector<char> initial_data;
+    if (!cache_directory_.empty()) {
+        std::ifstream file{cache_directory_ + "/" + kPipelineCacheFilename,
+                           std::ios::binary | std::ios::ate};
+        if (file) {
+            initial_data.resize(static_cast<usize>(file.tellg()));
+            file.seekg(0);
+            file.read(initial_data.data(), initial_data.size());
+        }
+    }
+    if (!initial_data.empty()) {
+        const auto& properties = device_->properties();
+        bool valid = false;
+        if (initial_data.size() >= 16 + VK_UUID_SIZE) {
+            u32 header[4];
+            std::memcpy(header, initial_data.data(), sizeof(header));
+            valid = header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+                    header[2] == properties.vendorID && header[3] == properties.deviceID &&
+                    std::memcmp(initial_data.data() + 16, properties.pipelineCacheUUID,
+                                VK_UUID_SIZE) == 0;
+        }
+        if (!valid) {
+            logger_.warn("Ignoring pipeline cache created by a different device or driver.");
+            initial_data.clear();
+        }
+    }
+
+    vk::PipelineCacheCreateInfo create_info;
+    create_info.initialDataSize = initial_data.size();
+    create_info.pInitialData = initial_data.data();
+    pipeline_cache_ = vk_device_.createPipelineCache(create_info);
+}
+
+void RenderContextVK::savePipelineCache() {
+    if (cache_directory_.empty()) {
+        return;
+    }
+    auto data = vk_device_.getPipelineCacheData(pipeline_cache_);
+    std::ofstream file{cache_directory_ + "/" + kPipelineCacheFilename,
+                       std::ios::binary | std::ios::trunc};
+    if (!file) {
+        logger_.warn("Unable to write pipeline cache to {}.", cache_directory_);
+        return;
+    }
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
 }
 
 void RenderContextVK::createSyncObjects() {
-    image_available_semaphores_.reserve(kMaxFramesInFlight);
-    render_finished_semaphores_.reserve(kMaxFramesInFlight);
-    in_flight_fences_.reserve(kMaxFramesInFlight);
-    for (int i = 0; i < kMaxFramesInFlight; ++i) {
+    image_available_semaphores_.reserve(max_frames_in_flight_);
+    render_finished_semaphores_.reserve(max_frames_in_flight_);
+    in_flight_fences_.reserve(max_frames_in_flight_);
+    for (uint i = 0; i < max_frames_in_flight_; ++i) {
         image_available_semaphores_.push_back(
             vk_device_.createSemaphore(vk::SemaphoreCreateInfo{}));
         render_finished_semaphores_.push_back(
@@ -1825,35 +3738,65 @@ void RenderContextVK::createSyncObjects() {
     images_in_flight_.resize(swap_chain_images_.size());
 }
 
+void RenderContextVK::createOcclusionQueryPool() {
+    vk::QueryPoolCreateInfo pool_info;
+    pool_info.queryType = vk::QueryType::eOcclusion;
+    pool_info.queryCount = kMaxOcclusionQueries * per_image_resource_count_;
+    occlusion_query_pool_ = vk_device_.createQueryPool(pool_info);
+    occlusion_query_frames_.resize(per_image_resource_count_);
+    if (conditional_rendering_supported_) {
+        for (auto& query_frame : occlusion_query_frames_) {
+            device_->createBuffer(kMaxOcclusionQueries * sizeof(u32),
+                                  vk::BufferUsageFlagBits::eConditionalRenderingEXT |
+                                      vk::BufferUsageFlagBits::eTransferDst,
+                                  vk::MemoryPropertyFlagBits::eHostVisible |
+                                      vk::MemoryPropertyFlagBits::eHostCoherent,
+                                  query_frame.predicate_buffer, query_frame.predicate_memory);
+        }
+    }
+}
+
+void RenderContextVK::createTimestampQueryPool() {
+    if (!gpu_timing_supported_) {
+        return;
+    }
+    vk::QueryPoolCreateInfo pool_info;
+    pool_info.queryType = vk::QueryType::eTimestamp;
+    pool_info.queryCount = kMaxGpuTimestampQueries * per_image_resource_count_;
+    timestamp_query_pool_ = vk_device_.createQueryPool(pool_info);
+    gpu_timing_frames_.resize(per_image_resource_count_);
+}
+
 PipelineVK RenderContextVK::findOrCreateGraphicsPipeline(PipelineVK::Info info) {
+    std::lock_guard<std::mutex> lock{pipeline_cache_mutex_};
     auto cached_pipeline = graphics_pipeline_cache_.find(info);
     if (cached_pipeline != graphics_pipeline_cache_.end()) {
+        stats_.pipeline_cache.hits++;
         return cached_pipeline->second;
     }
+    stats_.pipeline_cache.misses++;
 
     // Cache miss. Create a new graphics pipeline.
+    DW_TRACE_SCOPE("RenderContextVK::createGraphicsPipeline");
     PipelineVK graphics_pipeline;
 
     // Create fixed function pipeline stages.
     vk::PipelineVertexInputStateCreateInfo vertex_input_info;
-    vertex_input_info.vertexBindingDescriptionCount = 1;
+    vertex_input_info.vertexBindingDescriptionCount =
+        static_cast<u32>(info.decl->binding_descriptions.size());
     vertex_input_info.vertexAttributeDescriptionCount =
         static_cast<u32>(info.decl->attribute_descriptions.size());
-    vertex_input_info.pVertexBindingDescriptions = &info.decl->binding_description;
+    vertex_input_info.pVertexBindingDescriptions = info.decl->binding_descriptions.data();
     vertex_input_info.pVertexAttributeDescriptions = info.decl->attribute_descriptions.data();
 
     vk::PipelineInputAssemblyStateCreateInfo input_assembly;
     input_assembly.topology = vk::PrimitiveTopology::eTriangleList;
     input_assembly.primitiveRestartEnable = VK_FALSE;
 
-    vk::Viewport viewport;
+    // The viewport and scissor are dynamic, so pipelines which target the backbuffer stay valid
+    // when the swapchain is recreated with a different extent.
     vk::Extent2D viewport_extent = info.framebuffer ? info.framebuffer->extent : swap_chain_extent_;
-    viewport.width = static_cast<float>(viewport_extent.width);
-    viewport.height = -static_cast<float>(viewport_extent.height);
-    viewport.x = 0.0f;
-    viewport.y = static_cast<float>(viewport_extent.height);
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
+    vk::Viewport viewport = targetViewport(viewport_extent);
 
     vk::Rect2D scissor;
     scissor.offset = vk::Offset2D{0, 0};
@@ -1870,9 +3813,9 @@ PipelineVK RenderContextVK::findOrCreateGraphicsPipeline(PipelineVK::Info info)
     rasterizer.rasterizerDiscardEnable = VK_FALSE;
     rasterizer.polygonMode = vk::PolygonMode::eFill;
     rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = info.render_item->cull_face_enabled ? vk::CullModeFlagBits::eNone
+    rasterizer.cullMode = info.pipeline_state.cull_face_enabled ? vk::CullModeFlagBits::eNone
                                                               : vk::CullModeFlagBits::eNone;
-    rasterizer.frontFace = info.render_item->cull_front_face == CullFrontFace::CW
+    rasterizer.frontFace = info.pipeline_state.cull_front_face == CullFrontFace::CW
                                ? vk::FrontFace::eClockwise
                                : vk::FrontFace::eCounterClockwise;
     rasterizer.depthBiasEnable = VK_FALSE;
@@ -1892,24 +3835,24 @@ PipelineVK RenderContextVK::findOrCreateGraphicsPipeline(PipelineVK::Info info)
     usize colour_attachment_count = info.framebuffer ? info.framebuffer->images.size() : 1;
     for (usize i = 0; i < colour_attachment_count; ++i) {
         vk::PipelineColorBlendAttachmentState colour_blend_attachment;
-        if (info.render_item->colour_write) {
+        if (info.pipeline_state.colour_write) {
             colour_blend_attachment.colorWriteMask =
                 vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
                 vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
         }
-        colour_blend_attachment.blendEnable = info.render_item->blend_enabled;
+        colour_blend_attachment.blendEnable = info.pipeline_state.blend_enabled;
         colour_blend_attachment.srcColorBlendFactor =
-            kBlendFuncMap.at(info.render_item->blend_src_rgb);
+            kBlendFuncMap.at(info.pipeline_state.blend_src_rgb);
         colour_blend_attachment.dstColorBlendFactor =
-            kBlendFuncMap.at(info.render_item->blend_dest_rgb);
+            kBlendFuncMap.at(info.pipeline_state.blend_dest_rgb);
         colour_blend_attachment.colorBlendOp =
-            kBlendEquationMap.at(info.render_item->blend_equation_rgb);
+            kBlendEquationMap.at(info.pipeline_state.blend_equation_rgb);
         colour_blend_attachment.srcAlphaBlendFactor =
-            kBlendFuncMap.at(info.render_item->blend_src_a);
+            kBlendFuncMap.at(info.pipeline_state.blend_src_a);
         colour_blend_attachment.dstAlphaBlendFactor =
-            kBlendFuncMap.at(info.render_item->blend_dest_a);
+            kBlendFuncMap.at(info.pipeline_state.blend_dest_a);
         colour_blend_attachment.alphaBlendOp =
-            kBlendEquationMap.at(info.render_item->blend_equation_a);
+            kBlendEquationMap.at(info.pipeline_state.blend_equation_a);
         colour_blend_attachments.push_back(colour_blend_attachment);
     }
 
@@ -1923,22 +3866,27 @@ PipelineVK RenderContextVK::findOrCreateGraphicsPipeline(PipelineVK::Info info)
     colour_blending.blendConstants[2] = 0.0f;
     colour_blending.blendConstants[3] = 0.0f;
 
-    vk::DynamicState dynamic_states[] = {vk::DynamicState::eScissor};
+    vk::DynamicState dynamic_states[] = {vk::DynamicState::eViewport,
+                                         vk::DynamicState::eScissor};
     vk::PipelineDynamicStateCreateInfo dynamic_state;
     dynamic_state.dynamicStateCount = sizeof(dynamic_states) / sizeof(dynamic_states[0]);
     dynamic_state.pDynamicStates = dynamic_states;
 
+    std::array<vk::DescriptorSetLayout, 2> set_layouts = {info.program->descriptor_set_layout,
+                                                          bindless_descriptor_set_layout_};
     vk::PipelineLayoutCreateInfo pipeline_layout_info;
-    pipeline_layout_info.setLayoutCount = 1;
-    pipeline_layout_info.pSetLayouts = &info.program->descriptor_set_layout;
-    pipeline_layout_info.pushConstantRangeCount = 0;
-    pipeline_layout_info.pPushConstantRanges = nullptr;
+    pipeline_layout_info.setLayoutCount = info.program->uses_bindless_textures ? 2 : 1;
+    pipeline_layout_info.pSetLayouts = set_layouts.data();
+    vk::PushConstantRange push_constant_range{info.program->push_constant_stages, 0,
+                                              info.program->push_constant_size};
+    pipeline_layout_info.pushConstantRangeCount = push_constant_range.size > 0 ? 1 : 0;
+    pipeline_layout_info.pPushConstantRanges = &push_constant_range;
     graphics_pipeline.layout = vk_device_.createPipelineLayout(pipeline_layout_info);
 
     // Depth / Stencil.
     vk::PipelineDepthStencilStateCreateInfo depth_stencil;
-    depth_stencil.depthTestEnable = info.render_item->depth_enabled ? VK_TRUE : VK_FALSE;
-    depth_stencil.depthWriteEnable = info.render_item->depth_write ? VK_TRUE : VK_FALSE;
+    depth_stencil.depthTestEnable = info.pipeline_state.depth_enabled ? VK_TRUE : VK_FALSE;
+    depth_stencil.depthWriteEnable = info.pipeline_state.depth_write ? VK_TRUE : VK_FALSE;
     depth_stencil.depthCompareOp = vk::CompareOp::eLess;
     depth_stencil.depthBoundsTestEnable = VK_FALSE;
     depth_stencil.minDepthBounds = 0.0f;
@@ -1965,29 +3913,95 @@ PipelineVK RenderContextVK::findOrCreateGraphicsPipeline(PipelineVK::Info info)
     pipeline_info.subpass = 0;
 
     graphics_pipeline.pipeline =
-        vk_device_.createGraphicsPipelines(vk::PipelineCache{}, pipeline_info)[0];
+        vk_device_.createGraphicsPipelines(pipeline_cache_, pipeline_info)[0];
 
     graphics_pipeline_cache_.emplace(info, graphics_pipeline);
     return graphics_pipeline;
 }
 
+PipelineVK RenderContextVK::findOrCreateComputePipeline(const ProgramVK* program) {
+    std::lock_guard<std::mutex> lock{pipeline_cache_mutex_};
+    auto cached_pipeline = compute_pipeline_cache_.find(program);
+    if (cached_pipeline != compute_pipeline_cache_.end()) {
+        stats_.pipeline_cache.hits++;
+        return cached_pipeline->second;
+    }
+    stats_.pipeline_cache.misses++;
+
+    // Cache miss. Create a new compute pipeline.
+    DW_TRACE_SCOPE("RenderContextVK::createComputePipeline");
+    PipelineVK compute_pipeline;
+
+    std::array<vk::DescriptorSetLayout, 2> set_layouts = {program->descriptor_set_layout,
+                                                          bindless_descriptor_set_layout_};
+    vk::PipelineLayoutCreateInfo pipeline_layout_info;
+    pipeline_layout_info.setLayoutCount = program->uses_bindless_textures ? 2 : 1;
+    pipeline_layout_info.pSetLayouts = set_layouts.data();
+    vk::PushConstantRange push_constant_range{program->push_constant_stages, 0,
+                                              program->push_constant_size};
+    pipeline_layout_info.pushConstantRangeCount = push_constant_range.size > 0 ? 1 : 0;
+    pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+    compute_pipeline.layout = vk_device_.createPipelineLayout(pipeline_layout_info);
+
+    vk::ComputePipelineCreateInfo pipeline_info;
+    for (const auto& stage : program->pipeline_stages) {
+        if (stage.stage == vk::ShaderStageFlagBits::eCompute) {
+            pipeline_info.stage = stage;
+        }
+    }
+    pipeline_info.layout = compute_pipeline.layout;
+    compute_pipeline.pipeline =
+        vk_device_.createComputePipelines(pipeline_cache_, pipeline_info)[0];
+
+    compute_pipeline_cache_.emplace(program, compute_pipeline);
+    return compute_pipeline;
+}
+
 DescriptorSetVK RenderContextVK::findOrCreateDescriptorSet(DescriptorSetVK::Info info) {
+    std::lock_guard<std::mutex> lock{descriptor_set_cache_mutex_};
     auto cached_descriptor_set = descriptor_set_cache_.find(info);
     if (cached_descriptor_set != descriptor_set_cache_.end()) {
-        return cached_descriptor_set->second;
+        stats_.descriptor_set_cache.hits++;
+        auto& cached = cached_descriptor_set->second;
+        if (cached.last_used_frame != frame_counter_) {
+            cached.last_used_frame = frame_counter_;
+            descriptor_set_lru_.splice(descriptor_set_lru_.begin(), descriptor_set_lru_,
+                                       cached.lru_position);
+        }
+        return cached.descriptor_set;
     }
+    stats_.descriptor_set_cache.misses++;
 
-    // Cache miss. Create a new descriptor set.
-    std::vector<vk::DescriptorSetLayout> layouts(swap_chain_images_.size(),
+    // Cache miss. Create a new descriptor set, starting with the pool that was used last. If every
+    // pool is full, chain a new one.
+    DW_TRACE_SCOPE("RenderContextVK::createDescriptorSet");
+    std::vector<vk::DescriptorSetLayout> layouts(per_image_resource_count_,
                                                  info.program->descriptor_set_layout);
     vk::DescriptorSetAllocateInfo alloc_info;
-    alloc_info.descriptorPool = descriptor_pool_;
     alloc_info.descriptorSetCount = layouts.size();
     alloc_info.pSetLayouts = layouts.data();
-    std::vector<vk::DescriptorSet> descriptor_sets = vk_device_.allocateDescriptorSets(alloc_info);
+    std::vector<vk::DescriptorSet> descriptor_sets;
+    const usize pool_count = descriptor_pools_.size();
+    for (usize attempt = 0; attempt < pool_count && descriptor_sets.empty(); ++attempt) {
+        alloc_info.descriptorPool = descriptor_pools_[descriptor_pool_index_];
+        try {
+            descriptor_sets = vk_device_.allocateDescriptorSets(alloc_info);
+        } catch (const vk::OutOfPoolMemoryError&) {
+            descriptor_pool_index_ = (descriptor_pool_index_ + 1) % pool_count;
+        } catch (const vk::FragmentedPoolError&) {
+            descriptor_pool_index_ = (descriptor_pool_index_ + 1) % pool_count;
+        }
+    }
+    if (descriptor_sets.empty()) {
+        createDescriptorPool();
+        descriptor_pool_index_ = descriptor_pools_.size() - 1;
+        alloc_info.descriptorPool = descriptor_pools_[descriptor_pool_index_];
+        descriptor_sets = vk_device_.allocateDescriptorSets(alloc_info);
+        logger_.debug("Chained descriptor pool {}.", descriptor_pools_.size());
+    }
 
     // Write to them.
-    for (usize i = 0; i < swap_chain_images_.size(); ++i) {
+    for (usize i = 0; i < per_image_resource_count_; ++i) {
         std::vector<vk::WriteDescriptorSet> descriptor_writes;
         std::vector<std::unique_ptr<vk::DescriptorBufferInfo>> buffer_info_storage;
         std::vector<std::unique_ptr<vk::DescriptorImageInfo>> image_info_storage;
@@ -2014,8 +4028,19 @@ DescriptorSetVK RenderContextVK::findOrCreateDescriptorSet(DescriptorSetVK::Info
                         });
                     assert(uniform_buffer_it != info.program->uniform_buffers.end());
 
-                    buffer_info.buffer = uniform_scratch_buffers_[i]->getBuffer();
-                    buffer_info.offset = 0;
+                    auto buffer_binding_it = std::find_if(
+                        info.uniform_buffers.begin(), info.uniform_buffers.end(),
+                        [binding = binding.binding](const RenderItem::UniformBufferBinding& b) {
+                            return b.binding_location == binding;
+                        });
+                    if (buffer_binding_it != info.uniform_buffers.end()) {
+                        const auto& buffer = uniform_buffer_map_.at(buffer_binding_it->handle);
+                        buffer_info.buffer = buffer.get();
+                        buffer_info.offset = buffer.getOffset(static_cast<u32>(i));
+                    } else {
+                        buffer_info.buffer = uniform_scratch_buffers_[i]->getBuffer();
+                        buffer_info.offset = 0;
+                    }
                     buffer_info.range = uniform_buffer_it->size;
                     descriptor_write.pBufferInfo = &buffer_info;
                 } break;
@@ -2045,6 +4070,58 @@ DescriptorSetVK RenderContextVK::findOrCreateDescriptorSet(DescriptorSetVK::Info
                     image_info.sampler = findOrCreateSampler(texture_info.sampler_info);
                     descriptor_write.pImageInfo = &image_info;
                 } break;
+                case vk::DescriptorType::eStorageBuffer: {
+                    auto buffer_binding_it = std::find_if(
+                        info.storage_buffers.begin(), info.storage_buffers.end(),
+                        [binding = binding.binding](const RenderItem::StorageBufferBinding& b) {
+                            return b.binding_location == binding;
+                        });
+                    if (buffer_binding_it == info.storage_buffers.end()) {
+                        logger_.error("Binding location {} requires a storage buffer to be bound.",
+                                      binding.binding);
+                        continue;
+                    }
+                    const BufferVK& buffer = std::visit(
+                        [this](auto handle) -> const BufferVK& {
+                            if constexpr (std::is_same_v<decltype(handle), StorageBufferHandle>) {
+                                return storage_buffer_map_.at(handle);
+                            } else {
+                                return indirect_buffer_map_.at(handle);
+                            }
+                        },
+                        buffer_binding_it->handle);
+
+                    buffer_info_storage.emplace_back(std::make_unique<vk::DescriptorBufferInfo>());
+                    auto& buffer_info = *buffer_info_storage.back();
+                    buffer_info.buffer = buffer.get();
+                    buffer_info.offset = buffer.getOffset(static_cast<u32>(i));
+                    buffer_info.range = buffer.size;
+                    descriptor_write.pBufferInfo = &buffer_info;
+                } break;
+                case vk::DescriptorType::eStorageImage: {
+                    auto image_binding_it = std::find_if(
+                        info.storage_images.begin(), info.storage_images.end(),
+                        [binding = binding.binding](const RenderItem::StorageImageBinding& b) {
+                            return b.binding_location == binding;
+                        });
+                    if (image_binding_it == info.storage_images.end()) {
+                        logger_.error("Binding location {} requires a storage image to be bound.",
+                                      binding.binding);
+                        continue;
+                    }
+                    const auto& texture = texture_map_.at(image_binding_it->handle);
+                    if (image_binding_it->mip_level >= texture.storage_image_views.size()) {
+                        logger_.error("Texture {} has no storage image view for mip level {}.",
+                                      image_binding_it->handle, image_binding_it->mip_level);
+                        continue;
+                    }
+
+                    image_info_storage.emplace_back(std::make_unique<vk::DescriptorImageInfo>());
+                    auto& image_info = *image_info_storage.back();
+                    image_info.imageLayout = vk::ImageLayout::eGeneral;
+                    image_info.imageView = texture.storage_image_views[image_binding_it->mip_level];
+                    descriptor_write.pImageInfo = &image_info;
+                } break;
                 default:
                     logger_.error("Unhandled descriptor type {}",
                                   vk::to_string(binding.descriptorType));
@@ -2055,16 +4132,23 @@ DescriptorSetVK RenderContextVK::findOrCreateDescriptorSet(DescriptorSetVK::Info
         vk_device_.updateDescriptorSets(descriptor_writes, {});
     }
 
-    DescriptorSetVK descriptor_set{std::move(descriptor_sets)};
-    descriptor_set_cache_.emplace(info, descriptor_set);
+    DescriptorSetVK descriptor_set{alloc_info.descriptorPool, std::move(descriptor_sets)};
+    auto inserted_it =
+        descriptor_set_cache_
+            .emplace(std::move(info), CachedDescriptorSet{descriptor_set, frame_counter_, {}})
+            .first;
+    descriptor_set_lru_.push_front(&inserted_it->first);
+    inserted_it->second.lru_position = descriptor_set_lru_.begin();
     return descriptor_set;
 }
 
 vk::Sampler RenderContextVK::findOrCreateSampler(RenderItem::SamplerInfo info) {
     auto cached_sampler = sampler_cache_.find(info);
     if (cached_sampler != sampler_cache_.end()) {
+        stats_.sampler_cache.hits++;
         return cached_sampler->second;
     }
+    stats_.sampler_cache.misses++;
 
     // Cache miss. Create a new sampler.
 
@@ -2107,56 +4191,157 @@ vk::Sampler RenderContextVK::findOrCreateSampler(RenderItem::SamplerInfo info) {
     samplerInfo.mipmapMode = mipmap_mode.at(mip_filter);
     samplerInfo.mipLodBias = 0.0f;
     samplerInfo.minLod = 0.0f;
-    samplerInfo.maxLod = 0.0f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
 
     vk::Sampler sampler = vk_device_.createSampler(samplerInfo);
     sampler_cache_.emplace(info, sampler);
     return sampler;
 }
 
+const VertexDeclVK* RenderContextVK::findOrCreateVertexDecl(const VertexDeclVK::Info& info) {
+    std::lock_guard<std::mutex> lock{vertex_decl_cache_mutex_};
+    auto decl_it = vertex_decl_cache_.find(info);
+    if (decl_it == vertex_decl_cache_.end()) {
+        stats_.vertex_decl_cache.misses++;
+        decl_it =
+            vertex_decl_cache_.emplace(info, VertexDeclVK{info, device_->getPhysicalDevice()})
+                .first;
+        if (decl_it->second.unsupported_format != vk::Format::eUndefined) {
+            logger_.error("Vertex attribute format {} is not supported by this device, skipping "
+                          "items which use it.",
+                          vk::to_string(decl_it->second.unsupported_format));
+        }
+    } else {
+        stats_.vertex_decl_cache.hits++;
+    }
+    return &decl_it->second;
+}
+
+int RenderContextVK::findUniformIndex(ProgramVK& program, UniformHandle uniform) {
+    u32 handle_index = static_cast<u32>(uniform);
+    if (handle_index >= program.uniform_handle_indices.size()) {
+        program.uniform_handle_indices.resize(handle_index + 1, ProgramVK::kUnresolved);
+    }
+    int& uniform_index = program.uniform_handle_indices[handle_index];
+    if (uniform_index != ProgramVK::kUnresolved) {
+        return uniform_index;
+    }
+
+    const std::string& uniform_name = uniform_names_.at(handle_index);
+    auto it = program.uniform_indices.find(uniform_name);
+    if (it == program.uniform_indices.end()) {
+        logger_.warn("Unknown uniform '{}', skipping.", uniform_name);
+        uniform_index = ProgramVK::kUnknown;
+    } else {
+        uniform_index = static_cast<int>(it->second);
+    }
+    return uniform_index;
+}
+
 void RenderContextVK::cleanup() {
     vk_device_.waitIdle();
 
+    // Stop worker threads, then destroy any async programs which were still in flight.
+    program_worker_pool_.reset();
+    pending_programs_.clear();
+    finishAsyncPrograms();
+    worker_pool_.reset();
+    for (const auto& pools : secondary_command_pools_) {
+        for (const auto& pool : pools) {
+            vk_device_.destroy(pool.pool);
+        }
+    }
+    secondary_command_pools_.clear();
+
     // Clear cached objects.
     for (const auto& entry : sampler_cache_) {
         vk_device_.destroy(entry.second);
     }
     sampler_cache_.clear();
+    for (auto& entry : descriptor_set_cache_) {
+        entry.second.descriptor_set.destroy(vk_device_);
+    }
     descriptor_set_cache_.clear();
+    descriptor_set_lru_.clear();
     for (const auto& entry : graphics_pipeline_cache_) {
         vk_device_.destroy(entry.second.layout);
         vk_device_.destroy(entry.second.pipeline);
     }
     graphics_pipeline_cache_.clear();
+    for (const auto& entry : compute_pipeline_cache_) {
+        vk_device_.destroy(entry.second.layout);
+        vk_device_.destroy(entry.second.pipeline);
+    }
+    compute_pipeline_cache_.clear();
     vertex_decl_cache_.clear();
+    savePipelineCache();
+    vk_device_.destroy(pipeline_cache_);
 
     // Free resources.
-    for (const auto& entry : framebuffer_map_) {
-        vk_device_.destroy(entry.second.render_pass);
-        vk_device_.destroy(entry.second.framebuffer);
-        vk_device_.destroy(entry.second.depth.image_view);
-        vk_device_.destroy(entry.second.depth.image);
-        vk_device_.free(entry.second.depth.image_memory);
+    destroyRetiredResources(true);
+    for (auto& entry : framebuffer_map_) {
+        destroyFramebuffer(entry.second);
     }
     framebuffer_map_.clear();
-    for (const auto& entry : texture_map_) {
-        vk_device_.destroy(entry.second.image_view);
-        vk_device_.destroy(entry.second.image);
-        vk_device_.free(entry.second.image_memory);
+    for (auto& entry : texture_map_) {
+        destroyTexture(entry.second);
     }
     texture_map_.clear();
-    for (const auto& entry : program_map_) {
-        vk_device_.destroy(entry.second.descriptor_set_layout);
-        for (const auto& stage : entry.second.stages) {
-            vk_device_.destroy(stage.second.module);
-        }
+    for (auto& entry : program_map_) {
+        destroyProgram(entry.second);
     }
     program_map_.clear();
+    pending_dynamic_buffers_.clear();
     index_buffer_map_.clear();
+    indirect_buffer_map_.clear();
+    storage_buffer_map_.clear();
+    uniform_buffer_map_.clear();
     vertex_buffer_map_.clear();
 
     uniform_scratch_buffers_.clear();
-    vk_device_.destroy(descriptor_pool_);
+    if (bindless_descriptor_pool_) {
+        vk_device_.destroy(bindless_descriptor_pool_);
+        vk_device_.destroy(bindless_descriptor_set_layout_);
+        bindless_descriptor_pool_ = vk::DescriptorPool{};
+        bindless_descriptor_set_layout_ = vk::DescriptorSetLayout{};
+    }
+    bindless_descriptor_sets_.clear();
+    bindless_pending_writes_.clear();
+    bindless_slots_.clear();
+    if (bindless_fallback_texture_.image) {
+        destroyTexture(bindless_fallback_texture_);
+        bindless_fallback_texture_ = TextureVK{};
+    }
+    for (auto& staging : texture_staging_buffers_) {
+        if (staging.buffer) {
+            device_->destroyBuffer(staging.buffer, staging.memory);
+        }
+    }
+    texture_staging_buffers_.clear();
+    pending_texture_updates_.clear();
+    for (auto pool : descriptor_pools_) {
+        vk_device_.destroy(pool);
+    }
+    descriptor_pools_.clear();
+    if (timestamp_query_pool_) {
+        vk_device_.destroy(timestamp_query_pool_);
+        timestamp_query_pool_ = vk::QueryPool{};
+    }
+    gpu_timing_frames_.clear();
+    for (auto& query_frame : occlusion_query_frames_) {
+        if (query_frame.predicate_buffer) {
+            device_->destroyBuffer(query_frame.predicate_buffer, query_frame.predicate_memory);
+        }
+    }
+    occlusion_query_frames_.clear();
+    if (occlusion_query_pool_) {
+        vk_device_.destroy(occlusion_query_pool_);
+        occlusion_query_pool_ = vk::QueryPool{};
+    }
+    occlusion_query_map_.clear();
+    free_occlusion_query_slots_.clear();
+    occlusion_query_slot_count_ = 0;
+    previous_occlusion_query_frame_.reset();
 
     // Destroy swapchain.
     for (const auto& fence : in_flight_fences_) {
@@ -2174,23 +4359,19 @@ void RenderContextVK::cleanup() {
     image_available_semaphores_.clear();
 
     vk_device_.destroy(swapchain_render_pass_);
-    for (const auto& framebuffer : swap_chain_framebuffers_) {
-        vk_device_.destroy(framebuffer);
-    }
-    swap_chain_framebuffers_.clear();
-
-    vk_device_.destroy(depth_image_view_);
-    vk_device_.destroy(depth_image_);
-    vk_device_.free(depth_image_memory_);
-
-    for (const auto& image_view : swap_chain_image_views_) {
-        vk_device_.destroy(image_view);
+    for (auto& variant : swapchain_render_pass_variants_) {
+        vk_device_.destroy(variant.second);
     }
-    swap_chain_image_views_.clear();
-    swap_chain_images_.clear();
+    destroySwapChainImages();
     vk_device_.destroy(swap_chain_);
 
     // Destroy device and instance.
+    upload_queue_.reset();
+    auto memory_stats = device_->allocator().stats();
+    if (memory_stats.allocation_count > 0) {
+        logger_.warn("Leaked {} device memory allocations ({} bytes).",
+                     memory_stats.allocation_count, memory_stats.used_bytes);
+    }
     device_.reset();
     instance_.destroy(surface_);
     if (debug_messenger_) {
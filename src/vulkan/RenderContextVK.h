@@ -6,6 +6,10 @@
 
 #include "Renderer.h"
 #include "RenderContext.h"
+#include "GpuTimestamps.h"
+#include "WorkerPool.h"
+#include "vulkan/MemoryAllocatorVK.h"
+#include "vulkan/UploadQueueVK.h"
 
 #include <dga/hash_combine.h>
 
@@ -13,16 +17,22 @@
 #include <vulkan/vulkan.hpp>
 #include <GLFW/glfw3.h>
 
+#include <array>
+#include <atomic>
+#include <deque>
+#include <list>
 #include <map>
+#include <mutex>
+#include <unordered_set>
 
 /*
  * TODOs:
  * - Move all the helper classes / structs into separate files.
  * - Refactor TextureVK into a real fully contained class that handles a texture resource properly.
  * Similar for other types like ShaderVK and ProgramVK.
- * - Use a real Vulkan memory allocator rather than directly allocating from the device.
  * - Revisit the way uniforms are handled to avoid all the heap allocating hash maps.
- * - Support recreation of the swapchain (when the window is resized etc).
+ * - Support resizable windows. The swapchain is recreated when the surface changes, but the
+ * frontend assumes that the backbuffer size is fixed.
  * - Refactor GLFW into a separate abstraction (that can be shared with RenderContextGL).
  */
 
@@ -38,13 +48,15 @@ public:
     vk::PhysicalDevice getPhysicalDevice() const;
     vk::Device getDevice() const;
     vk::CommandPool getCommandPool() const;
+    MemoryAllocatorVK& allocator();
 
     u32 findMemoryType(u32 type_filter, vk::MemoryPropertyFlags properties);
 
-    // Returns the allocation size of the buffe rmemory.
+    // Returns the allocation size of the buffer memory.
     vk::DeviceSize createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage,
                                 vk::MemoryPropertyFlags properties, vk::Buffer& buffer,
-                                vk::DeviceMemory& buffer_memory);
+                                MemoryAllocationVK& buffer_memory);
+    void destroyBuffer(vk::Buffer buffer, MemoryAllocationVK& buffer_memory);
     void copyBuffer(vk::Buffer src_buffer, vk::Buffer dst_buffer, vk::DeviceSize size);
     void copyBufferToImage(vk::Buffer buffer, vk::Image image, u32 width, u32 height);
     void transitionImageLayout(vk::Image image, vk::Format format, vk::ImageLayout old_layout,
@@ -52,9 +64,13 @@ public:
 
     void createImage(u32 width, u32 height, vk::Format format, vk::ImageTiling tiling,
                      vk::ImageUsageFlags usage, vk::MemoryPropertyFlags properties,
-                     vk::Image& image, vk::DeviceMemory& image_memory);
+                     vk::Image& image, MemoryAllocationVK& image_memory, u32 mip_levels = 1,
+                     u32 array_layers = 1);
+    void destroyImage(vk::Image image, MemoryAllocationVK& image_memory);
     vk::ImageView createImageView(vk::Image image, vk::Format format,
-                                  vk::ImageAspectFlags aspect_flags);
+                                  vk::ImageAspectFlags aspect_flags, u32 mip_levels = 1,
+                                  vk::ImageViewType view_type = vk::ImageViewType::e2D,
+                                  u32 array_layers = 1);
 
     vk::CommandBuffer beginSingleUseCommands();
     void endSingleUseCommands(vk::CommandBuffer command_buffer);
@@ -66,6 +82,7 @@ private:
     vk::Device device_;
     vk::CommandPool command_pool_;
     vk::Queue graphics_queue_;
+    std::unique_ptr<MemoryAllocatorVK> allocator_;
 
     vk::PhysicalDeviceProperties properties_;
 };
@@ -86,22 +103,57 @@ struct BufferVK {
     BufferVK& operator=(BufferVK&& other) noexcept;
     BufferVK& operator=(const BufferVK&) = delete;
 
-    vk::Buffer get(u32 frame_index) const;
+    // Stream and dynamic buffers contain one copy of their data per swap chain image, so the
+    // buffer must be bound at the offset of the current frame's copy.
+    vk::Buffer get() const;
+    vk::DeviceSize getOffset(u32 frame_index) const;
 
     bool update(u32 frame_index, const byte* data, vk::DeviceSize data_size, vk::DeviceSize offset);
 
+    // Copies pending updates into the copy used by this frame (dynamic buffers only). Returns
+    // true if other copies still have pending updates.
+    bool flush(u32 frame_index);
+
+    // Size of the device memory allocated for every copy of the buffer.
+    vk::DeviceSize allocatedSize() const;
+
 private:
+    static constexpr vk::DeviceSize kCopyAlignment = 256;
+
     u32 getIndex(u32 frame_index) const;
 
-    std::vector<vk::Buffer> buffer;
-    std::vector<vk::DeviceMemory> buffer_memory;
+    vk::Buffer buffer_;
+    MemoryAllocationVK buffer_memory_;
+    usize copy_count_;
+    vk::DeviceSize copy_stride_;
+
+    // Dynamic buffers only.
+    struct DirtyRange {
+        vk::DeviceSize begin = 0;
+        vk::DeviceSize end = 0;
+    };
+    std::vector<byte> shadow_data_;
+    std::vector<DirtyRange> dirty_ranges_;
 };
 
 struct VertexDeclVK {
-    vk::VertexInputBindingDescription binding_description;
+    std::vector<vk::VertexInputBindingDescription> binding_descriptions;
     std::vector<vk::VertexInputAttributeDescription> attribute_descriptions;
+    // The first attribute format which the device can't read from vertex buffers, or undefined
+    // if they all can. Items which use an unsupported decl are skipped.
+    vk::Format unsupported_format = vk::Format::eUndefined;
+
+    // Per-vertex data is in binding 0, and per-instance data (if any) is in binding 1.
+    struct Info {
+        VertexDecl decl;
+        VertexDecl instance_decl;
+
+        bool operator==(const Info& other) const {
+            return decl == other.decl && instance_decl == other.instance_decl;
+        }
+    };
 
-    VertexDeclVK(const VertexDecl& decl);
+    VertexDeclVK(const Info& info, vk::PhysicalDevice physical_device);
 
     static vk::Format getVertexAttributeFormat(VertexDecl::AttributeType type, usize count,
                                                bool normalised);
@@ -145,16 +197,28 @@ struct ProgramVK {
     std::vector<vk::PipelineShaderStageCreateInfo> pipeline_stages;
     std::vector<vk::DescriptorSetLayoutBinding> layout_bindings;
     vk::DescriptorSetLayout descriptor_set_layout;
+    // Identifies the layout bindings and uniform buffer sizes of the program. Programs with the
+    // same shape have compatible descriptor set layouts, so can share descriptor sets.
+    u32 descriptor_set_shape = 0;
 
     // Uniforms.
     struct Uniform {
+        std::string name;
         // Empty optional indicates a push_constant buffer.
         std::optional<usize> binding_location;
         usize offset = 0;
         usize size = 0;
         std::optional<UniformData> data;
     };
-    std::unordered_map<std::string, Uniform> uniform_locations;
+    std::vector<Uniform> uniforms;
+    std::unordered_map<std::string, usize> uniform_indices;
+
+    // Index into 'uniforms' for each uniform handle, resolved during rendering. kUnresolved marks
+    // handles which have not been looked up yet, and kUnknown marks handles which do not exist in
+    // this program.
+    static constexpr int kUnresolved = -2;
+    static constexpr int kUnknown = -1;
+    std::vector<int> uniform_handle_indices;
 
     // Uniform buffers.
     struct UniformBuffer {
@@ -162,6 +226,14 @@ struct ProgramVK {
         usize size = 0;
     };
     std::vector<UniformBuffer> uniform_buffers;
+
+    // Push constants. The push constant blocks of every stage share a single range starting at
+    // offset 0, which is written for each draw or dispatch.
+    u32 push_constant_size = 0;
+    vk::ShaderStageFlags push_constant_stages;
+
+    // True if the program samples from the bindless texture table, which is bound as set 1.
+    bool uses_bindless_textures = false;
 };
 
 class UniformScratchBuffer {
@@ -187,39 +259,57 @@ public:
 private:
     DeviceVK* device_;
     vk::Buffer buffer_;
-    vk::DeviceMemory buffer_memory_;
+    MemoryAllocationVK buffer_memory_;
     byte* data_;
     usize current_size_;
     usize maximum_size_;
 };
 
 struct TextureVK {
+    TextureFormat format = TextureFormat::RGBA8;
     vk::Image image;
-    vk::DeviceMemory image_memory;
+    MemoryAllocationVK image_memory;
     vk::ImageView image_view;
     vk::Format image_format;
     vk::ImageLayout image_layout;
     vk::ImageAspectFlags aspect_mask;
+    u32 mip_levels = 1;
+    // Single level views used to bind each mip level of storage textures as a storage image.
+    std::vector<vk::ImageView> storage_image_views;
 
     void setImageBarrier(vk::CommandBuffer command_buffer, vk::ImageLayout new_layout);
+    // Fills in a barrier which transitions this image to a new layout, so that several can be
+    // recorded at once. Returns false if the image is already in that layout.
+    bool makeImageBarrier(vk::ImageLayout new_layout, vk::ImageMemoryBarrier& barrier);
 };
 
 struct DescriptorSetVK {
-    // One descriptor set per swap chain image.
+    // One descriptor set per swap chain image, allocated from 'pool'.
+    vk::DescriptorPool pool;
     std::vector<vk::DescriptorSet> descriptor_sets;
 
-    void destroy(vk::Device device, vk::DescriptorPool pool) {
+    void destroy(vk::Device device) {
         device.freeDescriptorSets(pool, descriptor_sets);
     }
 
     struct Info {
-        // TODO: Instead pass specific <binding index / binding type> pairs, so we can reuse
-        // descriptor sets for multiple programs of the same "shape".
+        // Descriptor sets are keyed by the program's shape rather than by the program, so they're
+        // shared by all programs of the same shape. The program is only used to create the
+        // descriptor set, and isn't valid afterwards.
+        u32 shape;
         const ProgramVK* program;
         std::vector<RenderItem::TextureBinding> textures;
+        std::vector<RenderItem::StorageBufferBinding> storage_buffers;
+        std::vector<RenderItem::StorageImageBinding> storage_images;
+        // Uniform blocks which are sourced from a uniform buffer instead of the uniform scratch
+        // buffer. The offset is applied as a dynamic offset, so is always 0 here.
+        std::vector<RenderItem::UniformBufferBinding> uniform_buffers;
 
         bool operator==(const Info& other) const {
-            return program == other.program && textures == other.textures;
+            return shape == other.shape && textures == other.textures &&
+                   storage_buffers == other.storage_buffers &&
+                   storage_images == other.storage_images &&
+                   uniform_buffers == other.uniform_buffers;
         }
     };
 };
@@ -230,6 +320,9 @@ struct FramebufferVK {
     vk::Framebuffer framebuffer;
     std::vector<TextureVK*> images;
     vk::Extent2D extent;
+    // Render passes with other load and store ops than render_pass, keyed by their ops. These are
+    // compatible with render_pass, so they use the same framebuffer and pipelines.
+    std::unordered_map<u32, vk::RenderPass> render_pass_variants;
 
     FramebufferVK(DeviceVK* device, u16 width, u16 height, std::vector<TextureVK*> attachments);
 };
@@ -238,28 +331,16 @@ struct PipelineVK {
     vk::PipelineLayout layout;
     vk::Pipeline pipeline;
 
+    // Pipelines are keyed by value, so render items with the same state share a pipeline.
     struct Info {
-        // TODO: Replace RenderItem ptr with a copy of the render state used by the pipeline, which
-        // we can hash separately.
-        const RenderItem* render_item;
-        const VertexBufferVK* vb;
+        PipelineState pipeline_state;
         const VertexDeclVK* decl;
         const ProgramVK* program;
         const FramebufferVK* framebuffer;
 
         bool operator==(const Info& other) const {
-            return render_item->colour_write == other.render_item->colour_write &&
-                   render_item->blend_enabled == other.render_item->blend_enabled &&
-                   render_item->blend_src_rgb == other.render_item->blend_src_rgb &&
-                   render_item->blend_dest_rgb == other.render_item->blend_dest_rgb &&
-                   render_item->blend_equation_rgb == other.render_item->blend_equation_rgb &&
-                   render_item->blend_src_a == other.render_item->blend_src_a &&
-                   render_item->blend_dest_a == other.render_item->blend_dest_a &&
-                   render_item->blend_equation_a == other.render_item->blend_equation_a &&
-                   render_item->cull_face_enabled == other.render_item->cull_face_enabled &&
-                   render_item->cull_front_face == other.render_item->cull_front_face &&
-                   vb == other.vb && decl == other.decl && program == other.program &&
-                   framebuffer == other.framebuffer;
+            return pipeline_state == other.pipeline_state && decl == other.decl &&
+                   program == other.program && framebuffer == other.framebuffer;
         }
     };
 };
@@ -269,14 +350,31 @@ struct PipelineVK {
 namespace std {
 template <> struct hash<dw::gfx::PipelineVK::Info> {
     std::size_t operator()(const dw::gfx::PipelineVK::Info& i) const {
+        // Pack the pipeline state into a single integer, to avoid hashing each field separately.
+        const auto& ps = i.pipeline_state;
+        dw::gfx::u64 state = static_cast<dw::gfx::u64>(ps.depth_enabled) |
+                             static_cast<dw::gfx::u64>(ps.cull_face_enabled) << 1 |
+                             static_cast<dw::gfx::u64>(ps.blend_enabled) << 2 |
+                             static_cast<dw::gfx::u64>(ps.colour_write) << 3 |
+                             static_cast<dw::gfx::u64>(ps.depth_write) << 4 |
+                             static_cast<dw::gfx::u64>(ps.cull_front_face) << 5 |
+                             static_cast<dw::gfx::u64>(ps.polygon_mode) << 6 |
+                             static_cast<dw::gfx::u64>(ps.blend_equation_rgb) << 8 |
+                             static_cast<dw::gfx::u64>(ps.blend_equation_a) << 12 |
+                             static_cast<dw::gfx::u64>(ps.blend_src_rgb) << 16 |
+                             static_cast<dw::gfx::u64>(ps.blend_dest_rgb) << 24 |
+                             static_cast<dw::gfx::u64>(ps.blend_src_a) << 32 |
+                             static_cast<dw::gfx::u64>(ps.blend_dest_a) << 40;
         std::size_t hash = 0;
-        dga::hashCombine(hash, i.render_item->colour_write, i.render_item->blend_enabled,
-                         i.render_item->blend_src_rgb, i.render_item->blend_dest_rgb,
-                         i.render_item->blend_equation_rgb, i.render_item->blend_src_a,
-                         i.render_item->blend_dest_a, i.render_item->blend_equation_a,
-                         i.render_item->depth_enabled, i.render_item->depth_write,
-                         i.render_item->cull_face_enabled, i.render_item->cull_front_face);
-        dga::hashCombine(hash, i.vb, i.decl, i.program, i.framebuffer);
+        dga::hashCombine(hash, state, i.decl, i.program, i.framebuffer);
+        return hash;
+    }
+};
+
+template <> struct hash<dw::gfx::VertexDeclVK::Info> {
+    std::size_t operator()(const dw::gfx::VertexDeclVK::Info& i) const {
+        std::size_t hash = 0;
+        dga::hashCombine(hash, i.decl, i.instance_decl);
         return hash;
     }
 };
@@ -284,10 +382,19 @@ template <> struct hash<dw::gfx::PipelineVK::Info> {
 template <> struct hash<dw::gfx::DescriptorSetVK::Info> {
     std::size_t operator()(const dw::gfx::DescriptorSetVK::Info& i) const {
         std::size_t hash = 0;
-        dga::hashCombine(hash, i.program);
+        dga::hashCombine(hash, i.shape);
         for (const auto& texture : i.textures) {
             dga::hashCombine(hash, texture.handle, texture.sampler_info);
         }
+        for (const auto& buffer : i.storage_buffers) {
+            dga::hashCombine(hash, buffer.binding_location, buffer.handle);
+        }
+        for (const auto& image : i.storage_images) {
+            dga::hashCombine(hash, image.binding_location, image.handle, image.mip_level);
+        }
+        for (const auto& buffer : i.uniform_buffers) {
+            dga::hashCombine(hash, buffer.binding_location, buffer.handle);
+        }
         return hash;
     }
 };
@@ -307,6 +414,10 @@ public:
     // Capabilities / customisations.
     Mat4 adjustProjectionMatrix(Mat4 projection_matrix) const override;
     bool hasFlippedViewport() const override;
+    bool isTextureFormatSupported(TextureFormat format) const override;
+    bool isComputeSupported() const override;
+    bool isBindlessTexturingSupported() const override;
+    bool isConditionalRenderingSupported() const override;
 
     // Window management. Executed on the main thread.
     Result<void, std::string> createWindow(u16 width, u16 height, const std::string& title,
@@ -332,12 +443,26 @@ public:
     void operator()(const cmd::CreateIndexBuffer& c);
     void operator()(const cmd::UpdateIndexBuffer& c);
     void operator()(const cmd::DeleteIndexBuffer& c);
+    void operator()(const cmd::CreateIndirectBuffer& c);
+    void operator()(const cmd::UpdateIndirectBuffer& c);
+    void operator()(const cmd::DeleteIndirectBuffer& c);
+    void operator()(const cmd::CreateStorageBuffer& c);
+    void operator()(const cmd::UpdateStorageBuffer& c);
+    void operator()(const cmd::DeleteStorageBuffer& c);
+    void operator()(const cmd::CreateUniformBuffer& c);
+    void operator()(const cmd::UpdateUniformBuffer& c);
+    void operator()(const cmd::DeleteUniformBuffer& c);
     void operator()(const cmd::CreateProgram& c);
     void operator()(const cmd::DeleteProgram& c);
+    void operator()(const cmd::CreateUniform& c);
     void operator()(const cmd::CreateTexture2D& c);
+    void operator()(const cmd::UpdateTexture2D& c);
     void operator()(const cmd::DeleteTexture& c);
     void operator()(const cmd::CreateFrameBuffer& c);
     void operator()(const cmd::DeleteFrameBuffer& c);
+    void operator()(const cmd::CreateOcclusionQuery& c);
+    void operator()(const cmd::DeleteOcclusionQuery& c);
+    void operator()(const cmd::PrewarmPipeline& c);
     template <typename T> void operator()(const T& c) {
         static_assert(!std::is_same<T, T>::value, "Unimplemented RenderCommand");
     }
@@ -356,26 +481,114 @@ private:
     vk::Queue present_queue_;
     u32 graphics_queue_family_index_;
     u32 present_queue_family_index_;
+    std::optional<u32> transfer_queue_family_index_;
+    vk::Queue transfer_queue_;
+
+    // Batches texture uploads, and submits them once per frame.
+    std::unique_ptr<UploadQueueVK> upload_queue_;
+
+    // Texture formats which can be sampled, indexed by TextureFormat.
+    std::array<bool, usize(TextureFormat::Count)> texture_format_supported_;
+
+    // True if the device can issue more than one draw per indirect draw command. Otherwise, each
+    // draw in an indirect buffer is recorded separately.
+    bool multi_draw_indirect_supported_;
+
+    // True if the graphics queue can also run compute dispatches.
+    bool compute_supported_;
+
+    // True if VK_EXT_debug_utils is enabled, which labels render queues in graphics debuggers.
+    bool debug_labels_supported_;
+
+    // True if VK_EXT_memory_budget is enabled, which reports the budget and usage of each heap.
+    bool memory_budget_supported_;
+
+    // GPU timestamp queries. Each swap chain image has its own range of kMaxGpuTimestampQueries
+    // queries in the pool, which is read back the next time that image is rendered to (if the
+    // results are available by then).
+    static constexpr u32 kMaxGpuTimestampQueries = 1024;
+    struct GpuTimingFrame {
+        GpuTimestampLayout layout;
+        bool pending = false;
+    };
+    bool gpu_timing_supported_;
+    double timestamp_period_;  // Nanoseconds per timestamp tick.
+    vk::QueryPool timestamp_query_pool_;
+    std::vector<GpuTimingFrame> gpu_timing_frames_;
+
+    // Occlusion queries. Each query is assigned a slot, and each swap chain image has its own
+    // range of kMaxOcclusionQueries queries in the pool, which is read back the next time that
+    // image is rendered to. With VK_EXT_conditional_rendering, the results of the previous frame
+    // are also copied into a predicate buffer owned by the current frame, which draw conditions
+    // are evaluated with. Without it, draw conditions use the last result read back.
+    static constexpr u32 kMaxOcclusionQueries = 4096;
+    struct OcclusionQueryVK {
+        u32 slot;
+        std::optional<u64> last_result;
+    };
+    struct OcclusionQueryFrame {
+        // Queries written by the frame, as (query, slot) pairs in slot order.
+        std::vector<std::pair<OcclusionQueryHandle, u32>> written;
+        // Number of slots which were reset at the start of the frame.
+        u32 reset_count = 0;
+        // One 32-bit predicate per slot. Only used with conditional rendering.
+        vk::Buffer predicate_buffer;
+        MemoryAllocationVK predicate_memory;
+    };
+    bool conditional_rendering_supported_;
+    bool occlusion_query_precise_;
+    vk::QueryPool occlusion_query_pool_;
+    std::vector<OcclusionQueryFrame> occlusion_query_frames_;
+    HandleMap<OcclusionQueryHandle, OcclusionQueryVK> occlusion_query_map_;
+    std::vector<u32> free_occlusion_query_slots_;
+    u32 occlusion_query_slot_count_;
+    // The swap chain image which the previous frame was rendered to.
+    std::optional<u32> previous_occlusion_query_frame_;
 
     // Swapchain
     // =========
 
+    // The swapchain is recreated at the start of a frame if it's out of date, or if the present
+    // mode has changed. The framebuffer size is updated by GLFW on the main thread.
     vk::SwapchainKHR swap_chain_;
+    PresentMode requested_present_mode_;
+    std::atomic<bool> swap_chain_out_of_date_;
+    std::atomic<u32> framebuffer_width_;
+    std::atomic<u32> framebuffer_height_;
+    bool swap_chain_image_acquired_;
     vk::Format swap_chain_image_format_;
     vk::Extent2D swap_chain_extent_;
     std::vector<vk::Image> swap_chain_images_;
     std::vector<vk::ImageView> swap_chain_image_views_;
+    // Number of swapchain images that per image resources (command buffers, dynamic buffer copies,
+    // query pools and so on) are created for. Set by the first swapchain, so a recreated swapchain
+    // can't have more images than this.
+    u32 per_image_resource_count_;
 
     vk::Format depth_format_;
     vk::Image depth_image_;
-    vk::DeviceMemory depth_image_memory_;
+    MemoryAllocationVK depth_image_memory_;
     vk::ImageView depth_image_view_;
+    // Layout of the depth image after the last render pass, so that loading it can be skipped
+    // before it's first written.
+    vk::ImageLayout depth_image_layout_;
 
     std::vector<vk::Framebuffer> swap_chain_framebuffers_;
     vk::RenderPass swapchain_render_pass_;
+    std::unordered_map<u32, vk::RenderPass> swapchain_render_pass_variants_;
 
     std::vector<vk::CommandBuffer> command_buffers_;
 
+    // Secondary command buffers, recorded in parallel on the worker pool.
+    struct SecondaryCommandPoolVK {
+        vk::CommandPool pool;
+        std::vector<vk::CommandBuffer> command_buffers;
+        usize used = 0;
+    };
+    std::unique_ptr<WorkerPool> worker_pool_;
+    // Indexed by swap chain image, then by recording thread.
+    std::vector<std::vector<SecondaryCommandPoolVK>> secondary_command_pools_;
+
     // Concurrency primitives for frame tracking.
     std::vector<vk::Semaphore> image_available_semaphores_;
     std::vector<vk::Semaphore> render_finished_semaphores_;
@@ -387,43 +600,209 @@ private:
     // Resources
     // =========
 
-    vk::DescriptorPool descriptor_pool_;
+    // Descriptor pools. Another pool is chained when every pool is full.
+    std::vector<vk::DescriptorPool> descriptor_pools_;
+    // The pool which the last descriptor set was allocated from.
+    usize descriptor_pool_index_;
 
     // Per frame uniform scratch buffers (one per swapchain image).
     std::vector<std::unique_ptr<UniformScratchBuffer>> uniform_scratch_buffers_;
 
+    // Texture updates which are copied into their textures at the start of the next frame, from a
+    // staging buffer owned by that frame (one per swapchain image). Staging buffers grow to fit
+    // the largest set of updates made in a frame.
+    struct TextureStagingBufferVK {
+        vk::Buffer buffer;
+        MemoryAllocationVK memory;
+        vk::DeviceSize size = 0;
+    };
+    std::vector<cmd::UpdateTexture2D> pending_texture_updates_;
+    std::vector<TextureStagingBufferVK> texture_staging_buffers_;
+
+    // The bindless texture table, an array of DW_MAX_BINDLESS_TEXTURES partially bound combined
+    // image samplers (VK_EXT_descriptor_indexing). Each swap chain image has its own copy of the
+    // table, which is only written at the start of a frame which uses it, so that it's never
+    // written while a frame in flight may read it. Slots are indexed by texture handle index,
+    // and writes are queued for each copy by slot. The slot of a deleted texture is overwritten
+    // with a 1x1 fallback texture, so the table never refers to a destroyed image view.
+    bool bindless_texturing_supported_;
+    vk::DescriptorSetLayout bindless_descriptor_set_layout_;
+    vk::DescriptorPool bindless_descriptor_pool_;
+    std::vector<vk::DescriptorSet> bindless_descriptor_sets_;
+    std::vector<std::unordered_set<u32>> bindless_pending_writes_;
+    // The texture in each slot, or an invalid handle if the slot is empty.
+    std::vector<TextureHandle> bindless_slots_;
+    TextureVK bindless_fallback_texture_;
+
+    // Dynamic uniform buffer offsets of the render queue being recorded. Offsets for item i are in
+    // the range [item_dynamic_offsets_start_[i], item_dynamic_offsets_start_[i + 1]).
+    std::vector<u32> item_dynamic_offsets_;
+    std::vector<usize> item_dynamic_offsets_start_;
+    // Push constant data of the render queue being recorded, laid out the same way.
+    std::vector<byte> item_push_constants_;
+    std::vector<usize> item_push_constants_start_;
+
     // Resource maps.
-    std::unordered_map<VertexBufferHandle, VertexBufferVK> vertex_buffer_map_;
-    std::unordered_map<IndexBufferHandle, IndexBufferVK> index_buffer_map_;
-    std::unordered_map<ProgramHandle, ProgramVK> program_map_;
-    std::unordered_map<TextureHandle, TextureVK> texture_map_;
-    std::unordered_map<FrameBufferHandle, FramebufferVK> framebuffer_map_;
-
-    // Cached objects.
-    // TODO: Implement some form of cache eviction.
-    std::unordered_map<VertexDecl, VertexDeclVK> vertex_decl_cache_;
+    HandleMap<VertexBufferHandle, VertexBufferVK> vertex_buffer_map_;
+    HandleMap<IndexBufferHandle, IndexBufferVK> index_buffer_map_;
+    HandleMap<IndirectBufferHandle, BufferVK> indirect_buffer_map_;
+    HandleMap<StorageBufferHandle, BufferVK> storage_buffer_map_;
+    HandleMap<UniformBufferHandle, BufferVK> uniform_buffer_map_;
+    // Dynamic buffers which have updates that are not yet applied to all copies.
+    std::unordered_set<BufferVK*> pending_dynamic_buffers_;
+    HandleMap<ProgramHandle, ProgramVK> program_map_;
+    // Async programs are created on a separate worker pool, as they can take longer than a frame.
+    std::unique_ptr<WorkerPool> program_worker_pool_;
+    std::unordered_set<ProgramHandle> pending_programs_;
+    std::vector<std::pair<ProgramHandle, ProgramVK>> created_programs_;
+    std::mutex created_programs_mutex_;
+    HandleMap<TextureHandle, TextureVK> texture_map_;
+    HandleMap<FrameBufferHandle, FramebufferVK> framebuffer_map_;
+
+    // Deleted resources, which are destroyed once every frame which may still use them has
+    // finished. 'frame' is the value of frame_counter_ when they were deleted. Oldest first.
+    struct RetiredResourcesVK {
+        u64 frame;
+        std::vector<TextureVK> textures;
+        std::vector<FramebufferVK> framebuffers;
+        std::vector<PipelineVK> pipelines;
+        // Destroyed by their destructors.
+        std::vector<BufferVK> buffers;
+    };
+    std::deque<RetiredResourcesVK> retired_resources_;
+
+    // Uniform names indexed by uniform handle.
+    std::vector<std::string> uniform_names_;
+
+    // Cached objects. These are accessed from the worker pool, so are guarded by mutexes. The
+    // sampler cache is only accessed while creating descriptor sets.
+    // TODO: Implement some form of cache eviction for pipelines and vertex decls.
+    std::unordered_map<VertexDeclVK::Info, VertexDeclVK> vertex_decl_cache_;
     std::unordered_map<PipelineVK::Info, PipelineVK> graphics_pipeline_cache_;
-    std::unordered_map<DescriptorSetVK::Info, DescriptorSetVK> descriptor_set_cache_;
+    std::unordered_map<const ProgramVK*, PipelineVK> compute_pipeline_cache_;
     std::unordered_map<RenderItem::SamplerInfo, vk::Sampler> sampler_cache_;
+    std::mutex vertex_decl_cache_mutex_;
+    std::mutex pipeline_cache_mutex_;
+
+    // Descriptor sets, kept in least recently used order. Descriptor sets which are unused for
+    // kDescriptorSetMaxUnusedFrames frames are freed, by which time no frame in flight uses them.
+    static constexpr u64 kDescriptorSetMaxUnusedFrames = 240;
+    struct CachedDescriptorSet {
+        DescriptorSetVK descriptor_set;
+        u64 last_used_frame;
+        std::list<const DescriptorSetVK::Info*>::iterator lru_position;
+    };
+    std::unordered_map<DescriptorSetVK::Info, CachedDescriptorSet> descriptor_set_cache_;
+    // Most recently used at the front.
+    std::list<const DescriptorSetVK::Info*> descriptor_set_lru_;
+    u64 frame_counter_;
+    std::mutex descriptor_set_cache_mutex_;
+
+    // Descriptor set shapes, interned by createProgram. See ProgramVK::descriptor_set_shape.
+    std::map<std::vector<u32>, u32> descriptor_set_shapes_;
+    std::mutex descriptor_set_shapes_mutex_;
+
+    // Driver pipeline cache, persisted to the cache directory between runs.
+    vk::PipelineCache pipeline_cache_;
 
     // Helper functions
     // ================
 
     bool checkValidationLayerSupport();
-    std::vector<const char*> getRequiredExtensions(bool enable_validation_layers);
+    std::vector<const char*> getRequiredExtensions(bool enable_debug_utils);
 
     void createInstance(bool enable_validation_layers);
     void createDevice();
-    void createSwapChain();
+    // Requests 'image_count' images if it's non-zero and the surface supports it, otherwise one
+    // more than the surface's minimum.
+    void createSwapChain(vk::SwapchainKHR old_swap_chain = vk::SwapchainKHR{},
+                         u32 image_count = 0);
+    bool recreateSwapChain();
+    void destroySwapChainImages();
     void createRenderPass();
+    // Returns a render pass of a frame buffer (or the backbuffer if null) with a set of load and
+    // store ops.
+    vk::RenderPass findOrCreateRenderPass(FramebufferVK* frame_buffer,
+                                          const RenderQueue::AttachmentOps& ops);
     void createFramebuffers();
     void createCommandBuffers();
+    void createSecondaryCommandPools();
     void createDescriptorPool();
+    void evictDescriptorSets();
+    // Returns the resources retired while preparing the current frame.
+    RetiredResourcesVK& retiredResources();
+    void destroyRetiredResources(bool all = false);
+    // Reports the budget and usage of the device local heaps, if VK_EXT_memory_budget is enabled.
+    void queryMemoryBudget();
+    void destroyTexture(TextureVK& texture);
+    void destroyFramebuffer(FramebufferVK& framebuffer);
+    // Retires the cached pipelines which were created for a program or frame buffer that's being
+    // deleted, as a new program or frame buffer may reuse its address.
+    void retirePipelines(const ProgramVK* program, const FramebufferVK* framebuffer);
     void createSyncObjects();
-
+    void createTimestampQueryPool();
+    void createOcclusionQueryPool();
+    void createPipelineCache();
+    void savePipelineCache();
+
+    void uploadTransientBuffer(BufferVK& buffer, vk::BufferUsageFlags buffer_type,
+                               const Frame::TransientBufferStorage& storage);
+    void createBindlessTextureTable();
+    // Writes the pending bindless texture table writes of the current frame.
+    void writeBindlessTextures();
+    // Returns the current frame's bindless texture table, or a null handle if unsupported.
+    vk::DescriptorSet bindlessDescriptorSet() const;
+    // Copies the pending texture updates into their textures.
+    void recordTextureUpdates(vk::CommandBuffer command_buffer);
+    void prepareUniforms(const FrameVector<RenderItem>& items);
+    // Returns the uniform buffer range that a render item binds to a uniform block, or nullptr if
+    // the block is sourced from the uniform scratch buffer.
+    const RenderItem::UniformBufferBinding* findUniformBufferBinding(
+        const ProgramVK::UniformBuffer& ubo, const RenderItem& item) const;
+    // Returns the uniform buffers of a render item's descriptor set.
+    std::vector<RenderItem::UniformBufferBinding> descriptorUniformBuffers(
+        const ProgramVK& program, const RenderItem& item) const;
+    void recordRenderItems(vk::CommandBuffer command_buffer, const RenderQueue& queue, usize begin,
+                           usize end, const FramebufferVK* framebuffer,
+                           const GpuTimestampLayout::QueueTimestamps& timestamps,
+                           FrameStats& stats);
+    // Reads back the timestamps of the last frame rendered to the current swap chain image if they
+    // are available, then resets its queries and writes the first timestamp of this frame. Must be
+    // recorded outside of a render pass.
+    void beginGpuTiming(vk::CommandBuffer command_buffer, const Frame* frame);
+    void endGpuTiming(vk::CommandBuffer command_buffer);
+    u32 timestampQuery(u32 query) const;
+    // Reads back the occlusion queries of the last frame rendered to the current swap chain image,
+    // then resets its queries and fills in the predicates of this frame's draw conditions. Must be
+    // recorded outside of a render pass.
+    void beginOcclusionQueries(vk::CommandBuffer command_buffer, const Frame* frame);
+    u32 occlusionQuery(u32 slot) const;
+    // Returns the occlusion query used by a render item, or nullptr if it's unset or deleted.
+    const OcclusionQueryVK* findOcclusionQuery(std::optional<OcclusionQueryHandle> query) const;
+    // Returns true if recordRenderItems draws an item (and writes its occlusion query).
+    bool isRenderItemDrawn(const RenderItem& item) const;
+    // Records the compute items of a range of render queues, with barriers before and after.
+    void recordComputeItems(vk::CommandBuffer command_buffer,
+                            const std::vector<RenderQueue>& queues, usize begin, usize end);
+    // Transitions the textures sampled by a range of render queues, and the attachments of the
+    // frame buffer they render to, with a single barrier.
+    void transitionQueueImages(vk::CommandBuffer command_buffer,
+                               const std::vector<RenderQueue>& queues, usize begin, usize end,
+                               const FramebufferVK* frame_buffer);
+    vk::CommandBuffer beginSecondaryCommandBuffer(usize thread_index, vk::RenderPass render_pass,
+                                                  vk::Framebuffer framebuffer);
+
+    // Creates a program's shader modules, reflection data and descriptor set layout. Thread safe.
+    ProgramVK createProgram(const std::vector<ShaderStageInfo>& stages);
+    void destroyProgram(ProgramVK& program);
+    void finishAsyncPrograms();
+
+    const VertexDeclVK* findOrCreateVertexDecl(const VertexDeclVK::Info& info);
     PipelineVK findOrCreateGraphicsPipeline(PipelineVK::Info info);
+    PipelineVK findOrCreateComputePipeline(const ProgramVK* program);
     DescriptorSetVK findOrCreateDescriptorSet(DescriptorSetVK::Info info);
     vk::Sampler findOrCreateSampler(RenderItem::SamplerInfo info);
+    int findUniformIndex(ProgramVK& program, UniformHandle uniform);
 
     void cleanup();
 };
@@ -0,0 +1,326 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#include "vulkan/UploadQueueVK.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace dw {
+namespace gfx {
+namespace {
+// Alignment of each upload in the staging ring. This satisfies the texel (or block) size and
+// optimalBufferCopyOffsetAlignment requirements of all formats except 3 component formats.
+constexpr vk::DeviceSize kStagingAlignment = 16;
+
+u64 alignUp(u64 value, u64 alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+}  // namespace
+
+UploadQueueVK::UploadQueueVK(vk::Device device, MemoryAllocatorVK& allocator,
+                             u32 graphics_queue_family, vk::Queue graphics_queue,
+                             std::optional<u32> transfer_queue_family, vk::Queue transfer_queue,
+                             vk::DeviceSize staging_size)
+    : device_(device),
+      allocator_(allocator),
+      graphics_queue_family_(graphics_queue_family),
+      graphics_queue_(graphics_queue),
+      transfer_queue_family_(transfer_queue_family),
+      transfer_queue_(transfer_queue),
+      ring_size_(staging_size),
+      ring_head_(0),
+      ring_tail_(0) {
+    vk::CommandPoolCreateInfo pool_info;
+    pool_info.queueFamilyIndex = transfer_queue_family_.value_or(graphics_queue_family_);
+    pool_info.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer |
+                      vk::CommandPoolCreateFlagBits::eTransient;
+    command_pool_ = device_.createCommandPool(pool_info);
+
+    ring_ = createStaging(ring_size_);
+}
+
+UploadQueueVK::~UploadQueueVK() {
+    auto destroy_batch = [this](Batch& batch) {
+        for (auto& staging : batch.dedicated_staging) {
+            device_.destroy(staging.buffer);
+            allocator_.free(staging.memory);
+        }
+        device_.destroy(batch.fence);
+        if (batch.semaphore) {
+            device_.destroy(batch.semaphore);
+        }
+    };
+    for (auto& batch : in_flight_batches_) {
+        device_.waitForFences(batch.fence, VK_TRUE, UINT64_MAX);
+        destroy_batch(batch);
+    }
+    for (auto& batch : free_batches_) {
+        destroy_batch(batch);
+    }
+    if (current_batch_) {
+        destroy_batch(*current_batch_);
+    }
+    device_.destroy(command_pool_);
+    device_.destroy(ring_.buffer);
+    allocator_.free(ring_.memory);
+}
+
+void UploadQueueVK::uploadImage(vk::Image image, const std::vector<ImageLevel>& levels,
+                                u32 array_layers) {
+    auto level_count = static_cast<u32>(levels.size());
+
+    // Stage all levels in a single allocation. Allocating may need to retire older batches, which
+    // must not release memory used by earlier levels.
+    std::vector<vk::DeviceSize> level_offsets;
+    level_offsets.reserve(levels.size());
+    vk::DeviceSize staging_size = 0;
+    for (const auto& level : levels) {
+        staging_size = alignUp(staging_size, kStagingAlignment);
+        level_offsets.push_back(staging_size);
+        staging_size += level.size;
+    }
+    StagingAllocation staging = allocateStaging(staging_size);
+    for (u32 i = 0; i < level_count; ++i) {
+        std::memcpy(staging.data + level_offsets[i], levels[i].data, levels[i].size);
+    }
+    vk::CommandBuffer command_buffer = currentBatch().command_buffer;
+
+    auto to_transfer_dst = imageBarrier(image, level_count, vk::ImageLayout::eUndefined,
+                                        vk::ImageLayout::eTransferDstOptimal);
+    to_transfer_dst.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+                                   vk::PipelineStageFlagBits::eTransfer, {}, nullptr, nullptr,
+                                   to_transfer_dst);
+
+    for (u32 i = 0; i < level_count; ++i) {
+        vk::BufferImageCopy region;
+        region.bufferOffset = staging.offset + level_offsets[i];
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+        region.imageSubresource.mipLevel = i;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = array_layers;
+        region.imageOffset = vk::Offset3D{0, 0, 0};
+        region.imageExtent = vk::Extent3D{levels[i].width, levels[i].height, 1};
+        command_buffer.copyBufferToImage(staging.buffer, image,
+                                         vk::ImageLayout::eTransferDstOptimal, region);
+    }
+
+    auto to_shader_read = imageBarrier(image, level_count, vk::ImageLayout::eTransferDstOptimal,
+                                       vk::ImageLayout::eShaderReadOnlyOptimal);
+    to_shader_read.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    if (transfer_queue_family_) {
+        // Release ownership to the graphics queue. The matching acquire barrier is recorded by
+        // recordAcquireBarriers().
+        to_shader_read.srcQueueFamilyIndex = *transfer_queue_family_;
+        to_shader_read.dstQueueFamilyIndex = graphics_queue_family_;
+        command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                       vk::PipelineStageFlagBits::eBottomOfPipe, {}, nullptr,
+                                       nullptr, to_shader_read);
+        pending_acquires_.emplace_back(image, level_count);
+    } else {
+        // Uploads are submitted to the graphics queue before the frame which uses them, so a
+        // barrier is enough to make them visible.
+        to_shader_read.dstAccessMask = waitAccess();
+        command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, waitStages(), {},
+                                       nullptr, nullptr, to_shader_read);
+    }
+}
+
+void UploadQueueVK::recordAcquireBarriers(vk::CommandBuffer command_buffer) {
+    if (pending_acquires_.empty()) {
+        return;
+    }
+    std::vector<vk::ImageMemoryBarrier> barriers;
+    barriers.reserve(pending_acquires_.size());
+    for (const auto& acquire : pending_acquires_) {
+        auto barrier = imageBarrier(acquire.first, acquire.second,
+                                    vk::ImageLayout::eTransferDstOptimal,
+                                    vk::ImageLayout::eShaderReadOnlyOptimal);
+        barrier.srcQueueFamilyIndex = *transfer_queue_family_;
+        barrier.dstQueueFamilyIndex = graphics_queue_family_;
+        barrier.dstAccessMask = waitAccess();
+        barriers.push_back(barrier);
+    }
+    // The source stage matches the stage that the upload semaphores are waited on, so that the
+    // acquire happens after the transfer queue has released the images.
+    command_buffer.pipelineBarrier(waitStages(), waitStages(), {}, nullptr, nullptr, barriers);
+    pending_acquires_.clear();
+}
+
+const std::vector<vk::Semaphore>& UploadQueueVK::submit() {
+    submitCurrentBatch();
+    retireCompletedBatches();
+    wait_semaphores_.swap(pending_wait_semaphores_);
+    pending_wait_semaphores_.clear();
+    return wait_semaphores_;
+}
+
+vk::PipelineStageFlags UploadQueueVK::waitStages() {
+    // Uploaded images may be sampled by any shader stage, or copied to and from by transfers
+    // (such as texture updates and mip generation) recorded later in the frame.
+    return vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader |
+           vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer;
+}
+
+vk::AccessFlags UploadQueueVK::waitAccess() {
+    return vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eTransferRead |
+           vk::AccessFlagBits::eTransferWrite;
+}
+
+bool UploadQueueVK::hasDedicatedQueue() const {
+    return transfer_queue_family_.has_value();
+}
+
+UploadQueueVK::Batch& UploadQueueVK::currentBatch() {
+    if (current_batch_) {
+        return *current_batch_;
+    }
+
+    // Reuse a completed batch, unless its semaphore is yet to be waited on by the graphics queue
+    // (in which case it can't be signalled again).
+    auto reusable = std::find_if(free_batches_.begin(), free_batches_.end(), [this](Batch& b) {
+        return !b.semaphore ||
+               std::find(pending_wait_semaphores_.begin(), pending_wait_semaphores_.end(),
+                         b.semaphore) == pending_wait_semaphores_.end();
+    });
+    if (reusable != free_batches_.end()) {
+        current_batch_ = std::move(*reusable);
+        free_batches_.erase(reusable);
+    } else {
+        Batch batch;
+        vk::CommandBufferAllocateInfo alloc_info;
+        alloc_info.level = vk::CommandBufferLevel::ePrimary;
+        alloc_info.commandPool = command_pool_;
+        alloc_info.commandBufferCount = 1;
+        batch.command_buffer = device_.allocateCommandBuffers(alloc_info)[0];
+        batch.fence = device_.createFence(vk::FenceCreateInfo{});
+        if (transfer_queue_family_) {
+            batch.semaphore = device_.createSemaphore(vk::SemaphoreCreateInfo{});
+        }
+        current_batch_ = std::move(batch);
+    }
+    current_batch_->ring_head = ring_head_;
+
+    vk::CommandBufferBeginInfo begin_info;
+    begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    current_batch_->command_buffer.begin(begin_info);
+    return *current_batch_;
+}
+
+void UploadQueueVK::submitCurrentBatch() {
+    if (!current_batch_) {
+        return;
+    }
+    Batch batch = std::move(*current_batch_);
+    current_batch_.reset();
+    batch.command_buffer.end();
+
+    vk::SubmitInfo submit_info;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &batch.command_buffer;
+    if (transfer_queue_family_) {
+        submit_info.signalSemaphoreCount = 1;
+        submit_info.pSignalSemaphores = &batch.semaphore;
+        pending_wait_semaphores_.push_back(batch.semaphore);
+        transfer_queue_.submit(submit_info, batch.fence);
+    } else {
+        graphics_queue_.submit(submit_info, batch.fence);
+    }
+    in_flight_batches_.push_back(std::move(batch));
+}
+
+void UploadQueueVK::retireOldestBatch() {
+    Batch& batch = in_flight_batches_.front();
+    device_.waitForFences(batch.fence, VK_TRUE, UINT64_MAX);
+    device_.resetFences(batch.fence);
+    for (auto& staging : batch.dedicated_staging) {
+        device_.destroy(staging.buffer);
+        allocator_.free(staging.memory);
+    }
+    batch.dedicated_staging.clear();
+    ring_tail_ = std::max(ring_tail_, batch.ring_head);
+    free_batches_.push_back(std::move(batch));
+    in_flight_batches_.pop_front();
+}
+
+void UploadQueueVK::retireCompletedBatches() {
+    while (!in_flight_batches_.empty() &&
+           device_.getFenceStatus(in_flight_batches_.front().fence) == vk::Result::eSuccess) {
+        retireOldestBatch();
+    }
+}
+
+UploadQueueVK::StagingAllocation UploadQueueVK::allocateStaging(vk::DeviceSize size) {
+    // Uploads which don't fit in the ring get their own staging buffer.
+    if (size > ring_size_) {
+        Staging staging = createStaging(size);
+        currentBatch().dedicated_staging.push_back(staging);
+        return {staging.buffer, 0, staging.memory.mapped_data};
+    }
+
+    while (true) {
+        // Allocations never straddle the end of the ring.
+        u64 head = alignUp(ring_head_, kStagingAlignment);
+        if (head % ring_size_ + size > ring_size_) {
+            head += ring_size_ - head % ring_size_;
+        }
+        if (head + size - ring_tail_ <= ring_size_) {
+            ring_head_ = head + size;
+            currentBatch().ring_head = ring_head_;
+            vk::DeviceSize offset = head % ring_size_;
+            return {ring_.buffer, offset, ring_.memory.mapped_data + offset};
+        }
+
+        // If nothing is in use, restart from the beginning of the ring.
+        if (ring_tail_ == ring_head_) {
+            ring_head_ = ring_tail_ = alignUp(ring_head_, ring_size_);
+            continue;
+        }
+
+        // Otherwise, wait for the GPU to finish with the oldest uploads. If they haven't been
+        // submitted yet, submit them now.
+        if (in_flight_batches_.empty()) {
+            submitCurrentBatch();
+        }
+        retireOldestBatch();
+    }
+}
+
+UploadQueueVK::Staging UploadQueueVK::createStaging(vk::DeviceSize size) {
+    Staging staging;
+    vk::BufferCreateInfo buffer_info;
+    buffer_info.size = size;
+    buffer_info.usage = vk::BufferUsageFlagBits::eTransferSrc;
+    buffer_info.sharingMode = vk::SharingMode::eExclusive;
+    staging.buffer = device_.createBuffer(buffer_info);
+    staging.memory =
+        allocator_.allocate(device_.getBufferMemoryRequirements(staging.buffer),
+                            vk::MemoryPropertyFlagBits::eHostVisible |
+                                vk::MemoryPropertyFlagBits::eHostCoherent,
+                            MemoryAllocatorVK::ResourceType::Linear);
+    device_.bindBufferMemory(staging.buffer, staging.memory.memory, staging.memory.offset);
+    return staging;
+}
+
+vk::ImageMemoryBarrier UploadQueueVK::imageBarrier(vk::Image image, u32 level_count,
+                                                   vk::ImageLayout old_layout,
+                                                   vk::ImageLayout new_layout) const {
+    vk::ImageMemoryBarrier barrier;
+    barrier.oldLayout = old_layout;
+    barrier.newLayout = new_layout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = level_count;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+    return barrier;
+}
+}  // namespace gfx
+}  // namespace dw
@@ -0,0 +1,128 @@
+/*
+ * Dawn Graphics
+ * Written by David Avedissian (c) 2017-2020 (git@dga.dev)
+ */
+#pragma once
+
+#include "Base.h"
+#include "vulkan/MemoryAllocatorVK.h"
+
+#define VULKAN_HPP_DISPATCH_LOADER_DYNAMIC 1
+#include <vulkan/vulkan.hpp>
+
+#include <deque>
+#include <optional>
+#include <vector>
+
+namespace dw {
+namespace gfx {
+// Uploads data to images through a persistent staging ring buffer. Uploads are recorded into a
+// batch, which is submitted once per frame (on a dedicated transfer queue if the device has one)
+// and synchronised with the frame using a semaphore rather than waiting for the GPU. Staging
+// memory is only reused once the fence of the batch which used it has signalled.
+class UploadQueueVK {
+public:
+    UploadQueueVK(vk::Device device, MemoryAllocatorVK& allocator, u32 graphics_queue_family,
+                  vk::Queue graphics_queue, std::optional<u32> transfer_queue_family,
+                  vk::Queue transfer_queue, vk::DeviceSize staging_size);
+    ~UploadQueueVK();
+
+    UploadQueueVK(const UploadQueueVK&) = delete;
+    UploadQueueVK(UploadQueueVK&&) = delete;
+    UploadQueueVK& operator=(const UploadQueueVK&) = delete;
+    UploadQueueVK& operator=(UploadQueueVK&&) = delete;
+
+    struct ImageLevel {
+        u32 width;
+        u32 height;
+        const byte* data;
+        usize size;
+    };
+
+    // Records a copy of some data into the mip levels of an image in the undefined layout, starting
+    // with the base level. The image is in the shader read only layout once the upload completes.
+    // Each level of an array image contains every layer in turn.
+    void uploadImage(vk::Image image, const std::vector<ImageLevel>& levels,
+                     u32 array_layers = 1);
+
+    // Records barriers which acquire ownership of images uploaded on the transfer queue into a
+    // graphics command buffer. The command buffer must be submitted with the semaphores returned by
+    // submit(), before any of the images are used.
+    void recordAcquireBarriers(vk::CommandBuffer command_buffer);
+
+    // Submits the uploads recorded since the last call. Returns semaphores which the next graphics
+    // submission must wait on at waitStages(). The returned semaphores are only valid until the
+    // next call.
+    const std::vector<vk::Semaphore>& submit();
+
+    // Pipeline stages which wait on the semaphores returned by submit().
+    static vk::PipelineStageFlags waitStages();
+    // Accesses at waitStages() which uploads are made visible to.
+    static vk::AccessFlags waitAccess();
+
+    bool hasDedicatedQueue() const;
+
+private:
+    struct Staging {
+        vk::Buffer buffer;
+        MemoryAllocationVK memory;
+    };
+
+    struct Batch {
+        vk::CommandBuffer command_buffer;
+        vk::Fence fence;
+        // Only used with a dedicated transfer queue.
+        vk::Semaphore semaphore;
+        // Position of the ring head after this batch's last allocation.
+        u64 ring_head = 0;
+        // Staging buffers for uploads which are too large for the ring.
+        std::vector<Staging> dedicated_staging;
+    };
+
+    vk::Device device_;
+    MemoryAllocatorVK& allocator_;
+    u32 graphics_queue_family_;
+    vk::Queue graphics_queue_;
+    std::optional<u32> transfer_queue_family_;
+    vk::Queue transfer_queue_;
+    vk::CommandPool command_pool_;
+
+    // Staging ring. head_ and tail_ count the total number of bytes allocated and released, so the
+    // offset into the ring is head_ % size.
+    Staging ring_;
+    vk::DeviceSize ring_size_;
+    u64 ring_head_;
+    u64 ring_tail_;
+
+    std::optional<Batch> current_batch_;
+    std::deque<Batch> in_flight_batches_;
+    std::vector<Batch> free_batches_;
+
+    // Images (and their level counts) released by the transfer queue which are yet to be acquired
+    // by the graphics queue.
+    std::vector<std::pair<vk::Image, u32>> pending_acquires_;
+    // Semaphores to be waited on by the next graphics submission.
+    std::vector<vk::Semaphore> pending_wait_semaphores_;
+    std::vector<vk::Semaphore> wait_semaphores_;
+
+    Batch& currentBatch();
+    void submitCurrentBatch();
+    // Waits for the oldest in-flight batch, then releases its staging memory.
+    void retireOldestBatch();
+    void retireCompletedBatches();
+    struct StagingAllocation {
+        vk::Buffer buffer;
+        vk::DeviceSize offset;
+        // Host pointer to the start of the allocation.
+        byte* data;
+    };
+
+    // Allocates staging memory for an upload, which is released once the current batch completes.
+    StagingAllocation allocateStaging(vk::DeviceSize size);
+    Staging createStaging(vk::DeviceSize size);
+    vk::ImageMemoryBarrier imageBarrier(vk::Image image, u32 level_count,
+                                        vk::ImageLayout old_layout,
+                                        vk::ImageLayout new_layout) const;
+};
+}  // namespace gfx
+}  // namespace dw